@@ -0,0 +1,804 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define OTRNG_ACCOUNT_STORE_PRIVATE
+#define OTRNG_PERSISTENCE_PRIVATE
+
+#include "account_store.h"
+#include "alloc.h"
+#include "deserialize.h"
+#include "persistence.h"
+#include "serialize.h"
+#include "shake.h"
+#include "str.h"
+
+static const uint8_t account_store_magic[4] = {'O', 'N', 'G', 'S'};
+static const uint8_t account_store_index_magic[4] = {'O', 'N', 'G', 'I'};
+
+tstatic uint32_t account_store_checksum(const uint8_t *data, size_t len) {
+  uint8_t digest[ACCOUNT_STORE_CHECKSUM_BYTES];
+  uint32_t checksum = 0;
+
+  if (!shake_256_hash(digest, sizeof(digest), data, len)) {
+    return 0;
+  }
+
+  (void)otrng_deserialize_uint32(&checksum, digest, sizeof(digest), NULL);
+  return checksum;
+}
+
+INTERNAL otrng_account_store_s *
+otrng_account_store_open_buffer(const uint8_t *data, size_t len) {
+  otrng_account_store_s *store;
+  const uint8_t *trailer;
+  uint16_t version = 0;
+  uint64_t index_offset = 0;
+  uint32_t num_records = 0;
+  uint32_t checksum = 0;
+  size_t index_len;
+
+  if (len < ACCOUNT_STORE_HEADER_BYTES + ACCOUNT_STORE_TRAILER_BYTES) {
+    return NULL;
+  }
+
+  if (memcmp(data, account_store_magic, sizeof(account_store_magic)) != 0) {
+    return NULL;
+  }
+
+  if (!otrng_deserialize_uint16(&version, data + 4, 2, NULL) ||
+      version != OTRNG_ACCOUNT_STORE_VERSION) {
+    return NULL;
+  }
+
+  trailer = data + len - ACCOUNT_STORE_TRAILER_BYTES;
+  if (memcmp(trailer + 16, account_store_index_magic,
+             sizeof(account_store_index_magic)) != 0) {
+    return NULL;
+  }
+
+  if (!otrng_deserialize_uint64(&index_offset, trailer, 8, NULL) ||
+      !otrng_deserialize_uint32(&num_records, trailer + 8, 4, NULL) ||
+      !otrng_deserialize_uint32(&checksum, trailer + 12, 4, NULL)) {
+    return NULL;
+  }
+
+  /* The index has to sit exactly between the records and the trailer */
+  index_len = (size_t)num_records * ACCOUNT_STORE_INDEX_ENTRY_BYTES;
+  if (index_offset < ACCOUNT_STORE_HEADER_BYTES ||
+      index_offset > len - ACCOUNT_STORE_TRAILER_BYTES ||
+      len - ACCOUNT_STORE_TRAILER_BYTES - index_offset != index_len) {
+    return NULL;
+  }
+
+  if (account_store_checksum(data + index_offset, index_len) != checksum) {
+    return NULL;
+  }
+
+  store = otrng_xmalloc_z(sizeof(otrng_account_store_s));
+  store->data = data;
+  store->len = len;
+  store->num_records = num_records;
+  store->index = data + index_offset;
+  store->index_offset = index_offset;
+
+  return store;
+}
+
+API otrng_account_store_s *otrng_account_store_open(const char *filename) {
+  otrng_account_store_s *store;
+  struct stat st;
+  void *mapping;
+  int fd;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return NULL;
+  }
+
+  mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return NULL;
+  }
+
+  store = otrng_account_store_open_buffer(mapping, (size_t)st.st_size);
+  if (!store) {
+    munmap(mapping, (size_t)st.st_size);
+    return NULL;
+  }
+
+  store->mapping = mapping;
+  store->mapping_len = (size_t)st.st_size;
+
+  return store;
+}
+
+API void otrng_account_store_close(otrng_account_store_s *store) {
+  if (!store) {
+    return;
+  }
+
+  if (store->mapping) {
+    munmap(store->mapping, store->mapping_len);
+  }
+
+  otrng_free(store);
+}
+
+/* Reads a DATA field without copying it */
+static otrng_result account_store_read_data(const uint8_t **dst,
+                                            size_t *dst_len,
+                                            const uint8_t *buffer,
+                                            size_t buff_len, size_t *nread) {
+  uint32_t len = 0;
+
+  if (!otrng_deserialize_uint32(&len, buffer, buff_len, NULL)) {
+    return OTRNG_ERROR;
+  }
+
+  if (buff_len - 4 < len) {
+    return OTRNG_ERROR;
+  }
+
+  *dst = buffer + 4;
+  *dst_len = len;
+  *nread = 4 + (size_t)len;
+
+  return OTRNG_SUCCESS;
+}
+
+INTERNAL otrng_result otrng_account_store_get(
+    otrng_store_record_s *record, uint32_t i,
+    const otrng_account_store_s *store) {
+  const uint8_t *entry, *cursor;
+  uint64_t offset = 0;
+  uint32_t checksum = 0;
+  size_t len, nread = 0;
+
+  assert(store != NULL);
+
+  if (i >= store->num_records) {
+    return OTRNG_ERROR;
+  }
+
+  entry = store->index + (size_t)i * ACCOUNT_STORE_INDEX_ENTRY_BYTES;
+  if (!otrng_deserialize_uint64(&offset, entry + 1, 8, NULL)) {
+    return OTRNG_ERROR;
+  }
+
+  if (offset < ACCOUNT_STORE_HEADER_BYTES || offset >= store->index_offset) {
+    return OTRNG_ERROR;
+  }
+
+  cursor = store->data + offset;
+  len = store->index_offset - offset;
+
+  record->type = cursor[0];
+  if (record->type != entry[0]) {
+    return OTRNG_ERROR;
+  }
+  cursor++;
+  len--;
+
+  if (!account_store_read_data(&record->protocol, &record->protocol_len,
+                               cursor, len, &nread)) {
+    return OTRNG_ERROR;
+  }
+  cursor += nread;
+  len -= nread;
+
+  if (!account_store_read_data(&record->account, &record->account_len, cursor,
+                               len, &nread)) {
+    return OTRNG_ERROR;
+  }
+  cursor += nread;
+  len -= nread;
+
+  if (!account_store_read_data(&record->payload, &record->payload_len, cursor,
+                               len, &nread)) {
+    return OTRNG_ERROR;
+  }
+  cursor += nread;
+  len -= nread;
+
+  if (!otrng_deserialize_uint32(&checksum, cursor, len, NULL)) {
+    return OTRNG_ERROR;
+  }
+
+  if (account_store_checksum(store->data + offset,
+                             cursor - (store->data + offset)) != checksum) {
+    return OTRNG_ERROR;
+  }
+
+  return OTRNG_SUCCESS;
+}
+
+/* The prekey messages and fingerprints read for a client, which replace the
+   client's own once the whole store has loaded */
+typedef struct account_store_staged_s {
+  otrng_client_s *client;
+  otrng_tail_list_s prekeys;
+  /*@null@*/ otrng_prekey_index_s *prekey_index;
+  /*@null@*/ otrng_known_fingerprints_s *fingerprints;
+} account_store_staged_s;
+
+static account_store_staged_s *
+account_store_stage(list_element_s **staged, otrng_client_s *client) {
+  account_store_staged_s *stage;
+  list_element_s *current;
+
+  for (current = *staged; current; current = current->next) {
+    stage = current->data;
+    if (stage->client == client) {
+      return stage;
+    }
+  }
+
+  stage = otrng_xmalloc_z(sizeof(account_store_staged_s));
+  stage->client = client;
+  otrng_tail_list_init(&stage->prekeys);
+  if (client->prekey_index) {
+    stage->prekey_index = otrng_prekey_index_new();
+  }
+
+  *staged = otrng_list_add(stage, *staged);
+
+  return stage;
+}
+
+static void account_store_stage_all(list_element_s *node, void *staged) {
+  (void)account_store_stage(staged, node->data);
+}
+
+static void account_store_free_prekey_message(void *msg) {
+  otrng_prekey_message_free(msg);
+}
+
+static void account_store_discard_stage(void *data) {
+  account_store_staged_s *stage = data;
+
+  otrng_tail_list_free(&stage->prekeys, account_store_free_prekey_message);
+  otrng_prekey_index_free(stage->prekey_index);
+  otrng_known_fingerprints_free(stage->fingerprints);
+  otrng_free(stage);
+}
+
+static void account_store_commit_stage(void *data) {
+  account_store_staged_s *stage = data;
+  otrng_client_s *client = stage->client;
+
+  otrng_client_clear_prekey_messages(client);
+  otrng_prekey_index_free(client->prekey_index);
+  client->our_prekeys = stage->prekeys;
+  client->prekey_index = stage->prekey_index;
+
+  otrng_known_fingerprints_free(client->fingerprints);
+  client->fingerprints = stage->fingerprints;
+
+  otrng_free(stage);
+}
+
+static otrng_result
+account_store_load_fingerprint(account_store_staged_s *stage,
+                               const otrng_store_record_s *record) {
+  otrng_known_fingerprint_s *fpr;
+  const uint8_t *username;
+  size_t username_len, nread = 0;
+
+  if (!account_store_read_data(&username, &username_len, record->payload,
+                               record->payload_len, &nread)) {
+    return OTRNG_ERROR;
+  }
+
+  if (record->payload_len - nread != FPRINT_LEN_BYTES + 1) {
+    return OTRNG_ERROR;
+  }
+
+  fpr = otrng_xmalloc_z(sizeof(otrng_known_fingerprint_s));
+  fpr->username = otrng_xstrndup((const char *)username, username_len);
+  memcpy(fpr->fp, record->payload + nread, FPRINT_LEN_BYTES);
+  fpr->trusted = record->payload[nread + FPRINT_LEN_BYTES] ? otrng_true
+                                                             : otrng_false;
+
+  if (!stage->fingerprints) {
+    stage->fingerprints = otrng_xmalloc_z(sizeof(otrng_known_fingerprints_s));
+  }
+  stage->fingerprints->fps = otrng_list_add(fpr, stage->fingerprints->fps);
+
+  return OTRNG_SUCCESS;
+}
+
+static otrng_result account_store_load_record(
+    account_store_staged_s *stage, const otrng_store_record_s *record) {
+  otrng_client_s *client = stage->client;
+
+  switch (record->type) {
+  case OTRNG_STORE_PRIVATE_KEY_V4:
+    return otrng_client_private_key_v4_from_bytes(client, record->payload,
+                                                  record->payload_len);
+  case OTRNG_STORE_FORGING_KEY:
+    return otrng_client_forging_key_from_bytes(client, record->payload,
+                                               record->payload_len);
+  case OTRNG_STORE_CLIENT_PROFILE:
+    return otrng_client_client_profile_from_bytes(client, record->payload,
+                                                  record->payload_len);
+  case OTRNG_STORE_EXPIRED_CLIENT_PROFILE:
+    return otrng_client_expired_client_profile_from_bytes(
+        client, record->payload, record->payload_len);
+  case OTRNG_STORE_PREKEY_PROFILE:
+    return otrng_client_prekey_profile_from_bytes(client, record->payload,
+                                                  record->payload_len);
+  case OTRNG_STORE_EXPIRED_PREKEY_PROFILE:
+    return otrng_client_expired_prekey_profile_from_bytes(
+        client, record->payload, record->payload_len);
+  case OTRNG_STORE_PREKEY_MESSAGE:
+    return otrng_prekey_message_add_from_bytes(
+        &stage->prekeys, stage->prekey_index, record->payload,
+        record->payload_len);
+  case OTRNG_STORE_FINGERPRINT_V4:
+    return account_store_load_fingerprint(stage, record);
+  default:
+    /* Records from a newer version are skipped */
+    return OTRNG_SUCCESS;
+  }
+}
+
+static otrng_bool account_store_same_client(const otrng_client_s *client,
+                                            const otrng_store_record_s *r) {
+  return strlen(client->client_id.protocol) == r->protocol_len &&
+         memcmp(client->client_id.protocol, r->protocol, r->protocol_len) ==
+             0 &&
+         strlen(client->client_id.account) == r->account_len &&
+         memcmp(client->client_id.account, r->account, r->account_len) == 0;
+}
+
+API otrng_result otrng_global_state_account_store_load(
+    otrng_global_state_s *gs, const otrng_account_store_s *store) {
+  otrng_client_s *client = NULL;
+  account_store_staged_s *stage = NULL;
+  list_element_s *staged = NULL;
+  otrng_store_record_s record;
+  otrng_client_id_s client_id;
+  uint32_t i;
+
+  assert(gs != NULL);
+
+  if (!store) {
+    return OTRNG_ERROR;
+  }
+
+  /* Clients that have no records in the store end up with none as well */
+  otrng_list_foreach(gs->clients, account_store_stage_all, &staged);
+
+  for (i = 0; i < store->num_records; i++) {
+    if (!otrng_account_store_get(&record, i, store)) {
+      otrng_list_free(staged, account_store_discard_stage);
+      return OTRNG_ERROR;
+    }
+
+    /* Records are written grouped by client, so this is only looked up when
+       the client changes */
+    if (!client || !account_store_same_client(client, &record)) {
+      client_id.protocol =
+          otrng_xstrndup((const char *)record.protocol, record.protocol_len);
+      client_id.account =
+          otrng_xstrndup((const char *)record.account, record.account_len);
+      client = otrng_client_get(gs, client_id);
+      otrng_free((char *)client_id.protocol);
+      otrng_free((char *)client_id.account);
+
+      if (!client) {
+        otrng_list_free(staged, account_store_discard_stage);
+        return OTRNG_ERROR;
+      }
+      stage = account_store_stage(&staged, client);
+    }
+
+    if (!account_store_load_record(stage, &record)) {
+      otrng_list_free(staged, account_store_discard_stage);
+      return OTRNG_ERROR;
+    }
+  }
+
+  otrng_list_free(staged, account_store_commit_stage);
+
+  return OTRNG_SUCCESS;
+}
+
+typedef struct account_store_writer_s {
+  FILE *f;
+  uint64_t offset;
+  uint8_t *index;
+  size_t index_len;
+  size_t index_cap;
+  uint32_t num_records;
+  otrng_bool failed;
+
+  /* The client whose records are being written */
+  const otrng_client_s *client;
+} account_store_writer_s;
+
+static void account_store_write_record(account_store_writer_s *w,
+                                       uint8_t type,
+                                       const otrng_client_s *client,
+                                       const uint8_t *payload,
+                                       size_t payload_len) {
+  const char *protocol = client->client_id.protocol;
+  const char *account = client->client_id.account;
+  uint8_t *buffer, *cursor;
+  size_t len;
+
+  if (w->failed) {
+    return;
+  }
+
+  len = 1 + 4 + strlen(protocol) + 4 + strlen(account) + 4 + payload_len +
+        ACCOUNT_STORE_CHECKSUM_BYTES;
+
+  /* The payload can hold private keys */
+  buffer = otrng_secure_alloc(len);
+  cursor = buffer;
+  cursor += otrng_serialize_uint8(cursor, type);
+  cursor += otrng_serialize_data(cursor, (const uint8_t *)protocol,
+                                 strlen(protocol));
+  cursor += otrng_serialize_data(cursor, (const uint8_t *)account,
+                                 strlen(account));
+  cursor += otrng_serialize_data(cursor, payload, payload_len);
+  cursor += otrng_serialize_uint32(
+      cursor, account_store_checksum(buffer, cursor - buffer));
+
+  if (fwrite(buffer, 1, len, w->f) != len) {
+    w->failed = otrng_true;
+  }
+  otrng_secure_wipe(buffer, len);
+  otrng_secure_free(buffer);
+
+  if (w->failed) {
+    return;
+  }
+
+  if (w->index_len + ACCOUNT_STORE_INDEX_ENTRY_BYTES > w->index_cap) {
+    w->index_cap = w->index_cap ? w->index_cap * 2
+                                : 64 * ACCOUNT_STORE_INDEX_ENTRY_BYTES;
+    w->index = otrng_xrealloc(w->index, w->index_cap);
+  }
+
+  w->index_len += otrng_serialize_uint8(w->index + w->index_len, type);
+  w->index_len += otrng_serialize_uint64(w->index + w->index_len, w->offset);
+  w->num_records++;
+  w->offset += len;
+}
+
+static void account_store_write_prekey(account_store_writer_s *w,
+                                       const otrng_client_s *client,
+                                       const prekey_message_s *prekey) {
+  uint8_t *buffer = otrng_secure_alloc(PRE_KEY_WITH_METADATA_MAX_BYTES);
+  size_t w_len = 0;
+
+  if (otrng_prekey_message_serialize_with_metadata(
+          buffer, PRE_KEY_WITH_METADATA_MAX_BYTES, &w_len, prekey)) {
+    account_store_write_record(w, OTRNG_STORE_PREKEY_MESSAGE, client, buffer,
+                               w_len);
+  } else {
+    w->failed = otrng_true;
+  }
+
+  otrng_secure_free(buffer);
+}
+
+static otrng_result account_store_write_prekey_record(const uint8_t *record,
+                                                      size_t len,
+                                                      void *context) {
+  account_store_writer_s *w = context;
+
+  account_store_write_record(w, OTRNG_STORE_PREKEY_MESSAGE, w->client, record,
+                             len);
+
+  return w->failed ? OTRNG_ERROR : OTRNG_SUCCESS;
+}
+
+static void account_store_write_fingerprint(account_store_writer_s *w,
+                                            const otrng_client_s *client,
+                                            const otrng_known_fingerprint_s *fp) {
+  size_t username_len = strlen(fp->username);
+  size_t len = 4 + username_len + FPRINT_LEN_BYTES + 1;
+  uint8_t *buffer = otrng_xmalloc(len);
+  uint8_t *cursor = buffer;
+
+  cursor += otrng_serialize_data(cursor, (const uint8_t *)fp->username,
+                                 username_len);
+  cursor += otrng_serialize_bytes_array(cursor, fp->fp, FPRINT_LEN_BYTES);
+  cursor += otrng_serialize_uint8(cursor, fp->trusted ? 1 : 0);
+
+  account_store_write_record(w, OTRNG_STORE_FINGERPRINT_V4, client, buffer,
+                             len);
+  otrng_free(buffer);
+}
+
+static void account_store_write_client_profile(
+    account_store_writer_s *w, uint8_t type, const otrng_client_s *client,
+    const otrng_client_profile_s *profile) {
+  uint8_t *buffer = NULL;
+  size_t s = 0;
+
+  if (!otrng_client_profile_serialize_with_metadata(&buffer, &s, profile)) {
+    w->failed = otrng_true;
+    return;
+  }
+
+  account_store_write_record(w, type, client, buffer, s);
+  otrng_free(buffer);
+}
+
+static void account_store_write_prekey_profile(
+    account_store_writer_s *w, uint8_t type, const otrng_client_s *client,
+    otrng_prekey_profile_s *profile) {
+  uint8_t *buffer = NULL;
+  size_t s = 0;
+
+  if (!otrng_prekey_profile_serialize_with_metadata(&buffer, &s, profile)) {
+    w->failed = otrng_true;
+    return;
+  }
+
+  account_store_write_record(w, type, client, buffer, s);
+  otrng_free(buffer);
+}
+
+static void account_store_write_client(list_element_s *node, void *context) {
+  account_store_writer_s *w = context;
+  const otrng_client_s *client = node->data;
+  const list_element_s *current;
+
+  if (client->keypair) {
+    account_store_write_record(w, OTRNG_STORE_PRIVATE_KEY_V4, client,
+                               client->keypair->sym, ED448_PRIVATE_BYTES);
+  }
+
+  if (client->forging_key) {
+    uint8_t buffer[2 + ED448_POINT_BYTES];
+    size_t s = otrng_serialize_forging_key(buffer, *client->forging_key);
+
+    if (s == 0) {
+      w->failed = otrng_true;
+    } else {
+      account_store_write_record(w, OTRNG_STORE_FORGING_KEY, client, buffer,
+                                 s);
+    }
+  }
+
+  if (client->client_profile) {
+    account_store_write_client_profile(w, OTRNG_STORE_CLIENT_PROFILE, client,
+                                       client->client_profile);
+  }
+
+  if (client->exp_client_profile) {
+    account_store_write_client_profile(w, OTRNG_STORE_EXPIRED_CLIENT_PROFILE,
+                                       client, client->exp_client_profile);
+  }
+
+  if (client->prekey_profile) {
+    account_store_write_prekey_profile(w, OTRNG_STORE_PREKEY_PROFILE, client,
+                                       client->prekey_profile);
+  }
+
+  if (client->exp_prekey_profile) {
+    account_store_write_prekey_profile(w, OTRNG_STORE_EXPIRED_PREKEY_PROFILE,
+                                       client, client->exp_prekey_profile);
+  }
+
+  for (current = client->our_prekeys.head; current; current = current->next) {
+    account_store_write_prekey(w, client, current->data);
+  }
+
+  if (client->prekey_index) {
+    w->client = client;
+    (void)otrng_prekey_index_foreach_record(
+        client->prekey_index, account_store_write_prekey_record, w);
+  }
+
+  if (client->fingerprints) {
+    for (current = client->fingerprints->fps; current;
+         current = current->next) {
+      account_store_write_fingerprint(w, client, current->data);
+    }
+  }
+}
+
+API otrng_result otrng_global_state_account_store_write_to(
+    const otrng_global_state_s *gs, FILE *f) {
+  account_store_writer_s w;
+  uint8_t header[ACCOUNT_STORE_HEADER_BYTES];
+  uint8_t trailer[ACCOUNT_STORE_TRAILER_BYTES];
+  uint8_t *cursor;
+
+  assert(gs != NULL);
+
+  if (!f) {
+    return OTRNG_ERROR;
+  }
+
+  memset(&w, 0, sizeof(w));
+  w.f = f;
+
+  memcpy(header, account_store_magic, sizeof(account_store_magic));
+  otrng_serialize_uint16(header + 4, OTRNG_ACCOUNT_STORE_VERSION);
+  if (fwrite(header, 1, sizeof(header), f) != sizeof(header)) {
+    return OTRNG_ERROR;
+  }
+  w.offset = sizeof(header);
+
+  otrng_list_foreach(gs->clients, account_store_write_client, &w);
+
+  if (!w.failed && w.index_len > 0 &&
+      fwrite(w.index, 1, w.index_len, f) != w.index_len) {
+    w.failed = otrng_true;
+  }
+
+  cursor = trailer;
+  cursor += otrng_serialize_uint64(cursor, w.offset);
+  cursor += otrng_serialize_uint32(cursor, w.num_records);
+  cursor += otrng_serialize_uint32(
+      cursor, account_store_checksum(w.index, w.index_len));
+  memcpy(cursor, account_store_index_magic, sizeof(account_store_index_magic));
+
+  if (!w.failed && fwrite(trailer, 1, sizeof(trailer), f) != sizeof(trailer)) {
+    w.failed = otrng_true;
+  }
+
+  otrng_free(w.index);
+
+  if (w.failed) {
+    return OTRNG_ERROR;
+  }
+
+  return OTRNG_SUCCESS;
+}
+
+API otrng_result otrng_account_store_convert_from_text(
+    otrng_global_state_s *gs, const otrng_account_store_text_files_s *text,
+    FILE *binary) {
+  otrng_result result = OTRNG_SUCCESS;
+
+  assert(text != NULL);
+
+  if (text->private_key_v4) {
+    result = otrng_global_state_private_key_v4_read_from(
+        gs, text->private_key_v4, text->read_client_id);
+  }
+
+  if (otrng_succeeded(result) && text->forging_key) {
+    result = otrng_global_state_forging_key_read_from(gs, text->forging_key,
+                                                      text->read_client_id);
+  }
+
+  if (otrng_succeeded(result) && text->client_profile) {
+    result = otrng_global_state_client_profile_read_from(
+        gs, text->client_profile, text->read_client_id);
+  }
+
+  if (otrng_succeeded(result) && text->expired_client_profile) {
+    result = otrng_global_state_expired_client_profile_read_from(
+        gs, text->expired_client_profile, text->read_client_id);
+  }
+
+  if (otrng_succeeded(result) && text->prekey_profile) {
+    result = otrng_global_state_prekey_profile_read_from(
+        gs, text->prekey_profile, text->read_client_id);
+  }
+
+  if (otrng_succeeded(result) && text->expired_prekey_profile) {
+    result = otrng_global_state_expired_prekey_profile_read_from(
+        gs, text->expired_prekey_profile, text->read_client_id);
+  }
+
+  if (otrng_succeeded(result) && text->prekey_messages) {
+    result = otrng_global_state_prekeys_read_from(gs, text->prekey_messages,
+                                                  text->read_client_id);
+  }
+
+  if (otrng_succeeded(result) && text->fingerprints_v4) {
+    result = otrng_global_state_fingerprints_v4_read_from(
+        gs, text->fingerprints_v4, text->read_client_id);
+  }
+
+  if (otrng_failed(result)) {
+    return result;
+  }
+
+  return otrng_global_state_account_store_write_to(gs, binary);
+}
+
+API otrng_result otrng_account_store_convert_to_text(
+    otrng_global_state_s *gs, const char *filename,
+    const otrng_account_store_text_files_s *text) {
+  otrng_account_store_s *store;
+  otrng_result result;
+
+  assert(text != NULL);
+
+  store = otrng_account_store_open(filename);
+  if (!store) {
+    return OTRNG_ERROR;
+  }
+
+  result = otrng_global_state_account_store_load(gs, store);
+  otrng_account_store_close(store);
+
+  if (otrng_failed(result)) {
+    return result;
+  }
+
+  result = OTRNG_SUCCESS;
+
+  if (text->private_key_v4) {
+    result =
+        otrng_global_state_private_key_v4_write_to(gs, text->private_key_v4);
+  }
+
+  if (otrng_succeeded(result) && text->forging_key) {
+    result = otrng_global_state_forging_key_write_to(gs, text->forging_key);
+  }
+
+  if (otrng_succeeded(result) && text->client_profile) {
+    result =
+        otrng_global_state_client_profile_write_to(gs, text->client_profile);
+  }
+
+  if (otrng_succeeded(result) && text->expired_client_profile) {
+    result = otrng_global_state_expired_client_profile_write_to(
+        gs, text->expired_client_profile);
+  }
+
+  if (otrng_succeeded(result) && text->prekey_profile) {
+    result =
+        otrng_global_state_prekey_profile_write_to(gs, text->prekey_profile);
+  }
+
+  if (otrng_succeeded(result) && text->expired_prekey_profile) {
+    result = otrng_global_state_expired_prekey_profile_write_to(
+        gs, text->expired_prekey_profile);
+  }
+
+  if (otrng_succeeded(result) && text->prekey_messages) {
+    result = otrng_global_state_prekey_messages_write_to(gs,
+                                                         text->prekey_messages);
+  }
+
+  if (otrng_succeeded(result) && text->fingerprints_v4) {
+    result = otrng_global_state_fingerprints_v4_write_to(gs,
+                                                         text->fingerprints_v4);
+  }
+
+  return result;
+}
@@ -0,0 +1,185 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A binary account store. It keeps the same v4 records as the text files
+ * handled by persistence.h (private keys, forging keys, profiles, prekey
+ * messages and fingerprints) for every client of a global state in one
+ * file, which is memory mapped when it is opened.
+ *
+ * The file starts with a header ("ONGS" and a 16-bit version) and is followed
+ * by the records. Each record is:
+ *
+ *   type (BYTE) || protocol (DATA) || account (DATA) || payload (DATA) ||
+ *   checksum (INT)
+ *
+ * where the payload is the same serialization the text files store in base64,
+ * and the checksum is the first four bytes of SHAKE-256 over the rest of the
+ * record. After the records comes an index with the type (BYTE) and offset
+ * (LONG) of every record, and a fixed size trailer:
+ *
+ *   index offset (LONG) || number of records (INT) || index checksum (INT) ||
+ *   "ONGI"
+ *
+ * so a store can be opened by reading the trailer and the index, without
+ * parsing any of the records, and it can be written without seeking back.
+ *
+ * v3 keys, v3 fingerprints and instance tags are still stored by libotr in
+ * its own formats.
+ */
+
+#ifndef OTRNG_ACCOUNT_STORE_H
+#define OTRNG_ACCOUNT_STORE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "client.h"
+#include "messaging.h"
+#include "shared.h"
+
+#define OTRNG_ACCOUNT_STORE_VERSION 1
+
+typedef enum {
+  OTRNG_STORE_PRIVATE_KEY_V4 = 0x01,
+  OTRNG_STORE_FORGING_KEY = 0x02,
+  OTRNG_STORE_CLIENT_PROFILE = 0x03,
+  OTRNG_STORE_EXPIRED_CLIENT_PROFILE = 0x04,
+  OTRNG_STORE_PREKEY_PROFILE = 0x05,
+  OTRNG_STORE_EXPIRED_PREKEY_PROFILE = 0x06,
+  OTRNG_STORE_PREKEY_MESSAGE = 0x07,
+  OTRNG_STORE_FINGERPRINT_V4 = 0x08,
+} otrng_store_record_type;
+
+/* A record as it is in the store. All the pointers point into the store. */
+typedef struct otrng_store_record_s {
+  uint8_t type;
+  const uint8_t *protocol;
+  size_t protocol_len;
+  const uint8_t *account;
+  size_t account_len;
+  const uint8_t *payload;
+  size_t payload_len;
+} otrng_store_record_s;
+
+typedef struct otrng_account_store_s {
+  const uint8_t *data;
+  size_t len;
+
+  /* Set when the store was opened from a file */
+  /*@null@*/ void *mapping;
+  size_t mapping_len;
+
+  uint32_t num_records;
+  const uint8_t *index;
+  size_t index_offset;
+} otrng_account_store_s;
+
+/* The text files of the persistence.h format, used by the converters below.
+   Any of them can be NULL, in which case those records are not converted. */
+typedef struct otrng_account_store_text_files_s {
+  /*@null@*/ FILE *private_key_v4;
+  /*@null@*/ FILE *forging_key;
+  /*@null@*/ FILE *client_profile;
+  /*@null@*/ FILE *expired_client_profile;
+  /*@null@*/ FILE *prekey_profile;
+  /*@null@*/ FILE *expired_prekey_profile;
+  /*@null@*/ FILE *prekey_messages;
+  /*@null@*/ FILE *fingerprints_v4;
+
+  /* Reads the client id in front of each record of the text files */
+  otrng_client_id_s (*read_client_id)(FILE *filep);
+} otrng_account_store_text_files_s;
+
+/**
+ * @brief Opens and memory maps a store, and checks its header, trailer and
+ *    index. The records are only checked when they are read.
+ *
+ * @return The store, or NULL if it could not be opened or is not valid.
+ */
+API /*@null@*/ otrng_account_store_s *
+otrng_account_store_open(const char *filename);
+
+/**
+ * @brief Closes a store opened with otrng_account_store_open or
+ *    otrng_account_store_open_buffer. Safe to call with NULL.
+ */
+API void otrng_account_store_close(/*@only@*/ /*@null@*/ otrng_account_store_s *store);
+
+/**
+ * @brief Writes every v4 record of every client in [gs] as a store to [f].
+ */
+API otrng_result otrng_global_state_account_store_write_to(
+    const otrng_global_state_s *gs, FILE *f);
+
+/**
+ * @brief Loads every record of [store] into the clients of [gs], creating
+ *    the clients that do not exist yet.
+ *
+ * As with the text files, the prekey messages and fingerprints already in
+ * [gs] are replaced by the ones in the store. They are only replaced once
+ * every record has loaded, so a store that fails to load leaves them as they
+ * were.
+ */
+API otrng_result otrng_global_state_account_store_load(
+    otrng_global_state_s *gs, const otrng_account_store_s *store);
+
+/**
+ * @brief Reads the text files into [gs] and writes them as a store to
+ *    [binary].
+ */
+API otrng_result otrng_account_store_convert_from_text(
+    otrng_global_state_s *gs, const otrng_account_store_text_files_s *text,
+    FILE *binary);
+
+/**
+ * @brief Loads the store in [filename] into [gs] and writes it as text
+ *    files.
+ */
+API otrng_result otrng_account_store_convert_to_text(
+    otrng_global_state_s *gs, const char *filename,
+    const otrng_account_store_text_files_s *text);
+
+/**
+ * @brief Uses [data] as a store, without copying it. [data] has to outlive
+ *    the store.
+ */
+INTERNAL /*@null@*/ otrng_account_store_s *
+otrng_account_store_open_buffer(const uint8_t *data, size_t len);
+
+/**
+ * @brief Reads the record number [i], checking its checksum.
+ */
+INTERNAL otrng_result otrng_account_store_get(otrng_store_record_s *record,
+                                              uint32_t i,
+                                              const otrng_account_store_s *store);
+
+#ifdef OTRNG_ACCOUNT_STORE_PRIVATE
+
+#define ACCOUNT_STORE_HEADER_BYTES 6
+#define ACCOUNT_STORE_INDEX_ENTRY_BYTES 9
+#define ACCOUNT_STORE_TRAILER_BYTES 20
+#define ACCOUNT_STORE_CHECKSUM_BYTES 4
+
+tstatic uint32_t account_store_checksum(const uint8_t *data, size_t len);
+
+#endif
+
+#endif // OTRNG_ACCOUNT_STORE_H
@@ -21,11 +21,16 @@
 #define OTRNG_ALLOC_PRIVATE
 
 #include "alloc.h"
+#include <assert.h>
+#include <pthread.h>
 #include <sodium.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "footprint.h"
+
 static void (*oom_handler)(void);
 
 API void otrng_register_out_of_memory_handler(
@@ -33,19 +38,141 @@ API void otrng_register_out_of_memory_handler(
   oom_handler = handler;
 }
 
-INTERNAL /*@only@*/ /*@notnull@*/ void *otrng_xmalloc(size_t size) {
-  void *result = malloc(size);
+static void *default_alloc(size_t size, otrng_alloc_subsystem subsystem,
+                           void *context) {
+  (void)subsystem;
+  (void)context;
+  return malloc(size);
+}
+
+static void *default_realloc(void *ptr, size_t size, void *context) {
+  (void)context;
+  return realloc(ptr, size);
+}
+
+static void default_free(void *ptr, void *context) {
+  (void)context;
+  free(ptr);
+}
+
+static void *default_secure_alloc(size_t size,
+                                  otrng_alloc_subsystem subsystem,
+                                  void *context) {
+  (void)subsystem;
+  (void)context;
+  return sodium_malloc(size);
+}
+
+static void default_secure_free(void *ptr, void *context) {
+  (void)context;
+  sodium_free(ptr);
+}
+
+static const otrng_allocator_s default_allocator = {
+    default_alloc, default_realloc, default_free, NULL};
+
+static const otrng_allocator_s default_secure_allocator = {
+    default_secure_alloc, NULL, default_secure_free, NULL};
+
+static otrng_allocator_s normal_allocator = {default_alloc, default_realloc,
+                                             default_free, NULL};
+
+static otrng_allocator_s secure_allocator = {default_secure_alloc, NULL,
+                                             default_secure_free, NULL};
+
+API otrng_result otrng_set_allocators(const otrng_allocator_s *normal,
+                                      const otrng_allocator_s *secure) {
+  if (normal && (!normal->alloc || !normal->realloc || !normal->free)) {
+    return OTRNG_ERROR;
+  }
+
+  if (secure && (!secure->alloc || !secure->free)) {
+    return OTRNG_ERROR;
+  }
+
+  normal_allocator = normal ? *normal : default_allocator;
+  secure_allocator = secure ? *secure : default_secure_allocator;
+
+  return OTRNG_SUCCESS;
+}
+
+/* Only tagged allocations take the lock, so the rest of the library does not
+   pay for the accounting */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static otrng_alloc_stats_s stats[OTRNG_ALLOC_SUBSYSTEMS];
+
+static void stats_add(otrng_alloc_subsystem subsystem, size_t size) {
+  otrng_alloc_stats_s *s;
+
+  assert(subsystem < OTRNG_ALLOC_SUBSYSTEMS);
+
+  s = &stats[subsystem];
+  pthread_mutex_lock(&stats_lock);
+  s->live_bytes += size;
+  s->live_count++;
+  s->total_count++;
+  pthread_mutex_unlock(&stats_lock);
+}
+
+static void stats_remove(otrng_alloc_subsystem subsystem, size_t size) {
+  otrng_alloc_stats_s *s;
+
+  assert(subsystem < OTRNG_ALLOC_SUBSYSTEMS);
+
+  s = &stats[subsystem];
+  pthread_mutex_lock(&stats_lock);
+  assert(s->live_count > 0 && s->live_bytes >= size);
+  s->live_bytes -= size;
+  s->live_count--;
+  pthread_mutex_unlock(&stats_lock);
+}
+
+API otrng_result otrng_get_alloc_stats(otrng_alloc_stats_s *dst,
+                                       otrng_alloc_subsystem subsystem) {
+  if (subsystem >= OTRNG_ALLOC_SUBSYSTEMS) {
+    return OTRNG_ERROR;
+  }
+
+  pthread_mutex_lock(&stats_lock);
+  *dst = stats[subsystem];
+  pthread_mutex_unlock(&stats_lock);
+
+  return OTRNG_SUCCESS;
+}
+
+static void out_of_memory(const char *what, size_t size) {
+  if (oom_handler != NULL) {
+    oom_handler();
+  }
+  fprintf(stderr, "fatal: memory exhausted (%s of %lu bytes).\n", what, size);
+  exit(EXIT_FAILURE);
+}
+
+static void *xmalloc_for(otrng_alloc_subsystem subsystem, size_t size) {
+  void *result =
+      normal_allocator.alloc(size, subsystem, normal_allocator.context);
   if (result == NULL) {
-    if (oom_handler != NULL) {
-      oom_handler();
-    }
-    fprintf(stderr, "fatal: memory exhausted (xmalloc of %lu bytes).\n", size);
-    exit(EXIT_FAILURE);
+    out_of_memory("xmalloc", size);
+  }
+
+  return result;
+}
+
+static void *secure_alloc_for(otrng_alloc_subsystem subsystem, size_t size) {
+  void *result =
+      secure_allocator.alloc(size, subsystem, secure_allocator.context);
+  if (result == NULL) {
+    out_of_memory("secure alloc", size);
   }
 
+  memset(result, 0, size);
   return result;
 }
 
+INTERNAL /*@only@*/ /*@notnull@*/ void *otrng_xmalloc(size_t size) {
+  return xmalloc_for(OTRNG_ALLOC_OTHER, size);
+}
+
 INTERNAL /*@only@*/ /*@notnull@*/ void *otrng_xmalloc_z(size_t size) {
   void *result = otrng_xmalloc(size);
   memset(result, 0, size);
@@ -54,39 +181,217 @@ INTERNAL /*@only@*/ /*@notnull@*/ void *otrng_xmalloc_z(size_t size) {
 
 INTERNAL /*@only@*/ /*@notnull@*/ void *
 otrng_xrealloc(/*@only@*/ /*@null@*/ void *ptr, size_t size) {
-  void *result = realloc(ptr, size);
+  void *result = normal_allocator.realloc(ptr, size, normal_allocator.context);
   if (result == NULL) {
-    if (oom_handler != NULL) {
-      oom_handler();
-    }
-    fprintf(stderr, "fatal: memory exhausted (xrealloc of %lu bytes).\n", size);
-    exit(EXIT_FAILURE);
+    out_of_memory("xrealloc", size);
   }
 
   return result;
 }
 
 INTERNAL /*@only@*/ /*@notnull@*/ void *otrng_secure_alloc(size_t size) {
-  void *result = sodium_malloc(size);
-  memset(result, 0, size);
-  return result;
+  return secure_alloc_for(OTRNG_ALLOC_OTHER, size);
 }
 
 INTERNAL /*@only@*/ /*@notnull@*/ void *otrng_secure_alloc_array(size_t count,
                                                                  size_t size) {
-  return sodium_allocarray(count, size);
+  if (size != 0 && count > SIZE_MAX / size) {
+    out_of_memory("secure alloc", SIZE_MAX);
+  }
+
+  return secure_alloc_for(OTRNG_ALLOC_OTHER, count * size);
 }
 
 INTERNAL void otrng_free(/*@notnull@*/ /*@only@*/ void *p) /*@modifies p@*/ {
-  free(p);
+  if (p == NULL) {
+    return;
+  }
+
+  normal_allocator.free(p, normal_allocator.context);
 }
 
 INTERNAL void
 otrng_secure_free(/*@notnull@*/ /*@only@*/ void *p) /*@modifies p@*/ {
-  sodium_free(p);
+  if (p == NULL) {
+    return;
+  }
+
+  secure_allocator.free(p, secure_allocator.context);
+}
+
+INTERNAL /*@only@*/ /*@notnull@*/ void *
+otrng_xmalloc_in(otrng_alloc_subsystem subsystem, size_t size) {
+  void *result = xmalloc_for(subsystem, size);
+  memset(result, 0, size);
+  stats_add(subsystem, size);
+  return result;
+}
+
+INTERNAL /*@only@*/ /*@notnull@*/ void *
+otrng_secure_alloc_in(otrng_alloc_subsystem subsystem, size_t size) {
+  void *result = secure_alloc_for(subsystem, size);
+  stats_add(subsystem, size);
+  return result;
+}
+
+INTERNAL void otrng_free_in(otrng_alloc_subsystem subsystem,
+                            /*@null@*/ /*@only@*/ void *ptr, size_t size) {
+  if (ptr == NULL) {
+    return;
+  }
+
+  stats_remove(subsystem, size);
+  normal_allocator.free(ptr, normal_allocator.context);
+}
+
+INTERNAL void otrng_secure_free_in(otrng_alloc_subsystem subsystem,
+                                   /*@null@*/ /*@only@*/ void *ptr,
+                                   size_t size) {
+  if (ptr == NULL) {
+    return;
+  }
+
+  stats_remove(subsystem, size);
+  secure_allocator.free(ptr, secure_allocator.context);
 }
 
 INTERNAL void otrng_secure_wipe(/*@notnull@*/ /*@only@*/ void *p,
                                 size_t size) /*@modifies p@*/ {
   sodium_memzero(p, size);
 }
+
+/* Bigger chunks are not kept once the message that needed them is done */
+#define ARENA_MAX_RETAINED_BYTES (64 * 1024)
+
+/* Every allocation is aligned as malloc would */
+#define ARENA_ALIGNMENT (2 * sizeof(void *))
+#define ARENA_ALIGN(x) (((x) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+
+#define ARENA_CHUNK_HEADER ARENA_ALIGN(sizeof(otrng_arena_chunk_s))
+
+INTERNAL void otrng_arena_init(otrng_arena_s *arena, size_t chunk_size,
+                               otrng_bool secure) {
+  arena->chunks = NULL;
+  arena->chunk_size = chunk_size;
+  arena->secure = secure;
+  arena->depth = 0;
+  arena->bytes = 0;
+  arena->footprint = NULL;
+}
+
+static void arena_update_footprint(const otrng_arena_s *arena) {
+  if (arena->secure) {
+    otrng_footprint_set(arena->footprint, OTRNG_FOOTPRINT_ARENA, 0,
+                        arena->bytes);
+  } else {
+    otrng_footprint_set(arena->footprint, OTRNG_FOOTPRINT_ARENA, arena->bytes,
+                        0);
+  }
+}
+
+tstatic otrng_arena_chunk_s *arena_chunk_new(otrng_arena_s *arena,
+                                             size_t size) {
+  otrng_arena_chunk_s *chunk;
+
+  if (arena->secure) {
+    chunk = otrng_secure_alloc(ARENA_CHUNK_HEADER + size);
+  } else {
+    chunk = otrng_xmalloc_z(ARENA_CHUNK_HEADER + size);
+  }
+
+  chunk->next = NULL;
+  chunk->size = size;
+  chunk->used = 0;
+
+  arena->bytes += ARENA_CHUNK_HEADER + size;
+  arena_update_footprint(arena);
+
+  return chunk;
+}
+
+static void arena_chunk_free(otrng_arena_s *arena,
+                             otrng_arena_chunk_s *chunk) {
+  arena->bytes -= ARENA_CHUNK_HEADER + chunk->size;
+  arena_update_footprint(arena);
+
+  if (arena->secure) {
+    otrng_secure_free(chunk);
+  } else {
+    otrng_free(chunk);
+  }
+}
+
+INTERNAL void *otrng_arena_alloc(otrng_arena_s *arena, size_t size) {
+  otrng_arena_chunk_s *chunk = arena->chunks;
+  size_t aligned = ARENA_ALIGN(size);
+  uint8_t *result;
+
+  if (!chunk || chunk->size - chunk->used < aligned) {
+    chunk = arena_chunk_new(
+        arena, aligned > arena->chunk_size ? aligned : arena->chunk_size);
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+  }
+
+  result = (uint8_t *)chunk + ARENA_CHUNK_HEADER + chunk->used;
+  chunk->used += aligned;
+
+  /* Fresh chunks are zeroed already, and reset ones are wiped or cleared */
+  return result;
+}
+
+INTERNAL void otrng_arena_reset(otrng_arena_s *arena) {
+  otrng_arena_chunk_s *chunk = arena->chunks, *next;
+  size_t total = 0;
+
+  if (!chunk) {
+    return;
+  }
+
+  if (!chunk->next && chunk->size <= ARENA_MAX_RETAINED_BYTES) {
+    if (arena->secure) {
+      otrng_secure_wipe((uint8_t *)chunk + ARENA_CHUNK_HEADER, chunk->used);
+    } else {
+      memset((uint8_t *)chunk + ARENA_CHUNK_HEADER, 0, chunk->used);
+    }
+    chunk->used = 0;
+    return;
+  }
+
+  /* The message needed more than one chunk: replace them with a single one
+     that would have been big enough */
+  for (; chunk; chunk = next) {
+    next = chunk->next;
+    total += chunk->size;
+    arena_chunk_free(arena, chunk);
+  }
+
+  arena->chunks = NULL;
+  if (total <= ARENA_MAX_RETAINED_BYTES) {
+    arena->chunks = arena_chunk_new(arena, total);
+  }
+}
+
+INTERNAL void otrng_arena_destroy(otrng_arena_s *arena) {
+  otrng_arena_chunk_s *chunk = arena->chunks, *next;
+
+  for (; chunk; chunk = next) {
+    next = chunk->next;
+    arena_chunk_free(arena, chunk);
+  }
+
+  arena->chunks = NULL;
+}
+
+INTERNAL void otrng_arena_enter(otrng_arena_s *arena) { arena->depth++; }
+
+INTERNAL void otrng_arena_leave(otrng_arena_s *arena) {
+  if (arena->depth == 0) {
+    return;
+  }
+
+  arena->depth--;
+  if (arena->depth == 0) {
+    otrng_arena_reset(arena);
+  }
+}
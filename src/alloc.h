@@ -22,7 +22,9 @@
 #define OTRNG_ALLOC_H
 
 #include <stddef.h>
+#include <stdint.h>
 
+#include "error.h"
 #include "shared.h"
 
 /**
@@ -38,6 +40,70 @@
 API void otrng_register_out_of_memory_handler(
     /*@null@*/ void (*handler)(void)) /*@modifies internalState @*/;
 
+/* The parts of the library whose memory is accounted for separately */
+typedef enum {
+  OTRNG_ALLOC_RATCHET = 0,
+  OTRNG_ALLOC_FRAGMENTS = 1,
+  OTRNG_ALLOC_PREKEYS = 2,
+  OTRNG_ALLOC_PERSISTENCE = 3,
+  OTRNG_ALLOC_SMP = 4,
+  /* Everything else. It is not accounted for */
+  OTRNG_ALLOC_OTHER = 5
+} otrng_alloc_subsystem;
+
+#define OTRNG_ALLOC_SUBSYSTEMS 5
+
+/**
+ * @brief A set of functions the library gets its memory from.
+ *
+ *  [alloc]   returns [size] bytes for [subsystem], or NULL when there is no
+ *            memory left.
+ *  [realloc] resizes memory returned by [alloc], like realloc(3). Secure
+ *            memory is never resized, so it can be NULL for the secure
+ *            allocator.
+ *  [free]    releases memory returned by [alloc] or [realloc].
+ *  [context] given to every call.
+ **/
+typedef struct otrng_allocator_s {
+  void *(*alloc)(size_t size, otrng_alloc_subsystem subsystem, void *context);
+  /*@null@*/ void *(*realloc)(void *ptr, size_t size, void *context);
+  void (*free)(void *ptr, void *context);
+  /*@null@*/ void *context;
+} otrng_allocator_s;
+
+/**
+ * @brief Makes the library get its memory from [normal], and the memory that
+ *    holds secrets from [secure]. Either can be NULL to go back to the default,
+ *    which is malloc(3) for normal memory and sodium_malloc for secure memory.
+ *
+ * This has to be called before anything is allocated - that is, before any
+ *    other function of the library - since memory has to be freed by the
+ *    allocator it came from. Strings are handed to and from the application
+ *    and libotr, which use free(3) and malloc(3) on them, so [normal] has to
+ *    be interchangeable with malloc(3): typically a wrapper that counts or
+ *    traces it, or a malloc(3) replacement.
+ *
+ * @return OTRNG_ERROR if an allocator is missing a function it needs.
+ **/
+API otrng_result
+otrng_set_allocators(/*@null@*/ const otrng_allocator_s *normal,
+                     /*@null@*/ const otrng_allocator_s *secure);
+
+typedef struct otrng_alloc_stats_s {
+  /* How much memory the subsystem holds now */
+  size_t live_bytes;
+  size_t live_count;
+  /* How many allocations it has made so far */
+  unsigned long total_count;
+} otrng_alloc_stats_s;
+
+/**
+ * @brief Fills [dst] with the memory statistics of [subsystem], which can't
+ *    be OTRNG_ALLOC_OTHER. Normal and secure memory are counted together.
+ **/
+API otrng_result otrng_get_alloc_stats(otrng_alloc_stats_s *dst,
+                                       otrng_alloc_subsystem subsystem);
+
 INTERNAL /*@only@*/ /*@notnull@*/ void *otrng_xmalloc(size_t size);
 INTERNAL /*@only@*/ /*@notnull@*/ void *otrng_xmalloc_z(size_t size);
 
@@ -55,4 +121,83 @@ INTERNAL void otrng_secure_free(/*@notnull@*/ /*@only@*/ void *ptr);
 INTERNAL void otrng_secure_wipe(/*@notnull@*/ /*@only@*/ void *p,
                                 size_t size) /*@modifies p@*/;
 
+/* Zeroed memory accounted to [subsystem]. It has to be freed with the
+   matching *_free_in function, given the same size */
+INTERNAL /*@only@*/ /*@notnull@*/ void *
+otrng_xmalloc_in(otrng_alloc_subsystem subsystem, size_t size);
+
+INTERNAL /*@only@*/ /*@notnull@*/ void *
+otrng_secure_alloc_in(otrng_alloc_subsystem subsystem, size_t size);
+
+INTERNAL void otrng_free_in(otrng_alloc_subsystem subsystem,
+                            /*@null@*/ /*@only@*/ void *ptr, size_t size);
+
+INTERNAL void otrng_secure_free_in(otrng_alloc_subsystem subsystem,
+                                   /*@null@*/ /*@only@*/ void *ptr,
+                                   size_t size);
+
+struct otrng_footprint_totals_s;
+
+typedef struct otrng_arena_chunk_s {
+  struct otrng_arena_chunk_s *next;
+  size_t size;
+  size_t used;
+} otrng_arena_chunk_s;
+
+/**
+ * @brief An arena hands out memory that is only needed while one message is
+ *    processed, and releases all of it at once.
+ *
+ *  [chunks]     the chunks memory is taken from, the current one first
+ *  [chunk_size] the size of a new chunk, unless an allocation needs more
+ *  [secure]     whether the chunks come from otrng_secure_alloc and are
+ *               wiped when the arena is reset
+ *  [depth]      how many scopes are open, see otrng_arena_enter
+ *  [bytes]      how much memory the chunks take, headers included
+ *  [footprint]  the running totals [bytes] is kept in, if any
+ **/
+typedef struct otrng_arena_s {
+  /*@null@*/ otrng_arena_chunk_s *chunks;
+  size_t chunk_size;
+  otrng_bool secure;
+  unsigned int depth;
+  size_t bytes;
+  /*@null@*/ struct otrng_footprint_totals_s *footprint;
+} otrng_arena_s;
+
+INTERNAL void otrng_arena_init(otrng_arena_s *arena, size_t chunk_size,
+                               otrng_bool secure);
+
+/**
+ * @brief Returns [size] zeroed bytes from the arena. They must not be freed,
+ *    and are valid until the arena is reset.
+ **/
+INTERNAL /*@notnull@*/ void *otrng_arena_alloc(otrng_arena_s *arena,
+                                               size_t size);
+
+/**
+ * @brief Releases everything allocated from the arena, wiping it if the arena
+ *    is secure. The memory is kept for the next message, in a single chunk,
+ *    unless it has grown too large.
+ **/
+INTERNAL void otrng_arena_reset(otrng_arena_s *arena);
+
+INTERNAL void otrng_arena_destroy(otrng_arena_s *arena);
+
+/**
+ * @brief Opens a scope on the arena. Scopes nest - a message sent while
+ *    another is received uses the same scope - and the arena is reset when the
+ *    outermost one is closed by otrng_arena_leave.
+ **/
+INTERNAL void otrng_arena_enter(otrng_arena_s *arena);
+
+INTERNAL void otrng_arena_leave(otrng_arena_s *arena);
+
+#ifdef OTRNG_ALLOC_PRIVATE
+
+tstatic otrng_arena_chunk_s *arena_chunk_new(otrng_arena_s *arena,
+                                             size_t size);
+
+#endif
+
 #endif // OTRNG_ALLOC_H
@@ -1,7 +1,7 @@
 #include "base64.h"
 #include "alloc.h"
 
-INTERNAL char *otrng_base64_encode(uint8_t *src, size_t src_len) {
+INTERNAL char *otrng_base64_encode(const uint8_t *src, size_t src_len) {
   size_t l;
   char *dst = otrng_xmalloc_z(OTRNG_BASE64_ENCODE_LEN(src_len) + 1);
 
@@ -16,6 +16,6 @@
 
 #include "shared.h"
 
-INTERNAL char *otrng_base64_encode(uint8_t *src, size_t src_len);
+INTERNAL char *otrng_base64_encode(const uint8_t *src, size_t src_len);
 
 #endif
@@ -26,6 +26,7 @@
 #endif
 
 #include <assert.h>
+#include <sodium.h>
 #include <time.h>
 
 #define OTRNG_CLIENT_PRIVATE
@@ -37,13 +38,24 @@
 #include "deserialize.h"
 #include "instance_tag.h"
 #include "messaging.h"
+#include "metrics.h"
+#include "random.h"
 #include "serialize.h"
+#include "session.h"
 #include "smp.h"
 #include "str.h"
+#include "trace.h"
+#include "worker.h"
+#include "write_back.h"
 
 #define MAX_NUMBER_PUBLISHED_PREKEY_MSGS 255
 #define HEARTBEAT_INTERVAL 60
 
+/* The conversation the client holds, and the node of the list it is in */
+#define CONVERSATION_BYTES(recipient)                                          \
+  (sizeof(list_element_s) + sizeof(otrng_conversation_s) +                     \
+   strlen(recipient) + 1)
+
 tstatic otrng_conversation_s *new_conversation_with(const char *recipient,
                                                     otrng_s *conn) {
   otrng_conversation_s *conv = otrng_xmalloc_z(sizeof(otrng_conversation_s));
@@ -52,12 +64,23 @@ tstatic otrng_conversation_s *new_conversation_with(const char *recipient,
 
   conv->conn = conn;
 
+  otrng_footprint_attach(&conn->footprint, &conn->client->footprint);
+  otrng_footprint_charge(&conn->client->footprint,
+                         OTRNG_FOOTPRINT_CONVERSATION,
+                         CONVERSATION_BYTES(recipient), 0);
+
   return conv;
 }
 
 tstatic void conversation_free(void *data) {
   otrng_conversation_s *conv = data;
 
+  if (conv->conn) {
+    otrng_footprint_release(&conv->conn->client->footprint,
+                            OTRNG_FOOTPRINT_CONVERSATION,
+                            CONVERSATION_BYTES(conv->recipient), 0);
+  }
+
   otrng_free(conv->recipient);
   otrng_conn_free(conv->conn);
 
@@ -83,9 +106,11 @@ API otrng_client_s *otrng_client_new(const otrng_client_id_s client_id) {
   };
 
   client->client_id = cid;
+  client->trace_id = otrng_trace_new_id();
   client->max_stored_msg_keys = 1000;
   client->max_published_prekey_msg = 100;
   client->minimum_stored_prekey_msg = 20;
+  client->prekey_generation_threads = 1;
   client->should_heartbeat = should_heartbeat;
 
 #define EXTRA_CLIENT_PROFILE_EXPIRATION_SECONDS 2 * 24 * 60 * 60; /* 2 days */
@@ -103,6 +128,21 @@ API otrng_client_s *otrng_client_new(const otrng_client_id_s client_id) {
   return client;
 }
 
+/*@null@*/ static otrng_worker_s *get_prekey_worker(otrng_client_s *client,
+                                                   otrng_bool create) {
+  otrng_global_state_s *gs = client->global_state;
+
+  if (!gs) {
+    return NULL;
+  }
+
+  if (!gs->prekey_worker && create) {
+    gs->prekey_worker = otrng_worker_new(1);
+  }
+
+  return gs->prekey_worker;
+}
+
 tstatic void prekey_message_free_from_list(void *prekeys) {
   otrng_prekey_message_free(prekeys);
 }
@@ -117,7 +157,8 @@ API void otrng_client_free(otrng_client_s *client) {
     otrng_ec_point_destroy(*client->forging_key);
   }
   otrng_free(client->forging_key);
-  otrng_list_free(client->our_prekeys, prekey_message_free_from_list);
+  otrng_tail_list_free(&client->our_prekeys, prekey_message_free_from_list);
+  otrng_prekey_index_free(client->prekey_index);
   otrng_client_profile_free(client->client_profile);
   otrng_client_profile_free(client->exp_client_profile);
   otrng_prekey_profile_free(client->prekey_profile);
@@ -130,6 +171,10 @@ API void otrng_client_free(otrng_client_s *client) {
   otrng_free((char *)client->client_id.protocol);
 
   otrng_prekey_manager_free(client->prekey_manager);
+  otrng_prekey_reservoir_free(client->prekey_reservoir,
+                              get_prekey_worker(client, otrng_false));
+  otrng_prekey_ensemble_cache_free(client->ensemble_cache);
+  otrng_secure_free(client->hibernation_key);
 
   otrng_free(client);
 }
@@ -144,6 +189,9 @@ get_conversation_with(const char *recipient, list_element_s *conversations) {
   for (el = conversations; el; el = el->next) {
     conv = el->data;
     if (!strcmp(conv->recipient, recipient)) {
+      /* A conversation that can't be resumed starts over, so it can still be
+         used */
+      (void)otrng_resume(conv->conn);
       return conv;
     }
   }
@@ -216,6 +264,7 @@ create_connection_for(const char *recipient, otrng_client_s *client) {
 
   v3_conn->opdata = conn; /* For use in callbacks */
   conn->v3_conn = v3_conn;
+  otrng_conversation_footprint_update(conn);
 
   return conn;
 }
@@ -383,6 +432,7 @@ API otrng_result otrng_client_send_fragment(otrng_message_to_send_s **new_msg,
   string_p to_send = NULL;
   uint32_t our_tag, their_tag;
   otrng_result ret = OTRNG_ERROR;
+  uint64_t start;
 
   conv = get_or_create_conversation_with(recipient, client);
   if (!conv) {
@@ -400,7 +450,10 @@ API otrng_result otrng_client_send_fragment(otrng_message_to_send_s **new_msg,
   their_tag = conv->conn->their_instance_tag;
 
   if (to_send) {
+    start = otrng_metrics_start();
     ret = otrng_fragment_message(mms, *new_msg, our_tag, their_tag, to_send);
+    otrng_metrics_record(client->global_state, OTRNG_METRIC_FRAGMENT, start,
+                         ret);
     otrng_free(to_send);
   }
 
@@ -450,6 +503,19 @@ API otrng_result otrng_client_smp_abort(char **to_send, const char *recipient,
   return otrng_smp_abort(to_send, conv->conn);
 }
 
+API otrng_result otrng_client_smp_async_complete(char **to_send,
+                                                 const char *recipient,
+                                                 otrng_client_s *client) {
+  otrng_conversation_s *conv = NULL;
+
+  conv = get_conversation_with(recipient, client->conversations);
+  if (!conv) {
+    return OTRNG_ERROR;
+  }
+
+  return otrng_smp_async_complete(to_send, conv->conn);
+}
+
 API otrng_result otrng_client_receive(char **new_msg, char **to_display,
                                       const char *msg, const char *recipient,
                                       otrng_client_s *client,
@@ -576,6 +642,10 @@ INTERNAL void otrng_client_expire_sessions(otrng_client_s *client) {
     }
 
     conv = el->data;
+    if (conv->conn->hibernated) {
+      continue;
+    }
+
     expiration_time = get_session_expiry_time_from(conv->conn);
 
     if (conv->conn->keys->last_generated < now - expiration_time) {
@@ -632,15 +702,29 @@ INTERNAL void otrng_client_store_my_prekey_message(prekey_message_s *msg,
     return;
   }
 
-  client->our_prekeys = otrng_list_add(msg, client->our_prekeys);
+  if (client->prekey_index) {
+    /* The ids of the messages that have not been loaded are not in
+       our_prekeys, so a new message may have been given one of them. It has
+       not been published yet, so it can still get another one. */
+    while (otrng_prekey_index_get(client->prekey_index, msg->id)) {
+      random_bytes(&msg->id, sizeof(uint32_t));
+    }
+    otrng_prekey_index_add(client->prekey_index, msg);
+  }
+
+  otrng_tail_list_append(&client->our_prekeys, msg);
 }
 
-API /*@null@*/ prekey_message_s **
-otrng_client_build_prekey_messages(uint8_t num_messages,
-                                   otrng_client_s *client) {
+tstatic /*@null@*/ prekey_message_s **
+build_prekey_messages(uint8_t num_messages, otrng_client_s *client,
+                      otrng_bool unlock) {
   uint32_t instance_tag;
-  prekey_message_s **messages;
-  int i, j;
+  prekey_message_s **messages = NULL;
+  prekey_message_s **rest = NULL;
+  prekey_batch_s *batch;
+  list_element_s *taken, *reserved = NULL;
+  size_t from_reservoir = 0;
+  int i;
 
   if (num_messages > MAX_NUMBER_PUBLISHED_PREKEY_MSGS) {
     otrng_client_callbacks_handle_event(
@@ -651,33 +735,96 @@ otrng_client_build_prekey_messages(uint8_t num_messages,
 
   instance_tag = otrng_client_get_instance_tag(client);
 
-  messages = otrng_xmalloc_z(num_messages * sizeof(prekey_message_s *));
-
-  for (i = 0; i < num_messages; i++) {
-    ecdh_keypair_s ecdh;
-    dh_keypair_s dh;
-    if (!otrng_generate_ephemeral_keys(&ecdh, &dh)) {
-      otrng_free(messages);
-      return NULL;
+  if (client->prekey_reservoir) {
+    messages = otrng_xmalloc_z(num_messages * sizeof(prekey_message_s *));
+    from_reservoir = otrng_prekey_reservoir_take(
+        messages, num_messages, instance_tag, client->our_prekeys.head,
+        client->prekey_reservoir, get_prekey_worker(client, otrng_false));
+  }
+
+  if (from_reservoir < num_messages) {
+    /* The messages from the reservoir are only stored at the end, since the
+       lock can be released below, so their ids are chained in front of the
+       stored ones for the batch to avoid */
+    taken = client->our_prekeys.head;
+    if (from_reservoir > 0) {
+      reserved = otrng_xmalloc_z(from_reservoir * sizeof(list_element_s));
+      for (i = 0; i < (int)from_reservoir; i++) {
+        reserved[i].data = messages[i];
+        reserved[i].next =
+            i + 1 < (int)from_reservoir ? &reserved[i + 1] : taken;
+      }
+      taken = reserved;
     }
 
-    messages[i] = otrng_prekey_message_build(instance_tag, &ecdh, &dh);
-    otrng_dh_keypair_destroy(&dh);
+    batch = otrng_prekey_batch_new(instance_tag, num_messages - from_reservoir,
+                                   taken);
+    otrng_free(reserved);
+    if (batch) {
+      /* Generating the keys only touches the batch */
+      if (unlock) {
+        otrng_global_state_unlock(client->global_state);
+      }
+      rest = otrng_prekey_batch_build(batch, client->prekey_generation_threads);
+      if (unlock) {
+        otrng_global_state_lock(client->global_state);
+      }
+    }
 
-    if (!messages[i]) {
-      for (j = 0; j < i; j++) {
-        otrng_prekey_message_free(messages[j]);
+    if (!rest) {
+      for (i = 0; i < (int)from_reservoir; i++) {
+        otrng_prekey_message_free(messages[i]);
       }
       otrng_free(messages);
       return NULL;
     }
 
+    if (!messages) {
+      messages = rest;
+    } else {
+      memcpy(messages + from_reservoir, rest,
+             (num_messages - from_reservoir) * sizeof(prekey_message_s *));
+      otrng_free(rest);
+    }
+  }
+
+  for (i = 0; i < num_messages; i++) {
     otrng_client_store_my_prekey_message(messages[i], client);
   }
 
+  otrng_client_refill_prekey_reservoir(client);
+
   return messages;
 }
 
+API /*@null@*/ prekey_message_s **
+otrng_client_build_prekey_messages(uint8_t num_messages,
+                                   otrng_client_s *client) {
+  return build_prekey_messages(num_messages, client, otrng_false);
+}
+
+INTERNAL /*@null@*/ prekey_message_s **
+otrng_client_build_prekey_messages_unlocked(uint8_t num_messages,
+                                            otrng_client_s *client) {
+  return build_prekey_messages(num_messages, client, otrng_true);
+}
+
+INTERNAL void otrng_client_refill_prekey_reservoir(otrng_client_s *client) {
+  otrng_worker_s *worker;
+
+  if (!client->prekey_reservoir) {
+    return;
+  }
+
+  otrng_global_state_lock(client->global_state);
+  worker = get_prekey_worker(client, otrng_true);
+  otrng_global_state_unlock(client->global_state);
+
+  otrng_prekey_reservoir_refill(client->prekey_reservoir, worker,
+                                otrng_client_get_instance_tag(client),
+                                client->prekey_generation_threads);
+}
+
 #ifdef DEBUG_API
 
 #include "debug.h"
@@ -987,7 +1134,7 @@ tstatic void otrl_userstate_instance_tag_add(OtrlUserState us,
   us->instag_root = instag;
 }
 
-INTERNAL unsigned int otrng_client_get_instance_tag(otrng_client_s *client) {
+tstatic unsigned int find_or_create_instance_tag(otrng_client_s *client) {
   OtrlInsTag *instag;
 
   if (client->global_state->user_state_v3 == NULL) {
@@ -1016,6 +1163,17 @@ INTERNAL unsigned int otrng_client_get_instance_tag(otrng_client_s *client) {
   return instag->instag;
 }
 
+/* The v3 user state, where instance tags live, is shared by all clients */
+INTERNAL unsigned int otrng_client_get_instance_tag(otrng_client_s *client) {
+  unsigned int result;
+
+  otrng_global_state_lock(client->global_state);
+  result = find_or_create_instance_tag(client);
+  otrng_global_state_unlock(client->global_state);
+
+  return result;
+}
+
 INTERNAL otrng_result otrng_client_add_instance_tag(otrng_client_s *client,
                                                     unsigned int instag) {
   OtrlInsTag *p;
@@ -1064,26 +1222,88 @@ get_stored_prekey_node_by_id(uint32_t id, list_element_s *l) {
 }
 
 INTERNAL /*@null@*/ const prekey_message_s *
-otrng_client_get_prekey_by_id(uint32_t id, const otrng_client_s *client) {
-  list_element_s *node = get_stored_prekey_node_by_id(id, client->our_prekeys);
-  if (!node) {
+otrng_client_get_prekey_by_id(uint32_t id, otrng_client_s *client) {
+  list_element_s *node;
+  otrng_prekey_index_entry_s *entry;
+  prekey_message_s *msg;
+
+  if (!client->prekey_index) {
+    node = get_stored_prekey_node_by_id(id, client->our_prekeys.head);
+    if (!node) {
+      return NULL;
+    }
+
+    return node->data;
+  }
+
+  entry = otrng_prekey_index_get(client->prekey_index, id);
+  if (!entry) {
     return NULL;
   }
 
-  return node->data;
+  if (entry->msg) {
+    return entry->msg;
+  }
+
+  msg = otrng_prekey_index_load(client->prekey_index, entry);
+  if (!msg) {
+    return NULL;
+  }
+
+  otrng_tail_list_append(&client->our_prekeys, msg);
+
+  return msg;
+}
+
+INTERNAL size_t
+otrng_client_prekey_messages_count(const otrng_client_s *client) {
+  size_t count = otrng_tail_list_len(&client->our_prekeys);
+
+  if (client->prekey_index) {
+    count += client->prekey_index->num_unloaded;
+  }
+
+  return count;
+}
+
+INTERNAL void otrng_client_clear_prekey_messages(otrng_client_s *client) {
+  otrng_tail_list_free(&client->our_prekeys, prekey_message_free_from_list);
+
+  if (client->prekey_index) {
+    otrng_prekey_index_clear(client->prekey_index);
+  }
 }
 
 INTERNAL void
 otrng_client_delete_my_prekey_message_by_id(uint32_t id,
                                             otrng_client_s *client) {
-  list_element_s *node = get_stored_prekey_node_by_id(id, client->our_prekeys);
+  list_element_s *node;
+
+  if (client->prekey_index) {
+    otrng_prekey_index_entry_s *entry =
+        otrng_prekey_index_get(client->prekey_index, id);
+    otrng_bool loaded;
+
+    if (!entry) {
+      return;
+    }
+
+    loaded = entry->msg != NULL;
+    otrng_prekey_index_remove(client->prekey_index, id);
+    if (!loaded) {
+      otrng_client_store_section(client, OTRNG_SECTION_PREKEY_MESSAGES);
+      return;
+    }
+  }
+
+  node = get_stored_prekey_node_by_id(id, client->our_prekeys.head);
   if (!node) {
     return;
   }
 
-  client->our_prekeys = otrng_list_remove_element(node, client->our_prekeys);
-  otrng_list_free(node, prekey_message_free_from_list);
-  client->global_state->callbacks->store_prekey_messages(client);
+  prekey_message_free_from_list(node->data);
+  otrng_tail_list_remove(&client->our_prekeys, node);
+  otrng_client_store_section(client, OTRNG_SECTION_PREKEY_MESSAGES);
 }
 
 API void otrng_client_set_should_heartbeat(otrng_bool (*heartbeat)(long),
@@ -1098,6 +1318,216 @@ API void otrng_client_set_padding(size_t granularity, otrng_client_s *client) {
   assert(client != NULL);
 }
 
+API void otrng_client_set_smp_async(otrng_bool enabled,
+                                    otrng_client_s *client) {
+  assert(client != NULL);
+
+  client->smp_async = enabled;
+}
+
+API void otrng_client_set_prekey_generation_threads(unsigned int num_threads,
+                                                    otrng_client_s *client) {
+  assert(client != NULL);
+
+  client->prekey_generation_threads = num_threads;
+}
+
+API void otrng_client_set_prekey_reservoir(unsigned int low_watermark,
+                                           unsigned int high_watermark,
+                                           otrng_client_s *client) {
+  assert(client != NULL);
+
+  if (high_watermark == 0) {
+    otrng_prekey_reservoir_free(client->prekey_reservoir,
+                                get_prekey_worker(client, otrng_false));
+    client->prekey_reservoir = NULL;
+    return;
+  }
+
+  if (!client->prekey_reservoir) {
+    client->prekey_reservoir =
+        otrng_prekey_reservoir_new(low_watermark, high_watermark);
+    return;
+  }
+
+  client->prekey_reservoir->low_watermark = low_watermark;
+  client->prekey_reservoir->high_watermark = high_watermark;
+}
+
+API void otrng_client_set_ensemble_cache(unsigned int max_entries,
+                                         otrng_client_s *client) {
+  assert(client != NULL);
+
+  if (max_entries == 0) {
+    otrng_prekey_ensemble_cache_free(client->ensemble_cache);
+    client->ensemble_cache = NULL;
+    return;
+  }
+
+  if (!client->ensemble_cache) {
+    client->ensemble_cache = otrng_prekey_ensemble_cache_new(max_entries);
+    return;
+  }
+
+  otrng_prekey_ensemble_cache_resize(client->ensemble_cache, max_entries);
+}
+
+API void otrng_client_set_hibernation(unsigned int idle_time,
+                                      otrng_client_s *client) {
+  assert(client != NULL);
+  client->hibernation_idle_time = idle_time;
+}
+
+INTERNAL void otrng_client_hibernate_idle(otrng_client_s *client,
+                                          time_t now) {
+  const list_element_s *el;
+
+  if (client->hibernation_idle_time == 0) {
+    return;
+  }
+
+  for (el = client->conversations; el; el = el->next) {
+    otrng_conversation_s *conv = el->data;
+
+    if (conv->conn->hibernated ||
+        conv->conn->last_active + (time_t)client->hibernation_idle_time >
+            now) {
+      continue;
+    }
+
+    /* Conversations that are busy are tried again on the next poll */
+    (void)otrng_hibernate(conv->conn);
+  }
+}
+
+INTERNAL const uint8_t *otrng_client_hibernation_key(otrng_client_s *client) {
+  if (!client->hibernation_key) {
+    client->hibernation_key = otrng_secure_alloc(crypto_secretbox_KEYBYTES);
+    otrng_footprint_charge(&client->footprint, OTRNG_FOOTPRINT_HIBERNATED, 0,
+                           crypto_secretbox_KEYBYTES);
+    random_bytes(client->hibernation_key, crypto_secretbox_KEYBYTES);
+  }
+
+  return client->hibernation_key;
+}
+
+API otrng_result otrng_client_export_session(uint8_t **dst, size_t *dst_len,
+                                             const char *recipient,
+                                             otrng_client_s *client) {
+  otrng_conversation_s *conv;
+
+  conv = get_conversation_with(recipient, client->conversations);
+  if (!conv || !otrng_session_can_serialize(conv->conn)) {
+    return OTRNG_ERROR;
+  }
+
+  return otrng_session_export(dst, dst_len, conv->recipient,
+                              otrng_client_get_instance_tag(client),
+                              conv->conn);
+}
+
+API otrng_result otrng_client_import_session(const uint8_t *src,
+                                             size_t src_len,
+                                             otrng_client_s *client) {
+  otrng_conversation_s *conv;
+  const uint8_t *ser = NULL;
+  size_t ser_len = 0;
+  char *peer = NULL;
+  uint32_t instance_tag = 0;
+  otrng_result ret;
+
+  if (!otrng_session_parse_export(&peer, &instance_tag, &ser, &ser_len, src,
+                                  src_len)) {
+    return OTRNG_ERROR;
+  }
+
+  /* The peer addresses its messages to the instance tag the session was
+     established with */
+  if (instance_tag != otrng_client_get_instance_tag(client)) {
+    otrng_free(peer);
+    return OTRNG_ERROR;
+  }
+
+  conv = get_or_create_conversation_with(peer, client);
+  otrng_free(peer);
+  if (!conv) {
+    return OTRNG_ERROR;
+  }
+
+  /* The import only replaces what a session is serialized with: a DAKE, an
+     SMP or the reassembly of a fragmented message in progress would be left
+     running against the new keys */
+  if (!otrng_session_can_serialize(conv->conn)) {
+    return OTRNG_ERROR;
+  }
+
+  ret = otrng_session_deserialize(conv->conn, ser, ser_len);
+  if (otrng_succeeded(ret)) {
+    conv->conn->last_active = time(NULL);
+  }
+
+  return ret;
+}
+
+API void otrng_client_free_exported_session(uint8_t *exported,
+                                            size_t exported_len) {
+  otrng_session_free_serialized(exported, exported_len);
+}
+
+INTERNAL otrng_result otrng_client_validate_prekey_ensemble(
+    otrng_client_s *client, const char *identity,
+    const prekey_ensemble_s *ensemble) {
+  if (!client->ensemble_cache || !identity) {
+    return otrng_prekey_ensemble_validate(ensemble);
+  }
+
+  return otrng_prekey_ensemble_cache_validate(client->ensemble_cache, identity,
+                                              ensemble);
+}
+
+API void otrng_client_set_lazy_prekeys(otrng_bool enabled,
+                                       otrng_client_s *client) {
+  list_element_s *current;
+  size_t i;
+
+  assert(client != NULL);
+
+  if (!enabled) {
+    otrng_prekey_index_s *idx = client->prekey_index;
+    if (!idx) {
+      return;
+    }
+
+    /* Everything in the index has to be in our_prekeys again */
+    for (i = 0; i < idx->num_buckets; i++) {
+      otrng_prekey_index_entry_s *entry;
+      for (entry = idx->buckets[i]; entry; entry = entry->next) {
+        prekey_message_s *msg;
+        if (entry->msg) {
+          continue;
+        }
+        msg = otrng_prekey_index_load(idx, entry);
+        if (msg) {
+          otrng_tail_list_append(&client->our_prekeys, msg);
+        }
+      }
+    }
+
+    otrng_prekey_index_free(idx);
+    client->prekey_index = NULL;
+    return;
+  }
+
+  if (client->prekey_index) {
+    return;
+  }
+
+  client->prekey_index = otrng_prekey_index_new();
+  for (current = client->our_prekeys.head; current; current = current->next) {
+    otrng_prekey_index_add(client->prekey_index, current->data);
+  }
+}
+
 API void otrng_client_set_max_stored_msg_keys(unsigned int max_stored_msg_keys,
                                               otrng_client_s *client) {
   assert(client != NULL);
@@ -1163,7 +1593,7 @@ API void otrng_client_failed_published(otrng_client_s *client) {
 
   client->client_profile->is_publishing = otrng_false;
   client->prekey_profile->is_publishing = otrng_false;
-  for (current = client->our_prekeys; current != NULL;
+  for (current = client->our_prekeys.head; current != NULL;
        current = current->next) {
     prekey_message_s *pm = current->data;
     pm->is_publishing = otrng_false;
@@ -1179,16 +1609,16 @@ API void otrng_client_published(otrng_client_s *client) {
   if (client->client_profile->is_publishing) {
     client->client_profile->should_publish = otrng_false;
     client->client_profile->is_publishing = otrng_false;
-    client->global_state->callbacks->store_client_profile(client);
+    otrng_client_store_section(client, OTRNG_SECTION_CLIENT_PROFILE);
   }
 
   if (client->prekey_profile->is_publishing) {
     client->prekey_profile->should_publish = otrng_false;
     client->prekey_profile->is_publishing = otrng_false;
-    client->global_state->callbacks->store_prekey_profile(client);
+    otrng_client_store_section(client, OTRNG_SECTION_PREKEY_PROFILE);
   }
 
-  for (current = client->our_prekeys; current != NULL;
+  for (current = client->our_prekeys.head; current != NULL;
        current = current->next) {
     prekey_message_s *pm = current->data;
     if (pm->is_publishing) {
@@ -1198,7 +1628,7 @@ API void otrng_client_published(otrng_client_s *client) {
     }
   }
   if (has_any_pms) {
-    client->global_state->callbacks->store_prekey_messages(client);
+    otrng_client_store_section(client, OTRNG_SECTION_PREKEY_MESSAGES);
   }
 
   if (client->is_publishing) {
@@ -28,9 +28,13 @@
 #pragma clang diagnostic pop
 #endif
 
+#include "footprint.h"
 #include "list.h"
 #include "otrng.h"
+#include "prekey_ensemble_cache.h"
 #include "prekey_manager.h"
+#include "prekey_index.h"
+#include "prekey_reservoir.h"
 #include "shared.h"
 
 // TODO: @client REMOVE
@@ -55,6 +59,9 @@ typedef struct otrng_client_s {
 
   otrng_client_id_s client_id;
 
+  /* Identifies the client in tracing spans */
+  uint64_t trace_id;
+
   struct otrng_global_state_s *global_state;
   otrng_keypair_s *keypair;
   otrng_public_key *forging_key;
@@ -64,11 +71,41 @@ typedef struct otrng_client_s {
   otrng_client_profile_s *exp_client_profile;
   otrng_prekey_profile_s *prekey_profile;
   otrng_prekey_profile_s *exp_prekey_profile;
-  list_element_s *our_prekeys; /* prekey_message_s */
+  otrng_tail_list_s our_prekeys; /* prekey_message_s */
+
+  /* Every stored prekey message by id, including the ones that have not been
+     deserialized yet. Only set in lazy mode. See
+     otrng_client_set_lazy_prekeys */
+  /*@null@*/ otrng_prekey_index_s *prekey_index;
 
   unsigned int max_stored_msg_keys;
   unsigned int max_published_prekey_msg;
   unsigned int minimum_stored_prekey_msg;
+  unsigned int prekey_generation_threads;
+
+  /* Only set while otrng_client_ensure_correct_state runs, if the
+     application wants a startup report */
+  /*@null@*/ struct otrng_client_startup_report_s *startup_report;
+
+  /* Prekey messages generated ahead of time. See
+     otrng_client_set_prekey_reservoir */
+  /*@null@*/ otrng_prekey_reservoir_s *prekey_reservoir;
+
+  /* Prekey ensemble profiles already validated. See
+     otrng_client_set_ensemble_cache */
+  /*@null@*/ otrng_prekey_ensemble_cache_s *ensemble_cache;
+
+  /* How long, in seconds, a conversation stays idle before it hibernates.
+     0 if conversations never hibernate. See otrng_client_set_hibernation */
+  unsigned int hibernation_idle_time;
+
+  /* Encrypts the state of hibernated conversations. Created with the first
+     one, and only lives in memory */
+  /*@null@*/ uint8_t *hibernation_key;
+
+  /* The memory the client and its conversations hold, see
+     otrng_client_footprint */
+  otrng_footprint_totals_s footprint;
 
   uint64_t profiles_extra_valid_time;
   uint64_t client_profile_exp_time;
@@ -80,6 +117,10 @@ typedef struct otrng_client_s {
   otrng_bool (*should_heartbeat)(long last_sent);
   size_t padding;
 
+  /* When set, received SMP TLVs are processed on a worker thread. See
+     otrng_client_set_smp_async */
+  otrng_bool smp_async;
+
   /* This flag will be set when there is anything that should be published
      to prekey servers */
   otrng_bool should_publish;
@@ -92,6 +133,10 @@ typedef struct otrng_client_s {
 
   otrng_known_fingerprints_s *fingerprints;
 
+  /* The otrng_client_section bits that changed since the last write-back
+     flush. Only used when the global state has a write-back layer. */
+  unsigned int dirty_sections;
+
   /* Contains the prekey manager if prekey management has been enabled.
      It is NOT safe to assume that this will be non-null - it is a
      plugins/clients responsibility to ensure that the prekey management system
@@ -152,6 +197,10 @@ API otrng_result otrng_client_smp_respond(char **to_send, const char *recipient,
 API otrng_result otrng_client_smp_abort(char **to_send, const char *recipient,
                                         otrng_client_s *client);
 
+API otrng_result otrng_client_smp_async_complete(char **to_send,
+                                                 const char *recipient,
+                                                 otrng_client_s *client);
+
 API otrng_result otrng_client_receive(char **new_msg, char **to_display,
                                       const char *msg, const char *recipient,
                                       otrng_client_s *client,
@@ -186,6 +235,15 @@ API /*@null@*/ prekey_message_s **
 otrng_client_build_prekey_messages(uint8_t num_messages,
                                    otrng_client_s *client);
 
+/**
+ * @brief Like otrng_client_build_prekey_messages, for a caller that holds the
+ *    global state lock once. The lock is released while the keys of the
+ *    messages are generated, so that other clients can make progress.
+ **/
+INTERNAL /*@null@*/ prekey_message_s **
+otrng_client_build_prekey_messages_unlocked(uint8_t num_messages,
+                                            otrng_client_s *client);
+
 INTERNAL OtrlPrivKey *
 otrng_client_get_private_key_v3(const otrng_client_s *client);
 
@@ -236,8 +294,24 @@ INTERNAL unsigned int otrng_client_get_instance_tag(otrng_client_s *client);
 INTERNAL otrng_result otrng_client_add_instance_tag(otrng_client_s *client,
                                                     unsigned int instag);
 
+/**
+ * @brief Finds a stored prekey message by its id. In lazy mode, this is where
+ *    the message is deserialized.
+ **/
 INTERNAL /*@null@*/ const prekey_message_s *
-otrng_client_get_prekey_by_id(uint32_t id, const otrng_client_s *client);
+otrng_client_get_prekey_by_id(uint32_t id, otrng_client_s *client);
+
+/**
+ * @brief The number of stored prekey messages, whether they have been
+ *    deserialized or not.
+ **/
+INTERNAL size_t
+otrng_client_prekey_messages_count(const otrng_client_s *client);
+
+/**
+ * @brief Frees every stored prekey message.
+ **/
+INTERNAL void otrng_client_clear_prekey_messages(otrng_client_s *client);
 
 INTERNAL void
 otrng_client_delete_my_prekey_message_by_id(uint32_t id,
@@ -245,6 +319,144 @@ otrng_client_delete_my_prekey_message_by_id(uint32_t id,
 
 API void otrng_client_set_padding(size_t granularity, otrng_client_s *client);
 
+/**
+ * @brief Turns the asynchronous SMP mode on or off for the client.
+ *
+ * In this mode, the SMP steps triggered by received messages are computed on
+ * a worker thread instead of inside otrng_client_receive. The
+ * smp_async_done callback is invoked when a step has finished, and the
+ * application must then call otrng_client_smp_async_complete from its
+ * messaging thread to get the SMP events and the reply to send.
+ **/
+API void otrng_client_set_smp_async(otrng_bool enabled, otrng_client_s *client);
+
+/**
+ * @brief Sets how many threads are used to generate the keys when the client
+ *    builds a batch of prekey messages. The default is 1, which generates
+ *    them on the calling thread.
+ **/
+API void otrng_client_set_prekey_generation_threads(unsigned int num_threads,
+                                                    otrng_client_s *client);
+
+/**
+ * @brief Keeps prekey messages ready ahead of time for the client.
+ *
+ * When the client has fewer than [low_watermark] ready messages, a
+ * background worker generates enough of them to reach [high_watermark].
+ * New prekey messages are then taken from the reservoir, and only generated
+ * inline when it runs dry. A [high_watermark] of 0 turns the reservoir off
+ * and frees the ready messages.
+ **/
+API void otrng_client_set_prekey_reservoir(unsigned int low_watermark,
+                                           unsigned int high_watermark,
+                                           otrng_client_s *client);
+
+/**
+ * @brief Remembers the profiles of up to [max_entries] validated prekey
+ *    ensembles, one for each identity and instance tag.
+ *
+ * A prekey ensemble retrieved again with the same profiles, before they
+ * expire, only has its prekey message validated. A [max_entries] of 0 turns
+ * the cache off.
+ **/
+API void otrng_client_set_ensemble_cache(unsigned int max_entries,
+                                         otrng_client_s *client);
+
+/**
+ * @brief Makes conversations that have been idle for [idle_time] seconds
+ *    hibernate on the next otrng_poll: their state is serialized, encrypted
+ *    and kept in memory or handed to the store_hibernated callback, and
+ *    everything else they hold is freed. A hibernated conversation comes back
+ *    as soon as it is looked up to send or receive a message. An [idle_time]
+ *    of 0, the default, turns hibernation off.
+ *
+ * When a conversation is freed while it is hibernated, the discard_hibernated
+ * callback is told that what store_hibernated stored for it can be deleted.
+ *
+ * Conversations in the middle of a DAKE, of an SMP or of a fragmented
+ * message, and OTRv3 sessions, do not hibernate.
+ **/
+API void otrng_client_set_hibernation(unsigned int idle_time,
+                                      otrng_client_s *client);
+
+/**
+ * @brief Makes the conversations of [client] that have been idle since
+ *    before [now] - hibernation_idle_time hibernate.
+ **/
+INTERNAL void otrng_client_hibernate_idle(otrng_client_s *client, time_t now);
+
+/**
+ * @brief The key the state of hibernated conversations is encrypted with.
+ **/
+INTERNAL const uint8_t *otrng_client_hibernation_key(otrng_client_s *client);
+
+/**
+ * @brief Exports the session with [recipient] into [dst], so that it can be
+ *    resumed with otrng_client_import_session after a restart, without a new
+ *    DAKE. The export is versioned and holds the peer's profiles, the
+ *    instance tags and the keys and counters of the double ratchet, with the
+ *    skipped message keys.
+ *
+ * The export holds secrets: it has to be stored encrypted, and released with
+ * otrng_client_free_exported_session, which wipes it. It is only valid until
+ * the next message is sent or received in the conversation - importing an
+ * older export would go back to message keys that were already used.
+ *
+ * @return OTRNG_ERROR if there is no conversation with [recipient], if it is
+ *    an OTRv3 session, or while a DAKE, an SMP or the reassembly of a
+ *    fragmented message are in progress.
+ **/
+API otrng_result otrng_client_export_session(uint8_t **dst, size_t *dst_len,
+                                             const char *recipient,
+                                             otrng_client_s *client);
+
+/**
+ * @brief Resumes the session exported in [src] by
+ *    otrng_client_export_session, creating the conversation with the peer if
+ *    needed. The state of an existing conversation is replaced.
+ *
+ * @return OTRNG_ERROR if [src] is not a valid export, if it was exported by a
+ *    client with another instance tag, or if the existing conversation can't
+ *    be exported itself: while a DAKE, an SMP or the reassembly of a
+ *    fragmented message are in progress, or in an OTRv3 session. The
+ *    conversation is left as it was.
+ **/
+API otrng_result otrng_client_import_session(const uint8_t *src,
+                                             size_t src_len,
+                                             otrng_client_s *client);
+
+/**
+ * @brief Wipes and frees a session exported by otrng_client_export_session.
+ **/
+API void otrng_client_free_exported_session(/*@only@*/ uint8_t *exported,
+                                            size_t exported_len);
+
+/**
+ * @brief Validates a prekey ensemble retrieved for [identity], using the
+ *    client's ensemble cache if it has one. [identity] can be NULL when it is
+ *    not known, and then the cache is not used.
+ **/
+INTERNAL otrng_result otrng_client_validate_prekey_ensemble(
+    otrng_client_s *client, /*@null@*/ const char *identity,
+    const prekey_ensemble_s *ensemble);
+
+/**
+ * @brief Sets whether stored prekey messages are loaded lazily.
+ *
+ * In lazy mode, reading the stored prekey messages only indexes the ones that
+ * have already been published, and each of them is deserialized when a
+ * non-interactive DAKE refers to it.
+ **/
+API void otrng_client_set_lazy_prekeys(otrng_bool enabled,
+                                       otrng_client_s *client);
+
+/**
+ * @brief Collects prekey messages that finished generating in the
+ *    background, and starts a new refill if the reservoir is low. Called
+ *    from otrng_client_ensure_correct_state.
+ **/
+INTERNAL void otrng_client_refill_prekey_reservoir(otrng_client_s *client);
+
 API void otrng_client_set_max_stored_msg_keys(unsigned int max_stored_msg_keys,
                                               otrng_client_s *client);
 
@@ -292,6 +504,12 @@ API void otrng_conversation_debug_print(FILE *, int, otrng_conversation_s *);
 tstatic uint64_t
 otrng_client_get_client_profile_exp_time(otrng_client_s *client);
 
+tstatic unsigned int find_or_create_instance_tag(otrng_client_s *client);
+
+tstatic /*@null@*/ prekey_message_s **
+build_prekey_messages(uint8_t num_messages, otrng_client_s *client,
+                      otrng_bool unlock);
+
 #endif
 
 #endif
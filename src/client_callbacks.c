@@ -128,6 +128,61 @@ INTERNAL void otrng_client_callbacks_smp_update(
   cb->smp_update(event, progress_percent, conv);
 }
 
+INTERNAL void
+otrng_client_callbacks_smp_async_done(const otrng_client_callbacks_s *cb,
+                                      const otrng_s *conv) {
+  if (!cb->smp_async_done) {
+    return;
+  }
+
+  cb->smp_async_done(conv);
+}
+
+INTERNAL void otrng_client_callbacks_startup_report(
+    const otrng_client_callbacks_s *cb, otrng_client_s *client,
+    const struct otrng_client_startup_report_s *report) {
+  if (!cb->startup_report) {
+    return;
+  }
+
+  cb->startup_report(client, report);
+}
+
+INTERNAL otrng_bool
+otrng_client_callbacks_stores_hibernated(const otrng_client_callbacks_s *cb) {
+  return cb->store_hibernated != NULL && cb->load_hibernated != NULL;
+}
+
+INTERNAL otrng_result otrng_client_callbacks_store_hibernated(
+    const otrng_client_callbacks_s *cb, const struct otrng_s *conv,
+    const uint8_t *data, size_t data_len) {
+  if (!otrng_client_callbacks_stores_hibernated(cb)) {
+    return OTRNG_ERROR;
+  }
+
+  return cb->store_hibernated(conv, data, data_len);
+}
+
+INTERNAL otrng_result otrng_client_callbacks_load_hibernated(
+    const otrng_client_callbacks_s *cb, const struct otrng_s *conv,
+    uint8_t **data, size_t *data_len) {
+  if (!otrng_client_callbacks_stores_hibernated(cb)) {
+    return OTRNG_ERROR;
+  }
+
+  return cb->load_hibernated(conv, data, data_len);
+}
+
+INTERNAL void
+otrng_client_callbacks_discard_hibernated(const otrng_client_callbacks_s *cb,
+                                          const otrng_s *conv) {
+  if (!cb->discard_hibernated) {
+    return;
+  }
+
+  cb->discard_hibernated(conv);
+}
+
 INTERNAL void otrng_client_callbacks_display_error_message(
     const otrng_client_callbacks_s *cb, const otrng_error_event event,
     string_p *to_display, const otrng_s *conv) {
@@ -329,6 +384,26 @@ API void otrng_client_callbacks_debug_print(FILE *f, int indent,
     debug_api_print(f, "\n");
   }
 
+  if (otrng_debug_print_should_ignore("client_callbacks->smp_async_done")) {
+    otrng_print_indent(f, indent + 2);
+    debug_api_print(f, "smp_async_done = IGNORED\n");
+  } else {
+    otrng_print_indent(f, indent + 2);
+    debug_api_print(f, "smp_async_done = ");
+    otrng_debug_print_pointer(f, (const void *)c->smp_async_done);
+    debug_api_print(f, "\n");
+  }
+
+  if (otrng_debug_print_should_ignore("client_callbacks->startup_report")) {
+    otrng_print_indent(f, indent + 2);
+    debug_api_print(f, "startup_report = IGNORED\n");
+  } else {
+    otrng_print_indent(f, indent + 2);
+    debug_api_print(f, "startup_report = ");
+    otrng_debug_print_pointer(f, (const void *)c->startup_report);
+    debug_api_print(f, "\n");
+  }
+
   if (otrng_debug_print_should_ignore(
           "client_callbacks->display_error_message")) {
     otrng_print_indent(f, indent + 2);
@@ -105,6 +105,7 @@ typedef enum {
 struct otrng_client_s;
 struct otrng_s;
 struct otrng_client_id_s;
+struct otrng_client_startup_report_s;
 
 typedef struct otrng_client_callbacks_s {
   /* REQUIRED */
@@ -182,6 +183,13 @@ typedef struct otrng_client_callbacks_s {
   void (*smp_update)(const otrng_smp_event event,
                      const uint8_t progress_percent, const struct otrng_s *);
 
+  /* Called from the SMP worker thread when a received SMP TLV has been
+   * processed for a client in asynchronous SMP mode. The application should
+   * then call otrng_client_smp_async_complete from its messaging thread to
+   * get the SMP events and the reply TLV, serialized in a message to send. */
+  /* OPTIONAL */
+  void (*smp_async_done)(const struct otrng_s *);
+
   /* REQUIRED */
   /* Display the error message with respect to the received event
    */
@@ -264,6 +272,13 @@ typedef struct otrng_client_callbacks_s {
   /* REQUIRED */
   void (*load_fingerprints_v3)(struct otrng_client_s *client);
 
+  /* Called at the end of every otrng_client_ensure_correct_state, with the
+   * time spent in each of its steps. The report is only valid during the
+   * call. */
+  /* OPTIONAL */
+  void (*startup_report)(struct otrng_client_s *client,
+                         const struct otrng_client_startup_report_s *report);
+
   /* OPTIONAL - the string returned will transfer ownership to the caller */
   string_p (*localized_error_message)(
       struct otrng_client_s *client,
@@ -279,6 +294,24 @@ typedef struct otrng_client_callbacks_s {
   /* REQUIRED - Send the given IM to the given conversation - the callback takes
    * ownership of the message parameter */
   void (*inject_message)(const struct otrng_s *, string_p message);
+
+  /* OPTIONAL - stores the encrypted state of a conversation that hibernates,
+   * for load_hibernated to give back when it is used again. The data is only
+   * valid during the call. If not provided, the state is kept in memory. */
+  otrng_result (*store_hibernated)(const struct otrng_s *, const uint8_t *data,
+                                   size_t data_len);
+
+  /* REQUIRED with store_hibernated - gives back what store_hibernated stored
+   * for the conversation. The data has to be allocated with malloc, and the
+   * library takes ownership of it, freeing it with free. */
+  otrng_result (*load_hibernated)(const struct otrng_s *, uint8_t **data,
+                                  size_t *data_len);
+
+  /* OPTIONAL - called when a conversation is freed while what
+   * store_hibernated stored for it has not been loaded back. It can be
+   * deleted: it is encrypted with a key that only lives as long as the
+   * client, so nothing can read it anymore. */
+  void (*discard_hibernated)(const struct otrng_s *);
 } otrng_client_callbacks_s;
 
 INTERNAL int
@@ -319,6 +352,29 @@ INTERNAL void otrng_client_callbacks_smp_update(
     const otrng_client_callbacks_s *cb, const otrng_smp_event event,
     const uint8_t progress_percent, const struct otrng_s *conv);
 
+INTERNAL void
+otrng_client_callbacks_smp_async_done(const otrng_client_callbacks_s *cb,
+                                      const struct otrng_s *conv);
+
+INTERNAL void otrng_client_callbacks_startup_report(
+    const otrng_client_callbacks_s *cb, struct otrng_client_s *client,
+    const struct otrng_client_startup_report_s *report);
+
+INTERNAL otrng_bool
+otrng_client_callbacks_stores_hibernated(const otrng_client_callbacks_s *cb);
+
+INTERNAL otrng_result otrng_client_callbacks_store_hibernated(
+    const otrng_client_callbacks_s *cb, const struct otrng_s *conv,
+    const uint8_t *data, size_t data_len);
+
+INTERNAL otrng_result otrng_client_callbacks_load_hibernated(
+    const otrng_client_callbacks_s *cb, const struct otrng_s *conv,
+    uint8_t **data, size_t *data_len);
+
+INTERNAL void
+otrng_client_callbacks_discard_hibernated(const otrng_client_callbacks_s *cb,
+                                          const struct otrng_s *conv);
+
 INTERNAL void otrng_client_callbacks_display_error_message(
     const otrng_client_callbacks_s *cb, const otrng_error_event event,
     string_p *to_display, const struct otrng_s *conv);
@@ -21,10 +21,16 @@
 #define OTRNG_CLIENT_ORCHESTRATION_PRIVATE
 
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
+#include "alloc.h"
 #include "client_orchestration.h"
 #include "debug.h"
 #include "messaging.h"
+#include "trace.h"
+#include "worker.h"
+#include "write_back.h"
 
 tstatic void signal_error_in_state_management(otrng_client_s *client,
                                               const char *area) {
@@ -34,76 +40,240 @@ tstatic void signal_error_in_state_management(otrng_client_s *client,
       stderr, "encountered error when trying to ensure OTR state: %s\n", area);
 }
 
+static uint64_t monotonic_us(void) {
+  struct timespec now;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+static const char *startup_phase_names[OTRNG_STARTUP_PHASE_COUNT] = {
+    "load_privkey_v4",
+    "load_privkey_v3",
+    "load_forging_key",
+    "load_client_profile",
+    "load_expired_client_profile",
+    "load_prekey_profile",
+    "load_expired_prekey_profile",
+    "load_prekey_messages",
+    "load_fingerprints_v4",
+    "load_fingerprints_v3",
+    "create_privkey_v4",
+    "create_privkey_v3",
+    "create_forging_key",
+    "create_client_profile",
+    "create_prekey_profile",
+    "create_prekey_messages",
+    "create_fingerprints_v4",
+    "create_fingerprints_v3",
+    "ensure_long_term_key",
+    "ensure_long_term_key_v3",
+    "ensure_forging_key",
+    "ensure_client_profile",
+    "ensure_expired_client_profile",
+    "ensure_prekey_profile",
+    "ensure_expired_prekey_profile",
+    "ensure_prekey_messages",
+    "ensure_fingerprints_v4",
+    "ensure_fingerprints_v3",
+};
+
+API const char *otrng_startup_phase_name(otrng_startup_phase phase) {
+  if ((int)phase < 0 || phase >= OTRNG_STARTUP_PHASE_COUNT) {
+    return "unknown";
+  }
+
+  return startup_phase_names[phase];
+}
+
+/* Steps are only timed when the application asked for a startup report */
+static uint64_t phase_start(const otrng_client_s *client) {
+  if (!client->startup_report) {
+    return 0;
+  }
+
+  return monotonic_us();
+}
+
+static void phase_end(otrng_client_s *client, otrng_startup_phase phase,
+                      uint64_t start) {
+  otrng_startup_phase_timing_s *timing;
+
+  if (!client->startup_report) {
+    return;
+  }
+
+  timing = &client->startup_report->phases[phase];
+  timing->calls++;
+  timing->total_us += monotonic_us() - start;
+}
+
+/* The steps are traced for the client, outside of any conversation. Several
+   clients can be brought up at once, so their spans are kept apart by the
+   client they belong to */
+static inline void step_begin(otrng_trace_span_s *span, const char *name,
+                              const otrng_client_s *client) {
+  otrng_trace_begin(span, name, client->trace_id, 0, 0, 0, 0);
+}
+
+static inline void step_end(const otrng_trace_span_s *span) {
+  otrng_trace_end(span, OTRNG_SUCCESS);
+}
+
+/* Calls into the application are made with the global state lock held. The
+   lock is recursive, and a parallel startup already holds it for the whole
+   step of the client (see startup_job_run) */
+static void call_application(otrng_client_s *client,
+                             void (*callback)(otrng_client_s *client)) {
+  otrng_global_state_lock(client->global_state);
+  callback(client);
+  otrng_global_state_unlock(client->global_state);
+}
+
+/* The loaders below skip sections that are dirty in the write-back layer,
+   since what is in memory is newer than what is stored for them */
+
 tstatic void load_long_term_keys_from_storage(otrng_client_s *client) {
-  otrng_debug_enter("orchestration.load_long_term_keys_from_storage");
-  client->global_state->callbacks->load_privkey_v4(client);
-  otrng_debug_exit("orchestration.load_long_term_keys_from_storage");
+  uint64_t start = phase_start(client);
+  otrng_trace_span_s span;
+
+  step_begin(&span, "orchestration.load_long_term_keys_from_storage", client);
+  if (!otrng_client_is_dirty(client, OTRNG_SECTION_PRIVKEY_V4)) {
+    call_application(client, client->global_state->callbacks->load_privkey_v4);
+  }
+  step_end(&span);
+  phase_end(client, OTRNG_STARTUP_LOAD_PRIVKEY_V4, start);
 }
 
 tstatic void load_long_term_keys_v3_from_storage(otrng_client_s *client) {
-  otrng_debug_enter("orchestration.load_long_term_keys_v3_from_storage");
-  client->global_state->callbacks->load_privkey_v3(client);
-  otrng_debug_exit("orchestration.load_long_term_keys_v3_from_storage");
+  uint64_t start = phase_start(client);
+  otrng_trace_span_s span;
+
+  step_begin(&span, "orchestration.load_long_term_keys_v3_from_storage",
+             client);
+  if (!otrng_client_is_dirty(client, OTRNG_SECTION_PRIVKEY_V3)) {
+    call_application(client, client->global_state->callbacks->load_privkey_v3);
+  }
+  step_end(&span);
+  phase_end(client, OTRNG_STARTUP_LOAD_PRIVKEY_V3, start);
 }
 
 tstatic void load_forging_key_from_storage(otrng_client_s *client) {
-  otrng_debug_enter("orchestration.load_forging_key_from_storage");
-  client->global_state->callbacks->load_forging_key(client);
-  otrng_debug_exit("orchestration.load_forging_key_from_storage");
+  uint64_t start = phase_start(client);
+  otrng_trace_span_s span;
+
+  step_begin(&span, "orchestration.load_forging_key_from_storage", client);
+  if (!otrng_client_is_dirty(client, OTRNG_SECTION_FORGING_KEY)) {
+    call_application(client, client->global_state->callbacks->load_forging_key);
+  }
+  step_end(&span);
+  phase_end(client, OTRNG_STARTUP_LOAD_FORGING_KEY, start);
 }
 
 tstatic void create_long_term_keys(otrng_client_s *client) {
-  otrng_debug_enter("orchestration.create_long_term_keys");
-  client->global_state->callbacks->create_privkey_v4(client);
-  otrng_debug_exit("orchestration.create_long_term_keys");
+  uint64_t start = phase_start(client);
+  otrng_trace_span_s span;
+
+  step_begin(&span, "orchestration.create_long_term_keys", client);
+  call_application(client, client->global_state->callbacks->create_privkey_v4);
+  step_end(&span);
+  phase_end(client, OTRNG_STARTUP_CREATE_PRIVKEY_V4, start);
 }
 
 tstatic void create_long_term_keys_v3(otrng_client_s *client) {
-  otrng_debug_enter("orchestration.create_long_term_keys_v3");
-  client->global_state->callbacks->create_privkey_v3(client);
-  otrng_debug_exit("orchestration.create_long_term_keys_v3");
+  uint64_t start = phase_start(client);
+  otrng_trace_span_s span;
+
+  step_begin(&span, "orchestration.create_long_term_keys_v3", client);
+  call_application(client, client->global_state->callbacks->create_privkey_v3);
+  step_end(&span);
+  phase_end(client, OTRNG_STARTUP_CREATE_PRIVKEY_V3, start);
 }
 
 tstatic void create_forging_key(otrng_client_s *client) {
-  otrng_debug_enter("orchestration.create_forging_key");
-  client->global_state->callbacks->create_forging_key(client);
-  otrng_debug_exit("orchestration.create_forging_key");
+  uint64_t start = phase_start(client);
+  otrng_trace_span_s span;
+
+  step_begin(&span, "orchestration.create_forging_key", client);
+  call_application(client, client->global_state->callbacks->create_forging_key);
+  step_end(&span);
+  phase_end(client, OTRNG_STARTUP_CREATE_FORGING_KEY, start);
 }
 
 tstatic void load_client_profile_from_storage(otrng_client_s *client) {
-  otrng_debug_enter("orchestration.load_client_profile_from_storage");
-  client->global_state->callbacks->load_client_profile(client);
-  otrng_debug_exit("orchestration.load_client_profile_from_storage");
+  uint64_t start = phase_start(client);
+  otrng_trace_span_s span;
+
+  step_begin(&span, "orchestration.load_client_profile_from_storage", client);
+  if (!otrng_client_is_dirty(client, OTRNG_SECTION_CLIENT_PROFILE)) {
+    call_application(client,
+                     client->global_state->callbacks->load_client_profile);
+  }
+  step_end(&span);
+  phase_end(client, OTRNG_STARTUP_LOAD_CLIENT_PROFILE, start);
 }
 
 tstatic void load_expired_client_profile_from_storage(otrng_client_s *client) {
-  otrng_debug_enter("orchestration.load_expired_client_profile_from_storage");
-  client->global_state->callbacks->load_expired_client_profile(client);
-  otrng_debug_exit("orchestration.load_expired_client_profile_from_storage");
+  uint64_t start = phase_start(client);
+  otrng_trace_span_s span;
+
+  step_begin(&span,
+             "orchestration.load_expired_client_profile_from_storage", client);
+  if (!otrng_client_is_dirty(client, OTRNG_SECTION_EXPIRED_CLIENT_PROFILE)) {
+    call_application(
+        client, client->global_state->callbacks->load_expired_client_profile);
+  }
+  step_end(&span);
+  phase_end(client, OTRNG_STARTUP_LOAD_EXPIRED_CLIENT_PROFILE, start);
 }
 
 tstatic void load_expired_prekey_profile_from_storage(otrng_client_s *client) {
-  otrng_debug_enter("orchestration.load_expired_prekey_profile_from_storage");
-  client->global_state->callbacks->load_expired_prekey_profile(client);
-  otrng_debug_exit("orchestration.load_expired_prekey_profile_from_storage");
+  uint64_t start = phase_start(client);
+  otrng_trace_span_s span;
+
+  step_begin(&span,
+             "orchestration.load_expired_prekey_profile_from_storage", client);
+  if (!otrng_client_is_dirty(client, OTRNG_SECTION_EXPIRED_PREKEY_PROFILE)) {
+    call_application(
+        client, client->global_state->callbacks->load_expired_prekey_profile);
+  }
+  step_end(&span);
+  phase_end(client, OTRNG_STARTUP_LOAD_EXPIRED_PREKEY_PROFILE, start);
 }
 
 tstatic void create_client_profile(otrng_client_s *client) {
-  otrng_debug_enter("orchestration.create_client_profile");
-  client->global_state->callbacks->create_client_profile(client);
-  otrng_debug_exit("orchestration.create_client_profile");
+  uint64_t start = phase_start(client);
+  otrng_trace_span_s span;
+
+  step_begin(&span, "orchestration.create_client_profile", client);
+  call_application(client,
+                   client->global_state->callbacks->create_client_profile);
+  step_end(&span);
+  phase_end(client, OTRNG_STARTUP_CREATE_CLIENT_PROFILE, start);
 }
 
 tstatic void load_prekey_profile_from_storage(otrng_client_s *client) {
-  otrng_debug_enter("orchestration.load_prekey_profile_from_storage");
-  client->global_state->callbacks->load_prekey_profile(client);
-  otrng_debug_exit("orchestration.load_prekey_profile_from_storage");
+  uint64_t start = phase_start(client);
+  otrng_trace_span_s span;
+
+  step_begin(&span, "orchestration.load_prekey_profile_from_storage", client);
+  if (!otrng_client_is_dirty(client, OTRNG_SECTION_PREKEY_PROFILE)) {
+    call_application(client,
+                     client->global_state->callbacks->load_prekey_profile);
+  }
+  step_end(&span);
+  phase_end(client, OTRNG_STARTUP_LOAD_PREKEY_PROFILE, start);
 }
 
 tstatic void create_prekey_profile(otrng_client_s *client) {
-  otrng_debug_enter("orchestration.create_prekey_profile");
-  client->global_state->callbacks->create_prekey_profile(client);
-  otrng_debug_exit("orchestration.create_prekey_profile");
+  uint64_t start = phase_start(client);
+  otrng_trace_span_s span;
+
+  step_begin(&span, "orchestration.create_prekey_profile", client);
+  call_application(client,
+                   client->global_state->callbacks->create_prekey_profile);
+  step_end(&span);
+  phase_end(client, OTRNG_STARTUP_CREATE_PREKEY_PROFILE, start);
 }
 
 tstatic void clean_client_profile(otrng_client_s *client) {
@@ -164,7 +334,7 @@ tstatic otrng_bool ensure_valid_long_term_key(otrng_client_s *client) {
   if (verify_valid_long_term_key(client)) {
     clean_client_profile(client);
     clean_prekey_profile(client);
-    client->global_state->callbacks->store_privkey_v4(client);
+    otrng_client_store_section(client, OTRNG_SECTION_PRIVKEY_V4);
     return otrng_true;
   }
 
@@ -187,7 +357,7 @@ tstatic otrng_bool ensure_valid_forging_key(otrng_client_s *client) {
 
   if (verify_valid_forging_key(client)) {
     clean_client_profile(client);
-    client->global_state->callbacks->store_forging_key(client);
+    otrng_client_store_section(client, OTRNG_SECTION_FORGING_KEY);
     return otrng_true;
   }
 
@@ -268,18 +438,22 @@ tstatic otrng_bool verify_valid_prekey_profile(otrng_client_s *client) {
 }
 
 tstatic void move_client_profile_to_expired(otrng_client_s *client) {
-  otrng_debug_enter("move_client_profile_to_expired");
+  otrng_trace_span_s span;
+
+  step_begin(&span, "orchestration.move_client_profile_to_expired", client);
   clean_expired_client_profile(client);
   client->exp_client_profile = client->client_profile;
   client->client_profile = NULL;
 
-  client->global_state->callbacks->store_expired_client_profile(client);
+  otrng_client_store_section(client, OTRNG_SECTION_EXPIRED_CLIENT_PROFILE);
 
-  otrng_debug_exit("move_client_profile_to_expired");
+  step_end(&span);
 }
 
 tstatic void move_prekey_profile_to_expired(otrng_client_s *client) {
-  otrng_debug_enter("move_prekey_profile_to_expired");
+  otrng_trace_span_s span;
+
+  step_begin(&span, "orchestration.move_prekey_profile_to_expired", client);
 
   if (client->exp_prekey_profile) {
     otrng_prekey_profile_free(client->exp_prekey_profile);
@@ -288,9 +462,9 @@ tstatic void move_prekey_profile_to_expired(otrng_client_s *client) {
   client->exp_prekey_profile = client->prekey_profile;
   client->prekey_profile = NULL;
 
-  client->global_state->callbacks->store_expired_prekey_profile(client);
+  otrng_client_store_section(client, OTRNG_SECTION_EXPIRED_PREKEY_PROFILE);
 
-  otrng_debug_exit("move_prekey_profile_to_expired");
+  step_end(&span);
 }
 
 tstatic void check_if_expired_client_profile(otrng_client_s *client) {
@@ -363,7 +537,7 @@ tstatic otrng_bool ensure_valid_client_profile(otrng_client_s *client) {
     client->client_profile->should_publish = otrng_true;
     client->should_publish = otrng_true;
 
-    client->global_state->callbacks->store_client_profile(client);
+    otrng_client_store_section(client, OTRNG_SECTION_CLIENT_PROFILE);
     return otrng_true;
   }
 
@@ -385,7 +559,7 @@ tstatic void ensure_valid_expired_client_profile(otrng_client_s *client) {
   }
 
   clean_expired_client_profile(client);
-  client->global_state->callbacks->store_expired_client_profile(client);
+  otrng_client_store_section(client, OTRNG_SECTION_EXPIRED_CLIENT_PROFILE);
 }
 
 tstatic void ensure_valid_expired_prekey_profile(otrng_client_s *client) {
@@ -401,7 +575,7 @@ tstatic void ensure_valid_expired_prekey_profile(otrng_client_s *client) {
   }
 
   clean_expired_prekey_profile(client);
-  client->global_state->callbacks->store_expired_prekey_profile(client);
+  otrng_client_store_section(client, OTRNG_SECTION_EXPIRED_PREKEY_PROFILE);
 }
 
 tstatic otrng_bool ensure_valid_prekey_profile(otrng_client_s *client) {
@@ -430,7 +604,7 @@ tstatic otrng_bool ensure_valid_prekey_profile(otrng_client_s *client) {
     client->prekey_profile->should_publish = otrng_true;
     client->should_publish = otrng_true;
 
-    client->global_state->callbacks->store_prekey_profile(client);
+    otrng_client_store_section(client, OTRNG_SECTION_PREKEY_PROFILE);
     return otrng_true;
   }
 
@@ -440,37 +614,48 @@ tstatic otrng_bool ensure_valid_prekey_profile(otrng_client_s *client) {
 }
 
 tstatic void create_new_prekey_messages(otrng_client_s *client) {
+  uint64_t start = phase_start(client);
+  otrng_trace_span_s span;
   prekey_message_s **messages;
   size_t ix;
   uint8_t to_publish =
-      client->max_published_prekey_msg - otrng_list_len(client->our_prekeys);
+      client->max_published_prekey_msg -
+      otrng_client_prekey_messages_count(client);
 
   if (client->prekey_msgs_num_to_publish > to_publish) {
     to_publish = client->prekey_msgs_num_to_publish;
   }
 
   if (to_publish > 0) {
-    otrng_debug_enter("create_new_prekey_messages > 0");
+    step_begin(&span, "orchestration.create_new_prekey_messages", client);
     client->prekey_msgs_num_to_publish = 0;
 
-    messages = otrng_client_build_prekey_messages(to_publish, client);
+    messages = otrng_client_build_prekey_messages_unlocked(to_publish, client);
     for (ix = 0; ix < to_publish; ix++) {
       messages[ix]->should_publish = otrng_true;
     }
     otrng_free(messages);
 
-    otrng_debug_exit("create_new_prekey_messages > 0");
+    step_end(&span);
   }
+  phase_end(client, OTRNG_STARTUP_CREATE_PREKEY_MESSAGES, start);
 }
 
 tstatic void load_prekey_messages_from_storage(otrng_client_s *client) {
-  otrng_debug_enter("orchestration.load_prekey_messages_from_storage");
-  client->global_state->callbacks->load_prekey_messages(client);
-  otrng_debug_exit("orchestration.load_prekey_messages_from_storage");
+  uint64_t start = phase_start(client);
+  otrng_trace_span_s span;
+
+  step_begin(&span, "orchestration.load_prekey_messages_from_storage", client);
+  if (!otrng_client_is_dirty(client, OTRNG_SECTION_PREKEY_MESSAGES)) {
+    call_application(client,
+                     client->global_state->callbacks->load_prekey_messages);
+  }
+  step_end(&span);
+  phase_end(client, OTRNG_STARTUP_LOAD_PREKEY_MESSAGES, start);
 }
 
 tstatic otrng_bool verify_enough_prekey_messages(otrng_client_s *client) {
-  if (otrng_list_len(client->our_prekeys) >=
+  if (otrng_client_prekey_messages_count(client) >=
       client->minimum_stored_prekey_msg) {
     return otrng_true;
   }
@@ -492,7 +677,7 @@ tstatic otrng_bool ensure_enough_prekey_messages(otrng_client_s *client) {
 
   if (verify_enough_prekey_messages(client)) {
     client->should_publish = otrng_true;
-    client->global_state->callbacks->store_prekey_messages(client);
+    otrng_client_store_section(client, OTRNG_SECTION_PREKEY_MESSAGES);
     return otrng_true;
   }
 
@@ -501,12 +686,17 @@ tstatic otrng_bool ensure_enough_prekey_messages(otrng_client_s *client) {
 }
 
 tstatic otrng_bool verify_valid_long_term_key_v3(otrng_client_s *client) {
-  if (otrl_privkey_find(client->global_state->user_state_v3,
-                        client->client_id.account,
-                        client->client_id.protocol) != NULL) {
-    return otrng_true;
-  }
-  return otrng_false;
+  otrng_bool found;
+
+  otrng_global_state_lock(client->global_state);
+  found = otrl_privkey_find(client->global_state->user_state_v3,
+                            client->client_id.account,
+                            client->client_id.protocol) != NULL
+              ? otrng_true
+              : otrng_false;
+  otrng_global_state_unlock(client->global_state);
+
+  return found;
 }
 
 tstatic otrng_bool ensure_valid_long_term_key_v3(otrng_client_s *client) {
@@ -524,7 +714,7 @@ tstatic otrng_bool ensure_valid_long_term_key_v3(otrng_client_s *client) {
 
   if (verify_valid_long_term_key_v3(client)) {
     clean_client_profile(client);
-    client->global_state->callbacks->store_privkey_v3(client);
+    otrng_client_store_section(client, OTRNG_SECTION_PRIVKEY_V3);
     return otrng_true;
   }
 
@@ -540,29 +730,55 @@ tstatic otrng_bool verify_valid_fingerprints(otrng_client_s *client) {
 }
 
 tstatic otrng_bool verify_valid_fingerprints_v3(otrng_client_s *client) {
-  return client->global_state->fingerprints_v3_loaded;
+  otrng_bool loaded;
+
+  otrng_global_state_lock(client->global_state);
+  loaded = client->global_state->fingerprints_v3_loaded;
+  otrng_global_state_unlock(client->global_state);
+
+  return loaded;
 }
 
 tstatic void load_fingerprints_from_storage(otrng_client_s *client) {
-  otrng_debug_enter("load_fingerprints_from_storage");
-  client->global_state->callbacks->load_fingerprints_v4(client);
-  otrng_debug_exit("load_fingerprints_from_storage");
+  uint64_t start = phase_start(client);
+  otrng_trace_span_s span;
+
+  step_begin(&span, "orchestration.load_fingerprints_from_storage", client);
+  if (!otrng_client_is_dirty(client, OTRNG_SECTION_FINGERPRINTS_V4)) {
+    call_application(client,
+                     client->global_state->callbacks->load_fingerprints_v4);
+  }
+  step_end(&span);
+  phase_end(client, OTRNG_STARTUP_LOAD_FINGERPRINTS_V4, start);
 }
 
 tstatic void load_fingerprints_v3_from_storage(otrng_client_s *client) {
-  otrng_debug_enter("load_fingerprints_v3_from_storage");
-  client->global_state->callbacks->load_fingerprints_v3(client);
-  otrng_debug_exit("load_fingerprints_v3_from_storage");
+  uint64_t start = phase_start(client);
+  otrng_trace_span_s span;
+
+  step_begin(&span, "orchestration.load_fingerprints_v3_from_storage", client);
+  call_application(client,
+                   client->global_state->callbacks->load_fingerprints_v3);
+  step_end(&span);
+  phase_end(client, OTRNG_STARTUP_LOAD_FINGERPRINTS_V3, start);
 }
 
 tstatic void create_fingerprints(otrng_client_s *client) {
+  uint64_t start = phase_start(client);
+
   client->fingerprints = otrng_xmalloc_z(sizeof(otrng_known_fingerprints_s));
+  phase_end(client, OTRNG_STARTUP_CREATE_FINGERPRINTS_V4, start);
 }
 
 tstatic void create_fingerprints_v3(otrng_client_s *client) {
+  uint64_t start = phase_start(client);
+
   /* So, this doesn't really need to do much, because the structures for v3
    * storage are self creating */
+  otrng_global_state_lock(client->global_state);
   otrng_global_state_fingerprints_v3_loaded(client->global_state);
+  otrng_global_state_unlock(client->global_state);
+  phase_end(client, OTRNG_STARTUP_CREATE_FINGERPRINTS_V3, start);
 }
 
 tstatic void ensure_loaded_fingerprints(otrng_client_s *client) {
@@ -579,7 +795,7 @@ tstatic void ensure_loaded_fingerprints(otrng_client_s *client) {
   create_fingerprints(client);
 
   if (verify_valid_fingerprints(client)) {
-    client->global_state->callbacks->store_fingerprints_v4(client);
+    otrng_client_store_section(client, OTRNG_SECTION_FINGERPRINTS_V4);
     return;
   }
 
@@ -606,56 +822,103 @@ tstatic void ensure_loaded_fingerprints_v3(otrng_client_s *client) {
   signal_error_in_state_management(client, "Couldn't load v3 fingerprints");
 }
 
-/* Note, the ensure_ family of functions will check whether the
-   values are there and correct, and try to fix them if not.
-   The verify_ family of functions will just check that the values
-   are correct and return otrng_false if not. */
-/* TODO: this function should be called from the plugin every X amount of time,
-   by default every 67'th minute. This way we don't have to set specific
-   timers to check for expiry of prekey profiles and client profiles */
-API void otrng_client_ensure_correct_state(otrng_client_s *client) {
-  otrng_debug_enter("otrng_client_ensure_correct_state");
-  otrng_debug_fprintf(stderr, "client=%s\n", client->client_id.account);
+tstatic void ensure_correct_state(otrng_client_s *client) {
+  uint64_t start = phase_start(client);
+  otrng_bool ok = ensure_valid_long_term_key(client);
 
-  if (!ensure_valid_long_term_key(client)) {
-    otrng_debug_exit("otrng_client_ensure_correct_state");
+  phase_end(client, OTRNG_STARTUP_ENSURE_LONG_TERM_KEY, start);
+  if (!ok) {
     return;
   }
 
-  if (!ensure_valid_long_term_key_v3(client)) {
-    otrng_debug_exit("otrng_client_ensure_correct_state");
+  start = phase_start(client);
+  ok = ensure_valid_long_term_key_v3(client);
+  phase_end(client, OTRNG_STARTUP_ENSURE_LONG_TERM_KEY_V3, start);
+  if (!ok) {
     return;
   }
 
-  if (!ensure_valid_forging_key(client)) {
-    otrng_debug_exit("otrng_client_ensure_correct_state");
+  start = phase_start(client);
+  ok = ensure_valid_forging_key(client);
+  phase_end(client, OTRNG_STARTUP_ENSURE_FORGING_KEY, start);
+  if (!ok) {
     return;
   }
 
-  if (!ensure_valid_client_profile(client)) {
-    otrng_debug_exit("otrng_client_ensure_correct_state");
+  start = phase_start(client);
+  ok = ensure_valid_client_profile(client);
+  phase_end(client, OTRNG_STARTUP_ENSURE_CLIENT_PROFILE, start);
+  if (!ok) {
     return;
   }
 
+  start = phase_start(client);
   ensure_valid_expired_client_profile(client);
+  phase_end(client, OTRNG_STARTUP_ENSURE_EXPIRED_CLIENT_PROFILE, start);
 
-  if (!ensure_valid_prekey_profile(client)) {
-    otrng_debug_exit("otrng_client_ensure_correct_state");
+  start = phase_start(client);
+  ok = ensure_valid_prekey_profile(client);
+  phase_end(client, OTRNG_STARTUP_ENSURE_PREKEY_PROFILE, start);
+  if (!ok) {
     return;
   }
 
+  start = phase_start(client);
   ensure_valid_expired_prekey_profile(client);
+  phase_end(client, OTRNG_STARTUP_ENSURE_EXPIRED_PREKEY_PROFILE, start);
 
-  if (!ensure_enough_prekey_messages(client)) {
-    otrng_debug_exit("otrng_client_ensure_correct_state");
+  start = phase_start(client);
+  ok = ensure_enough_prekey_messages(client);
+  phase_end(client, OTRNG_STARTUP_ENSURE_PREKEY_MESSAGES, start);
+  if (!ok) {
     return;
   }
 
+  otrng_client_refill_prekey_reservoir(client);
+
+  start = phase_start(client);
   ensure_loaded_fingerprints(client);
+  phase_end(client, OTRNG_STARTUP_ENSURE_FINGERPRINTS_V4, start);
 
+  start = phase_start(client);
   ensure_loaded_fingerprints_v3(client);
+  phase_end(client, OTRNG_STARTUP_ENSURE_FINGERPRINTS_V3, start);
+}
+
+/* Note, the ensure_ family of functions will check whether the
+   values are there and correct, and try to fix them if not.
+   The verify_ family of functions will just check that the values
+   are correct and return otrng_false if not. */
+/* TODO: this function should be called from the plugin every X amount of time,
+   by default every 67'th minute. This way we don't have to set specific
+   timers to check for expiry of prekey profiles and client profiles */
+API void otrng_client_ensure_correct_state(otrng_client_s *client) {
+  otrng_client_startup_report_s report;
+  uint64_t start = 0;
+  otrng_trace_span_s span;
+
+  step_begin(&span, "orchestration.ensure_correct_state", client);
+  otrng_debug_fprintf(stderr, "client=%s\n", client->client_id.account);
+
+  if (client->global_state->callbacks->startup_report) {
+    memset(&report, 0, sizeof(otrng_client_startup_report_s));
+    client->startup_report = &report;
+    start = monotonic_us();
+  }
+
+  ensure_correct_state(client);
 
-  otrng_debug_exit("otrng_client_ensure_correct_state");
+  if (client->startup_report) {
+    report.total_us = monotonic_us() - start;
+    report.ready = otrng_client_verify_correct_state(client);
+    otrng_global_state_lock(client->global_state);
+    otrng_client_callbacks_startup_report(client->global_state->callbacks,
+                                          client, &report);
+    otrng_global_state_unlock(client->global_state);
+    client->startup_report = NULL;
+  }
+
+  step_end(&span);
 }
 
 API otrng_bool otrng_client_verify_correct_state(otrng_client_s *client) {
@@ -681,3 +944,106 @@ API otrng_bool otrng_client_verify_correct_state(otrng_client_s *client) {
 
   return otrng_true;
 }
+
+/* The callbacks that load and store a client can read and replace what the
+   other clients hold: the ones reading from a file load the records of every
+   client in it, and the ones writing to it walk every client. So the lock is
+   held for the whole step of a client, and only given up while its prekey
+   messages are generated, on keys that nothing else can see yet */
+tstatic void startup_job_run(void *data) {
+  startup_job_s *job = data;
+  otrng_global_state_s *gs = job->client->global_state;
+  uint64_t start = monotonic_us();
+
+  otrng_global_state_lock(gs);
+  otrng_client_ensure_correct_state(job->client);
+  job->ready = otrng_client_verify_correct_state(job->client);
+  otrng_global_state_unlock(gs);
+
+  job->elapsed_us = monotonic_us() - start;
+}
+
+API otrng_result otrng_global_state_ensure_correct_state(
+    otrng_global_state_s *gs, unsigned int num_threads,
+    /*@null@*/ void (*progress)(const otrng_client_s *client,
+                                otrng_bool ready, size_t done, size_t total,
+                                void *ctx),
+    /*@null@*/ void *ctx, /*@null@*/ otrng_startup_report_s *report) {
+  otrng_startup_report_s r;
+  startup_job_s *jobs;
+  otrng_worker_s *worker = NULL;
+  pthread_mutex_t lock;
+  pthread_mutexattr_t attr;
+  list_element_s *current;
+  uint64_t start = monotonic_us();
+  size_t i;
+
+  memset(&r, 0, sizeof(otrng_startup_report_s));
+  r.num_clients = otrng_list_len(gs->clients);
+
+  if (num_threads > r.num_clients) {
+    num_threads = r.num_clients;
+  }
+  if (num_threads > 1) {
+    worker = otrng_worker_new(num_threads);
+  }
+  r.num_threads = worker ? num_threads : 1;
+
+  if (worker) {
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    gs->shared_lock = &lock;
+  }
+
+  jobs = otrng_xmalloc_z((r.num_clients ? r.num_clients : 1) *
+                         sizeof(startup_job_s));
+  for (i = 0, current = gs->clients; current; i++, current = current->next) {
+    jobs[i].job.run = startup_job_run;
+    jobs[i].job.data = &jobs[i];
+    jobs[i].client = current->data;
+    if (worker) {
+      otrng_worker_submit(worker, &jobs[i].job);
+    }
+  }
+
+  /* Progress is reported from the calling thread, in the order the clients
+     are in the global state */
+  for (i = 0; i < r.num_clients; i++) {
+    if (worker) {
+      otrng_worker_job_wait(worker, &jobs[i].job);
+    } else {
+      startup_job_run(&jobs[i]);
+    }
+
+    if (jobs[i].ready) {
+      r.num_ready++;
+    }
+    r.clients_us += jobs[i].elapsed_us;
+
+    if (progress) {
+      otrng_global_state_lock(gs);
+      progress(jobs[i].client, jobs[i].ready, i + 1, r.num_clients, ctx);
+      otrng_global_state_unlock(gs);
+    }
+  }
+
+  if (worker) {
+    otrng_worker_free(worker);
+    gs->shared_lock = NULL;
+    pthread_mutex_destroy(&lock);
+  }
+  otrng_free(jobs);
+
+  r.wall_clock_us = monotonic_us() - start;
+  if (report) {
+    *report = r;
+  }
+
+  if (r.num_ready != r.num_clients) {
+    return OTRNG_ERROR;
+  }
+
+  return OTRNG_SUCCESS;
+}
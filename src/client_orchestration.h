@@ -22,10 +22,130 @@
 #define OTRNG_CLIENT_ORCHESTRATION_H
 
 #include "client.h"
+#include "messaging.h"
 #include "shared.h"
+#include "worker.h"
+
+/* The steps of otrng_client_ensure_correct_state. The time of an ensure_
+   step includes the load_ and create_ steps it makes, so the time spent
+   validating is what is left once those are subtracted. */
+typedef enum {
+  OTRNG_STARTUP_LOAD_PRIVKEY_V4 = 0,
+  OTRNG_STARTUP_LOAD_PRIVKEY_V3,
+  OTRNG_STARTUP_LOAD_FORGING_KEY,
+  OTRNG_STARTUP_LOAD_CLIENT_PROFILE,
+  OTRNG_STARTUP_LOAD_EXPIRED_CLIENT_PROFILE,
+  OTRNG_STARTUP_LOAD_PREKEY_PROFILE,
+  OTRNG_STARTUP_LOAD_EXPIRED_PREKEY_PROFILE,
+  OTRNG_STARTUP_LOAD_PREKEY_MESSAGES,
+  OTRNG_STARTUP_LOAD_FINGERPRINTS_V4,
+  OTRNG_STARTUP_LOAD_FINGERPRINTS_V3,
+  OTRNG_STARTUP_CREATE_PRIVKEY_V4,
+  OTRNG_STARTUP_CREATE_PRIVKEY_V3,
+  OTRNG_STARTUP_CREATE_FORGING_KEY,
+  OTRNG_STARTUP_CREATE_CLIENT_PROFILE,
+  OTRNG_STARTUP_CREATE_PREKEY_PROFILE,
+  OTRNG_STARTUP_CREATE_PREKEY_MESSAGES,
+  OTRNG_STARTUP_CREATE_FINGERPRINTS_V4,
+  OTRNG_STARTUP_CREATE_FINGERPRINTS_V3,
+  OTRNG_STARTUP_ENSURE_LONG_TERM_KEY,
+  OTRNG_STARTUP_ENSURE_LONG_TERM_KEY_V3,
+  OTRNG_STARTUP_ENSURE_FORGING_KEY,
+  OTRNG_STARTUP_ENSURE_CLIENT_PROFILE,
+  OTRNG_STARTUP_ENSURE_EXPIRED_CLIENT_PROFILE,
+  OTRNG_STARTUP_ENSURE_PREKEY_PROFILE,
+  OTRNG_STARTUP_ENSURE_EXPIRED_PREKEY_PROFILE,
+  OTRNG_STARTUP_ENSURE_PREKEY_MESSAGES,
+  OTRNG_STARTUP_ENSURE_FINGERPRINTS_V4,
+  OTRNG_STARTUP_ENSURE_FINGERPRINTS_V3,
+} otrng_startup_phase;
+
+#define OTRNG_STARTUP_PHASE_COUNT 28
+
+typedef struct otrng_startup_phase_timing_s {
+  unsigned int calls;
+  uint64_t total_us;
+} otrng_startup_phase_timing_s;
+
+/**
+ * @brief The time spent in each step of one otrng_client_ensure_correct_state,
+ *    given to the startup_report callback. Steps that did not run have no
+ *    calls.
+ *
+ *  [total_us] the time of the whole call, in microseconds.
+ *  [ready]    whether the client ended up in a correct state.
+ **/
+typedef struct otrng_client_startup_report_s {
+  otrng_startup_phase_timing_s phases[OTRNG_STARTUP_PHASE_COUNT];
+  uint64_t total_us;
+  otrng_bool ready;
+} otrng_client_startup_report_s;
+
+/**
+ * @brief A name for [phase], such as "load_privkey_v4", for logging.
+ **/
+API const char *otrng_startup_phase_name(otrng_startup_phase phase);
 
 API void otrng_client_ensure_correct_state(otrng_client_s *client);
 
 API otrng_bool otrng_client_verify_correct_state(otrng_client_s *client);
 
+/**
+ * @brief Reports on a call to otrng_global_state_ensure_correct_state.
+ *
+ *  [num_clients]   the clients that were brought up.
+ *  [num_ready]     how many of them ended up in a correct state.
+ *  [num_threads]   the threads that were used.
+ *  [wall_clock_us] how long the whole call took, in microseconds.
+ *  [clients_us]    the time spent on each client, added up. Compared with
+ *                  [wall_clock_us], it shows what the threads gained.
+ **/
+typedef struct otrng_startup_report_s {
+  size_t num_clients;
+  size_t num_ready;
+  unsigned int num_threads;
+  uint64_t wall_clock_us;
+  uint64_t clients_us;
+} otrng_startup_report_s;
+
+/**
+ * @brief Brings every client of the global state to a correct state, running
+ *    otrng_client_ensure_correct_state for up to [num_threads] clients at the
+ *    same time.
+ *
+ * The callbacks of the global state are called from the worker threads, but
+ * never at the same time, and they can touch any client of the global state:
+ * each client is brought up while holding a lock over all of them. What runs
+ * in parallel is the generation of the keys of new prekey messages, which
+ * dominates bringing up a client whose keys and profiles are already
+ * stored.
+ *
+ * @param [progress] Called once for each client when it is done, from the
+ *    calling thread. [done] counts up to [total]. Can be NULL.
+ * @param [report]   Filled in when everything is done. Can be NULL.
+ *
+ * @return OTRNG_SUCCESS if every client ended up in a correct state.
+ **/
+API otrng_result otrng_global_state_ensure_correct_state(
+    otrng_global_state_s *gs, unsigned int num_threads,
+    /*@null@*/ void (*progress)(const otrng_client_s *client,
+                                otrng_bool ready, size_t done, size_t total,
+                                void *ctx),
+    /*@null@*/ void *ctx, /*@null@*/ otrng_startup_report_s *report);
+
+#ifdef OTRNG_CLIENT_ORCHESTRATION_PRIVATE
+
+typedef struct startup_job_s {
+  otrng_worker_job_s job;
+  otrng_client_s *client;
+  otrng_bool ready;
+  uint64_t elapsed_us;
+} startup_job_s;
+
+tstatic void ensure_correct_state(otrng_client_s *client);
+
+tstatic void startup_job_run(void *data);
+
+#endif
+
 #endif // OTRNG_CLIENT_ORCHESTRATION_H
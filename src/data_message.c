@@ -38,6 +38,13 @@ INTERNAL data_message_s *otrng_data_message_new() {
   return ret;
 }
 
+INTERNAL data_message_s *otrng_data_message_new_in(otrng_arena_s *arena) {
+  data_message_s *ret = otrng_arena_alloc(arena, sizeof(data_message_s));
+  ret->arena = arena;
+
+  return ret;
+}
+
 INTERNAL void otrng_data_message_free(data_message_s *data_msg) {
   if (!data_msg) {
     return;
@@ -46,9 +53,14 @@ INTERNAL void otrng_data_message_free(data_message_s *data_msg) {
   otrng_ec_point_destroy(data_msg->ecdh);
   otrng_dh_mpi_release(data_msg->dh);
   otrng_secure_wipe(data_msg->nonce, DATA_MSG_NONCE_BYTES);
-  otrng_free(data_msg->enc_msg);
   otrng_secure_wipe(data_msg->mac, DATA_MSG_MAC_BYTES);
 
+  /* The rest goes with the arena */
+  if (data_msg->arena) {
+    return;
+  }
+
+  otrng_free(data_msg->enc_msg);
   otrng_free(data_msg);
 }
 
@@ -57,7 +69,13 @@ INTERNAL otrng_result otrng_data_message_body_serialize(
   size_t size = DATA_MSG_MAX_BYTES + data_msg->enc_msg_len;
   uint8_t *cursor;
   size_t len = 0;
-  uint8_t *dst = otrng_xmalloc_z(size);
+  uint8_t *dst;
+
+  if (data_msg->arena) {
+    dst = otrng_arena_alloc(data_msg->arena, size);
+  } else {
+    dst = otrng_xmalloc_z(size);
+  }
 
   cursor = dst;
   cursor += otrng_serialize_uint16(cursor, OTRNG_PROTOCOL_VERSION_4);
@@ -73,7 +91,9 @@ INTERNAL otrng_result otrng_data_message_body_serialize(
   // TODO: @freeing @sanitizer This could be NULL. We need to test.
   if (!otrng_serialize_dh_public_key(cursor, (size - (cursor - dst)), &len,
                                      data_msg->dh)) {
-    otrng_free(dst);
+    if (!data_msg->arena) {
+      otrng_free(dst);
+    }
     return OTRNG_ERROR;
   }
   cursor += len;
@@ -197,8 +217,8 @@ INTERNAL otrng_result otrng_data_message_deserialize(data_message_s *dst,
   cursor += DATA_MSG_NONCE_BYTES;
   len -= DATA_MSG_NONCE_BYTES;
 
-  if (!otrng_deserialize_data(&dst->enc_msg, &dst->enc_msg_len, cursor, len,
-                              &read)) {
+  if (!otrng_deserialize_data_in(dst->arena, &dst->enc_msg, &dst->enc_msg_len,
+                                 cursor, len, &read)) {
     return OTRNG_ERROR;
   }
 
@@ -214,23 +234,14 @@ INTERNAL otrng_result otrng_data_message_authenticator(uint8_t *dst,
                                                        const k_msg_mac mac_key,
                                                        const uint8_t *body,
                                                        size_t body_len) {
-  uint8_t *sections = otrng_secure_alloc(HASH_BYTES);
-
   if (dst_len < DATA_MSG_MAC_BYTES) {
     return OTRNG_ERROR;
   }
 
   /* Authenticator = KDF_1(usage_authenticator || MKmac ||
    * data_message_sections, 64) */
-  if (!otrng_key_manager_calculate_authenticator(dst, mac_key, body,
-                                                 body_len)) {
-    otrng_secure_free(sections);
-    return OTRNG_ERROR;
-  }
-
-  otrng_secure_free(sections);
-
-  return OTRNG_SUCCESS;
+  return otrng_key_manager_calculate_authenticator(dst, mac_key, body,
+                                                   body_len);
 }
 
 INTERNAL otrng_bool otrng_valid_data_message(k_msg_mac mac_key,
@@ -239,18 +250,21 @@ INTERNAL otrng_bool otrng_valid_data_message(k_msg_mac mac_key,
   size_t body_len = 0;
   // We don't need this tag to be in secure memory
   uint8_t mac_tag[DATA_MSG_MAC_BYTES];
+  otrng_result result;
 
   if (!otrng_data_message_body_serialize(&body, &body_len, data_msg)) {
     return otrng_false;
   }
 
-  if (!otrng_data_message_authenticator(mac_tag, DATA_MSG_MAC_BYTES, mac_key,
-                                        body, body_len)) {
+  result = otrng_data_message_authenticator(mac_tag, DATA_MSG_MAC_BYTES,
+                                            mac_key, body, body_len);
+  if (!data_msg->arena) {
     otrng_free(body);
-    return otrng_false;
   }
 
-  otrng_free(body);
+  if (otrng_failed(result)) {
+    return otrng_false;
+  }
 
   if (sodium_memcmp(mac_tag, data_msg->mac, DATA_MSG_MAC_BYTES) != 0) {
     otrng_secure_wipe(mac_tag, DATA_MSG_MAC_BYTES);
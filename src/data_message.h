@@ -25,6 +25,7 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "alloc.h"
 #include "constants.h"
 #include "key_management.h"
 #include "shared.h"
@@ -43,12 +44,24 @@ typedef struct data_message_s {
   uint8_t *enc_msg;
   size_t enc_msg_len;
   uint8_t mac[DATA_MSG_MAC_BYTES];
+
+  /* Where the message and its buffers come from, or NULL for the heap */
+  /*@null@*/ otrng_arena_s *arena;
 } data_message_s;
 
 INTERNAL data_message_s *otrng_data_message_new(void);
 
+/**
+ * @brief Creates a data message in [arena]. Its encrypted message and the
+ *    bodies serialized from it are taken from [arena] as well, so they are
+ *    released when it is reset. The keys still have to be released with
+ *    otrng_data_message_free.
+ **/
+INTERNAL data_message_s *otrng_data_message_new_in(otrng_arena_s *arena);
+
 INTERNAL void otrng_data_message_free(data_message_s *data_msg);
 
+/* The body is freed with otrng_free, unless the message is in an arena */
 INTERNAL otrng_result otrng_data_message_body_serialize(
     uint8_t **body, size_t *bodylen, const data_message_s *data_msg);
 
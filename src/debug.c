@@ -69,7 +69,9 @@ API void otrng_debug_enable(void) {
 
 API void otrng_debug_disable(void) { debug_printing_enabled = 0; }
 
-static int debug_indent = 0;
+/* Enter and exit are called from the workers as well as the calling thread,
+   so each thread keeps its own indentation */
+static __thread int debug_indent = 0;
 
 API void otrng_debug_enter(const char *name) {
   otrng_debug_fprintf(stderr, "-> %s()\n", name);
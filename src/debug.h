@@ -43,6 +43,8 @@ INTERNAL /*@null@*/ char *_otrng_memdump(const uint8_t *src, size_t len);
 API void otrng_debug_init(void);
 API void otrng_debug_enable(void);
 API void otrng_debug_disable(void);
+/* Only print when debug printing is enabled. The library itself reports what
+   it is doing with the spans in trace.h, which can be used in production */
 API void otrng_debug_enter(const char *name);
 API void otrng_debug_exit(const char *name);
 API void otrng_debug_fprintf(FILE *f, const char *fmt, ...);
@@ -101,6 +101,13 @@ INTERNAL otrng_result otrng_deserialize_uint8(uint8_t *n, const uint8_t *buffer,
 INTERNAL otrng_result otrng_deserialize_data(uint8_t **dst, size_t *dst_len,
                                              const uint8_t *buffer,
                                              size_t buff_len, size_t *read) {
+  return otrng_deserialize_data_in(NULL, dst, dst_len, buffer, buff_len, read);
+}
+
+INTERNAL otrng_result otrng_deserialize_data_in(otrng_arena_s *arena,
+                                                uint8_t **dst, size_t *dst_len,
+                                                const uint8_t *buffer,
+                                                size_t buff_len, size_t *read) {
   size_t r = 0;
   uint32_t s = 0;
   uint8_t *t;
@@ -127,7 +134,11 @@ INTERNAL otrng_result otrng_deserialize_data(uint8_t **dst, size_t *dst_len,
     return OTRNG_ERROR;
   }
 
-  t = otrng_xmalloc_z(s);
+  if (arena) {
+    t = otrng_arena_alloc(arena, s);
+  } else {
+    t = otrng_xmalloc_z(s);
+  }
 
   memcpy(t, buffer + r, s);
 
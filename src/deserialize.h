@@ -21,6 +21,7 @@
 #ifndef OTRNG_DESERIALIZE_H
 #define OTRNG_DESERIALIZE_H
 
+#include "alloc.h"
 #include "auth.h"
 #include "ed448.h"
 #include "error.h"
@@ -45,6 +46,13 @@ INTERNAL otrng_result otrng_deserialize_data(uint8_t **dst, size_t *dst_len,
                                              const uint8_t *buffer,
                                              size_t buff_len, size_t *read);
 
+/* Like otrng_deserialize_data, but [dst] is taken from [arena] when it is not
+   NULL */
+INTERNAL otrng_result otrng_deserialize_data_in(/*@null@*/ otrng_arena_s *arena,
+                                                uint8_t **dst, size_t *dst_len,
+                                                const uint8_t *buffer,
+                                                size_t buff_len, size_t *read);
+
 INTERNAL otrng_result otrng_deserialize_bytes_array(uint8_t *dst,
                                                     size_t dst_len,
                                                     const uint8_t *buffer,
@@ -19,9 +19,11 @@
  */
 
 #include <assert.h>
+#include <string.h>
 
 #define OTRNG_DH_PRIVATE
 
+#include "alloc.h"
 #include "dh.h"
 #include "key_management.h"
 #include "random.h"
@@ -161,23 +163,19 @@ INTERNAL void otrng_dh_calculate_public_key(dh_public_key pub,
   gcry_mpi_powm(pub, DH3072_GENERATOR, priv, DH3072_MODULUS);
 }
 
-INTERNAL otrng_result otrng_dh_keypair_generate(dh_keypair_s *keypair) {
+INTERNAL otrng_result otrng_dh_keypair_generate_from_random(
+    dh_keypair_s *keypair, const uint8_t random_buffer[DH_KEY_SIZE]) {
   uint8_t *hash = otrng_secure_alloc(DH_KEY_SIZE);
   gcry_mpi_t privkey = NULL;
-  uint8_t *sec_buffer = NULL;
   gcry_error_t err;
 
-  sec_buffer = gcry_random_bytes_secure(DH_KEY_SIZE, GCRY_STRONG_RANDOM);
-  if (!shake_256_hash(hash, DH_KEY_SIZE, sec_buffer, DH_KEY_SIZE)) {
-    otrng_secure_wipe(sec_buffer, DH_KEY_SIZE);
-    gcry_free(sec_buffer);
+  if (!shake_256_hash(hash, DH_KEY_SIZE, random_buffer, DH_KEY_SIZE)) {
+    otrng_secure_free(hash);
     return OTRNG_ERROR;
   }
 
   err = gcry_mpi_scan(&privkey, GCRYMPI_FMT_USG, hash, DH_KEY_SIZE, NULL);
   otrng_secure_free(hash);
-  otrng_secure_wipe(sec_buffer, DH_KEY_SIZE);
-  gcry_free(sec_buffer);
 
   if (err) {
     return OTRNG_ERROR;
@@ -190,6 +188,18 @@ INTERNAL otrng_result otrng_dh_keypair_generate(dh_keypair_s *keypair) {
   return OTRNG_SUCCESS;
 }
 
+INTERNAL otrng_result otrng_dh_keypair_generate(dh_keypair_s *keypair) {
+  uint8_t *sec_buffer = NULL;
+  otrng_result result;
+
+  sec_buffer = gcry_random_bytes_secure(DH_KEY_SIZE, GCRY_STRONG_RANDOM);
+  result = otrng_dh_keypair_generate_from_random(keypair, sec_buffer);
+  otrng_secure_wipe(sec_buffer, DH_KEY_SIZE);
+  gcry_free(sec_buffer);
+
+  return result;
+}
+
 INTERNAL otrng_result otrng_dh_keypair_generate_from_shared_secret(
     uint8_t shared_secret[SHARED_SECRET_BYTES], dh_keypair_s *keypair,
     const char participant) {
@@ -326,6 +336,112 @@ API otrng_bool otrng_dh_mpi_valid(dh_mpi mpi) {
   return otrng_true;
 }
 
+/* Sliding window recoding of [e]: digits[j] is the odd window value to
+   multiply in after the squaring for bit j, or 0 when there is none */
+tstatic void dh_sliding_window_recode(uint8_t *digits, const dh_mpi e,
+                                      int nbits) {
+  int j = nbits - 1;
+
+  memset(digits, 0, nbits);
+
+  while (j >= 0) {
+    int low, k;
+    uint8_t value = 0;
+
+    if (!gcry_mpi_test_bit(e, j)) {
+      j--;
+      continue;
+    }
+
+    low = j - DH_MULTI_POWM_WINDOW + 1;
+    if (low < 0) {
+      low = 0;
+    }
+    while (!gcry_mpi_test_bit(e, low)) {
+      low++;
+    }
+
+    for (k = j; k >= low; k--) {
+      value = (value << 1) | (gcry_mpi_test_bit(e, k) ? 1 : 0);
+    }
+
+    digits[low] = value;
+    j = low - 1;
+  }
+}
+
+INTERNAL void otrng_dh_multi_powm(dh_mpi dst, const dh_mpi *bases,
+                                  const dh_mpi *exps, size_t len,
+                                  const dh_mpi mod) {
+  const size_t half = (size_t)1 << (DH_MULTI_POWM_WINDOW - 1);
+  dh_mpi *table;
+  dh_mpi sq;
+  uint8_t *digits;
+  int nbits = 0, j;
+  size_t i, k;
+  otrng_bool started = otrng_false;
+
+  gcry_mpi_set_ui(dst, 1);
+
+  if (len == 1) {
+    gcry_mpi_powm(dst, bases[0], exps[0], mod);
+    return;
+  }
+
+  for (i = 0; i < len; i++) {
+    int bits = (int)gcry_mpi_get_nbits(exps[i]);
+    if (bits > nbits) {
+      nbits = bits;
+    }
+  }
+
+  if (nbits == 0) {
+    return;
+  }
+
+  /* table[i * half + k] = bases[i]^(2k + 1) */
+  table = otrng_xmalloc_z(len * half * sizeof(dh_mpi));
+  digits = otrng_xmalloc_z(len * nbits);
+  sq = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+
+  for (i = 0; i < len; i++) {
+    dh_mpi *row = table + i * half;
+
+    row[0] = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+    gcry_mpi_mod(row[0], bases[i], mod);
+    gcry_mpi_mulm(sq, row[0], row[0], mod);
+    for (k = 1; k < half; k++) {
+      row[k] = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+      gcry_mpi_mulm(row[k], row[k - 1], sq, mod);
+    }
+
+    dh_sliding_window_recode(digits + i * nbits, exps[i], nbits);
+  }
+
+  for (j = nbits - 1; j >= 0; j--) {
+    if (started) {
+      gcry_mpi_mulm(dst, dst, dst, mod);
+    }
+
+    for (i = 0; i < len; i++) {
+      uint8_t digit = digits[i * nbits + j];
+      if (digit == 0) {
+        continue;
+      }
+
+      gcry_mpi_mulm(dst, dst, table[i * half + (digit - 1) / 2], mod);
+      started = otrng_true;
+    }
+  }
+
+  for (i = 0; i < len * half; i++) {
+    gcry_mpi_release(table[i]);
+  }
+  gcry_mpi_release(sq);
+  otrng_free(table);
+  otrng_free(digits);
+}
+
 INTERNAL dh_mpi otrng_dh_mpi_copy(const dh_mpi src) {
   return gcry_mpi_copy(src);
 }
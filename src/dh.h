@@ -53,6 +53,13 @@ INTERNAL void otrng_dh_calculate_public_key(dh_public_key pub,
 
 INTERNAL otrng_result otrng_dh_keypair_generate(dh_keypair_s *keypair);
 
+/**
+ * @brief Generates a keypair from the given random bytes, which are hashed
+ *    into the private key the same way otrng_dh_keypair_generate does.
+ */
+INTERNAL otrng_result otrng_dh_keypair_generate_from_random(
+    dh_keypair_s *keypair, const uint8_t random_buffer[DH_KEY_SIZE]);
+
 /**
  * @param [participant]   If this corresponds to our or their key manager. 'u'
  * for us, 't' for them
@@ -86,6 +93,25 @@ INTERNAL void otrng_dh_mpi_release(dh_mpi mpi);
 INTERNAL /*@null@*/ dh_mpi otrng_dh_modulus_q(void);
 INTERNAL /*@null@*/ dh_mpi otrng_dh_modulus_p(void);
 
+/**
+ * @brief Simultaneous multi-exponentiation:
+ *    dst = prod(bases[i]^exps[i]) mod [mod].
+ *
+ * All bases share a single chain of squarings, with an interleaved sliding
+ * window over the exponents, instead of doing one full exponentiation each.
+ *
+ * @param [dst]   The result.
+ * @param [bases] The bases.
+ * @param [exps]  The exponents.
+ * @param [len]   The number of bases and exponents.
+ * @param [mod]   The modulus.
+ *
+ * @warning This runs in variable time. Only use it with public exponents.
+ */
+INTERNAL void otrng_dh_multi_powm(dh_mpi dst, const dh_mpi *bases,
+                                  const dh_mpi *exps, size_t len,
+                                  const dh_mpi mod);
+
 #ifdef DEBUG_API
 API void otrng_dh_keypair_debug_print(FILE *, int, dh_keypair_s *);
 API void otrng_dh_public_key_debug_print(FILE *, dh_public_key);
@@ -94,6 +120,14 @@ API void otrng_dh_private_key_debug_print(FILE *, dh_private_key);
 
 #ifdef OTRNG_DH_PRIVATE
 
+/* Width of the sliding window used by otrng_dh_multi_powm. With the 352-bit
+   exponents of the prekey proofs, 4 keeps the per-base table small (8
+   entries) while cutting the multiplications to about one per 5 bits. */
+#define DH_MULTI_POWM_WINDOW 4
+
+tstatic void dh_sliding_window_recode(uint8_t *digits, const dh_mpi e,
+                                      int nbits);
+
 INTERNAL /*@null@*/ dh_mpi otrng_dh_mpi_generator(void);
 
 #endif
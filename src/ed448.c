@@ -110,6 +110,118 @@ INTERNAL void otrng_ec_point_destroy(ec_point p) {
   goldilocks_448_point_destroy(p);
 }
 
+/* Reads the [width] bits of the little endian scalar encoding [enc] starting
+   at bit [offset] */
+tstatic unsigned int ec_scalar_window(const uint8_t *enc, size_t offset,
+                                      unsigned int width) {
+  unsigned int i;
+  unsigned int digit = 0;
+
+  for (i = 0; i < width && offset + i < ED448_SCALAR_BYTES * 8; i++) {
+    digit |= (unsigned int)((enc[(offset + i) / 8] >> ((offset + i) % 8)) & 1)
+             << i;
+  }
+
+  return digit;
+}
+
+/* Window width that roughly minimizes the number of additions for [len]
+   terms: each window costs [len] bucket additions plus 2^(width+1) to
+   combine the buckets */
+tstatic unsigned int ec_msm_window_bits(size_t len) {
+  if (len < 8) {
+    return 3;
+  }
+  if (len < 32) {
+    return 4;
+  }
+  if (len < 128) {
+    return 5;
+  }
+  return 6;
+}
+
+INTERNAL void otrng_ec_point_multiscalarmul(ec_point dst,
+                                            const ec_point *points,
+                                            const ec_scalar *scalars,
+                                            size_t len) {
+  unsigned int width = ec_msm_window_bits(len);
+  size_t num_buckets = ((size_t)1 << width) - 1;
+  size_t num_windows, bits = 0, i, w, k;
+  uint8_t *enc;
+  uint8_t *used;
+  goldilocks_448_point_s *buckets;
+  goldilocks_448_point_p running, sum;
+
+  goldilocks_448_point_copy(dst, goldilocks_448_point_identity);
+  if (len == 0) {
+    return;
+  }
+
+  enc = otrng_xmalloc_z(len * ED448_SCALAR_BYTES);
+  for (i = 0; i < len; i++) {
+    uint8_t *curr = enc + i * ED448_SCALAR_BYTES;
+    size_t top = ED448_SCALAR_BYTES;
+
+    goldilocks_448_scalar_encode(curr, scalars[i]);
+    while (top > 0 && curr[top - 1] == 0) {
+      top--;
+    }
+    if (top * 8 > bits) {
+      bits = top * 8;
+    }
+  }
+
+  buckets = otrng_xmalloc_z(num_buckets * sizeof(goldilocks_448_point_s));
+  used = otrng_xmalloc_z(num_buckets);
+  num_windows = (bits + width - 1) / width;
+
+  for (w = num_windows; w > 0; w--) {
+    size_t offset = (w - 1) * width;
+
+    if (w != num_windows) {
+      for (k = 0; k < width; k++) {
+        goldilocks_448_point_double(dst, dst);
+      }
+    }
+
+    memset(used, 0, num_buckets);
+    for (i = 0; i < len; i++) {
+      unsigned int digit =
+          ec_scalar_window(enc + i * ED448_SCALAR_BYTES, offset, width);
+      if (digit == 0) {
+        continue;
+      }
+
+      if (used[digit - 1]) {
+        goldilocks_448_point_add(&buckets[digit - 1], &buckets[digit - 1],
+                                 points[i]);
+      } else {
+        goldilocks_448_point_copy(&buckets[digit - 1], points[i]);
+        used[digit - 1] = 1;
+      }
+    }
+
+    /* sum_k k * bucket[k] as a running sum from the highest bucket down */
+    goldilocks_448_point_copy(running, goldilocks_448_point_identity);
+    goldilocks_448_point_copy(sum, goldilocks_448_point_identity);
+    for (k = num_buckets; k > 0; k--) {
+      if (used[k - 1]) {
+        goldilocks_448_point_add(running, running, &buckets[k - 1]);
+      }
+      goldilocks_448_point_add(sum, sum, running);
+    }
+
+    goldilocks_448_point_add(dst, dst, sum);
+  }
+
+  goldilocks_448_point_destroy(running);
+  goldilocks_448_point_destroy(sum);
+  otrng_free(used);
+  otrng_free(buckets);
+  otrng_free(enc);
+}
+
 INTERNAL void
 otrng_ec_scalar_derive_from_secret(ec_scalar priv,
                                    const uint8_t sym[ED448_PRIVATE_BYTES]) {
@@ -164,6 +164,25 @@ INTERNAL otrng_result otrng_ec_point_encode(uint8_t *enc, size_t len,
 INTERNAL otrng_result
 otrng_ec_point_decode(ec_point p, const uint8_t enc[ED448_POINT_BYTES]);
 
+/**
+ * @brief Multi-scalar multiplication: dst = sum(scalars[i] * points[i]).
+ *
+ * Uses the bucket method of Pippenger, which needs far fewer point additions
+ * than one scalar multiplication per term once there are more than a
+ * handful of terms.
+ *
+ * @param [dst]     The result.
+ * @param [points]  The points.
+ * @param [scalars] The scalars.
+ * @param [len]     The number of terms.
+ *
+ * @warning This runs in variable time. Only use it with public data.
+ */
+INTERNAL void otrng_ec_point_multiscalarmul(ec_point dst,
+                                            const ec_point *points,
+                                            const ec_scalar *scalars,
+                                            size_t len);
+
 /** Securely erase a point by overwriting it with zeros.
  * @warning This causes the point object to become invalid.
  */
@@ -261,6 +280,11 @@ API void otrng_ecdh_keypair_debug_print(FILE *, int, ecdh_keypair_s *);
 
 #ifdef OTRNG_ED448_PRIVATE
 
+tstatic unsigned int ec_scalar_window(const uint8_t *enc, size_t offset,
+                                      unsigned int width);
+
+tstatic unsigned int ec_msm_window_bits(size_t len);
+
 /**
  * @brief EdDSA signing.
  *
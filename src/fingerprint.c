@@ -21,10 +21,13 @@
 #define OTRNG_FINGERPRINT_PRIVATE
 
 #include <assert.h>
+#include <string.h>
 
 #include "alloc.h"
 #include "client.h"
 #include "fingerprint.h"
+#include "messaging.h"
+#include "prekey_ensemble_cache.h"
 #include "serialize.h"
 #include "shake.h"
 
@@ -118,14 +121,48 @@ tstatic void otrng_known_fingerprint_free(otrng_known_fingerprint_s *kf) {
 
 static void free_fp_proxy(void *kf) { otrng_known_fingerprint_free(kf); }
 
+INTERNAL void
+otrng_fingerprint_change_free(otrng_fingerprint_change_s *change) {
+  if (change == NULL) {
+    return;
+  }
+  otrng_free(change->fp.username);
+  otrng_free(change);
+}
+
+static void free_change_proxy(void *change) {
+  otrng_fingerprint_change_free(change);
+}
+
 API void otrng_known_fingerprints_free(otrng_known_fingerprints_s *kf) {
   if (kf == NULL) {
     return;
   }
   otrng_list_free(kf->fps, free_fp_proxy);
+  otrng_list_free(kf->changes, free_change_proxy);
   otrng_free(kf);
 }
 
+tstatic void record_change(const otrng_client_s *client,
+                           const otrng_known_fingerprint_s *fp,
+                           otrng_bool forget) {
+  otrng_fingerprint_change_s *change;
+
+  if (client->global_state == NULL ||
+      client->global_state->fingerprint_journal == NULL) {
+    return;
+  }
+
+  change = otrng_xmalloc_z(sizeof(otrng_fingerprint_change_s));
+  change->forget = forget;
+  change->fp.username = otrng_xstrdup(fp->username);
+  change->fp.trusted = fp->trusted;
+  memcpy(change->fp.fp, fp->fp, FPRINT_LEN_BYTES);
+
+  client->fingerprints->changes =
+      otrng_list_add(change, client->fingerprints->changes);
+}
+
 API /*@null@*/ otrng_known_fingerprint_s *
 otrng_fingerprint_get_by_fp(const otrng_client_s *client,
                             const otrng_fingerprint fp) {
@@ -183,6 +220,7 @@ API otrng_known_fingerprint_s *otrng_fingerprint_add(otrng_client_s *client,
   memcpy(nfp->fp, fp, FPRINT_LEN_BYTES);
 
   client->fingerprints->fps = otrng_list_add(nfp, client->fingerprints->fps);
+  record_change(client, nfp, otrng_false);
 
   return nfp;
 }
@@ -204,8 +242,9 @@ API void otrng_fingerprints_do_all(const struct otrng_client_s *client,
   }
 }
 
-API void otrng_fingerprint_forget(const otrng_client_s *client,
-                                  otrng_known_fingerprint_s *fp) {
+INTERNAL void otrng_fingerprint_remove(const otrng_client_s *client,
+                                       const otrng_fingerprint fp,
+                                       const char *username) {
   list_element_s *prev = NULL, *c, *work;
   assert(client != NULL);
 
@@ -215,8 +254,8 @@ API void otrng_fingerprint_forget(const otrng_client_s *client,
 
   for (c = client->fingerprints->fps; c;) {
     otrng_known_fingerprint_s *kf = c->data;
-    if (memcmp(fp->fp, kf->fp, FPRINT_LEN_BYTES) == 0 &&
-        strcmp(fp->username, kf->username) == 0) {
+    if (memcmp(fp, kf->fp, FPRINT_LEN_BYTES) == 0 &&
+        strcmp(username, kf->username) == 0) {
       work = c;
       c = work->next;
       if (prev) {
@@ -233,6 +272,48 @@ API void otrng_fingerprint_forget(const otrng_client_s *client,
   }
 }
 
+API void otrng_fingerprint_forget(const otrng_client_s *client,
+                                  otrng_known_fingerprint_s *fp) {
+  otrng_fingerprint fpr;
+  char *username;
+
+  assert(client != NULL);
+
+  if (client->fingerprints == NULL) {
+    return;
+  }
+
+  /* The prekey ensembles of the peer are not taken as valid on the strength
+     of having been validated before anymore */
+  if (client->ensemble_cache) {
+    otrng_prekey_ensemble_cache_forget(client->ensemble_cache, fp->username);
+  }
+
+  /* [fp] might be one of the fingerprints that are freed below, so what it is
+     matched by is copied first */
+  record_change(client, fp, otrng_true);
+  memcpy(fpr, fp->fp, FPRINT_LEN_BYTES);
+  username = otrng_xstrdup(fp->username);
+  otrng_fingerprint_remove(client, fpr, username);
+  otrng_free(username);
+}
+
+API void otrng_fingerprint_set_trusted(const otrng_client_s *client,
+                                       otrng_known_fingerprint_s *fp,
+                                       otrng_bool trusted) {
+  assert(client != NULL);
+
+  fp->trusted = trusted;
+
+  if (!trusted && client->ensemble_cache) {
+    otrng_prekey_ensemble_cache_forget(client->ensemble_cache, fp->username);
+  }
+
+  if (client->fingerprints != NULL) {
+    record_change(client, fp, otrng_false);
+  }
+}
+
 /* This returns the fingerprint of the peer, not the self.
  It only works properly if it's a v4 connection. */
 API /*@null@*/ otrng_known_fingerprint_s *
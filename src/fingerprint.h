@@ -64,9 +64,20 @@ typedef struct otrng_known_fingerprint_v3_s {
   Fingerprint *fp;
 } otrng_known_fingerprint_v3_s;
 
+/* a change to the known fingerprints that has not been appended to the
+   fingerprint journal yet (see fingerprint_journal.h) */
+typedef struct otrng_fingerprint_change_s {
+  otrng_bool forget;
+  otrng_known_fingerprint_s fp;
+} otrng_fingerprint_change_s;
+
 /* a list of known fingerprints */
 typedef struct otrng_known_fingerprints_s {
   list_element_s *fps;
+
+  /* otrng_fingerprint_change_s, oldest first. Only kept while the global
+     state has a fingerprint journal. */
+  list_element_s *changes;
 } otrng_known_fingerprints_s;
 
 /**
@@ -179,6 +190,20 @@ API void otrng_fingerprints_do_all(const struct otrng_client_s *client,
 API void otrng_fingerprint_forget(const struct otrng_client_s *client,
                                   otrng_known_fingerprint_s *fp);
 
+/**
+ * @brief Change the trust of a known fingerprint. Changing [trusted] directly
+ * works as well, but then the change is only persisted by the fingerprint
+ * journal on the next compaction.
+ *
+ * @param [client]        The client which has the fingerprints.
+ * @param [fp]            The fingerprint to change.
+ * @param [trusted]       The new trust level.
+ *
+ */
+API void otrng_fingerprint_set_trusted(const struct otrng_client_s *client,
+                                       otrng_known_fingerprint_s *fp,
+                                       otrng_bool trusted);
+
 /**
  * @brief Get the known fingerprint of the current peer.
  *
@@ -188,6 +213,18 @@ API void otrng_fingerprint_forget(const struct otrng_client_s *client,
 API /*@null@*/ otrng_known_fingerprint_s *
 otrng_fingerprint_get_current(const struct otrng_s *conn);
 
+/* Removes [fp] of [username] without recording the change */
+INTERNAL void otrng_fingerprint_remove(const struct otrng_client_s *client,
+                                       const otrng_fingerprint fp,
+                                       const char *username);
+
+INTERNAL void otrng_fingerprint_change_free(otrng_fingerprint_change_s *change);
+
 #ifdef OTRNG_FINGERPRINT_PRIVATE
+
+tstatic void record_change(const struct otrng_client_s *client,
+                           const otrng_known_fingerprint_s *fp,
+                           otrng_bool forget);
+
 #endif
 #endif
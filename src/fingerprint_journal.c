@@ -0,0 +1,445 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OTRNG_FINGERPRINT_JOURNAL_PRIVATE
+#define OTRNG_PERSISTENCE_PRIVATE
+
+#include "alloc.h"
+#include "fingerprint_journal.h"
+#include "persistence.h"
+#include "str.h"
+
+/*@null@*/ static otrng_worker_s *
+get_persistence_worker(otrng_global_state_s *gs, otrng_bool create) {
+  if (!gs->persistence_worker && create) {
+    gs->persistence_worker = otrng_worker_new(1);
+  }
+
+  return gs->persistence_worker;
+}
+
+static char *temporary_filename(const char *filename) {
+  size_t len = strlen(filename) + strlen(".tmp") + 1;
+  char *result = otrng_xmalloc(len);
+
+  snprintf(result, len, "%s.tmp", filename);
+  return result;
+}
+
+/* Writes [len] bytes to [filename] through a temporary file, so the file is
+   either the old or the new one after a crash */
+static otrng_result replace_file(const char *filename, const char *buffer,
+                                 size_t len) {
+  char *tmp = temporary_filename(filename);
+  otrng_result result = OTRNG_SUCCESS;
+  FILE *f = fopen(tmp, "wb");
+
+  if (!f) {
+    otrng_free(tmp);
+    return OTRNG_ERROR;
+  }
+
+  if ((len > 0 && fwrite(buffer, 1, len, f) != len) || fflush(f) != 0 ||
+      fsync(fileno(f)) != 0) {
+    result = OTRNG_ERROR;
+  }
+
+  if (fclose(f) != 0) {
+    result = OTRNG_ERROR;
+  }
+
+  if (otrng_succeeded(result) && rename(tmp, filename) != 0) {
+    result = OTRNG_ERROR;
+  }
+
+  if (otrng_failed(result)) {
+    (void)remove(tmp);
+  }
+
+  otrng_free(tmp);
+  return result;
+}
+
+tstatic void fingerprint_compaction_run(void *data) {
+  fingerprint_compaction_job_s *job = data;
+
+  job->result = replace_file(job->snapshot_filename, job->buffer, job->len);
+}
+
+static void fingerprint_compaction_free(fingerprint_compaction_job_s *job) {
+  otrng_free(job->snapshot_filename);
+  otrng_free(job->buffer);
+  otrng_free(job);
+}
+
+/* Drops the first [len] bytes of the journal, which are now covered by the
+   snapshot */
+static otrng_result drop_journal_prefix(const char *filename, long len) {
+  otrng_result result;
+  char *tail = NULL;
+  long end;
+  FILE *f = fopen(filename, "rb");
+
+  if (!f) {
+    return OTRNG_ERROR;
+  }
+
+  if (fseek(f, 0, SEEK_END) != 0 || (end = ftell(f)) < len ||
+      fseek(f, len, SEEK_SET) != 0) {
+    fclose(f);
+    return OTRNG_ERROR;
+  }
+
+  if (end > len) {
+    tail = otrng_xmalloc(end - len);
+    if (fread(tail, 1, end - len, f) != (size_t)(end - len)) {
+      otrng_free(tail);
+      fclose(f);
+      return OTRNG_ERROR;
+    }
+  }
+  fclose(f);
+
+  result = replace_file(filename, tail, end - len);
+  otrng_free(tail);
+
+  return result;
+}
+
+tstatic otrng_result fingerprint_journal_collect(
+    otrng_fingerprint_journal_s *journal, otrng_worker_s *worker,
+    otrng_bool wait) {
+  fingerprint_compaction_job_s *job = journal->compaction;
+  otrng_result result;
+
+  if (!job) {
+    return OTRNG_SUCCESS;
+  }
+
+  if (worker) {
+    if (!wait && !otrng_worker_job_ready(worker, &job->job)) {
+      return OTRNG_SUCCESS;
+    }
+    otrng_worker_job_wait(worker, &job->job);
+  }
+
+  journal->compaction = NULL;
+  result = job->result;
+  fingerprint_compaction_free(job);
+
+  if (otrng_succeeded(result)) {
+    result = drop_journal_prefix(journal->journal_filename,
+                                 journal->compacted_len);
+  }
+
+  /* If the journal could not be shortened, replaying all of it on top of
+     the new snapshot is still correct */
+  if (otrng_succeeded(result)) {
+    journal->appended = journal->appended > journal->compacted_changes
+                            ? journal->appended - journal->compacted_changes
+                            : 0;
+  }
+
+  return result;
+}
+
+INTERNAL void
+otrng_fingerprint_journal_free(otrng_fingerprint_journal_s *journal,
+                               otrng_worker_s *worker) {
+  if (!journal) {
+    return;
+  }
+
+  (void)fingerprint_journal_collect(journal, worker, otrng_true);
+
+  otrng_free(journal->snapshot_filename);
+  otrng_free(journal->journal_filename);
+  otrng_free(journal);
+}
+
+API void otrng_global_state_set_fingerprint_journal(
+    otrng_global_state_s *gs, const char *snapshot_filename,
+    const char *journal_filename, unsigned int compact_after) {
+  otrng_fingerprint_journal_s *journal;
+
+  assert(gs != NULL);
+
+  otrng_fingerprint_journal_free(gs->fingerprint_journal,
+                                 get_persistence_worker(gs, otrng_false));
+  gs->fingerprint_journal = NULL;
+
+  if (!snapshot_filename || !journal_filename) {
+    return;
+  }
+
+  journal = otrng_xmalloc_z(sizeof(otrng_fingerprint_journal_s));
+  journal->snapshot_filename = otrng_xstrdup(snapshot_filename);
+  journal->journal_filename = otrng_xstrdup(journal_filename);
+  journal->compact_after = compact_after;
+
+  gs->fingerprint_journal = journal;
+}
+
+static void reset_fingerprints(list_element_s *node, void *ignored) {
+  otrng_client_s *client = node->data;
+  (void)ignored;
+
+  otrng_known_fingerprints_free(client->fingerprints);
+  client->fingerprints = NULL;
+}
+
+API otrng_result
+otrng_global_state_fingerprints_v4_load(otrng_global_state_s *gs) {
+  otrng_fingerprint_journal_s *journal;
+  FILE *f;
+
+  assert(gs != NULL);
+
+  journal = gs->fingerprint_journal;
+  if (!journal) {
+    return OTRNG_ERROR;
+  }
+
+  otrng_list_foreach(gs->clients, reset_fingerprints, NULL);
+  journal->appended = 0;
+
+  f = fopen(journal->snapshot_filename, "r");
+  if (f) {
+    while (!feof(f)) {
+      (void)otrng_client_fingerprint_v4_read_from(gs, f, otrng_client_get);
+    }
+    fclose(f);
+  }
+
+  f = fopen(journal->journal_filename, "r");
+  if (f) {
+    while (!feof(f)) {
+      if (otrng_client_fingerprint_v4_replay_from(gs, f, otrng_client_get)) {
+        journal->appended++;
+      }
+    }
+    fclose(f);
+  }
+
+  return OTRNG_SUCCESS;
+}
+
+typedef struct journal_buffer_s {
+  char *data;
+  size_t len;
+  size_t cap;
+  unsigned int changes;
+} journal_buffer_s;
+
+static char *journal_buffer_reserve(journal_buffer_s *b, size_t len) {
+  char *result;
+
+  if (b->len + len > b->cap) {
+    b->cap = b->cap * 2 > b->len + len ? b->cap * 2 : b->len + len + 1024;
+    b->data = otrng_xrealloc(b->data, b->cap);
+  }
+
+  result = b->data + b->len;
+  b->len += len;
+
+  return result;
+}
+
+static void append_changes(list_element_s *node, void *context) {
+  const otrng_client_s *client = node->data;
+  journal_buffer_s *b = context;
+  const list_element_s *current;
+
+  if (!client->fingerprints) {
+    return;
+  }
+
+  for (current = client->fingerprints->changes; current;
+       current = current->next) {
+    const otrng_fingerprint_change_s *change = current->data;
+    size_t len =
+        otrng_known_fingerprint_line_len(&change->fp, client->client_id);
+    char *dst = journal_buffer_reserve(b, len + 2);
+
+    dst[0] = change->forget ? '-' : '+';
+    dst[1] = '\t';
+    (void)otrng_known_fingerprint_format_line(dst + 2, &change->fp,
+                                              client->client_id);
+    b->changes++;
+  }
+}
+
+static void free_change_from_list(void *change) {
+  otrng_fingerprint_change_free(change);
+}
+
+static void forget_changes(list_element_s *node, void *ignored) {
+  otrng_client_s *client = node->data;
+  (void)ignored;
+
+  if (client->fingerprints) {
+    otrng_list_free(client->fingerprints->changes, free_change_from_list);
+    client->fingerprints->changes = NULL;
+  }
+}
+
+static void append_snapshot(list_element_s *node, void *context) {
+  const otrng_client_s *client = node->data;
+  journal_buffer_s *b = context;
+  const list_element_s *current;
+
+  if (!client->fingerprints) {
+    return;
+  }
+
+  for (current = client->fingerprints->fps; current; current = current->next) {
+    size_t len =
+        otrng_known_fingerprint_line_len(current->data, client->client_id);
+
+    (void)otrng_known_fingerprint_format_line(journal_buffer_reserve(b, len),
+                                              current->data, client->client_id);
+  }
+}
+
+static otrng_result start_compaction(otrng_global_state_s *gs) {
+  otrng_fingerprint_journal_s *journal = gs->fingerprint_journal;
+  fingerprint_compaction_job_s *job;
+  journal_buffer_s b;
+  otrng_worker_s *worker;
+  FILE *f;
+
+  /* The snapshot covers everything that is in the journal at this point */
+  journal->compacted_len = 0;
+  f = fopen(journal->journal_filename, "rb");
+  if (f) {
+    if (fseek(f, 0, SEEK_END) == 0) {
+      journal->compacted_len = ftell(f);
+    }
+    fclose(f);
+  }
+  if (journal->compacted_len < 0) {
+    return OTRNG_ERROR;
+  }
+  journal->compacted_changes = journal->appended;
+
+  memset(&b, 0, sizeof(b));
+  otrng_list_foreach(gs->clients, append_snapshot, &b);
+
+  job = otrng_xmalloc_z(sizeof(fingerprint_compaction_job_s));
+  job->job.run = fingerprint_compaction_run;
+  job->job.data = job;
+  job->snapshot_filename = otrng_xstrdup(journal->snapshot_filename);
+  job->buffer = b.data;
+  job->len = b.len;
+  journal->compaction = job;
+
+  worker = get_persistence_worker(gs, otrng_true);
+  if (!worker) {
+    fingerprint_compaction_run(job);
+    return fingerprint_journal_collect(journal, NULL, otrng_true);
+  }
+
+  otrng_worker_submit(worker, &job->job);
+
+  return OTRNG_SUCCESS;
+}
+
+API otrng_result
+otrng_global_state_fingerprints_v4_flush(otrng_global_state_s *gs) {
+  otrng_fingerprint_journal_s *journal;
+  otrng_result result = OTRNG_SUCCESS;
+  journal_buffer_s b;
+  FILE *f;
+
+  assert(gs != NULL);
+
+  journal = gs->fingerprint_journal;
+  if (!journal) {
+    return OTRNG_ERROR;
+  }
+
+  if (otrng_failed(fingerprint_journal_collect(
+          journal, get_persistence_worker(gs, otrng_false), otrng_false))) {
+    result = OTRNG_ERROR;
+  }
+
+  memset(&b, 0, sizeof(b));
+  otrng_list_foreach(gs->clients, append_changes, &b);
+
+  if (b.changes > 0) {
+    f = fopen(journal->journal_filename, "ab");
+    if (!f) {
+      otrng_free(b.data);
+      return OTRNG_ERROR;
+    }
+
+    if (fwrite(b.data, 1, b.len, f) != b.len || fflush(f) != 0) {
+      fclose(f);
+      otrng_free(b.data);
+      return OTRNG_ERROR;
+    }
+    fclose(f);
+
+    otrng_list_foreach(gs->clients, forget_changes, NULL);
+    journal->appended += b.changes;
+  }
+  otrng_free(b.data);
+
+  if (journal->compact_after > 0 &&
+      journal->appended >= journal->compact_after && !journal->compaction) {
+    if (otrng_failed(start_compaction(gs))) {
+      result = OTRNG_ERROR;
+    }
+  }
+
+  return result;
+}
+
+API otrng_result
+otrng_global_state_fingerprints_v4_compact(otrng_global_state_s *gs) {
+  otrng_fingerprint_journal_s *journal;
+
+  assert(gs != NULL);
+
+  journal = gs->fingerprint_journal;
+  if (!journal) {
+    return OTRNG_ERROR;
+  }
+
+  (void)fingerprint_journal_collect(
+      journal, get_persistence_worker(gs, otrng_false), otrng_true);
+
+  if (otrng_failed(otrng_global_state_fingerprints_v4_flush(gs))) {
+    return OTRNG_ERROR;
+  }
+
+  /* The flush might have started one already */
+  if (!journal->compaction && otrng_failed(start_compaction(gs))) {
+    return OTRNG_ERROR;
+  }
+
+  return fingerprint_journal_collect(
+      journal, get_persistence_worker(gs, otrng_false), otrng_true);
+}
@@ -0,0 +1,128 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * An append-only journal for the v4 fingerprints.
+ *
+ * Instead of rewriting every known fingerprint whenever one of them changes,
+ * the changes made through otrng_fingerprint_add, otrng_fingerprint_forget
+ * and otrng_fingerprint_set_trusted are appended to a journal file, one line
+ * per change:
+ *
+ *   "+" or "-" \t username \t account \t protocol \t fingerprint \t trusted
+ *
+ * After a number of appended changes, the full set of fingerprints is written
+ * as a snapshot, in the same format as
+ * otrng_global_state_fingerprints_v4_write_to, on a background worker. Once
+ * the snapshot is in place, the part of the journal it covers is dropped.
+ *
+ * Loading reads the snapshot and replays the journal on top of it. Replaying
+ * a change twice gives the same result, so a crash between writing the
+ * snapshot and shortening the journal loses nothing.
+ *
+ * All functions here are called from the messaging thread. The worker only
+ * writes the snapshot buffer of its own compaction job.
+ */
+
+#ifndef OTRNG_FINGERPRINT_JOURNAL_H
+#define OTRNG_FINGERPRINT_JOURNAL_H
+
+#include "messaging.h"
+#include "shared.h"
+#include "worker.h"
+
+typedef struct fingerprint_compaction_job_s {
+  otrng_worker_job_s job;
+  char *snapshot_filename;
+  char *buffer;
+  size_t len;
+  otrng_result result;
+} fingerprint_compaction_job_s;
+
+typedef struct otrng_fingerprint_journal_s {
+  char *snapshot_filename;
+  char *journal_filename;
+
+  /* A compaction starts after this many changes have been appended */
+  unsigned int compact_after;
+  unsigned int appended;
+
+  /*@null@*/ fingerprint_compaction_job_s *compaction;
+  /* The journal length and changes covered by the running compaction */
+  long compacted_len;
+  unsigned int compacted_changes;
+} otrng_fingerprint_journal_s;
+
+/**
+ * @brief Keeps the v4 fingerprints of [gs] in [snapshot_filename] and
+ *    [journal_filename]. Passing NULL filenames turns the journal off.
+ *
+ * @param [compact_after] The number of appended changes after which the
+ *    snapshot is rewritten in the background.
+ */
+API void otrng_global_state_set_fingerprint_journal(
+    otrng_global_state_s *gs, /*@null@*/ const char *snapshot_filename,
+    /*@null@*/ const char *journal_filename, unsigned int compact_after);
+
+/**
+ * @brief Replaces the v4 fingerprints of [gs] with the ones in the snapshot
+ *    and the journal. Missing files count as empty.
+ */
+API otrng_result otrng_global_state_fingerprints_v4_load(
+    otrng_global_state_s *gs);
+
+/**
+ * @brief Appends the fingerprint changes of all clients to the journal,
+ *    finishes a compaction that is done, and starts a new one if enough
+ *    changes were appended. This is meant to be called from the
+ *    store_fingerprints_v4 callback.
+ */
+API otrng_result otrng_global_state_fingerprints_v4_flush(
+    otrng_global_state_s *gs);
+
+/**
+ * @brief Flushes the changes and writes a snapshot right away, waiting for
+ *    it to be done.
+ */
+API otrng_result otrng_global_state_fingerprints_v4_compact(
+    otrng_global_state_s *gs);
+
+/**
+ * @brief Finishes a running compaction and frees the journal. Pending
+ *    changes that were not flushed are lost. Safe to call with NULL.
+ *
+ * @param [worker] The worker the compaction runs on, or NULL if it has
+ *    already been freed (which waits for all of its jobs).
+ */
+INTERNAL void otrng_fingerprint_journal_free(
+    /*@only@*/ /*@null@*/ otrng_fingerprint_journal_s *journal,
+    /*@null@*/ otrng_worker_s *worker);
+
+#ifdef OTRNG_FINGERPRINT_JOURNAL_PRIVATE
+
+tstatic void fingerprint_compaction_run(void *data);
+
+tstatic otrng_result fingerprint_journal_collect(
+    otrng_fingerprint_journal_s *journal, /*@null@*/ otrng_worker_s *worker,
+    otrng_bool wait);
+
+#endif
+
+#endif
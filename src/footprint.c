@@ -0,0 +1,244 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define OTRNG_FOOTPRINT_PRIVATE
+
+#include <string.h>
+
+#include "client.h"
+#include "footprint.h"
+#include "prekey_ensemble_cache.h"
+#include "prekey_index.h"
+#include "prekey_message.h"
+#include "protocol.h"
+#include "smp_protocol.h"
+#include "v3.h"
+
+/* A prekey message we keep: the message, its public DH key, and its private
+   keys, of which the DH ones are MPIs */
+#define PREKEY_MESSAGE_HEAP_BYTES                                              \
+  (sizeof(prekey_message_s) + sizeof(list_element_s) +                         \
+   2 * DH3072_MOD_LEN_BYTES + DH_KEY_SIZE)
+#define PREKEY_MESSAGE_SECURE_BYTES                                            \
+  (sizeof(ecdh_keypair_s) + sizeof(dh_keypair_s))
+
+/* The key manager, with their public DH key and our DH keypair */
+#define KEY_MANAGER_HEAP_BYTES (2 * DH3072_MOD_LEN_BYTES + DH_KEY_SIZE)
+#define KEY_MANAGER_SECURE_BYTES                                               \
+  (sizeof(key_manager_s) + sizeof(ratchet_s) + sizeof(ecdh_keypair_s) +        \
+   sizeof(dh_keypair_s))
+
+/* The secret is counted whether it is set or not: while SMP jobs are in
+   flight the state belongs to the worker, as in otrng_session_can_serialize,
+   and can't be looked at */
+#define SMP_SECURE_BYTES (sizeof(smp_protocol_s) + HASH_BYTES)
+
+static void add_to(otrng_footprint_totals_s *totals,
+                   otrng_footprint_category category, size_t heap,
+                   size_t secure) {
+  /* Sizes are unsigned, so taking bytes away is adding their complement */
+  for (; totals; totals = totals->parent) {
+    totals->heap[category] += heap;
+    totals->secure[category] += secure;
+  }
+}
+
+INTERNAL void otrng_footprint_charge(otrng_footprint_totals_s *totals,
+                                     otrng_footprint_category category,
+                                     size_t heap, size_t secure) {
+  add_to(totals, category, heap, secure);
+}
+
+INTERNAL void otrng_footprint_release(otrng_footprint_totals_s *totals,
+                                      otrng_footprint_category category,
+                                      size_t heap, size_t secure) {
+  add_to(totals, category, -heap, -secure);
+}
+
+INTERNAL void otrng_footprint_set(otrng_footprint_totals_s *totals,
+                                  otrng_footprint_category category,
+                                  size_t heap, size_t secure) {
+  if (!totals) {
+    return;
+  }
+
+  add_to(totals, category, heap - totals->heap[category],
+         secure - totals->secure[category]);
+}
+
+INTERNAL void otrng_footprint_attach(otrng_footprint_totals_s *totals,
+                                     otrng_footprint_totals_s *parent) {
+  int category;
+
+  for (category = 0; category < OTRNG_FOOTPRINT_CATEGORIES; category++) {
+    add_to(parent, category, totals->heap[category],
+           totals->secure[category]);
+  }
+
+  parent->num_conversations += totals->num_conversations;
+  parent->num_hibernated += totals->num_hibernated;
+  totals->parent = parent;
+}
+
+INTERNAL void otrng_footprint_detach(otrng_footprint_totals_s *totals) {
+  otrng_footprint_totals_s *parent = totals->parent;
+  int category;
+
+  if (!parent) {
+    return;
+  }
+
+  for (category = 0; category < OTRNG_FOOTPRINT_CATEGORIES; category++) {
+    add_to(parent, category, -totals->heap[category],
+           -totals->secure[category]);
+  }
+
+  parent->num_conversations -= totals->num_conversations;
+  parent->num_hibernated -= totals->num_hibernated;
+  totals->parent = NULL;
+}
+
+static size_t string_bytes(/*@null@*/ const char *str) {
+  if (!str) {
+    return 0;
+  }
+
+  return strlen(str) + 1;
+}
+
+static size_t profiles_bytes(const otrng_s *otr) {
+  const otrng_client_profile_s *client_profile = otr->their_client_profile;
+  size_t heap = 0;
+
+  if (client_profile) {
+    heap += sizeof(otrng_client_profile_s) +
+            string_bytes(client_profile->versions) +
+            client_profile->dsa_key_len;
+    if (client_profile->transitional_signature) {
+      heap += OTRv3_DSA_SIG_BYTES;
+    }
+  }
+
+  if (otr->their_prekey_profile) {
+    heap += sizeof(otrng_prekey_profile_s);
+  }
+
+  return heap;
+}
+
+INTERNAL void otrng_conversation_footprint_update(otrng_s *otr) {
+  otrng_footprint_totals_s *totals = &otr->footprint;
+  size_t num_hibernated = otr->hibernated ? 1 : 0;
+
+  otrng_footprint_set(totals, OTRNG_FOOTPRINT_CONVERSATION,
+                      sizeof(otrng_s) + string_bytes(otr->peer) +
+                          string_bytes(otr->shared_session_state),
+                      0);
+
+  if (otr->keys) {
+    otrng_footprint_set(totals, OTRNG_FOOTPRINT_KEYS, KEY_MANAGER_HEAP_BYTES,
+                        KEY_MANAGER_SECURE_BYTES);
+  } else {
+    otrng_footprint_set(totals, OTRNG_FOOTPRINT_KEYS, 0, 0);
+  }
+
+  otrng_footprint_set(totals, OTRNG_FOOTPRINT_SMP, 0,
+                      otr->smp ? SMP_SECURE_BYTES : 0);
+  otrng_footprint_set(totals, OTRNG_FOOTPRINT_PROFILES, profiles_bytes(otr),
+                      0);
+
+  if (otr->v3_conn) {
+    otrng_footprint_set(totals, OTRNG_FOOTPRINT_V3,
+                        sizeof(otrng_v3_conn_s) +
+                            string_bytes(otr->v3_conn->peer),
+                        0);
+  } else {
+    otrng_footprint_set(totals, OTRNG_FOOTPRINT_V3, 0, 0);
+  }
+
+  otrng_footprint_set(totals, OTRNG_FOOTPRINT_HIBERNATED,
+                      otr->hibernated_state ? otr->hibernated_state_len : 0,
+                      0);
+
+  if (totals->parent) {
+    totals->parent->num_hibernated += num_hibernated - totals->num_hibernated;
+  }
+  totals->num_hibernated = num_hibernated;
+}
+
+tstatic void footprint_fill(otrng_footprint_s *dst,
+                            const otrng_footprint_totals_s *totals) {
+  /* In the order of otrng_footprint_category */
+  size_t *categories[OTRNG_FOOTPRINT_CATEGORIES] = {
+      &dst->keys,     &dst->skipped_keys, &dst->old_mac_keys, &dst->smp,
+      &dst->arena,    &dst->fragments,    &dst->profiles,     &dst->v3,
+      &dst->conversation, &dst->hibernated, &dst->prekeys};
+  int category;
+
+  memset(dst, 0, sizeof(otrng_footprint_s));
+
+  for (category = 0; category < OTRNG_FOOTPRINT_CATEGORIES; category++) {
+    *categories[category] = totals->heap[category] + totals->secure[category];
+    dst->heap_bytes += totals->heap[category];
+    dst->secure_bytes += totals->secure[category];
+  }
+
+  dst->num_conversations = totals->num_conversations;
+  dst->num_hibernated = totals->num_hibernated;
+}
+
+API void otrng_conversation_footprint(otrng_footprint_s *dst,
+                                      const otrng_s *otr) {
+  footprint_fill(dst, &otr->footprint);
+}
+
+/* Prekeys are not kept in the running totals: their counts are, so this
+   is as cheap to work out as to read */
+static void charge_prekeys(otrng_footprint_s *dst,
+                           const otrng_client_s *client) {
+  size_t num = otrng_tail_list_len(&client->our_prekeys);
+  const otrng_prekey_index_s *index = client->prekey_index;
+  const otrng_prekey_ensemble_cache_s *cache = client->ensemble_cache;
+  size_t heap = num * PREKEY_MESSAGE_HEAP_BYTES;
+  size_t secure = num * PREKEY_MESSAGE_SECURE_BYTES;
+
+  if (index) {
+    heap += sizeof(otrng_prekey_index_s) +
+            index->num_buckets * sizeof(otrng_prekey_index_entry_s *) +
+            index->num_entries * sizeof(otrng_prekey_index_entry_s) +
+            index->records_cap;
+  }
+
+  if (cache) {
+    heap += sizeof(otrng_prekey_ensemble_cache_s) +
+            cache->num_entries * (sizeof(list_element_s) +
+                                  sizeof(otrng_prekey_ensemble_cache_entry_s));
+  }
+
+  dst->prekeys += heap + secure;
+  dst->heap_bytes += heap;
+  dst->secure_bytes += secure;
+}
+
+API void otrng_client_footprint(otrng_footprint_s *dst,
+                                const otrng_client_s *client) {
+  footprint_fill(dst, &client->footprint);
+  charge_prekeys(dst, client);
+}
@@ -0,0 +1,182 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * How much memory conversations and clients hold, broken down by what holds
+ * it. Every conversation keeps running totals, updated where its parts are
+ * allocated and freed, and passes each change on to the totals of its client.
+ * Reading a footprint copies those totals, so it takes the same time however
+ * many conversations a client has.
+ *
+ * For a process-wide figure, see otrng_get_alloc_stats.
+ */
+
+#ifndef OTRNG_FOOTPRINT_H
+#define OTRNG_FOOTPRINT_H
+
+#include <stddef.h>
+
+#include "error.h"
+#include "shared.h"
+
+struct otrng_s;
+struct otrng_client_s;
+
+/**
+ * @brief The memory held by one conversation, or by a client and all of its
+ *    conversations. The breakdown adds up to [heap_bytes] + [secure_bytes].
+ *
+ *  [keys]          the key manager, the ratchet and the DH and ECDH keys
+ *  [skipped_keys]  message keys kept for messages that arrive out of order
+ *  [old_mac_keys]  mac keys waiting to be revealed
+ *  [smp]           the SMP state
+ *  [arena]         buffers kept for the next message
+ *  [fragments]     fragments of messages that are not complete yet
+ *  [profiles]      the client and prekey profiles of the peer
+ *  [v3]            the OTRv3 connection, not counting libotr's own state
+ *  [conversation]  the conversation itself
+ *  [hibernated]    the encrypted state of hibernated conversations kept in
+ *                  memory, and the key it is encrypted with
+ *  [prekeys]       our prekey messages and the validated ensemble cache.
+ *                  Only set for a client
+ *
+ * Every category is counted in [heap_bytes] or [secure_bytes], depending on
+ * where each of its parts lives. MPIs are counted at the size of a full key,
+ * without the overhead of libgcrypt.
+ **/
+typedef struct otrng_footprint_s {
+  size_t heap_bytes;
+  size_t secure_bytes;
+
+  size_t keys;
+  size_t skipped_keys;
+  size_t old_mac_keys;
+  size_t smp;
+  size_t arena;
+  size_t fragments;
+  size_t profiles;
+  size_t v3;
+  size_t conversation;
+  size_t hibernated;
+  size_t prekeys;
+
+  size_t num_conversations;
+  size_t num_hibernated;
+} otrng_footprint_s;
+
+/* What the running totals are kept for. Each is a field of otrng_footprint_s */
+typedef enum {
+  OTRNG_FOOTPRINT_KEYS = 0,
+  OTRNG_FOOTPRINT_SKIPPED_KEYS = 1,
+  OTRNG_FOOTPRINT_OLD_MAC_KEYS = 2,
+  OTRNG_FOOTPRINT_SMP = 3,
+  OTRNG_FOOTPRINT_ARENA = 4,
+  OTRNG_FOOTPRINT_FRAGMENTS = 5,
+  OTRNG_FOOTPRINT_PROFILES = 6,
+  OTRNG_FOOTPRINT_V3 = 7,
+  OTRNG_FOOTPRINT_CONVERSATION = 8,
+  OTRNG_FOOTPRINT_HIBERNATED = 9,
+  OTRNG_FOOTPRINT_PREKEYS = 10
+} otrng_footprint_category;
+
+#define OTRNG_FOOTPRINT_CATEGORIES 11
+
+/**
+ * @brief The running totals of a conversation or a client.
+ *
+ *  [heap]    the bytes of each category held in normal memory
+ *  [secure]  the bytes of each category held in secure memory
+ *  [parent]  the totals every change is passed on to: those of the client,
+ *            for a conversation the client holds. NULL otherwise
+ **/
+typedef struct otrng_footprint_totals_s {
+  size_t heap[OTRNG_FOOTPRINT_CATEGORIES];
+  size_t secure[OTRNG_FOOTPRINT_CATEGORIES];
+  size_t num_conversations;
+  size_t num_hibernated;
+  /*@null@*/ struct otrng_footprint_totals_s *parent;
+} otrng_footprint_totals_s;
+
+/**
+ * @brief Adds [heap] and [secure] bytes to [category] of [totals], and of
+ *    their parent. Does nothing if [totals] is NULL.
+ **/
+INTERNAL void
+otrng_footprint_charge(/*@null@*/ otrng_footprint_totals_s *totals,
+                       otrng_footprint_category category, size_t heap,
+                       size_t secure);
+
+/**
+ * @brief Takes away what otrng_footprint_charge added.
+ **/
+INTERNAL void
+otrng_footprint_release(/*@null@*/ otrng_footprint_totals_s *totals,
+                        otrng_footprint_category category, size_t heap,
+                        size_t secure);
+
+/**
+ * @brief Makes [category] of [totals] hold [heap] and [secure] bytes, for the
+ *    parts whose size is known at once rather than added up.
+ **/
+INTERNAL void otrng_footprint_set(/*@null@*/ otrng_footprint_totals_s *totals,
+                                  otrng_footprint_category category,
+                                  size_t heap, size_t secure);
+
+/**
+ * @brief Starts counting [totals] in [parent], which then includes
+ *    everything [totals] holds and its conversation.
+ **/
+INTERNAL void otrng_footprint_attach(otrng_footprint_totals_s *totals,
+                                     otrng_footprint_totals_s *parent);
+
+/**
+ * @brief Stops counting [totals] in its parent, if it has one.
+ **/
+INTERNAL void otrng_footprint_detach(otrng_footprint_totals_s *totals);
+
+/**
+ * @brief Brings the totals of [otr] in line with the parts of it whose size
+ *    is known without adding anything up: the conversation, its keys, SMP,
+ *    the peer's profiles, the OTRv3 connection and the hibernated state.
+ *    Called wherever one of them is replaced.
+ **/
+INTERNAL void otrng_conversation_footprint_update(struct otrng_s *otr);
+
+/**
+ * @brief Fills [dst] with the memory held by the conversation [otr].
+ **/
+API void otrng_conversation_footprint(otrng_footprint_s *dst,
+                                      const struct otrng_s *otr);
+
+/**
+ * @brief Fills [dst] with the memory held by [client]: its prekeys, and the
+ *    sum of the footprints of its conversations.
+ **/
+API void otrng_client_footprint(otrng_footprint_s *dst,
+                                const struct otrng_client_s *client);
+
+#ifdef OTRNG_FOOTPRINT_PRIVATE
+
+tstatic void footprint_fill(otrng_footprint_s *dst,
+                            const otrng_footprint_totals_s *totals);
+
+#endif
+
+#endif // OTRNG_FOOTPRINT_H
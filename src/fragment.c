@@ -60,6 +60,11 @@ tstatic void otrng_message_free(otrng_message_to_send_s *msg) {
   otrng_free(msg);
 }
 
+/* A context is counted with the list node that holds it, since they are freed
+   together */
+#define FRAGMENT_CONTEXT_BYTES                                                 \
+  (sizeof(fragment_context_s) + sizeof(list_element_s))
+
 tstatic void initialize_fragment_context(fragment_context_s *context) {
   context->identifier = 0;
   context->count = 0;
@@ -71,15 +76,26 @@ tstatic void initialize_fragment_context(fragment_context_s *context) {
 
 tstatic void free_fragments_in_context(fragment_context_s *context) {
   unsigned int i;
+  char *fragment;
 
   if (!context->fragments) {
     return;
   }
 
   for (i = 0; i < context->total; i++) {
-    otrng_free(context->fragments[i]);
-    context->fragments[i] = NULL;
+    fragment = context->fragments[i];
+    if (fragment) {
+      otrng_footprint_release(context->footprint, OTRNG_FOOTPRINT_FRAGMENTS,
+                              strlen(fragment) + 1, 0);
+      otrng_free_in(OTRNG_ALLOC_FRAGMENTS, fragment, strlen(fragment) + 1);
+    }
   }
+
+  otrng_footprint_release(context->footprint, OTRNG_FOOTPRINT_FRAGMENTS,
+                          sizeof(string_p) * context->total, 0);
+  otrng_free_in(OTRNG_ALLOC_FRAGMENTS, context->fragments,
+                sizeof(string_p) * context->total);
+  context->fragments = NULL;
 }
 
 tstatic void reset_fragment_context(fragment_context_s *context) {
@@ -88,15 +104,18 @@ tstatic void reset_fragment_context(fragment_context_s *context) {
 }
 
 tstatic /*@notnull@*/ fragment_context_s *otrng_fragment_context_new(void) {
-  fragment_context_s *context = otrng_xmalloc_z(sizeof(fragment_context_s));
+  fragment_context_s *context =
+      otrng_xmalloc_in(OTRNG_ALLOC_FRAGMENTS, sizeof(fragment_context_s));
   initialize_fragment_context(context);
+  context->footprint = NULL;
   return context;
 }
 
 INTERNAL void otrng_fragment_context_free(fragment_context_s *context) {
   free_fragments_in_context(context);
-  otrng_free(context->fragments);
-  otrng_free(context);
+  otrng_footprint_release(context->footprint, OTRNG_FOOTPRINT_FRAGMENTS,
+                          FRAGMENT_CONTEXT_BYTES, 0);
+  otrng_free_in(OTRNG_ALLOC_FRAGMENTS, context, sizeof(fragment_context_s));
 }
 
 static otrng_result create_fragment_message(char **dst, const char *piece,
@@ -190,7 +209,10 @@ tstatic otrng_bool is_fragment_generic(const string_p msg, const char *prefix) {
 }
 
 tstatic otrng_result initialize_fragments(fragment_context_s *context) {
-  context->fragments = otrng_xmalloc_z(sizeof(string_p) * context->total);
+  context->fragments = otrng_xmalloc_in(OTRNG_ALLOC_FRAGMENTS,
+                                        sizeof(string_p) * context->total);
+  otrng_footprint_charge(context->footprint, OTRNG_FOOTPRINT_FRAGMENTS,
+                         sizeof(string_p) * context->total, 0);
 
   return OTRNG_SUCCESS;
 }
@@ -214,7 +236,9 @@ tstatic otrng_result copy_fragment_to_context(fragment_context_s *context,
                                               unsigned short i,
                                               const string_p msg,
                                               uint32_t fragment_len) {
-  char *fragment = otrng_xmalloc(fragment_len + 1);
+  char *fragment = otrng_xmalloc_in(OTRNG_ALLOC_FRAGMENTS, fragment_len + 1);
+  otrng_footprint_charge(context->footprint, OTRNG_FOOTPRINT_FRAGMENTS,
+                         fragment_len + 1, 0);
 
   memcpy(fragment, msg, fragment_len);
   fragment[fragment_len] = '\0';
@@ -224,8 +248,9 @@ tstatic otrng_result copy_fragment_to_context(fragment_context_s *context,
 }
 
 INTERNAL otrng_result otrng_unfragment_message_generic(
-    char **unfrag_msg, list_element_s **contexts, const string_p msg,
-    const uint32_t our_instance_tag, const char *prefix, const char *format) {
+    char **unfrag_msg, otrng_tail_list_s *contexts, const string_p msg,
+    const uint32_t our_instance_tag, const char *prefix, const char *format,
+    otrng_footprint_totals_s *footprint) {
   int start = 0, end = 0;
   uint32_t fragment_identifier = 0, sender_tag = 0, receiver_tag = 0;
   uint16_t i = 0, t = 0;
@@ -264,7 +289,7 @@ INTERNAL otrng_result otrng_unfragment_message_generic(
     return OTRNG_ERROR;
   }
 
-  for (current = *contexts; current; current = current->next) {
+  for (current = contexts->head; current; current = current->next) {
     if (!current->data) {
       continue;
     }
@@ -279,7 +304,11 @@ INTERNAL otrng_result otrng_unfragment_message_generic(
   if (!context) {
     context = otrng_fragment_context_new();
     context->identifier = fragment_identifier;
-    *contexts = otrng_list_add(context, *contexts);
+    context->footprint = footprint;
+    otrng_footprint_charge(footprint, OTRNG_FOOTPRINT_FRAGMENTS,
+                           FRAGMENT_CONTEXT_BYTES, 0);
+    otrng_tail_list_append(contexts, context);
+    current = contexts->tail;
   }
 
   if (i == 0 || t == 0 || i > t) {
@@ -314,10 +343,8 @@ INTERNAL otrng_result otrng_unfragment_message_generic(
 
   if (context->count == t) {
     if (otrng_succeeded(join_fragments(unfrag_msg, context))) {
-      list_element_s *to_remove = otrng_list_get_by_value(context, *contexts);
-      *contexts = otrng_list_remove_element(to_remove, *contexts);
+      otrng_tail_list_remove(contexts, current);
       otrng_fragment_context_free(context);
-      otrng_list_free_nodes(to_remove);
       return OTRNG_SUCCESS;
     }
     return OTRNG_ERROR;
@@ -325,33 +352,30 @@ INTERNAL otrng_result otrng_unfragment_message_generic(
 
   return OTRNG_SUCCESS;
 }
-INTERNAL otrng_result
-otrng_unfragment_message(char **unfrag_msg, list_element_s **contexts,
-                         const string_p msg, const uint32_t our_instance_tag) {
-  return otrng_unfragment_message_generic(
-      unfrag_msg, contexts, msg, our_instance_tag, "?OTR|", UNFRAGMENT_FORMAT);
+INTERNAL otrng_result otrng_unfragment_message(
+    char **unfrag_msg, otrng_tail_list_s *contexts, const string_p msg,
+    const uint32_t our_instance_tag, otrng_footprint_totals_s *footprint) {
+  return otrng_unfragment_message_generic(unfrag_msg, contexts, msg,
+                                          our_instance_tag, "?OTR|",
+                                          UNFRAGMENT_FORMAT, footprint);
 }
 
 INTERNAL otrng_result otrng_expire_fragments(time_t now,
                                              uint32_t expiration_time,
-                                             list_element_s **contexts) {
-  list_element_s *current = *contexts;
+                                             otrng_tail_list_s *contexts) {
+  list_element_s *current = contexts->head;
 
   while (current) {
     fragment_context_s *ctx = current->data;
+    list_element_s *next = current->next;
 
-    list_element_s *to_free = NULL;
     if ((ctx != NULL) &&
         (difftime(now, ctx->last_fragment_received_at) < expiration_time)) {
-      *contexts = otrng_list_remove_element(current, *contexts);
+      otrng_tail_list_remove(contexts, current);
       otrng_fragment_context_free(ctx);
-      to_free = current;
     }
 
-    current = current->next;
-    if (to_free) {
-      otrng_list_free_nodes(to_free);
-    }
+    current = next;
   }
 
   return OTRNG_SUCCESS;
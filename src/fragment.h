@@ -29,6 +29,7 @@
 #define OTRNG_FRAGMENT_H
 
 #include "error.h"
+#include "footprint.h"
 #include "list.h"
 #include "shared.h"
 #include "str.h"
@@ -48,6 +49,8 @@ typedef struct fragment_context_s {
   size_t total_message_len;
   time_t last_fragment_received_at;
   string_p *fragments;
+  /* The running totals the context and its fragments are counted in */
+  /*@null@*/ otrng_footprint_totals_s *footprint;
 } fragment_context_s;
 
 INTERNAL void otrng_fragment_context_free(fragment_context_s *context);
@@ -58,18 +61,25 @@ INTERNAL otrng_result otrng_fragment_message(int max_size,
                                              uint32_t their_instance,
                                              const string_p msg);
 
-INTERNAL otrng_result otrng_unfragment_message(char **unfrag_msg,
-                                               list_element_s **contexts,
-                                               const string_p msg,
-                                               const uint32_t our_instance_tag);
+/**
+ * @brief Adds the fragment [msg] to the one of [contexts] it belongs to, and
+ *    sets [unfrag_msg] to the whole message once every fragment is in. New
+ *    contexts, and the fragments kept in them, are counted in [footprint],
+ *    which can be NULL.
+ **/
+INTERNAL otrng_result otrng_unfragment_message(
+    char **unfrag_msg, otrng_tail_list_s *contexts, const string_p msg,
+    const uint32_t our_instance_tag,
+    /*@null@*/ otrng_footprint_totals_s *footprint);
 
 INTERNAL otrng_result otrng_unfragment_message_generic(
-    char **unfrag_msg, list_element_s **contexts, const string_p msg,
-    const uint32_t our_instance_tag, const char *prefix, const char *format);
+    char **unfrag_msg, otrng_tail_list_s *contexts, const string_p msg,
+    const uint32_t our_instance_tag, const char *prefix, const char *format,
+    /*@null@*/ otrng_footprint_totals_s *footprint);
 
 INTERNAL otrng_result otrng_expire_fragments(time_t now,
                                              uint32_t expiration_time,
-                                             list_element_s **contexts);
+                                             otrng_tail_list_s *contexts);
 
 #ifdef OTRNG_FRAGMENT_PRIVATE
 
@@ -34,7 +34,8 @@
 #include "debug.h"
 
 tstatic ratchet_s *ratchet_new() {
-  ratchet_s *ratchet = otrng_secure_alloc(sizeof(ratchet_s));
+  ratchet_s *ratchet =
+      otrng_secure_alloc_in(OTRNG_ALLOC_RATCHET, sizeof(ratchet_s));
 
   return ratchet;
 }
@@ -48,31 +49,55 @@ tstatic void ratchet_free(ratchet_s *ratchet) {
   otrng_secure_wipe(ratchet->chain_s, CHAIN_KEY_BYTES);
   otrng_secure_wipe(ratchet->chain_r, CHAIN_KEY_BYTES);
 
-  otrng_secure_free(ratchet);
+  otrng_secure_free_in(OTRNG_ALLOC_RATCHET, ratchet, sizeof(ratchet_s));
 }
 
 INTERNAL void otrng_key_manager_init(key_manager_s *manager) {
   memset(manager, 0, sizeof(key_manager_s));
   manager->current = ratchet_new();
   manager->ssid_half_first = otrng_false;
-  manager->our_ecdh = otrng_secure_alloc(sizeof(ecdh_keypair_s));
-  manager->our_dh = otrng_secure_alloc(sizeof(dh_keypair_s));
+  manager->our_ecdh =
+      otrng_secure_alloc_in(OTRNG_ALLOC_RATCHET, sizeof(ecdh_keypair_s));
+  manager->our_dh =
+      otrng_secure_alloc_in(OTRNG_ALLOC_RATCHET, sizeof(dh_keypair_s));
   manager->our_dh->pub = NULL;
   manager->our_dh->priv = NULL;
 }
 
 INTERNAL key_manager_s *otrng_key_manager_new(void) {
-  key_manager_s *manager = otrng_secure_alloc(sizeof(key_manager_s));
+  key_manager_s *manager =
+      otrng_secure_alloc_in(OTRNG_ALLOC_RATCHET, sizeof(key_manager_s));
   otrng_key_manager_init(manager);
   return manager;
 }
 
+INTERNAL void
+otrng_key_manager_set_footprint(key_manager_s *manager,
+                                otrng_footprint_totals_s *footprint) {
+  manager->footprint = footprint;
+  otrng_key_manager_update_footprint(manager);
+}
+
+INTERNAL void otrng_key_manager_update_footprint(const key_manager_s *manager) {
+  size_t num_old_mac_keys = otrng_vector_len(&manager->old_mac_keys);
+  size_t num_skipped_keys = otrng_tail_list_len(&manager->skipped_keys);
+
+  otrng_footprint_set(manager->footprint, OTRNG_FOOTPRINT_SKIPPED_KEYS,
+                      num_skipped_keys * sizeof(list_element_s),
+                      num_skipped_keys * sizeof(skipped_keys_s));
+  otrng_footprint_set(manager->footprint, OTRNG_FOOTPRINT_OLD_MAC_KEYS,
+                      manager->old_mac_keys.capacity * sizeof(void *),
+                      num_old_mac_keys * MAC_KEY_BYTES);
+}
+
 INTERNAL void otrng_key_manager_destroy(key_manager_s *manager) {
   otrng_ecdh_keypair_destroy(manager->our_ecdh);
-  otrng_secure_free(manager->our_ecdh);
+  otrng_secure_free_in(OTRNG_ALLOC_RATCHET, manager->our_ecdh,
+                       sizeof(ecdh_keypair_s));
 
   otrng_dh_keypair_destroy(manager->our_dh);
-  otrng_secure_free(manager->our_dh);
+  otrng_secure_free_in(OTRNG_ALLOC_RATCHET, manager->our_dh,
+                       sizeof(dh_keypair_s));
 
   otrng_ec_point_destroy(manager->their_ecdh);
 
@@ -93,18 +118,29 @@ INTERNAL void otrng_key_manager_destroy(key_manager_s *manager) {
   manager->ssid_half_first = otrng_false;
   otrng_secure_wipe(manager->extra_symmetric_key, EXTRA_SYMMETRIC_KEY_BYTES);
 
-  otrng_list_free(manager->skipped_keys, otrng_secure_free);
-  manager->skipped_keys = NULL;
+  otrng_tail_list_free(&manager->skipped_keys, otrng_skipped_keys_free);
 
-  otrng_list_free(manager->old_mac_keys, otrng_secure_free);
-  manager->old_mac_keys = NULL;
+  otrng_vector_free(&manager->old_mac_keys, otrng_old_mac_key_free);
+  otrng_key_manager_update_footprint(manager);
 
   otrng_secure_wipe(manager, sizeof(key_manager_s));
 }
 
 INTERNAL void otrng_key_manager_free(key_manager_s *manager) {
+  if (!manager) {
+    return;
+  }
+
   otrng_key_manager_destroy(manager);
-  otrng_secure_free(manager);
+  otrng_secure_free_in(OTRNG_ALLOC_RATCHET, manager, sizeof(key_manager_s));
+}
+
+INTERNAL void otrng_skipped_keys_free(void *keys) {
+  otrng_secure_free_in(OTRNG_ALLOC_RATCHET, keys, sizeof(skipped_keys_s));
+}
+
+INTERNAL void otrng_old_mac_key_free(void *mac_key) {
+  otrng_secure_free_in(OTRNG_ALLOC_RATCHET, mac_key, MAC_KEY_BYTES);
 }
 
 INTERNAL void otrng_key_manager_wipe_shared_prekeys(key_manager_s *manager) {
@@ -116,8 +152,8 @@ INTERNAL void otrng_key_manager_wipe_shared_prekeys(key_manager_s *manager) {
 
 INTERNAL /*@null@*/ receiving_ratchet_s *
 otrng_receiving_ratchet_new(key_manager_s *manager) {
-  receiving_ratchet_s *ratchet =
-      otrng_secure_alloc(sizeof(receiving_ratchet_s));
+  receiving_ratchet_s *ratchet = otrng_secure_alloc_in(
+      OTRNG_ALLOC_RATCHET, sizeof(receiving_ratchet_s));
   otrng_ec_scalar_copy(ratchet->our_ecdh_priv, manager->our_ecdh->priv);
   ratchet->our_dh_priv = NULL;
 
@@ -175,6 +211,7 @@ INTERNAL void otrng_receiving_ratchet_copy(key_manager_s *dst,
          EXTRA_SYMMETRIC_KEY_BYTES);
 
   dst->skipped_keys = src->skipped_keys;
+  otrng_key_manager_update_footprint(dst);
 }
 
 INTERNAL void otrng_receiving_ratchet_destroy(receiving_ratchet_s *ratchet) {
@@ -194,7 +231,8 @@ INTERNAL void otrng_receiving_ratchet_destroy(receiving_ratchet_s *ratchet) {
   otrng_secure_wipe(ratchet->chain_r, CHAIN_KEY_BYTES);
   otrng_secure_wipe(ratchet->extra_symmetric_key, EXTRA_SYMMETRIC_KEY_BYTES);
 
-  otrng_secure_free(ratchet);
+  otrng_secure_free_in(OTRNG_ALLOC_RATCHET, ratchet,
+                       sizeof(receiving_ratchet_s));
 }
 
 INTERNAL void otrng_key_manager_set_their_tmp_keys(
@@ -893,52 +931,35 @@ tstatic otrng_result calculate_extra_key(
     key_manager_s *manager, receiving_ratchet_s *tmp_receiving_ratchet,
     const char action) {
   goldilocks_shake256_ctx_p hd;
-  uint8_t *extra_key_buffer = otrng_secure_alloc(EXTRA_SYMMETRIC_KEY_BYTES);
   uint8_t magic[1] = {0xFF};
+  const uint8_t *chain_key;
+  uint8_t *extra_key;
 
-  if (!hash_init_with_usage(hd, usage_extra_symm_key)) {
-    otrng_secure_free(extra_key_buffer);
-    return OTRNG_ERROR;
+  /* The key is hashed straight into where it is kept, which is already secure
+     memory */
+  assert(action == 's' || action == 'r');
+  if (action == 's') {
+    chain_key = manager->current->chain_s;
+    extra_key = manager->extra_symmetric_key;
+  } else {
+    chain_key = tmp_receiving_ratchet->chain_r;
+    extra_key = tmp_receiving_ratchet->extra_symmetric_key;
   }
 
-  if (hash_update(hd, magic, 1) == GOLDILOCKS_FAILURE) {
-    hash_destroy(hd);
-    otrng_secure_free(extra_key_buffer);
+  if (!hash_init_with_usage(hd, usage_extra_symm_key)) {
     return OTRNG_ERROR;
   }
 
   /* extra_symm_key = KDF_1(usage_extra_symm_key || 0xFF || chain_key_s[i-1][j],
    * 64) */
-  assert(action == 's' || action == 'r');
-  if (action == 's') {
-    if (hash_update(hd, manager->current->chain_s, CHAIN_KEY_BYTES) ==
-        GOLDILOCKS_FAILURE) {
-      hash_destroy(hd);
-      otrng_secure_free(extra_key_buffer);
-      return OTRNG_ERROR;
-    }
-
-    hash_final(hd, extra_key_buffer, EXTRA_SYMMETRIC_KEY_BYTES);
-    hash_destroy(hd);
-
-    memcpy(manager->extra_symmetric_key, extra_key_buffer,
-           EXTRA_SYMMETRIC_KEY_BYTES);
-  } else if (action == 'r') {
-    if (hash_update(hd, tmp_receiving_ratchet->chain_r, CHAIN_KEY_BYTES) ==
-        GOLDILOCKS_FAILURE) {
-      hash_destroy(hd);
-      otrng_secure_wipe(extra_key_buffer, EXTRA_SYMMETRIC_KEY_BYTES);
-      otrng_free(extra_key_buffer);
-      return OTRNG_ERROR;
-    }
-
-    hash_final(hd, extra_key_buffer, EXTRA_SYMMETRIC_KEY_BYTES);
+  if (hash_update(hd, magic, 1) == GOLDILOCKS_FAILURE ||
+      hash_update(hd, chain_key, CHAIN_KEY_BYTES) == GOLDILOCKS_FAILURE) {
     hash_destroy(hd);
-
-    memcpy(tmp_receiving_ratchet->extra_symmetric_key, extra_key_buffer,
-           EXTRA_SYMMETRIC_KEY_BYTES);
+    return OTRNG_ERROR;
   }
-  otrng_secure_free(extra_key_buffer);
+
+  hash_final(hd, extra_key, EXTRA_SYMMETRIC_KEY_BYTES);
+  hash_destroy(hd);
 
 // TODO: add to tmp
 #ifdef DEBUG
@@ -1004,7 +1025,8 @@ tstatic otrng_result store_enc_keys(
         return OTRNG_ERROR;
       }
 
-      skipped_msg_enc_key = otrng_secure_alloc(sizeof(skipped_keys_s));
+      skipped_msg_enc_key =
+          otrng_secure_alloc_in(OTRNG_ALLOC_RATCHET, sizeof(skipped_keys_s));
 
       assert(ratchet_type == 'd' || ratchet_type == 'c');
 
@@ -1027,8 +1049,8 @@ tstatic otrng_result store_enc_keys(
          1. session expired
          2. the key is retrieved
       */
-      tmp_receiving_ratchet->skipped_keys = otrng_list_add(
-          skipped_msg_enc_key, tmp_receiving_ratchet->skipped_keys);
+      otrng_tail_list_append(&tmp_receiving_ratchet->skipped_keys,
+                             skipped_msg_enc_key);
       otrng_secure_wipe(enc_key, ENC_KEY_BYTES);
       tmp_receiving_ratchet->k++;
     }
@@ -1046,7 +1068,7 @@ INTERNAL otrng_result otrng_key_get_skipped_keys(
     k_msg_enc enc_key, k_msg_mac mac_key, ec_point msg_ecdh,
     unsigned int msg_id, key_manager_s *manager,
     receiving_ratchet_s *tmp_receiving_ratchet) {
-  list_element_s *current = tmp_receiving_ratchet->skipped_keys;
+  list_element_s *current = tmp_receiving_ratchet->skipped_keys.head;
   (void)manager;
 
   while (current) {
@@ -1064,9 +1086,8 @@ INTERNAL otrng_result otrng_key_get_skipped_keys(
       memcpy(tmp_receiving_ratchet->extra_symmetric_key,
              skipped_keys->extra_symmetric_key, EXTRA_SYMMETRIC_KEY_BYTES);
 
-      tmp_receiving_ratchet->skipped_keys = otrng_list_remove_element(
-          current, tmp_receiving_ratchet->skipped_keys);
-      otrng_list_free(current, otrng_secure_free);
+      otrng_tail_list_remove(&tmp_receiving_ratchet->skipped_keys, current);
+      otrng_skipped_keys_free(skipped_keys);
 
       return OTRNG_SUCCESS;
     }
@@ -1153,18 +1174,21 @@ INTERNAL otrng_result otrng_key_manager_derive_dh_ratchet_keys(
 
 INTERNAL otrng_result otrng_store_old_mac_keys(key_manager_s *manager,
                                                k_msg_mac mac_key) {
-  uint8_t *to_store_mac = otrng_secure_alloc(MAC_KEY_BYTES);
+  uint8_t *to_store_mac =
+      otrng_secure_alloc_in(OTRNG_ALLOC_RATCHET, MAC_KEY_BYTES);
 
   memcpy(to_store_mac, mac_key, ENC_KEY_BYTES);
-  manager->old_mac_keys = otrng_list_add(to_store_mac, manager->old_mac_keys);
+  otrng_vector_push(&manager->old_mac_keys, to_store_mac);
+  otrng_key_manager_update_footprint(manager);
 
   return OTRNG_SUCCESS;
 }
 
 INTERNAL /*@null@*/ uint8_t *
 otrng_reveal_mac_keys_on_tlv(key_manager_s *manager) {
-  size_t num_stored_keys = otrng_list_len(manager->skipped_keys);
+  size_t num_stored_keys = otrng_tail_list_len(&manager->skipped_keys);
   size_t serlen = num_stored_keys * MAC_KEY_BYTES;
+  const list_element_s *current;
   uint8_t *ser_mac_keys;
   k_msg_mac mac_key;
   k_msg_enc enc_key;
@@ -1176,9 +1200,15 @@ otrng_reveal_mac_keys_on_tlv(key_manager_s *manager) {
     memset(enc_key, 0, ENC_KEY_BYTES);
     memset(mac_key, 0, MAC_KEY_BYTES);
 
-    for (i = 0; i < num_stored_keys; i++) {
-      list_element_s *last = otrng_list_get_last(manager->skipped_keys);
-      skipped_keys_s *skipped_keys = last->data;
+    /* Newest first, in a single pass */
+    for (i = 0, current = manager->skipped_keys.head; current;
+         current = current->next) {
+      skipped_keys_s *skipped_keys = current->data;
+      if (!skipped_keys) {
+        continue;
+      }
+
+      assert(i < num_stored_keys);
       memcpy(enc_key, skipped_keys->enc_key, ENC_KEY_BYTES);
 
       if (!shake_256_kdf1(mac_key, MAC_KEY_BYTES, usage_mac_key, enc_key,
@@ -1187,12 +1217,12 @@ otrng_reveal_mac_keys_on_tlv(key_manager_s *manager) {
         return NULL;
       }
 
-      memcpy(ser_mac_keys + i * MAC_KEY_BYTES, mac_key, MAC_KEY_BYTES);
-      manager->skipped_keys =
-          otrng_list_remove_element(last, manager->skipped_keys);
-      otrng_list_free(last, otrng_secure_free);
+      memcpy(ser_mac_keys + (num_stored_keys - 1 - i) * MAC_KEY_BYTES, mac_key,
+             MAC_KEY_BYTES);
+      i++;
     }
-    otrng_list_free_nodes(manager->skipped_keys);
+    otrng_tail_list_free(&manager->skipped_keys, otrng_skipped_keys_free);
+    otrng_key_manager_update_footprint(manager);
 
     return ser_mac_keys;
   }
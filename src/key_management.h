@@ -32,6 +32,7 @@
 #include "constants.h"
 #include "dh.h"
 #include "ed448.h"
+#include "footprint.h"
 #include "keys.h"
 #include "list.h"
 #include "shared.h"
@@ -83,7 +84,7 @@ typedef struct receiving_ratchet_s {
 
   k_extra_symmetric extra_symmetric_key;
 
-  list_element_s *skipped_keys;
+  otrng_tail_list_s skipped_keys;
 } receiving_ratchet_s;
 
 /* represents the different values needed for key management */
@@ -117,10 +118,13 @@ typedef struct key_manager_s {
   k_extra_symmetric extra_symmetric_key;
   uint8_t tmp_key[HASH_BYTES];
 
-  list_element_s *skipped_keys;
-  list_element_s *old_mac_keys;
+  otrng_tail_list_s skipped_keys;
+  otrng_vector_s old_mac_keys; /* k_msg_mac, oldest first */
 
   time_t last_generated;
+
+  /* The running totals skipped_keys and old_mac_keys are counted in */
+  /*@null@*/ otrng_footprint_totals_s *footprint;
 } key_manager_s;
 
 /*
@@ -151,6 +155,35 @@ INTERNAL void otrng_key_manager_destroy(key_manager_s *manager);
  */
 INTERNAL void otrng_key_manager_free(key_manager_s *manager);
 
+/**
+ * @brief Counts the skipped keys and old mac keys of [manager] in
+ *    [footprint], from now on. Called again after the manager is initialized.
+ *
+ * @param [manager]   The key manager.
+ * @param [footprint] The running totals of its conversation.
+ */
+INTERNAL void
+otrng_key_manager_set_footprint(key_manager_s *manager,
+                                /*@null@*/ otrng_footprint_totals_s *footprint);
+
+/**
+ * @brief Brings the footprint of [manager] in line with the keys it holds,
+ *    after they are changed from outside it.
+ *
+ * @param [manager]   The key manager.
+ */
+INTERNAL void otrng_key_manager_update_footprint(const key_manager_s *manager);
+
+/**
+ * @brief Frees a [skipped_keys_s], as stored in the skipped keys lists.
+ */
+INTERNAL void otrng_skipped_keys_free(void *keys);
+
+/**
+ * @brief Frees a mac key, as stored in the old mac keys.
+ */
+INTERNAL void otrng_old_mac_key_free(void *mac_key);
+
 /**
  * @brief Securely deletes the shared prekeys used in the DAKE.
  *
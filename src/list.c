@@ -19,6 +19,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #define OTRNG_LIST_PRIVATE
 
@@ -193,3 +194,158 @@ INTERNAL size_t otrng_list_len(list_element_s *head) {
 
   return size;
 }
+
+INTERNAL void otrng_tail_list_init(otrng_tail_list_s *list) {
+  list->head = NULL;
+  list->tail = NULL;
+  list->len = 0;
+}
+
+INTERNAL void otrng_tail_list_append(otrng_tail_list_s *list, void *data) {
+  list_element_s *n = list_new();
+
+  n->data = data;
+
+  if (list->tail) {
+    list->tail->next = n;
+  } else {
+    list->head = n;
+  }
+
+  list->tail = n;
+  list->len++;
+}
+
+INTERNAL void otrng_tail_list_remove(otrng_tail_list_s *list,
+                                     list_element_s *node) {
+  list_element_s *previous = NULL, *cursor = list->head;
+
+  while (cursor && cursor != node) {
+    previous = cursor;
+    cursor = cursor->next;
+  }
+
+  if (!cursor) {
+    return;
+  }
+
+  if (previous) {
+    previous->next = node->next;
+  } else {
+    list->head = node->next;
+  }
+
+  if (list->tail == node) {
+    list->tail = previous;
+  }
+
+  list->len--;
+  otrng_free(node);
+}
+
+INTERNAL size_t otrng_tail_list_len(const otrng_tail_list_s *list) {
+  return list->len;
+}
+
+INTERNAL void otrng_tail_list_foreach(otrng_tail_list_s *list,
+                                      void (*fn)(list_element_s *node,
+                                                 void *context),
+                                      void *context) {
+  otrng_list_foreach(list->head, fn, context);
+}
+
+INTERNAL void otrng_tail_list_copy(otrng_tail_list_s *dst,
+                                   const otrng_tail_list_s *src) {
+  const list_element_s *cursor;
+
+  otrng_tail_list_init(dst);
+  for (cursor = src->head; cursor; cursor = cursor->next) {
+    otrng_tail_list_append(dst, cursor->data);
+  }
+}
+
+INTERNAL void otrng_tail_list_free(otrng_tail_list_s *list,
+                                   void (*fn)(void *data)) {
+  otrng_list_free(list->head, fn);
+  otrng_tail_list_init(list);
+}
+
+INTERNAL void otrng_vector_init(otrng_vector_s *vector) {
+  vector->items = NULL;
+  vector->len = 0;
+  vector->capacity = 0;
+}
+
+INTERNAL void otrng_vector_push(otrng_vector_s *vector, void *data) {
+  if (vector->len == vector->capacity) {
+    vector->capacity = vector->capacity ? vector->capacity * 2 : 8;
+    vector->items =
+        otrng_xrealloc(vector->items, vector->capacity * sizeof(void *));
+  }
+
+  vector->items[vector->len++] = data;
+}
+
+INTERNAL void *otrng_vector_get(const otrng_vector_s *vector, size_t i) {
+  if (i >= vector->len) {
+    return NULL;
+  }
+
+  return vector->items[i];
+}
+
+INTERNAL void *otrng_vector_remove(otrng_vector_s *vector, size_t i) {
+  void *data;
+
+  if (i >= vector->len) {
+    return NULL;
+  }
+
+  data = vector->items[i];
+  memmove(vector->items + i, vector->items + i + 1,
+          (vector->len - i - 1) * sizeof(void *));
+  vector->len--;
+
+  return data;
+}
+
+INTERNAL size_t otrng_vector_len(const otrng_vector_s *vector) {
+  return vector->len;
+}
+
+INTERNAL void otrng_vector_foreach(otrng_vector_s *vector,
+                                   void (*fn)(void *data, void *context),
+                                   void *context) {
+  size_t i;
+
+  for (i = 0; i < vector->len; i++) {
+    fn(vector->items[i], context);
+  }
+}
+
+INTERNAL void otrng_vector_copy(otrng_vector_s *dst,
+                                const otrng_vector_s *src) {
+  otrng_vector_init(dst);
+  if (src->len == 0) {
+    return;
+  }
+
+  dst->items = otrng_xmalloc(src->len * sizeof(void *));
+  memcpy(dst->items, src->items, src->len * sizeof(void *));
+  dst->len = src->len;
+  dst->capacity = src->len;
+}
+
+INTERNAL void otrng_vector_free(otrng_vector_s *vector,
+                                void (*fn)(void *data)) {
+  size_t i;
+
+  if (fn) {
+    for (i = 0; i < vector->len; i++) {
+      fn(vector->items[i]);
+    }
+  }
+
+  otrng_free(vector->items);
+  otrng_vector_init(vector);
+}
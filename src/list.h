@@ -70,6 +70,92 @@ INTERNAL list_element_s *otrng_list_remove_element(const list_element_s *wanted,
 
 INTERNAL size_t otrng_list_len(list_element_s *head);
 
+/**
+ * @brief A list that keeps track of its last node and its length, so that
+ *    appending and counting take constant time.
+ *
+ *  [head] the first node. The usual otrng_list_* lookups can be given it,
+ *         but changes must go through the otrng_tail_list_* functions.
+ *  [tail] the last node
+ *  [len]  the number of nodes
+ **/
+typedef struct otrng_tail_list_s {
+  /*@null@*/ list_element_s *head;
+  /*@null@*/ list_element_s *tail;
+  size_t len;
+} otrng_tail_list_s;
+
+INTERNAL void otrng_tail_list_init(otrng_tail_list_s *list);
+
+INTERNAL void otrng_tail_list_append(otrng_tail_list_s *list, void *data);
+
+/**
+ * @brief Unlinks [node] from [list] and frees it, but not its data. Removing
+ *    the first node takes constant time, any other one has to be looked for.
+ **/
+INTERNAL void otrng_tail_list_remove(otrng_tail_list_s *list,
+                                     list_element_s *node);
+
+INTERNAL size_t otrng_tail_list_len(const otrng_tail_list_s *list);
+
+INTERNAL void otrng_tail_list_foreach(otrng_tail_list_s *list,
+                                      void (*fn)(list_element_s *node,
+                                                 void *context),
+                                      /*@null@*/ void *context);
+
+/**
+ * @brief Makes [dst] a list of the same data as [src]. The data is shared,
+ *    not copied.
+ **/
+INTERNAL void otrng_tail_list_copy(otrng_tail_list_s *dst,
+                                   const otrng_tail_list_s *src);
+
+// Empty the list and invoke fn to free the nodes' data
+INTERNAL void otrng_tail_list_free(otrng_tail_list_s *list,
+                                   /*@null@*/ void (*fn)(void *data));
+
+/**
+ * @brief A growable array of pointers.
+ *
+ *  [items]    the pointers
+ *  [len]      how many of them are used
+ *  [capacity] how many fit before the array has to grow
+ **/
+typedef struct otrng_vector_s {
+  /*@null@*/ void **items;
+  size_t len;
+  size_t capacity;
+} otrng_vector_s;
+
+INTERNAL void otrng_vector_init(otrng_vector_s *vector);
+
+INTERNAL void otrng_vector_push(otrng_vector_s *vector, void *data);
+
+INTERNAL void *otrng_vector_get(const otrng_vector_s *vector, size_t i);
+
+/**
+ * @brief Removes the item at [i], keeping the order of the others, and
+ *    returns it.
+ **/
+INTERNAL void *otrng_vector_remove(otrng_vector_s *vector, size_t i);
+
+INTERNAL size_t otrng_vector_len(const otrng_vector_s *vector);
+
+INTERNAL void otrng_vector_foreach(otrng_vector_s *vector,
+                                   void (*fn)(void *data, void *context),
+                                   /*@null@*/ void *context);
+
+/**
+ * @brief Makes [dst] a vector of the same data as [src]. The data is shared,
+ *    not copied.
+ **/
+INTERNAL void otrng_vector_copy(otrng_vector_s *dst,
+                                const otrng_vector_s *src);
+
+// Empty the vector and invoke fn to free the items
+INTERNAL void otrng_vector_free(otrng_vector_s *vector,
+                                /*@null@*/ void (*fn)(void *data));
+
 #ifdef OTRNG_LIST_PRIVATE
 
 tstatic /*@only@*/ /*@notnull@*/ list_element_s *list_new(void);
@@ -25,14 +25,20 @@
 #pragma clang diagnostic pop
 #endif
 
+#include <time.h>
+
 #define OTRNG_MESSAGING_PRIVATE
 #define OTRNG_PERSISTENCE_PRIVATE
 
 #include "alloc.h"
 #include "debug.h"
+#include "fingerprint_journal.h"
 #include "messaging.h"
+#include "metrics.h"
 #include "persistence.h"
 #include "prekey_manager.h"
+#include "worker.h"
+#include "write_back.h"
 
 API otrng_global_state_s *
 otrng_global_state_new(const otrng_client_callbacks_s *cb, otrng_bool die) {
@@ -47,6 +53,7 @@ otrng_global_state_new(const otrng_client_callbacks_s *cb, otrng_bool die) {
   }
 
   gs->callbacks = cb;
+  gs->metrics = otrng_metrics_state_new();
   gs->user_state_v3 = otrl_userstate_create();
   if (gs->user_state_v3 == NULL) {
     if (die) {
@@ -64,8 +71,31 @@ API void otrng_global_state_free(otrng_global_state_s *gs) {
     return;
   }
 
+  /* Any SMP job still in flight refers to conversations of our clients. The
+     worker itself is kept until they are freed, since they wait on it */
+  if (gs->smp_worker) {
+    otrng_worker_wait(gs->smp_worker);
+  }
+  if (gs->prekey_worker) {
+    otrng_worker_wait(gs->prekey_worker);
+  }
+  /* Changes that are still only marked as dirty are stored now, while the
+     clients, the fingerprint journal and the persistence worker are still
+     around: storing them can start a compaction of the journal on it */
+  otrng_global_state_set_write_back(gs, otrng_false, 0);
+  otrng_fingerprint_journal_free(gs->fingerprint_journal,
+                                 gs->persistence_worker);
+  gs->fingerprint_journal = NULL;
+  otrng_worker_free(gs->prekey_worker);
+  gs->prekey_worker = NULL;
+  otrng_worker_free(gs->persistence_worker);
+  gs->persistence_worker = NULL;
+
   otrng_list_free(gs->clients, free_client);
+  otrng_worker_free(gs->smp_worker);
+  gs->smp_worker = NULL;
   otrl_userstate_free(gs->user_state_v3);
+  otrng_metrics_state_free(gs->metrics);
 
   otrng_free(gs);
 }
@@ -475,16 +505,9 @@ API otrng_result otrng_global_state_expired_prekey_profile_read_from(
                                 otrng_client_expired_prekey_profile_read_from);
 }
 
-tstatic void prekey_global_state_message_free_from_list(void *prekeys) {
-  otrng_prekey_message_free(prekeys);
-}
-
 tstatic void free_prekeys_from(list_element_s *node, void *ignored) {
-  otrng_client_s *client = node->data;
   (void)ignored;
-  otrng_list_free(client->our_prekeys,
-                  prekey_global_state_message_free_from_list);
-  client->our_prekeys = NULL;
+  otrng_client_clear_prekey_messages(node->data);
 }
 
 API otrng_result otrng_global_state_prekeys_read_from(
@@ -624,12 +647,17 @@ tstatic void poll_for_client(list_element_s *node, void *context) {
   (void)context;
   otrng_client_expire_sessions(client);
   (void)otrng_client_expire_fragments(client);
+  otrng_client_hibernate_idle(client, time(NULL));
   otrng_prekey_check_account_request(client);
 }
 
 API void otrng_poll(otrng_global_state_s *gs) {
   otrng_list_foreach(gs->clients, poll_for_client, NULL);
   otrl_message_poll(gs->user_state_v3, NULL, NULL);
+
+  if (gs->write_back) {
+    (void)otrng_global_state_write_back_flush(gs, otrng_false, NULL);
+  }
 }
 
 INTERNAL void
@@ -637,9 +665,22 @@ otrng_global_state_fingerprints_v3_loaded(otrng_global_state_s *gs) {
   gs->fingerprints_v3_loaded = otrng_true;
 }
 
+INTERNAL void otrng_global_state_lock(otrng_global_state_s *gs) {
+  if (gs->shared_lock) {
+    pthread_mutex_lock(gs->shared_lock);
+  }
+}
+
+INTERNAL void otrng_global_state_unlock(otrng_global_state_s *gs) {
+  if (gs->shared_lock) {
+    pthread_mutex_unlock(gs->shared_lock);
+  }
+}
+
 #ifdef DEBUG_API
 
 #include "debug.h"
+#include "fingerprint_journal.h"
 
 static const char **debug_print_ignores = NULL;
 static size_t debug_print_ignores_len;
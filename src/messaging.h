@@ -51,6 +51,8 @@
  * otrng_messaging_client_receiving(client, alice_talking_to_bob);
  */
 
+#include <pthread.h>
+
 #include "client.h"
 #include "list.h"
 #include "shared.h"
@@ -61,6 +63,28 @@ typedef struct otrng_global_state_s {
   const otrng_client_callbacks_s *callbacks;
   OtrlUserState user_state_v3;
   otrng_bool fingerprints_v3_loaded;
+
+  /* Created on first use by clients in asynchronous SMP mode */
+  /*@null@*/ struct otrng_worker_s *smp_worker;
+
+  /* Created on first use by clients with a prekey reservoir */
+  /*@null@*/ struct otrng_worker_s *prekey_worker;
+
+  /* Set with otrng_global_state_set_fingerprint_journal */
+  /*@null@*/ struct otrng_fingerprint_journal_s *fingerprint_journal;
+
+  /* Set with otrng_global_state_set_write_back */
+  /*@null@*/ struct otrng_write_back_s *write_back;
+
+  /* Created on first use for writes that happen in the background */
+  /*@null@*/ struct otrng_worker_s *persistence_worker;
+
+  /* Only set while otrng_global_state_ensure_correct_state runs clients in
+     parallel. See otrng_global_state_lock */
+  /*@null@*/ pthread_mutex_t *shared_lock;
+
+  /* NULL if the library was built without metrics. See metrics.h */
+  /*@null@*/ struct otrng_metrics_state_s *metrics;
 } otrng_global_state_s;
 
 API otrng_global_state_s *
@@ -189,6 +213,15 @@ API void otrng_poll(otrng_global_state_s *gs);
 INTERNAL void
 otrng_global_state_fingerprints_v3_loaded(otrng_global_state_s *gs);
 
+/**
+ * @brief Serializes calls into the application, and changes to state that is
+ *    shared between clients, while clients are brought up in parallel. Does
+ *    nothing otherwise. The lock is recursive.
+ */
+INTERNAL void otrng_global_state_lock(otrng_global_state_s *gs);
+
+INTERNAL void otrng_global_state_unlock(otrng_global_state_s *gs);
+
 #ifdef DEBUG_API
 
 API void otrng_global_state_debug_print(FILE *, int, otrng_global_state_s *gs);
@@ -0,0 +1,216 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#define OTRNG_METRICS_PRIVATE
+
+#include "alloc.h"
+#include "messaging.h"
+#include "metrics.h"
+
+struct otrng_metrics_state_s {
+  pthread_mutex_t lock;
+  otrng_metrics_s metrics;
+};
+
+static const char *metric_names[OTRNG_NUM_METRICS] = {
+    "dake_start", "dake_identity", "dake_auth_r",  "dake_auth_i",
+    "dake_non_interactive",        "encrypt",      "decrypt",
+    "ratchet",    "keygen",        "smp",          "fragment",
+    "defragment", "prekey_dake1",  "prekey_dake3"};
+
+tstatic size_t histogram_bucket(uint64_t ns) {
+  unsigned int exp = 0;
+  uint64_t v = ns;
+  size_t bucket;
+
+  if (ns < OTRNG_HISTOGRAM_SUB_BUCKETS) {
+    return ns;
+  }
+
+  while (v >>= 1) {
+    exp++;
+  }
+
+  /* exp is at least 2 here: the two bits below the highest one choose the
+     sub bucket */
+  bucket = (exp - 1) * OTRNG_HISTOGRAM_SUB_BUCKETS +
+           ((ns >> (exp - 2)) & (OTRNG_HISTOGRAM_SUB_BUCKETS - 1));
+  if (bucket >= OTRNG_HISTOGRAM_BUCKETS) {
+    return OTRNG_HISTOGRAM_BUCKETS - 1;
+  }
+
+  return bucket;
+}
+
+static uint64_t bucket_lower_bound(size_t bucket) {
+  if (bucket < OTRNG_HISTOGRAM_SUB_BUCKETS) {
+    return bucket;
+  }
+
+  return (uint64_t)(OTRNG_HISTOGRAM_SUB_BUCKETS +
+                    bucket % OTRNG_HISTOGRAM_SUB_BUCKETS)
+         << (bucket / OTRNG_HISTOGRAM_SUB_BUCKETS - 1);
+}
+
+API uint64_t otrng_histogram_bucket_upper_bound(size_t bucket) {
+  if (bucket >= OTRNG_HISTOGRAM_BUCKETS - 1) {
+    return UINT64_MAX;
+  }
+
+  return bucket_lower_bound(bucket + 1);
+}
+
+API uint64_t otrng_histogram_percentile(const otrng_histogram_s *histogram,
+                                        double percentile) {
+  uint64_t rank, seen = 0, bound;
+  size_t i;
+
+  if (histogram->count == 0) {
+    return 0;
+  }
+
+  if (percentile <= 0) {
+    rank = 1;
+  } else if (percentile >= 100) {
+    rank = histogram->count;
+  } else {
+    rank = (uint64_t)(percentile / 100 * (double)histogram->count + 0.5);
+    if (rank == 0) {
+      rank = 1;
+    }
+  }
+
+  for (i = 0; i < OTRNG_HISTOGRAM_BUCKETS; i++) {
+    seen += histogram->buckets[i];
+    if (seen >= rank) {
+      break;
+    }
+  }
+
+  bound = otrng_histogram_bucket_upper_bound(i);
+  if (bound > histogram->max_ns) {
+    return histogram->max_ns;
+  }
+
+  return bound;
+}
+
+API const char *otrng_metric_name(otrng_metric metric) {
+  if ((size_t)metric >= OTRNG_NUM_METRICS) {
+    return "unknown";
+  }
+
+  return metric_names[metric];
+}
+
+#ifdef OTRNG_ENABLE_METRICS
+
+INTERNAL otrng_metrics_state_s *otrng_metrics_state_new(void) {
+  otrng_metrics_state_s *state = otrng_xmalloc_z(sizeof(otrng_metrics_state_s));
+
+  if (pthread_mutex_init(&state->lock, NULL) != 0) {
+    otrng_free(state);
+    return NULL;
+  }
+
+  return state;
+}
+
+INTERNAL uint64_t otrng_metrics_start(void) {
+  struct timespec now;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+/* Operations can run in worker threads, so the metrics are locked */
+INTERNAL void otrng_metrics_record(const otrng_global_state_s *gs,
+                                   otrng_metric metric, uint64_t start,
+                                   otrng_result result) {
+  otrng_metrics_state_s *state;
+  otrng_histogram_s *histogram;
+  uint64_t ns = otrng_metrics_start() - start;
+
+  if (!gs || !gs->metrics || (size_t)metric >= OTRNG_NUM_METRICS) {
+    return;
+  }
+
+  state = gs->metrics;
+  histogram = &state->metrics.histograms[metric];
+
+  pthread_mutex_lock(&state->lock);
+  histogram->count++;
+  if (otrng_failed(result)) {
+    histogram->errors++;
+  }
+  histogram->sum_ns += ns;
+  if (ns > histogram->max_ns) {
+    histogram->max_ns = ns;
+  }
+  histogram->buckets[histogram_bucket(ns)]++;
+  pthread_mutex_unlock(&state->lock);
+}
+
+#else
+
+INTERNAL otrng_metrics_state_s *otrng_metrics_state_new(void) { return NULL; }
+
+#endif
+
+INTERNAL void otrng_metrics_state_free(otrng_metrics_state_s *state) {
+  if (!state) {
+    return;
+  }
+
+  pthread_mutex_destroy(&state->lock);
+  otrng_free(state);
+}
+
+API otrng_result otrng_global_state_get_metrics(
+    otrng_metrics_s *dst, const otrng_global_state_s *gs) {
+  otrng_metrics_state_s *state = gs->metrics;
+
+  if (!state) {
+    return OTRNG_ERROR;
+  }
+
+  pthread_mutex_lock(&state->lock);
+  memcpy(dst, &state->metrics, sizeof(otrng_metrics_s));
+  pthread_mutex_unlock(&state->lock);
+
+  return OTRNG_SUCCESS;
+}
+
+API void otrng_global_state_reset_metrics(otrng_global_state_s *gs) {
+  otrng_metrics_state_s *state = gs->metrics;
+
+  if (!state) {
+    return;
+  }
+
+  pthread_mutex_lock(&state->lock);
+  memset(&state->metrics, 0, sizeof(otrng_metrics_s));
+  pthread_mutex_unlock(&state->lock);
+}
@@ -0,0 +1,188 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Counters and latency histograms for the operations that cost the most: the
+ * steps of the DAKEs, encrypting and decrypting data messages, rotating the
+ * double ratchet, generating ephemeral keys, SMP steps, fragmentation and the
+ * DAKE with the prekey server.
+ *
+ * They are only compiled in with ./configure --enable-metrics, which defines
+ * OTRNG_ENABLE_METRICS. Without it, recording compiles to nothing and
+ * otrng_global_state_get_metrics fails.
+ *
+ * Latencies are kept in log-linear histograms: every power of two of
+ * nanoseconds is split into OTRNG_HISTOGRAM_SUB_BUCKETS buckets of the same
+ * width, so the relative error of a bucket is at most 25%.
+ */
+
+#ifndef OTRNG_METRICS_H
+#define OTRNG_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "error.h"
+#include "shared.h"
+
+struct otrng_global_state_s;
+
+typedef enum {
+  /* Building an Identity message */
+  OTRNG_METRIC_DAKE_START = 0,
+  /* Receiving an Identity message, and replying with an Auth-R message */
+  OTRNG_METRIC_DAKE_IDENTITY,
+  /* Receiving an Auth-R message, and replying with an Auth-I message */
+  OTRNG_METRIC_DAKE_AUTH_R,
+  /* Receiving an Auth-I message */
+  OTRNG_METRIC_DAKE_AUTH_I,
+  /* Receiving a Non-Interactive-Auth message */
+  OTRNG_METRIC_DAKE_NON_INTERACTIVE,
+  /* Preparing and encrypting a data message */
+  OTRNG_METRIC_ENCRYPT,
+  /* Receiving and decrypting a data message, with its TLVs */
+  OTRNG_METRIC_DECRYPT,
+  /* Entering a new DH ratchet, when sending or receiving */
+  OTRNG_METRIC_RATCHET,
+  /* Generating our ephemeral ECDH and, when needed, DH keys for a DAKE */
+  OTRNG_METRIC_KEYGEN,
+  /* Starting an SMP, or processing an SMP message */
+  OTRNG_METRIC_SMP,
+  /* Splitting a message into fragments */
+  OTRNG_METRIC_FRAGMENT,
+  /* Checking whether a received message is a fragment, and reassembling
+     fragmented messages */
+  OTRNG_METRIC_DEFRAGMENT,
+  /* Building a DAKE-1 message for the prekey server */
+  OTRNG_METRIC_PREKEY_DAKE1,
+  /* Receiving a DAKE-2 message from the prekey server, and replying */
+  OTRNG_METRIC_PREKEY_DAKE3,
+} otrng_metric;
+
+#define OTRNG_NUM_METRICS 14
+
+#define OTRNG_HISTOGRAM_SUB_BUCKETS 4
+/* Enough for latencies of up to 2^40 nanoseconds, about 18 minutes. Longer
+   ones are counted in the last bucket */
+#define OTRNG_HISTOGRAM_BUCKETS (40 * OTRNG_HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * @brief The latencies of one operation.
+ *  [count]    how many times it was done
+ *  [errors]   how many of those failed
+ *  [sum_ns]   the sum of the latencies
+ *  [max_ns]   the highest latency
+ *  [buckets]  how many latencies fell into each bucket. The bounds of a
+ *             bucket are given by otrng_histogram_bucket_upper_bound
+ **/
+typedef struct otrng_histogram_s {
+  uint64_t count;
+  uint64_t errors;
+  uint64_t sum_ns;
+  uint64_t max_ns;
+  uint64_t buckets[OTRNG_HISTOGRAM_BUCKETS];
+} otrng_histogram_s;
+
+typedef struct otrng_metrics_s {
+  otrng_histogram_s histograms[OTRNG_NUM_METRICS];
+} otrng_metrics_s;
+
+/* Where a global state keeps its metrics */
+typedef struct otrng_metrics_state_s otrng_metrics_state_s;
+
+/**
+ * @brief Copies the metrics recorded for [gs] into [dst].
+ *
+ * @return OTRNG_ERROR if the library was built without metrics.
+ **/
+API otrng_result otrng_global_state_get_metrics(
+    otrng_metrics_s *dst, const struct otrng_global_state_s *gs);
+
+/**
+ * @brief Clears the metrics recorded for [gs].
+ **/
+API void otrng_global_state_reset_metrics(struct otrng_global_state_s *gs);
+
+/**
+ * @brief A short name for [metric], such as "dake_auth_r", for exporting it.
+ **/
+API const char *otrng_metric_name(otrng_metric metric);
+
+/**
+ * @brief The exclusive upper bound, in nanoseconds, of the latencies counted
+ *    in [bucket]. Its lower bound is the upper bound of the previous bucket,
+ *    or 0. The last bucket has no upper bound, and UINT64_MAX is returned.
+ **/
+API uint64_t otrng_histogram_bucket_upper_bound(size_t bucket);
+
+/**
+ * @brief An estimate of the [percentile] (between 0 and 100) of the
+ *    latencies in [histogram]: the upper bound of the bucket it falls into,
+ *    capped by the highest latency. 0 if nothing was recorded.
+ **/
+API uint64_t otrng_histogram_percentile(const otrng_histogram_s *histogram,
+                                        double percentile);
+
+/**
+ * @brief Creates the metrics of a global state, or returns NULL if the
+ *    library was built without metrics.
+ **/
+INTERNAL /*@null@*/ otrng_metrics_state_s *otrng_metrics_state_new(void);
+
+INTERNAL void otrng_metrics_state_free(/*@only@*/ otrng_metrics_state_s *state);
+
+#ifdef OTRNG_ENABLE_METRICS
+
+/**
+ * @brief The time an operation starts at, to be given to
+ *    otrng_metrics_record once it is done.
+ **/
+INTERNAL uint64_t otrng_metrics_start(void);
+
+/**
+ * @brief Records in [gs] that an operation of kind [metric] that started at
+ *    [start] is done, and whether it [result]ed in an error.
+ **/
+INTERNAL void otrng_metrics_record(const struct otrng_global_state_s *gs,
+                                   otrng_metric metric, uint64_t start,
+                                   otrng_result result);
+
+#else
+
+static inline uint64_t otrng_metrics_start(void) { return 0; }
+
+static inline void otrng_metrics_record(const struct otrng_global_state_s *gs,
+                                        otrng_metric metric, uint64_t start,
+                                        otrng_result result) {
+  (void)gs;
+  (void)metric;
+  (void)start;
+  (void)result;
+}
+
+#endif
+
+#ifdef OTRNG_METRICS_PRIVATE
+
+tstatic size_t histogram_bucket(uint64_t ns);
+
+#endif
+
+#endif // OTRNG_METRICS_H
@@ -29,6 +29,7 @@
 #pragma clang diagnostic pop
 #endif
 
+#include <sodium.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,14 +38,17 @@
 #define OTRNG_OTRNG_PRIVATE
 
 #include "constants.h"
+#include "base64.h"
 #include "dake.h"
 #include "data_message.h"
 #include "deserialize.h"
 #include "instance_tag.h"
 #include "messaging.h"
+#include "metrics.h"
 #include "padding.h"
 #include "random.h"
 #include "serialize.h"
+#include "session.h"
 #include "shake.h"
 #include "smp.h"
 #include "tlv.h"
@@ -151,6 +155,15 @@ our_shared_prekey(const otrng_s *otr) {
   return otr->client->prekey_profile->keys;
 }
 
+static otrng_result generate_ephemeral_keys(otrng_s *otr) {
+  uint64_t start = otrng_metrics_start();
+  otrng_result result = otrng_key_manager_generate_ephemeral_keys(otr->keys);
+
+  otrng_metrics_record(otr->client->global_state, OTRNG_METRIC_KEYGEN, start,
+                       result);
+  return result;
+}
+
 INTERNAL otrng_s *otrng_new(otrng_client_s *client, otrng_policy_s policy) {
   otrng_s *otr = otrng_xmalloc_z(sizeof(otrng_s));
 
@@ -162,16 +175,35 @@ INTERNAL otrng_s *otrng_new(otrng_client_s *client, otrng_policy_s policy) {
   otr->running_version = OTRNG_PROTOCOL_VERSION_NONE;
 
   otr->keys = otrng_key_manager_new();
-  otr->smp = otrng_secure_alloc(sizeof(smp_protocol_s));
+  otr->smp = otrng_secure_alloc_in(OTRNG_ALLOC_SMP, sizeof(smp_protocol_s));
 
   otrng_smp_protocol_init(otr->smp);
 
+  otrng_arena_init(&otr->arena, OTRNG_MESSAGE_ARENA_CHUNK_BYTES, otrng_true);
+
+  /* Counted in the client once it holds the conversation */
+  otr->footprint.num_conversations = 1;
+  otr->arena.footprint = &otr->footprint;
+  otrng_key_manager_set_footprint(otr->keys, &otr->footprint);
+  otrng_conversation_footprint_update(otr);
+
+  otr->last_active = time(NULL);
+  otr->trace_id = otrng_trace_new_id();
+  otr->client_trace_id = client->trace_id;
+
   return otr;
 }
 
 static void free_fragment_context(void *p) { otrng_fragment_context_free(p); }
 
 tstatic void otrng_destroy(/*@only@ */ otrng_s *otr) {
+  /* The application is told while it can still tell which conversation it
+     is */
+  if (otr->hibernated && !otr->hibernated_state) {
+    otrng_client_callbacks_discard_hibernated(
+        otr->client->global_state->callbacks, otr);
+  }
+
   otrng_free(otr->peer);
 
   otrng_key_manager_free(otr->keys);
@@ -183,18 +215,30 @@ tstatic void otrng_destroy(/*@only@ */ otrng_s *otr) {
   otrng_prekey_profile_free(otr->their_prekey_profile);
   otr->their_prekey_profile = NULL;
 
+  /* A hibernated conversation has already released all of this */
+  if (otr->hibernated) {
+    otrng_free(otr->hibernated_state);
+    otr->hibernated_state = NULL;
+    otrng_footprint_detach(&otr->footprint);
+    return;
+  }
+
+  otrng_smp_async_drain(otr);
   otrng_smp_destroy(otr->smp);
-  otrng_secure_free(otr->smp);
+  otrng_secure_free_in(OTRNG_ALLOC_SMP, otr->smp, sizeof(smp_protocol_s));
   otr->smp = NULL;
 
-  otrng_list_free(otr->pending_fragments, free_fragment_context);
-  otr->pending_fragments = NULL;
+  otrng_tail_list_free(&otr->pending_fragments, free_fragment_context);
 
   otrng_v3_conn_free(otr->v3_conn);
   otr->v3_conn = NULL;
 
   otrng_free(otr->shared_session_state);
   otr->shared_session_state = NULL;
+
+  otrng_arena_destroy(&otr->arena);
+
+  otrng_footprint_detach(&otr->footprint);
 }
 
 INTERNAL void otrng_conn_free(/*@only@ */ otrng_s *otr) {
@@ -206,6 +250,190 @@ INTERNAL void otrng_conn_free(/*@only@ */ otrng_s *otr) {
   otrng_free(otr);
 }
 
+/* The encrypted state is the nonce followed by the sealed serialized state */
+tstatic otrng_result encrypt_hibernated_state(uint8_t **dst, size_t *dst_len,
+                                              const uint8_t *ser,
+                                              size_t ser_len,
+                                              const uint8_t *key) {
+  size_t len = crypto_secretbox_NONCEBYTES + crypto_secretbox_MACBYTES +
+               ser_len;
+  uint8_t *enc = otrng_xmalloc(len);
+
+  random_bytes(enc, crypto_secretbox_NONCEBYTES);
+  if (crypto_secretbox_easy(enc + crypto_secretbox_NONCEBYTES, ser, ser_len,
+                            enc, key) != 0) {
+    otrng_free(enc);
+    return OTRNG_ERROR;
+  }
+
+  *dst = enc;
+  *dst_len = len;
+
+  return OTRNG_SUCCESS;
+}
+
+tstatic otrng_result decrypt_hibernated_state(uint8_t **dst, size_t *dst_len,
+                                              const uint8_t *src,
+                                              size_t src_len,
+                                              const uint8_t *key) {
+  size_t len;
+  uint8_t *ser;
+
+  if (src_len <= crypto_secretbox_NONCEBYTES + crypto_secretbox_MACBYTES) {
+    return OTRNG_ERROR;
+  }
+
+  len = src_len - crypto_secretbox_NONCEBYTES - crypto_secretbox_MACBYTES;
+  ser = otrng_secure_alloc(len);
+
+  if (crypto_secretbox_open_easy(ser, src + crypto_secretbox_NONCEBYTES,
+                                 src_len - crypto_secretbox_NONCEBYTES, src,
+                                 key) != 0) {
+    otrng_session_free_serialized(ser, len);
+    return OTRNG_ERROR;
+  }
+
+  *dst = ser;
+  *dst_len = len;
+
+  return OTRNG_SUCCESS;
+}
+
+INTERNAL otrng_result otrng_hibernate(otrng_s *otr) {
+  uint8_t *ser = NULL, *enc = NULL;
+  size_t ser_len = 0, enc_len = 0;
+  const otrng_client_callbacks_s *cb = otr->client->global_state->callbacks;
+  otrng_result ret;
+
+  if (otr->hibernated) {
+    return OTRNG_SUCCESS;
+  }
+
+  if (!otrng_session_can_serialize(otr)) {
+    return OTRNG_ERROR;
+  }
+
+  if (!otrng_session_serialize(&ser, &ser_len, otr)) {
+    return OTRNG_ERROR;
+  }
+
+  ret = encrypt_hibernated_state(&enc, &enc_len, ser, ser_len,
+                                 otrng_client_hibernation_key(otr->client));
+  otrng_session_free_serialized(ser, ser_len);
+  if (otrng_failed(ret)) {
+    return OTRNG_ERROR;
+  }
+
+  if (otrng_client_callbacks_stores_hibernated(cb)) {
+    ret = otrng_client_callbacks_store_hibernated(cb, otr, enc, enc_len);
+    otrng_free(enc);
+    if (otrng_failed(ret)) {
+      return OTRNG_ERROR;
+    }
+  } else {
+    otr->hibernated_state = enc;
+    otr->hibernated_state_len = enc_len;
+  }
+
+  otrng_key_manager_free(otr->keys);
+  otr->keys = NULL;
+
+  otrng_client_profile_free(otr->their_client_profile);
+  otr->their_client_profile = NULL;
+
+  otrng_prekey_profile_free(otr->their_prekey_profile);
+  otr->their_prekey_profile = NULL;
+
+  otrng_smp_destroy(otr->smp);
+  otrng_secure_free_in(OTRNG_ALLOC_SMP, otr->smp, sizeof(smp_protocol_s));
+  otr->smp = NULL;
+
+  otr->hibernated_v3_conn = otr->v3_conn != NULL;
+  otrng_v3_conn_free(otr->v3_conn);
+  otr->v3_conn = NULL;
+
+  otrng_free(otr->shared_session_state);
+  otr->shared_session_state = NULL;
+
+  otrng_arena_destroy(&otr->arena);
+
+  otr->hibernated = otrng_true;
+  otrng_conversation_footprint_update(otr);
+
+  return OTRNG_SUCCESS;
+}
+
+tstatic otrng_result load_hibernated_state(uint8_t **ser, size_t *ser_len,
+                                           otrng_s *otr) {
+  const otrng_client_callbacks_s *cb = otr->client->global_state->callbacks;
+  const uint8_t *key = otrng_client_hibernation_key(otr->client);
+  uint8_t *enc = NULL;
+  size_t enc_len = 0;
+  otrng_result ret;
+
+  if (otr->hibernated_state) {
+    ret = decrypt_hibernated_state(ser, ser_len, otr->hibernated_state,
+                                   otr->hibernated_state_len, key);
+    otrng_free(otr->hibernated_state);
+    otr->hibernated_state = NULL;
+    otr->hibernated_state_len = 0;
+    return ret;
+  }
+
+  if (!otrng_client_callbacks_load_hibernated(cb, otr, &enc, &enc_len)) {
+    return OTRNG_ERROR;
+  }
+
+  ret = decrypt_hibernated_state(ser, ser_len, enc, enc_len, key);
+  free(enc);
+
+  return ret;
+}
+
+INTERNAL otrng_result otrng_resume(otrng_s *otr) {
+  uint8_t *ser = NULL;
+  size_t ser_len = 0;
+  otrng_result ret;
+
+  if (!otr->hibernated) {
+    return OTRNG_SUCCESS;
+  }
+
+  otr->smp = otrng_secure_alloc_in(OTRNG_ALLOC_SMP, sizeof(smp_protocol_s));
+  otrng_smp_protocol_init(otr->smp);
+
+  otrng_arena_init(&otr->arena, OTRNG_MESSAGE_ARENA_CHUNK_BYTES, otrng_true);
+  otr->arena.footprint = &otr->footprint;
+
+  if (otr->hibernated_v3_conn) {
+    otr->v3_conn = otrng_v3_conn_new(otr->client, otr->peer);
+    if (otr->v3_conn) {
+      otr->v3_conn->opdata = otr; /* For use in callbacks */
+    }
+    otr->hibernated_v3_conn = otrng_false;
+  }
+
+  ret = load_hibernated_state(&ser, &ser_len, otr);
+  if (otrng_succeeded(ret)) {
+    ret = otrng_session_deserialize(otr, ser, ser_len);
+  }
+  otrng_session_free_serialized(ser, ser_len);
+
+  /* A state that is lost can't be recovered: the conversation starts over */
+  if (otrng_failed(ret)) {
+    otr->keys = otrng_key_manager_new();
+    otrng_key_manager_set_footprint(otr->keys, &otr->footprint);
+    otr->state = OTRNG_STATE_START;
+    otr->running_version = OTRNG_PROTOCOL_VERSION_NONE;
+  }
+
+  otr->hibernated = otrng_false;
+  otr->last_active = time(NULL);
+  otrng_conversation_footprint_update(otr);
+
+  return ret;
+}
+
 INTERNAL otrng_result otrng_build_query_message(string_p *dst,
                                                 const string_p msg,
                                                 otrng_s *otr) {
@@ -301,14 +529,14 @@ tstatic otrng_result serialize_and_encode_identity_message(
   return OTRNG_SUCCESS;
 }
 
-API otrng_result otrng_build_identity_message(string_p *dst, otrng_s *otr) {
+tstatic otrng_result build_identity_message(string_p *dst, otrng_s *otr) {
   dake_identity_message_s *msg = NULL;
   otrng_result result;
 
   // TODO: add policy check
   otr->running_version = OTRNG_PROTOCOL_VERSION_4;
 
-  if (otrng_key_manager_generate_ephemeral_keys(otr->keys) == OTRNG_ERROR) {
+  if (generate_ephemeral_keys(otr) == OTRNG_ERROR) {
     return OTRNG_ERROR;
   }
 
@@ -337,6 +565,22 @@ API otrng_result otrng_build_identity_message(string_p *dst, otrng_s *otr) {
   return OTRNG_SUCCESS;
 }
 
+API otrng_result otrng_build_identity_message(string_p *dst, otrng_s *otr) {
+  otrng_trace_span_s span;
+  uint64_t start;
+  otrng_result result;
+
+  otrng_trace_conversation_begin(&span, "dake.build_identity_message", otr,
+                                 IDENTITY_MSG_TYPE);
+  start = otrng_metrics_start();
+  result = build_identity_message(dst, otr);
+
+  otrng_metrics_record(otr->client->global_state, OTRNG_METRIC_DAKE_START,
+                       start, result);
+  otrng_trace_end(&span, result);
+  return result;
+}
+
 tstatic otrng_bool message_contains_tag(const string_p msg) {
   return strstr(msg, tag_base) != NULL;
 }
@@ -487,18 +731,26 @@ tstatic otrng_result reply_with_identity_message(otrng_response_s *response,
 }
 
 tstatic otrng_result start_dake(otrng_response_s *response, otrng_s *otr) {
-  if (otrng_key_manager_generate_ephemeral_keys(otr->keys) == OTRNG_ERROR) {
-    return OTRNG_ERROR;
-  }
+  otrng_trace_span_s span;
+  uint64_t start;
+  otrng_result result = OTRNG_ERROR;
 
-  maybe_create_keys(otr->client);
-  if (reply_with_identity_message(response, otr) == OTRNG_ERROR) {
-    return OTRNG_ERROR;
+  otrng_trace_conversation_begin(&span, "dake.start", otr, IDENTITY_MSG_TYPE);
+  start = otrng_metrics_start();
+
+  if (generate_ephemeral_keys(otr) == OTRNG_SUCCESS) {
+    maybe_create_keys(otr->client);
+    result = reply_with_identity_message(response, otr);
   }
 
-  otr->state = OTRNG_STATE_WAITING_AUTH_R;
+  if (result == OTRNG_SUCCESS) {
+    otr->state = OTRNG_STATE_WAITING_AUTH_R;
+  }
 
-  return OTRNG_SUCCESS;
+  otrng_metrics_record(otr->client->global_state, OTRNG_METRIC_DAKE_START,
+                       start, result);
+  otrng_trace_end(&span, result);
+  return result;
 }
 
 tstatic otrng_result receive_tagged_plaintext(otrng_response_s *response,
@@ -598,6 +850,7 @@ otrng_generate_session_state_string(const otrng_shared_session_state_s *state) {
 
   state = otrng_get_shared_session_state(otr);
   otr->shared_session_state = otrng_generate_session_state_string(&state);
+  otrng_conversation_footprint_update(otr);
 
   otrng_free(state.identifier1);
   otrng_free(state.identifier2);
@@ -1030,6 +1283,7 @@ set_their_client_profile(const otrng_client_profile_s *profile, otrng_s *otr) {
   if (!otrng_client_profile_copy(otr->their_client_profile, profile)) {
     return OTRNG_ERROR;
   }
+  otrng_conversation_footprint_update(otr);
 
   return OTRNG_SUCCESS;
 }
@@ -1046,6 +1300,7 @@ set_their_prekey_profile(const otrng_prekey_profile_s *profile, otrng_s *otr) {
   otr->their_prekey_profile = otrng_xmalloc_z(sizeof(otrng_prekey_profile_s));
 
   otrng_prekey_profile_copy(otr->their_prekey_profile, profile);
+  otrng_conversation_footprint_update(otr);
 
   otrng_ec_point_copy(otr->keys->their_shared_prekey,
                       otr->their_prekey_profile->shared_prekey);
@@ -1102,7 +1357,7 @@ tstatic otrng_result prekey_message_received(const prekey_message_s *msg,
   otrng_key_manager_set_their_ecdh(msg->Y, otr->keys);
   otrng_key_manager_set_their_dh(msg->B, otr->keys);
 
-  if (!otrng_key_manager_generate_ephemeral_keys(otr->keys)) {
+  if (!generate_ephemeral_keys(otr)) {
     return OTRNG_ERROR;
   }
 
@@ -1129,7 +1384,8 @@ tstatic otrng_result ensure_client_profile_version(char *versions,
 
 tstatic otrng_result receive_prekey_ensemble(const prekey_ensemble_s *ensemble,
                                              otrng_s *otr) {
-  if (!otrng_prekey_ensemble_validate(ensemble)) {
+  if (!otrng_client_validate_prekey_ensemble(otr->client, otr->peer,
+                                             ensemble)) {
     return OTRNG_ERROR;
   }
 
@@ -1355,6 +1611,7 @@ tstatic otrng_result non_interactive_auth_message_received(
   if (!otrng_client_profile_copy(otr->their_client_profile, auth->profile)) {
     return OTRNG_ERROR;
   }
+  otrng_conversation_footprint_update(otr);
 
   /* tmp_k = KDF_1(usage_tmp_key || K_ecdh ||
    * ECDH(x, our_shared_prekey.secret, their_ecdh) ||
@@ -1422,10 +1679,11 @@ tstatic otrng_result receive_identity_message_on_state_start(
                                  identity_msg->profile)) {
     return OTRNG_ERROR;
   }
+  otrng_conversation_footprint_update(otr);
 
   /* @secret the priv parts will be deleted once the mixed shared secret is
    * derived */
-  if (!otrng_key_manager_generate_ephemeral_keys(otr->keys)) {
+  if (!generate_ephemeral_keys(otr)) {
     return OTRNG_ERROR;
   }
 
@@ -1447,6 +1705,7 @@ tstatic otrng_result receive_identity_message_on_state_start(
 tstatic void forget_our_keys(otrng_s *otr) {
   otrng_key_manager_destroy(otr->keys);
   otrng_key_manager_init(otr->keys);
+  otrng_key_manager_set_footprint(otr->keys, &otr->footprint);
 }
 
 tstatic otrng_result receive_identity_message_on_waiting_auth_r(
@@ -1678,6 +1937,7 @@ tstatic otrng_result receive_auth_r(string_p *dst, const uint8_t *buffer,
     otrng_dake_auth_r_destroy(&auth);
     return OTRNG_ERROR;
   }
+  otrng_conversation_footprint_update(otr);
 
   if (!reply_with_auth_i_message(dst, otr->their_client_profile, otr)) {
     otrng_dake_auth_r_destroy(&auth);
@@ -1784,23 +2044,22 @@ tstatic otrng_result receive_auth_i(char **dst, const uint8_t *buffer,
   return otrng_send_message(dst, "", NULL, MSG_FLAGS_IGNORE_UNREADABLE, otr);
 }
 
-/*@null@*/ tstatic tlv_list_s *deserialize_received_tlvs(const uint8_t *src,
-                                                         size_t len) {
-  uint8_t *tlvs_start = NULL;
-  size_t tlvs_len;
-
-  tlvs_start = memchr(src, 0, len);
+tstatic void find_received_tlvs(tlv_iter_s *iter, const uint8_t *src,
+                               size_t len) {
+  const uint8_t *tlvs_start = memchr(src, 0, len);
   if (!tlvs_start) {
-    return NULL;
+    otrng_tlv_iter_init(iter, src, 0);
+    return;
   }
 
-  tlvs_len = len - (tlvs_start + 1 - src);
-  return otrng_parse_tlvs(tlvs_start + 1, tlvs_len);
+  otrng_tlv_iter_init(iter, tlvs_start + 1, len - (tlvs_start + 1 - src));
 }
 
 tstatic otrng_result decrypt_data_message(otrng_response_s *response,
+                                          uint8_t **plain_out,
                                           const k_msg_enc enc_key,
-                                          const data_message_s *msg) {
+                                          const data_message_s *msg,
+                                          otrng_s *otr) {
   string_p *dst = &response->to_display;
   uint8_t *plain;
   uint8_t actual_enc_key[ENC_ACTUAL_KEY_BYTES];
@@ -1816,7 +2075,7 @@ tstatic otrng_result decrypt_data_message(otrng_response_s *response,
 #endif
 
   // TODO: @initialization What if message->enc_msg_len == 0?
-  plain = otrng_secure_alloc(msg->enc_msg_len);
+  plain = otrng_arena_alloc(&otr->arena, msg->enc_msg_len);
 
   memcpy(actual_enc_key, enc_key, ENC_ACTUAL_KEY_BYTES);
   err = crypto_stream_xor(plain, msg->enc_msg, msg->enc_msg_len, msg->nonce,
@@ -1824,7 +2083,6 @@ tstatic otrng_result decrypt_data_message(otrng_response_s *response,
   otrng_secure_wipe(actual_enc_key, ENC_ACTUAL_KEY_BYTES);
 
   if (err) {
-    otrng_secure_free(plain);
     return OTRNG_ERROR;
   }
 
@@ -1833,8 +2091,9 @@ tstatic otrng_result decrypt_data_message(otrng_response_s *response,
     *dst = otrng_xstrndup((char *)plain, msg->enc_msg_len);
   }
 
-  response->tlvs = deserialize_received_tlvs(plain, msg->enc_msg_len);
-  otrng_secure_free(plain);
+  /* The TLVs are read from the plaintext itself by receive_tlvs. It is released
+     with the message arena */
+  *plain_out = plain;
   return OTRNG_SUCCESS;
 }
 
@@ -1870,34 +2129,56 @@ tstatic unsigned int extract_word(const unsigned char *bufp) {
   return otrng_process_smp_tlv(tlv, otr);
 }
 
-/*@null@*/ tstatic otrng_result process_received_tlvs(
-    tlv_list_s **to_send, otrng_response_s *response, otrng_s *otr) {
-  const tlv_list_s *current = response->tlvs;
-  while (current) {
-    tlv_s *tlv = process_tlv(current->data, otr);
-    current = current->next;
+/*@null@*/ tstatic tlv_s *copy_received_tlv(const tlv_s *tlv) {
+  /* The application only needs to know that there was padding, so its
+     contents are not copied */
+  if (tlv->type == OTRNG_TLV_PADDING) {
+    return otrng_tlv_new(OTRNG_TLV_PADDING, 0, NULL);
+  }
 
-    if (!tlv) {
-      continue;
+  return otrng_tlv_copy(tlv);
+}
+
+tstatic otrng_result receive_tlvs(otrng_response_s *response,
+                                  const uint8_t *plain, size_t plain_len,
+                                  otrng_s *otr) {
+  tlv_list_s *reply_tlvs = NULL, *reply_tail = NULL, *received_tail = NULL;
+  tlv_list_s *tmp;
+  otrng_result ret = OTRNG_SUCCESS;
+  tlv_iter_s iter;
+  tlv_s view;
+
+  find_received_tlvs(&iter, plain, plain_len);
+  while (otrng_tlv_iter_next(&view, &iter)) {
+    tlv_s *reply;
+
+    tmp = otrng_tlv_list_append_after(received_tail, copy_received_tlv(&view));
+    if (tmp) {
+      received_tail = tmp;
+      if (!response->tlvs) {
+        response->tlvs = received_tail;
+      }
     }
 
-    *to_send = otrng_append_tlv(*to_send, tlv);
-    if (!*to_send) {
-      return OTRNG_ERROR;
+    reply = process_tlv(&view, otr);
+    if (!reply) {
+      continue;
     }
-  }
 
-  return OTRNG_SUCCESS;
-}
+    tmp = otrng_tlv_list_append_after(reply_tail, reply);
+    if (!tmp) {
+      ret = OTRNG_ERROR;
+      break;
+    }
 
-tstatic otrng_result receive_tlvs(otrng_response_s *response, otrng_s *otr) {
-  tlv_list_s *reply_tlvs = NULL;
-  otrng_result ret = process_received_tlvs(&reply_tlvs, response, otr);
-  if (!reply_tlvs) {
-    return ret;
+    reply_tail = tmp;
+    if (!reply_tlvs) {
+      reply_tlvs = reply_tail;
+    }
   }
 
-  if (!ret) {
+  if (!reply_tlvs || !ret) {
+    otrng_tlv_list_free(reply_tlvs);
     return ret;
   }
 
@@ -1908,14 +2189,35 @@ tstatic otrng_result receive_tlvs(otrng_response_s *response, otrng_s *otr) {
   return ret;
 }
 
+static otrng_result derive_receiving_ratchet_keys(
+    otrng_s *otr, receiving_ratchet_s *tmp_receiving_ratchet,
+    data_message_s *msg) {
+  uint32_t ratchet_id = tmp_receiving_ratchet->i;
+  uint64_t start = otrng_metrics_start();
+  otrng_result result = otrng_key_manager_derive_dh_ratchet_keys(
+      otr->keys, otr->client->max_stored_msg_keys, tmp_receiving_ratchet,
+      msg->ecdh, msg->previous_chain_n, 'r',
+      otr->client->global_state->callbacks);
+
+  /* Only the first message of a new ratchet rotates it */
+  if (otrng_failed(result) || tmp_receiving_ratchet->i != ratchet_id) {
+    otrng_metrics_record(otr->client->global_state, OTRNG_METRIC_RATCHET,
+                         start, result);
+  }
+
+  return result;
+}
+
 tstatic otrng_result otrng_receive_data_message_after_dake(
     otrng_response_s *response, const uint8_t *buffer, size_t buff_len,
     otrng_s *otr) {
-  data_message_s *msg = otrng_data_message_new();
+  data_message_s *msg = otrng_data_message_new_in(&otr->arena);
   k_msg_enc enc_key;
   k_msg_mac mac_key;
   size_t read = 0;
   receiving_ratchet_s *tmp_receiving_ratchet;
+  uint8_t *plain = NULL;
+  otrng_trace_span_s span;
 
   memset(enc_key, 0, ENC_KEY_BYTES);
   memset(mac_key, 0, MAC_KEY_BYTES);
@@ -1946,10 +2248,10 @@ tstatic otrng_result otrng_receive_data_message_after_dake(
 
   if (valid_receiver_instance_tag(msg->receiver_instance_tag) == otrng_false) {
     otrng_error_message(&response->to_send, OTRNG_ERR_MSG_MALFORMED);
+    otrng_data_message_free(msg);
     return OTRNG_ERROR;
   }
 
-  // TODO: we still need to persist our_dh->priv
   tmp_receiving_ratchet = otrng_receiving_ratchet_new(otr->keys);
 
   otrng_key_manager_set_their_tmp_keys(msg->ecdh, msg->dh,
@@ -1961,11 +2263,10 @@ tstatic otrng_result otrng_receive_data_message_after_dake(
                                                 msg->message_id, otr->keys,
                                                 tmp_receiving_ratchet))) {
       /* if a new ratchet */
-      if (otrng_failed(otrng_key_manager_derive_dh_ratchet_keys(
-              otr->keys, otr->client->max_stored_msg_keys,
-              tmp_receiving_ratchet, msg->ecdh, msg->previous_chain_n, 'r',
-              otr->client->global_state->callbacks))) {
+      if (otrng_failed(derive_receiving_ratchet_keys(
+              otr, tmp_receiving_ratchet, msg))) {
         otrng_receiving_ratchet_destroy(tmp_receiving_ratchet);
+        otrng_data_message_free(msg);
 
         return OTRNG_ERROR;
       }
@@ -1974,6 +2275,8 @@ tstatic otrng_result otrng_receive_data_message_after_dake(
               enc_key, mac_key, otr->keys, tmp_receiving_ratchet,
               otr->client->max_stored_msg_keys, msg->message_id, 'r',
               otr->client->global_state->callbacks))) {
+        otrng_receiving_ratchet_destroy(tmp_receiving_ratchet);
+        otrng_data_message_free(msg);
         return OTRNG_ERROR;
       }
 
@@ -1984,9 +2287,8 @@ tstatic otrng_result otrng_receive_data_message_after_dake(
       otrng_secure_wipe(mac_key, MAC_KEY_BYTES);
       otrng_data_message_free(msg);
 
-      if (tmp_receiving_ratchet->skipped_keys) {
-        otrng_list_free(tmp_receiving_ratchet->skipped_keys, otrng_secure_free);
-      }
+      otrng_tail_list_free(&tmp_receiving_ratchet->skipped_keys,
+                           otrng_skipped_keys_free);
       otrng_receiving_ratchet_destroy(tmp_receiving_ratchet);
 
       otrng_client_callbacks_handle_event(otr->client->global_state->callbacks,
@@ -1995,17 +2297,16 @@ tstatic otrng_result otrng_receive_data_message_after_dake(
       return OTRNG_ERROR;
     }
 
-    if (otrng_failed(decrypt_data_message(response, enc_key, msg))) {
+    if (otrng_failed(
+            decrypt_data_message(response, &plain, enc_key, msg, otr))) {
 
       if (msg->flags != MSG_FLAGS_IGNORE_UNREADABLE) {
         otrng_error_message(&response->to_send, OTRNG_ERR_MSG_UNREADABLE);
         otrng_secure_wipe(enc_key, ENC_KEY_BYTES);
         otrng_secure_wipe(mac_key, MAC_KEY_BYTES);
 
-        if (tmp_receiving_ratchet->skipped_keys) {
-          otrng_list_free(tmp_receiving_ratchet->skipped_keys,
-                          otrng_secure_free);
-        }
+        otrng_tail_list_free(&tmp_receiving_ratchet->skipped_keys,
+                             otrng_skipped_keys_free);
         otrng_receiving_ratchet_destroy(tmp_receiving_ratchet);
 
         otrng_data_message_free(msg);
@@ -2015,10 +2316,8 @@ tstatic otrng_result otrng_receive_data_message_after_dake(
       if (msg->flags == MSG_FLAGS_IGNORE_UNREADABLE) {
         otrng_secure_wipe(enc_key, ENC_KEY_BYTES);
         otrng_secure_wipe(mac_key, MAC_KEY_BYTES);
-        if (tmp_receiving_ratchet->skipped_keys) {
-          otrng_list_free(tmp_receiving_ratchet->skipped_keys,
-                          otrng_secure_free);
-        }
+        otrng_tail_list_free(&tmp_receiving_ratchet->skipped_keys,
+                             otrng_skipped_keys_free);
         otrng_receiving_ratchet_destroy(tmp_receiving_ratchet);
         otrng_data_message_free(msg);
 
@@ -2031,7 +2330,7 @@ tstatic otrng_result otrng_receive_data_message_after_dake(
     otrng_receiving_ratchet_copy(otr->keys, tmp_receiving_ratchet);
     otrng_receiving_ratchet_destroy(tmp_receiving_ratchet);
 
-    if (otrng_failed(receive_tlvs(response, otr))) {
+    if (otrng_failed(receive_tlvs(response, plain, msg->enc_msg_len, otr))) {
       continue;
     }
 
@@ -2046,16 +2345,18 @@ tstatic otrng_result otrng_receive_data_message_after_dake(
     }
 
     if (otr->client->should_heartbeat(otr->last_sent)) {
-      otrng_debug_enter("trying to send a heartbeat message");
+      otrng_trace_conversation_begin(&span, "send_heartbeat", otr,
+                                     DATA_MSG_TYPE);
       if (!otrng_send_message(&response->to_send, "", NULL,
                               MSG_FLAGS_IGNORE_UNREADABLE, otr)) {
+        otrng_trace_end(&span, OTRNG_ERROR);
         otrng_secure_wipe(mac_key, MAC_KEY_BYTES);
         otrng_data_message_free(msg);
         return OTRNG_ERROR;
       }
       otrng_client_callbacks_handle_event(otr->client->global_state->callbacks,
                                           OTRNG_MSG_EVENT_HEARTBEAT_SENT);
-      otrng_debug_exit("heartbeat message sent");
+      otrng_trace_end(&span, OTRNG_SUCCESS);
       otr->last_sent = time(NULL);
     }
 
@@ -2122,6 +2423,10 @@ tstatic otrng_result receive_decoded_message(otrng_response_s *response,
                                              size_t dec_len, otrng_s *otr) {
   otrng_header_s header;
   int v3_allowed, v4_allowed;
+  otrng_metric metric;
+  otrng_trace_span_s span;
+  otrng_result result;
+  uint64_t start;
 
   header.version = 0;
 
@@ -2140,41 +2445,69 @@ tstatic otrng_result receive_decoded_message(otrng_response_s *response,
   maybe_create_keys(otr->client);
 
   response->to_send = NULL;
+  otrng_trace_conversation_begin(&span, "receive_decoded_message", otr,
+                                 header.type);
+  start = otrng_metrics_start();
 
   switch (header.type) {
   case IDENTITY_MSG_TYPE:
     otr->running_version = OTRNG_PROTOCOL_VERSION_4;
-    return receive_identity_message(&response->to_send, decoded, dec_len, otr);
+    metric = OTRNG_METRIC_DAKE_IDENTITY;
+    result =
+        receive_identity_message(&response->to_send, decoded, dec_len, otr);
+    break;
   case AUTH_R_MSG_TYPE:
-    return receive_auth_r(&response->to_send, decoded, dec_len, otr);
+    metric = OTRNG_METRIC_DAKE_AUTH_R;
+    result = receive_auth_r(&response->to_send, decoded, dec_len, otr);
+    break;
   case AUTH_I_MSG_TYPE:
-    return receive_auth_i(&response->to_send, decoded, dec_len, otr);
+    metric = OTRNG_METRIC_DAKE_AUTH_I;
+    result = receive_auth_i(&response->to_send, decoded, dec_len, otr);
+    break;
   case NON_INT_AUTH_MSG_TYPE:
     otr->running_version = OTRNG_PROTOCOL_VERSION_4;
-    return receive_non_interactive_auth_message(response, decoded, dec_len,
-                                                otr);
+    metric = OTRNG_METRIC_DAKE_NON_INTERACTIVE;
+    result = receive_non_interactive_auth_message(response, decoded, dec_len,
+                                                  otr);
+    break;
   case DATA_MSG_TYPE:
-    return otrng_receive_data_message(response, decoded, dec_len, otr);
+    metric = OTRNG_METRIC_DECRYPT;
+    result = otrng_receive_data_message(response, decoded, dec_len, otr);
+    break;
   default:
     /* error. bad message type */
+    otrng_trace_end(&span, OTRNG_ERROR);
     return OTRNG_ERROR;
   }
+
+  otrng_metrics_record(otr->client->global_state, metric, start, result);
+  otrng_trace_end(&span, result);
+  return result;
 }
 
 tstatic otrng_result receive_encoded_message(otrng_response_s *response,
                                              const string_p msg, otrng_s *otr) {
+  const char *start, *end;
   size_t dec_len = 0;
-  uint8_t *decoded = NULL;
-  otrng_result result;
+  uint8_t *decoded;
+
+  /* Decodes like otrl_base64_otr_decode, but into the message arena */
+  start = strstr(msg, "?OTR:");
+  if (!start) {
+    return OTRNG_ERROR;
+  }
+  start += 5;
 
-  if (otrl_base64_otr_decode(msg, &decoded, &dec_len)) {
+  end = strchr(start, '.');
+  if (!end) {
     return OTRNG_ERROR;
   }
 
-  result = receive_decoded_message(response, decoded, dec_len, otr);
-  otrng_free(decoded);
+  decoded =
+      otrng_arena_alloc(&otr->arena, OTRNG_BASE64_DECODE_LEN(end - start));
+  dec_len = otrl_base64_decode(decoded, start, end - start);
 
-  return result;
+  return receive_decoded_message(response, decoded, dec_len, otr);
 }
 
 tstatic otrng_result receive_error_message(otrng_response_s *response,
@@ -2290,27 +2623,48 @@ static otrng_result receive_defragmented_message(otrng_response_s *response,
 INTERNAL otrng_result otrng_receive_message(otrng_response_s *response,
                                             const string_p msg, otrng_s *otr) {
   char *defrag = NULL;
+  otrng_trace_span_s span;
   otrng_result ret;
+  uint64_t start;
 
   response->to_display = NULL;
 
-  if (otrng_failed(otrng_unfragment_message(&defrag, &otr->pending_fragments,
-                                            msg, our_instance_tag(otr)))) {
+  (void)otrng_resume(otr);
+  otr->last_active = time(NULL);
+
+  otrng_trace_conversation_begin(&span, "receive_message", otr, 0);
+  start = otrng_metrics_start();
+  ret = otrng_unfragment_message(&defrag, &otr->pending_fragments, msg,
+                                 our_instance_tag(otr), &otr->footprint);
+  otrng_metrics_record(otr->client->global_state, OTRNG_METRIC_DEFRAGMENT,
+                       start, ret);
+  if (otrng_failed(ret)) {
+    otrng_trace_end(&span, OTRNG_ERROR);
     return OTRNG_ERROR;
   }
 
+  otrng_arena_enter(&otr->arena);
   ret = receive_defragmented_message(response, defrag, otr);
+  otrng_arena_leave(&otr->arena);
+
   otrng_free(defrag);
+  otrng_trace_end(&span, ret);
   return ret;
 }
 
 INTERNAL otrng_result otrng_send_message(string_p *to_send, const string_p msg,
                                          const tlv_list_s *tlvs, uint8_t flags,
                                          otrng_s *otr) {
+  otrng_trace_span_s span;
+  otrng_result ret;
+
   if (!otr) {
     return OTRNG_ERROR;
   }
 
+  (void)otrng_resume(otr);
+  otr->last_active = time(NULL);
+
   if (otr->running_version == OTRNG_PROTOCOL_VERSION_NONE) {
     if (otr->state == OTRNG_STATE_START) {
       if (otr->policy_type & OTRNG_REQUIRE_ENCRYPTION) {
@@ -2328,7 +2682,13 @@ INTERNAL otrng_result otrng_send_message(string_p *to_send, const string_p msg,
   case OTRNG_PROTOCOL_VERSION_3:
     return otrng_v3_send_message(to_send, msg, tlvs, otr->v3_conn);
   case OTRNG_PROTOCOL_VERSION_4:
-    return otrng_prepare_to_send_data_message(to_send, msg, tlvs, otr, flags);
+    otrng_trace_conversation_begin(&span, "send_data_message", otr,
+                                   DATA_MSG_TYPE);
+    otrng_arena_enter(&otr->arena);
+    ret = otrng_prepare_to_send_data_message(to_send, msg, tlvs, otr, flags);
+    otrng_arena_leave(&otr->arena);
+    otrng_trace_end(&span, ret);
+    return ret;
   default:
     return OTRNG_ERROR;
   }
@@ -2344,9 +2704,8 @@ tstatic otrng_result otrng_close_v4(string_p *to_send, otrng_s *otr) {
     return OTRNG_SUCCESS;
   }
 
-  ser_len = otrng_list_len(otr->keys->skipped_keys) * MAC_KEY_BYTES;
+  ser_len = otrng_tail_list_len(&otr->keys->skipped_keys) * MAC_KEY_BYTES;
   ser_mac_keys = otrng_reveal_mac_keys_on_tlv(otr->keys);
-  otr->keys->skipped_keys = NULL;
 
   disconnected = otrng_tlv_list_one(
       otrng_tlv_new(OTRNG_TLV_DISCONNECTED, ser_len, ser_mac_keys));
@@ -71,6 +71,27 @@ INTERNAL otrng_s *otrng_new(struct otrng_client_s *client,
 
 INTERNAL void otrng_conn_free(/*@only@ */ otrng_s *otr);
 
+/**
+ * @brief Serializes the state of [otr], encrypts it with the hibernation key
+ *    of its client and frees everything else the conversation holds. The
+ *    encrypted state is kept in [otr], or given to the store_hibernated
+ *    callback when there is one.
+ *
+ * @return OTRNG_ERROR if the conversation can't hibernate now (see
+ *    otrng_session_can_serialize) or the state couldn't be stored. Nothing
+ *    is freed in that case.
+ **/
+INTERNAL otrng_result otrng_hibernate(otrng_s *otr);
+
+/**
+ * @brief Brings back a hibernated conversation. Does nothing if [otr] is not
+ *    hibernated.
+ *
+ * @return OTRNG_ERROR if the state couldn't be loaded or decrypted. The
+ *    conversation is usable anyway, but starts over from OTRNG_STATE_START.
+ **/
+INTERNAL otrng_result otrng_resume(otrng_s *otr);
+
 INTERNAL otrng_result otrng_build_query_message(string_p *dst,
                                                 const string_p msg,
                                                 otrng_s *otr);
@@ -117,6 +138,19 @@ API int otrng_get_msg_type(const string_p msg);
 
 tstatic void otrng_destroy(otrng_s *otr);
 
+tstatic otrng_result encrypt_hibernated_state(uint8_t **dst, size_t *dst_len,
+                                              const uint8_t *ser,
+                                              size_t ser_len,
+                                              const uint8_t *key);
+
+tstatic otrng_result decrypt_hibernated_state(uint8_t **dst, size_t *dst_len,
+                                              const uint8_t *src,
+                                              size_t src_len,
+                                              const uint8_t *key);
+
+tstatic otrng_result load_hibernated_state(uint8_t **ser, size_t *ser_len,
+                                           otrng_s *otr);
+
 tstatic otrng_shared_session_state_s
 
     tstatic
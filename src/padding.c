@@ -19,8 +19,8 @@
  */
 
 #include "padding.h"
-#include "alloc.h"
 #include "client.h"
+#include "serialize.h"
 #include "tlv.h"
 
 static size_t calculate_padding_len(size_t msg_len, size_t max) {
@@ -33,29 +33,22 @@ static size_t calculate_padding_len(size_t msg_len, size_t max) {
   return max - ((msg_len + tlv_header_len + 1) % max);
 }
 
-INTERNAL otrng_result generate_padding(uint8_t **dst, size_t *dst_len,
-                                       size_t msg_len, const otrng_s *otr) {
-  tlv_s *padding_tlv;
-  size_t ret;
+INTERNAL size_t otrng_padding_tlv_len(size_t msg_len, const otrng_s *otr) {
   size_t padding_len = calculate_padding_len(msg_len, otr->client->padding);
 
   if (!padding_len) {
-    return OTRNG_SUCCESS;
+    return 0;
   }
 
-  padding_tlv = otrng_tlv_padding_new(padding_len);
-  if (!padding_tlv) {
-    return OTRNG_ERROR;
-  }
+  return padding_len + 4;
+}
 
-  *dst_len = padding_tlv->len + 4;
-  *dst = otrng_xmalloc_z(*dst_len);
+INTERNAL size_t otrng_padding_tlv_serialize(uint8_t *dst, size_t tlv_len) {
+  size_t w = 0;
 
-  ret = otrng_tlv_serialize(*dst, padding_tlv);
-  otrng_tlv_free(padding_tlv);
+  w += otrng_serialize_uint16(dst + w, OTRNG_TLV_PADDING);
+  w += otrng_serialize_uint16(dst + w, tlv_len - 4);
+  memset(dst + w, 0, tlv_len - 4);
 
-  if (ret == 0) {
-    return OTRNG_ERROR;
-  }
-  return OTRNG_SUCCESS;
+  return tlv_len;
 }
@@ -35,7 +35,19 @@
 #include "otrng.h"
 #include "shared.h"
 
-INTERNAL otrng_result generate_padding(uint8_t **dst, size_t *dst_len,
-                                       size_t msg_len, const otrng_s *otr);
+/**
+ * @brief Returns how many bytes the padding TLV of a message with [msg_len]
+ *    bytes of plaintext takes, according to the client's padding setting.
+ *    Returns 0 when no padding is needed.
+ **/
+INTERNAL size_t otrng_padding_tlv_len(size_t msg_len, const otrng_s *otr);
+
+/**
+ * @brief Writes a padding TLV of [tlv_len] bytes, as returned by
+ *    otrng_padding_tlv_len, into [dst] - its header followed by zeros.
+ *
+ * @return the number of bytes written.
+ **/
+INTERNAL size_t otrng_padding_tlv_serialize(uint8_t *dst, size_t tlv_len);
 
 #endif
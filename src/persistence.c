@@ -20,6 +20,8 @@
 
 #include <assert.h>
 
+#define OTRNG_PERSISTENCE_PRIVATE
+
 #include "alloc.h"
 #include "base64.h"
 #include "deserialize.h"
@@ -229,7 +231,8 @@ tstatic otrng_result otrng_client_read_from_prefix(FILE *fp, uint8_t **dec,
 
 tstatic uint8_t **split_tab_delimited_file(char *line, size_t max,
                                            size_t *len) {
-  uint8_t **result = otrng_xmalloc_z(sizeof(uint8_t *) * max);
+  uint8_t **result =
+      otrng_xmalloc_in(OTRNG_ALLOC_PERSISTENCE, sizeof(uint8_t *) * max);
   size_t index = 0;
   char *curr, *last, *eol;
 
@@ -258,6 +261,10 @@ tstatic uint8_t **split_tab_delimited_file(char *line, size_t max,
   return result;
 }
 
+static void free_tab_delimited_items(uint8_t **items, size_t max) {
+  otrng_free_in(OTRNG_ALLOC_PERSISTENCE, items, sizeof(uint8_t *) * max);
+}
+
 static const unsigned int hextable[] = {
     0,  0,  0,  0, 0, 0,  0,  0,  0,  0,  0,  0, 0, 0, 0, 0, 0, 0,  0,  0,
     0,  0,  0,  0, 0, 0,  0,  0,  0,  0,  0,  0, 0, 0, 0, 0, 0, 0,  0,  0,
@@ -321,7 +328,7 @@ INTERNAL otrng_result otrng_client_fingerprint_v4_read_from(
 
   if (item_len != 4 && item_len != 5) {
     free(line);
-    free(items);
+    free_tab_delimited_items(items, 5);
     return OTRNG_ERROR;
   }
 
@@ -331,7 +338,7 @@ INTERNAL otrng_result otrng_client_fingerprint_v4_read_from(
 
   if (strlen((char *)fp_human) != FPRINT_LEN_BYTES * 2) {
     free(line);
-    free(items);
+    free_tab_delimited_items(items, 5);
     return OTRNG_ERROR;
   }
 
@@ -341,23 +348,105 @@ INTERNAL otrng_result otrng_client_fingerprint_v4_read_from(
 
   client = get_client(gs, client_id);
 
-  if (client->fingerprints == NULL) {
-    client->fingerprints = otrng_xmalloc_z(sizeof(otrng_known_fingerprints_s));
-  }
-
   fpr = otrng_xmalloc_z(sizeof(otrng_known_fingerprint_s));
   fpr->username = otrng_xstrdup((char *)items[0]);
   fpr->trusted = trusted;
   fingerprint_hex_to_bytes(fpr, (char *)fp_human);
 
   free(line);
-  free(items);
+  free_tab_delimited_items(items, 5);
 
-  client->fingerprints->fps = otrng_list_add(fpr, client->fingerprints->fps);
+  otrng_client_fingerprint_v4_add(client, fpr);
+
+  return OTRNG_SUCCESS;
+}
+
+INTERNAL otrng_result otrng_client_fingerprint_v4_replay_from(
+    otrng_global_state_s *gs, FILE *fp,
+    otrng_client_s *(*get_client)(otrng_global_state_s *,
+                                  const otrng_client_id_s)) {
+  char *line = NULL;
+  int len = 0;
+  uint8_t **items = NULL;
+  size_t item_len = 0;
+  otrng_client_id_s client_id;
+  otrng_client_s *client;
+  otrng_known_fingerprint_s change;
+  const list_element_s *current;
+  otrng_bool forget;
+
+  assert(fp != NULL);
+  len = get_limited_line(&line, fp);
+  if (len < 0) {
+    return OTRNG_ERROR;
+  }
+
+  items = split_tab_delimited_file(line, 6, &item_len);
+
+  if ((item_len != 5 && item_len != 6) ||
+      strlen((char *)items[4]) != FPRINT_LEN_BYTES * 2 ||
+      (strcmp((char *)items[0], "+") != 0 &&
+       strcmp((char *)items[0], "-") != 0)) {
+    free(line);
+    free_tab_delimited_items(items, 6);
+    return OTRNG_ERROR;
+  }
+
+  forget = strcmp((char *)items[0], "-") == 0;
+  client_id.account = (char *)items[2];
+  client_id.protocol = (char *)items[3];
+  change.username = (char *)items[1];
+  change.trusted = item_len == 6 && strlen((char *)items[5]) > 0;
+  fingerprint_hex_to_bytes(&change, (char *)items[4]);
+
+  client = get_client(gs, client_id);
+  if (!client) {
+    free(line);
+    free_tab_delimited_items(items, 6);
+    return OTRNG_ERROR;
+  }
+
+  if (forget) {
+    otrng_fingerprint_remove(client, change.fp, change.username);
+    free(line);
+    free_tab_delimited_items(items, 6);
+    return OTRNG_SUCCESS;
+  }
+
+  for (current = client->fingerprints ? client->fingerprints->fps : NULL;
+       current; current = current->next) {
+    otrng_known_fingerprint_s *kf = current->data;
+    if (memcmp(kf->fp, change.fp, FPRINT_LEN_BYTES) == 0 &&
+        strcmp(kf->username, change.username) == 0) {
+      kf->trusted = change.trusted;
+      break;
+    }
+  }
+
+  if (!current) {
+    otrng_known_fingerprint_s *fpr =
+        otrng_xmalloc_z(sizeof(otrng_known_fingerprint_s));
+    fpr->username = otrng_xstrdup(change.username);
+    fpr->trusted = change.trusted;
+    memcpy(fpr->fp, change.fp, FPRINT_LEN_BYTES);
+    otrng_client_fingerprint_v4_add(client, fpr);
+  }
+
+  free(line);
+  free_tab_delimited_items(items, 6);
 
   return OTRNG_SUCCESS;
 }
 
+INTERNAL void otrng_client_fingerprint_v4_add(otrng_client_s *client,
+                                              otrng_known_fingerprint_s *fpr) {
+  if (client->fingerprints == NULL) {
+    client->fingerprints = otrng_xmalloc_z(sizeof(otrng_known_fingerprints_s));
+  }
+
+  client->fingerprints->fps = otrng_list_add(fpr, client->fingerprints->fps);
+}
+
 INTERNAL otrng_result
 otrng_client_private_key_v4_read_from(otrng_client_s *client, FILE *privf) {
   char *line = NULL;
@@ -400,22 +489,54 @@ otrng_client_private_key_v4_read_from(otrng_client_s *client, FILE *privf) {
   return OTRNG_SUCCESS;
 }
 
+INTERNAL otrng_result
+otrng_client_private_key_v4_from_bytes(otrng_client_s *client,
+                                       const uint8_t *sym, size_t sym_len) {
+  otrng_keypair_s *keypair;
+
+  if (sym_len != ED448_PRIVATE_BYTES) {
+    return OTRNG_ERROR;
+  }
+
+  keypair = otrng_keypair_new();
+  if (!keypair) {
+    return OTRNG_ERROR;
+  }
+
+  if (!otrng_keypair_generate(keypair, sym)) {
+    otrng_keypair_free(keypair);
+    return OTRNG_ERROR;
+  }
+
+  otrng_keypair_free(client->keypair);
+  client->keypair = keypair;
+
+  return OTRNG_SUCCESS;
+}
+
 INTERNAL otrng_result otrng_client_forging_key_read_from(otrng_client_s *client,
                                                          FILE *fp) {
   uint8_t *dec = NULL;
   size_t dec_len = 0;
-  otrng_public_key key;
   otrng_result result = otrng_client_read_from_prefix(fp, &dec, &dec_len);
 
   if (otrng_failed(result)) {
     return result;
   }
 
-  result = otrng_deserialize_forging_key(key, dec, dec_len, NULL);
+  result = otrng_client_forging_key_from_bytes(client, dec, dec_len);
   otrng_free(dec);
 
-  if (otrng_failed(result)) {
-    return result;
+  return result;
+}
+
+INTERNAL otrng_result otrng_client_forging_key_from_bytes(otrng_client_s *client,
+                                                          const uint8_t *dec,
+                                                          size_t dec_len) {
+  otrng_public_key key;
+
+  if (otrng_failed(otrng_deserialize_forging_key(key, dec, dec_len, NULL))) {
+    return OTRNG_ERROR;
   }
 
   if (client->forging_key) {
@@ -472,17 +593,26 @@ INTERNAL otrng_result
 otrng_client_client_profile_read_from(otrng_client_s *client, FILE *fp) {
   uint8_t *dec = NULL;
   size_t dec_len = 0;
-  otrng_client_profile_s profile;
   otrng_result result = otrng_client_read_from_prefix(fp, &dec, &dec_len);
 
   if (otrng_failed(result)) {
     return result;
   }
 
+  result = otrng_client_client_profile_from_bytes(client, dec, dec_len);
+  otrng_free(dec);
+
+  return result;
+}
+
+INTERNAL otrng_result otrng_client_client_profile_from_bytes(
+    otrng_client_s *client, const uint8_t *dec, size_t dec_len) {
+  otrng_client_profile_s profile;
+  otrng_result result;
+
   memset(&profile, 0, sizeof(otrng_client_profile_s));
   result = otrng_client_profile_deserialize_with_metadata(&profile, dec,
                                                           dec_len, NULL);
-  otrng_free(dec);
 
   if (result == OTRNG_ERROR) {
     return result;
@@ -501,16 +631,25 @@ INTERNAL otrng_result otrng_client_expired_client_profile_read_from(
     otrng_client_s *client, FILE *fp) {
   uint8_t *dec = NULL;
   size_t dec_len = 0;
-  otrng_client_profile_s exp_profile;
   otrng_result result = otrng_client_read_from_prefix(fp, &dec, &dec_len);
 
   if (otrng_failed(result)) {
     return result;
   }
 
+  result = otrng_client_expired_client_profile_from_bytes(client, dec, dec_len);
+  otrng_free(dec);
+
+  return result;
+}
+
+INTERNAL otrng_result otrng_client_expired_client_profile_from_bytes(
+    otrng_client_s *client, const uint8_t *dec, size_t dec_len) {
+  otrng_client_profile_s exp_profile;
+  otrng_result result;
+
   memset(&exp_profile, 0, sizeof(otrng_client_profile_s));
   result = otrng_client_profile_deserialize(&exp_profile, dec, dec_len, NULL);
-  otrng_free(dec);
 
   if (result == OTRNG_ERROR) {
     return result;
@@ -651,6 +790,37 @@ static otrng_result serialize_and_store_prekey(const prekey_message_s *prekey,
   return OTRNG_SUCCESS;
 }
 
+typedef struct prekey_record_writer_s {
+  const char *storage_id;
+  FILE *prekeyf;
+} prekey_record_writer_s;
+
+static otrng_result store_prekey_record(const uint8_t *record, size_t len,
+                                        void *ctx) {
+  prekey_record_writer_s *writer = ctx;
+  char *encoded;
+  int ret;
+
+  if (fprintf(writer->prekeyf, "%s\n", writer->storage_id) < 0) {
+    return OTRNG_ERROR;
+  }
+
+  encoded = otrng_base64_encode(record, len);
+  if (!encoded) {
+    return OTRNG_ERROR;
+  }
+
+  ret = fprintf(writer->prekeyf, "%s\n", encoded);
+  otrng_secure_wipe(encoded, strlen(encoded));
+  otrng_free(encoded);
+
+  if (ret < 0) {
+    return OTRNG_ERROR;
+  }
+
+  return OTRNG_SUCCESS;
+}
+
 INTERNAL otrng_result
 otrng_client_prekeys_write_to(const otrng_client_s *client, FILE *prekeyf) {
   char *storage_id;
@@ -660,7 +830,7 @@ otrng_client_prekeys_write_to(const otrng_client_s *client, FILE *prekeyf) {
     return OTRNG_ERROR;
   }
 
-  if (!client->our_prekeys) {
+  if (otrng_client_prekey_messages_count(client) == 0) {
     return OTRNG_ERROR;
   }
 
@@ -669,7 +839,7 @@ otrng_client_prekeys_write_to(const otrng_client_s *client, FILE *prekeyf) {
     return OTRNG_ERROR;
   }
 
-  current = client->our_prekeys;
+  current = client->our_prekeys.head;
   while (current) {
     if (!serialize_and_store_prekey(current->data, storage_id, prekeyf)) {
       otrng_free(storage_id);
@@ -679,6 +849,19 @@ otrng_client_prekeys_write_to(const otrng_client_s *client, FILE *prekeyf) {
     current = current->next;
   }
 
+  /* Messages that were never loaded are written back as they were read */
+  if (client->prekey_index) {
+    prekey_record_writer_s writer;
+
+    writer.storage_id = storage_id;
+    writer.prekeyf = prekeyf;
+    if (!otrng_prekey_index_foreach_record(client->prekey_index,
+                                           store_prekey_record, &writer)) {
+      otrng_free(storage_id);
+      return OTRNG_ERROR;
+    }
+  }
+
   otrng_free(storage_id);
   return OTRNG_SUCCESS;
 }
@@ -687,25 +870,60 @@ static otrng_result read_and_deserialize_prekey(otrng_client_s *client,
                                                 FILE *fp) {
   uint8_t *dec = NULL;
   size_t dec_len = 0;
-  prekey_message_s *prekey_msg = NULL;
   otrng_result result = otrng_client_read_from_prefix(fp, &dec, &dec_len);
 
   if (otrng_failed(result)) {
     return result;
   }
 
-  prekey_msg = otrng_xmalloc_z(sizeof(prekey_message_s));
+  result = otrng_client_prekey_message_from_bytes(client, dec, dec_len);
+  otrng_secure_wipe(dec, dec_len);
+  otrng_free(dec);
+
+  return result;
+}
+
+INTERNAL otrng_result otrng_client_prekey_message_from_bytes(
+    otrng_client_s *client, const uint8_t *dec, size_t dec_len) {
+  return otrng_prekey_message_add_from_bytes(
+      &client->our_prekeys, client->prekey_index, dec, dec_len);
+}
+
+INTERNAL otrng_result otrng_prekey_message_add_from_bytes(
+    otrng_tail_list_s *prekeys, otrng_prekey_index_s *index,
+    const uint8_t *dec, size_t dec_len) {
+  prekey_message_s *prekey_msg;
+  otrng_result result;
+
+  if (index) {
+    uint32_t id;
+    uint8_t should_publish;
+
+    if (!otrng_prekey_message_peek_metadata(&id, &should_publish, dec,
+                                            dec_len)) {
+      return OTRNG_ERROR;
+    }
+
+    /* Messages still waiting to be published are needed right away */
+    if (!should_publish) {
+      otrng_prekey_index_add_record(index, id, dec, dec_len);
+      return OTRNG_SUCCESS;
+    }
+  }
 
+  prekey_msg = otrng_prekey_message_new();
   result = otrng_prekey_message_deserialize_with_metadata(prekey_msg, dec,
                                                           dec_len, NULL);
-  otrng_secure_wipe(dec, dec_len);
-  otrng_free(dec);
+
   if (otrng_failed(result)) {
-    otrng_free(prekey_msg);
+    otrng_prekey_message_free(prekey_msg);
     return result;
   }
 
-  client->our_prekeys = otrng_list_add(prekey_msg, client->our_prekeys);
+  if (index) {
+    otrng_prekey_index_add(index, prekey_msg);
+  }
+  otrng_tail_list_append(prekeys, prekey_msg);
 
   return OTRNG_SUCCESS;
 }
@@ -815,17 +1033,26 @@ INTERNAL otrng_result
 otrng_client_prekey_profile_read_from(otrng_client_s *client, FILE *fp) {
   uint8_t *dec = NULL;
   size_t dec_len = 0;
-  otrng_prekey_profile_s profile;
   otrng_result result = otrng_client_read_from_prefix(fp, &dec, &dec_len);
 
   if (otrng_failed(result)) {
     return result;
   }
 
+  result = otrng_client_prekey_profile_from_bytes(client, dec, dec_len);
+  otrng_free(dec);
+
+  return result;
+}
+
+INTERNAL otrng_result otrng_client_prekey_profile_from_bytes(
+    otrng_client_s *client, const uint8_t *dec, size_t dec_len) {
+  otrng_prekey_profile_s profile;
+  otrng_result result;
+
   memset(&profile, 0, sizeof(otrng_prekey_profile_s));
   result = otrng_prekey_profile_deserialize_with_metadata(&profile, dec,
                                                           dec_len, NULL);
-  otrng_free(dec);
 
   if (result == OTRNG_ERROR) {
     return result;
@@ -844,16 +1071,25 @@ INTERNAL otrng_result otrng_client_expired_prekey_profile_read_from(
     otrng_client_s *client, FILE *fp) {
   uint8_t *dec = NULL;
   size_t dec_len = 0;
-  otrng_prekey_profile_s exp_profile;
   otrng_result result = otrng_client_read_from_prefix(fp, &dec, &dec_len);
 
   if (otrng_failed(result)) {
     return result;
   }
 
+  result = otrng_client_expired_prekey_profile_from_bytes(client, dec, dec_len);
+  otrng_free(dec);
+
+  return result;
+}
+
+INTERNAL otrng_result otrng_client_expired_prekey_profile_from_bytes(
+    otrng_client_s *client, const uint8_t *dec, size_t dec_len) {
+  otrng_prekey_profile_s exp_profile;
+  otrng_result result;
+
   memset(&exp_profile, 0, sizeof(otrng_prekey_profile_s));
   result = otrng_prekey_profile_deserialize(&exp_profile, dec, dec_len, NULL);
-  otrng_free(dec);
 
   if (otrng_failed(result)) {
     return result;
@@ -869,30 +1105,60 @@ INTERNAL otrng_result otrng_client_expired_prekey_profile_read_from(
   return result;
 }
 
-typedef struct fingerprint_writing_context_s {
-  FILE *fp;
-  otrng_client_id_s client_id;
-} fingerprint_writing_context_s;
+static const char hexdigits[] = "0123456789abcdef";
 
-tstatic void add_fingerprint_to_file(list_element_s *node, void *c) {
-  fingerprint_writing_context_s *ctx = c;
-  otrng_known_fingerprint_s *fp = node->data;
+INTERNAL size_t
+otrng_known_fingerprint_line_len(const otrng_known_fingerprint_s *fp,
+                                 const otrng_client_id_s client_id) {
+  return strlen(fp->username) + strlen(client_id.account) +
+         strlen(client_id.protocol) + FPRINT_LEN_BYTES * 2 +
+         (fp->trusted ? strlen("trusted") : 0) + 5;
+}
+
+INTERNAL size_t
+otrng_known_fingerprint_format_line(char *dst,
+                                    const otrng_known_fingerprint_s *fp,
+                                    const otrng_client_id_s client_id) {
+  char *cursor = dst;
+  size_t len;
   int i;
 
-  fprintf(ctx->fp, "%s\t%s\t%s\t", fp->username, ctx->client_id.account,
-          ctx->client_id.protocol);
+  len = strlen(fp->username);
+  memcpy(cursor, fp->username, len);
+  cursor += len;
+  *cursor++ = '\t';
+
+  len = strlen(client_id.account);
+  memcpy(cursor, client_id.account, len);
+  cursor += len;
+  *cursor++ = '\t';
+
+  len = strlen(client_id.protocol);
+  memcpy(cursor, client_id.protocol, len);
+  cursor += len;
+  *cursor++ = '\t';
+
   for (i = 0; i < FPRINT_LEN_BYTES; i++) {
-    fprintf(ctx->fp, "%02x", fp->fp[i]);
+    *cursor++ = hexdigits[fp->fp[i] >> 4];
+    *cursor++ = hexdigits[fp->fp[i] & 0x0f];
+  }
+  *cursor++ = '\t';
+
+  if (fp->trusted) {
+    memcpy(cursor, "trusted", strlen("trusted"));
+    cursor += strlen("trusted");
   }
-  fprintf(ctx->fp, "\t%s\n", fp->trusted ? "trusted" : "");
+  *cursor++ = '\n';
+
+  return cursor - dst;
 }
 
 INTERNAL otrng_result
 otrng_client_fingerprints_v4_write_to(const otrng_client_s *client, FILE *fp) {
-  fingerprint_writing_context_s ctx = {
-      .fp = fp,
-      .client_id = client->client_id,
-  };
+  const list_element_s *current;
+  char *buffer, *cursor;
+  size_t len = 0;
+  otrng_result result = OTRNG_SUCCESS;
 
   if (client->fingerprints == NULL) {
     return OTRNG_ERROR;
@@ -902,9 +1168,28 @@ otrng_client_fingerprints_v4_write_to(const otrng_client_s *client, FILE *fp) {
     return OTRNG_ERROR;
   }
 
-  otrng_list_foreach(client->fingerprints->fps, add_fingerprint_to_file, &ctx);
+  /* All lines are formatted into one buffer, and written at once */
+  for (current = client->fingerprints->fps; current; current = current->next) {
+    len += otrng_known_fingerprint_line_len(current->data, client->client_id);
+  }
+
+  if (len == 0) {
+    return OTRNG_SUCCESS;
+  }
 
-  return OTRNG_SUCCESS;
+  buffer = otrng_xmalloc(len);
+  cursor = buffer;
+  for (current = client->fingerprints->fps; current; current = current->next) {
+    cursor += otrng_known_fingerprint_format_line(cursor, current->data,
+                                                  client->client_id);
+  }
+
+  if (fwrite(buffer, 1, len, fp) != len) {
+    result = OTRNG_ERROR;
+  }
+  otrng_free(buffer);
+
+  return result;
 }
 
 API otrng_result otrng_client_export_v4_identity(otrng_client_s *client,
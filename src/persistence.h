@@ -94,6 +94,59 @@ INTERNAL otrng_result otrng_client_fingerprint_v4_read_from(
 INTERNAL otrng_result
 otrng_client_fingerprints_v4_write_to(const otrng_client_s *client, FILE *fp);
 
+/* The functions below load one already decoded record into the client. They
+   are shared by the text readers above, which first decode a base64 line,
+   and by the binary account store (see account_store.h). */
+
+INTERNAL otrng_result
+otrng_client_private_key_v4_from_bytes(otrng_client_s *client,
+                                       const uint8_t *sym, size_t sym_len);
+
+INTERNAL otrng_result otrng_client_forging_key_from_bytes(otrng_client_s *client,
+                                                          const uint8_t *dec,
+                                                          size_t dec_len);
+
+INTERNAL otrng_result otrng_client_client_profile_from_bytes(
+    otrng_client_s *client, const uint8_t *dec, size_t dec_len);
+
+INTERNAL otrng_result otrng_client_expired_client_profile_from_bytes(
+    otrng_client_s *client, const uint8_t *dec, size_t dec_len);
+
+INTERNAL otrng_result otrng_client_prekey_profile_from_bytes(
+    otrng_client_s *client, const uint8_t *dec, size_t dec_len);
+
+INTERNAL otrng_result otrng_client_expired_prekey_profile_from_bytes(
+    otrng_client_s *client, const uint8_t *dec, size_t dec_len);
+
+INTERNAL otrng_result otrng_client_prekey_message_from_bytes(
+    otrng_client_s *client, const uint8_t *dec, size_t dec_len);
+
+/* Like otrng_client_prekey_message_from_bytes, into a list and an index that
+   are not the client's yet */
+INTERNAL otrng_result otrng_prekey_message_add_from_bytes(
+    otrng_tail_list_s *prekeys, /*@null@*/ otrng_prekey_index_s *index,
+    const uint8_t *dec, size_t dec_len);
+
+INTERNAL void otrng_client_fingerprint_v4_add(otrng_client_s *client,
+                                              otrng_known_fingerprint_s *fpr);
+
+/* Applies one line of the fingerprint journal (see fingerprint_journal.h) */
+INTERNAL otrng_result otrng_client_fingerprint_v4_replay_from(
+    otrng_global_state_s *gs, FILE *fp,
+    otrng_client_s *(*get_client)(otrng_global_state_s *,
+                                  const otrng_client_id_s));
+
+/* The line for [fp] in the v4 fingerprints file, formatted without stdio.
+   The line is not NUL terminated. */
+INTERNAL size_t
+otrng_known_fingerprint_line_len(const otrng_known_fingerprint_s *fp,
+                                 const otrng_client_id_s client_id);
+
+INTERNAL size_t
+otrng_known_fingerprint_format_line(char *dst,
+                                    const otrng_known_fingerprint_s *fp,
+                                    const otrng_client_id_s client_id);
+
 /* This function will export the private identity necessary to reform it on
    another device in a standard format.
    It will export the private v4 long term key, and the public forging key. The
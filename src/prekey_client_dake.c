@@ -71,6 +71,38 @@ INTERNAL otrng_result otrng_prekey_dake1_message_serialize(
   return OTRNG_SUCCESS;
 }
 
+INTERNAL otrng_result otrng_prekey_dake1_message_deserialize(
+    otrng_prekey_dake1_message_s *dst, const uint8_t *ser, size_t ser_len) {
+  size_t w = 0;
+  size_t read = 0;
+  uint8_t msg_type = 0;
+
+  if (!otrng_prekey_parse_header(&msg_type, ser, ser_len, &w)) {
+    return OTRNG_ERROR;
+  }
+
+  if (msg_type != OTRNG_PREKEY_DAKE1_MSG) {
+    return OTRNG_ERROR;
+  }
+
+  if (!otrng_deserialize_uint32(&dst->client_instance_tag, ser + w, ser_len - w,
+                                &read)) {
+    return OTRNG_ERROR;
+  }
+
+  w += read;
+
+  dst->client_profile = otrng_xmalloc_z(sizeof(otrng_client_profile_s));
+  if (!otrng_client_profile_deserialize(dst->client_profile, ser + w,
+                                        ser_len - w, &read)) {
+    return OTRNG_ERROR;
+  }
+
+  w += read;
+
+  return otrng_deserialize_ec_point(dst->I, ser + w, ser_len - w);
+}
+
 INTERNAL otrng_prekey_dake2_message_s *otrng_prekey_dake2_message_new() {
   otrng_prekey_dake2_message_s *dake_2 =
       otrng_xmalloc_z(sizeof(otrng_prekey_dake2_message_s));
@@ -163,6 +195,32 @@ INTERNAL otrng_result otrng_prekey_dake2_message_deserialize(
   return OTRNG_SUCCESS;
 }
 
+INTERNAL otrng_result otrng_prekey_dake2_message_serialize(
+    uint8_t **ser, size_t *ser_len, const otrng_prekey_dake2_message_s *msg) {
+  size_t ret_len = 2 + 1 + 4 + (4 + msg->server_identity_len) +
+                   ED448_PUBKEY_BYTES + ED448_POINT_BYTES + RING_SIG_BYTES;
+  uint8_t *ret = otrng_xmalloc_z(ret_len);
+  size_t w = 0;
+
+  w += otrng_serialize_uint16(ret + w, OTRNG_PROTOCOL_VERSION_4);
+  w += otrng_serialize_uint8(ret + w, OTRNG_PREKEY_DAKE2_MSG);
+  w += otrng_serialize_uint32(ret + w, msg->client_instance_tag);
+  w += otrng_serialize_data(ret + w, msg->server_identity,
+                            msg->server_identity_len);
+  w += otrng_serialize_public_key(ret + w, msg->server_pub_key);
+  w += otrng_serialize_ec_point(ret + w, msg->S);
+  w += otrng_serialize_ring_sig(ret + w, msg->sigma);
+
+  assert(w <= ret_len);
+
+  *ser = ret;
+  if (ser_len) {
+    *ser_len = w;
+  }
+
+  return OTRNG_SUCCESS;
+}
+
 INTERNAL void
 otrng_prekey_dake3_message_serialize(uint8_t **ser, size_t *ser_len,
                                      const otrng_prekey_dake3_message_s *msg) {
@@ -211,3 +269,105 @@ otrng_prekey_dake3_message_destroy(otrng_prekey_dake3_message_s *dake_3) {
   otrng_free(dake_3->sigma);
   dake_3->sigma = NULL;
 }
+
+INTERNAL otrng_result otrng_prekey_dake3_message_deserialize(
+    otrng_prekey_dake3_message_s *dst, const uint8_t *ser, size_t ser_len) {
+  size_t w = 0;
+  size_t read = 0;
+  uint8_t msg_type = 0;
+
+  if (!otrng_prekey_parse_header(&msg_type, ser, ser_len, &w)) {
+    return OTRNG_ERROR;
+  }
+
+  if (msg_type != OTRNG_PREKEY_DAKE3_MSG) {
+    return OTRNG_ERROR;
+  }
+
+  if (!otrng_deserialize_uint32(&dst->client_instance_tag, ser + w, ser_len - w,
+                                &read)) {
+    return OTRNG_ERROR;
+  }
+
+  w += read;
+
+  if (!otrng_deserialize_ring_sig(dst->sigma, ser + w, ser_len - w, &read)) {
+    return OTRNG_ERROR;
+  }
+
+  w += read;
+
+  return otrng_deserialize_data(&dst->msg, &dst->msg_len, ser + w, ser_len - w,
+                                NULL);
+}
+
+INTERNAL void
+otrng_prekey_resume_message_destroy(otrng_prekey_resume_message_s *msg) {
+  if (!msg) {
+    return;
+  }
+
+  otrng_free(msg->msg);
+  msg->msg = NULL;
+  msg->msg_len = 0;
+}
+
+INTERNAL void otrng_prekey_resume_message_serialize(
+    uint8_t **ser, size_t *ser_len, const otrng_prekey_resume_message_s *msg) {
+  size_t ret_len = 2 + 1 + 4 + PREKEY_SESSION_ID_BYTES + 4 + (4 + msg->msg_len);
+  uint8_t *ret = otrng_xmalloc_z(ret_len);
+  size_t w = 0;
+
+  w += otrng_serialize_uint16(ret + w, OTRNG_PROTOCOL_VERSION_4);
+  w += otrng_serialize_uint8(ret + w, OTRNG_PREKEY_RESUME_MSG);
+  w += otrng_serialize_uint32(ret + w, msg->client_instance_tag);
+  w += otrng_serialize_bytes_array(ret + w, msg->session_id,
+                                   PREKEY_SESSION_ID_BYTES);
+  w += otrng_serialize_uint32(ret + w, msg->counter);
+  w += otrng_serialize_data(ret + w, msg->msg, msg->msg_len);
+
+  assert(w == ret_len);
+
+  *ser = ret;
+  if (ser_len) {
+    *ser_len = w;
+  }
+}
+
+INTERNAL otrng_result otrng_prekey_resume_message_deserialize(
+    otrng_prekey_resume_message_s *dst, const uint8_t *ser, size_t ser_len) {
+  size_t w = 0;
+  size_t read = 0;
+  uint8_t msg_type = 0;
+
+  if (!otrng_prekey_parse_header(&msg_type, ser, ser_len, &w)) {
+    return OTRNG_ERROR;
+  }
+
+  if (msg_type != OTRNG_PREKEY_RESUME_MSG) {
+    return OTRNG_ERROR;
+  }
+
+  if (!otrng_deserialize_uint32(&dst->client_instance_tag, ser + w, ser_len - w,
+                                &read)) {
+    return OTRNG_ERROR;
+  }
+
+  w += read;
+
+  if (!otrng_deserialize_bytes_array(dst->session_id, PREKEY_SESSION_ID_BYTES,
+                                     ser + w, ser_len - w)) {
+    return OTRNG_ERROR;
+  }
+
+  w += PREKEY_SESSION_ID_BYTES;
+
+  if (!otrng_deserialize_uint32(&dst->counter, ser + w, ser_len - w, &read)) {
+    return OTRNG_ERROR;
+  }
+
+  w += read;
+
+  return otrng_deserialize_data(&dst->msg, &dst->msg_len, ser + w, ser_len - w,
+                                NULL);
+}
@@ -30,11 +30,13 @@
 #include "alloc.h"
 #include "auth.h"
 #include "client_profile.h"
+#include "prekey_client_shared.h"
 #include "shared.h"
 
 #define OTRNG_PREKEY_DAKE1_MSG 0x35
 #define OTRNG_PREKEY_DAKE2_MSG 0x36
 #define OTRNG_PREKEY_DAKE3_MSG 0x37
+#define OTRNG_PREKEY_RESUME_MSG 0x38
 
 typedef struct {
   uint32_t client_instance_tag;
@@ -62,12 +64,28 @@ typedef struct {
   size_t msg_len;
 } otrng_prekey_dake3_message_s;
 
+/*
+  Not part of the prekey server specification: carries the same inner message
+  as a DAKE3, inside a session that an earlier DAKE established. It can only
+  be sent to servers that are known to keep sessions.
+*/
+typedef struct {
+  uint32_t client_instance_tag;
+  uint8_t session_id[PREKEY_SESSION_ID_BYTES];
+  uint32_t counter;
+  uint8_t *msg;
+  size_t msg_len;
+} otrng_prekey_resume_message_s;
+
 INTERNAL void
 otrng_prekey_dake1_message_destroy(otrng_prekey_dake1_message_s *msg);
 
 INTERNAL otrng_result otrng_prekey_dake1_message_serialize(
     uint8_t **ser, size_t *ser_len, const otrng_prekey_dake1_message_s *msg);
 
+INTERNAL otrng_result otrng_prekey_dake1_message_deserialize(
+    otrng_prekey_dake1_message_s *dst, const uint8_t *ser, size_t ser_len);
+
 INTERNAL otrng_prekey_dake2_message_s *otrng_prekey_dake2_message_new(void);
 
 INTERNAL void
@@ -76,6 +94,11 @@ otrng_prekey_dake2_message_init(otrng_prekey_dake2_message_s *msg);
 INTERNAL otrng_result otrng_prekey_dake2_message_deserialize(
     otrng_prekey_dake2_message_s *dst, const uint8_t *ser, size_t ser_len);
 
+/* The composite identity is built from server_identity and server_pub_key,
+ * so the composite_identity field is not used */
+INTERNAL otrng_result otrng_prekey_dake2_message_serialize(
+    uint8_t **ser, size_t *ser_len, const otrng_prekey_dake2_message_s *msg);
+
 INTERNAL void
 otrng_prekey_dake2_message_destroy(otrng_prekey_dake2_message_s *msg);
 
@@ -91,6 +114,19 @@ INTERNAL void
 otrng_prekey_dake3_message_serialize(uint8_t **ser, size_t *ser_len,
                                      const otrng_prekey_dake3_message_s *msg);
 
+INTERNAL otrng_result otrng_prekey_dake3_message_deserialize(
+    otrng_prekey_dake3_message_s *dst, const uint8_t *ser, size_t ser_len);
+
+INTERNAL void
+otrng_prekey_resume_message_destroy(otrng_prekey_resume_message_s *msg);
+
+INTERNAL void
+otrng_prekey_resume_message_serialize(uint8_t **ser, size_t *ser_len,
+                                      const otrng_prekey_resume_message_s *msg);
+
+INTERNAL otrng_result otrng_prekey_resume_message_deserialize(
+    otrng_prekey_resume_message_s *dst, const uint8_t *ser, size_t ser_len);
+
 #ifdef OTRNG_PREKEY_CLIENT_DAKE_PRIVATE
 
 #endif
@@ -19,10 +19,12 @@
  */
 
 #include <assert.h>
+#include <string.h>
 
 #include "deserialize.h"
 #include "prekey_client_shared.h"
 #include "serialize.h"
+#include "shake.h"
 
 INTERNAL otrng_result otrng_prekey_parse_header(uint8_t *msg_type,
                                                 const uint8_t *buf,
@@ -55,3 +57,45 @@ INTERNAL otrng_result otrng_prekey_parse_header(uint8_t *msg_type,
 
   return OTRNG_SUCCESS;
 }
+
+INTERNAL otrng_result otrng_prekey_session_derive(
+    uint8_t session_secret[HASH_BYTES],
+    uint8_t session_id[PREKEY_SESSION_ID_BYTES],
+    const uint8_t shared_secret[HASH_BYTES]) {
+  if (!shake_256_prekey_server_kdf(session_secret, HASH_BYTES,
+                                   USAGE_SESSION_SECRET, shared_secret,
+                                   HASH_BYTES)) {
+    return OTRNG_ERROR;
+  }
+
+  return shake_256_prekey_server_kdf(session_id, PREKEY_SESSION_ID_BYTES,
+                                     USAGE_SESSION_ID, session_secret,
+                                     HASH_BYTES);
+}
+
+INTERNAL otrng_result otrng_prekey_session_request_keys(
+    uint8_t mac_key[MAC_KEY_BYTES], uint8_t mac_proof_key[HASH_BYTES],
+    const uint8_t session_secret[HASH_BYTES], uint32_t counter) {
+  uint8_t *values = otrng_secure_alloc(HASH_BYTES + 4);
+  uint8_t *request_key = otrng_secure_alloc(HASH_BYTES);
+  otrng_result ret = OTRNG_ERROR;
+
+  memcpy(values, session_secret, HASH_BYTES);
+  (void)otrng_serialize_uint32(values + HASH_BYTES, counter);
+
+  if (shake_256_prekey_server_kdf(request_key, HASH_BYTES,
+                                  USAGE_SESSION_REQUEST, values,
+                                  HASH_BYTES + 4) &&
+      shake_256_prekey_server_kdf(mac_key, MAC_KEY_BYTES, USAGE_PREMAC_KEY,
+                                  request_key, HASH_BYTES) &&
+      shake_256_prekey_server_kdf(mac_proof_key, HASH_BYTES,
+                                  USAGE_PROOF_CONTEXT, request_key,
+                                  HASH_BYTES)) {
+    ret = OTRNG_SUCCESS;
+  }
+
+  otrng_secure_free(values);
+  otrng_secure_free(request_key);
+
+  return ret;
+}
@@ -28,14 +28,74 @@
 #include <stdint.h>
 
 #include "alloc.h"
+#include "constants.h"
 #include "error.h"
 #include "shared.h"
 
+/* The domain separation and the KDF usage ids used by both sides of the
+   conversation with a prekey server */
+#define PREKEY_HASH_DOMAIN "OTR-Prekey-Server"
+
+#define USAGE_SK 0x01
+#define USAGE_INITIATOR_CLIENT_PROFILE 0x02
+#define USAGE_INITIATOR_PREKEY_COMPOSITE_IDENTITY 0x03
+#define USAGE_INITIATOR_PREKEY_COMPOSITE_PHI 0x04
+#define USAGE_RECEIVER_CLIENT_PROFILE 0x05
+#define USAGE_RECEIVER_PREKEY_COMPOSITE_IDENTITY 0x06
+#define USAGE_RECEIVER_PREKEY_COMPOSITE_PHI 0x07
+#define USAGE_PREMAC_KEY 0x08
+#define USAGE_PRE_MAC 0x09
+#define USAGE_STORAGE_INFO_MAC 0x0A
+#define USAGE_STATUS_MAC 0x0B
+#define USAGE_SUCCESS_MAC 0x0C
+#define USAGE_FAILURE_MAC 0x0D
+#define USAGE_PREKEY_MESSAGE 0x0E
+#define USAGE_CLIENT_PROFILE 0x0F
+#define USAGE_PREKEY_PROFILE 0x10
+#define USAGE_AUTH 0x11
+#define USAGE_PROOF_CONTEXT 0x12
+#define USAGE_PROOF_MESSAGE_ECDH 0x13
+#define USAGE_PROOF_MESSAGE_DH 0x14
+#define USAGE_PROOF_SHARED_ECDH 0x15
+#define USAGE_MAC_PROOFS 0x16
+
+/* These are not part of the prekey server specification. They are used for
+   sessions that are kept after a DAKE, see otrng_prekey_set_session_lifetime */
+#define USAGE_SESSION_SECRET 0x17
+#define USAGE_SESSION_ID 0x18
+#define USAGE_SESSION_REQUEST 0x19
+
+#define PREKEY_SESSION_ID_BYTES 32
+
 INTERNAL otrng_result otrng_prekey_parse_header(uint8_t *msg_type,
                                                 const uint8_t *buf,
                                                 size_t buflen,
                                                 /*@null@*/ size_t *read);
 
+/**
+ * @brief Derives the secret and the id of a prekey server session from the
+ *    shared secret (SK) of the DAKE that established it.
+ *
+ * session secret = KDF(usage_session_secret, SK, 64)
+ * session id = KDF(usage_session_id, session secret, 32)
+ **/
+INTERNAL otrng_result otrng_prekey_session_derive(
+    uint8_t session_secret[HASH_BYTES],
+    uint8_t session_id[PREKEY_SESSION_ID_BYTES],
+    const uint8_t shared_secret[HASH_BYTES]);
+
+/**
+ * @brief Derives the keys for one request sent inside a prekey server session.
+ *    Every request uses a new counter, so no two requests share keys.
+ *
+ * RK = KDF(usage_session_request, session secret || counter, 64)
+ * prekey_mac_k = KDF(usage_preMAC_key, RK, 64)
+ * mac for proofs = KDF(usage_proof_context, RK, 64)
+ **/
+INTERNAL otrng_result otrng_prekey_session_request_keys(
+    uint8_t mac_key[MAC_KEY_BYTES], uint8_t mac_proof_key[HASH_BYTES],
+    const uint8_t session_secret[HASH_BYTES], uint32_t counter);
+
 #ifdef OTRNG_PREKEY_CLIENT_SHARED_PRIVATE
 
 #endif
@@ -32,28 +32,34 @@ INTERNAL prekey_ensemble_s *otrng_prekey_ensemble_new() {
 }
 
 INTERNAL otrng_result
-otrng_prekey_ensemble_validate(const prekey_ensemble_s *dst) {
+otrng_prekey_ensemble_validate_profiles(const prekey_ensemble_s *dst) {
+  uint32_t instance = dst->client_profile->sender_instance_tag;
+
   /* Check that all the instance tags on the Prekey Ensemble's values are the
    * same. */
-  char *versions;
-  otrng_bool found;
-  uint32_t instance = dst->client_profile->sender_instance_tag;
   if (instance != dst->prekey_profile->instance_tag) {
     return OTRNG_ERROR;
   }
 
-  if (instance != dst->message->sender_instance_tag) {
+  if (!otrng_client_profile_valid(dst->client_profile, instance)) {
     return OTRNG_ERROR;
   }
 
-  if (!otrng_client_profile_valid(dst->client_profile,
-                                  dst->message->sender_instance_tag)) {
+  if (!otrng_prekey_profile_valid(dst->prekey_profile, instance,
+                                  dst->client_profile->long_term_pub_key)) {
     return OTRNG_ERROR;
   }
 
-  if (!otrng_prekey_profile_valid(dst->prekey_profile,
-                                  dst->message->sender_instance_tag,
-                                  dst->client_profile->long_term_pub_key)) {
+  return OTRNG_SUCCESS;
+}
+
+INTERNAL otrng_result
+otrng_prekey_ensemble_validate_message(const prekey_ensemble_s *dst) {
+  char *versions;
+  otrng_bool found;
+
+  if (dst->client_profile->sender_instance_tag !=
+      dst->message->sender_instance_tag) {
     return OTRNG_ERROR;
   }
 
@@ -84,6 +90,15 @@ otrng_prekey_ensemble_validate(const prekey_ensemble_s *dst) {
   return OTRNG_SUCCESS;
 }
 
+INTERNAL otrng_result
+otrng_prekey_ensemble_validate(const prekey_ensemble_s *dst) {
+  if (!otrng_prekey_ensemble_validate_profiles(dst)) {
+    return OTRNG_ERROR;
+  }
+
+  return otrng_prekey_ensemble_validate_message(dst);
+}
+
 INTERNAL otrng_result otrng_prekey_ensemble_deserialize(prekey_ensemble_s *dst,
                                                         const uint8_t *src,
                                                         size_t src_len,
@@ -103,7 +118,7 @@ INTERNAL otrng_result otrng_prekey_ensemble_deserialize(prekey_ensemble_s *dst,
 
   w += read;
 
-  dst->message = otrng_xmalloc_z(sizeof(prekey_message_s));
+  dst->message = otrng_prekey_message_new();
 
   if (!otrng_prekey_message_deserialize(dst->message, src + w, src_len - w,
                                         &read)) {
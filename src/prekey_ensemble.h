@@ -46,6 +46,20 @@ INTERNAL prekey_ensemble_s *otrng_prekey_ensemble_new(void);
 INTERNAL otrng_result
 otrng_prekey_ensemble_validate(const prekey_ensemble_s *dst);
 
+/**
+ * @brief Validates the client profile and the prekey profile of the ensemble,
+ *    including their signatures and expiry.
+ */
+INTERNAL otrng_result
+otrng_prekey_ensemble_validate_profiles(const prekey_ensemble_s *dst);
+
+/**
+ * @brief Validates the prekey message of the ensemble against its client
+ *    profile. Doesn't look at any signature.
+ */
+INTERNAL otrng_result
+otrng_prekey_ensemble_validate_message(const prekey_ensemble_s *dst);
+
 INTERNAL otrng_result otrng_prekey_ensemble_deserialize(prekey_ensemble_s *dst,
                                                         const uint8_t *src,
                                                         size_t src_len,
@@ -0,0 +1,224 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define OTRNG_PREKEY_ENSEMBLE_CACHE_PRIVATE
+
+#include <string.h>
+#include <time.h>
+
+#include <sodium.h>
+
+#include "alloc.h"
+#include "prekey_ensemble_cache.h"
+#include "shake.h"
+
+INTERNAL otrng_prekey_ensemble_cache_s *
+otrng_prekey_ensemble_cache_new(size_t max_entries) {
+  otrng_prekey_ensemble_cache_s *cache =
+      otrng_xmalloc_z(sizeof(otrng_prekey_ensemble_cache_s));
+
+  cache->max_entries = max_entries;
+
+  return cache;
+}
+
+static void entry_free(otrng_prekey_ensemble_cache_entry_s *entry) {
+  if (!entry) {
+    return;
+  }
+
+  otrng_free(entry->identity);
+  otrng_free(entry);
+}
+
+static void free_entry(void *p) { entry_free(p); }
+
+INTERNAL void
+otrng_prekey_ensemble_cache_free(otrng_prekey_ensemble_cache_s *cache) {
+  if (!cache) {
+    return;
+  }
+
+  otrng_list_free(cache->entries, free_entry);
+  otrng_free(cache);
+}
+
+tstatic otrng_result prekey_ensemble_digest(uint8_t digest[HASH_BYTES],
+                                            const prekey_ensemble_s *ensemble) {
+  uint8_t *cp = NULL, *pp = NULL, *both;
+  size_t cp_len = 0, pp_len = 0;
+  otrng_result ret = OTRNG_ERROR;
+
+  if (!otrng_client_profile_serialize(&cp, &cp_len,
+                                      ensemble->client_profile)) {
+    return OTRNG_ERROR;
+  }
+
+  if (!otrng_prekey_profile_serialize(&pp, &pp_len,
+                                      ensemble->prekey_profile)) {
+    otrng_free(cp);
+    return OTRNG_ERROR;
+  }
+
+  both = otrng_xmalloc(cp_len + pp_len);
+  memcpy(both, cp, cp_len);
+  memcpy(both + cp_len, pp, pp_len);
+
+  ret = shake_256_hash(digest, HASH_BYTES, both, cp_len + pp_len);
+
+  otrng_free(both);
+  otrng_free(cp);
+  otrng_free(pp);
+
+  return ret;
+}
+
+tstatic otrng_prekey_ensemble_cache_entry_s *
+prekey_ensemble_cache_get(const otrng_prekey_ensemble_cache_s *cache,
+                          const char *identity, uint32_t instance_tag) {
+  list_element_s *current = cache->entries;
+
+  for (; current; current = current->next) {
+    otrng_prekey_ensemble_cache_entry_s *entry = current->data;
+    if (entry->instance_tag == instance_tag &&
+        strcmp(entry->identity, identity) == 0) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+static void remove_entry(otrng_prekey_ensemble_cache_s *cache,
+                         list_element_s *node) {
+  otrng_prekey_ensemble_cache_entry_s *entry = node->data;
+
+  cache->entries = otrng_list_remove_element(node, cache->entries);
+  otrng_list_free_nodes(node);
+  entry_free(entry);
+  cache->num_entries--;
+}
+
+static void evict_least_recently_used(otrng_prekey_ensemble_cache_s *cache) {
+  list_element_s *current = cache->entries, *oldest = NULL;
+
+  for (; current; current = current->next) {
+    const otrng_prekey_ensemble_cache_entry_s *entry = current->data;
+    if (!oldest || entry->last_used <
+                       ((otrng_prekey_ensemble_cache_entry_s *)oldest->data)
+                           ->last_used) {
+      oldest = current;
+    }
+  }
+
+  if (oldest) {
+    remove_entry(cache, oldest);
+  }
+}
+
+static void remember(otrng_prekey_ensemble_cache_s *cache,
+                     const char *identity, const prekey_ensemble_s *ensemble,
+                     const uint8_t digest[HASH_BYTES]) {
+  uint32_t instance_tag = ensemble->client_profile->sender_instance_tag;
+  otrng_prekey_ensemble_cache_entry_s *entry =
+      prekey_ensemble_cache_get(cache, identity, instance_tag);
+
+  if (!entry) {
+    if (cache->max_entries == 0) {
+      return;
+    }
+
+    while (cache->num_entries >= cache->max_entries) {
+      evict_least_recently_used(cache);
+    }
+
+    entry = otrng_xmalloc_z(sizeof(otrng_prekey_ensemble_cache_entry_s));
+    entry->identity = otrng_xstrdup(identity);
+    entry->instance_tag = instance_tag;
+    cache->entries = otrng_list_add(entry, cache->entries);
+    cache->num_entries++;
+  }
+
+  memcpy(entry->digest, digest, HASH_BYTES);
+  entry->expires = ensemble->client_profile->expires;
+  if (ensemble->prekey_profile->expires < entry->expires) {
+    entry->expires = ensemble->prekey_profile->expires;
+  }
+  entry->last_used = ++cache->uses;
+}
+
+INTERNAL otrng_result otrng_prekey_ensemble_cache_validate(
+    otrng_prekey_ensemble_cache_s *cache, const char *identity,
+    const prekey_ensemble_s *ensemble) {
+  otrng_prekey_ensemble_cache_entry_s *entry;
+  uint8_t digest[HASH_BYTES];
+
+  if (!prekey_ensemble_digest(digest, ensemble)) {
+    return OTRNG_ERROR;
+  }
+
+  entry = prekey_ensemble_cache_get(
+      cache, identity, ensemble->client_profile->sender_instance_tag);
+
+  /* The profiles are the same ones we validated before, and they are still
+   * valid - the instance tags and the signatures can't have changed */
+  if (entry && difftime((time_t)entry->expires, time(NULL)) > 0 &&
+      sodium_memcmp(entry->digest, digest, HASH_BYTES) == 0) {
+    cache->hits++;
+    entry->last_used = ++cache->uses;
+    return otrng_prekey_ensemble_validate_message(ensemble);
+  }
+
+  cache->misses++;
+
+  if (!otrng_prekey_ensemble_validate(ensemble)) {
+    return OTRNG_ERROR;
+  }
+
+  remember(cache, identity, ensemble, digest);
+  return OTRNG_SUCCESS;
+}
+
+INTERNAL void
+otrng_prekey_ensemble_cache_forget(otrng_prekey_ensemble_cache_s *cache,
+                                   const char *identity) {
+  list_element_s *current = cache->entries;
+
+  while (current) {
+    list_element_s *next = current->next;
+    const otrng_prekey_ensemble_cache_entry_s *entry = current->data;
+
+    if (strcmp(entry->identity, identity) == 0) {
+      remove_entry(cache, current);
+    }
+
+    current = next;
+  }
+}
+
+INTERNAL void
+otrng_prekey_ensemble_cache_resize(otrng_prekey_ensemble_cache_s *cache,
+                                   size_t max_entries) {
+  cache->max_entries = max_entries;
+
+  while (cache->num_entries > cache->max_entries) {
+    evict_least_recently_used(cache);
+  }
+}
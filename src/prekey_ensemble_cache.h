@@ -0,0 +1,112 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A cache of the prekey ensemble profiles a client has already validated,
+ * keyed by the identity and the instance tag they were retrieved for.
+ *
+ * Validating a prekey ensemble verifies the signatures of its client profile
+ * and of its prekey profile. A peer keeps the same profiles for a long time,
+ * so when the same profiles come back in a later ensemble, only its prekey
+ * message has to be validated. An entry is used until the earliest expiry of
+ * its two profiles.
+ */
+
+#ifndef OTRNG_PREKEY_ENSEMBLE_CACHE_H
+#define OTRNG_PREKEY_ENSEMBLE_CACHE_H
+
+#include <stdint.h>
+
+#include "constants.h"
+#include "list.h"
+#include "prekey_ensemble.h"
+#include "shared.h"
+
+typedef struct otrng_prekey_ensemble_cache_entry_s {
+  /*@notnull@*/ char *identity;
+  uint32_t instance_tag;
+
+  /* A hash of the serialized client profile and prekey profile */
+  uint8_t digest[HASH_BYTES];
+
+  /* The earliest expiry of the two profiles */
+  uint64_t expires;
+
+  /* Used to find the least recently used entry */
+  uint64_t last_used;
+} otrng_prekey_ensemble_cache_entry_s;
+
+typedef struct otrng_prekey_ensemble_cache_s {
+  /* otrng_prekey_ensemble_cache_entry_s entries */
+  /*@null@*/ list_element_s *entries;
+  size_t num_entries;
+  size_t max_entries;
+
+  uint64_t uses;
+
+  unsigned long hits;
+  unsigned long misses;
+} otrng_prekey_ensemble_cache_s;
+
+INTERNAL otrng_prekey_ensemble_cache_s *
+otrng_prekey_ensemble_cache_new(size_t max_entries);
+
+INTERNAL void otrng_prekey_ensemble_cache_free(
+    /*@only@*/ /*@null@*/ otrng_prekey_ensemble_cache_s *cache);
+
+/**
+ * @brief Validates [ensemble], which was retrieved for [identity]. If its
+ *    profiles are the ones validated last time for the same identity and
+ *    instance tag, and they have not expired, only the prekey message is
+ *    validated. Otherwise the whole ensemble is, and its profiles are
+ *    remembered if it is valid.
+ */
+INTERNAL otrng_result otrng_prekey_ensemble_cache_validate(
+    otrng_prekey_ensemble_cache_s *cache, const char *identity,
+    const prekey_ensemble_s *ensemble);
+
+/**
+ * @brief Forgets the profiles remembered for [identity], on all its
+ *    instances - for example, when its keys are no longer trusted.
+ */
+INTERNAL void
+otrng_prekey_ensemble_cache_forget(otrng_prekey_ensemble_cache_s *cache,
+                                   const char *identity);
+
+/**
+ * @brief Changes how many entries the cache keeps, dropping the least
+ *    recently used ones if there are too many.
+ */
+INTERNAL void
+otrng_prekey_ensemble_cache_resize(otrng_prekey_ensemble_cache_s *cache,
+                                   size_t max_entries);
+
+#ifdef OTRNG_PREKEY_ENSEMBLE_CACHE_PRIVATE
+
+tstatic otrng_result prekey_ensemble_digest(uint8_t digest[HASH_BYTES],
+                                            const prekey_ensemble_s *ensemble);
+
+tstatic /*@null@*/ otrng_prekey_ensemble_cache_entry_s *
+prekey_ensemble_cache_get(const otrng_prekey_ensemble_cache_s *cache,
+                          const char *identity, uint32_t instance_tag);
+
+#endif
+
+#endif
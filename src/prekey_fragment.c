@@ -24,9 +24,9 @@
 #define PREKEY_UNFRAGMENT_FORMAT "?OTRP|%08x|%08x|%08x,%05hu,%05hu,%n%*[^,],%n"
 
 INTERNAL otrng_result otrng_fragment_message_receive(
-    char **unfrag_msg, list_element_s **contexts, const char *msg,
+    char **unfrag_msg, otrng_tail_list_s *contexts, const char *msg,
     const uint32_t our_instance_tag) {
   return otrng_unfragment_message_generic(unfrag_msg, contexts, msg,
                                           our_instance_tag, "?OTRP|",
-                                          PREKEY_UNFRAGMENT_FORMAT);
+                                          PREKEY_UNFRAGMENT_FORMAT, NULL);
 }
@@ -36,7 +36,7 @@
 #include "shared.h"
 
 INTERNAL otrng_result otrng_fragment_message_receive(
-    char **unfrag_msg, list_element_s **contexts, const char *msg,
+    char **unfrag_msg, otrng_tail_list_s *contexts, const char *msg,
     const uint32_t our_instance_tag);
 
 #ifdef OTRNG_PREKEY_FRAGMENT_PRIVATE
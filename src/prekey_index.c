@@ -0,0 +1,260 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define OTRNG_PREKEY_INDEX_PRIVATE
+
+#include <string.h>
+
+#include "alloc.h"
+#include "prekey_index.h"
+
+#define PREKEY_INDEX_INITIAL_BUCKETS 16
+
+INTERNAL otrng_prekey_index_s *otrng_prekey_index_new(void) {
+  otrng_prekey_index_s *idx = otrng_xmalloc_z(sizeof(otrng_prekey_index_s));
+
+  idx->num_buckets = PREKEY_INDEX_INITIAL_BUCKETS;
+  idx->buckets = otrng_xmalloc_z(idx->num_buckets *
+                                 sizeof(otrng_prekey_index_entry_s *));
+
+  return idx;
+}
+
+tstatic size_t prekey_index_bucket(const otrng_prekey_index_s *idx,
+                                   uint32_t id) {
+  uint32_t h = id * 2654435761u;
+
+  return (h ^ (h >> 16)) & (idx->num_buckets - 1);
+}
+
+static void prekey_index_grow(otrng_prekey_index_s *idx) {
+  otrng_prekey_index_entry_s **old = idx->buckets;
+  size_t old_num = idx->num_buckets;
+  size_t i;
+
+  idx->num_buckets *= 2;
+  idx->buckets = otrng_xmalloc_z(idx->num_buckets *
+                                 sizeof(otrng_prekey_index_entry_s *));
+
+  for (i = 0; i < old_num; i++) {
+    otrng_prekey_index_entry_s *entry = old[i];
+    while (entry) {
+      otrng_prekey_index_entry_s *next = entry->next;
+      size_t b = prekey_index_bucket(idx, entry->id);
+
+      entry->next = idx->buckets[b];
+      idx->buckets[b] = entry;
+      entry = next;
+    }
+  }
+
+  otrng_free(old);
+}
+
+tstatic void prekey_index_insert(otrng_prekey_index_s *idx,
+                                 otrng_prekey_index_entry_s *entry) {
+  size_t b;
+
+  if (idx->num_entries >= idx->num_buckets) {
+    prekey_index_grow(idx);
+  }
+
+  b = prekey_index_bucket(idx, entry->id);
+  entry->next = idx->buckets[b];
+  idx->buckets[b] = entry;
+  idx->num_entries++;
+  if (!entry->msg) {
+    idx->num_unloaded++;
+  }
+}
+
+static void prekey_index_wipe_records(otrng_prekey_index_s *idx) {
+  if (!idx->records) {
+    return;
+  }
+
+  otrng_secure_free(idx->records);
+  idx->records = NULL;
+  idx->records_len = 0;
+  idx->records_cap = 0;
+}
+
+INTERNAL void otrng_prekey_index_clear(otrng_prekey_index_s *idx) {
+  size_t i;
+
+  for (i = 0; i < idx->num_buckets; i++) {
+    otrng_prekey_index_entry_s *entry = idx->buckets[i];
+    while (entry) {
+      otrng_prekey_index_entry_s *next = entry->next;
+      otrng_free(entry);
+      entry = next;
+    }
+    idx->buckets[i] = NULL;
+  }
+
+  idx->num_entries = 0;
+  idx->num_unloaded = 0;
+  prekey_index_wipe_records(idx);
+}
+
+INTERNAL void
+otrng_prekey_index_free(/*@only@*/ /*@null@*/ otrng_prekey_index_s *idx) {
+  if (!idx) {
+    return;
+  }
+
+  otrng_prekey_index_clear(idx);
+  otrng_free(idx->buckets);
+  otrng_free(idx);
+}
+
+INTERNAL /*@null@*/ otrng_prekey_index_entry_s *
+otrng_prekey_index_get(const otrng_prekey_index_s *idx, uint32_t id) {
+  otrng_prekey_index_entry_s *entry = idx->buckets[prekey_index_bucket(idx, id)];
+
+  for (; entry; entry = entry->next) {
+    if (entry->id == id) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+INTERNAL void otrng_prekey_index_add(otrng_prekey_index_s *idx,
+                                     prekey_message_s *msg) {
+  otrng_prekey_index_entry_s *entry =
+      otrng_xmalloc_z(sizeof(otrng_prekey_index_entry_s));
+
+  entry->id = msg->id;
+  entry->msg = msg;
+  prekey_index_insert(idx, entry);
+}
+
+INTERNAL void otrng_prekey_index_add_record(otrng_prekey_index_s *idx,
+                                            uint32_t id, const uint8_t *record,
+                                            size_t len) {
+  otrng_prekey_index_entry_s *entry;
+
+  /* The records live in secure memory, which can not be reallocated in
+     place */
+  if (idx->records_len + len > idx->records_cap) {
+    size_t cap = idx->records_cap ? idx->records_cap : len * 8;
+    uint8_t *records;
+
+    while (cap < idx->records_len + len) {
+      cap *= 2;
+    }
+
+    records = otrng_secure_alloc(cap);
+    if (idx->records) {
+      memcpy(records, idx->records, idx->records_len);
+      otrng_secure_free(idx->records);
+    }
+    idx->records = records;
+    idx->records_cap = cap;
+  }
+
+  memcpy(idx->records + idx->records_len, record, len);
+
+  entry = otrng_xmalloc_z(sizeof(otrng_prekey_index_entry_s));
+  entry->id = id;
+  entry->offset = idx->records_len;
+  entry->len = len;
+  idx->records_len += len;
+
+  prekey_index_insert(idx, entry);
+}
+
+static void prekey_index_release_record(otrng_prekey_index_s *idx,
+                                        otrng_prekey_index_entry_s *entry) {
+  otrng_secure_wipe(idx->records + entry->offset, entry->len);
+  entry->len = 0;
+  idx->num_unloaded--;
+
+  /* The space of a record is only reclaimed once all of them are gone */
+  if (idx->num_unloaded == 0) {
+    prekey_index_wipe_records(idx);
+  }
+}
+
+INTERNAL /*@null@*/ prekey_message_s *
+otrng_prekey_index_load(otrng_prekey_index_s *idx,
+                        otrng_prekey_index_entry_s *entry) {
+  prekey_message_s *msg;
+
+  if (entry->msg) {
+    return entry->msg;
+  }
+
+  msg = otrng_prekey_message_new();
+  if (!otrng_prekey_message_deserialize_with_metadata(
+          msg, idx->records + entry->offset, entry->len, NULL)) {
+    otrng_prekey_message_free(msg);
+    return NULL;
+  }
+
+  entry->msg = msg;
+  prekey_index_release_record(idx, entry);
+
+  return msg;
+}
+
+INTERNAL void otrng_prekey_index_remove(otrng_prekey_index_s *idx,
+                                        uint32_t id) {
+  otrng_prekey_index_entry_s **link =
+      &idx->buckets[prekey_index_bucket(idx, id)];
+
+  for (; *link; link = &(*link)->next) {
+    otrng_prekey_index_entry_s *entry = *link;
+    if (entry->id != id) {
+      continue;
+    }
+
+    *link = entry->next;
+    idx->num_entries--;
+    if (!entry->msg) {
+      prekey_index_release_record(idx, entry);
+    }
+    otrng_free(entry);
+    return;
+  }
+}
+
+INTERNAL otrng_result otrng_prekey_index_foreach_record(
+    const otrng_prekey_index_s *idx,
+    otrng_result (*fn)(const uint8_t *record, size_t len, void *ctx),
+    void *ctx) {
+  size_t i;
+
+  for (i = 0; i < idx->num_buckets; i++) {
+    const otrng_prekey_index_entry_s *entry;
+    for (entry = idx->buckets[i]; entry; entry = entry->next) {
+      if (entry->msg) {
+        continue;
+      }
+      if (!fn(idx->records + entry->offset, entry->len, ctx)) {
+        return OTRNG_ERROR;
+      }
+    }
+  }
+
+  return OTRNG_SUCCESS;
+}
@@ -0,0 +1,125 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * An index of the stored prekey messages of a client, keyed by their id.
+ *
+ * When a client loads its prekey messages lazily, a stored message that does
+ * not need to be published is only kept as its serialized record, and it is
+ * deserialized the first time a non-interactive DAKE asks for its id. Loading
+ * a prekey message recomputes both of its public keys, so this keeps the
+ * 3072-bit DH work off the startup path of clients with many stored messages.
+ */
+
+#ifndef OTRNG_PREKEY_INDEX_H
+#define OTRNG_PREKEY_INDEX_H
+
+#include "prekey_message.h"
+#include "shared.h"
+
+typedef struct otrng_prekey_index_entry_s {
+  uint32_t id;
+
+  /* The serialized record in the index buffer, while [msg] is NULL */
+  size_t offset;
+  size_t len;
+
+  /*@null@*/ prekey_message_s *msg; /* owned by the client's prekey list */
+
+  struct otrng_prekey_index_entry_s *next;
+} otrng_prekey_index_entry_s;
+
+typedef struct otrng_prekey_index_s {
+  otrng_prekey_index_entry_s **buckets;
+  size_t num_buckets; /* always a power of two */
+  size_t num_entries;
+  size_t num_unloaded;
+
+  /* The records of the entries that have not been loaded yet */
+  /*@null@*/ uint8_t *records;
+  size_t records_len;
+  size_t records_cap;
+} otrng_prekey_index_s;
+
+INTERNAL otrng_prekey_index_s *otrng_prekey_index_new(void);
+
+/**
+ * @brief Frees the index and wipes every record in it. The loaded messages
+ *    are not freed, since they belong to the client. Safe to call with NULL.
+ */
+INTERNAL void
+otrng_prekey_index_free(/*@only@*/ /*@null@*/ otrng_prekey_index_s *idx);
+
+/**
+ * @brief Removes every entry, as when the stored prekey messages are read
+ *    again.
+ */
+INTERNAL void otrng_prekey_index_clear(otrng_prekey_index_s *idx);
+
+INTERNAL /*@null@*/ otrng_prekey_index_entry_s *
+otrng_prekey_index_get(const otrng_prekey_index_s *idx, uint32_t id);
+
+/**
+ * @brief Indexes a message that is already deserialized.
+ */
+INTERNAL void otrng_prekey_index_add(otrng_prekey_index_s *idx,
+                                     prekey_message_s *msg);
+
+/**
+ * @brief Indexes a message by its record, as serialized with its metadata.
+ *    The record is copied.
+ */
+INTERNAL void otrng_prekey_index_add_record(otrng_prekey_index_s *idx,
+                                            uint32_t id, const uint8_t *record,
+                                            size_t len);
+
+/**
+ * @brief Deserializes the record of [entry], and wipes it.
+ *
+ * @return The message, which the caller must add to the client's prekey
+ *    list, or NULL if the record can not be deserialized.
+ */
+INTERNAL /*@null@*/ prekey_message_s *
+otrng_prekey_index_load(otrng_prekey_index_s *idx,
+                        otrng_prekey_index_entry_s *entry);
+
+INTERNAL void otrng_prekey_index_remove(otrng_prekey_index_s *idx,
+                                        uint32_t id);
+
+/**
+ * @brief Calls [fn] with the record of every entry that has not been loaded,
+ *    stopping at the first error.
+ */
+INTERNAL otrng_result otrng_prekey_index_foreach_record(
+    const otrng_prekey_index_s *idx,
+    otrng_result (*fn)(const uint8_t *record, size_t len, void *ctx),
+    void *ctx);
+
+#ifdef OTRNG_PREKEY_INDEX_PRIVATE
+
+tstatic size_t prekey_index_bucket(const otrng_prekey_index_s *idx,
+                                   uint32_t id);
+
+tstatic void prekey_index_insert(otrng_prekey_index_s *idx,
+                                 otrng_prekey_index_entry_s *entry);
+
+#endif
+
+#endif
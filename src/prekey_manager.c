@@ -25,6 +25,7 @@
 #include "base64.h"
 #include "client.h"
 #include "deserialize.h"
+#include "metrics.h"
 #include "prekey_client_dake.h"
 #include "prekey_client_shared.h"
 #include "prekey_fragment.h"
@@ -44,32 +45,6 @@
   annotations, and also test them dynamically using 'assert'.
 */
 
-#define PREKEY_HASH_DOMAIN "OTR-Prekey-Server"
-
-#define USAGE_SK 0x01
-#define USAGE_INITIATOR_CLIENT_PROFILE 0x02
-#define USAGE_INITIATOR_PREKEY_COMPOSITE_IDENTITY 0x03
-#define USAGE_INITIATOR_PREKEY_COMPOSITE_PHI 0x04
-#define USAGE_RECEIVER_CLIENT_PROFILE 0x05
-#define USAGE_RECEIVER_PREKEY_COMPOSITE_IDENTITY 0x06
-#define USAGE_RECEIVER_PREKEY_COMPOSITE_PHI 0x07
-#define USAGE_PREMAC_KEY 0x08
-#define USAGE_PRE_MAC 0x09
-#define USAGE_STORAGE_INFO_MAC 0x0A
-/*This is not used in this file, but is provided here for completeness */
-#define USAGE_STATUS_MAC 0x0B
-#define USAGE_SUCCESS_MAC 0x0C
-#define USAGE_FAILURE_MAC 0x0D
-#define USAGE_PREKEY_MESSAGE 0x0E
-#define USAGE_CLIENT_PROFILE 0x0F
-#define USAGE_PREKEY_PROFILE 0x10
-#define USAGE_AUTH 0x11
-#define USAGE_PROOF_CONTEXT 0x12
-#define USAGE_PROOF_MESSAGE_ECDH 0x13
-#define USAGE_PROOF_MESSAGE_DH 0x14
-#define USAGE_PROOF_SHARED_ECDH 0x15
-#define USAGE_MAC_PROOFS 0x16
-
 /*
   This function calls the prekey server shake 256 and will kill the program
   if a failure happens. The reason for this is that the only thing that can go
@@ -143,6 +118,22 @@ get_prekey_server_for(/*@notnull@*/ otrng_prekey_manager_s *manager,
   return NULL;
 }
 
+/*@null@*/ tstatic otrng_prekey_server_s *
+find_server_for_identity(/*@notnull@*/ otrng_prekey_manager_s *manager,
+                         const char *identity) {
+  otrng_prekey_server_s *server = NULL;
+  list_element_s *current = manager->server_identities;
+
+  for (; current; current = current->next) {
+    server = current->data;
+    if (strcmp(identity, server->identity) == 0) {
+      return server;
+    }
+  }
+
+  return NULL;
+}
+
 tstatic /*@null@*/ otrng_prekey_request_s *
 create_prekey_request(otrng_prekey_server_s *server, void *ctx) {
   uint8_t *sym = otrng_secure_alloc(ED448_PRIVATE_BYTES);
@@ -195,6 +186,7 @@ static void prekey_request_free(/*@notnull@*/ otrng_prekey_request_s *request) {
   }
 
   clean_ephemeral_ecdh(request);
+  otrng_secure_free(request->session_secret);
   otrng_free(request);
 }
 
@@ -243,42 +235,269 @@ serialize_dake1(/*@notnull@*/ otrng_prekey_dake1_message_s *dake1) {
   return result;
 }
 
+/* The most requests a manager keeps in flight at the same time. Anything
+   beyond this is most likely a lost server, and we don't want to grow without
+   bounds because of it. */
+#define MAX_REQUESTS_IN_FLIGHT 32
+
+tstatic otrng_result
+prekey_manager_register_request(/*@notnull@*/ otrng_prekey_manager_s *manager,
+                                /*@notnull@*/ otrng_prekey_request_s *request) {
+  if (otrng_list_len(manager->requests) >= MAX_REQUESTS_IN_FLIGHT) {
+    return OTRNG_ERROR;
+  }
+
+  manager->next_request_id++;
+  if (manager->next_request_id == 0) {
+    manager->next_request_id++;
+  }
+
+  request->id = manager->next_request_id;
+  request->started_at = time(NULL);
+  request->dake_done = otrng_false;
+
+  /* otrng_list_add appends, so the list stays ordered oldest first */
+  manager->requests = otrng_list_add(request, manager->requests);
+  return OTRNG_SUCCESS;
+}
+
+static void
+prekey_manager_remove_request(/*@notnull@*/ otrng_prekey_manager_s *manager,
+                              /*@notnull@*/ otrng_prekey_request_s *request) {
+  list_element_s *node = otrng_list_get_by_value(request, manager->requests);
+
+  if (node == NULL) {
+    return;
+  }
+
+  manager->requests = otrng_list_remove_element(node, manager->requests);
+  otrng_list_free_nodes(node);
+  prekey_request_free(request);
+}
+
+tstatic /*@null@*/ otrng_prekey_request_s *
+find_request_by_id(/*@notnull@*/ const otrng_prekey_manager_s *manager,
+                   uint32_t id) {
+  list_element_s *current = manager->requests;
+
+  for (; current; current = current->next) {
+    otrng_prekey_request_s *request = current->data;
+    if (request->id == id) {
+      return request;
+    }
+  }
+
+  return NULL;
+}
+
+static void prekey_session_free(otrng_prekey_session_s *session) {
+  if (!session) {
+    return;
+  }
+
+  otrng_secure_free(session->secret);
+  otrng_free(session);
+}
+
+static void free_prekey_session(void *p) { prekey_session_free(p); }
+
+static void
+forget_session_for(/*@notnull@*/ otrng_prekey_manager_s *manager,
+                   /*@notnull@*/ const otrng_prekey_server_s *server) {
+  list_element_s *current = manager->sessions;
+
+  for (; current; current = current->next) {
+    otrng_prekey_session_s *session = current->data;
+    if (session->server == server) {
+      manager->sessions = otrng_list_remove_element(current, manager->sessions);
+      otrng_list_free_nodes(current);
+      prekey_session_free(session);
+      return;
+    }
+  }
+}
+
+/* Sessions are dropped this many seconds before the server would forget
+   them, so that a request sent at the end of one still reaches the server in
+   time, even with some clock skew */
+#define SESSION_EXPIRY_MARGIN 5
+
+static otrng_bool session_expired(const otrng_prekey_manager_s *manager,
+                                  const otrng_prekey_session_s *session,
+                                  time_t now) {
+  time_t expires_at = session->established_at + manager->session_lifetime -
+                      SESSION_EXPIRY_MARGIN;
+
+  /* The counter is part of every request key, so it can never wrap */
+  return difftime(expires_at, now) <= 0 || session->counter == UINT32_MAX
+             ? otrng_true
+             : otrng_false;
+}
+
+tstatic /*@null@*/ otrng_prekey_session_s *
+find_live_session(/*@notnull@*/ const otrng_prekey_manager_s *manager,
+                  /*@notnull@*/ const otrng_prekey_server_s *server) {
+  list_element_s *current = manager->sessions;
+  time_t now = time(NULL);
+
+  for (; current; current = current->next) {
+    otrng_prekey_session_s *session = current->data;
+    if (session->server == server) {
+      return session_expired(manager, session, now) ? NULL : session;
+    }
+  }
+
+  return NULL;
+}
+
 /*
-   TODO: if a request gets lost, manager->request_for_account will never be
-   reset We should probably do a bit of cleanup on it now and again
+  Called once the server has answered the request that finished a DAKE. Only
+  then do we know that the server has seen our DAKE3, so only then can the
+  session be used.
 */
+static void remember_session(/*@notnull@*/ otrng_prekey_manager_s *manager,
+                             /*@notnull@*/ otrng_prekey_request_s *request) {
+  otrng_prekey_session_s *session;
+
+  if (request->session_secret == NULL || manager->session_lifetime == 0) {
+    return;
+  }
+
+  session = otrng_xmalloc_z(sizeof(otrng_prekey_session_s));
+  session->server = request->server;
+  session->secret = otrng_secure_alloc(HASH_BYTES);
+  session->established_at = time(NULL);
+
+  if (otrng_failed(otrng_prekey_session_derive(
+          session->secret, session->id, request->session_secret))) {
+    prekey_session_free(session);
+    return;
+  }
+
+  otrng_secure_free(request->session_secret);
+  request->session_secret = NULL;
+
+  forget_session_for(manager, request->server);
+  manager->sessions = otrng_list_add(session, manager->sessions);
+}
+
+/*@null@*/ static char *
+serialize_resume(/*@notnull@*/ const otrng_prekey_resume_message_s *msg) {
+  uint8_t *ser = NULL;
+  size_t ser_len = 0;
+  char *result;
 
-static otrng_result prekey_manager_register_account_request(
-    /*@notnull@*/ otrng_prekey_manager_s *manager,
+  otrng_prekey_resume_message_serialize(&ser, &ser_len, msg);
+
+  result = prekey_message_encode(ser, ser_len);
+  otrng_free(ser);
+  return result;
+}
+
+/*
+  Sends the request inside an existing session. The message for the server is
+  built right away, since there is no DAKE to wait for.
+*/
+static otrng_result start_resumed(
+    /*@notnull@*/ char **new_msg,
+    /*@notnull@*/ otrng_client_s *client,
+    /*@notnull@*/ otrng_prekey_session_s *session,
     /*@notnull@*/ otrng_prekey_request_s *request) {
-  if (manager->request_for_account != NULL) {
+  otrng_prekey_dake3_message_s inner;
+  otrng_prekey_resume_message_s resume;
+
+  session->counter++;
+  if (otrng_failed(otrng_prekey_session_request_keys(
+          request->mac_key, request->mac_proof_key, session->secret,
+          session->counter))) {
+    return OTRNG_ERROR;
+  }
+
+  /* The inner message is the same one a DAKE3 would carry */
+  otrng_prekey_dake3_message_init(&inner);
+  if (otrng_failed(request->after_dake(client, request, &inner))) {
+    otrng_prekey_dake3_message_destroy(&inner);
     return OTRNG_ERROR;
   }
 
-  manager->request_for_account_at = time(NULL);
-  manager->request_for_account = request;
+  resume.client_instance_tag = otrng_client_get_instance_tag(client);
+  memcpy(resume.session_id, session->id, PREKEY_SESSION_ID_BYTES);
+  resume.counter = session->counter;
+  resume.msg = inner.msg;
+  resume.msg_len = inner.msg_len;
+
+  *new_msg = serialize_resume(&resume);
+  otrng_prekey_dake3_message_destroy(&inner);
+
+  request->resumed = otrng_true;
+  request->dake_done = otrng_true;
+
   return OTRNG_SUCCESS;
 }
 
-static otrng_result start_dake1(
+static otrng_result start_in_session(
     /*@notnull@*/ char **new_msg,
+    /*@null@*/ uint32_t *request_id,
     /*@notnull@*/ otrng_client_s *client,
+    /*@notnull@*/ otrng_prekey_session_s *session,
+    /*@null@*/ void *ctx,
+    /*@notnull@*/ otrng_prekey_next_message after_dake) {
+  otrng_prekey_request_s *request =
+      otrng_xmalloc_z(sizeof(otrng_prekey_request_s));
+
+  request->server = session->server;
+  request->ctx = ctx;
+  request->after_dake = after_dake;
+
+  if (otrng_failed(
+          prekey_manager_register_request(client->prekey_manager, request))) {
+    prekey_request_free(request);
+    return OTRNG_ERROR;
+  }
+
+  if (otrng_failed(start_resumed(new_msg, client, session, request)) ||
+      *new_msg == NULL) {
+    prekey_manager_remove_request(client->prekey_manager, request);
+    otrng_free(*new_msg);
+    *new_msg = NULL;
+    return OTRNG_ERROR;
+  }
+
+  if (request_id) {
+    *request_id = request->id;
+  }
+
+  return OTRNG_SUCCESS;
+}
+
+/*
+  Starts a new request to the server: inside a live session if there is one,
+  otherwise with a new DAKE.
+*/
+static otrng_result start_request(
+    /*@notnull@*/ char **new_msg,
+    /*@null@*/ uint32_t *request_id,
+    /*@notnull@*/ otrng_client_s *client,
+    /*@notnull@*/ otrng_prekey_server_s *server,
     /*@null@*/ void *ctx,
     /*@notnull@*/ otrng_prekey_next_message after_dake) {
-  const char *domain;
-  otrng_prekey_server_s *server;
   otrng_prekey_request_s *request;
+  otrng_prekey_session_s *session;
   otrng_prekey_dake1_message_s dake1;
+  uint64_t start;
+  otrng_result result;
 
   /* We verify the static assertions dynamically as well */
   assert(client);
   assert(client->prekey_manager);
   assert(new_msg);
 
-  domain = get_domain_for_account(client, ctx);
-  server = get_prekey_server_for(client->prekey_manager, domain);
-  if (!server) {
-    return OTRNG_ERROR;
+  *new_msg = NULL;
+
+  session = find_live_session(client->prekey_manager, server);
+  if (session) {
+    return start_in_session(new_msg, request_id, client, session, ctx,
+                            after_dake);
   }
 
   request = create_prekey_request(server, ctx);
@@ -286,7 +505,11 @@ static otrng_result start_dake1(
     return OTRNG_ERROR;
   }
 
-  if (otrng_failed(create_dake1(client, request, &dake1))) {
+  start = otrng_metrics_start();
+  result = create_dake1(client, request, &dake1);
+  otrng_metrics_record(client->global_state, OTRNG_METRIC_PREKEY_DAKE1, start,
+                       result);
+  if (otrng_failed(result)) {
     prekey_request_free(request);
     return OTRNG_ERROR;
   }
@@ -299,18 +522,34 @@ static otrng_result start_dake1(
   }
   otrng_prekey_dake1_message_destroy(&dake1);
 
-  if (otrng_failed(prekey_manager_register_account_request(
-          client->prekey_manager, request))) {
+  if (otrng_failed(
+          prekey_manager_register_request(client->prekey_manager, request))) {
     prekey_request_free(request);
     otrng_free(*new_msg);
+    *new_msg = NULL;
     return OTRNG_ERROR;
   }
 
   request->after_dake = after_dake;
 
+  if (request_id) {
+    *request_id = request->id;
+  }
+
   return OTRNG_SUCCESS;
 }
 
+/*@null@*/ static otrng_prekey_server_s *
+server_for_account(/*@notnull@*/ otrng_client_s *client, /*@null@*/ void *ctx) {
+  const char *domain;
+
+  assert(client);
+  assert(client->prekey_manager);
+
+  domain = get_domain_for_account(client, ctx);
+  return get_prekey_server_for(client->prekey_manager, domain);
+}
+
 #define OTRNG_DAKE3_MSG_LEN 67
 
 tstatic void dake3_message_append_storage_information_request(
@@ -348,7 +587,38 @@ API otrng_result otrng_prekey_request_storage_information(
     /*@notnull@*/ char **new_msg,
     /*@notnull@*/ otrng_client_s *client,
     /*@null@*/ void *ctx) {
-  return start_dake1(new_msg, client, ctx, storage_request_after_dake);
+  otrng_prekey_server_s *server = server_for_account(client, ctx);
+
+  if (!server) {
+    return OTRNG_ERROR;
+  }
+
+  return start_request(new_msg, NULL, client, server, ctx,
+                       storage_request_after_dake);
+}
+
+API otrng_result otrng_prekey_request_storage_information_from(
+    /*@notnull@*/ char **new_msg,
+    /*@null@*/ uint32_t *request_id,
+    /*@notnull@*/ otrng_client_s *client,
+    /*@notnull@*/ const char *server_identity,
+    /*@null@*/ void *ctx) {
+  otrng_prekey_server_s *server;
+
+  assert(client);
+  assert(client->prekey_manager);
+  assert(new_msg);
+  assert(server_identity);
+
+  *new_msg = NULL;
+
+  server = find_server_for_identity(client->prekey_manager, server_identity);
+  if (!server) {
+    return OTRNG_ERROR;
+  }
+
+  return start_request(new_msg, request_id, client, server, ctx,
+                       storage_request_after_dake);
 }
 
 API otrng_bool
@@ -469,7 +739,7 @@ static size_t kdf_composite_phi_into(uint8_t *buf,
 #define T_LEN 1 + 3 * HASH_BYTES + 2 * ED448_POINT_BYTES
 
 static otrng_bool validate_dake2(otrng_client_s *client,
-                                 otrng_prekey_request_s *request,
+                                 const otrng_prekey_request_s *request,
                                  const otrng_prekey_dake2_message_s *msg) {
   /*
      The spec says:
@@ -507,7 +777,8 @@ static otrng_bool validate_dake2(otrng_client_s *client,
   return ret;
 }
 
-static otrng_result create_mac_keys(otrng_prekey_request_s *request,
+static otrng_result create_mac_keys(const otrng_prekey_manager_s *manager,
+                                    otrng_prekey_request_s *request,
                                     const otrng_prekey_dake2_message_s *msg) {
   uint8_t *ecdh_shared = NULL, *shared_secret = NULL;
 
@@ -538,6 +809,12 @@ static otrng_result create_mac_keys(otrng_prekey_request_s *request,
   do_hash_x(request->mac_proof_key, HASH_BYTES, USAGE_PROOF_CONTEXT,
             shared_secret, HASH_BYTES);
 
+  /* Kept until the server answers, when the session is derived from it */
+  if (manager->session_lifetime > 0) {
+    request->session_secret = shared_secret;
+    return OTRNG_SUCCESS;
+  }
+
   otrng_secure_free(shared_secret);
 
   return OTRNG_SUCCESS;
@@ -594,7 +871,7 @@ create_rsig_auth_for_dake3(otrng_client_s *client,
     return NULL;
   }
 
-  if (otrng_failed(create_mac_keys(request, msg))) {
+  if (otrng_failed(create_mac_keys(client->prekey_manager, request, msg))) {
     return NULL;
   }
 
@@ -611,76 +888,194 @@ create_rsig_auth_for_dake3(otrng_client_s *client,
   return ret;
 }
 
-/*@null@*/ static char *
-process_received_dake2(otrng_client_s *client, otrng_prekey_request_s *request,
-                       const otrng_prekey_dake2_message_s *msg) {
-  if (msg->client_instance_tag != otrng_client_get_instance_tag(client)) {
-    return NULL;
-  }
+#define REQUEST_EXPIRY 10 * 60 /* 10 minutes */
 
-  if (!validate_dake2(client, request, msg)) {
-    notify_error(client, OTRNG_PREKEY_CLIENT_INVALID_DAKE2, request->ctx);
-    return NULL;
+void otrng_prekey_check_account_request(otrng_client_s *client) {
+  list_element_s *current;
+  time_t now = time(NULL);
+
+  if (client->prekey_manager == NULL) {
+    return;
   }
 
-  return send_dake3(client, request, msg);
-}
+  current = client->prekey_manager->requests;
+  while (current) {
+    otrng_prekey_request_s *request = current->data;
+    current = current->next;
+
+    if (difftime(request->started_at + REQUEST_EXPIRY, now) <= 0) {
+      /* The server has most likely forgotten the session */
+      if (request->resumed) {
+        forget_session_for(client->prekey_manager, request->server);
+      }
+      prekey_manager_remove_request(client->prekey_manager, request);
+    }
+  }
 
-#define ACCOUNT_REQUEST_EXPIRY 10 * 60 /* 10 minutes */
+  current = client->prekey_manager->sessions;
+  while (current) {
+    otrng_prekey_session_s *session = current->data;
+    current = current->next;
 
-static void clean_request_for_account(otrng_client_s *client) {
-  if (client->prekey_manager != NULL &&
-      client->prekey_manager->request_for_account != NULL) {
-    prekey_request_free(client->prekey_manager->request_for_account);
-    client->prekey_manager->request_for_account = NULL;
-    client->prekey_manager->request_for_account_at = 0;
+    if (session_expired(client->prekey_manager, session, now)) {
+      forget_session_for(client->prekey_manager, session->server);
+    }
   }
 }
 
-void otrng_prekey_check_account_request(otrng_client_s *client) {
-  if (client->prekey_manager != NULL &&
-      client->prekey_manager->request_for_account != NULL) {
-    if (difftime(client->prekey_manager->request_for_account_at +
-                     ACCOUNT_REQUEST_EXPIRY,
-                 time(NULL)) <= 0) {
-      clean_request_for_account(client);
+typedef otrng_bool (*request_matcher)(const otrng_prekey_request_s *request,
+                                      const void *data);
+
+/*
+  Returns the first in-flight request towards the server "from" that is in
+  the given DAKE stage and that the matcher accepts. Requests are kept oldest
+  first, and a server answers in the order it received our messages, so in
+  the common case the first candidate is the right one. The oldest candidate
+  is returned in "oldest" whether anything matched or not, so that errors can
+  be attributed to it.
+*/
+/*@null@*/ static otrng_prekey_request_s *
+find_request(/*@notnull@*/ const otrng_prekey_manager_s *manager,
+             /*@notnull@*/ const char *from, otrng_bool dake_done,
+             /*@null@*/ request_matcher matcher, /*@null@*/ const void *data,
+             /*@notnull@*/ otrng_prekey_request_s **oldest) {
+  list_element_s *current = manager->requests;
+
+  *oldest = NULL;
+
+  for (; current; current = current->next) {
+    otrng_prekey_request_s *request = current->data;
+
+    if (request->dake_done != dake_done ||
+        strcmp(request->server->identity, from) != 0) {
+      continue;
+    }
+
+    if (*oldest == NULL) {
+      *oldest = request;
+    }
+
+    if (matcher == NULL || matcher(request, data)) {
+      return request;
     }
   }
+
+  return NULL;
 }
 
-/*@null@*/ static char *receive_dake2(otrng_client_s *client,
-                                      otrng_prekey_request_s *request,
+typedef struct {
+  otrng_client_s *client;
+  const otrng_prekey_dake2_message_s *msg;
+} dake2_match_s;
+
+/* The ring signature in the DAKE2 covers our ephemeral key, so only the
+ * request that sent the matching DAKE1 will validate it */
+static otrng_bool dake2_matches(const otrng_prekey_request_s *request,
+                                const void *data) {
+  const dake2_match_s *match = data;
+  return validate_dake2(match->client, request, match->msg);
+}
+
+/*@null@*/ static char *receive_dake2(otrng_client_s *client, const char *from,
                                       const uint8_t *decoded,
                                       size_t decoded_len) {
+  otrng_prekey_manager_s *manager = client->prekey_manager;
   otrng_prekey_dake2_message_s msg;
+  otrng_prekey_request_s *request, *oldest = NULL;
+  dake2_match_s match;
   char *ret = NULL;
 
+  assert(manager != NULL);
+
+  if (find_request(manager, from, otrng_false, NULL, NULL, &oldest) == NULL) {
+    notify_error(client, OTRNG_PREKEY_CLIENT_MALFORMED_MSG, NULL);
+    return NULL;
+  }
+
   otrng_prekey_dake2_message_init(&msg);
   if (!otrng_prekey_dake2_message_deserialize(&msg, decoded, decoded_len)) {
-    notify_error(client, OTRNG_PREKEY_CLIENT_MALFORMED_MSG, request->ctx);
+    notify_error(client, OTRNG_PREKEY_CLIENT_MALFORMED_MSG, oldest->ctx);
+    prekey_manager_remove_request(manager, oldest);
+    return NULL;
+  }
+
+  if (msg.client_instance_tag != otrng_client_get_instance_tag(client)) {
+    otrng_prekey_dake2_message_destroy(&msg);
     return NULL;
   }
 
-  ret = process_received_dake2(client, request, &msg);
+  match.client = client;
+  match.msg = &msg;
+  request =
+      find_request(manager, from, otrng_false, dake2_matches, &match, &oldest);
+  if (request == NULL) {
+    notify_error(client, OTRNG_PREKEY_CLIENT_INVALID_DAKE2, oldest->ctx);
+    prekey_manager_remove_request(manager, oldest);
+    otrng_prekey_dake2_message_destroy(&msg);
+    return NULL;
+  }
+
+  ret = send_dake3(client, request, &msg);
   otrng_prekey_dake2_message_destroy(&msg);
 
+  if (ret == NULL) {
+    prekey_manager_remove_request(manager, request);
+    return NULL;
+  }
+
+  request->dake_done = otrng_true;
+  return ret;
+}
+
+typedef struct {
+  const uint8_t *decoded;
+  uint8_t usage;
+} result_match_s;
+
+static otrng_bool result_mac_matches(const otrng_prekey_request_s *request,
+                                     const void *data) {
+  const result_match_s *match = data;
+  uint8_t mac_tag[HASH_BYTES];
+  goldilocks_shake256_ctx_p hash;
+  otrng_bool ret;
+
+  kdf_init_with_usage_x(hash, match->usage);
+  hash_update_x(hash, request->mac_key, MAC_KEY_BYTES);
+  hash_update_x(hash, match->decoded + 2, 5);
+  hash_final(hash, mac_tag, HASH_BYTES);
+  hash_destroy(hash);
+
+  ret = sodium_memcmp(mac_tag, match->decoded + 7, HASH_BYTES) == 0
+            ? otrng_true
+            : otrng_false;
+  otrng_secure_wipe(mac_tag, HASH_BYTES);
+
   return ret;
 }
 
 /*@null@*/ static char *receive_success_or_failure(
-    otrng_client_s *client, otrng_prekey_request_s *request,
-    const uint8_t *decoded, size_t decoded_len, const size_t len,
-    const uint8_t usage, const uint8_t error_code,
+    otrng_client_s *client, const char *from, const uint8_t *decoded,
+    size_t decoded_len, const size_t len, const uint8_t usage,
+    const uint8_t error_code,
     void (*callback)(struct otrng_client_s *client, void *ctx)) {
+  otrng_prekey_manager_s *manager = client->prekey_manager;
+  otrng_prekey_request_s *request, *oldest = NULL;
   uint32_t instance_tag = 0;
   size_t read = 0;
-  uint8_t *mac_tag;
-  goldilocks_shake256_ctx_p hash;
+  result_match_s match;
+
+  assert(manager != NULL);
+
+  if (find_request(manager, from, otrng_true, NULL, NULL, &oldest) == NULL) {
+    notify_error(client, OTRNG_PREKEY_CLIENT_MALFORMED_MSG, NULL);
+    return NULL;
+  }
 
   /* Since we check the length here, we don't need to check the later
    * deserializations */
   if (decoded_len < len) {
-    notify_error(client, OTRNG_PREKEY_CLIENT_MALFORMED_MSG, request->ctx);
+    notify_error(client, OTRNG_PREKEY_CLIENT_MALFORMED_MSG, oldest->ctx);
+    prekey_manager_remove_request(manager, oldest);
     return NULL;
   }
 
@@ -691,61 +1086,50 @@ void otrng_prekey_check_account_request(otrng_client_s *client) {
     return NULL;
   }
 
-  kdf_init_with_usage_x(hash, usage);
-  hash_update_x(hash, request->mac_key, MAC_KEY_BYTES);
-  hash_update_x(hash, decoded + 2, 5);
-
-  mac_tag = otrng_xmalloc_z(HASH_BYTES * sizeof(uint8_t));
-  hash_final(hash, mac_tag, HASH_BYTES);
-  hash_destroy(hash);
+  match.decoded = decoded;
+  match.usage = usage;
+  request = find_request(manager, from, otrng_true, result_mac_matches, &match,
+                         &oldest);
 
-  if (sodium_memcmp(mac_tag, decoded + 7, HASH_BYTES) != 0) {
-    notify_error(client, error_code, request->ctx);
+  if (request == NULL) {
+    notify_error(client, error_code, oldest->ctx);
+    prekey_manager_remove_request(manager, oldest);
   } else {
+    remember_session(manager, request);
     callback(client, request->ctx);
+    prekey_manager_remove_request(manager, request);
   }
 
-  otrng_free(mac_tag);
   return NULL;
 }
 
 /*@null@*/ static char *receive_success(otrng_client_s *client,
-                                        otrng_prekey_request_s *request,
+                                        const char *from,
                                         const uint8_t *decoded,
                                         size_t decoded_len) {
   assert(client->prekey_manager != NULL);
   return receive_success_or_failure(
-      client, request, decoded, decoded_len, OTRNG_PREKEY_SUCCESS_MSG_LEN,
+      client, from, decoded, decoded_len, OTRNG_PREKEY_SUCCESS_MSG_LEN,
       USAGE_SUCCESS_MAC, OTRNG_PREKEY_CLIENT_INVALID_SUCCESS,
       client->prekey_manager->callbacks->success_received);
 }
 
 /*@null@*/ static char *receive_failure(otrng_client_s *client,
-                                        otrng_prekey_request_s *request,
+                                        const char *from,
                                         const uint8_t *decoded,
                                         size_t decoded_len) {
   assert(client->prekey_manager != NULL);
   return receive_success_or_failure(
-      client, request, decoded, decoded_len, OTRNG_PREKEY_FAILURE_MSG_LEN,
+      client, from, decoded, decoded_len, OTRNG_PREKEY_FAILURE_MSG_LEN,
       USAGE_FAILURE_MAC, OTRNG_PREKEY_CLIENT_INVALID_FAILURE,
       client->prekey_manager->callbacks->failure_received);
 }
 
-/*@null@*/ static char *process_received_storage_status(
+static void process_received_storage_status(
     otrng_client_s *client, const otrng_prekey_request_s *request,
     const otrng_prekey_storage_status_message_s *msg) {
   assert(client->prekey_manager != NULL);
 
-  if (msg->client_instance_tag != otrng_client_get_instance_tag(client)) {
-    return NULL;
-  }
-
-  if (!otrng_prekey_storage_status_message_valid(msg, request->mac_key)) {
-    notify_error(client, OTRNG_PREKEY_CLIENT_INVALID_STORAGE_STATUS,
-                 request->ctx);
-    return NULL;
-  }
-
   if (msg->stored_prekeys < client->prekey_manager->publication_policy
                                 ->minimum_stored_prekey_message) {
     client->prekey_msgs_num_to_publish =
@@ -759,25 +1143,54 @@ void otrng_prekey_check_account_request(otrng_client_s *client) {
 
   client->prekey_manager->callbacks->storage_status_received(client, msg,
                                                              request->ctx);
-  return NULL;
+}
+
+static otrng_bool storage_status_matches(const otrng_prekey_request_s *request,
+                                         const void *data) {
+  return otrng_prekey_storage_status_message_valid(data, request->mac_key);
 }
 
 /*@null@*/ static char *receive_storage_status(otrng_client_s *client,
-                                               otrng_prekey_request_s *request,
+                                               const char *from,
                                                const uint8_t *decoded,
                                                size_t decoded_len) {
+  otrng_prekey_manager_s *manager = client->prekey_manager;
   otrng_prekey_storage_status_message_s msg;
-  char *ret;
+  otrng_prekey_request_s *request, *oldest = NULL;
+
+  assert(manager != NULL);
+
+  if (find_request(manager, from, otrng_true, NULL, NULL, &oldest) == NULL) {
+    notify_error(client, OTRNG_PREKEY_CLIENT_MALFORMED_MSG, NULL);
+    return NULL;
+  }
 
   if (!otrng_prekey_storage_status_message_deserialize(&msg, decoded,
                                                        decoded_len)) {
-    notify_error(client, OTRNG_PREKEY_CLIENT_MALFORMED_MSG, request->ctx);
+    notify_error(client, OTRNG_PREKEY_CLIENT_MALFORMED_MSG, oldest->ctx);
+    prekey_manager_remove_request(manager, oldest);
     return NULL;
   }
 
-  ret = process_received_storage_status(client, request, &msg);
+  if (msg.client_instance_tag != otrng_client_get_instance_tag(client)) {
+    otrng_prekey_storage_status_message_destroy(&msg);
+    return NULL;
+  }
+
+  request = find_request(manager, from, otrng_true, storage_status_matches,
+                         &msg, &oldest);
+  if (request == NULL) {
+    notify_error(client, OTRNG_PREKEY_CLIENT_INVALID_STORAGE_STATUS,
+                 oldest->ctx);
+    prekey_manager_remove_request(manager, oldest);
+  } else {
+    remember_session(manager, request);
+    process_received_storage_status(client, request, &msg);
+    prekey_manager_remove_request(manager, request);
+  }
+
   otrng_prekey_storage_status_message_destroy(&msg);
-  return ret;
+  return NULL;
 }
 
 /*@null@*/ static char *receive_no_prekey_in_storage(otrng_client_s *client,
@@ -828,7 +1241,8 @@ static otrng_result process_received_prekey_ensemble_retrieval(
   }
 
   for (i = 0; i < msg->num_ensembles; i++) {
-    if (!otrng_prekey_ensemble_validate(msg->ensembles[i])) {
+    if (!otrng_client_validate_prekey_ensemble(client, msg->identity,
+                                               msg->ensembles[i])) {
       otrng_prekey_ensemble_destroy(msg->ensembles[i]);
       msg->ensembles[i] = NULL;
       msg->num_ensembles = msg->num_ensembles - 1;
@@ -865,99 +1279,38 @@ static otrng_result process_received_prekey_ensemble_retrieval(
   return NULL;
 }
 
-/*@null@*/ static otrng_prekey_request_s *
-check_current_dake_request(const otrng_client_s *client, const char *from) {
-  otrng_prekey_request_s *rfa;
-
-  assert(client->prekey_manager != NULL);
-
-  rfa = client->prekey_manager->request_for_account;
-
-  if (rfa == NULL) {
-    return NULL;
-  }
-
-  if (strcmp(rfa->server->identity, from) == 0) {
-    return rfa;
-  }
-
-  return NULL;
-}
-
 /*@null@*/ static char *
 receive_decoded_message(otrng_client_s *client, const uint8_t *decoded,
                         const size_t decoded_len,
                         /*@notnull@*/ const char *from) {
   uint8_t msg_type = 0;
-  otrng_prekey_request_s *request = NULL;
-  char *res;
+  uint64_t start;
+  char *reply;
 
   if (!otrng_prekey_parse_header(&msg_type, decoded, decoded_len, NULL)) {
     notify_error(client, OTRNG_PREKEY_CLIENT_MALFORMED_MSG, NULL);
     return NULL;
   }
 
-  request = check_current_dake_request(client, from);
-
   switch (msg_type) {
   case OTRNG_PREKEY_DAKE2_MSG:
-    if (!request) {
-      notify_error(client, OTRNG_PREKEY_CLIENT_MALFORMED_MSG, NULL);
-      return NULL;
-    }
-
-    res = receive_dake2(client, request, decoded, decoded_len);
-    if (res == NULL) {
-      clean_request_for_account(client);
-    }
-    return res;
+    start = otrng_metrics_start();
+    reply = receive_dake2(client, from, decoded, decoded_len);
+    otrng_metrics_record(client->global_state, OTRNG_METRIC_PREKEY_DAKE3,
+                         start, reply ? OTRNG_SUCCESS : OTRNG_ERROR);
+    return reply;
   case OTRNG_PREKEY_SUCCESS_MSG:
-    if (!request) {
-      notify_error(client, OTRNG_PREKEY_CLIENT_MALFORMED_MSG, NULL);
-      return NULL;
-    }
-    res = receive_success(client, request, decoded, decoded_len);
-    clean_request_for_account(client);
-    return res;
+    return receive_success(client, from, decoded, decoded_len);
   case OTRNG_PREKEY_FAILURE_MSG:
-    if (!request) {
-      notify_error(client, OTRNG_PREKEY_CLIENT_MALFORMED_MSG, NULL);
-      return NULL;
-    }
-    res = receive_failure(client, request, decoded, decoded_len);
-    clean_request_for_account(client);
-    return res;
+    return receive_failure(client, from, decoded, decoded_len);
   case OTRNG_PREKEY_STORAGE_STATUS_MSG:
-    if (!request) {
-      notify_error(client, OTRNG_PREKEY_CLIENT_MALFORMED_MSG, NULL);
-      return NULL;
-    }
-    res = receive_storage_status(client, request, decoded, decoded_len);
-    clean_request_for_account(client);
-    return res;
+    return receive_storage_status(client, from, decoded, decoded_len);
   case OTRNG_PREKEY_NO_PREKEY_IN_STORAGE_MSG:
     return receive_no_prekey_in_storage(client, decoded, decoded_len);
   case OTRNG_PREKEY_ENSEMBLE_RETRIEVAL_MSG:
     return receive_prekey_ensemble_retrieval(client, decoded, decoded_len);
   default:
-    notify_error(client, OTRNG_PREKEY_CLIENT_MALFORMED_MSG,
-                 request != NULL ? request->ctx : NULL);
-  }
-
-  return NULL;
-}
-
-/*@null@*/ tstatic otrng_prekey_server_s *
-find_server_for_identity(/*@notnull@*/ otrng_prekey_manager_s *manager,
-                         const char *identity) {
-  otrng_prekey_server_s *server = NULL;
-  list_element_s *current = manager->server_identities;
-
-  for (; current; current = current->next) {
-    server = current->data;
-    if (strcmp(identity, server->identity) == 0) {
-      return server;
-    }
+    notify_error(client, OTRNG_PREKEY_CLIENT_MALFORMED_MSG, NULL);
   }
 
   return NULL;
@@ -1367,16 +1720,90 @@ static otrng_result publication_after_dake(
 API otrng_result otrng_prekey_publish(/*@notnull@*/ char **new_msg,
                                       /*@notnull@*/ otrng_client_s *client,
                                       /*@null@*/ void *ctx) {
-  return start_dake1(new_msg, client, ctx, publication_after_dake);
+  otrng_prekey_server_s *server = server_for_account(client, ctx);
+
+  if (!server) {
+    return OTRNG_ERROR;
+  }
+
+  return start_request(new_msg, NULL, client, server, ctx,
+                       publication_after_dake);
+}
+
+API otrng_result otrng_prekey_publish_to(
+    /*@notnull@*/ char **new_msg,
+    /*@null@*/ uint32_t *request_id,
+    /*@notnull@*/ otrng_client_s *client,
+    /*@notnull@*/ const char *server_identity,
+    /*@null@*/ void *ctx) {
+  otrng_prekey_server_s *server;
+
+  assert(client);
+  assert(client->prekey_manager);
+  assert(new_msg);
+  assert(server_identity);
+
+  *new_msg = NULL;
+
+  server = find_server_for_identity(client->prekey_manager, server_identity);
+  if (!server) {
+    return OTRNG_ERROR;
+  }
+
+  return start_request(new_msg, request_id, client, server, ctx,
+                       publication_after_dake);
+}
+
+API otrng_bool otrng_prekey_cancel_request(/*@notnull@*/ otrng_client_s *client,
+                                           uint32_t request_id) {
+  otrng_prekey_request_s *request;
+
+  assert(client);
+
+  if (client->prekey_manager == NULL) {
+    return otrng_false;
+  }
+
+  request = find_request_by_id(client->prekey_manager, request_id);
+  if (request == NULL) {
+    return otrng_false;
+  }
+
+  prekey_manager_remove_request(client->prekey_manager, request);
+  return otrng_true;
+}
+
+API size_t
+otrng_prekey_pending_requests(/*@notnull@*/ const otrng_client_s *client,
+                              /*@null@*/ const char *server_identity) {
+  list_element_s *current;
+  size_t result = 0;
+
+  assert(client);
+
+  if (client->prekey_manager == NULL) {
+    return 0;
+  }
+
+  for (current = client->prekey_manager->requests; current;
+       current = current->next) {
+    const otrng_prekey_request_s *request = current->data;
+    if (server_identity == NULL ||
+        strcmp(request->server->identity, server_identity) == 0) {
+      result++;
+    }
+  }
+
+  return result;
 }
 
 API void otrng_prekey_add_prekey_messages_for_publication(
     /*@notnull@*/ otrng_client_s *client,
     /*@notnull@*/ otrng_prekey_publication_message_s *msg) {
-  const size_t max = otrng_list_len(client->our_prekeys);
+  const size_t max = otrng_tail_list_len(&client->our_prekeys);
   size_t real = 0;
   prekey_message_s **msg_list = otrng_xmalloc(max * sizeof(prekey_message_s *));
-  list_element_s *current = client->our_prekeys;
+  list_element_s *current = client->our_prekeys.head;
 
   assert(client);
   assert(msg);
@@ -1395,11 +1822,28 @@ API void otrng_prekey_add_prekey_messages_for_publication(
   if (real != 0) {
     // Since we are shrinking the array, there is no way this can fail, so no
     // need to check the result
-    msg->prekey_messages = realloc(msg_list, real * sizeof(prekey_message_s *));
+    msg->prekey_messages =
+        otrng_xrealloc(msg_list, real * sizeof(prekey_message_s *));
   }
   msg->num_prekey_messages = real;
 }
 
+API void otrng_prekey_set_session_lifetime(otrng_client_s *client,
+                                           time_t seconds) {
+  otrng_prekey_manager_s *manager;
+
+  assert(client);
+  assert(client->prekey_manager != NULL);
+
+  manager = client->prekey_manager;
+  manager->session_lifetime = seconds;
+
+  if (seconds == 0) {
+    otrng_list_free(manager->sessions, free_prekey_session);
+    manager->sessions = NULL;
+  }
+}
+
 API void otrng_prekey_set_client_profile_publication(otrng_client_s *client) {
   assert(client->prekey_manager != NULL);
   client->prekey_manager->publication_policy->publish_client_profile =
@@ -1425,6 +1869,7 @@ static void otrng_prekey_server_free(otrng_prekey_server_s *server) {
 
 static void free_fragment_context(void *p) { otrng_fragment_context_free(p); }
 static void free_server_identity(void *p) { otrng_prekey_server_free(p); }
+static void free_prekey_request(void *p) { prekey_request_free(p); }
 
 INTERNAL void otrng_prekey_manager_free(otrng_prekey_manager_s *manager) {
   if (manager == NULL) {
@@ -1435,11 +1880,10 @@ INTERNAL void otrng_prekey_manager_free(otrng_prekey_manager_s *manager) {
   otrng_free(manager->publication_policy);
   otrng_free(manager->callbacks);
 
-  otrng_list_free(manager->pending_fragments, free_fragment_context);
+  otrng_tail_list_free(&manager->pending_fragments, free_fragment_context);
+  otrng_list_free(manager->requests, free_prekey_request);
+  otrng_list_free(manager->sessions, free_prekey_session);
   otrng_list_free(manager->server_identities, free_server_identity);
-  if (manager->request_for_account != NULL) {
-    prekey_request_free(manager->request_for_account);
-  }
 
   otrng_free(manager);
 }
@@ -37,6 +37,7 @@
 #include "list.h"
 #include "prekey_client_dake.h"
 #include "prekey_client_messages.h"
+#include "prekey_client_shared.h"
 #include "shared.h"
 
 struct otrng_client_s;
@@ -72,9 +73,14 @@ typedef otrng_result (*otrng_prekey_next_message)(
   server.
 
   It will be created when needed to create a new request to a prekey server, and
-  then destroyed after the request is done.
+  then destroyed after the request is done. Several requests can be in flight
+  at the same time - they are identified by the server they talk to and by
+  their request id.
 */
 typedef struct otrng_prekey_request_s {
+  /* Unique for the lifetime of the prekey manager. Never 0. */
+  uint32_t id;
+
   /*@null@*/ void *ctx;
 
   /* The request does NOT own the server instance */
@@ -86,8 +92,41 @@ typedef struct otrng_prekey_request_s {
   uint8_t mac_proof_key[MAC_KEY_BYTES];
 
   /*@notnull@*/ otrng_prekey_next_message after_dake;
+
+  /* The time the DAKE1 was created - used to expire lost requests */
+  time_t started_at;
+
+  /* otrng_false while we wait for a DAKE2, otrng_true once the DAKE3 has been
+   * sent and we are waiting for the server's answer */
+  otrng_bool dake_done;
+
+  /* otrng_true if the request was sent inside an existing session, instead
+   * of after a DAKE of its own */
+  otrng_bool resumed;
+
+  /* The shared secret of the DAKE, kept until the server has answered if the
+   * session should be kept for later requests. Otherwise NULL. */
+  /*@null@*/ uint8_t *session_secret;
 } otrng_prekey_request_s;
 
+/*
+  A session with a prekey server, kept after a DAKE has finished. While it
+  lives, later requests to the same server are sent inside it, with keys
+  derived from its secret, instead of doing a new DAKE each.
+*/
+typedef struct otrng_prekey_session_s {
+  /* The session does NOT own the server instance */
+  /*@notnull@*/ otrng_prekey_server_s *server;
+
+  /*@notnull@*/ uint8_t *secret;
+  uint8_t id[PREKEY_SESSION_ID_BYTES];
+
+  /* The counter of the last request sent in this session */
+  uint32_t counter;
+
+  time_t established_at;
+} otrng_prekey_session_s;
+
 typedef struct {
   /*
      Returns the domain for a specific account. The caller does NOT take
@@ -159,16 +198,22 @@ typedef struct {
    * NULL */
   /*@null@*/ list_element_s *server_identities;
 
-  /* This contains the prekey request when a request for an account is active -
-   * otherwise it will be NULL */
-  /*@null@*/ otrng_prekey_request_s *request_for_account;
+  /* This list contains the otrng_prekey_request_s entries that are currently
+   * in flight, oldest first. An empty list will be NULL */
+  /*@null@*/ list_element_s *requests;
 
-  /* If request_for_account is not NULL, this contains the time when it was
-   * set - this allows us to clean it, if it hasn't been removed for a while
-   */
-  time_t request_for_account_at;
+  /* The id that will be given to the next request */
+  uint32_t next_request_id;
+
+  /* This list contains the otrng_prekey_session_s entries, at most one per
+   * server. An empty list will be NULL */
+  /*@null@*/ list_element_s *sessions;
 
-  /*@null@*/ list_element_s *pending_fragments;
+  /* How long, in seconds, a session is used after its DAKE. 0 means that
+   * every request does its own DAKE. */
+  time_t session_lifetime;
+
+  otrng_tail_list_s pending_fragments;
 
   /*@notnull@*/ otrng_prekey_publication_policy_s *publication_policy;
 
@@ -211,6 +256,79 @@ API otrng_result otrng_prekey_request_storage_information(
     /*@notnull@*/ struct otrng_client_s *client,
     /*@null@*/ void *ctx);
 
+/**
+ * @brief Will start the process of publishing new data to a specific prekey
+ *    server. Any number of these can be in flight at the same time, also
+ *    towards different servers.
+ *
+ * @param [new_msg] the non-NULL location where the message to send on the
+ *    network should be stored. the caller takes over ownership of the string
+ *    pointed to by new_msg in the case of a successful return
+ * @param [request_id] the optional location where the id of the new request
+ *    should be stored
+ * @param [client] the non-NULL OTR client
+ * @param [server_identity] the non-NULL identity of a server previously given
+ *    to otrng_prekey_provide_server_identity_for
+ * @param [ctx]  the optional context for callbacks
+ *
+ * @return whether the operation was successful or not. if not successful,
+ *    new_msg will point to NULL.
+ **/
+API otrng_result otrng_prekey_publish_to(
+    /*@notnull@*/ char **new_msg,
+    /*@null@*/ uint32_t *request_id,
+    /*@notnull@*/ struct otrng_client_s *client,
+    /*@notnull@*/ const char *server_identity,
+    /*@null@*/ void *ctx);
+
+/**
+ * @brief Will start the process of checking how many prekeys are currently
+ *    stored on a specific prekey server. Any number of these can be in flight
+ *    at the same time.
+ *
+ * @param [new_msg] the non-NULL location where the message to send on the
+ *    network should be stored. the caller takes over ownership of the string
+ *    pointed to by new_msg in the case of a successful return
+ * @param [request_id] the optional location where the id of the new request
+ *    should be stored
+ * @param [client] the non-NULL OTR client
+ * @param [server_identity] the non-NULL identity of a server previously given
+ *    to otrng_prekey_provide_server_identity_for
+ * @param [ctx]  the optional context for callbacks
+ *
+ * @return whether the operation was successful or not. if not successful,
+ *    new_msg will point to NULL.
+ **/
+API otrng_result otrng_prekey_request_storage_information_from(
+    /*@notnull@*/ char **new_msg,
+    /*@null@*/ uint32_t *request_id,
+    /*@notnull@*/ struct otrng_client_s *client,
+    /*@notnull@*/ const char *server_identity,
+    /*@null@*/ void *ctx);
+
+/**
+ * @brief Forgets about a request that is in flight. Any answer the server
+ *    sends for it afterwards will be reported as an error.
+ *
+ * @param [client] the non-NULL OTR client
+ * @param [request_id] the id of the request to cancel
+ *
+ * @return otrng_true if the request was found and removed
+ **/
+API otrng_bool otrng_prekey_cancel_request(
+    /*@notnull@*/ struct otrng_client_s *client, uint32_t request_id);
+
+/**
+ * @brief Returns the number of requests currently in flight.
+ *
+ * @param [client] the non-NULL OTR client
+ * @param [server_identity] if not NULL, only requests towards this server
+ *    are counted
+ **/
+API size_t otrng_prekey_pending_requests(
+    /*@notnull@*/ const struct otrng_client_s *client,
+    /*@null@*/ const char *server_identity);
+
 /**
  * @brief Starts the process of retrieving prekeys for a specific identity.
  *
@@ -330,12 +448,30 @@ API void otrng_prekey_set_client_profile_publication(
 API void otrng_prekey_set_prekey_profile_publication(
     /*@notnull@*/ struct otrng_client_s *client);
 
+/**
+ * @brief Lets later requests to a prekey server reuse the secret of a recent
+ *    DAKE with it, instead of doing a new DAKE. Sessions are used for
+ *    [seconds] seconds after their DAKE, less a few seconds so that the last
+ *    request in one does not reach the server after it has forgotten it.
+ *
+ * This is not part of the prekey server specification, so it should only be
+ * enabled for servers that are known to support it. A request sent in a
+ * session the server has forgotten will not be answered - it expires like any
+ * other lost request, and the session is then dropped.
+ *
+ * @param [client] the non-NULL OTR client
+ * @param [seconds] how long sessions are kept. 0, the default, disables the
+ *    sessions and forgets the ones that exist.
+ **/
+API void otrng_prekey_set_session_lifetime(
+    /*@notnull@*/ struct otrng_client_s *client, time_t seconds);
+
 INTERNAL void
 otrng_prekey_manager_free(/*@null@*/ otrng_prekey_manager_s *manager);
 
 /**
- * @brief Should be called regularly to see that the request_for_account
- *    request hasn't expired.
+ * @brief Should be called regularly to remove requests that have been in
+ *    flight for too long.
  **/
 INTERNAL void
 otrng_prekey_check_account_request(/*@notnull@*/ struct otrng_client_s *client);
@@ -352,6 +488,18 @@ storage_request_after_dake(/*@notnull@*/ struct otrng_client_s *client,
 tstatic /*@null@*/ otrng_prekey_request_s *
 create_prekey_request(otrng_prekey_server_s *server, void *ctx);
 
+tstatic otrng_result
+prekey_manager_register_request(/*@notnull@*/ otrng_prekey_manager_s *manager,
+                                /*@notnull@*/ otrng_prekey_request_s *request);
+
+tstatic /*@null@*/ otrng_prekey_request_s *
+find_request_by_id(/*@notnull@*/ const otrng_prekey_manager_s *manager,
+                   uint32_t id);
+
+tstatic /*@null@*/ otrng_prekey_session_s *
+find_live_session(/*@notnull@*/ const otrng_prekey_manager_s *manager,
+                  /*@notnull@*/ const otrng_prekey_server_s *server);
+
 tstatic char *send_dake3(struct otrng_client_s *client,
                          otrng_prekey_request_s *request,
                          const otrng_prekey_dake2_message_s *msg);
@@ -18,16 +18,21 @@
  *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define OTRNG_PREKEY_MESSAGE_PRIVATE
+
 #include "prekey_message.h"
 
 #include "alloc.h"
 
 #include "base64.h"
 #include "deserialize.h"
+#include "random.h"
 #include "serialize.h"
+#include "worker.h"
 
-tstatic /*@notnull@*/ prekey_message_s *otrng_prekey_message_new(void) {
-  prekey_message_s *prekey_msg = otrng_xmalloc_z(sizeof(prekey_message_s));
+INTERNAL /*@notnull@*/ prekey_message_s *otrng_prekey_message_new(void) {
+  prekey_message_s *prekey_msg =
+      otrng_xmalloc_in(OTRNG_ALLOC_PREKEYS, sizeof(prekey_message_s));
 
   return prekey_msg;
 }
@@ -48,7 +53,7 @@ otrng_prekey_message_create_copy(const prekey_message_s *src) {
   dst->B = otrng_dh_mpi_copy(src->B);
 
   if (src->y) {
-    dst->y = otrng_secure_alloc(sizeof(ecdh_keypair_s));
+    dst->y = otrng_secure_alloc_in(OTRNG_ALLOC_PREKEYS, sizeof(ecdh_keypair_s));
     otrng_ec_scalar_copy(dst->y->priv, src->y->priv);
     otrng_ec_point_copy(dst->y->pub, src->y->pub);
   } else {
@@ -56,7 +61,7 @@ otrng_prekey_message_create_copy(const prekey_message_s *src) {
   }
 
   if (src->b) {
-    dst->b = otrng_secure_alloc(sizeof(dh_keypair_s));
+    dst->b = otrng_secure_alloc_in(OTRNG_ALLOC_PREKEYS, sizeof(dh_keypair_s));
     dst->b->priv = otrng_dh_mpi_copy(src->b->priv);
     dst->b->pub = otrng_dh_mpi_copy(src->b->pub);
   } else {
@@ -66,31 +71,37 @@ otrng_prekey_message_create_copy(const prekey_message_s *src) {
   return dst;
 }
 
-INTERNAL /*@null@*/ prekey_message_s *
-otrng_prekey_message_build(uint32_t instance_tag, const ecdh_keypair_s *y,
-                           const dh_keypair_s *b) {
+tstatic prekey_message_s *prekey_message_build_with_id(uint32_t id,
+                                                       uint32_t instance_tag,
+                                                       const ecdh_keypair_s *y,
+                                                       const dh_keypair_s *b) {
   prekey_message_s *msg = otrng_prekey_message_new();
-  uint32_t *identifier;
-  if (!msg) {
-    return NULL;
-  }
 
+  msg->id = id;
   msg->sender_instance_tag = instance_tag;
 
-  msg->y = otrng_secure_alloc(sizeof(ecdh_keypair_s));
+  msg->y = otrng_secure_alloc_in(OTRNG_ALLOC_PREKEYS, sizeof(ecdh_keypair_s));
   otrng_ec_scalar_copy(msg->y->priv, y->priv);
   otrng_ec_point_copy(msg->y->pub, y->pub);
 
-  msg->b = otrng_secure_alloc(sizeof(dh_keypair_s));
+  msg->b = otrng_secure_alloc_in(OTRNG_ALLOC_PREKEYS, sizeof(dh_keypair_s));
   msg->b->priv = otrng_dh_mpi_copy(b->priv);
   msg->b->pub = otrng_dh_mpi_copy(b->pub);
 
   otrng_ec_point_copy(msg->Y, y->pub);
   msg->B = otrng_dh_mpi_copy(b->pub);
 
-  identifier = gcry_random_bytes(4, GCRY_STRONG_RANDOM);
-  msg->id = *identifier;
+  return msg;
+}
 
+INTERNAL /*@null@*/ prekey_message_s *
+otrng_prekey_message_build(uint32_t instance_tag, const ecdh_keypair_s *y,
+                           const dh_keypair_s *b) {
+  prekey_message_s *msg;
+  uint32_t *identifier;
+
+  identifier = gcry_random_bytes(4, GCRY_STRONG_RANDOM);
+  msg = prekey_message_build_with_id(*identifier, instance_tag, y, b);
   gcry_free(identifier);
 
   return msg;
@@ -104,12 +115,14 @@ static void otrng_prekey_message_destroy(prekey_message_s *prekey_msg) {
 
   if (prekey_msg->y) {
     otrng_ecdh_keypair_destroy(prekey_msg->y);
-    otrng_secure_free(prekey_msg->y);
+    otrng_secure_free_in(OTRNG_ALLOC_PREKEYS, prekey_msg->y,
+                         sizeof(ecdh_keypair_s));
   }
 
   if (prekey_msg->b) {
     otrng_dh_keypair_destroy(prekey_msg->b);
-    otrng_secure_free(prekey_msg->b);
+    otrng_secure_free_in(OTRNG_ALLOC_PREKEYS, prekey_msg->b,
+                         sizeof(dh_keypair_s));
   }
 }
 
@@ -119,7 +132,180 @@ INTERNAL void otrng_prekey_message_free(prekey_message_s *prekey_msg) {
   }
 
   otrng_prekey_message_destroy(prekey_msg);
-  otrng_free(prekey_msg);
+  otrng_free_in(OTRNG_ALLOC_PREKEYS, prekey_msg, sizeof(prekey_message_s));
+}
+
+/* Generates the keys for [num] messages from their seeds. Only touches its
+   own slice of the batch, so several of these can run at the same time. */
+tstatic void prekey_batch_job_run(void *data) {
+  prekey_batch_job_s *job = data;
+  size_t i;
+
+  for (i = 0; i < job->num; i++) {
+    const uint8_t *seed = job->seeds + i * PREKEY_BATCH_SEED_BYTES;
+    ecdh_keypair_s ecdh;
+    dh_keypair_s dh;
+
+    if (!otrng_ecdh_keypair_generate(&ecdh, seed)) {
+      job->result = OTRNG_ERROR;
+      return;
+    }
+
+    if (!otrng_dh_keypair_generate_from_random(&dh,
+                                               seed + ED448_PRIVATE_BYTES)) {
+      otrng_ecdh_keypair_destroy(&ecdh);
+      job->result = OTRNG_ERROR;
+      return;
+    }
+
+    job->messages[i] = prekey_message_build_with_id(
+        job->ids[i], job->instance_tag, &ecdh, &dh);
+
+    otrng_ecdh_keypair_destroy(&ecdh);
+    otrng_dh_keypair_destroy(&dh);
+  }
+
+  job->result = OTRNG_SUCCESS;
+}
+
+tstatic otrng_bool prekey_batch_id_taken(uint32_t id, const uint32_t *ids,
+                                         size_t num,
+                                         const list_element_s *taken) {
+  size_t i;
+  const list_element_s *el;
+
+  for (i = 0; i < num; i++) {
+    if (ids[i] == id) {
+      return otrng_true;
+    }
+  }
+
+  for (el = taken; el; el = el->next) {
+    const prekey_message_s *msg = el->data;
+    if (msg->id == id) {
+      return otrng_true;
+    }
+  }
+
+  return otrng_false;
+}
+
+tstatic void prekey_batch_free(prekey_batch_s *batch) {
+  otrng_secure_free(batch->seeds);
+  otrng_free(batch->ids);
+  otrng_free(batch);
+}
+
+INTERNAL /*@null@*/ prekey_batch_s *
+otrng_prekey_batch_new(uint32_t instance_tag, size_t num,
+                       const list_element_s *taken) {
+  prekey_batch_s *batch;
+  size_t i;
+
+  if (num == 0) {
+    return NULL;
+  }
+
+  batch = otrng_xmalloc_z(sizeof(prekey_batch_s));
+  batch->instance_tag = instance_tag;
+  batch->num = num;
+
+  /* All randomness is drawn here, in order, so the result only depends on
+     the random source and not on how the work is split between threads. */
+  batch->seeds = otrng_secure_alloc(num * PREKEY_BATCH_SEED_BYTES);
+  batch->ids = otrng_xmalloc_z(num * sizeof(uint32_t));
+  for (i = 0; i < num; i++) {
+    int attempts = 0;
+
+    random_bytes(batch->seeds + i * PREKEY_BATCH_SEED_BYTES,
+                 PREKEY_BATCH_SEED_BYTES);
+    do {
+      if (attempts++ == PREKEY_BATCH_MAX_ID_ATTEMPTS) {
+        prekey_batch_free(batch);
+        return NULL;
+      }
+      random_bytes(&batch->ids[i], sizeof(uint32_t));
+    } while (prekey_batch_id_taken(batch->ids[i], batch->ids, i, taken));
+  }
+
+  return batch;
+}
+
+INTERNAL /*@null@*/ prekey_message_s **
+otrng_prekey_batch_build(prekey_batch_s *batch, unsigned int num_threads) {
+  prekey_message_s **messages;
+  prekey_batch_job_s *jobs;
+  otrng_worker_s *worker = NULL;
+  size_t i, num_jobs, per_job;
+  size_t num = batch->num;
+  otrng_bool failed = otrng_false;
+
+  if (num_threads > num) {
+    num_threads = num;
+  }
+  if (num_threads > 1) {
+    worker = otrng_worker_new(num_threads);
+  }
+  num_jobs = worker ? num_threads : 1;
+  per_job = (num + num_jobs - 1) / num_jobs;
+
+  messages = otrng_xmalloc_z(num * sizeof(prekey_message_s *));
+  jobs = otrng_xmalloc_z(num_jobs * sizeof(prekey_batch_job_s));
+
+  for (i = 0; i < num_jobs; i++) {
+    size_t start = i * per_job;
+
+    jobs[i].job.run = prekey_batch_job_run;
+    jobs[i].job.data = &jobs[i];
+    jobs[i].instance_tag = batch->instance_tag;
+    jobs[i].seeds = batch->seeds + start * PREKEY_BATCH_SEED_BYTES;
+    jobs[i].ids = batch->ids + start;
+    jobs[i].messages = messages + start;
+    jobs[i].num = start < num ? num - start : 0;
+    if (jobs[i].num > per_job) {
+      jobs[i].num = per_job;
+    }
+
+    if (worker) {
+      otrng_worker_submit(worker, &jobs[i].job);
+    } else {
+      prekey_batch_job_run(&jobs[i]);
+    }
+  }
+
+  otrng_worker_free(worker);
+
+  for (i = 0; i < num_jobs; i++) {
+    if (otrng_failed(jobs[i].result)) {
+      failed = otrng_true;
+    }
+  }
+
+  prekey_batch_free(batch);
+  otrng_free(jobs);
+
+  if (failed) {
+    for (i = 0; i < num; i++) {
+      otrng_prekey_message_free(messages[i]);
+    }
+    otrng_free(messages);
+    return NULL;
+  }
+
+  return messages;
+}
+
+INTERNAL /*@null@*/ prekey_message_s **
+otrng_prekey_messages_build_batch(uint32_t instance_tag, size_t num,
+                                  unsigned int num_threads,
+                                  const list_element_s *taken) {
+  prekey_batch_s *batch = otrng_prekey_batch_new(instance_tag, num, taken);
+
+  if (!batch) {
+    return NULL;
+  }
+
+  return otrng_prekey_batch_build(batch, num_threads);
 }
 
 INTERNAL otrng_result otrng_prekey_message_serialize_into(
@@ -251,6 +437,34 @@ INTERNAL otrng_result otrng_prekey_message_deserialize(prekey_message_s *dst,
   return ret;
 }
 
+INTERNAL otrng_result otrng_prekey_message_peek_metadata(
+    uint32_t *id, uint8_t *should_publish, const uint8_t *src, size_t src_len) {
+  /* version (2), type (1), id (4), instance tag (4), Y */
+  size_t w = 2 + 1;
+  size_t read = 0;
+  uint32_t mpi_len = 0;
+
+  if (src_len < w ||
+      !otrng_deserialize_uint32(id, src + w, src_len - w, &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read + 4 + ED448_POINT_BYTES;
+
+  /* B is an MPI: a 4-byte length followed by its bytes */
+  if (w > src_len ||
+      !otrng_deserialize_uint32(&mpi_len, src + w, src_len - w, &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (mpi_len > src_len - w) {
+    return OTRNG_ERROR;
+  }
+  w += mpi_len;
+
+  return otrng_deserialize_uint8(should_publish, src + w, src_len - w, &read);
+}
+
 INTERNAL otrng_result otrng_prekey_message_deserialize_with_metadata(
     prekey_message_s *dst, const uint8_t *src, size_t src_len, size_t *nread) {
   size_t read = 0, w = 0;
@@ -271,8 +485,8 @@ INTERNAL otrng_result otrng_prekey_message_deserialize_with_metadata(
 
   w += read;
 
-  dst->b = otrng_secure_alloc(sizeof(dh_keypair_s));
-  dst->y = otrng_secure_alloc(sizeof(ecdh_keypair_s));
+  dst->b = otrng_secure_alloc_in(OTRNG_ALLOC_PREKEYS, sizeof(dh_keypair_s));
+  dst->y = otrng_secure_alloc_in(OTRNG_ALLOC_PREKEYS, sizeof(ecdh_keypair_s));
 
   result = otrng_deserialize_ec_scalar(dst->y->priv, src + w, src_len - w);
   if (otrng_failed(result)) {
@@ -32,6 +32,8 @@
 
 #include "dh.h"
 #include "ed448.h"
+#include "list.h"
+#include "worker.h"
 
 typedef struct prekey_message_s {
   uint32_t id;
@@ -46,6 +48,11 @@ typedef struct prekey_message_s {
   otrng_bool is_publishing;
 } prekey_message_s;
 
+/**
+ * @brief An empty prekey message, to be freed with otrng_prekey_message_free.
+ */
+INTERNAL /*@notnull@*/ prekey_message_s *otrng_prekey_message_new(void);
+
 INTERNAL /*@null@*/ prekey_message_s *
 otrng_prekey_message_create_copy(const prekey_message_s *src);
 
@@ -55,6 +62,54 @@ otrng_prekey_message_build(uint32_t instance_tag, const ecdh_keypair_s *y,
 
 INTERNAL void otrng_prekey_message_free(prekey_message_s *prekey_msg);
 
+/**
+ * @brief Builds [num] prekey messages for [instance_tag], generating their
+ *    keys on up to [num_threads] threads.
+ *
+ * All randomness is drawn from random_bytes() on the calling thread, in
+ * message order, so the messages only depend on the random source
+ * (see otrng_set_current_randomness) and never on the number of threads.
+ * The ids are unique within the batch and differ from the ids of the
+ * messages in [taken].
+ *
+ * @return an array of [num] messages, or NULL on failure.
+ */
+INTERNAL /*@null@*/ prekey_message_s **
+otrng_prekey_messages_build_batch(uint32_t instance_tag, size_t num,
+                                  unsigned int num_threads,
+                                  /*@null@*/ const list_element_s *taken);
+
+/* The randomness and the ids of a batch, drawn before any key is generated */
+typedef struct prekey_batch_s {
+  uint32_t instance_tag;
+  size_t num;
+  uint8_t *seeds;
+  uint32_t *ids;
+} prekey_batch_s;
+
+/**
+ * @brief Draws the randomness and picks the ids of the messages that
+ *    otrng_prekey_messages_build_batch would build.
+ *
+ * [taken] is only read here, so the batch can then be built without holding
+ * whatever protects it.
+ *
+ * @return the batch, or NULL when [num] is 0 or no free ids could be found.
+ */
+INTERNAL /*@null@*/ prekey_batch_s *
+otrng_prekey_batch_new(uint32_t instance_tag, size_t num,
+                       /*@null@*/ const list_element_s *taken);
+
+/**
+ * @brief Generates the keys of the messages of [batch] on up to
+ *    [num_threads] threads, and frees [batch].
+ *
+ * @return an array of [batch->num] messages, or NULL on failure.
+ */
+INTERNAL /*@null@*/ prekey_message_s **
+otrng_prekey_batch_build(/*@only@*/ prekey_batch_s *batch,
+                         unsigned int num_threads);
+
 INTERNAL otrng_result otrng_prekey_message_deserialize(prekey_message_s *dst,
                                                        const uint8_t *src,
                                                        size_t src_len,
@@ -64,6 +119,13 @@ INTERNAL otrng_result otrng_prekey_message_deserialize_with_metadata(
     prekey_message_s *dst, const uint8_t *src, size_t src_len,
     /*@null@*/ size_t *nread);
 
+/**
+ * @brief Reads the id and the should_publish flag of a prekey message
+ *    serialized with its metadata, without deserializing any of its keys.
+ */
+INTERNAL otrng_result otrng_prekey_message_peek_metadata(
+    uint32_t *id, uint8_t *should_publish, const uint8_t *src, size_t src_len);
+
 INTERNAL otrng_result otrng_prekey_message_serialize_into(
     uint8_t **dst, size_t *nbytes, const prekey_message_s *prekey_msg);
 
@@ -75,7 +137,36 @@ INTERNAL otrng_result otrng_prekey_message_serialize_with_metadata(
 
 #ifdef OTRNG_PREKEY_MESSAGE_PRIVATE
 
-tstatic /*@notnull@*/ prekey_message_s *otrng_prekey_message_new(void);
+/* Random bytes needed for the keys of one message: an ECDH secret and the
+   DH randomness */
+#define PREKEY_BATCH_SEED_BYTES (ED448_PRIVATE_BYTES + DH_KEY_SIZE)
+
+/* Give up on a random source that keeps repeating ids */
+#define PREKEY_BATCH_MAX_ID_ATTEMPTS 16
+
+/* One slice of a batch, generated on one thread */
+typedef struct prekey_batch_job_s {
+  otrng_worker_job_s job;
+  uint32_t instance_tag;
+  const uint8_t *seeds;
+  const uint32_t *ids;
+  prekey_message_s **messages;
+  size_t num;
+  otrng_result result;
+} prekey_batch_job_s;
+
+tstatic prekey_message_s *prekey_message_build_with_id(uint32_t id,
+                                                       uint32_t instance_tag,
+                                                       const ecdh_keypair_s *y,
+                                                       const dh_keypair_s *b);
+
+tstatic void prekey_batch_job_run(void *data);
+
+tstatic void prekey_batch_free(prekey_batch_s *batch);
+
+tstatic otrng_bool prekey_batch_id_taken(uint32_t id, const uint32_t *ids,
+                                         size_t num,
+                                         const list_element_s *taken);
 
 #endif
 
@@ -28,8 +28,6 @@
 #include "shake.h"
 #include <sodium.h>
 
-#define PREKEY_PROOF_LAMBDA 44 // 352 / 8
-
 static const uint8_t usage_proof_c_lambda = 0x17;
 
 INTERNAL otrng_result otrng_ecdh_proof_generate(
@@ -104,33 +102,13 @@ INTERNAL otrng_result otrng_ecdh_proof_generate(
   return OTRNG_SUCCESS;
 }
 
-INTERNAL otrng_bool otrng_ecdh_proof_verify(ecdh_proof_s *px,
-                                            const ec_point *values_pub,
-                                            const size_t values_len,
-                                            const uint8_t *m,
-                                            const uint8_t usage) {
+tstatic void ecdh_proof_combine_pairs(ec_point dst,
+                                      const ec_point *values_pub,
+                                      const uint8_t *p,
+                                      const size_t values_len) {
   size_t i;
-  uint8_t *p;
-  goldilocks_448_point_p a;
-  goldilocks_448_point_p curr;
-  size_t p_len = PREKEY_PROOF_LAMBDA * values_len;
-  uint8_t *cbuf;
-  uint8_t *cbuf_curr;
-  size_t cbuf_len = ((values_len + 1) * ED448_POINT_BYTES) + HASH_BYTES;
-  uint8_t c2[PROOF_C_SIZE];
-
-  p = otrng_xmalloc_z(p_len * sizeof(uint8_t));
-
-  if (!shake_256_prekey_server_kdf(p, p_len, usage_proof_c_lambda, px->c,
-                                   PROOF_C_SIZE)) {
-    otrng_free(p);
-    return otrng_false;
-  }
-
-  goldilocks_448_precomputed_scalarmul(a, goldilocks_448_precomputed_base,
-                                       px->v);
 
-  goldilocks_448_point_copy(curr, goldilocks_448_point_identity);
+  goldilocks_448_point_copy(dst, goldilocks_448_point_identity);
 
   for (i = 0; i + 1 < values_len; i += 2) {
     goldilocks_448_scalar_p t1, t2;
@@ -143,7 +121,7 @@ INTERNAL otrng_bool otrng_ecdh_proof_verify(ecdh_proof_s *px,
 
     goldilocks_448_point_double_scalarmul(res, values_pub[i], t1,
                                           values_pub[i + 1], t2);
-    goldilocks_448_point_add(curr, curr, res);
+    goldilocks_448_point_add(dst, dst, res);
 
     goldilocks_448_scalar_destroy(t1);
     goldilocks_448_scalar_destroy(t2);
@@ -157,11 +135,68 @@ INTERNAL otrng_bool otrng_ecdh_proof_verify(ecdh_proof_s *px,
     goldilocks_448_scalar_decode_long(t, p + i * PREKEY_PROOF_LAMBDA,
                                       PREKEY_PROOF_LAMBDA);
     goldilocks_448_point_scalarmul(res, values_pub[i], t);
-    goldilocks_448_point_add(curr, curr, res);
+    goldilocks_448_point_add(dst, dst, res);
 
     goldilocks_448_scalar_destroy(t);
     goldilocks_448_point_destroy(res);
   }
+}
+
+/* Computes dst = sum(t_i * values_pub[i]), with every t_i decoded from
+   PREKEY_PROOF_LAMBDA bytes of [p]. Everything here is public, so large
+   batches go through the variable time multi-scalar multiplication. */
+tstatic void ecdh_proof_combine(ec_point dst, const ec_point *values_pub,
+                                const uint8_t *p, const size_t values_len) {
+  size_t i;
+  ec_scalar *t;
+
+  if (values_len < PREKEY_PROOF_MSM_THRESHOLD) {
+    ecdh_proof_combine_pairs(dst, values_pub, p, values_len);
+    return;
+  }
+
+  t = otrng_xmalloc_z(values_len * sizeof(ec_scalar));
+  for (i = 0; i < values_len; i++) {
+    goldilocks_448_scalar_decode_long(t[i], p + i * PREKEY_PROOF_LAMBDA,
+                                      PREKEY_PROOF_LAMBDA);
+  }
+
+  otrng_ec_point_multiscalarmul(dst, values_pub, (const ec_scalar *)t,
+                                values_len);
+
+  for (i = 0; i < values_len; i++) {
+    goldilocks_448_scalar_destroy(t[i]);
+  }
+  otrng_free(t);
+}
+
+INTERNAL otrng_bool otrng_ecdh_proof_verify(ecdh_proof_s *px,
+                                            const ec_point *values_pub,
+                                            const size_t values_len,
+                                            const uint8_t *m,
+                                            const uint8_t usage) {
+  size_t i;
+  uint8_t *p;
+  goldilocks_448_point_p a;
+  goldilocks_448_point_p curr;
+  size_t p_len = PREKEY_PROOF_LAMBDA * values_len;
+  uint8_t *cbuf;
+  uint8_t *cbuf_curr;
+  size_t cbuf_len = ((values_len + 1) * ED448_POINT_BYTES) + HASH_BYTES;
+  uint8_t c2[PROOF_C_SIZE];
+
+  p = otrng_xmalloc_z(p_len * sizeof(uint8_t));
+
+  if (!shake_256_prekey_server_kdf(p, p_len, usage_proof_c_lambda, px->c,
+                                   PROOF_C_SIZE)) {
+    otrng_free(p);
+    return otrng_false;
+  }
+
+  goldilocks_448_precomputed_scalarmul(a, goldilocks_448_precomputed_base,
+                                       px->v);
+
+  ecdh_proof_combine(curr, values_pub, p, values_len);
 
   otrng_free(p);
 
@@ -317,6 +352,15 @@ INTERNAL otrng_result otrng_dh_proof_generate(
   return OTRNG_SUCCESS;
 }
 
+tstatic void dh_proof_release_exponents(dh_mpi *t, size_t len) {
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    otrng_dh_mpi_release(t[i]);
+  }
+  otrng_free(t);
+}
+
 INTERNAL otrng_bool otrng_dh_proof_verify(dh_proof_s *px,
                                           const dh_mpi *values_pub,
                                           const size_t values_len,
@@ -324,6 +368,7 @@ INTERNAL otrng_bool otrng_dh_proof_verify(dh_proof_s *px,
                                           const uint8_t usage) {
   uint8_t *p;
   dh_mpi mod, a, curr;
+  dh_mpi *t;
   size_t i;
   uint8_t *cbuf;
   uint8_t *cbuf_curr;
@@ -345,26 +390,23 @@ INTERNAL otrng_bool otrng_dh_proof_verify(dh_proof_s *px,
 
   mod = otrng_dh_modulus_p();
 
-  curr = gcry_mpi_new(DH3072_MOD_LEN_BITS);
-  gcry_mpi_set_ui(curr, 1);
-
+  t = otrng_xmalloc_z(values_len * sizeof(dh_mpi));
   p_curr = p;
   for (i = 0; i < values_len; i++) {
-    gcry_mpi_t t = NULL;
-    if (!otrng_dh_mpi_deserialize(&t, p_curr, PREKEY_PROOF_LAMBDA, &w)) {
+    if (!otrng_dh_mpi_deserialize(&t[i], p_curr, PREKEY_PROOF_LAMBDA, &w)) {
+      dh_proof_release_exponents(t, values_len);
       otrng_free(p);
       gcry_mpi_release(a);
-      otrng_dh_mpi_release(curr);
       return otrng_false;
     }
     p_curr += w;
-
-    gcry_mpi_powm(t, values_pub[i], t, mod);
-    gcry_mpi_mulm(curr, curr, t, mod);
-    otrng_dh_mpi_release(t);
   }
 
   otrng_free(p);
+
+  curr = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+  otrng_dh_multi_powm(curr, values_pub, (const dh_mpi *)t, values_len, mod);
+  dh_proof_release_exponents(t, values_len);
   gcry_mpi_invm(curr, curr, mod);
   gcry_mpi_mulm(a, a, curr, mod);
   otrng_dh_mpi_release(curr);
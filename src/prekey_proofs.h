@@ -79,6 +79,24 @@ INTERNAL otrng_result otrng_dh_proof_deserialize(dh_proof_s *px,
                                                  size_t ser_len, size_t *read);
 
 #ifdef OTRNG_PREKEY_PROOFS_PRIVATE
+
+#define PREKEY_PROOF_LAMBDA 44 // 352 / 8
+
+/* Below this many values, pairwise double scalar multiplication is faster
+   than the bucket method. See the "/prekey_server/proofs/ecdh/verify/perf"
+   test. */
+#define PREKEY_PROOF_MSM_THRESHOLD 16
+
+tstatic void ecdh_proof_combine_pairs(ec_point dst,
+                                      const ec_point *values_pub,
+                                      const uint8_t *p,
+                                      const size_t values_len);
+
+tstatic void ecdh_proof_combine(ec_point dst, const ec_point *values_pub,
+                                const uint8_t *p, const size_t values_len);
+
+tstatic void dh_proof_release_exponents(dh_mpi *t, size_t len);
+
 #endif
 
 #endif // OTRNG_PREKEY_PROOFS_H
@@ -0,0 +1,148 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define OTRNG_PREKEY_RESERVOIR_PRIVATE
+
+#include "prekey_reservoir.h"
+#include "alloc.h"
+
+tstatic void prekey_refill_job_run(void *data) {
+  prekey_refill_job_s *job = data;
+
+  job->messages = otrng_prekey_messages_build_batch(
+      job->instance_tag, job->num, job->num_threads, NULL);
+}
+
+INTERNAL otrng_prekey_reservoir_s *
+otrng_prekey_reservoir_new(unsigned int low_watermark,
+                           unsigned int high_watermark) {
+  otrng_prekey_reservoir_s *r =
+      otrng_xmalloc_z(sizeof(otrng_prekey_reservoir_s));
+
+  r->low_watermark = low_watermark;
+  r->high_watermark = high_watermark;
+
+  return r;
+}
+
+tstatic void prekey_reservoir_collect(otrng_prekey_reservoir_s *r,
+                                      otrng_worker_s *worker, otrng_bool wait) {
+  prekey_refill_job_s *job = r->refill;
+  size_t i;
+
+  if (!job) {
+    return;
+  }
+
+  /* Without a worker, the job has already finished */
+  if (worker) {
+    if (!wait && !otrng_worker_job_ready(worker, &job->job)) {
+      return;
+    }
+    otrng_worker_job_wait(worker, &job->job);
+  }
+  r->refill = NULL;
+
+  if (job->messages) {
+    for (i = 0; i < job->num; i++) {
+      r->ready = otrng_list_add(job->messages[i], r->ready);
+    }
+    r->ready_len += job->num;
+    otrng_free(job->messages);
+  }
+
+  otrng_free(job);
+}
+
+static void prekey_message_free_from_list(void *data) {
+  otrng_prekey_message_free(data);
+}
+
+INTERNAL void otrng_prekey_reservoir_free(otrng_prekey_reservoir_s *r,
+                                          otrng_worker_s *worker) {
+  if (!r) {
+    return;
+  }
+
+  prekey_reservoir_collect(r, worker, otrng_true);
+  otrng_list_free(r->ready, prekey_message_free_from_list);
+  otrng_free(r);
+}
+
+INTERNAL void otrng_prekey_reservoir_refill(otrng_prekey_reservoir_s *r,
+                                            otrng_worker_s *worker,
+                                            uint32_t instance_tag,
+                                            unsigned int num_threads) {
+  prekey_refill_job_s *job;
+
+  prekey_reservoir_collect(r, worker, otrng_false);
+
+  if (r->refill || !worker || r->ready_len >= r->low_watermark ||
+      r->ready_len >= r->high_watermark) {
+    return;
+  }
+
+  job = otrng_xmalloc_z(sizeof(prekey_refill_job_s));
+  job->job.run = prekey_refill_job_run;
+  job->job.data = job;
+  job->instance_tag = instance_tag;
+  job->num_threads = num_threads;
+  job->num = r->high_watermark - r->ready_len;
+
+  r->refill = job;
+  otrng_worker_submit(worker, &job->job);
+}
+
+INTERNAL size_t otrng_prekey_reservoir_take(prekey_message_s **dst, size_t num,
+                                            uint32_t instance_tag,
+                                            const list_element_s *taken,
+                                            otrng_prekey_reservoir_s *r,
+                                            otrng_worker_s *worker) {
+  size_t moved = 0;
+
+  prekey_reservoir_collect(r, worker, otrng_false);
+
+  while (moved < num && r->ready) {
+    list_element_s *node = r->ready;
+    prekey_message_s *msg = node->data;
+    const list_element_s *el;
+    otrng_bool usable = msg->sender_instance_tag == instance_tag;
+
+    for (el = taken; usable && el; el = el->next) {
+      const prekey_message_s *other = el->data;
+      if (other->id == msg->id) {
+        usable = otrng_false;
+      }
+    }
+
+    r->ready = otrng_list_remove_element(node, r->ready);
+    otrng_list_free_nodes(node);
+    r->ready_len--;
+
+    if (!usable) {
+      otrng_prekey_message_free(msg);
+      continue;
+    }
+
+    dst[moved++] = msg;
+  }
+
+  return moved;
+}
@@ -0,0 +1,108 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A reservoir of prekey messages that are generated ahead of time on a
+ * background worker, so publishing prekeys does not have to wait for the
+ * key generation.
+ *
+ * The reservoir itself is only touched from the messaging thread. The worker
+ * thread only fills the batch of its own refill job, which is collected by
+ * otrng_prekey_reservoir_refill.
+ */
+
+#ifndef OTRNG_PREKEY_RESERVOIR_H
+#define OTRNG_PREKEY_RESERVOIR_H
+
+#include "list.h"
+#include "prekey_message.h"
+#include "shared.h"
+#include "worker.h"
+
+typedef struct prekey_refill_job_s {
+  otrng_worker_job_s job;
+  uint32_t instance_tag;
+  unsigned int num_threads;
+  size_t num;
+  /*@null@*/ prekey_message_s **messages;
+} prekey_refill_job_s;
+
+typedef struct otrng_prekey_reservoir_s {
+  list_element_s *ready; /* prekey_message_s, not stored by the client yet */
+  size_t ready_len;
+
+  /* A refill starts when there are fewer than [low_watermark] ready
+     messages, and it tops the reservoir up to [high_watermark] */
+  unsigned int low_watermark;
+  unsigned int high_watermark;
+
+  /*@null@*/ prekey_refill_job_s *refill;
+} otrng_prekey_reservoir_s;
+
+INTERNAL otrng_prekey_reservoir_s *
+otrng_prekey_reservoir_new(unsigned int low_watermark,
+                           unsigned int high_watermark);
+
+/**
+ * @brief Waits for a running refill, and frees the reservoir together with
+ *    every message in it. Safe to call with NULL.
+ *
+ * @param [worker] The worker refills were started on, or NULL if it has
+ *    already been freed (which waits for all of its jobs).
+ */
+INTERNAL void
+otrng_prekey_reservoir_free(/*@only@*/ /*@null@*/ otrng_prekey_reservoir_s *r,
+                            /*@null@*/ otrng_worker_s *worker);
+
+/**
+ * @brief Collects a finished refill, and starts a new one on [worker] if the
+ *    reservoir is below its low watermark.
+ *
+ * @param [instance_tag] The instance tag for the new messages.
+ * @param [num_threads]  The threads used to generate each refill batch.
+ */
+INTERNAL void otrng_prekey_reservoir_refill(otrng_prekey_reservoir_s *r,
+                                            otrng_worker_s *worker,
+                                            uint32_t instance_tag,
+                                            unsigned int num_threads);
+
+/**
+ * @brief Collects a finished refill, and moves up to [num] ready messages
+ *    into [dst]. Messages built for another instance tag, or whose id is
+ *    already in [taken], are discarded.
+ *
+ * @return the number of messages moved.
+ */
+INTERNAL size_t otrng_prekey_reservoir_take(prekey_message_s **dst, size_t num,
+                                            uint32_t instance_tag,
+                                            const list_element_s *taken,
+                                            otrng_prekey_reservoir_s *r,
+                                            otrng_worker_s *worker);
+
+#ifdef OTRNG_PREKEY_RESERVOIR_PRIVATE
+
+tstatic void prekey_refill_job_run(void *data);
+
+tstatic void prekey_reservoir_collect(otrng_prekey_reservoir_s *r,
+                                      otrng_worker_s *worker, otrng_bool wait);
+
+#endif
+
+#endif
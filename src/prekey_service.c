@@ -0,0 +1,1285 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libotr/b64.h>
+#include <sodium.h>
+
+#include "alloc.h"
+#include "auth.h"
+#include "base64.h"
+#include "client_profile.h"
+#include "deserialize.h"
+#include "dh.h"
+#include "prekey_client_dake.h"
+#include "prekey_client_messages.h"
+#include "prekey_client_shared.h"
+#include "prekey_message.h"
+#include "prekey_profile.h"
+#include "prekey_proofs.h"
+#include "prekey_service.h"
+#include "random.h"
+#include "serialize.h"
+#include "shake.h"
+
+/* The most ensembles a retrieval message can carry */
+#define MAX_ENSEMBLES 255
+
+#define T_LEN 1 + 3 * HASH_BYTES + 2 * ED448_POINT_BYTES
+
+/*
+  All the KDF calls in this file work on buffers we own, so the only way they
+  can fail is a programming error. Like in the prekey manager, we don't try to
+  recover from that.
+ */
+static void kdf_x(uint8_t *dst, size_t dst_len, uint8_t usage,
+                  const uint8_t *values, size_t values_len) {
+  if (otrng_failed(shake_256_prekey_server_kdf(dst, dst_len, usage, values,
+                                               values_len))) {
+    fprintf(stderr, "fatal: hash failure, this shouldn't happen - usage %d.\n",
+            usage);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void kdf_init_x(goldilocks_shake256_ctx_p hash, uint8_t usage) {
+  if (!hash_init_with_usage_and_domain_separation(hash, usage,
+                                                  PREKEY_HASH_DOMAIN)) {
+    fprintf(stderr, "fatal: hash failure, this shouldn't happen - usage %d.\n",
+            usage);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void update_x(goldilocks_shake256_ctx_p hash, const uint8_t *buf,
+                     size_t len) {
+  if (hash_update(hash, buf, len) == GOLDILOCKS_FAILURE) {
+    fprintf(stderr, "fatal: hash failure, this shouldn't happen\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static char *service_encode(const uint8_t *buffer, size_t buff_len) {
+  char *ret = otrng_xmalloc_z(OTRNG_BASE64_ENCODE_LEN(buff_len) + 2);
+  size_t l;
+
+  l = otrl_base64_encode(ret, buffer, buff_len);
+  ret[l] = '.';
+  ret[l + 1] = '\0';
+
+  return ret;
+}
+
+static otrng_result service_decode(const char *msg, uint8_t **buffer,
+                                   size_t *buff_len) {
+  size_t len = strlen(msg);
+
+  if (!len || '.' != msg[len - 1]) {
+    return OTRNG_ERROR;
+  }
+
+  *buffer = otrng_xmalloc_z(((len - 1 + 3) / 4) * 3);
+  *buff_len = otrl_base64_decode(*buffer, msg, len - 1);
+
+  return OTRNG_SUCCESS;
+}
+
+static otrng_prekey_service_record_s *record_new(const uint8_t *data,
+                                                 size_t len) {
+  otrng_prekey_service_record_s *record =
+      otrng_xmalloc_z(sizeof(otrng_prekey_service_record_s));
+
+  record->data = otrng_xmalloc(len);
+  memcpy(record->data, data, len);
+  record->len = len;
+
+  return record;
+}
+
+static void record_free(otrng_prekey_service_record_s *record) {
+  if (!record) {
+    return;
+  }
+
+  otrng_free(record->data);
+  otrng_free(record);
+}
+
+static void free_record(void *p) { record_free(p); }
+
+static void session_free(otrng_prekey_service_session_s *session) {
+  if (!session) {
+    return;
+  }
+
+  otrng_free(session->identity);
+  otrng_free(session->client_profile);
+  otrng_ec_point_destroy(session->I);
+  otrng_ec_point_destroy(session->client_pub);
+
+  if (session->S) {
+    otrng_ecdh_keypair_destroy(session->S);
+    otrng_secure_free(session->S);
+  }
+
+  otrng_secure_free(session->secret);
+  otrng_free(session);
+}
+
+static void free_session(void *p) { session_free(p); }
+
+static void entry_free(otrng_prekey_service_entry_s *entry) {
+  if (!entry) {
+    return;
+  }
+
+  otrng_free(entry->identity);
+  record_free(entry->client_profile);
+  record_free(entry->prekey_profile);
+  otrng_list_free(entry->prekey_messages, free_record);
+  otrng_free(entry);
+}
+
+static void free_entry(void *p) { entry_free(p); }
+
+API otrng_prekey_service_s *
+otrng_prekey_service_new(const char *identity,
+                         const uint8_t sym[ED448_PRIVATE_BYTES]) {
+  otrng_prekey_service_s *service;
+  size_t w = 0;
+
+  assert(identity);
+  assert(sym);
+
+  service = otrng_xmalloc_z(sizeof(otrng_prekey_service_s));
+  service->identity = otrng_xstrdup(identity);
+  service->keypair = otrng_keypair_new();
+
+  if (!otrng_keypair_generate(service->keypair, sym)) {
+    otrng_prekey_service_free(service);
+    return NULL;
+  }
+
+  service->composite_identity_len =
+      4 + strlen(identity) + ED448_PUBKEY_BYTES;
+  service->composite_identity =
+      otrng_xmalloc_z(service->composite_identity_len);
+  w += otrng_serialize_data(service->composite_identity,
+                            (const uint8_t *)identity, strlen(identity));
+  w += otrng_serialize_public_key(service->composite_identity + w,
+                                  service->keypair->pub);
+  service->composite_identity_len = w;
+
+  return service;
+}
+
+API void otrng_prekey_service_free(otrng_prekey_service_s *service) {
+  if (!service) {
+    return;
+  }
+
+  otrng_free(service->identity);
+  otrng_keypair_free(service->keypair);
+  otrng_free(service->composite_identity);
+  otrng_list_free(service->sessions, free_session);
+  otrng_list_free(service->resumable, free_session);
+  otrng_list_free(service->entries, free_entry);
+  otrng_free(service);
+}
+
+tstatic otrng_prekey_service_entry_s *
+prekey_service_get_entry(const otrng_prekey_service_s *service,
+                         const char *identity, uint32_t instance_tag) {
+  list_element_s *current = service->entries;
+
+  for (; current; current = current->next) {
+    otrng_prekey_service_entry_s *entry = current->data;
+    if (entry->instance_tag == instance_tag &&
+        strcmp(entry->identity, identity) == 0) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+static otrng_prekey_service_entry_s *
+get_or_create_entry(otrng_prekey_service_s *service, const char *identity,
+                    uint32_t instance_tag) {
+  otrng_prekey_service_entry_s *entry =
+      prekey_service_get_entry(service, identity, instance_tag);
+
+  if (entry) {
+    return entry;
+  }
+
+  entry = otrng_xmalloc_z(sizeof(otrng_prekey_service_entry_s));
+  entry->identity = otrng_xstrdup(identity);
+  entry->instance_tag = instance_tag;
+  service->entries = otrng_list_add(entry, service->entries);
+
+  return entry;
+}
+
+/*
+  t = first || KDF(usage_client_profile, Client Profile, 64)
+        || KDF(usage_composite_identity, Prekey Server Composite Identity, 64)
+        || I || S || KDF(usage_composite_phi, phi, 64)
+
+  The same construction is used for the DAKE2 and the DAKE3 - only the first
+  byte and the usages differ.
+*/
+static void session_t(uint8_t *t, const otrng_prekey_service_s *service,
+                      const otrng_prekey_service_session_s *session,
+                      uint8_t first, uint8_t usage_client_profile,
+                      uint8_t usage_composite_identity,
+                      uint8_t usage_composite_phi) {
+  size_t phi_len =
+      4 + strlen(session->identity) + 4 + strlen(service->identity);
+  uint8_t *phi = otrng_xmalloc(phi_len);
+  size_t w = 0;
+
+  w += otrng_serialize_data(phi, (const uint8_t *)session->identity,
+                            strlen(session->identity));
+  (void)otrng_serialize_data(phi + w, (const uint8_t *)service->identity,
+                             strlen(service->identity));
+
+  w = 0;
+  t[w++] = first;
+  kdf_x(t + w, HASH_BYTES, usage_client_profile, session->client_profile,
+        session->client_profile_len);
+  w += HASH_BYTES;
+  kdf_x(t + w, HASH_BYTES, usage_composite_identity,
+        service->composite_identity, service->composite_identity_len);
+  w += HASH_BYTES;
+  w += otrng_serialize_ec_point(t + w, session->I);
+  w += otrng_serialize_ec_point(t + w, session->S->pub);
+  kdf_x(t + w, HASH_BYTES, usage_composite_phi, phi, phi_len);
+  w += HASH_BYTES;
+
+  assert(w == T_LEN);
+  otrng_free(phi);
+}
+
+static otrng_prekey_service_session_s *
+session_new(const char *from, const otrng_prekey_dake1_message_s *msg) {
+  otrng_prekey_service_session_s *session;
+  uint8_t *sym;
+
+  session = otrng_xmalloc_z(sizeof(otrng_prekey_service_session_s));
+  session->identity = otrng_xstrdup(from);
+  session->instance_tag = msg->client_instance_tag;
+  session->started_at = time(NULL);
+  otrng_ec_point_copy(session->client_pub,
+                      msg->client_profile->long_term_pub_key);
+  otrng_ec_point_copy(session->I, msg->I);
+
+  if (!otrng_client_profile_serialize(&session->client_profile,
+                                      &session->client_profile_len,
+                                      msg->client_profile)) {
+    session_free(session);
+    return NULL;
+  }
+
+  sym = otrng_secure_alloc(ED448_PRIVATE_BYTES);
+  random_bytes(sym, ED448_PRIVATE_BYTES);
+  session->S = otrng_secure_alloc(sizeof(ecdh_keypair_s));
+  if (!otrng_ecdh_keypair_generate(session->S, sym)) {
+    otrng_secure_free(sym);
+    session_free(session);
+    return NULL;
+  }
+  otrng_secure_free(sym);
+
+  return session;
+}
+
+static char *send_dake2(const otrng_prekey_service_s *service,
+                        const otrng_prekey_service_session_s *session) {
+  otrng_prekey_dake2_message_s dake2;
+  uint8_t t[T_LEN];
+  uint8_t *ser = NULL;
+  size_t ser_len = 0;
+  char *ret = NULL;
+
+  /*
+    t = 0x00 || KDF(usage_Initiator_Client_Profile, Alices_Client_Profile, 64)
+      || KDF(usage_initiator_prekey_composite_identity,
+             Prekey_Server_Composite_Identity, 64) || I || S ||
+         KDF(usage_initiator_prekey_composite_PHI, phi, 64)
+  */
+  session_t(t, service, session, 0x00, USAGE_INITIATOR_CLIENT_PROFILE,
+            USAGE_INITIATOR_PREKEY_COMPOSITE_IDENTITY,
+            USAGE_INITIATOR_PREKEY_COMPOSITE_PHI);
+
+  otrng_prekey_dake2_message_init(&dake2);
+  dake2.client_instance_tag = session->instance_tag;
+  dake2.server_identity_len = strlen(service->identity);
+  dake2.server_identity = otrng_xmalloc(dake2.server_identity_len);
+  memcpy(dake2.server_identity, service->identity, dake2.server_identity_len);
+  otrng_ec_point_copy(dake2.server_pub_key, service->keypair->pub);
+  otrng_ec_point_copy(dake2.S, session->S->pub);
+
+  if (otrng_rsig_authenticate_with_usage_and_domain(
+          USAGE_AUTH, PREKEY_HASH_DOMAIN, dake2.sigma, service->keypair->priv,
+          service->keypair->pub, session->client_pub, service->keypair->pub,
+          session->I, t, T_LEN) &&
+      otrng_prekey_dake2_message_serialize(&ser, &ser_len, &dake2)) {
+    ret = service_encode(ser, ser_len);
+    otrng_free(ser);
+  }
+
+  otrng_prekey_dake2_message_destroy(&dake2);
+  return ret;
+}
+
+tstatic char *
+prekey_service_receive_dake1(otrng_prekey_service_s *service, const char *from,
+                             const uint8_t *decoded, size_t decoded_len) {
+  otrng_prekey_dake1_message_s msg;
+  otrng_prekey_service_session_s *session = NULL;
+  char *ret;
+
+  memset(&msg, 0, sizeof(otrng_prekey_dake1_message_s));
+
+  if (otrng_prekey_dake1_message_deserialize(&msg, decoded, decoded_len) &&
+      otrng_client_profile_valid(msg.client_profile,
+                                 msg.client_instance_tag)) {
+    session = session_new(from, &msg);
+  }
+  otrng_prekey_dake1_message_destroy(&msg);
+
+  if (!session) {
+    service->stats.failures++;
+    return NULL;
+  }
+
+  ret = send_dake2(service, session);
+  if (!ret) {
+    session_free(session);
+    service->stats.failures++;
+    return NULL;
+  }
+
+  /* A client can have several DAKEs going at the same time, so we never
+   * replace an earlier session here. The DAKE3 tells them apart. */
+  service->sessions = otrng_list_add(session, service->sessions);
+  service->stats.dakes_started++;
+
+  return ret;
+}
+
+static otrng_bool session_verify_dake3(
+    const otrng_prekey_service_s *service,
+    const otrng_prekey_service_session_s *session,
+    const otrng_prekey_dake3_message_s *msg) {
+  uint8_t t[T_LEN];
+
+  /*
+    t = 0x01 || KDF(usage_receiver_client_profile, Alices_Client_Profile, 64) ||
+        KDF(usage_receiver_prekey_composite_identity,
+            Prekey_Server_Composite_Identity, 64) || I || S ||
+        KDF(usage_receiver_prekey_composite_PHI, phi, 64)
+  */
+  session_t(t, service, session, 0x01, USAGE_RECEIVER_CLIENT_PROFILE,
+            USAGE_RECEIVER_PREKEY_COMPOSITE_IDENTITY,
+            USAGE_RECEIVER_PREKEY_COMPOSITE_PHI);
+
+  return otrng_rsig_verify_with_usage_and_domain(
+      USAGE_AUTH, PREKEY_HASH_DOMAIN, msg->sigma, session->client_pub,
+      service->keypair->pub, session->S->pub, t, T_LEN);
+}
+
+/*
+  Derives the keys of the DAKE. If the service keeps sessions, the secret and
+  the id the session can be resumed with are derived as well.
+*/
+static otrng_result
+session_mac_keys(uint8_t mac_key[MAC_KEY_BYTES],
+                 uint8_t mac_proof_key[HASH_BYTES],
+                 const otrng_prekey_service_s *service,
+                 otrng_prekey_service_session_s *session) {
+  uint8_t *ecdh_shared = otrng_secure_alloc(ED448_POINT_BYTES);
+  uint8_t *shared_secret;
+
+  /* ECDH(s, I) */
+  if (otrng_failed(otrng_ecdh_shared_secret(ecdh_shared, ED448_POINT_BYTES,
+                                            session->S->priv, session->I))) {
+    otrng_secure_free(ecdh_shared);
+    return OTRNG_ERROR;
+  }
+
+  /* SK = KDF(0x01, ECDH(s, I), 64) */
+  shared_secret = otrng_secure_alloc(HASH_BYTES);
+  kdf_x(shared_secret, HASH_BYTES, USAGE_SK, ecdh_shared, ED448_POINT_BYTES);
+  otrng_secure_free(ecdh_shared);
+
+  kdf_x(mac_key, MAC_KEY_BYTES, USAGE_PREMAC_KEY, shared_secret, HASH_BYTES);
+  kdf_x(mac_proof_key, HASH_BYTES, USAGE_PROOF_CONTEXT, shared_secret,
+        HASH_BYTES);
+
+  if (service->session_lifetime > 0) {
+    session->secret = otrng_secure_alloc(HASH_BYTES);
+    if (otrng_failed(otrng_prekey_session_derive(session->secret, session->id,
+                                                 shared_secret))) {
+      otrng_secure_free(session->secret);
+      session->secret = NULL;
+    }
+  }
+
+  otrng_secure_free(shared_secret);
+
+  return OTRNG_SUCCESS;
+}
+
+/* Success and failure messages only differ in their type and usage */
+static char *send_result(uint8_t msg_type, uint8_t usage,
+                         uint32_t instance_tag,
+                         const uint8_t mac_key[MAC_KEY_BYTES]) {
+  uint8_t buf[OTRNG_PREKEY_SUCCESS_MSG_LEN];
+  goldilocks_shake256_ctx_p hash;
+  size_t w = 0;
+
+  w += otrng_serialize_uint16(buf, OTRNG_PROTOCOL_VERSION_4);
+  w += otrng_serialize_uint8(buf + w, msg_type);
+  w += otrng_serialize_uint32(buf + w, instance_tag);
+
+  /* KDF(usage, prekey_mac_k || message type || receiver instance tag, 64) */
+  kdf_init_x(hash, usage);
+  update_x(hash, mac_key, MAC_KEY_BYTES);
+  update_x(hash, buf + 2, 5);
+  hash_final(hash, buf + w, HASH_BYTES);
+  hash_destroy(hash);
+
+  return service_encode(buf, sizeof(buf));
+}
+
+static size_t stored_for_instance(const otrng_prekey_service_s *service,
+                                  const char *identity, uint32_t instance_tag) {
+  const otrng_prekey_service_entry_s *entry =
+      prekey_service_get_entry(service, identity, instance_tag);
+
+  return entry ? entry->num_prekey_messages : 0;
+}
+
+static char *answer_storage_information(otrng_prekey_service_s *service,
+                                        const char *from,
+                                        uint32_t instance_tag,
+                                        const uint8_t *msg, size_t msg_len,
+                                        const uint8_t mac_key[MAC_KEY_BYTES]) {
+  uint8_t expected[HASH_BYTES];
+  uint8_t buf[2 + 1 + 4 + 4 + HASH_BYTES];
+  uint32_t stored;
+  goldilocks_shake256_ctx_p hash;
+  size_t w = 0;
+
+  if (msg_len < 3 + HASH_BYTES) {
+    return NULL;
+  }
+
+  /* MAC: KDF(usage_storage_info_MAC, prekey_mac_k || msg type, 64) */
+  kdf_init_x(hash, USAGE_STORAGE_INFO_MAC);
+  update_x(hash, mac_key, MAC_KEY_BYTES);
+  update_x(hash, msg + 2, 1);
+  hash_final(hash, expected, HASH_BYTES);
+  hash_destroy(hash);
+
+  if (sodium_memcmp(expected, msg + 3, HASH_BYTES) != 0) {
+    return NULL;
+  }
+
+  stored = (uint32_t)stored_for_instance(service, from, instance_tag);
+
+  w += otrng_serialize_uint16(buf, OTRNG_PROTOCOL_VERSION_4);
+  w += otrng_serialize_uint8(buf + w, OTRNG_PREKEY_STORAGE_STATUS_MSG);
+  w += otrng_serialize_uint32(buf + w, instance_tag);
+  w += otrng_serialize_uint32(buf + w, stored);
+
+  /* KDF(usage_status_MAC, prekey_mac_k || message type || receiver instance
+     tag || Stored Prekey Messages Number, 64) */
+  kdf_init_x(hash, USAGE_STATUS_MAC);
+  update_x(hash, mac_key, MAC_KEY_BYTES);
+  update_x(hash, buf + 2, 1 + 4 + 4);
+  hash_final(hash, buf + w, HASH_BYTES);
+  hash_destroy(hash);
+
+  service->stats.storage_requests++;
+
+  return service_encode(buf, sizeof(buf));
+}
+
+/* A publication message, with pointers into the buffer it was read from */
+typedef struct {
+  uint8_t num_prekey_messages;
+  prekey_message_s **prekey_messages;
+  const uint8_t *prekey_messages_start;
+  size_t *prekey_messages_len;
+
+  otrng_client_profile_s *client_profile;
+  const uint8_t *client_profile_start;
+  size_t client_profile_len;
+
+  otrng_prekey_profile_s *prekey_profile;
+  const uint8_t *prekey_profile_start;
+  size_t prekey_profile_len;
+
+  ecdh_proof_s prekey_messages_ecdh_proof;
+  dh_proof_s prekey_messages_dh_proof;
+  ecdh_proof_s prekey_profile_proof;
+  const uint8_t *proofs_start;
+  size_t proofs_len;
+
+  const uint8_t *mac;
+} publication_s;
+
+static void publication_destroy(publication_s *pub) {
+  int i;
+
+  if (pub->prekey_messages) {
+    for (i = 0; i < pub->num_prekey_messages; i++) {
+      otrng_prekey_message_free(pub->prekey_messages[i]);
+    }
+    otrng_free(pub->prekey_messages);
+  }
+  otrng_free(pub->prekey_messages_len);
+
+  otrng_client_profile_free(pub->client_profile);
+  otrng_prekey_profile_free(pub->prekey_profile);
+  otrng_dh_mpi_release(pub->prekey_messages_dh_proof.v);
+}
+
+static otrng_result publication_parse(publication_s *pub, const uint8_t *msg,
+                                      size_t msg_len) {
+  size_t w = 3, read = 0;
+  uint8_t flag = 0;
+  int i;
+
+  if (!otrng_deserialize_uint8(&pub->num_prekey_messages, msg + w,
+                               msg_len - w, &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  pub->prekey_messages =
+      otrng_xmalloc_z(pub->num_prekey_messages * sizeof(prekey_message_s *));
+  pub->prekey_messages_len =
+      otrng_xmalloc_z(pub->num_prekey_messages * sizeof(size_t));
+  pub->prekey_messages_start = msg + w;
+
+  for (i = 0; i < pub->num_prekey_messages; i++) {
+    pub->prekey_messages[i] = otrng_prekey_message_new();
+    if (!otrng_prekey_message_deserialize(pub->prekey_messages[i], msg + w,
+                                          msg_len - w, &read)) {
+      return OTRNG_ERROR;
+    }
+    pub->prekey_messages_len[i] = read;
+    w += read;
+  }
+
+  if (!otrng_deserialize_uint8(&flag, msg + w, msg_len - w, &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (flag) {
+    pub->client_profile = otrng_xmalloc_z(sizeof(otrng_client_profile_s));
+    pub->client_profile_start = msg + w;
+    if (!otrng_client_profile_deserialize(pub->client_profile, msg + w,
+                                          msg_len - w, &read)) {
+      return OTRNG_ERROR;
+    }
+    pub->client_profile_len = read;
+    w += read;
+  }
+
+  if (!otrng_deserialize_uint8(&flag, msg + w, msg_len - w, &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (flag) {
+    pub->prekey_profile = otrng_xmalloc_z(sizeof(otrng_prekey_profile_s));
+    pub->prekey_profile_start = msg + w;
+    if (!otrng_prekey_profile_deserialize(pub->prekey_profile, msg + w,
+                                          msg_len - w, &read)) {
+      return OTRNG_ERROR;
+    }
+    pub->prekey_profile_len = read;
+    w += read;
+  }
+
+  pub->proofs_start = msg + w;
+
+  if (pub->num_prekey_messages > 0) {
+    if (!otrng_ecdh_proof_deserialize(&pub->prekey_messages_ecdh_proof,
+                                      msg + w, msg_len - w, &read)) {
+      return OTRNG_ERROR;
+    }
+    w += read;
+
+    if (!otrng_dh_proof_deserialize(&pub->prekey_messages_dh_proof, msg + w,
+                                    msg_len - w, &read)) {
+      return OTRNG_ERROR;
+    }
+    w += read;
+  }
+
+  if (pub->prekey_profile) {
+    if (!otrng_ecdh_proof_deserialize(&pub->prekey_profile_proof, msg + w,
+                                      msg_len - w, &read)) {
+      return OTRNG_ERROR;
+    }
+    w += read;
+  }
+
+  pub->proofs_len = msg + w - pub->proofs_start;
+
+  if (msg_len - w < HASH_BYTES) {
+    return OTRNG_ERROR;
+  }
+  pub->mac = msg + w;
+
+  return OTRNG_SUCCESS;
+}
+
+static void update_with_optional_kdf(goldilocks_shake256_ctx_p hash,
+                                     uint8_t usage, const uint8_t *start,
+                                     size_t len) {
+  uint8_t kdf[HASH_BYTES];
+  uint8_t flag = start ? 1 : 0;
+
+  update_x(hash, &flag, 1);
+  if (start) {
+    kdf_x(kdf, HASH_BYTES, usage, start, len);
+    update_x(hash, kdf, HASH_BYTES);
+  }
+}
+
+static otrng_bool publication_mac_valid(const publication_s *pub,
+                                        const uint8_t mac_key[MAC_KEY_BYTES]) {
+  uint8_t kdf[HASH_BYTES], expected[HASH_BYTES];
+  uint8_t msg_type = OTRNG_PREKEY_PUBLICATION_MSG;
+  size_t prekey_messages_len = 0;
+  goldilocks_shake256_ctx_p hash;
+  int i;
+
+  for (i = 0; i < pub->num_prekey_messages; i++) {
+    prekey_messages_len += pub->prekey_messages_len[i];
+  }
+
+  /* MAC: KDF(usage_preMAC, prekey_mac_k || message type
+            || N || KDF(usage_prekey_message, Prekey Messages, 64)
+            || K || KDF(usage_client_profile, Client Profile, 64)
+            || J || KDF(usage_prekey_profile, Prekey Profile, 64)
+            || KDF(usage_mac_proofs, Proofs, 64),
+        64) */
+  kdf_init_x(hash, USAGE_PRE_MAC);
+  update_x(hash, mac_key, MAC_KEY_BYTES);
+  update_x(hash, &msg_type, 1);
+  update_x(hash, &pub->num_prekey_messages, 1);
+  kdf_x(kdf, HASH_BYTES, USAGE_PREKEY_MESSAGE, pub->prekey_messages_start,
+        prekey_messages_len);
+  update_x(hash, kdf, HASH_BYTES);
+  update_with_optional_kdf(hash, USAGE_CLIENT_PROFILE,
+                           pub->client_profile_start, pub->client_profile_len);
+  update_with_optional_kdf(hash, USAGE_PREKEY_PROFILE,
+                           pub->prekey_profile_start, pub->prekey_profile_len);
+  kdf_x(kdf, HASH_BYTES, USAGE_MAC_PROOFS, pub->proofs_start, pub->proofs_len);
+  update_x(hash, kdf, HASH_BYTES);
+  hash_final(hash, expected, HASH_BYTES);
+  hash_destroy(hash);
+
+  return sodium_memcmp(expected, pub->mac, HASH_BYTES) == 0 ? otrng_true
+                                                             : otrng_false;
+}
+
+static otrng_bool
+publication_valid(publication_s *pub,
+                  const otrng_prekey_service_session_s *session,
+                  const uint8_t mac_proof_key[HASH_BYTES]) {
+  ec_point *values_ecdh;
+  dh_mpi *values_dh;
+  otrng_bool ret = otrng_true;
+  int i;
+
+  if (pub->client_profile &&
+      !otrng_client_profile_valid(pub->client_profile, session->instance_tag)) {
+    return otrng_false;
+  }
+
+  if (pub->prekey_profile &&
+      (!otrng_prekey_profile_valid(pub->prekey_profile, session->instance_tag,
+                                   session->client_pub) ||
+       !otrng_ecdh_proof_verify(
+           &pub->prekey_profile_proof,
+           (const ec_point *)&pub->prekey_profile->shared_prekey, 1,
+           mac_proof_key, USAGE_PROOF_SHARED_ECDH))) {
+    return otrng_false;
+  }
+
+  if (pub->num_prekey_messages == 0) {
+    return otrng_true;
+  }
+
+  values_ecdh = otrng_xmalloc_z(pub->num_prekey_messages * sizeof(ec_point));
+  values_dh = otrng_xmalloc_z(pub->num_prekey_messages * sizeof(dh_mpi));
+
+  for (i = 0; i < pub->num_prekey_messages; i++) {
+    const prekey_message_s *pm = pub->prekey_messages[i];
+    if (pm->sender_instance_tag != session->instance_tag ||
+        !otrng_ec_point_valid(pm->Y) || !otrng_dh_mpi_valid(pm->B)) {
+      ret = otrng_false;
+    }
+    otrng_ec_point_copy(values_ecdh[i], pm->Y);
+    values_dh[i] = pm->B;
+  }
+
+  if (ret) {
+    ret = otrng_ecdh_proof_verify(&pub->prekey_messages_ecdh_proof,
+                                  (const ec_point *)values_ecdh,
+                                  pub->num_prekey_messages, mac_proof_key,
+                                  USAGE_PROOF_MESSAGE_ECDH) &&
+                  otrng_dh_proof_verify(&pub->prekey_messages_dh_proof,
+                                        values_dh, pub->num_prekey_messages,
+                                        mac_proof_key, USAGE_PROOF_MESSAGE_DH)
+              ? otrng_true
+              : otrng_false;
+  }
+
+  otrng_free(values_ecdh);
+  otrng_free(values_dh);
+
+  return ret;
+}
+
+static void publication_store(otrng_prekey_service_s *service,
+                              const publication_s *pub,
+                              const otrng_prekey_service_session_s *session) {
+  otrng_prekey_service_entry_s *entry = get_or_create_entry(
+      service, session->identity, session->instance_tag);
+  const uint8_t *cursor = pub->prekey_messages_start;
+  int i;
+
+  if (pub->client_profile_start) {
+    if (entry->client_profile) {
+      service->stats.stored_bytes -= entry->client_profile->len;
+    }
+    record_free(entry->client_profile);
+    entry->client_profile =
+        record_new(pub->client_profile_start, pub->client_profile_len);
+    service->stats.stored_bytes += pub->client_profile_len;
+  }
+
+  if (pub->prekey_profile_start) {
+    if (entry->prekey_profile) {
+      service->stats.stored_bytes -= entry->prekey_profile->len;
+    }
+    record_free(entry->prekey_profile);
+    entry->prekey_profile =
+        record_new(pub->prekey_profile_start, pub->prekey_profile_len);
+    service->stats.stored_bytes += pub->prekey_profile_len;
+  }
+
+  for (i = 0; i < pub->num_prekey_messages; i++) {
+    entry->prekey_messages = otrng_list_add(
+        record_new(cursor, pub->prekey_messages_len[i]),
+        entry->prekey_messages);
+    entry->num_prekey_messages++;
+    service->stats.stored_prekey_messages++;
+    service->stats.stored_bytes += pub->prekey_messages_len[i];
+    cursor += pub->prekey_messages_len[i];
+  }
+}
+
+static char *answer_publication(otrng_prekey_service_s *service,
+                                const otrng_prekey_service_session_s *session,
+                                const uint8_t *msg, size_t msg_len,
+                                const uint8_t mac_key[MAC_KEY_BYTES],
+                                const uint8_t mac_proof_key[HASH_BYTES]) {
+  publication_s pub;
+  otrng_bool ok;
+
+  memset(&pub, 0, sizeof(publication_s));
+
+  if (!publication_parse(&pub, msg, msg_len) ||
+      !publication_mac_valid(&pub, mac_key)) {
+    publication_destroy(&pub);
+    service->stats.failures++;
+    return NULL;
+  }
+
+  ok = publication_valid(&pub, session, mac_proof_key);
+  if (ok) {
+    publication_store(service, &pub, session);
+    service->stats.publications++;
+  } else {
+    service->stats.failures++;
+  }
+  publication_destroy(&pub);
+
+  if (!ok) {
+    return send_result(OTRNG_PREKEY_FAILURE_MSG, USAGE_FAILURE_MAC,
+                       session->instance_tag, mac_key);
+  }
+
+  return send_result(OTRNG_PREKEY_SUCCESS_MSG, USAGE_SUCCESS_MAC,
+                     session->instance_tag, mac_key);
+}
+
+/* Answers the message carried by a DAKE3 or by a resumed session */
+static char *answer_inner(otrng_prekey_service_s *service,
+                          const otrng_prekey_service_session_s *session,
+                          const uint8_t *msg, size_t msg_len,
+                          const uint8_t mac_key[MAC_KEY_BYTES],
+                          const uint8_t mac_proof_key[HASH_BYTES]) {
+  uint8_t msg_type = 0;
+
+  if (!otrng_prekey_parse_header(&msg_type, msg, msg_len, NULL)) {
+    return NULL;
+  }
+
+  switch (msg_type) {
+  case OTRNG_PREKEY_STORAGE_INFO_REQ_MSG:
+    return answer_storage_information(service, session->identity,
+                                      session->instance_tag, msg, msg_len,
+                                      mac_key);
+  case OTRNG_PREKEY_PUBLICATION_MSG:
+    return answer_publication(service, session, msg, msg_len, mac_key,
+                              mac_proof_key);
+  default:
+    return NULL;
+  }
+}
+
+static char *answer_dake3(otrng_prekey_service_s *service,
+                          otrng_prekey_service_session_s *session,
+                          const otrng_prekey_dake3_message_s *dake3) {
+  uint8_t *mac_key = otrng_secure_alloc(MAC_KEY_BYTES);
+  uint8_t *mac_proof_key = otrng_secure_alloc(HASH_BYTES);
+  char *ret = NULL;
+
+  if (session_mac_keys(mac_key, mac_proof_key, service, session)) {
+    ret = answer_inner(service, session, dake3->msg, dake3->msg_len, mac_key,
+                       mac_proof_key);
+  }
+
+  otrng_secure_free(mac_key);
+  otrng_secure_free(mac_proof_key);
+
+  return ret;
+}
+
+tstatic char *
+prekey_service_receive_dake3(otrng_prekey_service_s *service, const char *from,
+                             const uint8_t *decoded, size_t decoded_len) {
+  otrng_prekey_dake3_message_s dake3;
+  otrng_prekey_service_session_s *session = NULL;
+  list_element_s *current, *node = NULL;
+  char *ret;
+
+  otrng_prekey_dake3_message_init(&dake3);
+  if (!otrng_prekey_dake3_message_deserialize(&dake3, decoded, decoded_len)) {
+    otrng_prekey_dake3_message_destroy(&dake3);
+    service->stats.failures++;
+    return NULL;
+  }
+
+  /* The ring signature covers S, so only the session that sent the DAKE2
+   * this DAKE3 answers will verify it */
+  for (current = service->sessions; current; current = current->next) {
+    otrng_prekey_service_session_s *candidate = current->data;
+    if (candidate->instance_tag == dake3.client_instance_tag &&
+        strcmp(candidate->identity, from) == 0 &&
+        session_verify_dake3(service, candidate, &dake3)) {
+      session = candidate;
+      node = current;
+      break;
+    }
+  }
+
+  if (!session) {
+    otrng_prekey_dake3_message_destroy(&dake3);
+    service->stats.failures++;
+    return NULL;
+  }
+
+  service->sessions = otrng_list_remove_element(node, service->sessions);
+  otrng_list_free_nodes(node);
+  service->stats.dakes_finished++;
+
+  ret = answer_dake3(service, session, &dake3);
+  otrng_prekey_dake3_message_destroy(&dake3);
+
+  /* The client only uses the session once it has seen our answer */
+  if (ret == NULL || session->secret == NULL) {
+    session_free(session);
+    return ret;
+  }
+
+  otrng_ecdh_keypair_destroy(session->S);
+  otrng_secure_free(session->S);
+  session->S = NULL;
+  session->started_at = time(NULL);
+  service->resumable = otrng_list_add(session, service->resumable);
+
+  return ret;
+}
+
+static otrng_bool
+session_resumable(const otrng_prekey_service_s *service,
+                  const otrng_prekey_service_session_s *session, time_t now) {
+  return difftime(now, session->started_at) <
+                 (double)service->session_lifetime
+             ? otrng_true
+             : otrng_false;
+}
+
+tstatic char *prekey_service_receive_resume(otrng_prekey_service_s *service,
+                                            const char *from,
+                                            const uint8_t *decoded,
+                                            size_t decoded_len) {
+  otrng_prekey_resume_message_s resume;
+  otrng_prekey_service_session_s *session = NULL;
+  list_element_s *current;
+  uint8_t *mac_key, *mac_proof_key;
+  char *ret = NULL;
+
+  memset(&resume, 0, sizeof(otrng_prekey_resume_message_s));
+  if (!otrng_prekey_resume_message_deserialize(&resume, decoded,
+                                               decoded_len)) {
+    otrng_prekey_resume_message_destroy(&resume);
+    service->stats.failures++;
+    return NULL;
+  }
+
+  for (current = service->resumable; current; current = current->next) {
+    otrng_prekey_service_session_s *candidate = current->data;
+    if (candidate->instance_tag == resume.client_instance_tag &&
+        strcmp(candidate->identity, from) == 0 &&
+        sodium_memcmp(candidate->id, resume.session_id,
+                      PREKEY_SESSION_ID_BYTES) == 0) {
+      session = candidate;
+      break;
+    }
+  }
+
+  /* Counters only go up, so a request can't be replayed */
+  if (!session || !session_resumable(service, session, time(NULL)) ||
+      resume.counter <= session->counter) {
+    otrng_prekey_resume_message_destroy(&resume);
+    service->stats.failures++;
+    return NULL;
+  }
+
+  mac_key = otrng_secure_alloc(MAC_KEY_BYTES);
+  mac_proof_key = otrng_secure_alloc(HASH_BYTES);
+
+  if (otrng_prekey_session_request_keys(mac_key, mac_proof_key,
+                                        session->secret, resume.counter)) {
+    ret = answer_inner(service, session, resume.msg, resume.msg_len, mac_key,
+                       mac_proof_key);
+  }
+
+  /* Only a request that was authenticated moves the counter */
+  if (ret) {
+    session->counter = resume.counter;
+    service->stats.resumed++;
+  }
+
+  otrng_secure_free(mac_key);
+  otrng_secure_free(mac_proof_key);
+  otrng_prekey_resume_message_destroy(&resume);
+
+  return ret;
+}
+
+static otrng_bool entry_has_ensemble(const otrng_prekey_service_entry_s *entry,
+                                     const char *identity) {
+  return entry->client_profile && entry->prekey_profile &&
+                 entry->prekey_messages &&
+                 strcmp(entry->identity, identity) == 0
+             ? otrng_true
+             : otrng_false;
+}
+
+static char *answer_no_prekeys(uint32_t instance_tag, const char *identity) {
+  size_t len = 2 + 1 + 4 + 4 + strlen(identity);
+  uint8_t *buf = otrng_xmalloc(len);
+  size_t w = 0;
+  char *ret;
+
+  w += otrng_serialize_uint16(buf, OTRNG_PROTOCOL_VERSION_4);
+  w += otrng_serialize_uint8(buf + w, OTRNG_PREKEY_NO_PREKEY_IN_STORAGE_MSG);
+  w += otrng_serialize_uint32(buf + w, instance_tag);
+  w += otrng_serialize_data(buf + w, (const uint8_t *)identity,
+                            strlen(identity));
+
+  ret = service_encode(buf, w);
+  otrng_free(buf);
+  return ret;
+}
+
+/*
+  Every instance of the identity that has published both profiles and still
+  has a prekey message gets one ensemble in the answer. The prekey message
+  that is handed out is removed, so it will never be used twice.
+*/
+static char *answer_ensembles(otrng_prekey_service_s *service,
+                              uint32_t instance_tag, const char *identity) {
+  list_element_s *current;
+  size_t len = 2 + 1 + 4 + 4 + strlen(identity) + 1;
+  uint8_t num = 0;
+  uint8_t *buf;
+  size_t w = 0;
+  char *ret;
+
+  for (current = service->entries; current && num < MAX_ENSEMBLES;
+       current = current->next) {
+    const otrng_prekey_service_entry_s *entry = current->data;
+    const otrng_prekey_service_record_s *pm;
+
+    if (!entry_has_ensemble(entry, identity)) {
+      continue;
+    }
+
+    pm = entry->prekey_messages->data;
+    len += entry->client_profile->len + entry->prekey_profile->len + pm->len;
+    num++;
+  }
+
+  if (num == 0) {
+    return answer_no_prekeys(instance_tag, identity);
+  }
+
+  buf = otrng_xmalloc(len);
+  w += otrng_serialize_uint16(buf, OTRNG_PROTOCOL_VERSION_4);
+  w += otrng_serialize_uint8(buf + w, OTRNG_PREKEY_ENSEMBLE_RETRIEVAL_MSG);
+  w += otrng_serialize_uint32(buf + w, instance_tag);
+  w += otrng_serialize_data(buf + w, (const uint8_t *)identity,
+                            strlen(identity));
+  w += otrng_serialize_uint8(buf + w, num);
+
+  for (current = service->entries; current && num > 0;
+       current = current->next) {
+    otrng_prekey_service_entry_s *entry = current->data;
+    list_element_s *first;
+    otrng_prekey_service_record_s *pm;
+
+    if (!entry_has_ensemble(entry, identity)) {
+      continue;
+    }
+
+    first = entry->prekey_messages;
+    pm = first->data;
+
+    w += otrng_serialize_bytes_array(buf + w, entry->client_profile->data,
+                                     entry->client_profile->len);
+    w += otrng_serialize_bytes_array(buf + w, entry->prekey_profile->data,
+                                     entry->prekey_profile->len);
+    w += otrng_serialize_bytes_array(buf + w, pm->data, pm->len);
+
+    entry->prekey_messages = otrng_list_remove_element(first,
+                                                       entry->prekey_messages);
+    otrng_list_free_nodes(first);
+    entry->num_prekey_messages--;
+    service->stats.stored_prekey_messages--;
+    service->stats.stored_bytes -= pm->len;
+    record_free(pm);
+    num--;
+  }
+
+  assert(w == len);
+
+  ret = service_encode(buf, w);
+  otrng_free(buf);
+  return ret;
+}
+
+tstatic char *
+prekey_service_receive_query(otrng_prekey_service_s *service,
+                             const uint8_t *decoded, size_t decoded_len) {
+  uint32_t instance_tag = 0;
+  uint8_t *identity_ser = NULL, *versions_ser = NULL;
+  size_t identity_len = 0, versions_len = 0;
+  size_t w = 0, read = 0;
+  char *identity;
+  char *ret = NULL;
+
+  if (!otrng_deserialize_uint32(&instance_tag, decoded + 3, decoded_len - 3,
+                                &read)) {
+    service->stats.failures++;
+    return NULL;
+  }
+  w = 3 + read;
+
+  if (!otrng_deserialize_data(&identity_ser, &identity_len, decoded + w,
+                              decoded_len - w, &read)) {
+    service->stats.failures++;
+    return NULL;
+  }
+  w += read;
+
+  if (!otrng_deserialize_data(&versions_ser, &versions_len, decoded + w,
+                              decoded_len - w, &read)) {
+    otrng_free(identity_ser);
+    service->stats.failures++;
+    return NULL;
+  }
+
+  identity = otrng_xmalloc_z(identity_len + 1);
+  if (identity_ser) {
+    memcpy(identity, identity_ser, identity_len);
+  }
+
+  service->stats.retrievals++;
+
+  /* We only store version 4 prekey messages */
+  if (versions_ser && memchr(versions_ser, '4', versions_len)) {
+    ret = answer_ensembles(service, instance_tag, identity);
+  } else {
+    ret = answer_no_prekeys(instance_tag, identity);
+  }
+
+  otrng_free(identity);
+  otrng_free(identity_ser);
+  otrng_free(versions_ser);
+
+  return ret;
+}
+
+API otrng_bool otrng_prekey_service_receive(char **to_send,
+                                            otrng_prekey_service_s *service,
+                                            const char *from,
+                                            const char *msg) {
+  uint8_t *decoded = NULL;
+  size_t decoded_len = 0;
+  uint8_t msg_type = 0;
+  otrng_bool ret = otrng_true;
+
+  assert(to_send);
+  assert(service);
+  assert(from);
+  assert(msg);
+
+  *to_send = NULL;
+
+  if (!service_decode(msg, &decoded, &decoded_len)) {
+    return otrng_false;
+  }
+
+  if (!otrng_prekey_parse_header(&msg_type, decoded, decoded_len, NULL)) {
+    otrng_free(decoded);
+    return otrng_false;
+  }
+
+  switch (msg_type) {
+  case OTRNG_PREKEY_DAKE1_MSG:
+    *to_send =
+        prekey_service_receive_dake1(service, from, decoded, decoded_len);
+    break;
+  case OTRNG_PREKEY_DAKE3_MSG:
+    *to_send =
+        prekey_service_receive_dake3(service, from, decoded, decoded_len);
+    break;
+  case OTRNG_PREKEY_RESUME_MSG:
+    *to_send =
+        prekey_service_receive_resume(service, from, decoded, decoded_len);
+    break;
+  case OTRNG_PREKEY_ENSEMBLE_QUERY_RETRIEVAL_MSG:
+    *to_send = prekey_service_receive_query(service, decoded, decoded_len);
+    break;
+  default:
+    ret = otrng_false;
+  }
+
+  otrng_free(decoded);
+  return ret;
+}
+
+API void
+otrng_prekey_service_set_session_lifetime(otrng_prekey_service_s *service,
+                                          time_t seconds) {
+  assert(service);
+
+  service->session_lifetime = seconds;
+}
+
+static list_element_s *drop_session(list_element_s *sessions,
+                                    list_element_s *node) {
+  otrng_prekey_service_session_s *session = node->data;
+
+  sessions = otrng_list_remove_element(node, sessions);
+  otrng_list_free_nodes(node);
+  session_free(session);
+
+  return sessions;
+}
+
+API void otrng_prekey_service_expire_sessions(otrng_prekey_service_s *service,
+                                              time_t max_age) {
+  list_element_s *current;
+  time_t now = time(NULL);
+
+  assert(service);
+
+  current = service->sessions;
+  while (current) {
+    list_element_s *next = current->next;
+    otrng_prekey_service_session_s *session = current->data;
+
+    if (difftime(now, session->started_at) >= (double)max_age) {
+      service->sessions = drop_session(service->sessions, current);
+    }
+
+    current = next;
+  }
+
+  current = service->resumable;
+  while (current) {
+    list_element_s *next = current->next;
+
+    if (!session_resumable(service, current->data, now)) {
+      service->resumable = drop_session(service->resumable, current);
+    }
+
+    current = next;
+  }
+}
+
+API size_t otrng_prekey_service_stored_prekey_messages(
+    const otrng_prekey_service_s *service, const char *identity) {
+  list_element_s *current;
+  size_t result = 0;
+
+  assert(service);
+  assert(identity);
+
+  for (current = service->entries; current; current = current->next) {
+    const otrng_prekey_service_entry_s *entry = current->data;
+    if (strcmp(entry->identity, identity) == 0) {
+      result += entry->num_prekey_messages;
+    }
+  }
+
+  return result;
+}
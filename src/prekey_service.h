@@ -0,0 +1,212 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A small prekey server that lives in the same process as its clients. It
+ * speaks the server side of the prekey DAKE (DAKE1, DAKE2 and DAKE3), answers
+ * storage information requests, stores publications and hands out prekey
+ * ensembles. It keeps everything in memory.
+ *
+ * It is meant for tests, load tests and local setups. It does not do any of the
+ * rate limiting or long term storage a real prekey server needs.
+ *
+ * The functions in this file only operate on their arguments, and doesn't touch
+ * any global state. A service can't be used from different threads at the same
+ * time.
+ */
+
+#ifndef OTRNG_PREKEY_SERVICE_H
+#define OTRNG_PREKEY_SERVICE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "ed448.h"
+#include "error.h"
+#include "keys.h"
+#include "list.h"
+#include "prekey_client_shared.h"
+#include "shared.h"
+
+/*
+  A DAKE that has been started with a DAKE1, and waits for its DAKE3. If the
+  service keeps sessions, it stays around after the DAKE3 and can be resumed -
+  then S is gone and the secret is set.
+*/
+typedef struct otrng_prekey_service_session_s {
+  /*@notnull@*/ char *identity;
+  uint32_t instance_tag;
+
+  otrng_public_key client_pub;
+  /*@notnull@*/ uint8_t *client_profile;
+  size_t client_profile_len;
+
+  ec_point I;
+  /*@null@*/ ecdh_keypair_s *S;
+
+  /*@null@*/ uint8_t *secret;
+  uint8_t id[PREKEY_SESSION_ID_BYTES];
+  /* The counter of the last request received in this session */
+  uint32_t counter;
+
+  /* When the DAKE1 was received, or the DAKE3 for resumable sessions */
+  time_t started_at;
+} otrng_prekey_service_session_s;
+
+/* A serialized value kept by the service */
+typedef struct otrng_prekey_service_record_s {
+  /*@notnull@*/ uint8_t *data;
+  size_t len;
+} otrng_prekey_service_record_s;
+
+/* Everything published by one client instance */
+typedef struct otrng_prekey_service_entry_s {
+  /*@notnull@*/ char *identity;
+  uint32_t instance_tag;
+
+  /*@null@*/ otrng_prekey_service_record_s *client_profile;
+  /*@null@*/ otrng_prekey_service_record_s *prekey_profile;
+
+  /* otrng_prekey_service_record_s entries, oldest first */
+  /*@null@*/ list_element_s *prekey_messages;
+  size_t num_prekey_messages;
+} otrng_prekey_service_entry_s;
+
+typedef struct otrng_prekey_service_stats_s {
+  unsigned long dakes_started;
+  unsigned long dakes_finished;
+  unsigned long resumed;
+  unsigned long publications;
+  unsigned long storage_requests;
+  unsigned long retrievals;
+  unsigned long failures;
+
+  size_t stored_prekey_messages;
+  size_t stored_bytes;
+} otrng_prekey_service_stats_s;
+
+typedef struct otrng_prekey_service_s {
+  /*@notnull@*/ char *identity;
+  /*@notnull@*/ otrng_keypair_s *keypair;
+
+  /* The identity and the public key, serialized the way they are signed in
+   * the DAKE */
+  /*@notnull@*/ uint8_t *composite_identity;
+  size_t composite_identity_len;
+
+  /* otrng_prekey_service_session_s entries, oldest first */
+  /*@null@*/ list_element_s *sessions;
+
+  /* otrng_prekey_service_session_s entries for finished DAKEs that can be
+   * resumed */
+  /*@null@*/ list_element_s *resumable;
+
+  /* How long, in seconds, a session can be resumed after its DAKE. 0 means
+   * sessions are not kept */
+  time_t session_lifetime;
+
+  /* otrng_prekey_service_entry_s entries */
+  /*@null@*/ list_element_s *entries;
+
+  otrng_prekey_service_stats_s stats;
+} otrng_prekey_service_s;
+
+/**
+ * @brief Creates a new prekey service.
+ *
+ * @param [identity] the non-NULL identity the service is reached at. The
+ *    string is copied.
+ * @param [sym] the non-NULL secret the long term key of the service is
+ *    derived from
+ *
+ * @return the new service, or NULL if the key could not be generated
+ **/
+API /*@null@*/ otrng_prekey_service_s *
+otrng_prekey_service_new(/*@notnull@*/ const char *identity,
+                         /*@notnull@*/ const uint8_t sym[ED448_PRIVATE_BYTES]);
+
+API void otrng_prekey_service_free(/*@null@*/ otrng_prekey_service_s *service);
+
+/**
+ * @brief Handles one message sent to the service.
+ *
+ * @param [to_send] the non-NULL location where the answer should be stored.
+ *    The caller takes over ownership of the string. It will be NULL if there
+ *    is nothing to answer.
+ * @param [service] the non-NULL service
+ * @param [from] the non-NULL identity of the sender. It has to be the same
+ *    identity the sender uses for itself in its prekey manager.
+ * @param [msg] the non-NULL message, encoded as it was sent on the network
+ *
+ * @return otrng_true if the message was understood
+ **/
+API otrng_bool otrng_prekey_service_receive(
+    /*@notnull@*/ char **to_send, /*@notnull@*/ otrng_prekey_service_s *service,
+    /*@notnull@*/ const char *from, /*@notnull@*/ const char *msg);
+
+/**
+ * @brief Keeps the session of every finished DAKE for [seconds] seconds, so
+ *    clients can send more requests in it. See
+ *    otrng_prekey_set_session_lifetime.
+ **/
+API void otrng_prekey_service_set_session_lifetime(
+    /*@notnull@*/ otrng_prekey_service_s *service, time_t seconds);
+
+/**
+ * @brief Drops DAKEs that were started more than [max_age] seconds ago and
+ *    never finished, and sessions that can't be resumed anymore.
+ **/
+API void otrng_prekey_service_expire_sessions(
+    /*@notnull@*/ otrng_prekey_service_s *service, time_t max_age);
+
+/**
+ * @brief Returns the number of prekey messages stored for an identity, over
+ *    all its instances.
+ **/
+API size_t otrng_prekey_service_stored_prekey_messages(
+    /*@notnull@*/ const otrng_prekey_service_s *service,
+    /*@notnull@*/ const char *identity);
+
+#ifdef OTRNG_PREKEY_SERVICE_PRIVATE
+
+tstatic /*@null@*/ otrng_prekey_service_entry_s *
+prekey_service_get_entry(const otrng_prekey_service_s *service,
+                         const char *identity, uint32_t instance_tag);
+
+tstatic /*@null@*/ char *
+prekey_service_receive_dake1(otrng_prekey_service_s *service, const char *from,
+                             const uint8_t *decoded, size_t decoded_len);
+
+tstatic /*@null@*/ char *
+prekey_service_receive_dake3(otrng_prekey_service_s *service, const char *from,
+                             const uint8_t *decoded, size_t decoded_len);
+
+tstatic /*@null@*/ char *
+prekey_service_receive_resume(otrng_prekey_service_s *service,
+                              const char *from, const uint8_t *decoded,
+                              size_t decoded_len);
+
+tstatic /*@null@*/ char *
+prekey_service_receive_query(otrng_prekey_service_s *service,
+                             const uint8_t *decoded, size_t decoded_len);
+
+#endif
+
+#endif
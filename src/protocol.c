@@ -23,6 +23,7 @@
 #include "data_message.h"
 #include "debug.h"
 #include "messaging.h"
+#include "metrics.h"
 #include "padding.h"
 #include "random.h"
 #include "serialize.h"
@@ -124,7 +125,11 @@ tstatic otrng_result encrypt_data_message(data_message_s *data_msg,
 
   random_bytes(data_msg->nonce, DATA_MSG_NONCE_BYTES);
 
-  c = otrng_xmalloc_z(msg_len);
+  if (data_msg->arena) {
+    c = otrng_arena_alloc(data_msg->arena, msg_len);
+  } else {
+    c = otrng_xmalloc_z(msg_len);
+  }
 
   memcpy(actual_enc_key, enc_key, ENC_ACTUAL_KEY_BYTES);
 
@@ -132,7 +137,9 @@ tstatic otrng_result encrypt_data_message(data_message_s *data_msg,
   otrng_secure_wipe(actual_enc_key, ENC_ACTUAL_KEY_BYTES);
 
   if (err) {
-    otrng_free(c);
+    if (!data_msg->arena) {
+      otrng_free(c);
+    }
     return OTRNG_ERROR;
   }
 
@@ -153,11 +160,8 @@ tstatic otrng_result encrypt_data_message(data_message_s *data_msg,
 }
 
 /*@null@*/ tstatic data_message_s *
-generate_data_message(const otrng_s *otr, const uint32_t ratchet_id) {
-  data_message_s *data_msg = otrng_data_message_new();
-  if (!data_msg) {
-    return NULL;
-  }
+generate_data_message(otrng_s *otr, const uint32_t ratchet_id) {
+  data_message_s *data_msg = otrng_data_message_new_in(&otr->arena);
 
   data_msg->sender_instance_tag = our_instance_tag(otr);
   data_msg->receiver_instance_tag = otr->their_instance_tag;
@@ -170,6 +174,13 @@ generate_data_message(const otrng_s *otr, const uint32_t ratchet_id) {
   return data_msg;
 }
 
+static void free_serialized_data_message(uint8_t *ser,
+                                         const data_message_s *data_msg) {
+  if (!data_msg->arena) {
+    otrng_free(ser);
+  }
+}
+
 tstatic otrng_result serialize_and_encode_data_message(
     string_p *dst, const k_msg_mac mac_key, uint8_t *to_reveal_mac_keys,
     size_t to_reveal_mac_keys_len, const data_message_s *data_msg) {
@@ -184,14 +195,18 @@ tstatic otrng_result serialize_and_encode_data_message(
 
   ser_len = body_len + MAC_KEY_BYTES + to_reveal_mac_keys_len;
 
-  ser = otrng_xmalloc_z(ser_len);
-
-  memcpy(ser, body, body_len);
-  otrng_free(body);
+  /* The authenticator and the revealed MAC keys are written after the body,
+     in the same buffer */
+  if (data_msg->arena) {
+    ser = otrng_arena_alloc(data_msg->arena, ser_len);
+    memcpy(ser, body, body_len);
+  } else {
+    ser = otrng_xrealloc(body, ser_len);
+  }
 
   if (otrng_failed(otrng_data_message_authenticator(
           ser + body_len, MAC_KEY_BYTES, mac_key, ser, body_len))) {
-    otrng_free(ser);
+    free_serialized_data_message(ser, data_msg);
     return OTRNG_ERROR;
   }
 
@@ -199,14 +214,14 @@ tstatic otrng_result serialize_and_encode_data_message(
     if (otrng_serialize_bytes_array(ser + body_len + DATA_MSG_MAC_BYTES,
                                     to_reveal_mac_keys,
                                     to_reveal_mac_keys_len) == 0) {
-      otrng_free(ser);
+      free_serialized_data_message(ser, data_msg);
       return OTRNG_ERROR;
     }
   }
 
   *dst = otrl_base64_otr_encode(ser, ser_len);
 
-  otrng_free(ser);
+  free_serialized_data_message(ser, data_msg);
   return OTRNG_SUCCESS;
 }
 
@@ -217,11 +232,18 @@ tstatic otrng_result send_data_message(string_p *to_send, const uint8_t *msg,
   uint32_t ratchet_id = otr->keys->i;
   k_msg_enc enc_key;
   k_msg_mac mac_key;
+  uint64_t start = otrng_metrics_start();
+  otrng_result result;
 
   /* if j == 0 */
-  if (!otrng_key_manager_derive_dh_ratchet_keys(
-          otr->keys, otr->client->max_stored_msg_keys, NULL, NULL, 0, 's',
-          otr->client->global_state->callbacks)) {
+  result = otrng_key_manager_derive_dh_ratchet_keys(
+      otr->keys, otr->client->max_stored_msg_keys, NULL, NULL, 0, 's',
+      otr->client->global_state->callbacks);
+  if (otrng_failed(result) || otr->keys->i != ratchet_id) {
+    otrng_metrics_record(otr->client->global_state, OTRNG_METRIC_RATCHET,
+                         start, result);
+  }
+  if (otrng_failed(result)) {
     return OTRNG_ERROR;
   }
 
@@ -258,10 +280,10 @@ tstatic otrng_result send_data_message(string_p *to_send, const uint8_t *msg,
    * data_message_sections, 64), 64) */
   if (otr->keys->j == 0) {
     size_t ser_mac_keys_len =
-        otrng_list_len(otr->keys->old_mac_keys) * MAC_KEY_BYTES;
+        otrng_vector_len(&otr->keys->old_mac_keys) * MAC_KEY_BYTES;
     uint8_t *ser_mac_keys =
-        otrng_serialize_old_mac_keys(otr->keys->old_mac_keys);
-    otr->keys->old_mac_keys = NULL;
+        otrng_serialize_old_mac_keys(&otr->keys->old_mac_keys);
+    otrng_key_manager_update_footprint(otr->keys);
 
     if (!serialize_and_encode_data_message(to_send, mac_key, ser_mac_keys,
                                            ser_mac_keys_len, data_msg)) {
@@ -289,68 +311,33 @@ tstatic otrng_result send_data_message(string_p *to_send, const uint8_t *msg,
   return OTRNG_SUCCESS;
 }
 
-tstatic otrng_result serialize_tlvs(uint8_t **dst, size_t *dst_len,
-                                    const tlv_list_s *tlvs) {
-  const tlv_list_s *current = tlvs;
-  uint8_t *cursor = NULL;
-
-  *dst = NULL;
-  *dst_len = 0;
-
-  if (!tlvs) {
-    return OTRNG_SUCCESS;
-  }
-
-  for (*dst_len = 0; current; current = current->next) {
-    *dst_len += current->data->len + 4;
-  }
-
-  *dst = otrng_xmalloc_z(*dst_len);
-
-  cursor = *dst;
-  for (current = tlvs; current; current = current->next) {
-    cursor += otrng_tlv_serialize(cursor, current->data);
-  }
-
-  return OTRNG_SUCCESS;
-}
-
 tstatic otrng_result append_tlvs(uint8_t **dst, size_t *dst_len,
                                  const string_p msg, const tlv_list_s *tlvs,
-                                 const otrng_s *otr) {
-  uint8_t *ser = NULL;
-  size_t len = 0;
-  size_t msg_len;
-  uint8_t *padding = NULL;
-  size_t padding_len = 0;
-  char *res;
-
-  if (!serialize_tlvs(&ser, &len, tlvs)) {
-    return OTRNG_ERROR;
-  }
+                                 otrng_s *otr) {
+  const tlv_list_s *current;
+  size_t msg_len = strlen(msg) + 1;
+  size_t padding_len;
+  uint8_t *cursor;
 
-  /* Append padding */
-  msg_len = strlen(msg) + 1 + len;
-  if (!generate_padding(&padding, &padding_len, msg_len, otr)) {
-    otrng_free(ser);
-    return OTRNG_ERROR;
+  for (current = tlvs; current; current = current->next) {
+    msg_len += current->data->len + 4;
   }
 
+  /* The TLVs and the padding are written straight into the plaintext */
+  padding_len = otrng_padding_tlv_len(msg_len, otr);
+
   *dst_len = msg_len + padding_len;
-  *dst = otrng_xmalloc_z(*dst_len);
+  *dst = otrng_arena_alloc(&otr->arena, *dst_len);
 
-  res = otrng_stpcpy((char *)*dst, msg);
-  if (ser) {
-    memcpy(res + 1, ser, len);
+  cursor = (uint8_t *)otrng_stpcpy((char *)*dst, msg) + 1;
+  for (current = tlvs; current; current = current->next) {
+    cursor += otrng_tlv_serialize(cursor, current->data);
   }
 
-  if (padding) {
-    memcpy(*dst + msg_len, padding, padding_len);
+  if (padding_len) {
+    otrng_padding_tlv_serialize(cursor, padding_len);
   }
 
-  otrng_free(ser);
-  otrng_free(padding);
-
   return OTRNG_SUCCESS;
 }
 
@@ -362,6 +349,7 @@ INTERNAL otrng_result otrng_prepare_to_send_data_message(string_p *to_send,
   uint8_t *msg2 = NULL;
   size_t msg_len = 0;
   otrng_result result;
+  uint64_t start;
 
   if (otr->state == OTRNG_STATE_FINISHED) {
     otrng_client_callbacks_handle_event(otr->client->global_state->callbacks,
@@ -377,22 +365,30 @@ INTERNAL otrng_result otrng_prepare_to_send_data_message(string_p *to_send,
     return OTRNG_ERROR;
   }
 
+  start = otrng_metrics_start();
+
+  /* The plaintext and the data message are only needed until it is encoded.
+     SMP sends its messages from here without going through
+     otrng_send_message, so the scope is opened here as well */
+  otrng_arena_enter(&otr->arena);
   if (!append_tlvs(&msg2, &msg_len, msg, tlvs, otr)) {
+    otrng_arena_leave(&otr->arena);
     return OTRNG_ERROR;
   }
 
   result = send_data_message(to_send, msg2, msg_len, otr, flags);
+  otrng_arena_leave(&otr->arena);
+
+  otrng_metrics_record(otr->client->global_state, OTRNG_METRIC_ENCRYPT, start,
+                       result);
   if (result == OTRNG_ERROR) {
     otrng_client_callbacks_handle_event(otr->client->global_state->callbacks,
                                         OTRNG_MSG_EVENT_ENCRYPTION_ERROR);
-    otrng_free(msg2);
 
     return OTRNG_ERROR;
   }
 
   otr->last_sent = time(NULL);
 
-  otrng_free(msg2);
-
   return OTRNG_SUCCESS;
 }
@@ -28,10 +28,13 @@
 #ifndef OTRNG_PROTOCOL_H
 #define OTRNG_PROTOCOL_H
 
+#include "alloc.h"
 #include "client_profile.h"
+#include "footprint.h"
 #include "key_management.h"
 #include "prekey_profile.h"
 #include "smp_protocol.h"
+#include "trace.h"
 #include "v3.h"
 
 typedef enum {
@@ -69,6 +72,9 @@ typedef enum {
   (OTRNG_REQUIRE_ENCRYPTION | OTRNG_ERROR_START_DAKE |                         \
    OTRNG_IDENTITY_START_DAKE)
 
+/* Enough for the buffers of a typical data message */
+#define OTRNG_MESSAGE_ARENA_CHUNK_BYTES 4096
+
 typedef struct otrng_s {
   struct otrng_client_s *client;
 
@@ -92,12 +98,37 @@ typedef struct otrng_s {
 
   key_manager_s *keys;
   smp_protocol_s *smp;
+  list_element_s *smp_jobs; /* smp_job_s, oldest first */
 
-  list_element_s *pending_fragments;
+  otrng_tail_list_s pending_fragments;
 
   time_t last_sent; // TODO: @refactoring not sure if the best place to put
 
   char *shared_session_state;
+
+  /* Buffers that only live while one message is received or sent. It is
+     secure, since they hold plaintext */
+  otrng_arena_s arena;
+
+  /* The memory the conversation holds, see otrng_conversation_footprint */
+  otrng_footprint_totals_s footprint;
+
+  /* Identifies the conversation, and the client it belongs to, in tracing
+     spans */
+  uint64_t trace_id;
+  uint64_t client_trace_id;
+
+  /* When a message was last sent or received, to find idle conversations */
+  time_t last_active;
+
+  /* While a conversation is hibernated, only the fields above that describe
+     it are kept. The rest of its state is serialized and encrypted into
+     [hibernated_state], unless the application stores it.
+     See otrng_client_set_hibernation */
+  otrng_bool hibernated;
+  otrng_bool hibernated_v3_conn;
+  /*@null@*/ uint8_t *hibernated_state;
+  size_t hibernated_state_len;
 } otrng_s;
 
 INTERNAL void maybe_create_keys(struct otrng_client_s *client);
@@ -116,6 +147,24 @@ INTERNAL dh_public_key our_dh(const otrng_s *otr);
 
 INTERNAL uint32_t our_instance_tag(const otrng_s *otr);
 
+/**
+ * @brief Begins [span] in the conversation [otr], about a message of
+ *    [message_type], or 0.
+ **/
+static inline void otrng_trace_conversation_begin(otrng_trace_span_s *span,
+                                                  const char *name,
+                                                  const otrng_s *otr,
+                                                  uint8_t message_type) {
+  span->begun = otrng_false;
+  if (!otrng_trace_enabled()) {
+    return;
+  }
+
+  otrng_trace_begin(span, name, otr->client_trace_id, otr->trace_id,
+                    our_instance_tag(otr), otr->their_instance_tag,
+                    message_type);
+}
+
 INTERNAL otrng_result otrng_prepare_to_send_data_message(string_p *to_send,
                                                          const string_p msg,
                                                          const tlv_list_s *tlvs,
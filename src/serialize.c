@@ -23,6 +23,7 @@
 #define OTRNG_SERIALIZE_PRIVATE
 
 #include "alloc.h"
+#include "key_management.h"
 #include "serialize.h"
 
 static size_t serialize_uint(uint8_t *target, const uint64_t data,
@@ -175,11 +176,11 @@ INTERNAL size_t otrng_serialize_ring_sig(uint8_t *dst,
 }
 
 /*@null@*/ INTERNAL uint8_t *
-otrng_serialize_old_mac_keys(list_element_s *old_mac_keys) {
-  size_t num_mac_keys = otrng_list_len(old_mac_keys);
+otrng_serialize_old_mac_keys(otrng_vector_s *old_mac_keys) {
+  size_t num_mac_keys = otrng_vector_len(old_mac_keys);
   size_t serlen = num_mac_keys * MAC_KEY_BYTES;
   uint8_t *ser_mac_keys;
-  unsigned int i;
+  size_t i;
 
   if (serlen == 0) {
     return NULL;
@@ -188,13 +189,12 @@ otrng_serialize_old_mac_keys(list_element_s *old_mac_keys) {
   ser_mac_keys = otrng_xmalloc(serlen);
 
   for (i = 0; i < num_mac_keys; i++) {
-    list_element_s *last = otrng_list_get_last(old_mac_keys);
-    memcpy(ser_mac_keys + i * MAC_KEY_BYTES, last->data, MAC_KEY_BYTES);
-    old_mac_keys = otrng_list_remove_element(last, old_mac_keys);
-    otrng_list_free(last, otrng_secure_free);
+    memcpy(ser_mac_keys + i * MAC_KEY_BYTES,
+           otrng_vector_get(old_mac_keys, num_mac_keys - 1 - i),
+           MAC_KEY_BYTES);
   }
 
-  otrng_list_free_nodes(old_mac_keys);
+  otrng_vector_free(old_mac_keys, otrng_old_mac_key_free);
 
   return ser_mac_keys;
 }
@@ -92,12 +92,13 @@ INTERNAL size_t otrng_serialize_shared_prekey(
     uint8_t *dst, const otrng_shared_prekey_pub shared_prekey);
 
 /**
- * @brief Serialize the old mac keys to reveal.
+ * @brief Serialize the old mac keys to reveal, newest first, and empty
+ *        [old_mac_keys].
  *
- * @param [old_mac_keys]   The list of old mac keys.
+ * @param [old_mac_keys]   The old mac keys.
  */
 /*@null@*/ INTERNAL uint8_t *
-otrng_serialize_old_mac_keys(list_element_s *old_mac_keys);
+otrng_serialize_old_mac_keys(otrng_vector_s *old_mac_keys);
 
 INTERNAL size_t otrng_serialize_phi(uint8_t *dst,
                                     const char *shared_session_state,
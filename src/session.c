@@ -0,0 +1,759 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define OTRNG_SESSION_PRIVATE
+
+#include <string.h>
+
+#include "alloc.h"
+#include "client_profile.h"
+#include "deserialize.h"
+#include "footprint.h"
+#include "key_management.h"
+#include "prekey_profile.h"
+#include "serialize.h"
+#include "session.h"
+#include "smp_protocol.h"
+
+#define SKIPPED_KEY_BYTES                                                      \
+  (ED448_POINT_BYTES + 4 + EXTRA_SYMMETRIC_KEY_BYTES + ENC_KEY_BYTES)
+
+#define KEYS_BYTES                                                             \
+  (ED448_SCALAR_BYTES + 2 * ED448_POINT_BYTES + 3 * (1 + DH_MPI_MAX_BYTES) +   \
+   4 * 4 + ROOT_KEY_BYTES + 2 * CHAIN_KEY_BYTES + BRACE_KEY_BYTES +            \
+   SHARED_SECRET_BYTES + SSID_BYTES + 1 + EXTRA_SYMMETRIC_KEY_BYTES + 4 + 4 + \
+   8)
+
+static otrng_bool has_keys(const otrng_s *otr) {
+  return otr->state == OTRNG_STATE_ENCRYPTED_MESSAGES && otr->keys;
+}
+
+INTERNAL otrng_bool otrng_session_can_serialize(const otrng_s *otr) {
+  if (otr->running_version == OTRNG_PROTOCOL_VERSION_3) {
+    return otrng_false;
+  }
+
+  if (otr->state != OTRNG_STATE_START &&
+      otr->state != OTRNG_STATE_ENCRYPTED_MESSAGES &&
+      otr->state != OTRNG_STATE_FINISHED) {
+    return otrng_false;
+  }
+
+  if (otrng_tail_list_len(&otr->pending_fragments) != 0 || otr->smp_jobs ||
+      otr->arena.depth != 0) {
+    return otrng_false;
+  }
+
+  if (otr->smp && (otr->smp->state_expect != SMP_STATE_EXPECT_1 ||
+                   otr->smp->secret != NULL)) {
+    return otrng_false;
+  }
+
+  return otrng_true;
+}
+
+tstatic size_t session_max_serialized_len(const otrng_s *otr,
+                                          size_t client_profile_len,
+                                          size_t prekey_profile_len) {
+  size_t result = 1 + 1 + 1 + 4 + 4 + 8 + 4 + client_profile_len + 4 +
+                  prekey_profile_len + 4 + 1;
+
+  if (otr->shared_session_state) {
+    result += strlen(otr->shared_session_state);
+  }
+
+  if (has_keys(otr)) {
+    result +=
+        KEYS_BYTES +
+        otrng_tail_list_len(&otr->keys->skipped_keys) * SKIPPED_KEY_BYTES +
+        otrng_vector_len(&otr->keys->old_mac_keys) * MAC_KEY_BYTES;
+  }
+
+  return result;
+}
+
+static otrng_result serialize_optional_mpi(uint8_t *dst, size_t *written,
+                                           /*@null@*/ const dh_mpi mpi) {
+  size_t w = 0;
+
+  if (!mpi) {
+    *written = otrng_serialize_uint8(dst, 0);
+    return OTRNG_SUCCESS;
+  }
+
+  dst += otrng_serialize_uint8(dst, 1);
+  if (!otrng_serialize_dh_mpi_otr(dst, DH_MPI_MAX_BYTES, &w, mpi)) {
+    return OTRNG_ERROR;
+  }
+
+  *written = 1 + w;
+  return OTRNG_SUCCESS;
+}
+
+static otrng_result serialize_keys(uint8_t *dst, size_t *written,
+                                   const key_manager_s *keys) {
+  const list_element_s *current;
+  uint8_t *cursor = dst;
+  size_t w = 0, i;
+
+  cursor += otrng_serialize_ec_scalar(cursor, keys->our_ecdh->priv);
+  cursor += otrng_serialize_ec_point(cursor, keys->our_ecdh->pub);
+
+  if (!serialize_optional_mpi(cursor, &w, keys->our_dh->priv)) {
+    return OTRNG_ERROR;
+  }
+  cursor += w;
+
+  if (!serialize_optional_mpi(cursor, &w, keys->our_dh->pub)) {
+    return OTRNG_ERROR;
+  }
+  cursor += w;
+
+  cursor += otrng_serialize_ec_point(cursor, keys->their_ecdh);
+
+  if (!serialize_optional_mpi(cursor, &w, keys->their_dh)) {
+    return OTRNG_ERROR;
+  }
+  cursor += w;
+
+  cursor += otrng_serialize_uint32(cursor, keys->i);
+  cursor += otrng_serialize_uint32(cursor, keys->j);
+  cursor += otrng_serialize_uint32(cursor, keys->k);
+  cursor += otrng_serialize_uint32(cursor, keys->pn);
+
+  cursor += otrng_serialize_bytes_array(cursor, keys->current->root_key,
+                                        ROOT_KEY_BYTES);
+  cursor += otrng_serialize_bytes_array(cursor, keys->current->chain_s,
+                                        CHAIN_KEY_BYTES);
+  cursor += otrng_serialize_bytes_array(cursor, keys->current->chain_r,
+                                        CHAIN_KEY_BYTES);
+  cursor +=
+      otrng_serialize_bytes_array(cursor, keys->brace_key, BRACE_KEY_BYTES);
+  cursor += otrng_serialize_bytes_array(cursor, keys->shared_secret,
+                                        SHARED_SECRET_BYTES);
+  cursor += otrng_serialize_bytes_array(cursor, keys->ssid, SSID_BYTES);
+  cursor += otrng_serialize_uint8(cursor, keys->ssid_half_first ? 1 : 0);
+  cursor += otrng_serialize_bytes_array(cursor, keys->extra_symmetric_key,
+                                        EXTRA_SYMMETRIC_KEY_BYTES);
+
+  cursor += otrng_serialize_uint32(cursor,
+                                   otrng_tail_list_len(&keys->skipped_keys));
+  for (current = keys->skipped_keys.head; current; current = current->next) {
+    const skipped_keys_s *skipped = current->data;
+
+    cursor += otrng_serialize_ec_point(cursor, skipped->their_ecdh);
+    cursor += otrng_serialize_uint32(cursor, skipped->k);
+    cursor += otrng_serialize_bytes_array(
+        cursor, skipped->extra_symmetric_key, EXTRA_SYMMETRIC_KEY_BYTES);
+    cursor +=
+        otrng_serialize_bytes_array(cursor, skipped->enc_key, ENC_KEY_BYTES);
+  }
+
+  cursor += otrng_serialize_uint32(cursor,
+                                   otrng_vector_len(&keys->old_mac_keys));
+  for (i = 0; i < otrng_vector_len(&keys->old_mac_keys); i++) {
+    cursor += otrng_serialize_bytes_array(
+        cursor, otrng_vector_get(&keys->old_mac_keys, i), MAC_KEY_BYTES);
+  }
+
+  cursor += otrng_serialize_uint64(cursor, keys->last_generated);
+
+  *written = cursor - dst;
+  return OTRNG_SUCCESS;
+}
+
+INTERNAL otrng_result otrng_session_serialize(uint8_t **dst, size_t *dst_len,
+                                              const otrng_s *otr) {
+  uint8_t *client_profile = NULL, *prekey_profile = NULL;
+  size_t client_profile_len = 0, prekey_profile_len = 0;
+  size_t max_len, shared_len = 0, w = 0;
+  uint8_t *ser, *cursor;
+  otrng_result result = OTRNG_SUCCESS;
+
+  if (otr->their_client_profile &&
+      !otrng_client_profile_serialize(&client_profile, &client_profile_len,
+                                      otr->their_client_profile)) {
+    return OTRNG_ERROR;
+  }
+
+  if (otr->their_prekey_profile &&
+      !otrng_prekey_profile_serialize(&prekey_profile, &prekey_profile_len,
+                                      otr->their_prekey_profile)) {
+    otrng_free(client_profile);
+    return OTRNG_ERROR;
+  }
+
+  if (otr->shared_session_state) {
+    shared_len = strlen(otr->shared_session_state);
+  }
+
+  max_len =
+      session_max_serialized_len(otr, client_profile_len, prekey_profile_len);
+  ser = otrng_secure_alloc(max_len);
+  cursor = ser;
+
+  cursor += otrng_serialize_uint8(cursor, OTRNG_SESSION_VERSION);
+  cursor += otrng_serialize_uint8(cursor, otr->state);
+  cursor += otrng_serialize_uint8(cursor, otr->running_version);
+  cursor += otrng_serialize_uint32(cursor, otr->their_instance_tag);
+  cursor += otrng_serialize_uint32(cursor, otr->their_prekeys_id);
+  cursor += otrng_serialize_uint64(cursor, otr->last_sent);
+  cursor += otrng_serialize_data(
+      cursor, (const uint8_t *)otr->shared_session_state, shared_len);
+  cursor += otrng_serialize_data(cursor, client_profile, client_profile_len);
+  cursor += otrng_serialize_data(cursor, prekey_profile, prekey_profile_len);
+
+  otrng_free(client_profile);
+  otrng_free(prekey_profile);
+
+  if (has_keys(otr)) {
+    cursor += otrng_serialize_uint8(cursor, 1);
+    result = serialize_keys(cursor, &w, otr->keys);
+    cursor += w;
+  } else {
+    cursor += otrng_serialize_uint8(cursor, 0);
+  }
+
+  if (otrng_failed(result)) {
+    otrng_session_free_serialized(ser, max_len);
+    return OTRNG_ERROR;
+  }
+
+  *dst = ser;
+  *dst_len = cursor - ser;
+
+  return OTRNG_SUCCESS;
+}
+
+INTERNAL void otrng_session_free_serialized(uint8_t *ser, size_t ser_len) {
+  if (!ser) {
+    return;
+  }
+
+  otrng_secure_wipe(ser, ser_len);
+  otrng_secure_free(ser);
+}
+
+static otrng_result deserialize_optional_mpi(dh_mpi *dst, const uint8_t *src,
+                                             size_t src_len, size_t *nread) {
+  uint8_t present = 0;
+  size_t read = 0;
+
+  if (!otrng_deserialize_uint8(&present, src, src_len, &read)) {
+    return OTRNG_ERROR;
+  }
+
+  *dst = NULL;
+  if (!present) {
+    *nread = read;
+    return OTRNG_SUCCESS;
+  }
+
+  if (!otrng_deserialize_dh_mpi_otr(dst, src + 1, src_len - 1, &read)) {
+    return OTRNG_ERROR;
+  }
+
+  *nread = 1 + read;
+  return OTRNG_SUCCESS;
+}
+
+static otrng_result deserialize_skipped_keys(key_manager_s *keys,
+                                             const uint8_t *src,
+                                             size_t src_len, size_t *nread) {
+  size_t w = 0, read = 0;
+  uint32_t num, i;
+
+  if (!otrng_deserialize_uint32(&num, src, src_len, &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (num > (src_len - w) / SKIPPED_KEY_BYTES) {
+    return OTRNG_ERROR;
+  }
+
+  for (i = 0; i < num; i++) {
+    skipped_keys_s *skipped =
+        otrng_secure_alloc_in(OTRNG_ALLOC_RATCHET, sizeof(skipped_keys_s));
+
+    otrng_tail_list_append(&keys->skipped_keys, skipped);
+
+    if (!otrng_deserialize_ec_point(skipped->their_ecdh, src + w,
+                                    src_len - w)) {
+      return OTRNG_ERROR;
+    }
+    w += ED448_POINT_BYTES;
+
+    if (!otrng_deserialize_uint32(&skipped->k, src + w, src_len - w, &read)) {
+      return OTRNG_ERROR;
+    }
+    w += read;
+
+    if (!otrng_deserialize_bytes_array(skipped->extra_symmetric_key,
+                                       EXTRA_SYMMETRIC_KEY_BYTES, src + w,
+                                       src_len - w)) {
+      return OTRNG_ERROR;
+    }
+    w += EXTRA_SYMMETRIC_KEY_BYTES;
+
+    if (!otrng_deserialize_bytes_array(skipped->enc_key, ENC_KEY_BYTES,
+                                       src + w, src_len - w)) {
+      return OTRNG_ERROR;
+    }
+    w += ENC_KEY_BYTES;
+  }
+
+  *nread = w;
+  return OTRNG_SUCCESS;
+}
+
+static otrng_result deserialize_old_mac_keys(key_manager_s *keys,
+                                             const uint8_t *src,
+                                             size_t src_len, size_t *nread) {
+  size_t w = 0, read = 0;
+  uint32_t num, i;
+
+  if (!otrng_deserialize_uint32(&num, src, src_len, &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (num > (src_len - w) / MAC_KEY_BYTES) {
+    return OTRNG_ERROR;
+  }
+
+  for (i = 0; i < num; i++) {
+    uint8_t *mac_key =
+        otrng_secure_alloc_in(OTRNG_ALLOC_RATCHET, MAC_KEY_BYTES);
+    memcpy(mac_key, src + w, MAC_KEY_BYTES);
+    otrng_vector_push(&keys->old_mac_keys, mac_key);
+    w += MAC_KEY_BYTES;
+  }
+
+  *nread = w;
+  return OTRNG_SUCCESS;
+}
+
+/* Fills [keys], a new key manager. On failure, it still has to be freed */
+static otrng_result deserialize_keys(key_manager_s *keys, const uint8_t *src,
+                                     size_t src_len, size_t *nread) {
+  uint8_t ssid_half_first = 0;
+  uint64_t last_generated = 0;
+  size_t w = 0, read = 0;
+
+  if (!otrng_deserialize_ec_scalar(keys->our_ecdh->priv, src, src_len)) {
+    return OTRNG_ERROR;
+  }
+  w += ED448_SCALAR_BYTES;
+
+  if (!otrng_deserialize_ec_point(keys->our_ecdh->pub, src + w, src_len - w)) {
+    return OTRNG_ERROR;
+  }
+  w += ED448_POINT_BYTES;
+
+  if (!deserialize_optional_mpi(&keys->our_dh->priv, src + w, src_len - w,
+                                &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (!deserialize_optional_mpi(&keys->our_dh->pub, src + w, src_len - w,
+                                &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (!otrng_deserialize_ec_point(keys->their_ecdh, src + w, src_len - w)) {
+    return OTRNG_ERROR;
+  }
+  w += ED448_POINT_BYTES;
+
+  if (!deserialize_optional_mpi(&keys->their_dh, src + w, src_len - w,
+                                &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (!otrng_deserialize_uint32(&keys->i, src + w, src_len - w, &read) ||
+      !otrng_deserialize_uint32(&keys->j, src + w + 4, src_len - w - 4,
+                                &read) ||
+      !otrng_deserialize_uint32(&keys->k, src + w + 8, src_len - w - 8,
+                                &read) ||
+      !otrng_deserialize_uint32(&keys->pn, src + w + 12, src_len - w - 12,
+                                &read)) {
+    return OTRNG_ERROR;
+  }
+  w += 16;
+
+  if (!otrng_deserialize_bytes_array(keys->current->root_key, ROOT_KEY_BYTES,
+                                     src + w, src_len - w)) {
+    return OTRNG_ERROR;
+  }
+  w += ROOT_KEY_BYTES;
+
+  if (!otrng_deserialize_bytes_array(keys->current->chain_s, CHAIN_KEY_BYTES,
+                                     src + w, src_len - w)) {
+    return OTRNG_ERROR;
+  }
+  w += CHAIN_KEY_BYTES;
+
+  if (!otrng_deserialize_bytes_array(keys->current->chain_r, CHAIN_KEY_BYTES,
+                                     src + w, src_len - w)) {
+    return OTRNG_ERROR;
+  }
+  w += CHAIN_KEY_BYTES;
+
+  if (!otrng_deserialize_bytes_array(keys->brace_key, BRACE_KEY_BYTES, src + w,
+                                     src_len - w)) {
+    return OTRNG_ERROR;
+  }
+  w += BRACE_KEY_BYTES;
+
+  if (!otrng_deserialize_bytes_array(keys->shared_secret, SHARED_SECRET_BYTES,
+                                     src + w, src_len - w)) {
+    return OTRNG_ERROR;
+  }
+  w += SHARED_SECRET_BYTES;
+
+  if (!otrng_deserialize_bytes_array(keys->ssid, SSID_BYTES, src + w,
+                                     src_len - w)) {
+    return OTRNG_ERROR;
+  }
+  w += SSID_BYTES;
+
+  if (!otrng_deserialize_uint8(&ssid_half_first, src + w, src_len - w,
+                               &read)) {
+    return OTRNG_ERROR;
+  }
+  keys->ssid_half_first = ssid_half_first ? otrng_true : otrng_false;
+  w += read;
+
+  if (!otrng_deserialize_bytes_array(keys->extra_symmetric_key,
+                                     EXTRA_SYMMETRIC_KEY_BYTES, src + w,
+                                     src_len - w)) {
+    return OTRNG_ERROR;
+  }
+  w += EXTRA_SYMMETRIC_KEY_BYTES;
+
+  if (!deserialize_skipped_keys(keys, src + w, src_len - w, &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (!deserialize_old_mac_keys(keys, src + w, src_len - w, &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (!otrng_deserialize_uint64(&last_generated, src + w, src_len - w,
+                                &read)) {
+    return OTRNG_ERROR;
+  }
+  keys->last_generated = (time_t)last_generated;
+  w += read;
+
+  *nread = w;
+  return OTRNG_SUCCESS;
+}
+
+/* The deserialized state, before it replaces the state of the conversation */
+typedef struct session_s {
+  uint8_t state;
+  uint8_t running_version;
+  uint32_t their_instance_tag;
+  uint32_t their_prekeys_id;
+  uint64_t last_sent;
+  /*@null@*/ char *shared_session_state;
+  /*@null@*/ otrng_client_profile_s *their_client_profile;
+  /*@null@*/ otrng_prekey_profile_s *their_prekey_profile;
+  /*@null@*/ key_manager_s *keys;
+} session_s;
+
+static void session_destroy(session_s *session) {
+  otrng_free(session->shared_session_state);
+  otrng_client_profile_free(session->their_client_profile);
+  otrng_prekey_profile_free(session->their_prekey_profile);
+  if (session->keys) {
+    otrng_key_manager_free(session->keys);
+  }
+}
+
+static otrng_result deserialize_profiles(session_s *session,
+                                         const uint8_t *src, size_t src_len,
+                                         size_t *nread) {
+  uint8_t *data = NULL;
+  size_t data_len = 0, w = 0, read = 0;
+
+  if (!otrng_deserialize_data(&data, &data_len, src, src_len, &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (data_len != 0) {
+    session->their_client_profile =
+        otrng_xmalloc_z(sizeof(otrng_client_profile_s));
+    if (!otrng_client_profile_deserialize(session->their_client_profile, data,
+                                          data_len, NULL)) {
+      otrng_free(data);
+      return OTRNG_ERROR;
+    }
+  }
+  otrng_free(data);
+  data = NULL;
+
+  if (!otrng_deserialize_data(&data, &data_len, src + w, src_len - w,
+                              &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (data_len != 0) {
+    session->their_prekey_profile =
+        otrng_xmalloc_z(sizeof(otrng_prekey_profile_s));
+    if (!otrng_prekey_profile_deserialize(session->their_prekey_profile, data,
+                                          data_len, &read)) {
+      otrng_free(data);
+      return OTRNG_ERROR;
+    }
+  }
+  otrng_free(data);
+
+  *nread = w;
+  return OTRNG_SUCCESS;
+}
+
+/* Only what otrng_session_can_serialize lets through is accepted, since the
+   serialized form can come back from the application */
+static otrng_bool valid_session(const session_s *session, uint8_t with_keys) {
+  otrng_bool encrypted = session->state == OTRNG_STATE_ENCRYPTED_MESSAGES;
+
+  if (session->state != OTRNG_STATE_START && !encrypted &&
+      session->state != OTRNG_STATE_FINISHED) {
+    return otrng_false;
+  }
+
+  if (session->running_version != OTRNG_PROTOCOL_VERSION_NONE &&
+      session->running_version != OTRNG_PROTOCOL_VERSION_4) {
+    return otrng_false;
+  }
+
+  if (encrypted && session->running_version != OTRNG_PROTOCOL_VERSION_4) {
+    return otrng_false;
+  }
+
+  /* The keys are kept exactly when the conversation is encrypted */
+  if (with_keys > 1 || (with_keys == 1) != encrypted) {
+    return otrng_false;
+  }
+
+  return otrng_true;
+}
+
+static otrng_result deserialize_session(session_s *session, const uint8_t *src,
+                                        size_t src_len) {
+  uint8_t version = 0, with_keys = 0;
+  uint8_t *shared = NULL;
+  size_t shared_len = 0, w = 0, read = 0;
+
+  if (!otrng_deserialize_uint8(&version, src, src_len, &read) ||
+      version != OTRNG_SESSION_VERSION) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (!otrng_deserialize_uint8(&session->state, src + w, src_len - w, &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (!otrng_deserialize_uint8(&session->running_version, src + w, src_len - w,
+                               &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (!otrng_deserialize_uint32(&session->their_instance_tag, src + w,
+                                src_len - w, &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (!otrng_deserialize_uint32(&session->their_prekeys_id, src + w,
+                                src_len - w, &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (!otrng_deserialize_uint64(&session->last_sent, src + w, src_len - w,
+                                &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (!otrng_deserialize_data(&shared, &shared_len, src + w, src_len - w,
+                              &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (shared_len != 0) {
+    session->shared_session_state = otrng_xmalloc_z(shared_len + 1);
+    memcpy(session->shared_session_state, shared, shared_len);
+  }
+  otrng_free(shared);
+
+  if (!deserialize_profiles(session, src + w, src_len - w, &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (!otrng_deserialize_uint8(&with_keys, src + w, src_len - w, &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (!valid_session(session, with_keys)) {
+    return OTRNG_ERROR;
+  }
+
+  if (with_keys) {
+    session->keys = otrng_key_manager_new();
+    if (!deserialize_keys(session->keys, src + w, src_len - w, &read)) {
+      return OTRNG_ERROR;
+    }
+    w += read;
+  }
+
+  if (w != src_len) {
+    return OTRNG_ERROR;
+  }
+
+  return OTRNG_SUCCESS;
+}
+
+INTERNAL otrng_result otrng_session_deserialize(otrng_s *otr,
+                                                const uint8_t *src,
+                                                size_t src_len) {
+  session_s session;
+
+  memset(&session, 0, sizeof(session_s));
+
+  if (!deserialize_session(&session, src, src_len)) {
+    session_destroy(&session);
+    return OTRNG_ERROR;
+  }
+
+  otr->state = session.state;
+  otr->running_version = session.running_version;
+  otr->their_instance_tag = session.their_instance_tag;
+  otr->their_prekeys_id = session.their_prekeys_id;
+  otr->last_sent = (time_t)session.last_sent;
+
+  otrng_free(otr->shared_session_state);
+  otr->shared_session_state = session.shared_session_state;
+
+  otrng_client_profile_free(otr->their_client_profile);
+  otr->their_client_profile = session.their_client_profile;
+
+  otrng_prekey_profile_free(otr->their_prekey_profile);
+  otr->their_prekey_profile = session.their_prekey_profile;
+
+  /* Sessions that are not encrypted start over with new keys */
+  if (!session.keys) {
+    session.keys = otrng_key_manager_new();
+  }
+
+  if (otr->keys) {
+    otrng_key_manager_free(otr->keys);
+  }
+  otr->keys = session.keys;
+  otrng_key_manager_set_footprint(otr->keys, &otr->footprint);
+  otrng_conversation_footprint_update(otr);
+
+  return OTRNG_SUCCESS;
+}
+
+INTERNAL otrng_result otrng_session_export(uint8_t **dst, size_t *dst_len,
+                                           const char *peer,
+                                           uint32_t our_instance_tag,
+                                           const otrng_s *otr) {
+  uint8_t *ser = NULL, *exported, *cursor;
+  size_t ser_len = 0, peer_len = strlen(peer), exported_len;
+
+  if (!otrng_session_serialize(&ser, &ser_len, otr)) {
+    return OTRNG_ERROR;
+  }
+
+  exported_len = 1 + 4 + 4 + peer_len + ser_len;
+  exported = otrng_secure_alloc(exported_len);
+  cursor = exported;
+
+  cursor += otrng_serialize_uint8(cursor, OTRNG_SESSION_EXPORT_VERSION);
+  cursor += otrng_serialize_uint32(cursor, our_instance_tag);
+  cursor += otrng_serialize_data(cursor, (const uint8_t *)peer, peer_len);
+  cursor += otrng_serialize_bytes_array(cursor, ser, ser_len);
+
+  otrng_session_free_serialized(ser, ser_len);
+
+  *dst = exported;
+  *dst_len = exported_len;
+
+  return OTRNG_SUCCESS;
+}
+
+INTERNAL otrng_result otrng_session_parse_export(
+    char **peer, uint32_t *our_instance_tag, const uint8_t **ser,
+    size_t *ser_len, const uint8_t *src, size_t src_len) {
+  uint8_t version = 0;
+  uint8_t *data = NULL;
+  size_t data_len = 0, w = 0, read = 0;
+
+  if (!otrng_deserialize_uint8(&version, src, src_len, &read) ||
+      version != OTRNG_SESSION_EXPORT_VERSION) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (!otrng_deserialize_uint32(our_instance_tag, src + w, src_len - w,
+                                &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (!otrng_deserialize_data(&data, &data_len, src + w, src_len - w,
+                              &read)) {
+    return OTRNG_ERROR;
+  }
+  w += read;
+
+  if (data_len == 0 || memchr(data, 0, data_len) || w == src_len) {
+    otrng_free(data);
+    return OTRNG_ERROR;
+  }
+
+  *peer = otrng_xmalloc_z(data_len + 1);
+  memcpy(*peer, data, data_len);
+  otrng_free(data);
+
+  *ser = src + w;
+  *ser_len = src_len - w;
+
+  return OTRNG_SUCCESS;
+}
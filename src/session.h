@@ -0,0 +1,105 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * The state of a conversation, serialized so that it can be restored later
+ * into the same otrng_s, or into a new one: the protocol state, the profiles
+ * of the peer and, for an encrypted session, the keys and counters of the
+ * double ratchet, with the skipped message keys and the mac keys still to be
+ * revealed.
+ *
+ * The serialized state holds secrets, so it lives in secure memory and has to
+ * be wiped once it is not needed.
+ *
+ * An exported session wraps the serialized state with what is needed to put
+ * it back into a client after a restart: the name of the peer and our
+ * instance tag, which the peer addresses its messages to.
+ */
+
+#ifndef OTRNG_SESSION_H
+#define OTRNG_SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "error.h"
+#include "protocol.h"
+#include "shared.h"
+
+/* The first byte of every serialized session */
+#define OTRNG_SESSION_VERSION 1
+
+/* The first byte of every exported session */
+#define OTRNG_SESSION_EXPORT_VERSION 1
+
+/**
+ * @brief Whether the state of [otr] can be serialized now. It can't while a
+ *    DAKE, an SMP or the reassembly of a fragmented message are in progress,
+ *    or for OTRv3 sessions, whose state is held by libotr.
+ **/
+INTERNAL otrng_bool otrng_session_can_serialize(const otrng_s *otr);
+
+/**
+ * @brief Serializes the state of [otr] into [dst], a buffer of [dst_len]
+ *    bytes of secure memory. It has to be released with
+ *    otrng_session_free_serialized.
+ **/
+INTERNAL otrng_result otrng_session_serialize(uint8_t **dst, size_t *dst_len,
+                                              const otrng_s *otr);
+
+/**
+ * @brief Restores into [otr] the state serialized in [src]. The keys and
+ *    profiles [otr] holds are replaced, and left as they were on failure.
+ **/
+INTERNAL otrng_result otrng_session_deserialize(otrng_s *otr,
+                                                const uint8_t *src,
+                                                size_t src_len);
+
+INTERNAL void otrng_session_free_serialized(/*@only@*/ uint8_t *ser,
+                                            size_t ser_len);
+
+/**
+ * @brief Exports the state of [otr], a conversation with [peer] of the client
+ *    whose instance tag is [our_instance_tag], into [dst]. Like a serialized
+ *    session, it has to be released with otrng_session_free_serialized.
+ **/
+INTERNAL otrng_result otrng_session_export(uint8_t **dst, size_t *dst_len,
+                                           const char *peer,
+                                           uint32_t our_instance_tag,
+                                           const otrng_s *otr);
+
+/**
+ * @brief Reads the envelope of the exported session [src]: the [peer], which
+ *    has to be freed, [our_instance_tag], and the serialized state, in
+ *    [ser], that points into [src].
+ **/
+INTERNAL otrng_result otrng_session_parse_export(
+    char **peer, uint32_t *our_instance_tag, const uint8_t **ser,
+    size_t *ser_len, const uint8_t *src, size_t src_len);
+
+#ifdef OTRNG_SESSION_PRIVATE
+
+tstatic size_t session_max_serialized_len(const otrng_s *otr,
+                                          size_t client_profile_len,
+                                          size_t prekey_profile_len);
+
+#endif
+
+#endif // OTRNG_SESSION_H
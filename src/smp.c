@@ -22,6 +22,7 @@
 #include "messaging.h"
 
 #include "alloc.h"
+#include "metrics.h"
 
 tstatic void handle_smp_event_cb_v4(const otrng_smp_event event,
                                     const uint8_t progress_percent,
@@ -153,9 +154,100 @@ otrng_process_smp(otrng_smp_event *ret, smp_protocol_s *smp, const tlv_s *tlv) {
   return to_send;
 }
 
+static /*@null@*/ tlv_s *process_smp(otrng_smp_event *event,
+                                     const tlv_s *tlv, otrng_s *otr) {
+  uint64_t start = otrng_metrics_start();
+  tlv_s *reply = otrng_process_smp(event, otr->smp, tlv);
+
+  otrng_metrics_record(otr->client->global_state, OTRNG_METRIC_SMP, start,
+                       *event == OTRNG_SMP_EVENT_ERROR ? OTRNG_ERROR
+                                                       : OTRNG_SUCCESS);
+  return reply;
+}
+
+tstatic void smp_job_run(void *data) {
+  smp_job_s *job = data;
+  smp_protocol_s *smp = job->conv->smp;
+
+  job->event = OTRNG_SMP_EVENT_NONE;
+  job->reply = process_smp(&job->event, job->tlv, job->conv);
+  job->progress = smp->progress;
+
+  /* Later jobs can change the SMP state before this one is completed */
+  if (smp->message1 && smp->message1->question) {
+    job->question = otrng_xmemdup(smp->message1->question,
+                                  smp->message1->q_len);
+    job->q_len = smp->message1->q_len;
+  }
+}
+
+static void smp_job_notify(void *data) {
+  smp_job_s *job = data;
+  otrng_client_callbacks_smp_async_done(
+      job->conv->client->global_state->callbacks, job->conv);
+}
+
+static void smp_job_free(void *data) {
+  smp_job_s *job = data;
+
+  otrng_tlv_free(job->tlv);
+  otrng_tlv_free(job->reply);
+  otrng_free(job->question);
+  otrng_free_in(OTRNG_ALLOC_SMP, job, sizeof(smp_job_s));
+}
+
+/*@null@*/ static otrng_worker_s *get_smp_worker(otrng_s *otr) {
+  otrng_global_state_s *gs = otr->client->global_state;
+
+  if (!gs->smp_worker) {
+    /* One thread is enough to keep the jobs of a conversation in order */
+    gs->smp_worker = otrng_worker_new(1);
+  }
+
+  return gs->smp_worker;
+}
+
+tstatic otrng_result smp_queue_job(const tlv_s *tlv, otrng_s *otr) {
+  otrng_worker_s *worker = get_smp_worker(otr);
+  smp_job_s *job;
+
+  if (!worker) {
+    return OTRNG_ERROR;
+  }
+
+  job = otrng_xmalloc_in(OTRNG_ALLOC_SMP, sizeof(smp_job_s));
+  job->tlv = otrng_tlv_copy(tlv);
+  if (!job->tlv) {
+    otrng_free_in(OTRNG_ALLOC_SMP, job, sizeof(smp_job_s));
+    return OTRNG_ERROR;
+  }
+
+  job->worker = worker;
+  job->conv = otr;
+  job->job.run = smp_job_run;
+  job->job.notify = smp_job_notify;
+  job->job.data = job;
+
+  otr->smp_jobs = otrng_list_add(job, otr->smp_jobs);
+  otrng_worker_submit(worker, &job->job);
+
+  return OTRNG_SUCCESS;
+}
+
 INTERNAL tlv_s *otrng_process_smp_tlv(const tlv_s *tlv, otrng_s *otr) {
   otrng_smp_event event = OTRNG_SMP_EVENT_NONE;
-  tlv_s *out = otrng_process_smp(&event, otr->smp, tlv);
+  tlv_s *out;
+
+  /* While there are jobs in flight, the SMP state belongs to the worker, so
+     every TLV after them is queued as well - even if the mode was turned off
+     in the meantime */
+  if (otr->client->smp_async || otr->smp_jobs) {
+    if (otrng_succeeded(smp_queue_job(tlv, otr)) || otr->smp_jobs) {
+      return NULL;
+    }
+  }
+
+  out = process_smp(&event, tlv, otr);
   handle_smp_event_cb_v4(
       event, otr->smp->progress,
       otr->smp->message1 ? otr->smp->message1->question : NULL,
@@ -164,6 +256,69 @@ INTERNAL tlv_s *otrng_process_smp_tlv(const tlv_s *tlv, otrng_s *otr) {
   return out;
 }
 
+API otrng_result otrng_smp_async_complete(string_p *to_send, otrng_s *otr) {
+  tlv_list_s *tlvs = NULL, *tmp;
+  list_element_s *head;
+  smp_job_s *job;
+  otrng_result ret;
+
+  while (otr->smp_jobs) {
+    head = otr->smp_jobs;
+    job = head->data;
+
+    if (!otrng_worker_job_ready(job->worker, &job->job)) {
+      break;
+    }
+
+    /* Only the notification can be running at this point */
+    otrng_worker_job_wait(job->worker, &job->job);
+
+    otr->smp_jobs = otrng_list_remove_element(head, otr->smp_jobs);
+    otrng_list_free_nodes(head);
+
+    handle_smp_event_cb_v4(job->event, job->progress, job->question,
+                           job->q_len, otr);
+
+    if (job->reply) {
+      tmp = otrng_append_tlv(tlvs, job->reply);
+      if (tmp) {
+        tlvs = tmp;
+        job->reply = NULL;
+      }
+    }
+
+    smp_job_free(job);
+  }
+
+  if (!tlvs) {
+    return OTRNG_SUCCESS;
+  }
+
+  ret = otrng_send_message(to_send, "", tlvs, MSG_FLAGS_IGNORE_UNREADABLE, otr);
+  otrng_tlv_list_free(tlvs);
+
+  return ret;
+}
+
+INTERNAL void otrng_smp_async_drain(otrng_s *otr) {
+  list_element_s *current;
+  smp_job_s *job;
+
+  /* Nothing else is touched when there is nothing queued: this is called
+     when a conversation is destroyed, and its client can already be gone */
+  if (!otr->smp_jobs) {
+    return;
+  }
+
+  for (current = otr->smp_jobs; current; current = current->next) {
+    job = current->data;
+    otrng_worker_job_wait(job->worker, &job->job);
+  }
+
+  otrng_list_free(otr->smp_jobs, smp_job_free);
+  otr->smp_jobs = NULL;
+}
+
 /*@null@*/ tstatic tlv_s *
 otrng_smp_initiate(const otrng_client_profile_s *initiator_profile,
                    const otrng_client_profile_s *responder_profile,
@@ -238,6 +393,7 @@ INTERNAL otrng_result otrng_smp_start(string_p *to_send,
   tlv_s *smp_start_tlv;
   tlv_list_s *tlvs;
   otrng_result ret;
+  uint64_t start;
 
   if (!otr) {
     return OTRNG_ERROR;
@@ -253,9 +409,17 @@ INTERNAL otrng_result otrng_smp_start(string_p *to_send,
       return OTRNG_ERROR;
     }
 
+    /* The SMP state is in use by the worker */
+    if (otr->smp_jobs) {
+      return OTRNG_ERROR;
+    }
+
+    start = otrng_metrics_start();
     smp_start_tlv = otrng_smp_initiate(
         get_my_client_profile(otr), otr->their_client_profile, question, q_len,
         answer, answer_len, otr->keys->ssid, otr->smp, otr);
+    otrng_metrics_record(otr->client->global_state, OTRNG_METRIC_SMP, start,
+                         smp_start_tlv ? OTRNG_SUCCESS : OTRNG_ERROR);
 
     if (!smp_start_tlv) {
       return OTRNG_ERROR;
@@ -318,15 +482,24 @@ tstatic otrng_result smp_continue_v4(string_p *to_send, const uint8_t *secret,
   otrng_smp_event event;
   tlv_list_s *tlvs;
   otrng_result ret;
+  uint64_t start;
 
   if (!otr) {
     return OTRNG_ERROR;
   }
 
+  /* The SMP state is in use by the worker */
+  if (otr->smp_jobs) {
+    return OTRNG_ERROR;
+  }
+
   event = OTRNG_SMP_EVENT_NONE;
+  start = otrng_metrics_start();
   tlvs = otrng_tlv_list_one(otrng_smp_provide_secret(
       &event, otr->smp, get_my_client_profile(otr), otr->their_client_profile,
       otr->keys->ssid, secret, secret_len));
+  otrng_metrics_record(otr->client->global_state, OTRNG_METRIC_SMP, start,
+                       tlvs ? OTRNG_SUCCESS : OTRNG_ERROR);
 
   if (!tlvs) {
     return OTRNG_ERROR;
@@ -375,6 +548,9 @@ tstatic otrng_result otrng_smp_abort_v4(string_p *to_send, otrng_s *otr) {
     return OTRNG_ERROR;
   }
 
+  /* Whatever the worker is doing is thrown away by the abort */
+  otrng_smp_async_drain(otr);
+
   otr->smp->state_expect = SMP_STATE_EXPECT_1;
   ret = otrng_prepare_to_send_data_message(to_send, "", tlvs, otr,
                                            MSG_FLAGS_IGNORE_UNREADABLE);
@@ -31,7 +31,35 @@
 #include "protocol.h"
 #include "shared.h"
 #include "tlv.h"
+#include "worker.h"
 
+/**
+ * @brief The smp_job_s structure represents one received SMP TLV that is
+ *    being processed off the messaging thread.
+ *
+ * While there are jobs in flight for a conversation, the SMP state of that
+ * conversation belongs to the worker and is not touched by anything else.
+ * The result fields are only valid once the job is ready.
+ **/
+typedef struct smp_job_s {
+  otrng_worker_job_s job;
+  /* The worker it was queued on. The job can outlive the client of [conv],
+     when a global state is freed before its conversations */
+  otrng_worker_s *worker;
+  otrng_s *conv;
+  tlv_s *tlv;
+
+  otrng_smp_event event;
+  uint8_t progress;
+  /*@null@*/ uint8_t *question;
+  size_t q_len;
+  /*@null@*/ tlv_s *reply;
+} smp_job_s;
+
+/**
+ * @brief Processes a received SMP TLV. [tlv] can borrow its data from the
+ *    received message, since it is only copied if it has to be queued.
+ **/
 /*@null@*/ INTERNAL tlv_s *otrng_process_smp_tlv(const tlv_s *tlv,
                                                  otrng_s *otr);
 
@@ -46,8 +74,30 @@ INTERNAL otrng_result otrng_smp_continue(string_p *to_send,
 
 API otrng_result otrng_smp_abort(string_p *to_send, otrng_s *otr);
 
+/**
+ * @brief Collects the results of the asynchronous SMP jobs that are ready for
+ *    this conversation, in the order the TLVs were received.
+ *
+ * The SMP events for every job are reported through the usual callbacks, and
+ * the reply TLVs, if any, are put in a data message in [to_send]. Jobs that
+ * are still running are left for a later call.
+ *
+ * This must be called from the messaging thread.
+ **/
+API otrng_result otrng_smp_async_complete(string_p *to_send, otrng_s *otr);
+
+/**
+ * @brief Waits for all asynchronous SMP jobs of this conversation to finish
+ *    and discards their results.
+ **/
+INTERNAL void otrng_smp_async_drain(otrng_s *otr);
+
 #ifdef OTRNG_SMP_PRIVATE
 
+tstatic void smp_job_run(void *data);
+
+tstatic otrng_result smp_queue_job(const tlv_s *tlv, otrng_s *otr);
+
 /*@null@*/ tstatic tlv_s *
 otrng_smp_initiate(const otrng_client_profile_s *initiator_profile,
                    const otrng_client_profile_s *responder_profile,
@@ -60,7 +60,7 @@ static void test_api_interactive_conversation(void) {
     // Alice sends a data message
     result = otrng_send_message(&to_send, "hi", NULL, 0, alice);
     assert_message_sent(result, to_send);
-    otrng_assert(!alice->keys->old_mac_keys);
+    otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
     g_assert_cmpint(alice->keys->i, ==, 1);
     g_assert_cmpint(alice->keys->j, ==, message_id + 1);
@@ -75,11 +75,11 @@ static void test_api_interactive_conversation(void) {
     response_to_alice = otrng_response_new();
     result = otrng_receive_message(response_to_alice, to_send, bob);
     assert_message_rec(result, "hi", response_to_alice);
-    otrng_assert(bob->keys->old_mac_keys);
+    otrng_assert(otrng_vector_len(&bob->keys->old_mac_keys) > 0);
 
     free_message_and_response(response_to_alice, &to_send);
 
-    g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==,
+    g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==,
                     message_id + 1);
     g_assert_cmpint(bob->keys->i, ==, 1);
     g_assert_cmpint(bob->keys->j, ==, 0);
@@ -97,7 +97,7 @@ static void test_api_interactive_conversation(void) {
     result = otrng_send_message(&to_send, "hello", NULL, 0, bob);
     assert_message_sent(result, to_send);
 
-    g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 0);
+    g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 0);
 
     g_assert_cmpint(bob->keys->i, ==, 2);
     g_assert_cmpint(bob->keys->j, ==, message_id);
@@ -112,7 +112,8 @@ static void test_api_interactive_conversation(void) {
     response_to_bob = otrng_response_new();
     result = otrng_receive_message(response_to_bob, to_send, alice);
     assert_message_rec(result, "hello", response_to_bob);
-    g_assert_cmpint(otrng_list_len(alice->keys->old_mac_keys), ==, message_id);
+    g_assert_cmpint(otrng_vector_len(&alice->keys->old_mac_keys), ==,
+                    message_id);
 
     free_message_and_response(response_to_bob, &to_send);
 
@@ -133,13 +134,13 @@ static void test_api_interactive_conversation(void) {
   result = otrng_smp_start(&to_send, NULL, 0, secret_data, secret_len, bob);
   assert_message_sent(result, to_send);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 0);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 0);
 
   // Alice receives a data message with TLV
   response_to_bob = otrng_response_new();
   otrng_assert_is_success(
       otrng_receive_message(response_to_bob, to_send, alice));
-  g_assert_cmpint(otrng_list_len(alice->keys->old_mac_keys), ==, 4);
+  g_assert_cmpint(otrng_vector_len(&alice->keys->old_mac_keys), ==, 4);
 
   // Check TLVs
   otrng_assert(response_to_bob->tlvs);
@@ -253,7 +254,7 @@ static void test_otrng_send_offline_message() {
   for (message_id = 1; message_id < 4; message_id++) {
     result = otrng_send_message(&to_send, "hi", NULL, 0, alice);
     assert_message_sent(result, to_send);
-    otrng_assert(!alice->keys->old_mac_keys);
+    otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
     g_assert_cmpint(alice->keys->i, ==, 1);
     g_assert_cmpint(alice->keys->j, ==, message_id);
@@ -264,9 +265,9 @@ static void test_otrng_send_offline_message() {
     response_to_alice = otrng_response_new();
     result = otrng_receive_message(response_to_alice, to_send, bob);
     assert_message_rec(result, "hi", response_to_alice);
-    otrng_assert(bob->keys->old_mac_keys);
+    otrng_assert(otrng_vector_len(&bob->keys->old_mac_keys) > 0);
 
-    g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, message_id);
+    g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, message_id);
 
     g_assert_cmpint(bob->keys->i, ==, 1);
     g_assert_cmpint(bob->keys->j, ==, 0);
@@ -281,7 +282,7 @@ static void test_otrng_send_offline_message() {
     result = otrng_send_message(&to_send, "hello", NULL, 0, bob);
     assert_message_sent(result, to_send);
 
-    g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 0);
+    g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 0);
     g_assert_cmpint(bob->keys->i, ==, 2);
     g_assert_cmpint(bob->keys->j, ==, message_id);
     g_assert_cmpint(bob->keys->k, ==, 3);
@@ -291,7 +292,8 @@ static void test_otrng_send_offline_message() {
     response_to_bob = otrng_response_new();
     result = otrng_receive_message(response_to_bob, to_send, alice);
     assert_message_rec(result, "hello", response_to_bob);
-    g_assert_cmpint(otrng_list_len(alice->keys->old_mac_keys), ==, message_id);
+    g_assert_cmpint(otrng_vector_len(&alice->keys->old_mac_keys), ==,
+                    message_id);
 
     g_assert_cmpint(alice->keys->i, ==, 2);
     g_assert_cmpint(alice->keys->j, ==, 0);
@@ -308,13 +310,13 @@ static void test_otrng_send_offline_message() {
   result = otrng_smp_start(&to_send, NULL, 0, secret_data, secret_len, bob);
   assert_message_sent(result, to_send);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 0);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 0);
 
   // Alice receives a data message with TLV
   response_to_bob = otrng_response_new();
   otrng_assert_is_success(
       otrng_receive_message(response_to_bob, to_send, alice));
-  g_assert_cmpint(otrng_list_len(alice->keys->old_mac_keys), ==, 4);
+  g_assert_cmpint(otrng_vector_len(&alice->keys->old_mac_keys), ==, 4);
 
   // Check TLVS
   otrng_assert(response_to_bob->tlvs);
@@ -537,7 +539,7 @@ static void test_api_whitespace_tag(void) {
   otrng_assert(response_to_alice->to_display == NULL);
   otrng_assert(response_to_alice);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 1);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 1);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 1);
@@ -584,7 +586,7 @@ static void test_api_conversation_errors_1(void) {
   result = otrng_send_message(&to_send, "hi", NULL, 0, alice);
 
   assert_message_sent(result, to_send);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   g_assert_cmpint(alice->keys->i, ==, 1);
   g_assert_cmpint(alice->keys->j, ==, 2);
@@ -601,7 +603,7 @@ static void test_api_conversation_errors_1(void) {
   otrng_assert_cmpmem(err_code, response_to_alice->to_send, strlen(err_code));
 
   otrng_assert(response_to_alice->to_send != NULL);
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 1);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 1);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
 
@@ -704,7 +706,7 @@ static void test_api_conversation_errors_3(void) {
   // Alice sends a data message
   result = otrng_send_message(&to_send, "hi", NULL, 0, alice);
   assert_message_sent(result, to_send);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   // Corrupt message
   size_t dec_len = 0;
@@ -1238,7 +1240,7 @@ static void test_api_extra_sym_key(void) {
 
   result = otrng_send_message(&to_send, "hi", NULL, 0, alice);
   assert_message_sent(result, to_send);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   // This is a follow up message.
   g_assert_cmpint(alice->keys->i, ==, 1);
@@ -1248,9 +1250,9 @@ static void test_api_extra_sym_key(void) {
   response_to_alice = otrng_response_new();
   result = otrng_receive_message(response_to_alice, to_send, bob);
   assert_message_rec(result, "hi", response_to_alice);
-  otrng_assert(bob->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&bob->keys->old_mac_keys) > 0);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 2);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 2);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 2);
@@ -1267,13 +1269,13 @@ static void test_api_extra_sym_key(void) {
                                      bob->keys->extra_symmetric_key, bob);
   assert_message_sent(result, to_send);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 0);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 0);
 
   // Alice receives a data message with TLV
   response_to_bob = otrng_response_new();
   otrng_assert_is_success(
       otrng_receive_message(response_to_bob, to_send, alice));
-  g_assert_cmpint(otrng_list_len(alice->keys->old_mac_keys), ==, 1);
+  g_assert_cmpint(otrng_vector_len(&alice->keys->old_mac_keys), ==, 1);
 
   // Check TLVS
   otrng_assert(response_to_bob->tlvs);
@@ -1312,21 +1314,21 @@ static void test_heartbeat_messages(void) {
 
   result = otrng_send_message(&to_send, "hi", NULL, 0, alice);
   assert_message_sent(result, to_send);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   // bob->last_sent = time(NULL) - 60;
 
   g_assert_cmpint(alice->keys->i, ==, 1);
   g_assert_cmpint(alice->keys->j, ==, 2);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 1);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 1);
 
   // Bob receives a data message
   // Bob sends a heartbeat message
   response_to_alice = otrng_response_new();
   otrng_assert_is_success(
       otrng_receive_message(response_to_alice, to_send, bob));
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 0);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 0);
 
   otrng_assert_cmpmem("hi", response_to_alice->to_display, strlen("hi") + 1);
   otrng_assert(response_to_alice->to_send != NULL);
@@ -1340,7 +1342,7 @@ static void test_heartbeat_messages(void) {
   response_to_bob = otrng_response_new();
   otrng_assert_is_success(otrng_receive_message(
       response_to_bob, response_to_alice->to_send, alice));
-  otrng_assert(alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) > 0);
   otrng_assert(!response_to_bob->to_display);
   otrng_assert(!response_to_bob->to_send);
   g_assert_cmpint(alice->keys->i, ==, 2);
@@ -1037,11 +1037,11 @@ static void test_client_expires_old_fragments(void) {
 
   otrng_conversation_s *conv =
       otrng_client_get_conversation(0, BOB_ACCOUNT, alice);
-  g_assert_cmpint(otrng_list_len(conv->conn->pending_fragments), ==, 1);
+  g_assert_cmpint(otrng_tail_list_len(&conv->conn->pending_fragments), ==, 1);
 
   otrng_client_expire_fragments(alice);
 
-  g_assert_cmpint(otrng_list_len(conv->conn->pending_fragments), ==, 0);
+  g_assert_cmpint(otrng_tail_list_len(&conv->conn->pending_fragments), ==, 0);
 
   otrng_free(to_display);
   otrng_message_free(fmessage);
@@ -24,6 +24,8 @@
 
 #include "test_fixtures.h"
 
+#include "footprint.h"
+
 /* Test the an in-order sending and receiving double ratchet */
 static void test_double_ratchet_new_sending_ratchet_in_order(void) {
   otrng_client_s *alice_client = otrng_client_new(ALICE_IDENTITY);
@@ -48,7 +50,7 @@ static void test_double_ratchet_new_sending_ratchet_in_order(void) {
   // Alice sends a data message
   result = otrng_send_message(&to_send_1, "hi", NULL, 0, alice);
   assert_message_sent(result, to_send_1);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   g_assert_cmpint(alice->keys->i, ==, 1);
   g_assert_cmpint(alice->keys->j, ==, 2);
@@ -57,7 +59,7 @@ static void test_double_ratchet_new_sending_ratchet_in_order(void) {
 
   result = otrng_send_message(&to_send_2, "how are you?", NULL, 0, alice);
   assert_message_sent(result, to_send_2);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   g_assert_cmpint(alice->keys->i, ==, 1);
   g_assert_cmpint(alice->keys->j, ==, 3);
@@ -66,7 +68,7 @@ static void test_double_ratchet_new_sending_ratchet_in_order(void) {
 
   result = otrng_send_message(&to_send_3, "it's me", NULL, 0, alice);
   assert_message_sent(result, to_send_3);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   g_assert_cmpint(alice->keys->i, ==, 1);
   g_assert_cmpint(alice->keys->j, ==, 4);
@@ -77,11 +79,11 @@ static void test_double_ratchet_new_sending_ratchet_in_order(void) {
   response_to_alice = otrng_response_new();
   result = otrng_receive_message(response_to_alice, to_send_1, bob);
   assert_message_rec(result, "hi", response_to_alice);
-  otrng_assert(bob->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&bob->keys->old_mac_keys) > 0);
 
   free_message_and_response(response_to_alice, &to_send_1);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 2);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 2);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 2);
@@ -90,11 +92,11 @@ static void test_double_ratchet_new_sending_ratchet_in_order(void) {
   response_to_alice = otrng_response_new();
   result = otrng_receive_message(response_to_alice, to_send_2, bob);
   assert_message_rec(result, "how are you?", response_to_alice);
-  otrng_assert(bob->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&bob->keys->old_mac_keys) > 0);
 
   free_message_and_response(response_to_alice, &to_send_2);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 3);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 3);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 3);
@@ -104,7 +106,7 @@ static void test_double_ratchet_new_sending_ratchet_in_order(void) {
   result = otrng_send_message(&to_send_4, "oh, hi", NULL, 0, bob);
   assert_message_sent(result, to_send_4);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 0);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 0);
 
   g_assert_cmpint(bob->keys->i, ==, 2);
   g_assert_cmpint(bob->keys->j, ==, 1);
@@ -115,11 +117,11 @@ static void test_double_ratchet_new_sending_ratchet_in_order(void) {
   response_to_alice = otrng_response_new();
   result = otrng_receive_message(response_to_alice, to_send_3, bob);
   assert_message_rec(result, "it's me", response_to_alice);
-  otrng_assert(bob->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&bob->keys->old_mac_keys) > 0);
 
   free_message_and_response(response_to_alice, &to_send_3);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 1);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 1);
   g_assert_cmpint(bob->keys->i, ==, 2);
   g_assert_cmpint(bob->keys->j, ==, 1);
   g_assert_cmpint(bob->keys->k, ==, 4);
@@ -129,7 +131,7 @@ static void test_double_ratchet_new_sending_ratchet_in_order(void) {
   response_to_bob = otrng_response_new();
   result = otrng_receive_message(response_to_bob, to_send_4, alice);
   assert_message_rec(result, "oh, hi", response_to_bob);
-  g_assert_cmpint(otrng_list_len(alice->keys->old_mac_keys), ==, 1);
+  g_assert_cmpint(otrng_vector_len(&alice->keys->old_mac_keys), ==, 1);
 
   free_message_and_response(response_to_bob, &to_send_4);
   g_assert_cmpint(alice->keys->i, ==, 2);
@@ -141,7 +143,7 @@ static void test_double_ratchet_new_sending_ratchet_in_order(void) {
   result = otrng_send_message(&to_send_5, "I'm good", NULL, 0, bob);
   assert_message_sent(result, to_send_5);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 1);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 1);
 
   g_assert_cmpint(bob->keys->i, ==, 2);
   g_assert_cmpint(bob->keys->j, ==, 2);
@@ -152,7 +154,7 @@ static void test_double_ratchet_new_sending_ratchet_in_order(void) {
   response_to_bob = otrng_response_new();
   result = otrng_receive_message(response_to_bob, to_send_5, alice);
   assert_message_rec(result, "I'm good", response_to_bob);
-  g_assert_cmpint(otrng_list_len(alice->keys->old_mac_keys), ==, 2);
+  g_assert_cmpint(otrng_vector_len(&alice->keys->old_mac_keys), ==, 2);
 
   free_message_and_response(response_to_bob, &to_send_5);
   g_assert_cmpint(alice->keys->i, ==, 2);
@@ -188,7 +190,7 @@ static void test_double_ratchet_same_ratchet_out_of_order(void) {
 
   result = otrng_send_message(&to_send_1, "hi", NULL, 0, alice);
   assert_message_sent(result, to_send_1);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   g_assert_cmpint(alice->keys->i, ==, 1);
   g_assert_cmpint(alice->keys->j, ==, 2);
@@ -197,7 +199,7 @@ static void test_double_ratchet_same_ratchet_out_of_order(void) {
 
   result = otrng_send_message(&to_send_2, "how are you?", NULL, 0, alice);
   assert_message_sent(result, to_send_2);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   g_assert_cmpint(alice->keys->i, ==, 1);
   g_assert_cmpint(alice->keys->j, ==, 3);
@@ -206,7 +208,7 @@ static void test_double_ratchet_same_ratchet_out_of_order(void) {
 
   result = otrng_send_message(&to_send_3, "it's me", NULL, 0, alice);
   assert_message_sent(result, to_send_3);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   g_assert_cmpint(alice->keys->i, ==, 1);
   g_assert_cmpint(alice->keys->j, ==, 4);
@@ -215,7 +217,7 @@ static void test_double_ratchet_same_ratchet_out_of_order(void) {
 
   result = otrng_send_message(&to_send_4, "ok?", NULL, 0, alice);
   assert_message_sent(result, to_send_4);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   g_assert_cmpint(alice->keys->i, ==, 1);
   g_assert_cmpint(alice->keys->j, ==, 5);
@@ -226,11 +228,11 @@ static void test_double_ratchet_same_ratchet_out_of_order(void) {
   response_to_alice = otrng_response_new();
   result = otrng_receive_message(response_to_alice, to_send_1, bob);
   assert_message_rec(result, "hi", response_to_alice);
-  otrng_assert(bob->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&bob->keys->old_mac_keys) > 0);
 
   free_message_and_response(response_to_alice, &to_send_1);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 2);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 2);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 2);
@@ -239,39 +241,45 @@ static void test_double_ratchet_same_ratchet_out_of_order(void) {
   response_to_alice = otrng_response_new();
   result = otrng_receive_message(response_to_alice, to_send_4, bob);
   assert_message_rec(result, "ok?", response_to_alice);
-  otrng_assert(bob->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&bob->keys->old_mac_keys) > 0);
 
   free_message_and_response(response_to_alice, &to_send_4);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 3);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 3);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 5);
   g_assert_cmpint(bob->keys->pn, ==, 0);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 2);
+  g_assert_cmpint(otrng_tail_list_len(&bob->keys->skipped_keys), ==, 2);
+  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys.head), ==, 2);
+
+  otrng_footprint_s footprint;
+  otrng_conversation_footprint(&footprint, bob);
+  g_assert_cmpuint(footprint.skipped_keys, ==,
+                   2 * (sizeof(skipped_keys_s) + sizeof(list_element_s)));
 
   response_to_alice = otrng_response_new();
   result = otrng_receive_message(response_to_alice, to_send_3, bob);
   assert_message_rec(result, "it's me", response_to_alice);
-  otrng_assert(bob->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&bob->keys->old_mac_keys) > 0);
 
   free_message_and_response(response_to_alice, &to_send_3);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 4);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 4);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 5);
   g_assert_cmpint(bob->keys->pn, ==, 0);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 1);
+  g_assert_cmpint(otrng_tail_list_len(&bob->keys->skipped_keys), ==, 1);
 
   response_to_alice = otrng_response_new();
   result = otrng_receive_message(response_to_alice, to_send_2, bob);
   assert_message_rec(result, "how are you?", response_to_alice);
-  otrng_assert(bob->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&bob->keys->old_mac_keys) > 0);
 
   free_message_and_response(response_to_alice, &to_send_2);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 5);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 5);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 5);
@@ -306,7 +314,7 @@ static void test_double_ratchet_new_ratchet_out_of_order(void) {
   // Alice sends a data message
   result = otrng_send_message(&to_send_1, "hi", NULL, 0, alice);
   assert_message_sent(result, to_send_1);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   g_assert_cmpint(alice->keys->i, ==, 1);
   g_assert_cmpint(alice->keys->j, ==, 2);
@@ -315,7 +323,7 @@ static void test_double_ratchet_new_ratchet_out_of_order(void) {
 
   result = otrng_send_message(&to_send_2, "how are you?", NULL, 0, alice);
   assert_message_sent(result, to_send_2);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   g_assert_cmpint(alice->keys->i, ==, 1);
   g_assert_cmpint(alice->keys->j, ==, 3);
@@ -324,7 +332,7 @@ static void test_double_ratchet_new_ratchet_out_of_order(void) {
 
   result = otrng_send_message(&to_send_3, "it's me", NULL, 0, alice);
   assert_message_sent(result, to_send_3);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   g_assert_cmpint(alice->keys->i, ==, 1);
   g_assert_cmpint(alice->keys->j, ==, 4);
@@ -335,11 +343,11 @@ static void test_double_ratchet_new_ratchet_out_of_order(void) {
   response_to_alice = otrng_response_new();
   result = otrng_receive_message(response_to_alice, to_send_1, bob);
   assert_message_rec(result, "hi", response_to_alice);
-  otrng_assert(bob->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&bob->keys->old_mac_keys) > 0);
 
   free_message_and_response(response_to_alice, &to_send_1);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 2);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 2);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 2);
@@ -351,8 +359,8 @@ static void test_double_ratchet_new_ratchet_out_of_order(void) {
 
   free_message_and_response(response_to_alice, &to_send_2);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 3);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 0);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 3);
+  g_assert_cmpint(otrng_tail_list_len(&bob->keys->skipped_keys), ==, 0);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 3);
@@ -362,7 +370,7 @@ static void test_double_ratchet_new_ratchet_out_of_order(void) {
   result = otrng_send_message(&to_send_4, "oh, hi", NULL, 0, bob);
   assert_message_sent(result, to_send_4);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 0);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 0);
 
   g_assert_cmpint(bob->keys->i, ==, 2);
   g_assert_cmpint(bob->keys->j, ==, 1);
@@ -373,7 +381,7 @@ static void test_double_ratchet_new_ratchet_out_of_order(void) {
   response_to_bob = otrng_response_new();
   result = otrng_receive_message(response_to_bob, to_send_4, alice);
   assert_message_rec(result, "oh, hi", response_to_bob);
-  g_assert_cmpint(otrng_list_len(alice->keys->old_mac_keys), ==, 1);
+  g_assert_cmpint(otrng_vector_len(&alice->keys->old_mac_keys), ==, 1);
 
   free_message_and_response(response_to_bob, &to_send_4);
   g_assert_cmpint(alice->keys->i, ==, 2);
@@ -385,7 +393,7 @@ static void test_double_ratchet_new_ratchet_out_of_order(void) {
   result = otrng_send_message(&to_send_5, "good", NULL, 0, alice);
   assert_message_sent(result, to_send_5);
 
-  g_assert_cmpint(otrng_list_len(alice->keys->old_mac_keys), ==, 0);
+  g_assert_cmpint(otrng_vector_len(&alice->keys->old_mac_keys), ==, 0);
 
   g_assert_cmpint(alice->keys->i, ==, 3);
   g_assert_cmpint(alice->keys->j, ==, 1);
@@ -396,16 +404,16 @@ static void test_double_ratchet_new_ratchet_out_of_order(void) {
   response_to_alice = otrng_response_new();
   result = otrng_receive_message(response_to_alice, to_send_5, bob);
   assert_message_rec(result, "good", response_to_alice);
-  otrng_assert(bob->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&bob->keys->old_mac_keys) > 0);
 
   free_message_and_response(response_to_alice, &to_send_5);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 1);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 1);
   g_assert_cmpint(bob->keys->i, ==, 3);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 1);
   g_assert_cmpint(bob->keys->pn, ==, 1);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 1);
+  g_assert_cmpint(otrng_tail_list_len(&bob->keys->skipped_keys), ==, 1);
 
   // Bob receives the previous data message
   response_to_alice = otrng_response_new();
@@ -414,8 +422,8 @@ static void test_double_ratchet_new_ratchet_out_of_order(void) {
 
   free_message_and_response(response_to_alice, &to_send_3);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 2);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 0);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 2);
+  g_assert_cmpint(otrng_tail_list_len(&bob->keys->skipped_keys), ==, 0);
   g_assert_cmpint(bob->keys->i, ==, 3);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 1);
@@ -451,7 +459,7 @@ static void test_double_ratchet_new_ratchet_out_of_order_2(void) {
   // Alice sends a data message
   result = otrng_send_message(&to_send_1, "hi", NULL, 0, alice);
   assert_message_sent(result, to_send_1);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   g_assert_cmpint(alice->keys->i, ==, 1);
   g_assert_cmpint(alice->keys->j, ==, 2);
@@ -460,7 +468,7 @@ static void test_double_ratchet_new_ratchet_out_of_order_2(void) {
 
   result = otrng_send_message(&to_send_2, "how are you?", NULL, 0, alice);
   assert_message_sent(result, to_send_2);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   g_assert_cmpint(alice->keys->i, ==, 1);
   g_assert_cmpint(alice->keys->j, ==, 3);
@@ -469,7 +477,7 @@ static void test_double_ratchet_new_ratchet_out_of_order_2(void) {
 
   result = otrng_send_message(&to_send_3, "it's me", NULL, 0, alice);
   assert_message_sent(result, to_send_3);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   g_assert_cmpint(alice->keys->i, ==, 1);
   g_assert_cmpint(alice->keys->j, ==, 4);
@@ -480,11 +488,11 @@ static void test_double_ratchet_new_ratchet_out_of_order_2(void) {
   response_to_alice = otrng_response_new();
   result = otrng_receive_message(response_to_alice, to_send_1, bob);
   assert_message_rec(result, "hi", response_to_alice);
-  otrng_assert(bob->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&bob->keys->old_mac_keys) > 0);
 
   free_message_and_response(response_to_alice, &to_send_1);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 2);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 2);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 2);
@@ -496,8 +504,8 @@ static void test_double_ratchet_new_ratchet_out_of_order_2(void) {
 
   free_message_and_response(response_to_alice, &to_send_2);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 3);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 0);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 3);
+  g_assert_cmpint(otrng_tail_list_len(&bob->keys->skipped_keys), ==, 0);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 3);
@@ -507,7 +515,7 @@ static void test_double_ratchet_new_ratchet_out_of_order_2(void) {
   result = otrng_send_message(&to_send_4, "oh, hi", NULL, 0, bob);
   assert_message_sent(result, to_send_4);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 0);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 0);
 
   g_assert_cmpint(bob->keys->i, ==, 2);
   g_assert_cmpint(bob->keys->j, ==, 1);
@@ -518,7 +526,7 @@ static void test_double_ratchet_new_ratchet_out_of_order_2(void) {
   result = otrng_send_message(&to_send_6, "and test", NULL, 0, bob);
   assert_message_sent(result, to_send_6);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 0);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 0);
 
   g_assert_cmpint(bob->keys->i, ==, 2);
   g_assert_cmpint(bob->keys->j, ==, 2);
@@ -529,7 +537,7 @@ static void test_double_ratchet_new_ratchet_out_of_order_2(void) {
   response_to_bob = otrng_response_new();
   result = otrng_receive_message(response_to_bob, to_send_6, alice);
   assert_message_rec(result, "and test", response_to_bob);
-  g_assert_cmpint(otrng_list_len(alice->keys->old_mac_keys), ==, 1);
+  g_assert_cmpint(otrng_vector_len(&alice->keys->old_mac_keys), ==, 1);
 
   free_message_and_response(response_to_bob, &to_send_6);
 
@@ -542,7 +550,7 @@ static void test_double_ratchet_new_ratchet_out_of_order_2(void) {
   response_to_bob = otrng_response_new();
   result = otrng_receive_message(response_to_bob, to_send_4, alice);
   assert_message_rec(result, "oh, hi", response_to_bob);
-  g_assert_cmpint(otrng_list_len(alice->keys->old_mac_keys), ==, 2);
+  g_assert_cmpint(otrng_vector_len(&alice->keys->old_mac_keys), ==, 2);
 
   free_message_and_response(response_to_bob, &to_send_4);
 
@@ -555,7 +563,7 @@ static void test_double_ratchet_new_ratchet_out_of_order_2(void) {
   result = otrng_send_message(&to_send_5, "good", NULL, 0, alice);
   assert_message_sent(result, to_send_5);
 
-  g_assert_cmpint(otrng_list_len(alice->keys->old_mac_keys), ==, 0);
+  g_assert_cmpint(otrng_vector_len(&alice->keys->old_mac_keys), ==, 0);
 
   g_assert_cmpint(alice->keys->i, ==, 3);
   g_assert_cmpint(alice->keys->j, ==, 1);
@@ -566,16 +574,16 @@ static void test_double_ratchet_new_ratchet_out_of_order_2(void) {
   response_to_alice = otrng_response_new();
   result = otrng_receive_message(response_to_alice, to_send_5, bob);
   assert_message_rec(result, "good", response_to_alice);
-  otrng_assert(bob->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&bob->keys->old_mac_keys) > 0);
 
   free_message_and_response(response_to_alice, &to_send_5);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 1);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 1);
   g_assert_cmpint(bob->keys->i, ==, 3);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 1);
   g_assert_cmpint(bob->keys->pn, ==, 2);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 1);
+  g_assert_cmpint(otrng_tail_list_len(&bob->keys->skipped_keys), ==, 1);
 
   // Bob receives the previous data message
   response_to_alice = otrng_response_new();
@@ -584,8 +592,8 @@ static void test_double_ratchet_new_ratchet_out_of_order_2(void) {
 
   free_message_and_response(response_to_alice, &to_send_3);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 2);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 0);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 2);
+  g_assert_cmpint(otrng_tail_list_len(&bob->keys->skipped_keys), ==, 0);
   g_assert_cmpint(bob->keys->i, ==, 3);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 1);
@@ -616,7 +624,7 @@ static void test_double_ratchet_corrupted_ratchet(void) {
   // Alice sends a data message
   result = otrng_send_message(&to_send_1, "hi", NULL, 0, alice);
   assert_message_sent(result, to_send_1);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   g_assert_cmpint(alice->keys->i, ==, 1);
   g_assert_cmpint(alice->keys->j, ==, 2);
@@ -646,11 +654,11 @@ static void test_double_ratchet_corrupted_ratchet(void) {
   response_to_alice = otrng_response_new();
   result = otrng_receive_message(response_to_alice, to_send_1, bob);
   assert_message_rec(result, "hi", response_to_alice);
-  otrng_assert(bob->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&bob->keys->old_mac_keys) > 0);
 
   free_message_and_response(response_to_alice, &to_send_1);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 2);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 2);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 2);
@@ -662,8 +670,8 @@ static void test_double_ratchet_corrupted_ratchet(void) {
       otrng_receive_message(response_to_alice, to_send_2, bob));
   free_message_and_response(response_to_alice, &to_send_2);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 2);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 0);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 2);
+  g_assert_cmpint(otrng_tail_list_len(&bob->keys->skipped_keys), ==, 0);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 2);
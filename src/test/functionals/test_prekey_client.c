@@ -74,13 +74,14 @@ static void test_send_dake_3_message_with_storage_info_request(void) {
   otrng_prekey_provide_server_identity_for(alice, "jabber.localhost",
                                            "prekey@localhost", fpr);
 
-  alice->prekey_manager->request_for_account = create_prekey_request(
+  otrng_prekey_request_s *request = create_prekey_request(
       otrng_prekey_get_server_identity_for(alice, "jabber.localhost"), NULL);
-  alice->prekey_manager->request_for_account->after_dake =
-      storage_request_after_dake;
+  request->after_dake = storage_request_after_dake;
+  otrng_assert_is_success(
+      prekey_manager_register_request(alice->prekey_manager, request));
 
-  otrng_assert_is_success(otrng_ecdh_keypair_generate(
-      alice->prekey_manager->request_for_account->ephemeral_ecdh, sym));
+  otrng_assert_is_success(
+      otrng_ecdh_keypair_generate(request->ephemeral_ecdh, sym));
 
   otrng_prekey_dake2_message_s message;
   otrng_prekey_dake2_message_init(&message);
@@ -123,8 +124,7 @@ static void test_send_dake_3_message_with_storage_info_request(void) {
   memcpy(message.composite_identity, composite_identity,
          message.composite_identity_len);
 
-  char *dake_3 =
-      send_dake3(alice, alice->prekey_manager->request_for_account, &message);
+  char *dake_3 = send_dake3(alice, request, &message);
 
   otrng_assert(dake_3);
 
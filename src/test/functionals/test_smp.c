@@ -313,9 +313,104 @@ static void test_otrng_smp_message_1_serialize_null_question(void) {
   otrng_free(buff);
 }
 
+static void test_smp_state_machine_async(void) {
+  OTRNG_INIT;
+
+  otrng_client_s *alice_state = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *bob_state = otrng_client_new(BOB_IDENTITY);
+
+  otrng_s *alice = set_up(alice_state, 1);
+  otrng_s *bob = set_up(bob_state, 2);
+
+  do_dake_fixture(alice, bob);
+  otrng_client_set_smp_async(otrng_true, bob_state);
+
+  const uint8_t *question = (const uint8_t *)"some-question";
+  tlv_s *tlv_smp_1 = otrng_smp_initiate(
+      get_my_client_profile(alice), alice->their_client_profile, question, 13,
+      (const uint8_t *)"answer", strlen("answer"), alice->keys->ssid,
+      alice->smp, alice);
+  otrng_assert(tlv_smp_1);
+
+  // Bob queues the first message and returns immediately
+  otrng_assert(!process_tlv(tlv_smp_1, bob));
+  otrng_tlv_free(tlv_smp_1);
+  otrng_assert(bob->smp_jobs);
+  otrng_assert(bob_state->global_state->smp_worker);
+
+  // Bob can't touch the SMP state while the job is in flight
+  string_p to_send = NULL;
+  otrng_assert_is_error(otrng_smp_continue(&to_send, (const uint8_t *)"answer",
+                                           strlen("answer"), bob));
+  otrng_assert(!to_send);
+
+  otrng_worker_wait(bob_state->global_state->smp_worker);
+  otrng_assert_is_success(otrng_smp_async_complete(&to_send, bob));
+  otrng_assert(!to_send);
+  otrng_assert(!bob->smp_jobs);
+  g_assert_cmpint(bob->smp->progress, ==, SMP_QUARTER_PROGRESS);
+  g_assert_cmpint(bob->smp->state_expect, ==, SMP_STATE_EXPECT_1);
+
+  otrng_smp_event event = OTRNG_SMP_EVENT_NONE;
+  tlv_s *tlv_smp_2 = otrng_smp_provide_secret(
+      &event, bob->smp, get_my_client_profile(bob), bob->their_client_profile,
+      bob->keys->ssid, (const uint8_t *)"answer", strlen("answer"));
+  otrng_assert(tlv_smp_2);
+
+  tlv_s *tlv_smp_3 = process_tlv(tlv_smp_2, alice);
+  otrng_tlv_free(tlv_smp_2);
+  otrng_assert(tlv_smp_3);
+
+  // Bob's reply is only available after the job has been completed
+  otrng_assert(!process_tlv(tlv_smp_3, bob));
+  otrng_tlv_free(tlv_smp_3);
+
+  otrng_worker_wait(bob_state->global_state->smp_worker);
+  otrng_assert_is_success(otrng_smp_async_complete(&to_send, bob));
+  otrng_assert(to_send);
+  otrng_assert(!bob->smp_jobs);
+  g_assert_cmpint(bob->smp->progress, ==, SMP_TOTAL_PROGRESS);
+  g_assert_cmpint(bob->smp->state_expect, ==, SMP_STATE_EXPECT_1);
+  otrng_free(to_send);
+
+  otrng_global_state_free(alice_state->global_state);
+  otrng_global_state_free(bob_state->global_state);
+  otrng_conn_free_all(alice, bob);
+}
+
+static void test_smp_async_drain_on_free(void) {
+  OTRNG_INIT;
+
+  otrng_client_s *alice_state = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *bob_state = otrng_client_new(BOB_IDENTITY);
+
+  otrng_s *alice = set_up(alice_state, 1);
+  otrng_s *bob = set_up(bob_state, 2);
+
+  do_dake_fixture(alice, bob);
+  otrng_client_set_smp_async(otrng_true, bob_state);
+
+  tlv_s *tlv_smp_1 = otrng_smp_initiate(
+      get_my_client_profile(alice), alice->their_client_profile,
+      (const uint8_t *)"q", 1, (const uint8_t *)"answer", strlen("answer"),
+      alice->keys->ssid, alice->smp, alice);
+  otrng_assert(tlv_smp_1);
+
+  otrng_assert(!process_tlv(tlv_smp_1, bob));
+  otrng_tlv_free(tlv_smp_1);
+  otrng_assert(bob->smp_jobs);
+
+  // The job is waited for and thrown away with the conversation
+  otrng_conn_free_all(alice, bob);
+  otrng_global_state_free(alice_state->global_state);
+  otrng_global_state_free(bob_state->global_state);
+}
+
 void functionals_smp_add_tests(void) {
   g_test_add_func("/smp/state_machine", test_smp_state_machine);
   g_test_add_func("/smp/state_machine_abort", test_smp_state_machine_abort);
+  g_test_add_func("/smp/state_machine_async", test_smp_state_machine_async);
+  g_test_add_func("/smp/async_drain_on_free", test_smp_async_drain_on_free);
   g_test_add_func("/smp/generate_secret", test_otrng_generate_smp_secret);
   g_test_add_func("/smp/message_1_serialize_null_question",
                   test_otrng_smp_message_1_serialize_null_question);
@@ -0,0 +1,291 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+  A memory harness for idle conversations. One client gets a number of
+  encrypted conversations, all restored from the same session, which then
+  hibernate. The resident set of the process is reported next to what the
+  library counts in its footprint.
+
+  Usage: hibernation_load [conversations] [memory|store|awake] [sodium|plain]
+
+  With "memory", the default, the encrypted states are kept by the library.
+  With "store" they are handed to the store_hibernated callback, which only
+  counts them. In both, the conversations are created in batches, and each
+  batch hibernates before the next one is made, as otrng_poll would do over
+  time. With "awake" every conversation is created first and measured, and
+  then they all hibernate at once.
+
+  sodium_malloc gives every piece of secure memory its own mapping, with a
+  guard page on each side. Many awake conversations can therefore run into
+  the limit on the number of mappings of a process (vm.max_map_count), so
+  "awake" needs a smaller number of conversations. With "plain", secure
+  memory comes from calloc(3) instead, without guard pages or locking, so
+  that as many awake conversations as hibernated ones can be compared. The
+  resident set then leaves out what the guard pages cost.
+*/
+
+#include <gcrypt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "test_helpers.h"
+
+#include "test_fixtures.h"
+
+#include "alloc.h"
+#include "footprint.h"
+#include "otrng.h"
+#include "session.h"
+
+#define BATCH 1000
+
+static unsigned long errors = 0;
+static unsigned long stored = 0;
+static size_t stored_bytes = 0;
+static unsigned long discarded = 0;
+
+static otrng_result store_hibernated(const otrng_s *otr, const uint8_t *data,
+                                     size_t data_len) {
+  (void)otr;
+  (void)data;
+  stored++;
+  stored_bytes += data_len;
+  return OTRNG_SUCCESS;
+}
+
+static otrng_result load_hibernated(const otrng_s *otr, uint8_t **data,
+                                    size_t *data_len) {
+  (void)otr;
+  (void)data;
+  (void)data_len;
+  errors++;
+  return OTRNG_ERROR;
+}
+
+static void discard_hibernated(const otrng_s *otr) {
+  (void)otr;
+  discarded++;
+}
+
+static void *plain_secure_alloc(size_t size, otrng_alloc_subsystem subsystem,
+                                void *context) {
+  (void)subsystem;
+  (void)context;
+  return calloc(1, size);
+}
+
+static void plain_secure_free(void *ptr, void *context) {
+  (void)context;
+  free(ptr);
+}
+
+static const otrng_allocator_s plain_secure = {plain_secure_alloc, NULL,
+                                               plain_secure_free, NULL};
+
+static uint64_t monotonic_us(void) {
+  struct timespec now;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+/* The current resident set, in KiB, or 0 if it can't be read */
+static unsigned long resident_kib(void) {
+  unsigned long size = 0, resident = 0;
+  FILE *statm;
+
+  /* Memory that was freed is given back first, so that what is left is what
+     the conversations hold */
+#ifdef __GLIBC__
+  (void)malloc_trim(0);
+#endif
+
+  statm = fopen("/proc/self/statm", "r");
+  if (!statm) {
+    return 0;
+  }
+  if (fscanf(statm, "%lu %lu", &size, &resident) != 2) {
+    resident = 0;
+  }
+  (void)fclose(statm);
+
+  return resident * (unsigned long)sysconf(_SC_PAGESIZE) / 1024;
+}
+
+static void report(const char *what, unsigned long baseline,
+                   otrng_client_s *client, int num_conversations) {
+  unsigned long resident = resident_kib();
+  otrng_footprint_s footprint;
+
+  otrng_client_footprint(&footprint, client);
+
+  printf("%s:\n", what);
+  printf("  resident set (KiB):     %lu\n", resident);
+  if (resident > baseline) {
+    printf("  per conversation:       %.0f bytes\n",
+           (double)(resident - baseline) * 1024 / num_conversations);
+  }
+  printf("  footprint (bytes):      %zu heap, %zu secure\n",
+         footprint.heap_bytes, footprint.secure_bytes);
+  printf("  hibernated:             %zu conversations, %zu bytes\n",
+         footprint.num_hibernated, footprint.hibernated);
+}
+
+static void hibernate_all(otrng_client_s *client) {
+  /* Everything that was made before now has been idle long enough */
+  otrng_client_hibernate_idle(client, time(NULL) + 1);
+}
+
+int main(int argc, char **argv) {
+  otrng_client_s *alice_client, *bob_client;
+  otrng_client_callbacks_s callbacks = *test_callbacks;
+  const char *mode = "memory", *secure = "sodium";
+  otrng_bool awake;
+  otrng_s *alice, *bob;
+  uint8_t *ser = NULL;
+  size_t ser_len = 0;
+  unsigned long baseline;
+  uint64_t start;
+  int num_conversations = 100000;
+  int n;
+
+  if (argc > 1) {
+    num_conversations = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    mode = argv[2];
+  }
+  if (argc > 3) {
+    secure = argv[3];
+  }
+  if (num_conversations < 1 ||
+      (strcmp(mode, "memory") && strcmp(mode, "store") &&
+       strcmp(mode, "awake")) ||
+      (strcmp(secure, "sodium") && strcmp(secure, "plain"))) {
+    fprintf(stderr,
+            "usage: %s [conversations > 0] [memory|store|awake] "
+            "[sodium|plain]\n",
+            argv[0]);
+    return 1;
+  }
+  awake = strcmp(mode, "awake") == 0;
+
+  /* Before anything is allocated */
+  if (strcmp(secure, "plain") == 0 &&
+      otrng_failed(otrng_set_allocators(NULL, &plain_secure))) {
+    return 2;
+  }
+
+  if (!gcry_check_version(GCRYPT_VERSION)) {
+    return 2;
+  }
+
+  gcry_control(GCRYCTL_INIT_SECMEM, 0);
+  gcry_control(GCRYCTL_RESUME_SECMEM_WARN);
+  gcry_control(GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+  gcry_control(GCRYCTL_INITIALIZATION_FINISHED);
+
+  OTRNG_INIT;
+
+  alice_client = otrng_client_new(ALICE_IDENTITY);
+  bob_client = otrng_client_new(BOB_IDENTITY);
+  alice = set_up(alice_client, 1);
+  bob = set_up(bob_client, 2);
+
+  if (strcmp(mode, "store") == 0) {
+    callbacks.store_hibernated = store_hibernated;
+    callbacks.load_hibernated = load_hibernated;
+    callbacks.discard_hibernated = discard_hibernated;
+  }
+  alice_client->global_state->callbacks = &callbacks;
+
+  /* Every conversation gets the state of a real session */
+  do_dake_fixture(alice, bob);
+  if (otrng_failed(otrng_session_serialize(&ser, &ser_len, alice))) {
+    fprintf(stderr, "could not serialize the session\n");
+    return 2;
+  }
+
+  otrng_client_set_hibernation(1, alice_client);
+  baseline = resident_kib();
+
+  start = monotonic_us();
+  for (n = 0; n < num_conversations; n++) {
+    char peer[64];
+    otrng_conversation_s *conv;
+
+    (void)snprintf(peer, sizeof(peer), "peer%d@load.example", n);
+    conv = otrng_client_get_conversation(1, peer, alice_client);
+    if (!conv ||
+        otrng_failed(otrng_session_deserialize(conv->conn, ser, ser_len))) {
+      errors++;
+    }
+
+    if (!awake && (n + 1) % BATCH == 0) {
+      hibernate_all(alice_client);
+    }
+  }
+  if (!awake) {
+    hibernate_all(alice_client);
+  }
+
+  printf("conversations:            %d\n", num_conversations);
+  printf("mode:                     %s\n", mode);
+  printf("secure memory:            %s\n", secure);
+  printf("created in:               %.3f s\n",
+         (double)(monotonic_us() - start) / 1e6);
+  printf("resident set before (KiB): %lu\n", baseline);
+
+  if (awake) {
+    report("awake", baseline, alice_client, num_conversations);
+    hibernate_all(alice_client);
+  }
+  report("hibernated", baseline, alice_client, num_conversations);
+
+  if (stored) {
+    printf("stored by the application: %lu states, %zu bytes\n", stored,
+           stored_bytes);
+  }
+
+  otrng_session_free_serialized(ser, ser_len);
+  otrng_global_state_free(alice_client->global_state);
+  otrng_global_state_free(bob_client->global_state);
+  otrng_conn_free_all(alice, bob);
+
+  if (stored) {
+    printf("discarded when freed:     %lu\n", discarded);
+    if (discarded != stored) {
+      errors++;
+    }
+  }
+  printf("errors:                   %lu\n", errors);
+
+  OTRNG_FREE;
+
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,277 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+  A load harness for the prekey conversation. It drives a number of clients
+  against an in-process prekey service: every client publishes its profiles
+  and a batch of prekey messages, and then every client retrieves the prekey
+  ensembles of another one.
+
+  Usage: prekey_load [number of clients] [prekey messages per publication]
+*/
+
+#include <gcrypt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "test_helpers.h"
+
+#include "test_fixtures.h"
+
+#include "otrng.h"
+#include "prekey_service.h"
+
+#define SERVICE_IDENTITY "prekey@load.example"
+
+static uint8_t messages_per_publication = 5;
+static unsigned long errors = 0;
+static unsigned long publications = 0;
+static unsigned long ensembles = 0;
+
+static uint64_t monotonic_us(void) {
+  struct timespec now;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+static const char *load_domain(otrng_client_s *client, void *ctx) {
+  (void)client;
+  (void)ctx;
+
+  return "load.example";
+}
+
+static int build_publication(otrng_client_s *client,
+                             otrng_prekey_publication_message_s *pub_msg,
+                             void *ctx) {
+  prekey_message_s **messages =
+      otrng_client_build_prekey_messages(messages_per_publication, client);
+  int i;
+
+  (void)ctx;
+
+  if (!messages) {
+    return 0;
+  }
+
+  for (i = 0; i < messages_per_publication; i++) {
+    messages[i]->should_publish = otrng_true;
+  }
+  otrng_free(messages);
+
+  pub_msg->client_profile = otrng_xmalloc_z(sizeof(otrng_client_profile_s));
+  otrng_client_profile_copy(pub_msg->client_profile, client->client_profile);
+  pub_msg->prekey_profile = otrng_client_build_default_prekey_profile(client);
+
+  otrng_prekey_add_prekey_messages_for_publication(client, pub_msg);
+
+  return 1;
+}
+
+static void count_success(otrng_client_s *client, void *ctx) {
+  (void)client;
+  (void)ctx;
+  publications++;
+}
+
+static void count_failure(otrng_client_s *client, void *ctx) {
+  (void)client;
+  (void)ctx;
+  errors++;
+}
+
+static void count_error(otrng_client_s *client, int error, void *ctx) {
+  (void)client;
+  (void)error;
+  (void)ctx;
+  errors++;
+}
+
+static void count_no_prekeys(otrng_client_s *client, const char *identity) {
+  (void)client;
+  (void)identity;
+  errors++;
+}
+
+static void count_ensembles(otrng_client_s *client,
+                            prekey_ensemble_s *const *const received,
+                            uint8_t num_ensembles, const char *identity) {
+  (void)client;
+  (void)received;
+  (void)identity;
+  ensembles += num_ensembles;
+}
+
+static otrng_client_s *load_client_new(int i) {
+  char account[64];
+  otrng_client_s *client;
+  otrng_fingerprint fpr = {1};
+
+  (void)snprintf(account, sizeof(account), "client%d@load.example", i);
+  client = otrng_client_new(create_client_id("otr", account));
+  set_up_client(client, i + 1);
+
+  otrng_prekey_ensure_manager(client, account);
+  client->prekey_manager->callbacks->domain_for_account = load_domain;
+  client->prekey_manager->callbacks->build_prekey_publication_message =
+      build_publication;
+  client->prekey_manager->callbacks->success_received = count_success;
+  client->prekey_manager->callbacks->failure_received = count_failure;
+  client->prekey_manager->callbacks->notify_error = count_error;
+  client->prekey_manager->callbacks->no_prekey_in_storage_received =
+      count_no_prekeys;
+  client->prekey_manager->callbacks->prekey_ensembles_received =
+      count_ensembles;
+
+  otrng_prekey_provide_server_identity_for(client, "load.example",
+                                           SERVICE_IDENTITY, fpr);
+
+  return client;
+}
+
+static void converse(otrng_prekey_service_s *service, otrng_client_s *client,
+                     char *msg) {
+  char *reply = NULL;
+
+  while (msg) {
+    if (!otrng_prekey_service_receive(
+            &reply, service, client->prekey_manager->our_identity, msg)) {
+      errors++;
+    }
+    otrng_free(msg);
+    msg = NULL;
+
+    if (reply) {
+      (void)otrng_prekey_receive(&msg, client, SERVICE_IDENTITY, reply);
+      otrng_free(reply);
+      reply = NULL;
+    }
+  }
+}
+
+static int compare_latencies(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv) {
+  uint8_t sym[ED448_PRIVATE_BYTES] = {0x55};
+  otrng_prekey_service_s *service;
+  otrng_client_s **clients;
+  uint64_t *latencies;
+  uint64_t start, elapsed, total = 0;
+  struct rusage usage;
+  int num_clients = 50;
+  int i;
+
+  if (argc > 1) {
+    num_clients = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    messages_per_publication = (uint8_t)atoi(argv[2]);
+  }
+  if (num_clients < 2 || messages_per_publication == 0) {
+    fprintf(stderr, "usage: %s [clients >= 2] [prekey messages > 0]\n",
+            argv[0]);
+    return 1;
+  }
+
+  if (!gcry_check_version(GCRYPT_VERSION)) {
+    return 2;
+  }
+
+  gcry_control(GCRYCTL_INIT_SECMEM, 0);
+  gcry_control(GCRYCTL_RESUME_SECMEM_WARN);
+  gcry_control(GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+  gcry_control(GCRYCTL_INITIALIZATION_FINISHED);
+
+  OTRNG_INIT;
+
+  service = otrng_prekey_service_new(SERVICE_IDENTITY, sym);
+  clients = otrng_xmalloc_z(num_clients * sizeof(otrng_client_s *));
+  latencies = otrng_xmalloc_z(num_clients * sizeof(uint64_t));
+
+  for (i = 0; i < num_clients; i++) {
+    clients[i] = load_client_new(i);
+  }
+
+  start = monotonic_us();
+  for (i = 0; i < num_clients; i++) {
+    char *msg = NULL;
+    if (otrng_failed(otrng_prekey_publish(&msg, clients[i], NULL))) {
+      errors++;
+      continue;
+    }
+    converse(service, clients[i], msg);
+  }
+  elapsed = monotonic_us() - start;
+
+  printf("clients:                  %d\n", num_clients);
+  printf("prekey messages each:     %u\n", messages_per_publication);
+  printf("publications:             %lu in %.3f s (%.1f/s)\n", publications,
+         (double)elapsed / 1e6,
+         elapsed ? (double)publications * 1e6 / (double)elapsed : 0.0);
+
+  for (i = 0; i < num_clients; i++) {
+    otrng_client_s *peer = clients[(i + 1) % num_clients];
+    char *msg = NULL;
+
+    start = monotonic_us();
+    otrng_prekey_retrieve_prekeys(&msg, clients[i],
+                                  peer->prekey_manager->our_identity, "4");
+    converse(service, clients[i], msg);
+    latencies[i] = monotonic_us() - start;
+    total += latencies[i];
+  }
+
+  qsort(latencies, num_clients, sizeof(uint64_t), compare_latencies);
+
+  printf("ensembles retrieved:      %lu\n", ensembles);
+  printf("retrieval latency (us):   min %llu, mean %llu, p50 %llu, p99 %llu, "
+         "max %llu\n",
+         (unsigned long long)latencies[0],
+         (unsigned long long)(total / num_clients),
+         (unsigned long long)latencies[num_clients / 2],
+         (unsigned long long)latencies[(num_clients * 99) / 100],
+         (unsigned long long)latencies[num_clients - 1]);
+
+  printf("stored prekey messages:   %zu\n",
+         service->stats.stored_prekey_messages);
+  printf("stored bytes:             %zu\n", service->stats.stored_bytes);
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    printf("max resident set (KiB):   %ld\n", usage.ru_maxrss);
+  }
+  printf("errors:                   %lu\n", errors);
+
+  for (i = 0; i < num_clients; i++) {
+    otrng_global_state_free(clients[i]->global_state);
+  }
+  otrng_free(clients);
+  otrng_free(latencies);
+  otrng_prekey_service_free(service);
+
+  OTRNG_FREE;
+
+  return errors ? 1 : 0;
+}
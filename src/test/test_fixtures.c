@@ -528,7 +528,7 @@ void do_dake_fixture(otrng_s *alice, otrng_s *bob) {
   otrng_assert(response_to_alice->to_send == NULL);
   otrng_assert(response_to_alice->to_display == NULL);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 1);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 1);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 1);
@@ -21,11 +21,13 @@
 #ifndef __TEST_HELPERS_H__
 #define __TEST_HELPERS_H__
 
+#define OTRNG_ACCOUNT_STORE_PRIVATE
 #define OTRNG_AUTH_PRIVATE
 #define OTRNG_CLIENT_PRIVATE
 #define OTRNG_DAKE_PRIVATE
 #define OTRNG_DH_PRIVATE
 #define OTRNG_ED448_PRIVATE
+#define OTRNG_FOOTPRINT_PRIVATE
 #define OTRNG_FRAGMENT_PRIVATE
 #define OTRNG_KEY_MANAGEMENT_PRIVATE
 #define OTRNG_LIST_PRIVATE
@@ -33,14 +35,20 @@
 #define OTRNG_PERSISTENCE_PRIVATE
 #define OTRNG_PREKEY_MANAGER_PRIVATE
 #define OTRNG_PREKEY_MESSAGE_PRIVATE
+#define OTRNG_PREKEY_PROOFS_PRIVATE
+#define OTRNG_PREKEY_SERVICE_PRIVATE
 #define OTRNG_PREKEY_PROFILE_PRIVATE
 #define OTRNG_PROTOCOL_PRIVATE
+#define OTRNG_SESSION_PRIVATE
 #define OTRNG_SHAKE_PRIVATE
 #define OTRNG_SMP_PRIVATE
 #define OTRNG_SMP_PROTOCOL_PRIVATE
 #define OTRNG_TLV_PRIVATE
+#define OTRNG_TRACE_PRIVATE
 #define OTRNG_USER_PROFILE_PRIVATE
+#define OTRNG_WRITE_BACK_PRIVATE
 #define OTRNG_MESSAGING_PRIVATE
+#define OTRNG_METRICS_PRIVATE
 
 #include <glib.h>
 #include <stdarg.h>
@@ -21,6 +21,7 @@
 #ifndef __TEST_UNIT_ALL_H__
 #define __TEST_UNIT_ALL_H__
 
+void units_alloc_add_tests(void);
 void units_auth_add_tests(void);
 void units_client_add_tests(void);
 void units_client_profile_add_tests(void);
@@ -28,12 +29,14 @@ void units_dake_add_tests(void);
 void units_data_message_add_tests(void);
 void units_dh_add_tests(void);
 void units_ed448_add_tests(void);
+void units_footprint_add_tests(void);
 void units_fragment_add_tests(void);
 void units_identity_message_add_tests(void);
 void units_instance_tag_add_tests(void);
 void units_key_management_add_tests(void);
 void units_list_add_tests(void);
 void units_messaging_add_tests(void);
+void units_metrics_add_tests(void);
 void units_non_interactive_messages_add_tests(void);
 void units_orchestration_add_tests(void);
 void units_otrng_add_tests(void);
@@ -44,12 +47,16 @@ void units_prekey_messages_add_tests(void);
 void units_prekey_profile_add_tests(void);
 void units_prekey_proofs_add_tests(void);
 void units_prekey_server_client_add_tests(void);
+void units_prekey_service_add_tests(void);
 void units_serialize_add_tests(void);
+void units_session_add_tests(void);
 void units_standard_add_tests(void);
 void units_tlv_add_tests(void);
+void units_trace_add_tests(void);
 
 #define REGISTER_UNITS                                                         \
   do {                                                                         \
+    units_alloc_add_tests();                                                   \
     units_auth_add_tests();                                                    \
     units_client_add_tests();                                                  \
     units_client_profile_add_tests();                                          \
@@ -57,12 +64,14 @@ void units_tlv_add_tests(void);
     units_data_message_add_tests();                                            \
     units_dh_add_tests();                                                      \
     units_ed448_add_tests();                                                   \
+    units_footprint_add_tests();                                               \
     units_fragment_add_tests();                                                \
     units_identity_message_add_tests();                                        \
     units_instance_tag_add_tests();                                            \
     units_key_management_add_tests();                                          \
     units_list_add_tests();                                                    \
     units_messaging_add_tests();                                               \
+    units_metrics_add_tests();                                                 \
     units_non_interactive_messages_add_tests();                                \
     units_orchestration_add_tests();                                           \
     units_otrng_add_tests();                                                   \
@@ -73,9 +82,12 @@ void units_tlv_add_tests(void);
     units_prekey_profile_add_tests();                                          \
     units_prekey_proofs_add_tests();                                           \
     units_prekey_server_client_add_tests();                                    \
+    units_prekey_service_add_tests();                                          \
     units_serialize_add_tests();                                               \
+    units_session_add_tests();                                                 \
     units_standard_add_tests();                                                \
     units_tlv_add_tests();                                                     \
+    units_trace_add_tests();                                                   \
   } while (0);
 
 #endif // __TEST_UNIT_ALL_H__
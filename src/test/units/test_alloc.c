@@ -0,0 +1,198 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include "test_helpers.h"
+
+#include "alloc.h"
+#include "key_management.h"
+
+static void test_arena_alloc(void) {
+  otrng_arena_s arena;
+  uint8_t *a, *b, *big;
+  size_t i;
+
+  otrng_arena_init(&arena, 64, otrng_false);
+
+  a = otrng_arena_alloc(&arena, 10);
+  b = otrng_arena_alloc(&arena, 20);
+  otrng_assert(a != b);
+  g_assert_cmpuint((uintptr_t)b % (2 * sizeof(void *)), ==, 0);
+  for (i = 0; i < 20; i++) {
+    otrng_assert(b[i] == 0);
+  }
+  memset(a, 0xAA, 10);
+  memset(b, 0xBB, 20);
+  otrng_assert(a[9] == 0xAA);
+  otrng_assert(arena.chunks->next == NULL);
+
+  // Too big for the chunk size
+  big = otrng_arena_alloc(&arena, 100);
+  otrng_assert(big);
+  otrng_assert(arena.chunks->next != NULL);
+  g_assert_cmpuint(arena.chunks->size, >=, 100);
+
+  // Reset merges the chunks, and the memory comes back zeroed
+  otrng_arena_reset(&arena);
+  otrng_assert(arena.chunks);
+  otrng_assert(arena.chunks->next == NULL);
+  g_assert_cmpuint(arena.chunks->used, ==, 0);
+  a = otrng_arena_alloc(&arena, 120);
+  for (i = 0; i < 120; i++) {
+    otrng_assert(a[i] == 0);
+  }
+  otrng_assert(arena.chunks->next == NULL);
+
+  g_assert_cmpuint(arena.bytes, >=, 120);
+
+  otrng_arena_destroy(&arena);
+  otrng_assert(arena.chunks == NULL);
+  g_assert_cmpuint(arena.bytes, ==, 0);
+}
+
+static void test_arena_scopes(void) {
+  otrng_arena_s arena;
+  uint8_t *a;
+
+  otrng_arena_init(&arena, 64, otrng_true);
+
+  otrng_arena_enter(&arena);
+  a = otrng_arena_alloc(&arena, 32);
+  memset(a, 0xCC, 32);
+
+  // A nested scope does not release the outer one
+  otrng_arena_enter(&arena);
+  otrng_arena_alloc(&arena, 8);
+  otrng_arena_leave(&arena);
+  otrng_assert(a[0] == 0xCC);
+  g_assert_cmpuint(arena.chunks->used, >, 0);
+
+  otrng_arena_leave(&arena);
+  g_assert_cmpuint(arena.chunks->used, ==, 0);
+  otrng_assert(a[0] == 0);
+
+  // Leaving more than was entered does nothing
+  otrng_arena_leave(&arena);
+  g_assert_cmpuint(arena.depth, ==, 0);
+
+  otrng_arena_destroy(&arena);
+}
+
+typedef struct counting_allocator_s {
+  int allocs;
+  int reallocs;
+  int frees;
+  otrng_alloc_subsystem last_subsystem;
+} counting_allocator_s;
+
+static void *counting_alloc(size_t size, otrng_alloc_subsystem subsystem,
+                            void *context) {
+  counting_allocator_s *counts = context;
+  counts->allocs++;
+  counts->last_subsystem = subsystem;
+  return malloc(size);
+}
+
+static void *counting_realloc(void *ptr, size_t size, void *context) {
+  counting_allocator_s *counts = context;
+  counts->reallocs++;
+  return realloc(ptr, size);
+}
+
+static void counting_free(void *ptr, void *context) {
+  counting_allocator_s *counts = context;
+  counts->frees++;
+  free(ptr);
+}
+
+static void test_set_allocators(void) {
+  counting_allocator_s counts = {0, 0, 0, OTRNG_ALLOC_OTHER};
+  otrng_allocator_s normal = {counting_alloc, counting_realloc, counting_free,
+                              NULL};
+  otrng_allocator_s broken = {counting_alloc, NULL, counting_free, NULL};
+  uint8_t *p;
+
+  normal.context = &counts;
+  broken.context = &counts;
+  otrng_assert_is_success(otrng_set_allocators(&normal, NULL));
+
+  p = otrng_xmalloc(8);
+  p = otrng_xrealloc(p, 16);
+  otrng_free(p);
+  g_assert_cmpint(counts.allocs, ==, 1);
+  g_assert_cmpint(counts.reallocs, ==, 1);
+  g_assert_cmpint(counts.frees, ==, 1);
+  otrng_assert(counts.last_subsystem == OTRNG_ALLOC_OTHER);
+
+  p = otrng_xmalloc_in(OTRNG_ALLOC_FRAGMENTS, 8);
+  otrng_assert(counts.last_subsystem == OTRNG_ALLOC_FRAGMENTS);
+  otrng_free_in(OTRNG_ALLOC_FRAGMENTS, p, 8);
+  g_assert_cmpint(counts.frees, ==, 2);
+
+  // Normal memory has to be resizable, secure memory does not
+  otrng_assert_is_error(otrng_set_allocators(&broken, NULL));
+  otrng_assert_is_success(otrng_set_allocators(NULL, &broken));
+
+  otrng_assert_is_success(otrng_set_allocators(NULL, NULL));
+  p = otrng_xmalloc(8);
+  otrng_free(p);
+  g_assert_cmpint(counts.allocs, ==, 2);
+}
+
+static void test_alloc_stats(void) {
+  otrng_alloc_stats_s before, stats;
+  key_manager_s *manager;
+  uint8_t *p;
+
+  otrng_assert_is_success(otrng_get_alloc_stats(&before, OTRNG_ALLOC_SMP));
+
+  p = otrng_secure_alloc_in(OTRNG_ALLOC_SMP, 100);
+  otrng_assert_is_success(otrng_get_alloc_stats(&stats, OTRNG_ALLOC_SMP));
+  g_assert_cmpuint(stats.live_bytes, ==, before.live_bytes + 100);
+  g_assert_cmpuint(stats.live_count, ==, before.live_count + 1);
+  g_assert_cmpuint(stats.total_count, ==, before.total_count + 1);
+
+  otrng_secure_free_in(OTRNG_ALLOC_SMP, p, 100);
+  otrng_assert_is_success(otrng_get_alloc_stats(&stats, OTRNG_ALLOC_SMP));
+  g_assert_cmpuint(stats.live_bytes, ==, before.live_bytes);
+  g_assert_cmpuint(stats.live_count, ==, before.live_count);
+  g_assert_cmpuint(stats.total_count, ==, before.total_count + 1);
+
+  otrng_assert_is_success(otrng_get_alloc_stats(&before, OTRNG_ALLOC_RATCHET));
+  manager = otrng_key_manager_new();
+  otrng_assert_is_success(otrng_get_alloc_stats(&stats, OTRNG_ALLOC_RATCHET));
+  /* Our ephemeral keypairs are part of the ratchet */
+  g_assert_cmpuint(stats.live_bytes, >=,
+                   before.live_bytes + sizeof(key_manager_s) +
+                       sizeof(ecdh_keypair_s) + sizeof(dh_keypair_s));
+  otrng_key_manager_free(manager);
+  otrng_assert_is_success(otrng_get_alloc_stats(&stats, OTRNG_ALLOC_RATCHET));
+  g_assert_cmpuint(stats.live_bytes, ==, before.live_bytes);
+
+  otrng_assert_is_error(otrng_get_alloc_stats(&stats, OTRNG_ALLOC_OTHER));
+}
+
+void units_alloc_add_tests(void) {
+  g_test_add_func("/alloc/arena/alloc", test_arena_alloc);
+  g_test_add_func("/alloc/arena/scopes", test_arena_scopes);
+  g_test_add_func("/alloc/set_allocators", test_set_allocators);
+  g_test_add_func("/alloc/stats", test_alloc_stats);
+}
@@ -29,6 +29,7 @@
 #include "fragment.h"
 #include "instance_tag.h"
 #include "messaging.h"
+#include "random.h"
 #include "serialize.h"
 #include "shake.h"
 
@@ -76,9 +77,136 @@ static void test_fingerprint_hash_to_human() {
                   strncmp(expected_fp, fp_human, OTRNG_FPRINT_HUMAN_LEN));
 }
 
+static uint32_t deterministic_state;
+
+static void deterministic_randomness(void *buffer, size_t size) {
+  uint8_t *out = buffer;
+  size_t i;
+
+  for (i = 0; i < size; i++) {
+    deterministic_state = deterministic_state * 1103515245 + 12345;
+    out[i] = (uint8_t)(deterministic_state >> 16);
+  }
+}
+
+static prekey_message_s **build_prekeys_with_threads(otrng_client_s *client,
+                                                     unsigned int threads,
+                                                     uint8_t num) {
+  prekey_message_s **messages;
+
+  deterministic_state = 42;
+  otrng_set_current_randomness(deterministic_randomness);
+  otrng_client_set_prekey_generation_threads(threads, client);
+  messages = otrng_client_build_prekey_messages(num, client);
+  otrng_set_current_randomness(NULL);
+
+  return messages;
+}
+
+static void test_client_build_prekey_messages_in_parallel() {
+  const uint8_t num = 13;
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *bob = otrng_client_new(BOB_IDENTITY);
+  prekey_message_s **sequential, **parallel;
+  int i, j;
+
+  set_up_client(alice, 1);
+  set_up_client(bob, 2);
+
+  sequential = build_prekeys_with_threads(alice, 1, num);
+  parallel = build_prekeys_with_threads(bob, 4, num);
+  otrng_assert(sequential);
+  otrng_assert(parallel);
+  g_assert_cmpint(otrng_tail_list_len(&alice->our_prekeys), ==, num);
+  g_assert_cmpint(otrng_tail_list_len(&bob->our_prekeys), ==, num);
+
+  for (i = 0; i < num; i++) {
+    g_assert_cmpint(sequential[i]->sender_instance_tag, ==,
+                    otrng_client_get_instance_tag(alice));
+    g_assert_cmpint(parallel[i]->sender_instance_tag, ==,
+                    otrng_client_get_instance_tag(bob));
+
+    /* Same randomness, same messages, no matter the number of threads */
+    g_assert_cmpint(sequential[i]->id, ==, parallel[i]->id);
+    otrng_assert(otrng_ec_point_eq(sequential[i]->Y, parallel[i]->Y));
+    otrng_assert_dh_public_key_eq(sequential[i]->B, parallel[i]->B);
+
+    for (j = 0; j < i; j++) {
+      g_assert_cmpint(sequential[i]->id, !=, sequential[j]->id);
+    }
+  }
+
+  /* Replaying the randomness does not reuse the ids alice already stores,
+     which are the same as bob's */
+  otrng_free(sequential);
+  sequential = build_prekeys_with_threads(alice, 4, num);
+  otrng_assert(sequential);
+  for (i = 0; i < num; i++) {
+    g_assert_cmpint(sequential[i]->id, !=, parallel[i]->id);
+  }
+  g_assert_cmpint(otrng_tail_list_len(&alice->our_prekeys), ==, 2 * num);
+
+  otrng_free(sequential);
+  otrng_free(parallel);
+  otrng_global_state_free(alice->global_state);
+  otrng_global_state_free(bob->global_state);
+}
+
+static void test_client_prekey_reservoir() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  otrng_prekey_reservoir_s *r;
+  prekey_message_s **messages;
+  const prekey_message_s *first_ready;
+
+  set_up_client(alice, 1);
+  otrng_client_set_prekey_reservoir(4, 8, alice);
+  r = alice->prekey_reservoir;
+  otrng_assert(r);
+
+  /* Nothing is ready until the background refill has been collected */
+  otrng_client_refill_prekey_reservoir(alice);
+  otrng_assert(r->refill);
+  g_assert_cmpint(r->ready_len, ==, 0);
+  otrng_worker_wait(alice->global_state->prekey_worker);
+  otrng_client_refill_prekey_reservoir(alice);
+  otrng_assert(!r->refill);
+  g_assert_cmpint(r->ready_len, ==, 8);
+  g_assert_cmpint(otrng_list_len(r->ready), ==, 8);
+
+  /* New prekey messages come out of the reservoir, which is then refilled
+     once it drops below the low watermark */
+  first_ready = r->ready->data;
+  messages = otrng_client_build_prekey_messages(5, alice);
+  otrng_assert(messages);
+  otrng_assert(messages[0] == first_ready);
+  g_assert_cmpint(otrng_tail_list_len(&alice->our_prekeys), ==, 5);
+  g_assert_cmpint(r->ready_len, ==, 3);
+  otrng_assert(r->refill);
+  otrng_free(messages);
+
+  otrng_worker_wait(alice->global_state->prekey_worker);
+  otrng_client_refill_prekey_reservoir(alice);
+  g_assert_cmpint(r->ready_len, ==, 8);
+
+  /* Asking for more than is ready generates the rest inline */
+  messages = otrng_client_build_prekey_messages(10, alice);
+  otrng_assert(messages);
+  g_assert_cmpint(otrng_tail_list_len(&alice->our_prekeys), ==, 15);
+  g_assert_cmpint(r->ready_len, ==, 0);
+  otrng_free(messages);
+
+  otrng_client_set_prekey_reservoir(0, 0, alice);
+  otrng_assert(!alice->prekey_reservoir);
+
+  otrng_global_state_free(alice->global_state);
+}
+
 void units_client_add_tests(void) {
   g_test_add_func("/client/fingerprint_to_human",
                   test_fingerprint_hash_to_human);
   g_test_add_func("/client/get_our_fingerprint",
                   test_client_get_our_fingerprint);
+  g_test_add_func("/client/build_prekey_messages_in_parallel",
+                  test_client_build_prekey_messages_in_parallel);
+  g_test_add_func("/client/prekey_reservoir", test_client_prekey_reservoir);
 }
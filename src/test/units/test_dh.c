@@ -183,9 +183,58 @@ static void test_dh_keypair_destroy() {
   otrng_assert(!alice.pub);
 }
 
+static void test_dh_multi_powm() {
+  const size_t sizes[] = {1, 2, 17};
+  dh_mpi mod = otrng_dh_modulus_p();
+  size_t i, j;
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    size_t len = sizes[i];
+    dh_mpi *bases = otrng_xmalloc_z(len * sizeof(dh_mpi));
+    dh_mpi *exps = otrng_xmalloc_z(len * sizeof(dh_mpi));
+    dh_mpi expected = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+    dh_mpi result = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+    dh_mpi t = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+
+    gcry_mpi_set_ui(expected, 1);
+    for (j = 0; j < len; j++) {
+      dh_keypair_s k;
+      otrng_assert_is_success(otrng_dh_keypair_generate(&k));
+      bases[j] = otrng_dh_mpi_copy(k.pub);
+      otrng_dh_keypair_destroy(&k);
+
+      /* Mix full, short and zero exponents */
+      exps[j] = gcry_mpi_new(352);
+      if (j % 4 == 1) {
+        gcry_mpi_set_ui(exps[j], 0);
+      } else {
+        gcry_mpi_randomize(exps[j], j % 4 == 2 ? 12 : 352, GCRY_WEAK_RANDOM);
+      }
+
+      gcry_mpi_powm(t, bases[j], exps[j], mod);
+      gcry_mpi_mulm(expected, expected, t, mod);
+    }
+
+    otrng_dh_multi_powm(result, (const dh_mpi *)bases, (const dh_mpi *)exps,
+                        len, mod);
+    otrng_assert_dh_public_key_eq(expected, result);
+
+    for (j = 0; j < len; j++) {
+      otrng_dh_mpi_release(bases[j]);
+      otrng_dh_mpi_release(exps[j]);
+    }
+    otrng_free(bases);
+    otrng_free(exps);
+    otrng_dh_mpi_release(expected);
+    otrng_dh_mpi_release(result);
+    otrng_dh_mpi_release(t);
+  }
+}
+
 void units_dh_add_tests(void) {
   g_test_add_func("/dh/api", test_dh_api);
   g_test_add_func("/dh/serialize", test_dh_serialize);
   g_test_add_func("/dh/shared-secret", test_dh_shared_secret);
   g_test_add_func("/dh/destroy", test_dh_keypair_destroy);
+  g_test_add_func("/dh/multi_powm", test_dh_multi_powm);
 }
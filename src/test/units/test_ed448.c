@@ -93,6 +93,52 @@ static void test_ed448_signature() {
   otrng_keypair_free(pair);
 }
 
+static void test_ed448_multiscalarmul() {
+  const size_t sizes[] = {1, 7, 40, 200};
+  size_t i, j;
+  ec_point empty;
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    size_t len = sizes[i];
+    ec_point *points = otrng_xmalloc_z(len * sizeof(ec_point));
+    ec_scalar *scalars = otrng_xmalloc_z(len * sizeof(ec_scalar));
+    ec_point expected, result, term;
+    uint8_t buff[ED448_SCALAR_BYTES];
+
+    goldilocks_448_point_copy(expected, goldilocks_448_point_identity);
+    for (j = 0; j < len; j++) {
+      random_bytes(buff, ED448_SCALAR_BYTES);
+      goldilocks_448_scalar_decode_long(scalars[j], buff, ED448_SCALAR_BYTES);
+      otrng_ec_calculate_public_key(points[j], scalars[j]);
+
+      /* Exercise short and zero scalars as well */
+      random_bytes(buff, ED448_SCALAR_BYTES);
+      if (j % 5 == 1) {
+        goldilocks_448_scalar_copy(scalars[j], goldilocks_448_scalar_zero);
+      } else if (j % 5 == 2) {
+        goldilocks_448_scalar_decode_long(scalars[j], buff, 3);
+      } else {
+        goldilocks_448_scalar_decode_long(scalars[j], buff,
+                                          ED448_SCALAR_BYTES);
+      }
+
+      goldilocks_448_point_scalarmul(term, points[j], scalars[j]);
+      goldilocks_448_point_add(expected, expected, term);
+    }
+
+    otrng_ec_point_multiscalarmul(result, (const ec_point *)points,
+                                  (const ec_scalar *)scalars, len);
+    otrng_assert(otrng_ec_point_eq(expected, result) == otrng_true);
+
+    otrng_free(points);
+    otrng_free(scalars);
+  }
+
+  otrng_ec_point_multiscalarmul(empty, NULL, NULL, 0);
+  otrng_assert(otrng_ec_point_eq(empty, goldilocks_448_point_identity) ==
+               otrng_true);
+}
+
 void units_ed448_add_tests(void) {
   g_test_add_func("/edwards448/eddsa_serialization",
                   test_ed448_eddsa_serialization);
@@ -100,4 +146,5 @@ void units_ed448_add_tests(void) {
   g_test_add_func("/edwards448/scalar_serialization",
                   test_ed448_scalar_serialization);
   g_test_add_func("/edwards448/signature", test_ed448_signature);
+  g_test_add_func("/edwards448/multiscalarmul", test_ed448_multiscalarmul);
 }
@@ -0,0 +1,129 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include "test_helpers.h"
+
+#include "test_fixtures.h"
+
+#include "footprint.h"
+#include "fragment.h"
+
+static size_t footprint_total(const otrng_footprint_s *footprint) {
+  return footprint->keys + footprint->skipped_keys + footprint->old_mac_keys +
+         footprint->smp + footprint->arena + footprint->fragments +
+         footprint->profiles + footprint->v3 + footprint->conversation +
+         footprint->hibernated + footprint->prekeys;
+}
+
+static void test_conversation_footprint(otrng_fixture_s *otrng_fixture,
+                                        gconstpointer data) {
+  otrng_footprint_s footprint, v3_footprint;
+  (void)data;
+
+  otrng_conversation_footprint(&footprint, otrng_fixture->otr);
+
+  g_assert_cmpuint(footprint.num_conversations, ==, 1);
+  g_assert_cmpuint(footprint.conversation, >=, sizeof(otrng_s));
+  g_assert_cmpuint(footprint.keys, >=, sizeof(key_manager_s));
+  g_assert_cmpuint(footprint.smp, >=, sizeof(smp_protocol_s));
+  g_assert_cmpuint(footprint.skipped_keys, ==, 0);
+  g_assert_cmpuint(footprint.fragments, ==, 0);
+  g_assert_cmpuint(footprint.v3, ==, 0);
+  g_assert_cmpuint(footprint.prekeys, ==, 0);
+  g_assert_cmpuint(footprint.heap_bytes + footprint.secure_bytes, ==,
+                   footprint_total(&footprint));
+
+  otrng_conversation_footprint(&v3_footprint, otrng_fixture->v3);
+  g_assert_cmpuint(v3_footprint.v3, >, 0);
+}
+
+static void test_client_footprint(otrng_fixture_s *otrng_fixture,
+                                  gconstpointer data) {
+  otrng_footprint_s footprint, conv_footprint;
+  otrng_conversation_s *conv;
+  (void)data;
+
+  otrng_client_footprint(&footprint, otrng_fixture->client);
+  g_assert_cmpuint(footprint.num_conversations, ==, 0);
+
+  conv = otrng_client_get_conversation(otrng_true, "alice",
+                                       otrng_fixture->client);
+  otrng_assert(conv);
+
+  otrng_client_footprint(&footprint, otrng_fixture->client);
+  otrng_conversation_footprint(&conv_footprint, conv->conn);
+
+  g_assert_cmpuint(footprint.num_conversations, ==, 1);
+  g_assert_cmpuint(footprint.keys, ==, conv_footprint.keys);
+  g_assert_cmpuint(footprint.conversation, >, conv_footprint.conversation);
+  g_assert_cmpuint(footprint.heap_bytes + footprint.secure_bytes, ==,
+                   footprint_total(&footprint));
+}
+
+static void test_client_footprint_fragments(otrng_fixture_s *otrng_fixture,
+                                            gconstpointer data) {
+  const char *first = "?OTR|00000000|00000001|00000002,00001,00002,one ,";
+  const char *second = "?OTR|00000000|00000001|00000002,00002,00002,more,";
+  otrng_footprint_s before, footprint, conv_footprint;
+  otrng_conversation_s *conv;
+  char *unfrag = NULL;
+  (void)data;
+
+  conv = otrng_client_get_conversation(otrng_true, "alice",
+                                       otrng_fixture->client);
+  otrng_assert(conv);
+  otrng_client_footprint(&before, otrng_fixture->client);
+
+  otrng_assert_is_success(otrng_unfragment_message(
+      &unfrag, &conv->conn->pending_fragments, first, 2,
+      &conv->conn->footprint));
+  otrng_assert(!unfrag);
+
+  otrng_conversation_footprint(&conv_footprint, conv->conn);
+  otrng_client_footprint(&footprint, otrng_fixture->client);
+  g_assert_cmpuint(conv_footprint.fragments, >, strlen(first));
+  g_assert_cmpuint(footprint.fragments, ==, conv_footprint.fragments);
+  g_assert_cmpuint(footprint.heap_bytes, ==,
+                   before.heap_bytes + conv_footprint.fragments);
+
+  otrng_assert_is_success(otrng_unfragment_message(
+      &unfrag, &conv->conn->pending_fragments, second, 2,
+      &conv->conn->footprint));
+  g_assert_cmpstr(unfrag, ==, "one more");
+  otrng_free(unfrag);
+
+  otrng_client_footprint(&footprint, otrng_fixture->client);
+  g_assert_cmpuint(footprint.fragments, ==, 0);
+  g_assert_cmpuint(footprint.heap_bytes, ==, before.heap_bytes);
+  g_assert_cmpuint(footprint.secure_bytes, ==, before.secure_bytes);
+}
+
+void units_footprint_add_tests(void) {
+  g_test_add("/footprint/conversation", otrng_fixture_s, NULL,
+             otrng_fixture_set_up, test_conversation_footprint,
+             otrng_fixture_teardown);
+  g_test_add("/footprint/client", otrng_fixture_s, NULL, otrng_fixture_set_up,
+             test_client_footprint, otrng_fixture_teardown);
+  g_test_add("/footprint/client_follows_fragments", otrng_fixture_s, NULL,
+             otrng_fixture_set_up, test_client_footprint_fragments,
+             otrng_fixture_teardown);
+}
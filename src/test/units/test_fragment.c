@@ -77,56 +77,61 @@ static void test_defragment_valid_message(void) {
   fragments[1] = "?OTR|00000000|00000001|00000002,00002,00002,more,";
 
   fragment_context_s *context = NULL;
-  list_element_s *list = NULL;
+  otrng_tail_list_s list;
 
   char *unfrag = NULL;
+  otrng_tail_list_init(&list);
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, fragments[0], 2));
+      otrng_unfragment_message(&unfrag, &list, fragments[0], 2, NULL));
 
-  context = list->data;
+  context = list.head->data;
   g_assert_cmpint(context->total, ==, 2);
   g_assert_cmpint(context->count, ==, 1);
   otrng_assert(!unfrag);
 
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, fragments[1], 2));
+      otrng_unfragment_message(&unfrag, &list, fragments[1], 2, NULL));
 
-  otrng_assert(otrng_list_len(list) == 0);
+  otrng_assert(otrng_tail_list_len(&list) == 0);
   g_assert_cmpstr(unfrag, ==, "one more");
 
   otrng_free(unfrag);
-  otrng_list_free_nodes(list);
+  otrng_list_free_nodes(list.head);
 }
 
 static void test_defragment_single_fragment(void) {
   const string_p message =
       "?OTR|00000000|00000001|00000002,00001,00001,small lol,";
 
-  list_element_s *list = NULL;
+  otrng_tail_list_s list;
   char *unfrag = NULL;
 
-  otrng_assert_is_success(otrng_unfragment_message(&unfrag, &list, message, 2));
+  otrng_tail_list_init(&list);
+  otrng_assert_is_success(
+      otrng_unfragment_message(&unfrag, &list, message, 2, NULL));
 
-  otrng_assert(otrng_list_len(list) == 0);
+  otrng_assert(otrng_tail_list_len(&list) == 0);
   g_assert_cmpstr(unfrag, ==, "small lol");
 
   otrng_free(unfrag);
-  otrng_list_free_nodes(list);
+  otrng_list_free_nodes(list.head);
 }
 
 static void test_defragment_without_comma_fails(void) {
   const string_p message = "?OTR|00000000|00000001|00000002,00001,00001,blergh";
 
-  list_element_s *list = NULL;
+  otrng_tail_list_s list;
 
   char *unfrag = NULL;
-  otrng_assert_is_error(otrng_unfragment_message(&unfrag, &list, message, 2));
+  otrng_tail_list_init(&list);
+  otrng_assert_is_error(
+      otrng_unfragment_message(&unfrag, &list, message, 2, NULL));
 
-  otrng_assert(list == NULL);
+  otrng_assert(otrng_tail_list_len(&list) == 0);
   g_assert_cmpstr(unfrag, ==, NULL);
 
   otrng_free(unfrag);
-  otrng_list_free_nodes(list);
+  otrng_list_free_nodes(list.head);
 }
 
 static void test_defragment_with_different_total_fails(void) {
@@ -135,27 +140,28 @@ static void test_defragment_with_different_total_fails(void) {
   fragments[1] = "?OTR|00000000|00000001|00000002,00002,00002,total,";
 
   fragment_context_s *context = NULL;
-  list_element_s *list = NULL;
+  otrng_tail_list_s list;
 
   char *unfrag = NULL;
+  otrng_tail_list_init(&list);
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, fragments[0], 2));
+      otrng_unfragment_message(&unfrag, &list, fragments[0], 2, NULL));
   otrng_assert(!unfrag);
 
-  context = list->data;
+  context = list.head->data;
   g_assert_cmpint(context->total, ==, 3);
   g_assert_cmpint(context->count, ==, 1);
 
   otrng_assert_is_error(
-      otrng_unfragment_message(&unfrag, &list, fragments[1], 2));
+      otrng_unfragment_message(&unfrag, &list, fragments[1], 2, NULL));
 
-  context = list->data;
+  context = list.head->data;
   otrng_assert(!unfrag);
   g_assert_cmpint(context->total, ==, 3);
   g_assert_cmpint(context->count, ==, 1);
 
   otrng_fragment_context_free(context);
-  otrng_list_free_nodes(list);
+  otrng_list_free_nodes(list.head);
 }
 
 static void test_defragment_fragment_twice_fails(void) {
@@ -164,26 +170,27 @@ static void test_defragment_fragment_twice_fails(void) {
   fragments[1] = "?OTR|00000000|00000001|00000002,00001,00002,same twice,";
 
   fragment_context_s *context = NULL;
-  list_element_s *list = NULL;
+  otrng_tail_list_s list;
 
   char *unfrag = NULL;
+  otrng_tail_list_init(&list);
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, fragments[0], 2));
+      otrng_unfragment_message(&unfrag, &list, fragments[0], 2, NULL));
 
-  context = list->data;
+  context = list.head->data;
   otrng_assert(!unfrag);
   g_assert_cmpint(context->total, ==, 2);
   g_assert_cmpint(context->count, ==, 1);
 
   otrng_assert_is_error(
-      otrng_unfragment_message(&unfrag, &list, fragments[1], 2));
+      otrng_unfragment_message(&unfrag, &list, fragments[1], 2, NULL));
 
   otrng_assert(!unfrag);
   g_assert_cmpint(context->total, ==, 2);
   g_assert_cmpint(context->count, ==, 1);
 
   otrng_fragment_context_free(context);
-  otrng_list_free_nodes(list);
+  otrng_list_free_nodes(list.head);
 }
 
 static void test_defragment_out_of_order_message(void) {
@@ -193,61 +200,66 @@ static void test_defragment_out_of_order_message(void) {
   fragments[2] = "?OTR|00000000|00000001|00000002,00001,00003,one more ,";
 
   fragment_context_s *context = NULL;
-  list_element_s *list = NULL;
+  otrng_tail_list_s list;
 
   char *unfrag = NULL;
+  otrng_tail_list_init(&list);
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, fragments[0], 2));
+      otrng_unfragment_message(&unfrag, &list, fragments[0], 2, NULL));
 
-  context = list->data;
+  context = list.head->data;
   otrng_assert(!unfrag);
   g_assert_cmpint(context->total, ==, 3);
   g_assert_cmpint(context->count, ==, 1);
 
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, fragments[1], 2));
+      otrng_unfragment_message(&unfrag, &list, fragments[1], 2, NULL));
   otrng_assert(!unfrag);
   g_assert_cmpint(context->total, ==, 3);
   g_assert_cmpint(context->count, ==, 2);
 
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, fragments[2], 2));
+      otrng_unfragment_message(&unfrag, &list, fragments[2], 2, NULL));
   g_assert_cmpstr(unfrag, ==, "one more fragment send");
 
-  otrng_assert(otrng_list_len(list) == 0);
+  otrng_assert(otrng_tail_list_len(&list) == 0);
 
   otrng_free(unfrag);
-  otrng_list_free_nodes(list);
+  otrng_list_free_nodes(list.head);
 }
 
 static void test_defragment_fails_for_another_instance(void) {
   const string_p message =
       "?OTR|00000000|00000001|00000002,00001,00001,small lol,";
 
-  list_element_s *list = NULL;
+  otrng_tail_list_s list;
   char *unfrag = NULL;
 
-  otrng_assert_is_success(otrng_unfragment_message(&unfrag, &list, message, 1));
+  otrng_tail_list_init(&list);
+  otrng_assert_is_success(
+      otrng_unfragment_message(&unfrag, &list, message, 1, NULL));
 
-  otrng_assert(list == NULL);
+  otrng_assert(otrng_tail_list_len(&list) == 0);
   g_assert_cmpstr(unfrag, ==, NULL);
 
-  otrng_list_free_nodes(list);
+  otrng_list_free_nodes(list.head);
 }
 
 static void test_defragment_regular_otr_message(void) {
   const string_p message = "?OTR:not a fragmented message.";
 
-  list_element_s *list = NULL;
+  otrng_tail_list_s list;
   char *unfrag = NULL;
 
-  otrng_assert_is_success(otrng_unfragment_message(&unfrag, &list, message, 1));
+  otrng_tail_list_init(&list);
+  otrng_assert_is_success(
+      otrng_unfragment_message(&unfrag, &list, message, 1, NULL));
 
-  otrng_assert(list == NULL);
+  otrng_assert(otrng_tail_list_len(&list) == 0);
   g_assert_cmpstr(unfrag, ==, message);
 
   otrng_free(unfrag);
-  otrng_list_free_nodes(list);
+  otrng_list_free_nodes(list.head);
 }
 
 static void test_defragment_two_messages(void) {
@@ -261,56 +273,103 @@ static void test_defragment_two_messages(void) {
   message2_fragments[1] =
       "?OTR|00000002|00000001|00000002,00002,00002,message,";
 
-  list_element_s *list = NULL;
+  otrng_tail_list_s list;
 
   char *unfrag = NULL;
+  otrng_tail_list_init(&list);
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, message1_fragments[0], 2));
+      otrng_unfragment_message(&unfrag, &list, message1_fragments[0], 2, NULL));
 
   otrng_assert(!unfrag);
-  otrng_assert(otrng_list_len(list) == 1);
+  otrng_assert(otrng_tail_list_len(&list) == 1);
 
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, message2_fragments[0], 2));
+      otrng_unfragment_message(&unfrag, &list, message2_fragments[0], 2, NULL));
   otrng_assert(!unfrag);
-  otrng_assert(otrng_list_len(list) == 2);
+  otrng_assert(otrng_tail_list_len(&list) == 2);
 
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, message2_fragments[1], 2));
+      otrng_unfragment_message(&unfrag, &list, message2_fragments[1], 2, NULL));
   g_assert_cmpstr(unfrag, ==, "second message");
-  otrng_assert(otrng_list_len(list) == 1);
+  otrng_assert(otrng_tail_list_len(&list) == 1);
 
   otrng_free(unfrag);
   unfrag = NULL;
 
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, message1_fragments[1], 2));
+      otrng_unfragment_message(&unfrag, &list, message1_fragments[1], 2, NULL));
   g_assert_cmpstr(unfrag, ==, "first message");
-  otrng_assert(otrng_list_len(list) == 0);
+  otrng_assert(otrng_tail_list_len(&list) == 0);
 
   otrng_free(unfrag);
-  otrng_list_free_nodes(list);
+  otrng_list_free_nodes(list.head);
 }
 
 static void test_expiration_of_fragments(void) {
   time_t HOUR_IN_SEC = 3600;
-  list_element_s *list = NULL;
+  otrng_tail_list_s list;
   fragment_context_s *ctx1 = otrng_fragment_context_new();
   fragment_context_s *ctx2 = otrng_fragment_context_new();
 
   ctx1->last_fragment_received_at = HOUR_IN_SEC;
   ctx2->last_fragment_received_at = HOUR_IN_SEC + 2;
 
-  list = otrng_list_add(ctx1, list);
-  list = otrng_list_add(ctx2, list);
+  otrng_tail_list_init(&list);
+  otrng_tail_list_append(&list, ctx1);
+  otrng_tail_list_append(&list, ctx2);
 
   time_t now = HOUR_IN_SEC + 1;
   otrng_assert_is_success(otrng_expire_fragments(now, 5, &list));
-  otrng_assert(otrng_list_len(list) == 1);
+  otrng_assert(otrng_tail_list_len(&list) == 1);
 
   now = HOUR_IN_SEC + 3;
   otrng_assert_is_success(otrng_expire_fragments(now, 5, &list));
-  otrng_assert(otrng_list_len(list) == 0);
+  otrng_assert(otrng_tail_list_len(&list) == 0);
+}
+
+static void test_buffered_fragments_are_accounted(void) {
+  const string_p first = "?OTR|00000000|00000001|00000002,00001,00002,one ,";
+  const string_p second = "?OTR|00000000|00000001|00000002,00002,00002,more,";
+  otrng_alloc_stats_s before, stats;
+  otrng_tail_list_s list;
+  char *unfrag = NULL;
+
+  otrng_assert_is_success(
+      otrng_get_alloc_stats(&before, OTRNG_ALLOC_FRAGMENTS));
+
+  otrng_tail_list_init(&list);
+  /* The context, its array of two pieces, and the piece */
+  otrng_assert_is_success(
+      otrng_unfragment_message(&unfrag, &list, first, 2, NULL));
+  otrng_assert(!unfrag);
+  otrng_assert_is_success(
+      otrng_get_alloc_stats(&stats, OTRNG_ALLOC_FRAGMENTS));
+  g_assert_cmpuint(stats.live_count, ==, before.live_count + 3);
+  g_assert_cmpuint(stats.live_bytes, ==,
+                   before.live_bytes + sizeof(fragment_context_s) +
+                       2 * sizeof(string_p) + strlen("one ") + 1);
+
+  otrng_assert_is_success(
+      otrng_unfragment_message(&unfrag, &list, second, 2, NULL));
+  g_assert_cmpstr(unfrag, ==, "one more");
+  otrng_free(unfrag);
+
+  otrng_assert_is_success(
+      otrng_get_alloc_stats(&stats, OTRNG_ALLOC_FRAGMENTS));
+  g_assert_cmpuint(stats.live_count, ==, before.live_count);
+  g_assert_cmpuint(stats.live_bytes, ==, before.live_bytes);
+
+  /* Fragments that are dropped before the message is complete are released
+     as well */
+  otrng_assert_is_success(
+      otrng_unfragment_message(&unfrag, &list, first, 2, NULL));
+  otrng_fragment_context_free(list.head->data);
+  otrng_list_free_nodes(list.head);
+
+  otrng_assert_is_success(
+      otrng_get_alloc_stats(&stats, OTRNG_ALLOC_FRAGMENTS));
+  g_assert_cmpuint(stats.live_count, ==, before.live_count);
+  g_assert_cmpuint(stats.live_bytes, ==, before.live_bytes);
 }
 
 void units_fragment_add_tests(void) {
@@ -337,4 +396,6 @@ void units_fragment_add_tests(void) {
                   test_defragment_two_messages);
   g_test_add_func("/fragment/expiration_of_fragments",
                   test_expiration_of_fragments);
+  g_test_add_func("/fragment/buffered_fragments_are_accounted",
+                  test_buffered_fragments_are_accounted);
 }
@@ -156,6 +156,129 @@ static void test_list_empty_size() {
   otrng_list_free_nodes(empty);
 }
 
+static void test_tail_list() {
+  int one = 1, two = 2, three = 3;
+  otrng_tail_list_s list, copy;
+
+  otrng_tail_list_init(&list);
+  g_assert_cmpint(otrng_tail_list_len(&list), ==, 0);
+
+  otrng_tail_list_append(&list, &one);
+  otrng_tail_list_append(&list, &two);
+  otrng_tail_list_append(&list, &three);
+  g_assert_cmpint(otrng_tail_list_len(&list), ==, 3);
+  g_assert_cmpint(one, ==, *((int *)list.head->data));
+  g_assert_cmpint(three, ==, *((int *)list.tail->data));
+
+  otrng_tail_list_copy(&copy, &list);
+  g_assert_cmpint(otrng_tail_list_len(&copy), ==, 3);
+  otrng_assert(copy.head != list.head);
+  g_assert_cmpint(two, ==, *((int *)copy.head->next->data));
+
+  // Removing the last node moves the tail back
+  otrng_tail_list_remove(&list, list.tail);
+  g_assert_cmpint(two, ==, *((int *)list.tail->data));
+  otrng_assert(!list.tail->next);
+
+  otrng_tail_list_remove(&list, list.head);
+  g_assert_cmpint(two, ==, *((int *)list.head->data));
+  otrng_assert(list.head == list.tail);
+
+  otrng_tail_list_remove(&list, list.head);
+  g_assert_cmpint(otrng_tail_list_len(&list), ==, 0);
+  otrng_assert(!list.head);
+  otrng_assert(!list.tail);
+
+  // Appending works again once emptied
+  otrng_tail_list_append(&list, &one);
+  otrng_assert(list.head == list.tail);
+
+  otrng_tail_list_free(&list, NULL);
+  otrng_tail_list_free(&copy, NULL);
+  otrng_assert(!copy.head);
+}
+
+static void test_vector() {
+  int values[20];
+  otrng_vector_s vector, copy;
+  size_t i;
+
+  otrng_vector_init(&vector);
+  otrng_assert(!otrng_vector_get(&vector, 0));
+
+  for (i = 0; i < 20; i++) {
+    values[i] = i;
+    otrng_vector_push(&vector, &values[i]);
+  }
+  g_assert_cmpint(otrng_vector_len(&vector), ==, 20);
+  g_assert_cmpint(*(int *)otrng_vector_get(&vector, 19), ==, 19);
+
+  otrng_vector_copy(&copy, &vector);
+
+  // Removing keeps the order
+  g_assert_cmpint(*(int *)otrng_vector_remove(&vector, 5), ==, 5);
+  g_assert_cmpint(otrng_vector_len(&vector), ==, 19);
+  g_assert_cmpint(*(int *)otrng_vector_get(&vector, 5), ==, 6);
+  g_assert_cmpint(*(int *)otrng_vector_get(&vector, 18), ==, 19);
+  otrng_assert(!otrng_vector_get(&vector, 19));
+  otrng_assert(!otrng_vector_remove(&vector, 19));
+
+  g_assert_cmpint(otrng_vector_len(&copy), ==, 20);
+  g_assert_cmpint(*(int *)otrng_vector_get(&copy, 5), ==, 5);
+
+  otrng_vector_free(&vector, NULL);
+  otrng_vector_free(&copy, NULL);
+  g_assert_cmpint(otrng_vector_len(&vector), ==, 0);
+}
+
+#define BENCHMARK_ITEMS 5000
+
+static void test_append_benchmark() {
+  int value = 0;
+  list_element_s *list = NULL;
+  otrng_tail_list_s tail_list;
+  otrng_vector_s vector;
+  double list_time, tail_list_time, vector_time;
+  size_t i, n = g_test_perf() ? BENCHMARK_ITEMS * 10 : BENCHMARK_ITEMS;
+
+  g_test_timer_start();
+  for (i = 0; i < n; i++) {
+    list = otrng_list_add(&value, list);
+  }
+  g_assert_cmpint(otrng_list_len(list), ==, n);
+  list_time = g_test_timer_elapsed();
+
+  otrng_tail_list_init(&tail_list);
+  g_test_timer_start();
+  for (i = 0; i < n; i++) {
+    otrng_tail_list_append(&tail_list, &value);
+  }
+  g_assert_cmpint(otrng_tail_list_len(&tail_list), ==, n);
+  tail_list_time = g_test_timer_elapsed();
+
+  otrng_vector_init(&vector);
+  g_test_timer_start();
+  for (i = 0; i < n; i++) {
+    otrng_vector_push(&vector, &value);
+  }
+  g_assert_cmpint(otrng_vector_len(&vector), ==, n);
+  vector_time = g_test_timer_elapsed();
+
+  g_test_minimized_result(list_time, "list: %lu appends in %.4fs",
+                          (unsigned long)n, list_time);
+  g_test_minimized_result(tail_list_time, "tail list: %lu appends in %.4fs",
+                          (unsigned long)n, tail_list_time);
+  g_test_minimized_result(vector_time, "vector: %lu appends in %.4fs",
+                          (unsigned long)n, vector_time);
+
+  /* Quadratic against linear: even on a loaded machine, this is far apart */
+  otrng_assert(tail_list_time < list_time);
+
+  otrng_list_free_nodes(list);
+  otrng_tail_list_free(&tail_list, NULL);
+  otrng_vector_free(&vector, NULL);
+}
+
 void units_list_add_tests(void) {
   g_test_add_func("/list/add", test_otrng_list_add);
   g_test_add_func("/list/copy", test_otrng_list_copy);
@@ -163,4 +286,7 @@ void units_list_add_tests(void) {
   g_test_add_func("/list/get_by_value", test_otrng_list_get_by_value);
   g_test_add_func("/list/length", test_otrng_list_len);
   g_test_add_func("/list/empty_size", test_list_empty_size);
+  g_test_add_func("/list/tail_list", test_tail_list);
+  g_test_add_func("/list/vector", test_vector);
+  g_test_add_func("/list/append_benchmark", test_append_benchmark);
 }
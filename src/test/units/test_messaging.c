@@ -318,7 +318,7 @@ static void test_global_state_prekey_message_management(void) {
   otrng_client_s *client =
       get_client(state, create_client_id("otr", charlie_account));
 
-  otrng_assert(client->our_prekeys);
+  otrng_assert(client->our_prekeys.head);
 
   uint32_t message_id = 831563016;
   const prekey_message_s *stored_prekey = NULL;
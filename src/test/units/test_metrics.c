@@ -0,0 +1,133 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include "test_helpers.h"
+
+#include "test_fixtures.h"
+
+#include "metrics.h"
+
+static void test_histogram_buckets(void) {
+  uint64_t ns, lower, upper;
+  size_t bucket;
+
+  for (ns = 0; ns < 1 << 16; ns++) {
+    bucket = histogram_bucket(ns);
+    upper = otrng_histogram_bucket_upper_bound(bucket);
+    lower = bucket ? otrng_histogram_bucket_upper_bound(bucket - 1) : 0;
+
+    otrng_assert(lower <= ns);
+    otrng_assert(ns < upper);
+    /* Buckets are log-linear: at most a quarter wider than their start */
+    otrng_assert(upper - lower <= lower / 4 + 1);
+  }
+
+  g_assert_cmpuint(histogram_bucket(UINT64_MAX), ==,
+                   OTRNG_HISTOGRAM_BUCKETS - 1);
+  g_assert_cmpuint(
+      otrng_histogram_bucket_upper_bound(OTRNG_HISTOGRAM_BUCKETS - 1), ==,
+      UINT64_MAX);
+}
+
+static void test_histogram_percentile(void) {
+  otrng_histogram_s histogram;
+
+  memset(&histogram, 0, sizeof(otrng_histogram_s));
+  g_assert_cmpuint(otrng_histogram_percentile(&histogram, 50), ==, 0);
+
+  /* 90 latencies of 1000ns and 10 of 1000000ns */
+  histogram.count = 100;
+  histogram.max_ns = 1000000;
+  histogram.buckets[histogram_bucket(1000)] = 90;
+  histogram.buckets[histogram_bucket(1000000)] = 10;
+
+  g_assert_cmpuint(otrng_histogram_percentile(&histogram, 50), ==,
+                   otrng_histogram_bucket_upper_bound(histogram_bucket(1000)));
+  g_assert_cmpuint(otrng_histogram_percentile(&histogram, 99), ==, 1000000);
+  g_assert_cmpuint(otrng_histogram_percentile(&histogram, 100), ==, 1000000);
+}
+
+static void test_metric_names(void) {
+  g_assert_cmpstr(otrng_metric_name(OTRNG_METRIC_DAKE_AUTH_R), ==,
+                  "dake_auth_r");
+  g_assert_cmpstr(otrng_metric_name(OTRNG_METRIC_PREKEY_DAKE3), ==,
+                  "prekey_dake3");
+  g_assert_cmpstr(otrng_metric_name(OTRNG_NUM_METRICS), ==, "unknown");
+}
+
+static void test_global_state_metrics(void) {
+  otrng_client_s *alice_client = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *bob_client = otrng_client_new(BOB_IDENTITY);
+  otrng_metrics_s metrics;
+  string_p to_send = NULL;
+
+  otrng_s *alice = set_up(alice_client, 1);
+  otrng_s *bob = set_up(bob_client, 2);
+
+  do_dake_fixture(alice, bob);
+  assert_message_sent(otrng_send_message(&to_send, "hi", NULL, 0, alice),
+                      to_send);
+  otrng_free(to_send);
+
+#ifdef OTRNG_ENABLE_METRICS
+  otrng_assert_is_success(
+      otrng_global_state_get_metrics(&metrics, alice_client->global_state));
+
+  /* Alice received the Identity and Auth-I messages */
+  g_assert_cmpuint(metrics.histograms[OTRNG_METRIC_DAKE_IDENTITY].count, ==,
+                   1);
+  g_assert_cmpuint(metrics.histograms[OTRNG_METRIC_DAKE_AUTH_I].count, ==, 1);
+  g_assert_cmpuint(metrics.histograms[OTRNG_METRIC_DAKE_AUTH_I].errors, ==, 0);
+  g_assert_cmpuint(metrics.histograms[OTRNG_METRIC_DAKE_AUTH_R].count, ==, 0);
+  g_assert_cmpuint(metrics.histograms[OTRNG_METRIC_ENCRYPT].count, >=, 1);
+  g_assert_cmpuint(metrics.histograms[OTRNG_METRIC_KEYGEN].count, >=, 1);
+  g_assert_cmpuint(metrics.histograms[OTRNG_METRIC_DAKE_IDENTITY].max_ns, >,
+                   0);
+
+  otrng_global_state_reset_metrics(alice_client->global_state);
+  otrng_assert_is_success(
+      otrng_global_state_get_metrics(&metrics, alice_client->global_state));
+  g_assert_cmpuint(metrics.histograms[OTRNG_METRIC_DAKE_IDENTITY].count, ==,
+                   0);
+
+  /* Bob started the DAKE and received the Auth-R message */
+  otrng_assert_is_success(
+      otrng_global_state_get_metrics(&metrics, bob_client->global_state));
+  g_assert_cmpuint(metrics.histograms[OTRNG_METRIC_DAKE_START].count, ==, 1);
+  g_assert_cmpuint(metrics.histograms[OTRNG_METRIC_DAKE_AUTH_R].count, ==, 1);
+  g_assert_cmpuint(metrics.histograms[OTRNG_METRIC_DECRYPT].count, ==, 1);
+#else
+  otrng_assert_is_error(
+      otrng_global_state_get_metrics(&metrics, alice_client->global_state));
+#endif
+
+  otrng_global_state_free(alice_client->global_state);
+  otrng_global_state_free(bob_client->global_state);
+  otrng_conn_free_all(alice, bob);
+}
+
+void units_metrics_add_tests(void) {
+  g_test_add_func("/metrics/histogram_buckets", test_histogram_buckets);
+  g_test_add_func("/metrics/histogram_percentile", test_histogram_percentile);
+  g_test_add_func("/metrics/names", test_metric_names);
+  g_test_add_func("/metrics/global_state", test_global_state_metrics);
+}
@@ -106,7 +106,7 @@ static void test_otrng_prekey_message_deserializes() {
   otrng_assert_is_success(
       otrng_prekey_message_serialize_into(&ser, &ser_len, prekey_msg));
 
-  prekey_message_s *deser = otrng_xmalloc_z(sizeof(prekey_message_s));
+  prekey_message_s *deser = otrng_prekey_message_new();
   otrng_assert_is_success(
       otrng_prekey_message_deserialize(deser, ser, ser_len, NULL));
 
@@ -24,6 +24,7 @@
 
 #include "client_orchestration.h"
 #include "messaging.h"
+#include "write_back.h"
 
 #include <libotr/privkey.h>
 
@@ -121,11 +122,14 @@ static void load_prekey_messages(otrng_client_s *client) {
   load_prekey_messages__called_with = client;
 
   if (load_prekey_messages__should_assign) {
-    if (client->our_prekeys != NULL) {
-      otrng_list_free(client->our_prekeys, prekey_free_from_list);
-    }
+    list_element_s *current;
 
-    client->our_prekeys = load_prekey_messages__assign;
+    otrng_tail_list_free(&client->our_prekeys, prekey_free_from_list);
+    for (current = load_prekey_messages__assign; current;
+         current = current->next) {
+      otrng_tail_list_append(&client->our_prekeys, current->data);
+    }
+    otrng_list_free_nodes(load_prekey_messages__assign);
   }
 }
 
@@ -1584,17 +1588,17 @@ static void test__otrng_client_ensure_correct_state__prekey_messages__creates(
   g_assert_cmpint(load_prekey_messages__called, ==, 1);
   g_assert_cmpint(store_prekey_messages__called, ==, 1);
 
-  g_assert_cmpint(otrng_list_len(f->client->our_prekeys), ==, 3);
+  g_assert_cmpint(otrng_tail_list_len(&f->client->our_prekeys), ==, 3);
   g_assert_cmpint(f->client->prekey_msgs_num_to_publish, ==, 0);
 
   g_assert(f->client->should_publish == otrng_true);
-  g_assert(
-      ((prekey_message_s *)(f->client->our_prekeys->data))->should_publish ==
-      otrng_false);
-  g_assert(((prekey_message_s *)(f->client->our_prekeys->next->data))
-               ->should_publish == otrng_true);
-  g_assert(((prekey_message_s *)(f->client->our_prekeys->next->next->data))
+  g_assert(((prekey_message_s *)(f->client->our_prekeys.head->data))
+               ->should_publish == otrng_false);
+  g_assert(((prekey_message_s *)(f->client->our_prekeys.head->next->data))
                ->should_publish == otrng_true);
+  g_assert(
+      ((prekey_message_s *)(f->client->our_prekeys.head->next->next->data))
+          ->should_publish == otrng_true);
 
   f->client->keypair = NULL;
   v3_remove_key(f->v3_key);
@@ -1626,7 +1630,7 @@ test__otrng_client_ensure_correct_state__prekey_messages__creates_based_on_to_pu
   g_assert_cmpint(load_prekey_messages__called, ==, 1);
   g_assert_cmpint(store_prekey_messages__called, ==, 1);
 
-  g_assert_cmpint(otrng_list_len(f->client->our_prekeys), ==, 5);
+  g_assert_cmpint(otrng_tail_list_len(&f->client->our_prekeys), ==, 5);
   g_assert_cmpint(f->client->prekey_msgs_num_to_publish, ==, 0);
 
   f->client->keypair = NULL;
@@ -1660,7 +1664,7 @@ static void test__otrng_client_ensure_correct_state__prekey_messages__fails(
   g_assert_cmpint(load_prekey_messages__called, ==, 1);
   g_assert_cmpint(store_prekey_messages__called, ==, 0);
 
-  g_assert_cmpint(otrng_list_len(f->client->our_prekeys), ==, 3);
+  g_assert_cmpint(otrng_tail_list_len(&f->client->our_prekeys), ==, 3);
   g_assert_cmpint(f->client->prekey_msgs_num_to_publish, ==, 0);
 
   f->client->keypair = NULL;
@@ -1748,6 +1752,285 @@ static void test__otrng_client_ensure_correct_state__v3_key__fails(
   f->client->keypair = NULL;
 }
 
+static void test__otrng_client_ensure_correct_state__write_back__coalesces(
+    orchestration_fixture_s *f, gconstpointer data) {
+  otrng_write_back_stats_s stats;
+
+  (void)data;
+
+  otrng_global_state_set_write_back(f->gs, otrng_true, 0);
+  create_privkey_v4__assign = f->long_term_key;
+
+  otrng_client_ensure_correct_state(f->client);
+  g_assert_cmpint(create_privkey_v4__called, ==, 1);
+
+  /* The new key is only marked as dirty, and stored on the flush */
+  g_assert_cmpint(store_privkey_v4__called, ==, 0);
+  otrng_assert(otrng_client_is_dirty(f->client, OTRNG_SECTION_PRIVKEY_V4));
+
+  /* Marking it again does not store it twice */
+  otrng_client_store_section(f->client, OTRNG_SECTION_PRIVKEY_V4);
+
+  otrng_assert_is_success(
+      otrng_global_state_write_back_flush(f->gs, otrng_true, &stats));
+  g_assert_cmpint(store_privkey_v4__called, ==, 1);
+  g_assert(store_privkey_v4__called_with == f->client);
+  g_assert_cmpuint(stats.clients, ==, 1);
+  g_assert_cmpuint(stats.sections, >=, 1);
+  g_assert_cmpuint(stats.callbacks, >=, 1);
+  g_assert_cmpuint(stats.bytes_written, ==, 0);
+  g_assert_cmpuint(f->client->dirty_sections, ==, 0);
+
+  otrng_assert_is_success(
+      otrng_global_state_write_back_flush(f->gs, otrng_true, &stats));
+  g_assert_cmpint(store_privkey_v4__called, ==, 1);
+  g_assert_cmpuint(stats.sections, ==, 0);
+
+  otrng_global_state_set_write_back(f->gs, otrng_false, 0);
+  f->client->keypair = NULL;
+}
+
+static int startup_report__called = 0;
+static otrng_client_startup_report_s startup_report__copy;
+static void startup_report(otrng_client_s *client,
+                           const otrng_client_startup_report_s *report) {
+  (void)client;
+  startup_report__called++;
+  startup_report__copy = *report;
+}
+
+static void test__otrng_client_ensure_correct_state__startup_report(
+    orchestration_fixture_s *f, gconstpointer data) {
+  const otrng_startup_phase_timing_s *phases = startup_report__copy.phases;
+  int i;
+
+  (void)data;
+
+  f->callbacks->startup_report = startup_report;
+  startup_report__called = 0;
+
+  f->client->keypair = f->long_term_key;
+  v3_add_key_to(f->client->global_state->user_state_v3, f->v3_key, f->client);
+  f->client->forging_key = &f->forging_key->pub;
+  f->client->client_profile = f->client_profile;
+  f->client->prekey_profile = f->prekey_profile;
+  f->client->exp_client_profile = f->client_profile;
+  f->client->exp_prekey_profile = f->prekey_profile;
+
+  otrng_client_ensure_correct_state(f->client);
+
+  g_assert_cmpint(startup_report__called, ==, 1);
+  otrng_assert(!f->client->startup_report);
+  otrng_assert(startup_report__copy.ready);
+
+  /* Every ensure_ step ran once. Only the prekey messages and the
+     fingerprints had to be loaded and created */
+  for (i = OTRNG_STARTUP_ENSURE_LONG_TERM_KEY; i < OTRNG_STARTUP_PHASE_COUNT;
+       i++) {
+    g_assert_cmpuint(phases[i].calls, ==, 1);
+  }
+  g_assert_cmpuint(phases[OTRNG_STARTUP_LOAD_PRIVKEY_V4].calls, ==, 0);
+  g_assert_cmpuint(phases[OTRNG_STARTUP_CREATE_CLIENT_PROFILE].calls, ==, 0);
+  g_assert_cmpuint(phases[OTRNG_STARTUP_LOAD_PREKEY_MESSAGES].calls, ==, 1);
+  g_assert_cmpuint(phases[OTRNG_STARTUP_CREATE_PREKEY_MESSAGES].calls, ==, 1);
+  g_assert_cmpuint(phases[OTRNG_STARTUP_CREATE_FINGERPRINTS_V4].calls, ==, 1);
+
+  g_assert_cmpuint(
+      phases[OTRNG_STARTUP_ENSURE_PREKEY_MESSAGES].total_us, >=,
+      phases[OTRNG_STARTUP_CREATE_PREKEY_MESSAGES].total_us);
+  g_assert_cmpuint(startup_report__copy.total_us, >=,
+                   phases[OTRNG_STARTUP_ENSURE_PREKEY_MESSAGES].total_us);
+
+  g_assert_cmpstr(otrng_startup_phase_name(OTRNG_STARTUP_LOAD_PRIVKEY_V4), ==,
+                  "load_privkey_v4");
+  g_assert_cmpstr(
+      otrng_startup_phase_name(OTRNG_STARTUP_ENSURE_FINGERPRINTS_V3), ==,
+      "ensure_fingerprints_v3");
+
+  f->client->keypair = NULL;
+  v3_remove_key(f->v3_key);
+  f->client->forging_key = NULL;
+  f->client->client_profile = NULL;
+  f->client->prekey_profile = NULL;
+  f->client->exp_client_profile = NULL;
+  f->client->exp_prekey_profile = NULL;
+}
+
+static size_t startup_progress__done = 0;
+static size_t startup_progress__ready = 0;
+static void startup_progress(const otrng_client_s *client, otrng_bool ready,
+                             size_t done, size_t total, void *ctx) {
+  (void)client;
+  (void)ctx;
+
+  g_assert_cmpuint(done, ==, startup_progress__done + 1);
+  g_assert_cmpuint(total, ==, 4);
+  startup_progress__done = done;
+  if (ready) {
+    startup_progress__ready++;
+  }
+}
+
+/* The parallel startup loads and stores through the global state, the way an
+   application keeping all of its accounts in one file does: every load reads
+   the records of every client, and every store writes all of them */
+static const char *parallel_accounts[4] = {"sita@otr.im", "sita1@otr.im",
+                                           "sita2@otr.im", "sita3@otr.im"};
+static FILE *parallel_privkeys = NULL;
+static FILE *parallel_prekeys = NULL;
+
+static otrng_client_id_s read_parallel_client_id(FILE *fp) {
+  char line[100];
+  otrng_client_id_s result = {
+      .protocol = NULL,
+      .account = NULL,
+  };
+  size_t len;
+  int n;
+
+  if (!fgets(line, sizeof(line), fp)) {
+    return result;
+  }
+
+  len = strlen(line);
+  if (len > 0 && line[len - 1] == '\n') {
+    line[len - 1] = 0;
+  }
+
+  for (n = 0; n < 4; n++) {
+    if (strncmp(line, "test-otr:", 9) == 0 &&
+        strcmp(line + 9, parallel_accounts[n]) == 0) {
+      result.protocol = "test-otr";
+      result.account = parallel_accounts[n];
+    }
+  }
+
+  return result;
+}
+
+static void load_privkey_v4_from_file(otrng_client_s *client) {
+  load_privkey_v4__called++;
+  rewind(parallel_privkeys);
+  (void)otrng_global_state_private_key_v4_read_from(
+      client->global_state, parallel_privkeys, read_parallel_client_id);
+}
+
+static void load_prekey_messages_from_file(otrng_client_s *client) {
+  load_prekey_messages__called++;
+  rewind(parallel_prekeys);
+  (void)otrng_global_state_prekeys_read_from(
+      client->global_state, parallel_prekeys, read_parallel_client_id);
+}
+
+static void store_prekey_messages_to_file(otrng_client_s *client) {
+  store_prekey_messages__called++;
+  fclose(parallel_prekeys);
+  parallel_prekeys = tmpfile();
+  (void)otrng_global_state_prekey_messages_write_to(client->global_state,
+                                                    parallel_prekeys);
+}
+
+static void test__otrng_global_state_ensure_correct_state__parallel(
+    orchestration_fixture_s *f, gconstpointer data) {
+  otrng_client_s *clients[4];
+  OtrlPrivKey *v3_keys[4];
+  otrng_startup_report_s report;
+  otrng_client_id_s client_id;
+  uint32_t first_ids[4];
+  int i;
+
+  (void)data;
+
+  f->callbacks->load_privkey_v4 = load_privkey_v4_from_file;
+  f->callbacks->load_prekey_messages = load_prekey_messages_from_file;
+  f->callbacks->store_prekey_messages = store_prekey_messages_to_file;
+
+  client_id.protocol = f->client_id.protocol;
+  clients[0] = f->client;
+  for (i = 1; i < 4; i++) {
+    client_id.account = parallel_accounts[i];
+    clients[i] = otrng_client_new(client_id);
+    clients[i]->max_published_prekey_msg = 3;
+    clients[i]->minimum_stored_prekey_msg = 2;
+    clients[i]->global_state = f->gs;
+    f->gs->clients = otrng_list_add(clients[i], f->gs->clients);
+  }
+
+  /* The keys of every client are stored, and no prekey messages */
+  parallel_privkeys = tmpfile();
+  parallel_prekeys = tmpfile();
+  for (i = 0; i < 4; i++) {
+    clients[i]->keypair = f->long_term_key;
+  }
+  otrng_assert_is_success(
+      otrng_global_state_private_key_v4_write_to(f->gs, parallel_privkeys));
+
+  /* Everything else but the prekey messages is there already, so each client
+     loads its key and generates its own messages */
+  for (i = 0; i < 4; i++) {
+    clients[i]->keypair = NULL;
+    clients[i]->forging_key = &f->forging_key->pub;
+    clients[i]->client_profile = f->client_profile;
+    clients[i]->prekey_profile = f->prekey_profile;
+    clients[i]->exp_client_profile = f->client_profile;
+    clients[i]->exp_prekey_profile = f->prekey_profile;
+    v3_keys[i] = i == 0 ? f->v3_key : v3_create_new_key(clients[i]);
+    v3_add_key_to(f->gs->user_state_v3, v3_keys[i], clients[i]);
+  }
+
+  startup_progress__done = 0;
+  startup_progress__ready = 0;
+  otrng_assert_is_success(otrng_global_state_ensure_correct_state(
+      f->gs, 4, startup_progress, NULL, &report));
+
+  g_assert_cmpuint(report.num_clients, ==, 4);
+  g_assert_cmpuint(report.num_ready, ==, 4);
+  g_assert_cmpuint(report.num_threads, ==, 4);
+  g_assert_cmpuint(startup_progress__done, ==, 4);
+  g_assert_cmpuint(startup_progress__ready, ==, 4);
+  otrng_assert(!f->gs->shared_lock);
+  g_assert_cmpuint(otrng_list_len(f->gs->clients), ==, 4);
+
+  /* The first load gave every client its key */
+  g_assert_cmpint(load_privkey_v4__called, >=, 1);
+  g_assert_cmpint(load_prekey_messages__called, ==, 4);
+  g_assert_cmpint(store_prekey_messages__called, ==, 4);
+  for (i = 0; i < 4; i++) {
+    otrng_assert(clients[i]->keypair);
+    otrng_assert(otrng_ec_point_eq(clients[i]->keypair->pub,
+                                   f->long_term_key->pub));
+    g_assert_cmpint(otrng_tail_list_len(&clients[i]->our_prekeys), ==, 3);
+  }
+
+  /* And the last store has the messages of all of them */
+  for (i = 0; i < 4; i++) {
+    first_ids[i] = ((prekey_message_s *)clients[i]->our_prekeys.head->data)->id;
+  }
+  load_prekey_messages_from_file(f->client);
+  for (i = 0; i < 4; i++) {
+    g_assert_cmpint(otrng_tail_list_len(&clients[i]->our_prekeys), ==, 3);
+    otrng_assert(otrng_client_get_prekey_by_id(first_ids[i], clients[i]));
+  }
+
+  fclose(parallel_privkeys);
+  fclose(parallel_prekeys);
+  parallel_privkeys = NULL;
+  parallel_prekeys = NULL;
+
+  for (i = 0; i < 4; i++) {
+    clients[i]->forging_key = NULL;
+    clients[i]->client_profile = NULL;
+    clients[i]->prekey_profile = NULL;
+    clients[i]->exp_client_profile = NULL;
+    clients[i]->exp_prekey_profile = NULL;
+    v3_remove_key(v3_keys[i]);
+    if (i > 0) {
+      v3_free_key(v3_keys[i]);
+      otrng_client_free(clients[i]);
+    }
+  }
+}
+
 #define WITH_O_FIXTURE(_p, _c)                                                 \
   WITH_FIXTURE(_p, _c, orchestration_fixture_s, orchestration_fixture)
 
@@ -1894,4 +2177,13 @@ void units_orchestration_add_tests(void) {
                  test__otrng_client_ensure_correct_state__v3_key__creates);
   WITH_O_FIXTURE("/orchestration/ensure_correct_state/v3_key/fails",
                  test__otrng_client_ensure_correct_state__v3_key__fails);
+
+  WITH_O_FIXTURE("/orchestration/ensure_correct_state/write_back/coalesces",
+                 test__otrng_client_ensure_correct_state__write_back__coalesces);
+
+  WITH_O_FIXTURE("/orchestration/ensure_correct_state/startup_report",
+                 test__otrng_client_ensure_correct_state__startup_report);
+
+  WITH_O_FIXTURE("/orchestration/global_state/ensure_correct_state/parallel",
+                 test__otrng_global_state_ensure_correct_state__parallel);
 }
@@ -19,12 +19,14 @@
  */
 
 #include <glib.h>
+#include <sodium.h>
 #include <string.h>
 
 #include "test_helpers.h"
 
 #include "test_fixtures.h"
 
+#include "alloc.h"
 #include "otrng.h"
 
 static void test_otrng_builds_query_message(otrng_fixture_s *otrng_fixture,
@@ -266,7 +268,7 @@ static void test_otrng_build_prekey_ensemble() {
   // Stores the same prekey message sent
   // TODO: Assert the instance tag
   // TODO: Assert the private part
-  prekey_message_s *stored = client->our_prekeys->data;
+  prekey_message_s *stored = client->our_prekeys.head->data;
   otrng_assert(stored);
   otrng_assert_ec_public_key_eq(ensemble->message->Y, stored->y->pub);
   otrng_assert_dh_public_key_eq(ensemble->message->B, stored->b->pub);
@@ -475,7 +477,7 @@ void test_start_with_whitespace_tag(void) {
   otrng_assert(response_to_alice->to_send == NULL);
   otrng_assert(response_to_alice->to_display == NULL);
 
-  g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 1);
+  g_assert_cmpint(otrng_vector_len(&bob->keys->old_mac_keys), ==, 1);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 1);
@@ -508,7 +510,7 @@ void test_send_with_padding(void) {
   /* Alice sends a data message */
   result = otrng_send_message(&to_send_1, "hi", NULL, 0, alice);
   assert_message_sent(result, to_send_1);
-  otrng_assert(!alice->keys->old_mac_keys);
+  otrng_assert(otrng_vector_len(&alice->keys->old_mac_keys) == 0);
 
   g_assert_cmpint(alice->keys->i, ==, 1);
   g_assert_cmpint(alice->keys->j, ==, 2);
@@ -524,6 +526,116 @@ void test_send_with_padding(void) {
   otrng_conn_free_all(alice, bob);
 }
 
+typedef struct allocation_counts_s {
+  unsigned long allocs;
+  unsigned long reallocs;
+  unsigned long secure_allocs; /* also counted in allocs */
+} allocation_counts_s;
+
+static void *count_alloc(size_t size, otrng_alloc_subsystem subsystem,
+                         void *context) {
+  allocation_counts_s *counts = context;
+  (void)subsystem;
+  counts->allocs++;
+  return malloc(size);
+}
+
+static void *count_realloc(void *ptr, size_t size, void *context) {
+  allocation_counts_s *counts = context;
+  counts->reallocs++;
+  return realloc(ptr, size);
+}
+
+static void count_free(void *ptr, void *context) {
+  (void)context;
+  free(ptr);
+}
+
+static void *count_secure_alloc(size_t size, otrng_alloc_subsystem subsystem,
+                                void *context) {
+  allocation_counts_s *counts = context;
+  (void)subsystem;
+  counts->allocs++;
+  counts->secure_allocs++;
+  return sodium_malloc(size);
+}
+
+static void count_secure_free(void *ptr, void *context) {
+  (void)context;
+  sodium_free(ptr);
+}
+
+#define COUNTED_MESSAGES 8
+
+/* Counts what the library allocates itself - libotr and libgcrypt have their
+   own allocators - to send and to receive a data message once the
+   conversation is set up */
+static void test_allocations_per_message(void) {
+  otrng_client_s *alice_client = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *bob_client = otrng_client_new(BOB_IDENTITY);
+  allocation_counts_s sending = {0, 0, 0}, receiving = {0, 0, 0};
+  otrng_allocator_s normal = {count_alloc, count_realloc, count_free, NULL};
+  otrng_allocator_s secure = {count_secure_alloc, NULL, count_secure_free,
+                              NULL};
+  otrng_response_s *response;
+  string_p to_send = NULL;
+  int message;
+
+  otrng_s *alice = set_up(alice_client, 1);
+  otrng_s *bob = set_up(bob_client, 2);
+  alice_client->should_heartbeat = test_should_not_heartbeat;
+  bob_client->should_heartbeat = test_should_not_heartbeat;
+
+  do_dake_fixture(alice, bob);
+
+  /* The first message gives the arenas their chunk */
+  for (message = 0; message <= COUNTED_MESSAGES; message++) {
+    normal.context = &sending;
+    secure.context = &sending;
+    if (message > 0) {
+      otrng_assert_is_success(otrng_set_allocators(&normal, &secure));
+    }
+    otrng_assert_is_success(
+        otrng_send_message(&to_send, "hi", NULL, 0, alice));
+    otrng_assert_is_success(otrng_set_allocators(NULL, NULL));
+
+    response = otrng_response_new();
+
+    normal.context = &receiving;
+    secure.context = &receiving;
+    if (message > 0) {
+      otrng_assert_is_success(otrng_set_allocators(&normal, &secure));
+    }
+    otrng_assert_is_success(otrng_receive_message(response, to_send, bob));
+    otrng_assert_is_success(otrng_set_allocators(NULL, NULL));
+
+    otrng_assert_cmpmem("hi", response->to_display, 3);
+    otrng_response_free(response);
+    free(to_send);
+    to_send = NULL;
+  }
+
+  g_test_message("per message: %.1f allocations (%.1f secure) and %.1f "
+                 "reallocations to send, %.1f allocations (%.1f secure) and "
+                 "%.1f reallocations to receive",
+                 (double)sending.allocs / COUNTED_MESSAGES,
+                 (double)sending.secure_allocs / COUNTED_MESSAGES,
+                 (double)sending.reallocs / COUNTED_MESSAGES,
+                 (double)receiving.allocs / COUNTED_MESSAGES,
+                 (double)receiving.secure_allocs / COUNTED_MESSAGES,
+                 (double)receiving.reallocs / COUNTED_MESSAGES);
+
+  /* Sending takes everything from the arena. Receiving still allocates the
+     defragmented copy, the temporary receiving ratchet, the old MAC key and
+     the message handed to the application */
+  g_assert_cmpuint(sending.allocs, <=, COUNTED_MESSAGES);
+  g_assert_cmpuint(receiving.allocs, <=, 5 * COUNTED_MESSAGES);
+
+  otrng_global_state_free(alice_client->global_state);
+  otrng_global_state_free(bob_client->global_state);
+  otrng_conn_free_all(alice, bob);
+}
+
 void units_otrng_add_tests(void) {
   (void)test_otrng_receives_identity_message_invalid_on_start; // this function
                                                                // is unused
@@ -575,4 +687,6 @@ void units_otrng_add_tests(void) {
   g_test_add_func("/otrng/start_with_whitespace_tag",
                   test_start_with_whitespace_tag);
   g_test_add_func("/otrng/send_with_padding", test_send_with_padding);
+  g_test_add_func("/otrng/allocations_per_message",
+                  test_allocations_per_message);
 }
@@ -19,9 +19,15 @@
  */
 
 #include <glib.h>
+#include <unistd.h>
 
 #include "test_helpers.h"
 
+#include "test_fixtures.h"
+
+#include "account_store.h"
+#include "fingerprint_journal.h"
+#include "write_back.h"
 #include "persistence.h"
 
 /* Expects the file pointer to be at the END of the file */
@@ -476,6 +482,605 @@ static void test_persistence_import_v4_failures() {
   otrng_free((char *)client_id.account);
 }
 
+static otrng_client_id_s read_alice_client_id(FILE *fp) {
+  char line[100];
+  otrng_client_id_s result = {
+      .protocol = NULL,
+      .account = NULL,
+  };
+
+  if (!fgets(line, sizeof(line), fp) ||
+      strcmp(line, "otr:" ALICE_ACCOUNT "\n") != 0) {
+    return result;
+  }
+
+  result.protocol = "otr";
+  result.account = ALICE_ACCOUNT;
+  return result;
+}
+
+static uint8_t *write_account_store(size_t *len, otrng_global_state_s *gs) {
+  FILE *fp = tmpfile();
+  uint8_t *buffer;
+  long size;
+
+  otrng_assert_is_success(otrng_global_state_account_store_write_to(gs, fp));
+  size = ftell(fp);
+  otrng_assert(size > 0);
+
+  buffer = otrng_xmalloc(size);
+  rewind(fp);
+  otrng_assert(fread(buffer, size, 1, fp) == 1);
+  fclose(fp);
+
+  *len = size;
+  return buffer;
+}
+
+static void assert_same_account(otrng_client_s *loaded,
+                                const otrng_client_s *client) {
+  const list_element_s *a, *b;
+  otrng_known_fingerprint_s *fpr;
+
+  otrng_assert(loaded->keypair);
+  otrng_assert_cmpmem(client->keypair->sym, loaded->keypair->sym,
+                      ED448_PRIVATE_BYTES);
+  otrng_assert(loaded->forging_key);
+  otrng_assert(otrng_ec_point_eq(*client->forging_key, *loaded->forging_key));
+  otrng_assert(loaded->client_profile);
+  g_assert_cmpuint(loaded->client_profile->sender_instance_tag, ==,
+                   client->client_profile->sender_instance_tag);
+
+  g_assert_cmpint(otrng_tail_list_len(&loaded->our_prekeys), ==,
+                  otrng_tail_list_len(&client->our_prekeys));
+  for (a = client->our_prekeys.head, b = loaded->our_prekeys.head; a && b;
+       a = a->next, b = b->next) {
+    g_assert_cmpuint(((prekey_message_s *)a->data)->id, ==,
+                     ((prekey_message_s *)b->data)->id);
+  }
+
+  fpr = otrng_fingerprint_get_by_username(loaded, "bob@otr.im");
+  otrng_assert(fpr);
+  otrng_assert(fpr->trusted);
+}
+
+static void test_persistence_account_store() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  otrng_global_state_s *gs;
+  otrng_account_store_s *store;
+  otrng_client_s *loaded;
+  otrng_fingerprint fp = {0x42};
+  prekey_message_s **messages;
+  uint8_t *buffer;
+  size_t len;
+
+  set_up_client(alice, 1);
+  messages = otrng_client_build_prekey_messages(3, alice);
+  otrng_assert(messages);
+  otrng_free(messages);
+  otrng_assert(otrng_fingerprint_add(alice, fp, "bob@otr.im", otrng_true));
+
+  buffer = write_account_store(&len, alice->global_state);
+  store = otrng_account_store_open_buffer(buffer, len);
+  otrng_assert(store);
+  /* key, forging key, profile, 3 prekey messages and a fingerprint */
+  g_assert_cmpuint(store->num_records, ==, 7);
+
+  gs = otrng_global_state_new(test_callbacks, otrng_false);
+  otrng_assert_is_success(otrng_global_state_account_store_load(gs, store));
+  otrng_account_store_close(store);
+
+  loaded = otrng_client_get(gs, alice->client_id);
+  g_assert_cmpint(otrng_list_len(gs->clients), ==, 1);
+  assert_same_account(loaded, alice);
+
+  otrng_global_state_free(gs);
+  otrng_free(buffer);
+  otrng_global_state_free(alice->global_state);
+}
+
+static void test_persistence_account_store_corrupted() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  otrng_global_state_s *gs;
+  otrng_account_store_s *store;
+  uint8_t *buffer;
+  size_t len;
+
+  set_up_client(alice, 1);
+  buffer = write_account_store(&len, alice->global_state);
+  gs = otrng_global_state_new(test_callbacks, otrng_false);
+
+  /* A changed record is only found when it is read */
+  buffer[ACCOUNT_STORE_HEADER_BYTES + 20] ^= 0x01;
+  store = otrng_account_store_open_buffer(buffer, len);
+  otrng_assert(store);
+  otrng_assert_is_error(otrng_global_state_account_store_load(gs, store));
+  otrng_account_store_close(store);
+  buffer[ACCOUNT_STORE_HEADER_BYTES + 20] ^= 0x01;
+
+  /* A changed index is found when the store is opened */
+  buffer[len - ACCOUNT_STORE_TRAILER_BYTES - 1] ^= 0x01;
+  otrng_assert(!otrng_account_store_open_buffer(buffer, len));
+  buffer[len - ACCOUNT_STORE_TRAILER_BYTES - 1] ^= 0x01;
+
+  otrng_assert(!otrng_account_store_open_buffer(buffer, len - 1));
+  otrng_assert(!otrng_account_store_open_buffer(buffer, 10));
+
+  otrng_global_state_free(gs);
+  otrng_free(buffer);
+  otrng_global_state_free(alice->global_state);
+}
+
+static void test_persistence_account_store_failed_load() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  otrng_global_state_s *gs;
+  otrng_account_store_s *store;
+  otrng_client_s *loaded;
+  otrng_fingerprint fp = {0x42};
+  prekey_message_s **messages;
+  uint8_t *buffer;
+  size_t len;
+
+  set_up_client(alice, 1);
+  messages = otrng_client_build_prekey_messages(3, alice);
+  otrng_assert(messages);
+  otrng_free(messages);
+  otrng_assert(otrng_fingerprint_add(alice, fp, "bob@otr.im", otrng_true));
+
+  buffer = write_account_store(&len, alice->global_state);
+  gs = otrng_global_state_new(test_callbacks, otrng_false);
+  store = otrng_account_store_open_buffer(buffer, len);
+  otrng_assert(store);
+  otrng_assert_is_success(otrng_global_state_account_store_load(gs, store));
+  otrng_account_store_close(store);
+  loaded = otrng_client_get(gs, alice->client_id);
+
+  /* The fingerprint is the last record, so the prekey messages before it
+     have already been read when it fails */
+  store = otrng_account_store_open_buffer(buffer, len);
+  otrng_assert(store);
+  buffer[store->index_offset - 1] ^= 0x01;
+  otrng_assert_is_error(otrng_global_state_account_store_load(gs, store));
+  otrng_account_store_close(store);
+
+  assert_same_account(loaded, alice);
+
+  otrng_global_state_free(gs);
+  otrng_free(buffer);
+  otrng_global_state_free(alice->global_state);
+}
+
+static void test_persistence_account_store_convert() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  otrng_global_state_s *gs;
+  otrng_account_store_text_files_s text;
+  char filename[] = "/tmp/otrng-account-store-XXXXXX";
+  prekey_message_s **messages;
+  otrng_fingerprint fp = {0x42};
+  FILE *binary;
+  int fd;
+
+  set_up_client(alice, 1);
+  messages = otrng_client_build_prekey_messages(2, alice);
+  otrng_free(messages);
+  otrng_assert(otrng_fingerprint_add(alice, fp, "bob@otr.im", otrng_true));
+
+  memset(&text, 0, sizeof(text));
+  text.read_client_id = read_alice_client_id;
+  text.private_key_v4 = tmpfile();
+  text.forging_key = tmpfile();
+  text.client_profile = tmpfile();
+  text.prekey_messages = tmpfile();
+  text.fingerprints_v4 = tmpfile();
+
+  /* Text to binary */
+  otrng_assert_is_success(otrng_global_state_private_key_v4_write_to(
+      alice->global_state, text.private_key_v4));
+  otrng_assert_is_success(otrng_global_state_forging_key_write_to(
+      alice->global_state, text.forging_key));
+  otrng_assert_is_success(otrng_global_state_client_profile_write_to(
+      alice->global_state, text.client_profile));
+  otrng_assert_is_success(otrng_global_state_prekey_messages_write_to(
+      alice->global_state, text.prekey_messages));
+  otrng_assert_is_success(otrng_global_state_fingerprints_v4_write_to(
+      alice->global_state, text.fingerprints_v4));
+  rewind(text.private_key_v4);
+  rewind(text.forging_key);
+  rewind(text.client_profile);
+  rewind(text.prekey_messages);
+  rewind(text.fingerprints_v4);
+
+  fd = mkstemp(filename);
+  otrng_assert(fd >= 0);
+  binary = fdopen(fd, "wb");
+  otrng_assert(binary);
+
+  gs = otrng_global_state_new(test_callbacks, otrng_false);
+  otrng_assert_is_success(
+      otrng_account_store_convert_from_text(gs, &text, binary));
+  fclose(binary);
+  otrng_global_state_free(gs);
+
+  /* And back to text, through the memory mapped store */
+  fclose(text.private_key_v4);
+  fclose(text.forging_key);
+  fclose(text.client_profile);
+  fclose(text.prekey_messages);
+  fclose(text.fingerprints_v4);
+  memset(&text, 0, sizeof(text));
+  text.read_client_id = read_alice_client_id;
+  text.prekey_messages = tmpfile();
+
+  gs = otrng_global_state_new(test_callbacks, otrng_false);
+  otrng_assert_is_success(
+      otrng_account_store_convert_to_text(gs, filename, &text));
+  assert_same_account(otrng_client_get(gs, alice->client_id), alice);
+  otrng_global_state_free(gs);
+
+  rewind(text.prekey_messages);
+  gs = otrng_global_state_new(test_callbacks, otrng_false);
+  otrng_assert_is_success(otrng_global_state_prekeys_read_from(
+      gs, text.prekey_messages, read_alice_client_id));
+  g_assert_cmpint(
+      otrng_tail_list_len(&otrng_client_get(gs, alice->client_id)->our_prekeys),
+      ==, 2);
+  otrng_global_state_free(gs);
+  fclose(text.prekey_messages);
+
+  unlink(filename);
+  otrng_global_state_free(alice->global_state);
+}
+
+static void test_persistence_prekey_messages_lazy() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  otrng_global_state_s *gs;
+  otrng_client_s *loaded;
+  const prekey_message_s *pm;
+  prekey_message_s **messages;
+  FILE *fp = tmpfile();
+
+  set_up_client(alice, 1);
+  messages = otrng_client_build_prekey_messages(4, alice);
+  otrng_assert(messages);
+  messages[0]->should_publish = otrng_true;
+  otrng_assert_is_success(otrng_global_state_prekey_messages_write_to(
+      alice->global_state, fp));
+  rewind(fp);
+
+  gs = otrng_global_state_new(test_callbacks, otrng_false);
+  loaded = otrng_client_get(gs, alice->client_id);
+  otrng_client_set_lazy_prekeys(otrng_true, loaded);
+  otrng_assert_is_success(
+      otrng_global_state_prekeys_read_from(gs, fp, read_alice_client_id));
+  fclose(fp);
+
+  /* Only the message that still has to be published is deserialized */
+  g_assert_cmpint(otrng_tail_list_len(&loaded->our_prekeys), ==, 1);
+  g_assert_cmpuint(loaded->prekey_index->num_unloaded, ==, 3);
+  g_assert_cmpuint(otrng_client_prekey_messages_count(loaded), ==, 4);
+
+  pm = otrng_client_get_prekey_by_id(messages[2]->id, loaded);
+  otrng_assert(pm);
+  otrng_assert(otrng_ec_point_eq(pm->Y, messages[2]->Y));
+  otrng_assert(otrng_ec_point_eq(pm->y->pub, messages[2]->y->pub));
+  g_assert_cmpint(otrng_tail_list_len(&loaded->our_prekeys), ==, 2);
+  g_assert_cmpuint(loaded->prekey_index->num_unloaded, ==, 2);
+  otrng_assert(otrng_client_get_prekey_by_id(messages[2]->id, loaded) == pm);
+
+  otrng_client_delete_my_prekey_message_by_id(messages[3]->id, loaded);
+  g_assert_cmpuint(otrng_client_prekey_messages_count(loaded), ==, 3);
+
+  /* The messages that were never loaded are still written out */
+  fp = tmpfile();
+  otrng_assert_is_success(otrng_global_state_prekey_messages_write_to(gs, fp));
+  otrng_global_state_free(gs);
+  rewind(fp);
+
+  gs = otrng_global_state_new(test_callbacks, otrng_false);
+  otrng_assert_is_success(
+      otrng_global_state_prekeys_read_from(gs, fp, read_alice_client_id));
+  loaded = otrng_client_get(gs, alice->client_id);
+  g_assert_cmpint(otrng_tail_list_len(&loaded->our_prekeys), ==, 3);
+  otrng_assert(otrng_client_get_prekey_by_id(messages[1]->id, loaded));
+  otrng_assert(!otrng_client_get_prekey_by_id(messages[3]->id, loaded));
+  otrng_global_state_free(gs);
+  fclose(fp);
+
+  otrng_free(messages);
+  otrng_global_state_free(alice->global_state);
+}
+
+static void test_persistence_fingerprints_v4_write() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  otrng_fingerprint fp1, fp2;
+  char expected[1000], *cursor = expected, *written;
+  FILE *fp;
+  int i;
+
+  for (i = 0; i < FPRINT_LEN_BYTES; i++) {
+    fp1[i] = i;
+    fp2[i] = 0xff - i;
+  }
+
+  set_up_client(alice, 1);
+  otrng_fingerprint_add(alice, fp1, "bob@otr.im", otrng_false);
+  otrng_fingerprint_add(alice, fp2, "charlie@otr.im", otrng_true);
+
+  /* The same output the per-byte fprintf used to produce */
+  cursor += sprintf(cursor, "bob@otr.im\t%s\totr\t", ALICE_ACCOUNT);
+  for (i = 0; i < FPRINT_LEN_BYTES; i++) {
+    cursor += sprintf(cursor, "%02x", fp1[i]);
+  }
+  cursor += sprintf(cursor, "\t\ncharlie@otr.im\t%s\totr\t", ALICE_ACCOUNT);
+  for (i = 0; i < FPRINT_LEN_BYTES; i++) {
+    cursor += sprintf(cursor, "%02x", fp2[i]);
+  }
+  sprintf(cursor, "\ttrusted\n");
+
+  fp = tmpfile();
+  otrng_assert_is_success(otrng_client_fingerprints_v4_write_to(alice, fp));
+  written = read_full_file(fp);
+  fclose(fp);
+
+  g_assert_cmpstr(written, ==, expected);
+
+  free(written);
+  otrng_global_state_free(alice->global_state);
+}
+
+static int count_lines(const char *filename) {
+  FILE *fp = fopen(filename, "r");
+  int c, lines = 0;
+
+  if (!fp) {
+    return 0;
+  }
+
+  while ((c = fgetc(fp)) != EOF) {
+    if (c == '\n') {
+      lines++;
+    }
+  }
+  fclose(fp);
+
+  return lines;
+}
+
+static void temporary_file(char *filename) {
+  int fd = mkstemp(filename);
+  otrng_assert(fd >= 0);
+  close(fd);
+}
+
+static void test_persistence_fingerprint_journal_replay() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  char snapshot[] = "/tmp/otrng-fingerprints-XXXXXX";
+  char journal[] = "/tmp/otrng-fingerprints-journal-XXXXXX";
+  otrng_known_fingerprint_s *bob, *charlie;
+  otrng_fingerprint fp1 = {0x01}, fp2 = {0x02};
+  otrng_global_state_s *gs;
+  otrng_client_s *loaded;
+
+  temporary_file(snapshot);
+  temporary_file(journal);
+
+  set_up_client(alice, 1);
+  otrng_global_state_set_fingerprint_journal(alice->global_state, snapshot,
+                                             journal, 0);
+
+  bob = otrng_fingerprint_add(alice, fp1, "bob@otr.im", otrng_false);
+  charlie = otrng_fingerprint_add(alice, fp2, "charlie@otr.im", otrng_true);
+  otrng_assert_is_success(
+      otrng_global_state_fingerprints_v4_flush(alice->global_state));
+  g_assert_cmpint(count_lines(journal), ==, 2);
+
+  /* Only the changes are appended */
+  otrng_fingerprint_set_trusted(alice, bob, otrng_true);
+  otrng_fingerprint_forget(alice, charlie);
+  otrng_assert_is_success(
+      otrng_global_state_fingerprints_v4_flush(alice->global_state));
+  g_assert_cmpint(count_lines(journal), ==, 4);
+  g_assert_cmpint(count_lines(snapshot), ==, 0);
+
+  gs = otrng_global_state_new(test_callbacks, otrng_false);
+  otrng_global_state_set_fingerprint_journal(gs, snapshot, journal, 0);
+  otrng_assert_is_success(otrng_global_state_fingerprints_v4_load(gs));
+
+  loaded = otrng_client_get(gs, alice->client_id);
+  g_assert_cmpint(otrng_list_len(loaded->fingerprints->fps), ==, 1);
+  bob = otrng_fingerprint_get_by_fp(loaded, fp1);
+  otrng_assert(bob);
+  otrng_assert(bob->trusted);
+  otrng_assert(!otrng_fingerprint_get_by_fp(loaded, fp2));
+
+  /* Loading does not produce changes of its own */
+  otrng_assert(!loaded->fingerprints->changes);
+
+  otrng_global_state_free(gs);
+  otrng_global_state_free(alice->global_state);
+  unlink(snapshot);
+  unlink(journal);
+}
+
+static void test_persistence_fingerprint_journal_forget() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  char snapshot[] = "/tmp/otrng-fingerprints-XXXXXX";
+  char journal[] = "/tmp/otrng-fingerprints-journal-XXXXXX";
+  otrng_known_fingerprint_s *bob;
+  otrng_fingerprint fp1 = {0x01}, fp2 = {0x02};
+  otrng_global_state_s *gs;
+  otrng_client_s *loaded;
+
+  temporary_file(snapshot);
+  temporary_file(journal);
+
+  set_up_client(alice, 1);
+  otrng_global_state_set_fingerprint_journal(alice->global_state, snapshot,
+                                             journal, 0);
+
+  /* The fingerprint that is forgotten comes first, so it is freed while the
+     rest of the list is still matched against it */
+  bob = otrng_fingerprint_add(alice, fp1, "bob@otr.im", otrng_true);
+  otrng_fingerprint_add(alice, fp2, "charlie@otr.im", otrng_true);
+  otrng_fingerprint_add(alice, fp1, "bob@otr.im", otrng_true);
+  otrng_fingerprint_forget(alice, bob);
+
+  g_assert_cmpint(otrng_list_len(alice->fingerprints->fps), ==, 1);
+  otrng_assert(!otrng_fingerprint_get_by_fp(alice, fp1));
+  otrng_assert(otrng_fingerprint_get_by_fp(alice, fp2));
+
+  otrng_assert_is_success(
+      otrng_global_state_fingerprints_v4_flush(alice->global_state));
+  g_assert_cmpint(count_lines(journal), ==, 4);
+
+  gs = otrng_global_state_new(test_callbacks, otrng_false);
+  otrng_global_state_set_fingerprint_journal(gs, snapshot, journal, 0);
+  otrng_assert_is_success(otrng_global_state_fingerprints_v4_load(gs));
+
+  loaded = otrng_client_get(gs, alice->client_id);
+  g_assert_cmpint(otrng_list_len(loaded->fingerprints->fps), ==, 1);
+  otrng_assert(!otrng_fingerprint_get_by_fp(loaded, fp1));
+  otrng_assert(otrng_fingerprint_get_by_fp(loaded, fp2));
+
+  otrng_global_state_free(gs);
+  otrng_global_state_free(alice->global_state);
+  unlink(snapshot);
+  unlink(journal);
+}
+
+static void test_persistence_fingerprint_journal_compaction() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  char snapshot[] = "/tmp/otrng-fingerprints-XXXXXX";
+  char journal[] = "/tmp/otrng-fingerprints-journal-XXXXXX";
+  otrng_fingerprint fp1 = {0x01}, fp2 = {0x02}, fp3 = {0x03};
+  otrng_global_state_s *gs;
+
+  temporary_file(snapshot);
+  temporary_file(journal);
+
+  set_up_client(alice, 1);
+  otrng_global_state_set_fingerprint_journal(alice->global_state, snapshot,
+                                             journal, 2);
+
+  /* Two changes start a compaction in the background */
+  otrng_fingerprint_add(alice, fp1, "bob@otr.im", otrng_false);
+  otrng_fingerprint_add(alice, fp2, "charlie@otr.im", otrng_true);
+  otrng_assert_is_success(
+      otrng_global_state_fingerprints_v4_flush(alice->global_state));
+  otrng_assert(alice->global_state->fingerprint_journal->compaction);
+  otrng_worker_wait(alice->global_state->persistence_worker);
+
+  /* The next flush drops the part of the journal the snapshot covers */
+  otrng_fingerprint_add(alice, fp3, "dave@otr.im", otrng_false);
+  otrng_assert_is_success(
+      otrng_global_state_fingerprints_v4_flush(alice->global_state));
+  otrng_assert(!alice->global_state->fingerprint_journal->compaction);
+  g_assert_cmpint(count_lines(snapshot), ==, 2);
+  g_assert_cmpint(count_lines(journal), ==, 1);
+
+  gs = otrng_global_state_new(test_callbacks, otrng_false);
+  otrng_global_state_set_fingerprint_journal(gs, snapshot, journal, 0);
+  otrng_assert_is_success(otrng_global_state_fingerprints_v4_load(gs));
+  g_assert_cmpint(
+      otrng_list_len(otrng_client_get(gs, alice->client_id)->fingerprints->fps),
+      ==, 3);
+  otrng_global_state_free(gs);
+
+  otrng_assert_is_success(
+      otrng_global_state_fingerprints_v4_compact(alice->global_state));
+  g_assert_cmpint(count_lines(snapshot), ==, 3);
+  g_assert_cmpint(count_lines(journal), ==, 0);
+
+  otrng_global_state_free(alice->global_state);
+  unlink(snapshot);
+  unlink(journal);
+}
+
+static void flush_fingerprints_to_journal(otrng_client_s *client) {
+  otrng_assert_is_success(
+      otrng_global_state_fingerprints_v4_flush(client->global_state));
+}
+
+static void test_persistence_write_back_flushed_on_free() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  char snapshot[] = "/tmp/otrng-fingerprints-XXXXXX";
+  char journal[] = "/tmp/otrng-fingerprints-journal-XXXXXX";
+  otrng_client_callbacks_s callbacks = test_callbacks[0];
+  otrng_fingerprint fp = {0x01};
+  otrng_global_state_s *gs;
+
+  temporary_file(snapshot);
+  temporary_file(journal);
+
+  callbacks.store_fingerprints_v4 = flush_fingerprints_to_journal;
+
+  set_up_client(alice, 1);
+  gs = alice->global_state;
+  gs->callbacks = &callbacks;
+  otrng_global_state_set_fingerprint_journal(gs, snapshot, journal, 1);
+  otrng_global_state_set_write_back(gs, otrng_true, 60 * 1000);
+
+  otrng_fingerprint_add(alice, fp, "bob@otr.im", otrng_true);
+  otrng_client_store_section(alice, OTRNG_SECTION_FINGERPRINTS_V4);
+  g_assert_cmpint(count_lines(journal), ==, 0);
+
+  /* The final flush appends the change, which starts a compaction. It is
+     completed, and the journal shortened, before the global state is gone */
+  otrng_global_state_free(gs);
+  g_assert_cmpint(count_lines(snapshot), ==, 1);
+  g_assert_cmpint(count_lines(journal), ==, 0);
+
+  unlink(snapshot);
+  unlink(journal);
+}
+
+static void test_persistence_write_back_file() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  char filename[] = "/tmp/otrng-write-back-XXXXXX";
+  otrng_global_state_s *gs;
+  otrng_write_back_stats_s stats;
+  otrng_fingerprint fp = {0x01};
+  struct timespec now;
+
+  temporary_file(filename);
+
+  set_up_client(alice, 1);
+  gs = alice->global_state;
+  otrng_global_state_set_write_back(gs, otrng_true, 60 * 1000);
+  otrng_global_state_set_write_back_file(gs, OTRNG_SECTION_FINGERPRINTS_V4,
+                                         filename);
+
+  otrng_fingerprint_add(alice, fp, "bob@otr.im", otrng_true);
+  otrng_client_store_section(alice, OTRNG_SECTION_FINGERPRINTS_V4);
+  otrng_client_store_section(alice, OTRNG_SECTION_FINGERPRINTS_V4);
+
+  /* Nothing is written before the delay has passed */
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  otrng_assert(!write_back_due(gs->write_back, &now));
+  otrng_assert_is_success(
+      otrng_global_state_write_back_flush(gs, otrng_false, &stats));
+  g_assert_cmpuint(stats.sections, ==, 0);
+  g_assert_cmpint(count_lines(filename), ==, 0);
+
+  now.tv_sec += 60;
+  otrng_assert(write_back_due(gs->write_back, &now));
+
+  otrng_assert_is_success(
+      otrng_global_state_write_back_flush(gs, otrng_true, &stats));
+  g_assert_cmpuint(stats.clients, ==, 1);
+  g_assert_cmpuint(stats.sections, ==, 1);
+  g_assert_cmpuint(stats.callbacks, ==, 0);
+  g_assert_cmpuint(
+      stats.bytes_written, ==,
+      otrng_known_fingerprint_line_len(alice->fingerprints->fps->data,
+                                       alice->client_id));
+  g_assert_cmpint(count_lines(filename), ==, 1);
+  otrng_assert(!gs->write_back->pending);
+
+  otrng_global_state_free(gs);
+  unlink(filename);
+}
+
 void units_persistence_add_tests(void) {
   g_test_add_func("/persistence/v4/export", test_persistence_export_v4);
   g_test_add_func("/persistence/v4/export_failure1",
@@ -487,4 +1092,26 @@ void units_persistence_add_tests(void) {
   g_test_add_func("/persistence/v4/import", test_persistence_import_v4);
   g_test_add_func("/persistence/v4/import_failures",
                   test_persistence_import_v4_failures);
+  g_test_add_func("/persistence/account_store/round_trip",
+                  test_persistence_account_store);
+  g_test_add_func("/persistence/account_store/corrupted",
+                  test_persistence_account_store_corrupted);
+  g_test_add_func("/persistence/account_store/failed_load",
+                  test_persistence_account_store_failed_load);
+  g_test_add_func("/persistence/account_store/convert",
+                  test_persistence_account_store_convert);
+  g_test_add_func("/persistence/prekey_messages/lazy",
+                  test_persistence_prekey_messages_lazy);
+  g_test_add_func("/persistence/fingerprints_v4/write",
+                  test_persistence_fingerprints_v4_write);
+  g_test_add_func("/persistence/fingerprint_journal/replay",
+                  test_persistence_fingerprint_journal_replay);
+  g_test_add_func("/persistence/fingerprint_journal/forget",
+                  test_persistence_fingerprint_journal_forget);
+  g_test_add_func("/persistence/fingerprint_journal/compaction",
+                  test_persistence_fingerprint_journal_compaction);
+  g_test_add_func("/persistence/write_back/file",
+                  test_persistence_write_back_file);
+  g_test_add_func("/persistence/write_back/flushed_on_free",
+                  test_persistence_write_back_flushed_on_free);
 }
@@ -24,7 +24,9 @@
 
 #include "test_fixtures.h"
 
+#include "fingerprint.h"
 #include "prekey_ensemble.h"
+#include "prekey_ensemble_cache.h"
 
 static void test_prekey_ensemble_validate(void) {
   uint8_t sym[ED448_PRIVATE_BYTES] = {0xA0};
@@ -114,6 +116,153 @@ static void test_prekey_ensemble_validate(void) {
   otrng_prekey_ensemble_free(ensemble);
 }
 
+static prekey_ensemble_s *create_ensemble(const otrng_keypair_s *keypair,
+                                          const otrng_keypair_s *keypair2,
+                                          uint32_t instance_tag) {
+  uint8_t sym[ED448_PRIVATE_BYTES] = {0xA2};
+  prekey_ensemble_s *ensemble = otrng_prekey_ensemble_new();
+  otrng_public_key *fk;
+
+  ensemble->client_profile->versions = otrng_xstrdup("4");
+  ensemble->client_profile->sender_instance_tag = instance_tag;
+  ensemble->client_profile->expires = time(NULL) + 60 * 60 * 24; // one day
+  ensemble->client_profile->transitional_signature = NULL;
+  ensemble->client_profile->dsa_key = NULL;
+  fk = create_forging_key_from(sym);
+  otrng_ec_point_copy(ensemble->client_profile->forging_pub_key, *fk);
+  otrng_free(fk);
+  otrng_assert_is_success(
+      client_profile_sign(ensemble->client_profile, keypair));
+
+  ensemble->prekey_profile->instance_tag = instance_tag;
+  ensemble->prekey_profile->expires = time(NULL) + 60 * 60; // one hour
+  otrng_ec_point_copy(ensemble->prekey_profile->shared_prekey, keypair->pub);
+  otrng_assert_is_success(
+      otrng_prekey_profile_sign(ensemble->prekey_profile, keypair));
+
+  ensemble->message = otrng_prekey_message_new();
+  ensemble->message->sender_instance_tag = instance_tag;
+  otrng_ec_point_copy(ensemble->message->Y, keypair2->pub);
+  ensemble->message->B = gcry_mpi_set_ui(NULL, 3);
+
+  return ensemble;
+}
+
+static void test_prekey_ensemble_cache(void) {
+  uint8_t sym[ED448_PRIVATE_BYTES] = {0xA0};
+  otrng_keypair_s *keypair = otrng_keypair_new();
+  otrng_assert_is_success(otrng_keypair_generate(keypair, sym));
+
+  uint8_t sym2[ED448_PRIVATE_BYTES] = {0xA1};
+  otrng_keypair_s *keypair2 = otrng_keypair_new();
+  otrng_assert_is_success(otrng_keypair_generate(keypair2, sym2));
+
+  otrng_prekey_ensemble_cache_s *cache = otrng_prekey_ensemble_cache_new(2);
+  prekey_ensemble_s *ensemble = create_ensemble(keypair, keypair2, 1);
+
+  otrng_assert_is_success(
+      otrng_prekey_ensemble_cache_validate(cache, "bob@otr.im", ensemble));
+  g_assert_cmpuint(cache->misses, ==, 1);
+  g_assert_cmpuint(cache->hits, ==, 0);
+
+  // The same profiles only have the prekey message validated
+  otrng_assert_is_success(
+      otrng_prekey_ensemble_cache_validate(cache, "bob@otr.im", ensemble));
+  g_assert_cmpuint(cache->hits, ==, 1);
+
+  // ... which still has to be valid
+  ensemble->message->sender_instance_tag = 2;
+  otrng_assert_is_error(
+      otrng_prekey_ensemble_cache_validate(cache, "bob@otr.im", ensemble));
+  g_assert_cmpuint(cache->hits, ==, 2);
+  ensemble->message->sender_instance_tag = 1;
+
+  // A different identity is not a hit
+  otrng_assert_is_success(
+      otrng_prekey_ensemble_cache_validate(cache, "carol@otr.im", ensemble));
+  g_assert_cmpuint(cache->misses, ==, 2);
+  g_assert_cmpuint(cache->num_entries, ==, 2);
+
+  // A changed profile is validated again
+  ensemble->prekey_profile->expires -= 1; // Messes up with the signature
+  otrng_assert_is_error(
+      otrng_prekey_ensemble_cache_validate(cache, "bob@otr.im", ensemble));
+  g_assert_cmpuint(cache->misses, ==, 3);
+  ensemble->prekey_profile->expires += 1;
+
+  // An expired entry is validated again. Bob's entry was added first
+  ((otrng_prekey_ensemble_cache_entry_s *)cache->entries->data)->expires =
+      time(NULL) - 1;
+  otrng_assert_is_success(
+      otrng_prekey_ensemble_cache_validate(cache, "bob@otr.im", ensemble));
+  g_assert_cmpuint(cache->misses, ==, 4);
+
+  // The least recently used entry (carol's) makes room for a new instance
+  otrng_prekey_ensemble_free(ensemble);
+  ensemble = create_ensemble(keypair, keypair2, 3);
+  otrng_assert_is_success(
+      otrng_prekey_ensemble_cache_validate(cache, "bob@otr.im", ensemble));
+  g_assert_cmpuint(cache->num_entries, ==, 2);
+  otrng_assert_is_success(
+      otrng_prekey_ensemble_cache_validate(cache, "carol@otr.im", ensemble));
+  g_assert_cmpuint(cache->misses, ==, 6);
+
+  otrng_prekey_ensemble_cache_forget(cache, "bob@otr.im");
+  g_assert_cmpuint(cache->num_entries, ==, 1);
+
+  otrng_keypair_free(keypair);
+  otrng_keypair_free(keypair2);
+  otrng_prekey_ensemble_free(ensemble);
+  otrng_prekey_ensemble_cache_free(cache);
+}
+
+static void test_prekey_ensemble_cache_forgets_untrusted_peer(void) {
+  otrng_client_s *client = otrng_client_new(ALICE_IDENTITY);
+  otrng_fingerprint fpr = {0x42};
+  otrng_known_fingerprint_s *fp;
+
+  uint8_t sym[ED448_PRIVATE_BYTES] = {0xA0};
+  otrng_keypair_s *keypair = otrng_keypair_new();
+  otrng_assert_is_success(otrng_keypair_generate(keypair, sym));
+
+  uint8_t sym2[ED448_PRIVATE_BYTES] = {0xA1};
+  otrng_keypair_s *keypair2 = otrng_keypair_new();
+  otrng_assert_is_success(otrng_keypair_generate(keypair2, sym2));
+
+  prekey_ensemble_s *ensemble = create_ensemble(keypair, keypair2, 1);
+
+  set_up_client(client, 1);
+  otrng_client_set_ensemble_cache(4, client);
+  fp = otrng_fingerprint_add(client, fpr, "bob@otr.im", otrng_true);
+
+  otrng_assert_is_success(
+      otrng_client_validate_prekey_ensemble(client, "bob@otr.im", ensemble));
+  otrng_assert_is_success(otrng_client_validate_prekey_ensemble(
+      client, "carol@otr.im", ensemble));
+  g_assert_cmpuint(client->ensemble_cache->num_entries, ==, 2);
+
+  // Bob's profiles are validated again once his key is not trusted
+  otrng_fingerprint_set_trusted(client, fp, otrng_false);
+  g_assert_cmpuint(client->ensemble_cache->num_entries, ==, 1);
+
+  otrng_assert_is_success(
+      otrng_client_validate_prekey_ensemble(client, "bob@otr.im", ensemble));
+  g_assert_cmpuint(client->ensemble_cache->num_entries, ==, 2);
+
+  // ... or forgotten
+  otrng_fingerprint_forget(client, fp);
+  g_assert_cmpuint(client->ensemble_cache->num_entries, ==, 1);
+  otrng_assert(otrng_fingerprint_get_by_fp(client, fpr) == NULL);
+
+  otrng_keypair_free(keypair);
+  otrng_keypair_free(keypair2);
+  otrng_prekey_ensemble_free(ensemble);
+  otrng_global_state_free(client->global_state);
+}
+
 void units_prekey_ensemble_add_tests(void) {
   g_test_add_func("/prekey_ensemble/validate", test_prekey_ensemble_validate);
+  g_test_add_func("/prekey_ensemble/cache", test_prekey_ensemble_cache);
+  g_test_add_func("/prekey_ensemble/cache_forgets_untrusted_peer",
+                  test_prekey_ensemble_cache_forgets_untrusted_peer);
 }
@@ -24,7 +24,10 @@
 
 #include "test_fixtures.h"
 
+#include "base64.h"
 #include "prekey_ensemble.h"
+#include "serialize.h"
+#include "shake.h"
 
 #include "randomness.h"
 
@@ -103,8 +106,209 @@ test_prekey_manager__otrng_prekey_request_storage_information(void) {
   otrng_free((char *)client_id.account);
 }
 
+static int answers_received = 0;
+static void *answer_ctx[4];
+static int errors_received = 0;
+static int last_error = 0;
+static void *last_error_ctx = NULL;
+
+static void record_answer(otrng_client_s *client, void *ctx) {
+  (void)client;
+  if (answers_received < 4) {
+    answer_ctx[answers_received] = ctx;
+  }
+  answers_received++;
+}
+
+static void record_error(otrng_client_s *client, int error, void *ctx) {
+  (void)client;
+  errors_received++;
+  last_error = error;
+  last_error_ctx = ctx;
+}
+
+/* Pretends that the DAKE for the request has finished, by giving it the MAC
+ * key a server would have derived */
+static void finish_dake(otrng_client_s *client, uint32_t id, uint8_t key) {
+  otrng_prekey_request_s *request =
+      find_request_by_id(client->prekey_manager, id);
+
+  otrng_assert(request);
+  otrng_assert(!request->dake_done);
+
+  memset(request->mac_key, key, MAC_KEY_BYTES);
+  request->dake_done = otrng_true;
+}
+
+/* Builds the answer a prekey server would send after a DAKE3 */
+static char *stand_in_answer(uint8_t msg_type, uint8_t usage,
+                             uint32_t instance_tag, uint8_t key) {
+  uint8_t buf[OTRNG_PREKEY_SUCCESS_MSG_LEN];
+  uint8_t mac_key[MAC_KEY_BYTES];
+  char *encoded, *result;
+  goldilocks_shake256_ctx_p hash;
+  size_t w = 0;
+
+  memset(mac_key, key, MAC_KEY_BYTES);
+  w += otrng_serialize_uint16(buf, OTRNG_PROTOCOL_VERSION_4);
+  w += otrng_serialize_uint8(buf + w, msg_type);
+  w += otrng_serialize_uint32(buf + w, instance_tag);
+
+  otrng_assert_is_success(hash_init_with_usage_and_domain_separation(
+      hash, usage, "OTR-Prekey-Server"));
+  hash_update(hash, mac_key, MAC_KEY_BYTES);
+  hash_update(hash, buf + 2, 5);
+  hash_final(hash, buf + w, HASH_BYTES);
+  hash_destroy(hash);
+
+  encoded = otrng_base64_encode(buf, sizeof(buf));
+  result = g_strdup_printf("%s.", encoded);
+  otrng_free(encoded);
+
+  return result;
+}
+
+static void receive_answer(otrng_client_s *client, const char *from,
+                           uint8_t msg_type, uint8_t usage, uint8_t key) {
+  char *to_send = NULL;
+  char *answer = stand_in_answer(msg_type, usage,
+                                 otrng_client_get_instance_tag(client), key);
+
+  otrng_assert(otrng_prekey_receive(&to_send, client, from, answer));
+  otrng_assert(!to_send);
+  g_free(answer);
+}
+
+static otrng_client_s *set_up_client_with_two_servers(void) {
+  otrng_client_s *client = otrng_client_new(ALICE_IDENTITY);
+  otrng_fingerprint fpr = {1};
+
+  set_up_client(client, 1);
+
+  otrng_prekey_ensure_manager(client, "alice@localhost");
+  client->prekey_manager->callbacks->domain_for_account =
+      fixed_domain_for_account;
+  client->prekey_manager->callbacks->notify_error = record_error;
+  client->prekey_manager->callbacks->success_received = record_answer;
+  client->prekey_manager->callbacks->failure_received = record_answer;
+
+  otrng_prekey_provide_server_identity_for(client, "otr.im", "prekey@otr.im",
+                                           fpr);
+  otrng_prekey_provide_server_identity_for(client, "example.org",
+                                           "prekey@example.org", fpr);
+
+  answers_received = 0;
+  errors_received = 0;
+  last_error = 0;
+  last_error_ctx = NULL;
+
+  return client;
+}
+
+static void test_prekey_manager_concurrent_requests(void) {
+  otrng_client_s *client = set_up_client_with_two_servers();
+  int ctx_first = 1, ctx_second = 2, ctx_other = 3;
+  uint32_t first = 0, second = 0, other = 0;
+  char *dake_1 = NULL;
+
+  otrng_assert_is_success(otrng_prekey_publish_to(
+      &dake_1, &first, client, "prekey@otr.im", &ctx_first));
+  otrng_assert(dake_1);
+  otrng_free(dake_1);
+
+  otrng_assert_is_success(otrng_prekey_request_storage_information_from(
+      &dake_1, &other, client, "prekey@example.org", &ctx_other));
+  otrng_free(dake_1);
+
+  otrng_assert_is_success(otrng_prekey_publish_to(
+      &dake_1, &second, client, "prekey@otr.im", &ctx_second));
+  otrng_free(dake_1);
+
+  otrng_assert(first != 0);
+  otrng_assert(first != second);
+  otrng_assert(second != other);
+  g_assert_cmpuint(otrng_prekey_pending_requests(client, NULL), ==, 3);
+  g_assert_cmpuint(otrng_prekey_pending_requests(client, "prekey@otr.im"), ==,
+                   2);
+
+  otrng_assert_is_error(otrng_prekey_publish_to(&dake_1, NULL, client,
+                                                "prekey@unknown.org", NULL));
+  otrng_assert(!dake_1);
+
+  finish_dake(client, first, 0x11);
+  finish_dake(client, second, 0x22);
+  finish_dake(client, other, 0x33);
+
+  /* The server answers the second publication before the first one */
+  receive_answer(client, "prekey@otr.im", OTRNG_PREKEY_SUCCESS_MSG, 0x0C,
+                 0x22);
+  g_assert_cmpint(answers_received, ==, 1);
+  otrng_assert(answer_ctx[0] == &ctx_second);
+  otrng_assert(find_request_by_id(client->prekey_manager, second) == NULL);
+
+  receive_answer(client, "prekey@otr.im", OTRNG_PREKEY_FAILURE_MSG, 0x0D,
+                 0x11);
+  g_assert_cmpint(answers_received, ==, 2);
+  otrng_assert(answer_ctx[1] == &ctx_first);
+  g_assert_cmpuint(otrng_prekey_pending_requests(client, "prekey@otr.im"), ==,
+                   0);
+
+  /* An answer for a key that we never agreed on is attributed to the oldest
+   * request waiting on that server, which is then dropped */
+  receive_answer(client, "prekey@example.org", OTRNG_PREKEY_SUCCESS_MSG, 0x0C,
+                 0x44);
+  g_assert_cmpint(answers_received, ==, 2);
+  g_assert_cmpint(errors_received, ==, 1);
+  g_assert_cmpint(last_error, ==, OTRNG_PREKEY_CLIENT_INVALID_SUCCESS);
+  otrng_assert(last_error_ctx == &ctx_other);
+  g_assert_cmpuint(otrng_prekey_pending_requests(client, NULL), ==, 0);
+
+  /* Nothing is waiting anymore */
+  receive_answer(client, "prekey@otr.im", OTRNG_PREKEY_SUCCESS_MSG, 0x0C,
+                 0x11);
+  g_assert_cmpint(errors_received, ==, 2);
+  g_assert_cmpint(last_error, ==, OTRNG_PREKEY_CLIENT_MALFORMED_MSG);
+  otrng_assert(last_error_ctx == NULL);
+
+  otrng_global_state_free(client->global_state);
+}
+
+static void test_prekey_manager_cancel_and_expire_requests(void) {
+  otrng_client_s *client = set_up_client_with_two_servers();
+  uint32_t first = 0, second = 0;
+  otrng_prekey_request_s *request;
+  char *dake_1 = NULL;
+
+  otrng_assert_is_success(otrng_prekey_publish_to(&dake_1, &first, client,
+                                                  "prekey@otr.im", NULL));
+  otrng_free(dake_1);
+  otrng_assert_is_success(otrng_prekey_request_storage_information_from(
+      &dake_1, &second, client, "prekey@example.org", NULL));
+  otrng_free(dake_1);
+
+  otrng_assert(otrng_prekey_cancel_request(client, first));
+  otrng_assert(!otrng_prekey_cancel_request(client, first));
+  g_assert_cmpuint(otrng_prekey_pending_requests(client, NULL), ==, 1);
+
+  otrng_prekey_check_account_request(client);
+  g_assert_cmpuint(otrng_prekey_pending_requests(client, NULL), ==, 1);
+
+  request = find_request_by_id(client->prekey_manager, second);
+  otrng_assert(request);
+  request->started_at = time(NULL) - 11 * 60;
+
+  otrng_prekey_check_account_request(client);
+  g_assert_cmpuint(otrng_prekey_pending_requests(client, NULL), ==, 0);
+
+  otrng_global_state_free(client->global_state);
+}
+
 void units_prekey_manager_add_tests(void) {
   g_test_add_func(
       "/prekey/manager/otrng_prekey_request_storage_information",
       test_prekey_manager__otrng_prekey_request_storage_information);
+  g_test_add_func("/prekey/manager/concurrent_requests",
+                  test_prekey_manager_concurrent_requests);
+  g_test_add_func("/prekey/manager/cancel_and_expire_requests",
+                  test_prekey_manager_cancel_and_expire_requests);
 }
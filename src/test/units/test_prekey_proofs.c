@@ -63,6 +63,102 @@ static void test_ecdh_proof_generation_and_validation(void) {
       !otrng_ecdh_proof_verify(&res, (const ec_point *)pubs, 3, m, 0x13));
 }
 
+static void ecdh_proof_values_generate(ec_scalar *privs, ec_point *pubs,
+                                       size_t len) {
+  size_t i;
+  uint8_t sym[ED448_PRIVATE_BYTES];
+  otrng_keypair_s v;
+
+  for (i = 0; i < len; i++) {
+    random_bytes(sym, ED448_PRIVATE_BYTES);
+    otrng_assert_is_success(otrng_keypair_generate(&v, sym));
+    goldilocks_448_scalar_copy(privs[i], v.priv);
+    goldilocks_448_point_copy(pubs[i], v.pub);
+  }
+}
+
+static void test_ecdh_proof_generation_and_validation_many_values(void) {
+  const size_t len = 100;
+  ec_scalar *privs = otrng_xmalloc_z(len * sizeof(ec_scalar));
+  ec_point *pubs = otrng_xmalloc_z(len * sizeof(ec_point));
+  uint8_t m[HASH_BYTES] = {0x01, 0x02, 0x03};
+  ecdh_proof_s res;
+
+  ecdh_proof_values_generate(privs, pubs, len);
+
+  otrng_assert_is_success(otrng_ecdh_proof_generate(
+      &res, (const ec_scalar *)privs, (const ec_point *)pubs, len, m, 0x13));
+  otrng_assert(
+      otrng_ecdh_proof_verify(&res, (const ec_point *)pubs, len, m, 0x13));
+  otrng_assert(
+      !otrng_ecdh_proof_verify(&res, (const ec_point *)pubs, len, m, 0x14));
+
+  goldilocks_448_point_copy(pubs[len - 1], pubs[0]);
+  otrng_assert(
+      !otrng_ecdh_proof_verify(&res, (const ec_point *)pubs, len, m, 0x13));
+
+  otrng_free(privs);
+  otrng_free(pubs);
+}
+
+/* Run with "-m perf" to compare the verification strategies for the
+   sizes the prekey server deals with */
+static void test_ecdh_proof_verification_perf(void) {
+  const size_t sizes[] = {1, 10, 100, 255};
+  const int rounds = 10;
+  ec_scalar *privs = otrng_xmalloc_z(255 * sizeof(ec_scalar));
+  ec_point *pubs = otrng_xmalloc_z(255 * sizeof(ec_point));
+  uint8_t *p = otrng_xmalloc_z(255 * PREKEY_PROOF_LAMBDA);
+  size_t i;
+  int j;
+
+  if (!g_test_perf()) {
+    g_test_skip("performance test");
+    otrng_free(privs);
+    otrng_free(pubs);
+    otrng_free(p);
+    return;
+  }
+
+  ecdh_proof_values_generate(privs, pubs, 255);
+  random_bytes(p, 255 * PREKEY_PROOF_LAMBDA);
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    ec_point pairs, msm;
+    ec_scalar *t = otrng_xmalloc_z(sizes[i] * sizeof(ec_scalar));
+    double pairs_time, msm_time;
+    size_t k;
+
+    for (k = 0; k < sizes[i]; k++) {
+      goldilocks_448_scalar_decode_long(t[k], p + k * PREKEY_PROOF_LAMBDA,
+                                        PREKEY_PROOF_LAMBDA);
+    }
+
+    g_test_timer_start();
+    for (j = 0; j < rounds; j++) {
+      ecdh_proof_combine_pairs(pairs, (const ec_point *)pubs, p, sizes[i]);
+    }
+    pairs_time = g_test_timer_elapsed() / rounds;
+
+    g_test_timer_start();
+    for (j = 0; j < rounds; j++) {
+      otrng_ec_point_multiscalarmul(msm, (const ec_point *)pubs,
+                                    (const ec_scalar *)t, sizes[i]);
+    }
+    msm_time = g_test_timer_elapsed() / rounds;
+
+    otrng_assert(otrng_ec_point_eq(pairs, msm) == otrng_true);
+    g_test_message("%zu values: pairwise %.3fms, bucket %.3fms", sizes[i],
+                   pairs_time * 1000, msm_time * 1000);
+
+    otrng_free(t);
+  }
+
+  otrng_free(privs);
+  otrng_free(pubs);
+  otrng_free(p);
+}
+
 static void *fixed_random_number_generator(size_t n) {
   uint8_t *buf = otrng_secure_alloc(n);
   buf[0] = 0x01;
@@ -125,6 +221,100 @@ static void test_dh_proof_generation_and_validation(void) {
   otrng_dh_mpi_release(res.v);
 }
 
+static void test_dh_proof_generation_and_validation_many_values(void) {
+  const size_t len = 40;
+  dh_mpi *privs = otrng_xmalloc_z(len * sizeof(dh_mpi));
+  dh_mpi *pubs = otrng_xmalloc_z(len * sizeof(dh_mpi));
+  uint8_t m[HASH_BYTES] = {0x01, 0x02, 0x03};
+  dh_proof_s res;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    dh_keypair_s k;
+    otrng_assert_is_success(otrng_dh_keypair_generate(&k));
+    privs[i] = otrng_dh_mpi_copy(k.priv);
+    pubs[i] = otrng_dh_mpi_copy(k.pub);
+    otrng_dh_keypair_destroy(&k);
+  }
+
+  otrng_assert_is_success(
+      otrng_dh_proof_generate(&res, (const dh_mpi *)privs,
+                              (const dh_mpi *)pubs, len, m, 0x13, NULL));
+  otrng_assert(otrng_dh_proof_verify(&res, (const dh_mpi *)pubs, len, m, 0x13));
+  otrng_assert(
+      !otrng_dh_proof_verify(&res, (const dh_mpi *)pubs, len, m, 0x14));
+
+  for (i = 0; i < len; i++) {
+    otrng_dh_mpi_release(privs[i]);
+    otrng_dh_mpi_release(pubs[i]);
+  }
+  otrng_free(privs);
+  otrng_free(pubs);
+  otrng_dh_mpi_release(res.v);
+}
+
+/* Run with "-m perf" to compare one exponentiation per value against the
+   simultaneous multi-exponentiation used by otrng_dh_proof_verify */
+static void test_dh_proof_verification_perf(void) {
+  const size_t sizes[] = {1, 10, 100, 255};
+  dh_mpi mod = otrng_dh_modulus_p();
+  dh_mpi *pubs, *t;
+  dh_mpi single, multi, tmp;
+  size_t i, k;
+
+  if (!g_test_perf()) {
+    g_test_skip("performance test");
+    return;
+  }
+
+  pubs = otrng_xmalloc_z(255 * sizeof(dh_mpi));
+  t = otrng_xmalloc_z(255 * sizeof(dh_mpi));
+  for (k = 0; k < 255; k++) {
+    dh_keypair_s pair;
+    otrng_assert_is_success(otrng_dh_keypair_generate(&pair));
+    pubs[k] = otrng_dh_mpi_copy(pair.pub);
+    otrng_dh_keypair_destroy(&pair);
+
+    t[k] = gcry_mpi_new(PREKEY_PROOF_LAMBDA * 8);
+    gcry_mpi_randomize(t[k], PREKEY_PROOF_LAMBDA * 8, GCRY_WEAK_RANDOM);
+  }
+
+  single = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+  multi = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+  tmp = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    double single_time, multi_time;
+
+    g_test_timer_start();
+    gcry_mpi_set_ui(single, 1);
+    for (k = 0; k < sizes[i]; k++) {
+      gcry_mpi_powm(tmp, pubs[k], t[k], mod);
+      gcry_mpi_mulm(single, single, tmp, mod);
+    }
+    single_time = g_test_timer_elapsed();
+
+    g_test_timer_start();
+    otrng_dh_multi_powm(multi, (const dh_mpi *)pubs, (const dh_mpi *)t,
+                        sizes[i], mod);
+    multi_time = g_test_timer_elapsed();
+
+    otrng_assert_dh_public_key_eq(single, multi);
+    g_test_message("%zu values: powm each %.3fms, simultaneous %.3fms",
+                   sizes[i], single_time * 1000, multi_time * 1000);
+  }
+
+  for (k = 0; k < 255; k++) {
+    otrng_dh_mpi_release(pubs[k]);
+    otrng_dh_mpi_release(t[k]);
+  }
+  otrng_free(pubs);
+  otrng_free(t);
+  otrng_dh_mpi_release(single);
+  otrng_dh_mpi_release(multi);
+  otrng_dh_mpi_release(tmp);
+}
+
 static void test_dh_proof_generation_and_validation_specific_values(void) {
   gcry_mpi_t v1, v2, v3;
   uint8_t v1data[DH_KEY_SIZE] = {0x00, 0x01, 0x42};
@@ -311,6 +501,14 @@ void units_prekey_proofs_add_tests(void) {
                   test_dh_proof_generation_and_validation);
   g_test_add_func("/prekey_server/proofs/ecdh_gen_validation",
                   test_ecdh_proof_generation_and_validation);
+  g_test_add_func("/prekey_server/proofs/ecdh/gen_and_verify/many_values",
+                  test_ecdh_proof_generation_and_validation_many_values);
+  g_test_add_func("/prekey_server/proofs/ecdh/verify/perf",
+                  test_ecdh_proof_verification_perf);
+  g_test_add_func("/prekey_server/proofs/dh/gen_and_verify/many_values",
+                  test_dh_proof_generation_and_validation_many_values);
+  g_test_add_func("/prekey_server/proofs/dh/verify/perf",
+                  test_dh_proof_verification_perf);
   g_test_add_func("/prekey_server/proofs/dh/gen_and_verify/fixed",
                   test_dh_proof_generation_and_validation_specific_values);
   g_test_add_func("/prekey_server/proofs/ecdh/serialization",
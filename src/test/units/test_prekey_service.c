@@ -0,0 +1,368 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include "test_helpers.h"
+
+#include "test_fixtures.h"
+
+#include "prekey_service.h"
+
+#define SERVICE_IDENTITY "prekey@otr.im"
+
+static int successes = 0;
+static int failures = 0;
+static int errors = 0;
+static int no_prekeys = 0;
+static int ensembles = 0;
+static uint32_t last_stored = 0;
+
+static const char *fixed_domain(otrng_client_s *client, void *ctx) {
+  (void)client;
+  (void)ctx;
+
+  return "otr.im";
+}
+
+static int build_publication(otrng_client_s *client,
+                             otrng_prekey_publication_message_s *pub_msg,
+                             void *ctx) {
+  prekey_message_s **messages = otrng_client_build_prekey_messages(3, client);
+  int i;
+
+  (void)ctx;
+
+  for (i = 0; i < 3; i++) {
+    messages[i]->should_publish = otrng_true;
+  }
+  otrng_free(messages);
+
+  pub_msg->client_profile = otrng_xmalloc_z(sizeof(otrng_client_profile_s));
+  otrng_client_profile_copy(pub_msg->client_profile, client->client_profile);
+  pub_msg->prekey_profile = otrng_client_build_default_prekey_profile(client);
+
+  otrng_prekey_add_prekey_messages_for_publication(client, pub_msg);
+
+  return 1;
+}
+
+static void record_success(otrng_client_s *client, void *ctx) {
+  (void)client;
+  (void)ctx;
+  successes++;
+}
+
+static void record_failure(otrng_client_s *client, void *ctx) {
+  (void)client;
+  (void)ctx;
+  failures++;
+}
+
+static void record_error(otrng_client_s *client, int error, void *ctx) {
+  (void)client;
+  (void)error;
+  (void)ctx;
+  errors++;
+}
+
+static void record_low_storage(otrng_client_s *client, void *ctx) {
+  (void)client;
+  (void)ctx;
+}
+
+static void
+record_storage_status(otrng_client_s *client,
+                      const otrng_prekey_storage_status_message_s *msg,
+                      void *ctx) {
+  (void)client;
+  (void)ctx;
+  last_stored = msg->stored_prekeys;
+}
+
+static void record_no_prekeys(otrng_client_s *client, const char *identity) {
+  (void)client;
+  (void)identity;
+  no_prekeys++;
+}
+
+static void record_ensembles(otrng_client_s *client,
+                             prekey_ensemble_s *const *const received,
+                             uint8_t num_ensembles, const char *identity) {
+  (void)client;
+  (void)received;
+  g_assert_cmpstr(identity, ==, ALICE_ACCOUNT);
+  ensembles += num_ensembles;
+}
+
+static otrng_client_s *set_up_prekey_client(otrng_client_id_s id, int byte) {
+  otrng_client_s *client = otrng_client_new(id);
+  otrng_fingerprint fpr = {1};
+
+  set_up_client(client, byte);
+
+  otrng_prekey_ensure_manager(client, id.account);
+  client->prekey_manager->callbacks->domain_for_account = fixed_domain;
+  client->prekey_manager->callbacks->build_prekey_publication_message =
+      build_publication;
+  client->prekey_manager->callbacks->success_received = record_success;
+  client->prekey_manager->callbacks->failure_received = record_failure;
+  client->prekey_manager->callbacks->notify_error = record_error;
+  client->prekey_manager->callbacks->low_prekey_messages_in_storage =
+      record_low_storage;
+  client->prekey_manager->callbacks->storage_status_received =
+      record_storage_status;
+  client->prekey_manager->callbacks->no_prekey_in_storage_received =
+      record_no_prekeys;
+  client->prekey_manager->callbacks->prekey_ensembles_received =
+      record_ensembles;
+
+  otrng_prekey_provide_server_identity_for(client, "otr.im", SERVICE_IDENTITY,
+                                           fpr);
+
+  return client;
+}
+
+static void reset_records(void) {
+  successes = 0;
+  failures = 0;
+  errors = 0;
+  no_prekeys = 0;
+  ensembles = 0;
+  last_stored = 0;
+}
+
+/* Hands the message to the service and its answer back to the client */
+static char *exchange(otrng_prekey_service_s *service, otrng_client_s *client,
+                      char *msg) {
+  char *reply = NULL, *next = NULL;
+
+  otrng_assert(otrng_prekey_service_receive(
+      &reply, service, client->prekey_manager->our_identity, msg));
+  otrng_free(msg);
+
+  if (reply) {
+    otrng_assert(otrng_prekey_receive(&next, client, SERVICE_IDENTITY, reply));
+    otrng_free(reply);
+  }
+
+  return next;
+}
+
+/* Runs a whole conversation with the service, starting with msg */
+static void converse(otrng_prekey_service_s *service, otrng_client_s *client,
+                     char *msg) {
+  while (msg) {
+    msg = exchange(service, client, msg);
+  }
+}
+
+static void test_prekey_service_publish_and_retrieve(void) {
+  uint8_t sym[ED448_PRIVATE_BYTES] = {0x42};
+  otrng_prekey_service_s *service =
+      otrng_prekey_service_new(SERVICE_IDENTITY, sym);
+  otrng_client_s *alice = set_up_prekey_client(ALICE_IDENTITY, 1);
+  otrng_client_s *bob = set_up_prekey_client(BOB_IDENTITY, 2);
+  char *msg = NULL;
+
+  reset_records();
+
+  otrng_assert_is_success(otrng_prekey_publish(&msg, alice, NULL));
+  converse(service, alice, msg);
+
+  g_assert_cmpint(successes, ==, 1);
+  g_assert_cmpint(errors, ==, 0);
+  g_assert_cmpuint(service->stats.publications, ==, 1);
+  g_assert_cmpuint(service->stats.dakes_finished, ==, 1);
+  g_assert_cmpuint(
+      otrng_prekey_service_stored_prekey_messages(service, ALICE_ACCOUNT), ==,
+      3);
+  otrng_assert(service->sessions == NULL);
+
+  otrng_assert_is_success(
+      otrng_prekey_request_storage_information(&msg, alice, NULL));
+  converse(service, alice, msg);
+
+  g_assert_cmpuint(last_stored, ==, 3);
+  g_assert_cmpuint(service->stats.storage_requests, ==, 1);
+
+  /* Bob gets one of Alice's prekey messages, which is then gone */
+  otrng_prekey_retrieve_prekeys(&msg, bob, ALICE_ACCOUNT, "4");
+  converse(service, bob, msg);
+
+  g_assert_cmpint(ensembles, ==, 1);
+  g_assert_cmpuint(
+      otrng_prekey_service_stored_prekey_messages(service, ALICE_ACCOUNT), ==,
+      2);
+
+  otrng_prekey_retrieve_prekeys(&msg, alice, BOB_ACCOUNT, "4");
+  converse(service, alice, msg);
+
+  g_assert_cmpint(no_prekeys, ==, 1);
+  g_assert_cmpint(errors, ==, 0);
+
+  otrng_prekey_service_free(service);
+  otrng_global_state_free(alice->global_state);
+  otrng_global_state_free(bob->global_state);
+}
+
+static void test_prekey_service_interleaved_dakes(void) {
+  uint8_t sym[ED448_PRIVATE_BYTES] = {0x43};
+  otrng_prekey_service_s *service =
+      otrng_prekey_service_new(SERVICE_IDENTITY, sym);
+  otrng_client_s *alice = set_up_prekey_client(ALICE_IDENTITY, 1);
+  char *first = NULL, *second = NULL, *dake3 = NULL, *reply = NULL;
+
+  reset_records();
+
+  otrng_assert_is_success(otrng_prekey_publish_to(
+      &first, NULL, alice, SERVICE_IDENTITY, NULL));
+  otrng_assert_is_success(otrng_prekey_request_storage_information_from(
+      &second, NULL, alice, SERVICE_IDENTITY, NULL));
+
+  /* Both DAKEs are started before either of them finishes */
+  first = exchange(service, alice, first);
+  second = exchange(service, alice, second);
+  otrng_assert(first);
+  otrng_assert(second);
+  g_assert_cmpuint(otrng_list_len(service->sessions), ==, 2);
+
+  dake3 = otrng_xstrdup(second);
+  converse(service, alice, second);
+  converse(service, alice, first);
+
+  g_assert_cmpint(successes, ==, 1);
+  g_assert_cmpuint(last_stored, ==, 0);
+  g_assert_cmpuint(service->stats.dakes_finished, ==, 2);
+  g_assert_cmpint(errors, ==, 0);
+
+  /* A DAKE3 can't be replayed once its session is gone */
+  otrng_assert(
+      otrng_prekey_service_receive(&reply, service, ALICE_ACCOUNT, dake3));
+  otrng_assert(!reply);
+  g_assert_cmpuint(service->stats.failures, ==, 1);
+  otrng_free(dake3);
+
+  otrng_prekey_service_free(service);
+  otrng_global_state_free(alice->global_state);
+}
+
+static void test_prekey_service_expire_sessions(void) {
+  uint8_t sym[ED448_PRIVATE_BYTES] = {0x44};
+  otrng_prekey_service_s *service =
+      otrng_prekey_service_new(SERVICE_IDENTITY, sym);
+  otrng_client_s *alice = set_up_prekey_client(ALICE_IDENTITY, 1);
+  otrng_prekey_service_session_s *session;
+  char *msg = NULL, *reply = NULL;
+
+  otrng_assert_is_success(otrng_prekey_publish(&msg, alice, NULL));
+  otrng_assert(
+      otrng_prekey_service_receive(&reply, service, ALICE_ACCOUNT, msg));
+  otrng_assert(reply);
+  otrng_free(msg);
+  otrng_free(reply);
+
+  otrng_prekey_service_expire_sessions(service, 60);
+  g_assert_cmpuint(otrng_list_len(service->sessions), ==, 1);
+
+  session = service->sessions->data;
+  session->started_at -= 61;
+  otrng_prekey_service_expire_sessions(service, 60);
+  otrng_assert(service->sessions == NULL);
+
+  /* Nothing we don't understand is taken by the service */
+  otrng_assert(
+      !otrng_prekey_service_receive(&reply, service, ALICE_ACCOUNT, "?OTR"));
+  otrng_assert(!reply);
+
+  otrng_prekey_service_free(service);
+  otrng_global_state_free(alice->global_state);
+}
+
+static void test_prekey_service_session_reuse(void) {
+  uint8_t sym[ED448_PRIVATE_BYTES] = {0x45};
+  otrng_prekey_service_s *service =
+      otrng_prekey_service_new(SERVICE_IDENTITY, sym);
+  otrng_client_s *alice = set_up_prekey_client(ALICE_IDENTITY, 1);
+  otrng_prekey_session_s *session;
+  char *msg = NULL, *replay = NULL, *reply = NULL;
+
+  reset_records();
+  otrng_prekey_service_set_session_lifetime(service, 60);
+  otrng_prekey_set_session_lifetime(alice, 60);
+
+  otrng_assert_is_success(otrng_prekey_publish(&msg, alice, NULL));
+  converse(service, alice, msg);
+  g_assert_cmpint(successes, ==, 1);
+  g_assert_cmpuint(otrng_list_len(service->resumable), ==, 1);
+
+  session = alice->prekey_manager->sessions->data;
+  g_assert_cmpuint(session->counter, ==, 0);
+
+  /* The storage request goes in the session, without a DAKE */
+  otrng_assert_is_success(
+      otrng_prekey_request_storage_information(&msg, alice, NULL));
+  replay = otrng_xstrdup(msg);
+  converse(service, alice, msg);
+
+  g_assert_cmpuint(last_stored, ==, 3);
+  g_assert_cmpuint(service->stats.dakes_started, ==, 1);
+  g_assert_cmpuint(service->stats.resumed, ==, 1);
+  g_assert_cmpuint(session->counter, ==, 1);
+  g_assert_cmpuint(otrng_prekey_pending_requests(alice, NULL), ==, 0);
+
+  /* A request can't be sent twice */
+  otrng_assert(
+      otrng_prekey_service_receive(&reply, service, ALICE_ACCOUNT, replay));
+  otrng_assert(!reply);
+  g_assert_cmpuint(service->stats.failures, ==, 1);
+  otrng_free(replay);
+
+  /* A few seconds before the server would forget the session, a new DAKE is
+     done */
+  session->established_at -= 57;
+  otrng_prekey_check_account_request(alice);
+  otrng_assert(alice->prekey_manager->sessions == NULL);
+
+  otrng_assert_is_success(
+      otrng_prekey_request_storage_information(&msg, alice, NULL));
+  converse(service, alice, msg);
+  g_assert_cmpuint(service->stats.dakes_started, ==, 2);
+  g_assert_cmpuint(otrng_list_len(alice->prekey_manager->sessions), ==, 1);
+
+  /* Turning sessions off forgets them */
+  otrng_prekey_set_session_lifetime(alice, 0);
+  otrng_assert(alice->prekey_manager->sessions == NULL);
+  g_assert_cmpint(errors, ==, 0);
+
+  otrng_prekey_service_free(service);
+  otrng_global_state_free(alice->global_state);
+}
+
+void units_prekey_service_add_tests(void) {
+  g_test_add_func("/prekey/service/publish_and_retrieve",
+                  test_prekey_service_publish_and_retrieve);
+  g_test_add_func("/prekey/service/interleaved_dakes",
+                  test_prekey_service_interleaved_dakes);
+  g_test_add_func("/prekey/service/expire_sessions",
+                  test_prekey_service_expire_sessions);
+  g_test_add_func("/prekey/service/session_reuse",
+                  test_prekey_service_session_reuse);
+}
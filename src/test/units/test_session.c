@@ -0,0 +1,514 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <time.h>
+
+#include "test_helpers.h"
+
+#include "test_fixtures.h"
+
+#include "footprint.h"
+#include "session.h"
+
+static void test_session_serializes(void) {
+  otrng_client_s *alice_client = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *bob_client = otrng_client_new(BOB_IDENTITY);
+  otrng_policy_s policy = {.allows = OTRNG_ALLOW_V34,
+                           .type = OTRNG_POLICY_ALWAYS};
+  otrng_response_s *response_to_alice = NULL;
+  string_p to_send_1 = NULL;
+  string_p to_send_2 = NULL;
+  uint8_t *ser = NULL;
+  size_t ser_len = 0;
+  otrng_result result;
+
+  otrng_s *alice = set_up(alice_client, 1);
+  otrng_s *bob = set_up(bob_client, 2);
+  otrng_s *restored = otrng_new(bob_client, policy);
+
+  do_dake_fixture(alice, bob);
+
+  result = otrng_send_message(&to_send_1, "hi", NULL, 0, alice);
+  assert_message_sent(result, to_send_1);
+  result = otrng_send_message(&to_send_2, "how are you?", NULL, 0, alice);
+  assert_message_sent(result, to_send_2);
+
+  /* Bob keeps a skipped key for the first message */
+  response_to_alice = otrng_response_new();
+  result = otrng_receive_message(response_to_alice, to_send_2, bob);
+  assert_message_rec(result, "how are you?", response_to_alice);
+  free_message_and_response(response_to_alice, &to_send_2);
+  g_assert_cmpuint(otrng_tail_list_len(&bob->keys->skipped_keys), ==, 1);
+
+  otrng_assert(otrng_session_can_serialize(bob));
+  otrng_assert_is_success(otrng_session_serialize(&ser, &ser_len, bob));
+  g_assert_cmpuint(ser[0], ==, OTRNG_SESSION_VERSION);
+
+  otrng_assert_is_success(otrng_session_deserialize(restored, ser, ser_len));
+  otrng_session_free_serialized(ser, ser_len);
+
+  otrng_assert(restored->state == OTRNG_STATE_ENCRYPTED_MESSAGES);
+  otrng_assert(restored->running_version == OTRNG_PROTOCOL_VERSION_4);
+  g_assert_cmpuint(restored->their_instance_tag, ==, bob->their_instance_tag);
+  g_assert_cmpint(restored->keys->i, ==, bob->keys->i);
+  g_assert_cmpint(restored->keys->j, ==, bob->keys->j);
+  g_assert_cmpint(restored->keys->k, ==, bob->keys->k);
+  g_assert_cmpuint(otrng_tail_list_len(&restored->keys->skipped_keys), ==, 1);
+  g_assert_cmpuint(otrng_vector_len(&restored->keys->old_mac_keys), ==,
+                   otrng_vector_len(&bob->keys->old_mac_keys));
+  otrng_assert_root_key_eq(restored->keys->current->root_key,
+                           bob->keys->current->root_key);
+  otrng_assert_cmpmem(restored->keys->ssid, bob->keys->ssid, SSID_BYTES);
+
+  /* The restored session decrypts the message that was skipped */
+  response_to_alice = otrng_response_new();
+  result = otrng_receive_message(response_to_alice, to_send_1, restored);
+  assert_message_rec(result, "hi", response_to_alice);
+  free_message_and_response(response_to_alice, &to_send_1);
+  g_assert_cmpuint(otrng_tail_list_len(&restored->keys->skipped_keys), ==, 0);
+
+  otrng_global_state_free(alice_client->global_state);
+  otrng_global_state_free(bob_client->global_state);
+  otrng_conn_free_all(alice, bob, restored);
+}
+
+static void test_session_rejects_truncated_state(void) {
+  otrng_client_s *alice_client = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *bob_client = otrng_client_new(BOB_IDENTITY);
+  uint8_t *ser = NULL;
+  size_t ser_len = 0;
+  unsigned int i_before;
+
+  otrng_s *alice = set_up(alice_client, 1);
+  otrng_s *bob = set_up(bob_client, 2);
+
+  do_dake_fixture(alice, bob);
+
+  otrng_assert_is_success(otrng_session_serialize(&ser, &ser_len, alice));
+
+  i_before = bob->keys->i;
+  otrng_assert_is_error(otrng_session_deserialize(bob, ser, ser_len / 2));
+  ser[0] = OTRNG_SESSION_VERSION + 1;
+  otrng_assert_is_error(otrng_session_deserialize(bob, ser, ser_len));
+  otrng_session_free_serialized(ser, ser_len);
+
+  /* Bob's session is left untouched */
+  otrng_assert(bob->state == OTRNG_STATE_ENCRYPTED_MESSAGES);
+  g_assert_cmpint(bob->keys->i, ==, i_before);
+
+  otrng_global_state_free(alice_client->global_state);
+  otrng_global_state_free(bob_client->global_state);
+  otrng_conn_free_all(alice, bob);
+}
+
+static void test_session_hibernates_encrypted_conversation(void) {
+  otrng_client_s *alice_client = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *bob_client = otrng_client_new(BOB_IDENTITY);
+  otrng_response_s *response_to_alice = NULL;
+  otrng_response_s *response_to_bob = NULL;
+  otrng_footprint_s footprint;
+  string_p to_send_1 = NULL;
+  string_p to_send_2 = NULL;
+  otrng_result result;
+
+  otrng_s *alice = set_up(alice_client, 1);
+  otrng_s *bob = set_up(bob_client, 2);
+
+  do_dake_fixture(alice, bob);
+
+  otrng_assert_is_success(otrng_hibernate(bob));
+  otrng_assert(bob->hibernated);
+  otrng_assert(bob->keys == NULL);
+  otrng_assert(bob->smp == NULL);
+  otrng_assert(bob->their_client_profile == NULL);
+  otrng_assert(bob->hibernated_state);
+
+  otrng_conversation_footprint(&footprint, bob);
+  g_assert_cmpuint(footprint.num_hibernated, ==, 1);
+  g_assert_cmpuint(footprint.hibernated, ==, bob->hibernated_state_len);
+  g_assert_cmpuint(footprint.keys, ==, 0);
+  g_assert_cmpuint(footprint.smp, ==, 0);
+
+  /* Bob resumes when a message arrives */
+  result = otrng_send_message(&to_send_1, "hi", NULL, 0, alice);
+  assert_message_sent(result, to_send_1);
+
+  response_to_alice = otrng_response_new();
+  result = otrng_receive_message(response_to_alice, to_send_1, bob);
+  assert_message_rec(result, "hi", response_to_alice);
+  free_message_and_response(response_to_alice, &to_send_1);
+
+  otrng_assert(!bob->hibernated);
+  otrng_assert(bob->hibernated_state == NULL);
+  otrng_assert(bob->state == OTRNG_STATE_ENCRYPTED_MESSAGES);
+  otrng_assert(bob->their_client_profile);
+
+  /* And the ratchet goes on */
+  result = otrng_send_message(&to_send_2, "oh, hi", NULL, 0, bob);
+  assert_message_sent(result, to_send_2);
+
+  response_to_bob = otrng_response_new();
+  result = otrng_receive_message(response_to_bob, to_send_2, alice);
+  assert_message_rec(result, "oh, hi", response_to_bob);
+  free_message_and_response(response_to_bob, &to_send_2);
+
+  otrng_global_state_free(alice_client->global_state);
+  otrng_global_state_free(bob_client->global_state);
+  otrng_conn_free_all(alice, bob);
+}
+
+static void test_session_does_not_hibernate_busy_conversation(void) {
+  otrng_client_s *alice_client = otrng_client_new(ALICE_IDENTITY);
+  otrng_s *alice = set_up(alice_client, 1);
+
+  alice->state = OTRNG_STATE_WAITING_AUTH_I;
+  otrng_assert_is_error(otrng_hibernate(alice));
+  otrng_assert(!alice->hibernated);
+  otrng_assert(alice->keys);
+
+  alice->state = OTRNG_STATE_START;
+  alice->smp->state_expect = SMP_STATE_EXPECT_2;
+  otrng_assert_is_error(otrng_hibernate(alice));
+  otrng_assert(alice->smp);
+
+  alice->smp->state_expect = SMP_STATE_EXPECT_1;
+  otrng_assert_is_success(otrng_hibernate(alice));
+
+  otrng_global_state_free(alice_client->global_state);
+  otrng_conn_free(alice);
+}
+
+static int stored_hibernated = 0;
+static int discarded_hibernated = 0;
+
+static otrng_result count_store_hibernated(const otrng_s *otr,
+                                           const uint8_t *data,
+                                           size_t data_len) {
+  (void)otr;
+  (void)data;
+  (void)data_len;
+  stored_hibernated++;
+  return OTRNG_SUCCESS;
+}
+
+static otrng_result fail_load_hibernated(const otrng_s *otr, uint8_t **data,
+                                         size_t *data_len) {
+  (void)otr;
+  (void)data;
+  (void)data_len;
+  return OTRNG_ERROR;
+}
+
+static void count_discard_hibernated(const otrng_s *otr) {
+  otrng_assert_cmpmem("bob", otr->peer, 4);
+  discarded_hibernated++;
+}
+
+static void test_session_discards_stored_hibernated_state(void) {
+  otrng_client_s *alice_client = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_callbacks_s callbacks = *test_callbacks;
+  otrng_s *alice = set_up(alice_client, 1);
+
+  callbacks.store_hibernated = count_store_hibernated;
+  callbacks.load_hibernated = fail_load_hibernated;
+  callbacks.discard_hibernated = count_discard_hibernated;
+  alice_client->global_state->callbacks = &callbacks;
+  alice->peer = otrng_xstrdup("bob");
+
+  stored_hibernated = 0;
+  discarded_hibernated = 0;
+
+  otrng_assert_is_success(otrng_hibernate(alice));
+  otrng_assert(alice->hibernated);
+  otrng_assert(alice->hibernated_state == NULL);
+  g_assert_cmpint(stored_hibernated, ==, 1);
+  g_assert_cmpint(discarded_hibernated, ==, 0);
+
+  /* Nothing can read what was stored once the conversation is gone */
+  otrng_conn_free(alice);
+  g_assert_cmpint(discarded_hibernated, ==, 1);
+
+  otrng_global_state_free(alice_client->global_state);
+}
+
+static void test_session_starts_over_when_state_is_lost(void) {
+  otrng_client_s *alice_client = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *bob_client = otrng_client_new(BOB_IDENTITY);
+
+  otrng_s *alice = set_up(alice_client, 1);
+  otrng_s *bob = set_up(bob_client, 2);
+
+  do_dake_fixture(alice, bob);
+
+  otrng_assert_is_success(otrng_hibernate(alice));
+  alice->hibernated_state[alice->hibernated_state_len - 1] ^= 1;
+
+  otrng_assert_is_error(otrng_resume(alice));
+  otrng_assert(!alice->hibernated);
+  otrng_assert(alice->keys);
+  otrng_assert(alice->smp);
+  otrng_assert(alice->state == OTRNG_STATE_START);
+  otrng_assert(alice->running_version == OTRNG_PROTOCOL_VERSION_NONE);
+
+  otrng_global_state_free(alice_client->global_state);
+  otrng_global_state_free(bob_client->global_state);
+  otrng_conn_free_all(alice, bob);
+}
+
+static void test_client_hibernates_idle_conversations(otrng_fixture_s *f,
+                                                      gconstpointer data) {
+  otrng_conversation_s *idle, *active;
+  otrng_footprint_s footprint;
+  time_t now = time(NULL);
+  (void)data;
+
+  idle = otrng_client_get_conversation(otrng_true, "alice", f->client);
+  active = otrng_client_get_conversation(otrng_true, "bob", f->client);
+
+  idle->conn->last_active = now - 120;
+
+  /* Hibernation is off by default */
+  otrng_client_hibernate_idle(f->client, now);
+  otrng_assert(!idle->conn->hibernated);
+
+  otrng_client_set_hibernation(60, f->client);
+  otrng_client_hibernate_idle(f->client, now);
+  otrng_assert(idle->conn->hibernated);
+  otrng_assert(!active->conn->hibernated);
+  otrng_assert(idle->conn->v3_conn == NULL);
+
+  otrng_client_footprint(&footprint, f->client);
+  g_assert_cmpuint(footprint.num_conversations, ==, 2);
+  g_assert_cmpuint(footprint.num_hibernated, ==, 1);
+
+  /* Looking the conversation up brings it back */
+  idle = otrng_client_get_conversation(otrng_false, "alice", f->client);
+  otrng_assert(!idle->conn->hibernated);
+  otrng_assert(idle->conn->keys);
+  otrng_assert(idle->conn->smp);
+  otrng_assert(idle->conn->v3_conn);
+  otrng_assert(idle->conn->v3_conn->opdata == idle->conn);
+  otrng_assert(idle->conn->state == OTRNG_STATE_START);
+}
+
+static void test_session_resumes_after_restart(void) {
+  otrng_client_s *alice_client = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *bob_client = otrng_client_new(BOB_IDENTITY);
+  otrng_client_s *restarted_client = otrng_client_new(BOB_IDENTITY);
+  otrng_client_s *other_client = otrng_client_new(BOB_IDENTITY);
+  otrng_response_s *response_to_alice = NULL;
+  otrng_conversation_s *conv;
+  uint8_t *exported = NULL;
+  size_t exported_len = 0;
+  string_p to_send = NULL;
+  otrng_result result;
+
+  otrng_s *alice = set_up(alice_client, 1);
+  set_up_client(bob_client, 2);
+  set_up_client(restarted_client, 2);
+  set_up_client(other_client, 3);
+
+  conv = otrng_client_get_conversation(otrng_true, "alice", bob_client);
+  do_dake_fixture(alice, conv->conn);
+
+  otrng_assert_is_error(otrng_client_export_session(&exported, &exported_len,
+                                                    "charlie", bob_client));
+  otrng_assert_is_success(otrng_client_export_session(
+      &exported, &exported_len, "alice", bob_client));
+  g_assert_cmpuint(exported[0], ==, OTRNG_SESSION_EXPORT_VERSION);
+
+  /* It was established with another instance tag */
+  otrng_assert_is_error(
+      otrng_client_import_session(exported, exported_len, other_client));
+  otrng_assert(!otrng_client_get_conversation(otrng_false, "alice",
+                                              other_client));
+
+  otrng_assert_is_error(
+      otrng_client_import_session(exported, exported_len - 1,
+                                  restarted_client));
+  otrng_assert_is_success(
+      otrng_client_import_session(exported, exported_len, restarted_client));
+  otrng_client_free_exported_session(exported, exported_len);
+
+  conv = otrng_client_get_conversation(otrng_false, "alice", restarted_client);
+  otrng_assert(conv);
+  otrng_assert(otrng_conversation_is_encrypted(conv));
+
+  /* No new DAKE is needed */
+  result = otrng_send_message(&to_send, "hi", NULL, 0, alice);
+  assert_message_sent(result, to_send);
+
+  response_to_alice = otrng_response_new();
+  result = otrng_receive_message(response_to_alice, to_send, conv->conn);
+  assert_message_rec(result, "hi", response_to_alice);
+  free_message_and_response(response_to_alice, &to_send);
+
+  otrng_global_state_free(alice_client->global_state);
+  otrng_global_state_free(bob_client->global_state);
+  otrng_global_state_free(restarted_client->global_state);
+  otrng_global_state_free(other_client->global_state);
+  otrng_conn_free(alice);
+}
+
+static void test_session_import_refuses_live_conversation(void) {
+  otrng_client_s *alice_client = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *bob_client = otrng_client_new(BOB_IDENTITY);
+  otrng_client_s *restarted_client = otrng_client_new(BOB_IDENTITY);
+  otrng_response_s *response = otrng_response_new();
+  otrng_conversation_s *conv, *live;
+  uint8_t *exported = NULL;
+  size_t exported_len = 0;
+
+  otrng_s *alice = set_up(alice_client, 1);
+  set_up_client(bob_client, 2);
+  set_up_client(restarted_client, 2);
+
+  conv = otrng_client_get_conversation(otrng_true, "alice", bob_client);
+  do_dake_fixture(alice, conv->conn);
+  otrng_assert_is_success(otrng_client_export_session(
+      &exported, &exported_len, "alice", bob_client));
+
+  /* Half of a fragmented message is waiting for the other half */
+  live = otrng_client_get_conversation(otrng_true, "alice", restarted_client);
+  otrng_assert_is_success(otrng_receive_message(
+      response, "?OTR|00000001|00000101|00000000,00001,00002,one ,",
+      live->conn));
+  otrng_assert(otrng_tail_list_len(&live->conn->pending_fragments) == 1);
+
+  otrng_assert_is_error(
+      otrng_client_import_session(exported, exported_len, restarted_client));
+  otrng_assert(otrng_tail_list_len(&live->conn->pending_fragments) == 1);
+  otrng_assert(!otrng_conversation_is_encrypted(live));
+  otrng_assert(live->conn->state == OTRNG_STATE_START);
+
+  otrng_client_free_exported_session(exported, exported_len);
+  otrng_response_free(response);
+  otrng_global_state_free(alice_client->global_state);
+  otrng_global_state_free(bob_client->global_state);
+  otrng_global_state_free(restarted_client->global_state);
+  otrng_conn_free(alice);
+}
+
+/* The serialized session follows the version, our instance tag and the peer
+   in an export */
+#define SESSION_OFFSET(peer) (1 + 4 + 4 + strlen(peer))
+
+static void assert_import_fails_with(const uint8_t *exported,
+                                     size_t exported_len, size_t offset,
+                                     uint8_t value, otrng_client_s *client) {
+  uint8_t *tampered = otrng_xmalloc(exported_len);
+
+  memcpy(tampered, exported, exported_len);
+  tampered[offset] = value;
+  otrng_assert_is_error(
+      otrng_client_import_session(tampered, exported_len, client));
+  otrng_free(tampered);
+}
+
+static void test_session_rejects_tampered_import(void) {
+  otrng_client_s *alice_client = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *bob_client = otrng_client_new(BOB_IDENTITY);
+  otrng_client_s *restarted_client = otrng_client_new(BOB_IDENTITY);
+  otrng_conversation_s *conv;
+  uint8_t *exported = NULL, *longer;
+  size_t exported_len = 0, session = SESSION_OFFSET("alice");
+
+  otrng_s *alice = set_up(alice_client, 1);
+  set_up_client(bob_client, 2);
+  set_up_client(restarted_client, 2);
+
+  conv = otrng_client_get_conversation(otrng_true, "alice", bob_client);
+  do_dake_fixture(alice, conv->conn);
+
+  otrng_assert_is_success(otrng_client_export_session(
+      &exported, &exported_len, "alice", bob_client));
+  g_assert_cmpuint(exported[session], ==, OTRNG_SESSION_VERSION);
+  g_assert_cmpuint(exported[session + 1], ==, OTRNG_STATE_ENCRYPTED_MESSAGES);
+
+  /* A state or a protocol version that is never serialized */
+  assert_import_fails_with(exported, exported_len, session + 1,
+                           OTRNG_STATE_WAITING_AUTH_I, restarted_client);
+  assert_import_fails_with(exported, exported_len, session + 1, 0x7f,
+                           restarted_client);
+  assert_import_fails_with(exported, exported_len, session + 2,
+                           OTRNG_PROTOCOL_VERSION_3, restarted_client);
+  assert_import_fails_with(exported, exported_len, session + 2,
+                           OTRNG_PROTOCOL_VERSION_NONE, restarted_client);
+
+  /* Keys for a conversation that is not encrypted */
+  assert_import_fails_with(exported, exported_len, session + 1,
+                           OTRNG_STATE_START, restarted_client);
+
+  /* Trailing bytes */
+  longer = otrng_xmalloc_z(exported_len + 1);
+  memcpy(longer, exported, exported_len);
+  otrng_assert_is_error(
+      otrng_client_import_session(longer, exported_len + 1, restarted_client));
+  otrng_free(longer);
+  otrng_client_free_exported_session(exported, exported_len);
+
+  /* An encrypted conversation without keys */
+  otrng_assert(otrng_client_get_conversation(otrng_true, "dave", bob_client));
+  otrng_assert_is_success(otrng_client_export_session(
+      &exported, &exported_len, "dave", bob_client));
+  session = SESSION_OFFSET("dave");
+  g_assert_cmpuint(exported[session + 1], ==, OTRNG_STATE_START);
+  g_assert_cmpuint(exported[exported_len - 1], ==, 0);
+  exported[session + 2] = OTRNG_PROTOCOL_VERSION_4;
+  assert_import_fails_with(exported, exported_len, session + 1,
+                           OTRNG_STATE_ENCRYPTED_MESSAGES, restarted_client);
+  otrng_client_free_exported_session(exported, exported_len);
+
+  /* Nothing was restored */
+  conv = otrng_client_get_conversation(otrng_false, "alice", restarted_client);
+  otrng_assert(!conv || !otrng_conversation_is_encrypted(conv));
+  conv = otrng_client_get_conversation(otrng_false, "dave", restarted_client);
+  otrng_assert(!conv || !otrng_conversation_is_encrypted(conv));
+
+  otrng_global_state_free(alice_client->global_state);
+  otrng_global_state_free(bob_client->global_state);
+  otrng_global_state_free(restarted_client->global_state);
+  otrng_conn_free(alice);
+}
+
+void units_session_add_tests(void) {
+  g_test_add_func("/session/serializes", test_session_serializes);
+  g_test_add_func("/session/rejects_truncated_state",
+                  test_session_rejects_truncated_state);
+  g_test_add_func("/session/hibernates_encrypted_conversation",
+                  test_session_hibernates_encrypted_conversation);
+  g_test_add_func("/session/does_not_hibernate_busy_conversation",
+                  test_session_does_not_hibernate_busy_conversation);
+  g_test_add_func("/session/discards_stored_hibernated_state",
+                  test_session_discards_stored_hibernated_state);
+  g_test_add_func("/session/starts_over_when_state_is_lost",
+                  test_session_starts_over_when_state_is_lost);
+  g_test_add_func("/session/resumes_after_restart",
+                  test_session_resumes_after_restart);
+  g_test_add_func("/session/rejects_tampered_import",
+                  test_session_rejects_tampered_import);
+  g_test_add_func("/session/import_refuses_live_conversation",
+                  test_session_import_refuses_live_conversation);
+  g_test_add("/session/client_hibernates_idle_conversations",
+             otrng_fixture_s, NULL, otrng_fixture_set_up,
+             test_client_hibernates_idle_conversations,
+             otrng_fixture_teardown);
+}
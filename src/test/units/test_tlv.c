@@ -59,6 +59,39 @@ static void test_tlv_parse() {
   otrng_tlv_list_free(tlvs);
 }
 
+static void test_tlv_iterate() {
+  uint8_t message[22] = {0x00, 0x06, 0x00, 0x03, 0x08, 0x05, 0x09, 0x00,
+                         0x02, 0x00, 0x04, 0xac, 0x04, 0x05, 0x06, 0x00,
+                         0x05, 0x00, 0x03, 0x08, 0x05, 0x09};
+  tlv_iter_s iter;
+  tlv_s view;
+
+  otrng_tlv_iter_init(&iter, message, sizeof(message));
+
+  otrng_assert(otrng_tlv_iter_next(&view, &iter));
+  otrng_assert(view.type == OTRNG_TLV_SMP_ABORT);
+  otrng_assert(view.len == 3);
+  otrng_assert(view.data == message + 4);
+
+  otrng_assert(otrng_tlv_iter_next(&view, &iter));
+  otrng_assert(view.type == OTRNG_TLV_SMP_MSG_1);
+  otrng_assert(view.len == 4);
+  otrng_assert(view.data == message + 11);
+
+  otrng_assert(otrng_tlv_iter_next(&view, &iter));
+  otrng_assert(view.type == OTRNG_TLV_SMP_MSG_4);
+  otrng_assert(view.data == message + 19);
+
+  otrng_assert(!otrng_tlv_iter_next(&view, &iter));
+
+  // Stops at a TLV longer than what is left
+  otrng_tlv_iter_init(&iter, message, sizeof(message) - 1);
+  otrng_assert(otrng_tlv_iter_next(&view, &iter));
+  otrng_assert(otrng_tlv_iter_next(&view, &iter));
+  otrng_assert(!otrng_tlv_iter_next(&view, &iter));
+  otrng_assert(!otrng_tlv_iter_next(&view, &iter));
+}
+
 static void test_otrng_append_tlv() {
   uint8_t smp2_data[2] = {0x03, 0x04};
   uint8_t smp3_data[3] = {0x05, 0x04, 0x03};
@@ -89,5 +122,6 @@ static void test_otrng_append_tlv() {
 
 void units_tlv_add_tests(void) {
   g_test_add_func("/tlv/parse", test_tlv_parse);
+  g_test_add_func("/tlv/iterate", test_tlv_iterate);
   g_test_add_func("/tlv/append", test_otrng_append_tlv);
 }
@@ -0,0 +1,360 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "test_helpers.h"
+
+#include "test_fixtures.h"
+
+#include "trace.h"
+
+#define MAX_RECORDED_EVENTS 128
+
+typedef struct {
+  otrng_trace_event_s events[MAX_RECORDED_EVENTS];
+  size_t num_events;
+} recorded_events_s;
+
+static void record_event(const otrng_trace_event_s *event, void *ctx) {
+  recorded_events_s *recorded = ctx;
+
+  otrng_assert(recorded->num_events < MAX_RECORDED_EVENTS);
+  recorded->events[recorded->num_events++] = *event;
+}
+
+static const otrng_trace_event_s *
+find_event(const recorded_events_s *recorded, otrng_trace_phase phase,
+           const char *name, uint64_t conversation, uint8_t message_type) {
+  size_t i;
+
+  for (i = 0; i < recorded->num_events; i++) {
+    const otrng_trace_event_s *event = &recorded->events[i];
+    if (event->phase == phase && strcmp(event->name, name) == 0 &&
+        event->conversation == conversation &&
+        event->message_type == message_type) {
+      return event;
+    }
+  }
+
+  return NULL;
+}
+
+static void test_trace_disabled(void) {
+  otrng_trace_span_s span;
+
+  otrng_assert(!otrng_trace_enabled());
+
+  otrng_trace_begin(&span, "nothing", 1, 2, 3, 4, 5);
+  otrng_assert(!span.begun);
+  otrng_trace_end(&span, OTRNG_SUCCESS);
+}
+
+static void test_trace_sink_receives_spans(void) {
+  recorded_events_s recorded;
+  otrng_trace_span_s outer, inner;
+  uint64_t client = otrng_trace_new_id();
+  uint64_t conversation = otrng_trace_new_id();
+
+  recorded.num_events = 0;
+  otrng_trace_set_sink(record_event, &recorded);
+  otrng_assert(otrng_trace_enabled());
+
+  otrng_trace_begin(&outer, "outer", client, conversation, 0x100, 0x200,
+                    DATA_MSG_TYPE);
+  otrng_trace_begin(&inner, "inner", client, conversation, 0x100, 0x200, 0);
+  otrng_trace_end(&inner, OTRNG_ERROR);
+  otrng_trace_end(&outer, OTRNG_SUCCESS);
+
+  otrng_trace_set_sink(NULL, NULL);
+
+  /* Nothing is emitted once the sink is cleared */
+  otrng_trace_begin(&outer, "outer", client, conversation, 0x100, 0x200, 0);
+  otrng_trace_end(&outer, OTRNG_SUCCESS);
+
+  g_assert_cmpuint(recorded.num_events, ==, 4);
+
+  g_assert_cmpint(recorded.events[0].phase, ==, OTRNG_TRACE_BEGIN);
+  g_assert_cmpstr(recorded.events[0].name, ==, "outer");
+  g_assert_cmpuint(recorded.events[0].client, ==, client);
+  g_assert_cmpuint(recorded.events[0].conversation, ==, conversation);
+  g_assert_cmpuint(recorded.events[0].our_instance_tag, ==, 0x100);
+  g_assert_cmpuint(recorded.events[0].their_instance_tag, ==, 0x200);
+  g_assert_cmpuint(recorded.events[0].message_type, ==, DATA_MSG_TYPE);
+
+  g_assert_cmpint(recorded.events[1].phase, ==, OTRNG_TRACE_BEGIN);
+  g_assert_cmpstr(recorded.events[1].name, ==, "inner");
+
+  g_assert_cmpint(recorded.events[2].phase, ==, OTRNG_TRACE_END);
+  g_assert_cmpstr(recorded.events[2].name, ==, "inner");
+  otrng_assert_is_error(recorded.events[2].result);
+
+  g_assert_cmpint(recorded.events[3].phase, ==, OTRNG_TRACE_END);
+  g_assert_cmpstr(recorded.events[3].name, ==, "outer");
+  otrng_assert_is_success(recorded.events[3].result);
+  g_assert_cmpuint(recorded.events[3].message_type, ==, DATA_MSG_TYPE);
+
+  g_assert_cmpuint(recorded.events[0].timestamp_ns, <=,
+                   recorded.events[1].timestamp_ns);
+  g_assert_cmpuint(recorded.events[2].timestamp_ns, <=,
+                   recorded.events[3].timestamp_ns);
+}
+
+typedef struct {
+  otrng_trace_sink_f sink;
+  unsigned int events;
+} counting_sink_s;
+
+static unsigned int counting_mismatches = 0;
+
+/* Two sinks that check they are called with their own context */
+static void count_event(counting_sink_s *sink, otrng_trace_sink_f expected) {
+  if (sink->sink != expected) {
+    __atomic_add_fetch(&counting_mismatches, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_add_fetch(&sink->events, 1, __ATOMIC_RELAXED);
+}
+
+static void count_event_a(const otrng_trace_event_s *event, void *ctx) {
+  (void)event;
+  count_event(ctx, count_event_a);
+}
+
+static void count_event_b(const otrng_trace_event_s *event, void *ctx) {
+  (void)event;
+  count_event(ctx, count_event_b);
+}
+
+static void *emit_spans(void *data) {
+  otrng_trace_span_s span;
+  int n;
+
+  (void)data;
+  for (n = 0; n < 20000; n++) {
+    otrng_trace_begin(&span, "worker", 1, 0, 0, 0, 0);
+    otrng_trace_end(&span, OTRNG_SUCCESS);
+  }
+
+  return NULL;
+}
+
+static void test_trace_sink_swapped_while_emitting(void) {
+  counting_sink_s a = {count_event_a, 0};
+  counting_sink_s b = {count_event_b, 0};
+  pthread_t worker;
+  int n;
+
+  counting_mismatches = 0;
+  otrng_trace_set_sink(count_event_a, &a);
+  otrng_assert(pthread_create(&worker, NULL, emit_spans, NULL) == 0);
+
+  for (n = 0; n < 2000; n++) {
+    otrng_trace_set_sink(count_event_b, &b);
+    otrng_trace_set_sink(NULL, NULL);
+    otrng_trace_set_sink(count_event_a, &a);
+  }
+
+  otrng_assert(pthread_join(worker, NULL) == 0);
+  otrng_trace_set_sink(NULL, NULL);
+
+  /* No event went to a sink with the context of the other one */
+  g_assert_cmpuint(counting_mismatches, ==, 0);
+  g_assert_cmpuint(a.events + b.events, >, 0);
+}
+
+static void test_trace_ids(void) {
+  uint64_t first = otrng_trace_new_id();
+  uint64_t second = otrng_trace_new_id();
+
+  g_assert_cmpuint(first, !=, 0);
+  g_assert_cmpuint(second, !=, 0);
+  g_assert_cmpuint(first, !=, second);
+}
+
+static char *read_trace(FILE *fp) {
+  long size = ftell(fp);
+  char *buffer;
+
+  otrng_assert(size >= 0);
+  buffer = otrng_xmalloc_z(size + 1);
+
+  rewind(fp);
+  otrng_assert(fread(buffer, 1, size, fp) == (size_t)size);
+
+  return buffer;
+}
+
+static void test_trace_chrome_writer(void) {
+  FILE *fp = tmpfile();
+  otrng_trace_chrome_writer_s *writer = otrng_trace_chrome_writer_new(fp);
+  otrng_trace_event_s event;
+  char *trace;
+
+  event.phase = OTRNG_TRACE_BEGIN;
+  event.name = "receive_message";
+  event.timestamp_ns = 1234567;
+  event.client = 3;
+  event.conversation = 7;
+  event.our_instance_tag = 0x100;
+  event.their_instance_tag = 0x101;
+  event.message_type = DATA_MSG_TYPE;
+  event.result = OTRNG_SUCCESS;
+  otrng_trace_chrome_sink(&event, writer);
+
+  event.phase = OTRNG_TRACE_END;
+  event.name = "a \"quoted\"\n\\name";
+  event.timestamp_ns = 2000001;
+  event.result = OTRNG_ERROR;
+  otrng_trace_chrome_sink(&event, writer);
+
+  /* The spans of the client itself are on a thread of their own */
+  event.phase = OTRNG_TRACE_BEGIN;
+  event.name = "orchestration.step";
+  event.timestamp_ns = 3000000;
+  event.conversation = 0;
+  event.our_instance_tag = 0;
+  event.their_instance_tag = 0;
+  event.message_type = 0;
+  otrng_trace_chrome_sink(&event, writer);
+
+  otrng_trace_chrome_writer_free(writer);
+
+  trace = read_trace(fp);
+  fclose(fp);
+
+  g_assert_cmpstr(
+      trace, ==,
+      "[\n"
+      "{\"name\":\"receive_message\",\"cat\":\"otrng\",\"ph\":\"B\","
+      "\"ts\":1234.567,\"pid\":3,\"tid\":7,"
+      "\"args\":{\"our_instance_tag\":256,\"their_instance_tag\":257,"
+      "\"message_type\":3}},\n"
+      "{\"name\":\"a \\\"quoted\\\"\\u000a\\\\name\",\"cat\":\"otrng\","
+      "\"ph\":\"E\",\"ts\":2000.001,\"pid\":3,\"tid\":7,"
+      "\"args\":{\"result\":\"error\"}},\n"
+      "{\"name\":\"orchestration.step\",\"cat\":\"otrng\",\"ph\":\"B\","
+      "\"ts\":3000.000,\"pid\":3,\"tid\":3,"
+      "\"args\":{\"our_instance_tag\":0,\"their_instance_tag\":0,"
+      "\"message_type\":0}}\n"
+      "]\n");
+
+  otrng_free(trace);
+}
+
+static void test_trace_chrome_writer_empty(void) {
+  FILE *fp = tmpfile();
+  char *trace;
+
+  otrng_trace_chrome_writer_free(otrng_trace_chrome_writer_new(fp));
+
+  trace = read_trace(fp);
+  fclose(fp);
+
+  g_assert_cmpstr(trace, ==, "[\n]\n");
+  otrng_free(trace);
+}
+
+/* Every span that begins in a conversation ends in it, innermost first */
+static void assert_spans_nest(const recorded_events_s *recorded,
+                              uint64_t conversation) {
+  const char *open[16];
+  size_t depth = 0, i;
+
+  for (i = 0; i < recorded->num_events; i++) {
+    const otrng_trace_event_s *event = &recorded->events[i];
+    if (event->conversation != conversation) {
+      continue;
+    }
+
+    if (event->phase == OTRNG_TRACE_BEGIN) {
+      otrng_assert(depth < 16);
+      open[depth++] = event->name;
+    } else {
+      otrng_assert(depth > 0);
+      g_assert_cmpstr(open[--depth], ==, event->name);
+    }
+  }
+
+  g_assert_cmpuint(depth, ==, 0);
+}
+
+static void test_trace_dake_spans(void) {
+  otrng_client_s *alice_client = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *bob_client = otrng_client_new(BOB_IDENTITY);
+  recorded_events_s *recorded = otrng_xmalloc_z(sizeof(recorded_events_s));
+  const otrng_trace_event_s *event;
+
+  otrng_s *alice = set_up(alice_client, 1);
+  otrng_s *bob = set_up(bob_client, 2);
+
+  g_assert_cmpuint(alice->trace_id, !=, bob->trace_id);
+  g_assert_cmpuint(alice_client->trace_id, !=, bob_client->trace_id);
+  g_assert_cmpuint(alice_client->trace_id, !=, alice->trace_id);
+
+  otrng_trace_set_sink(record_event, recorded);
+  do_dake_fixture(alice, bob);
+  otrng_trace_set_sink(NULL, NULL);
+
+  assert_spans_nest(recorded, alice->trace_id);
+  assert_spans_nest(recorded, bob->trace_id);
+
+  /* Bob starts the DAKE when he receives the Query message */
+  otrng_assert(find_event(recorded, OTRNG_TRACE_BEGIN, "dake.start",
+                          bob->trace_id, IDENTITY_MSG_TYPE));
+
+  event = find_event(recorded, OTRNG_TRACE_BEGIN, "receive_decoded_message",
+                     alice->trace_id, IDENTITY_MSG_TYPE);
+  otrng_assert(event);
+  g_assert_cmpuint(event->client, ==, alice_client->trace_id);
+  g_assert_cmpuint(event->our_instance_tag, ==, our_instance_tag(alice));
+
+  event = find_event(recorded, OTRNG_TRACE_END, "receive_decoded_message",
+                     bob->trace_id, AUTH_R_MSG_TYPE);
+  otrng_assert(event);
+  otrng_assert_is_success(event->result);
+
+  otrng_assert(find_event(recorded, OTRNG_TRACE_END,
+                          "receive_decoded_message", alice->trace_id,
+                          AUTH_I_MSG_TYPE));
+  otrng_assert(find_event(recorded, OTRNG_TRACE_END, "send_data_message",
+                          alice->trace_id, DATA_MSG_TYPE));
+  otrng_assert(find_event(recorded, OTRNG_TRACE_END,
+                          "receive_decoded_message", bob->trace_id,
+                          DATA_MSG_TYPE));
+
+  otrng_free(recorded);
+  otrng_global_state_free(alice_client->global_state);
+  otrng_global_state_free(bob_client->global_state);
+  otrng_conn_free_all(alice, bob);
+}
+
+void units_trace_add_tests(void) {
+  g_test_add_func("/trace/disabled", test_trace_disabled);
+  g_test_add_func("/trace/sink_receives_spans",
+                  test_trace_sink_receives_spans);
+  g_test_add_func("/trace/sink_swapped_while_emitting",
+                  test_trace_sink_swapped_while_emitting);
+  g_test_add_func("/trace/ids", test_trace_ids);
+  g_test_add_func("/trace/chrome_writer", test_trace_chrome_writer);
+  g_test_add_func("/trace/chrome_writer_empty", test_trace_chrome_writer_empty);
+  g_test_add_func("/trace/dake_spans", test_trace_dake_spans);
+}
@@ -44,50 +44,91 @@ tstatic void set_tlv_type(tlv_s *tlv, uint16_t tlv_type) {
   }
 }
 
-/*@null@*/ tstatic tlv_s *parse_tlv(const uint8_t *src, size_t len,
+tstatic otrng_result parse_tlv_view(tlv_s *view, const uint8_t *src, size_t len,
                                     size_t *read) {
-  tlv_s *tlv = otrng_tlv_new(OTRNG_TLV_NONE, 0, NULL);
   size_t w = 0;
   uint16_t tlv_type = -1;
   const uint8_t *cursor = src;
 
-  if (!tlv) {
-    return NULL;
-  }
-
   if (!otrng_deserialize_uint16(&tlv_type, cursor, len, &w)) {
-    otrng_tlv_free(tlv);
-    return NULL;
+    return OTRNG_ERROR;
   }
 
-  set_tlv_type(tlv, tlv_type);
+  set_tlv_type(view, tlv_type);
 
   len -= w;
   cursor += w;
 
-  if (!otrng_deserialize_uint16(&tlv->len, cursor, len, &w)) {
-    otrng_tlv_free(tlv);
-    return NULL;
+  if (!otrng_deserialize_uint16(&view->len, cursor, len, &w)) {
+    return OTRNG_ERROR;
   }
 
   len -= w;
   cursor += w;
 
-  if (len < tlv->len) {
-    otrng_tlv_free(tlv);
-    return NULL;
+  if (len < view->len) {
+    return OTRNG_ERROR;
   }
 
-  tlv->data = otrng_xmalloc_z(tlv->len);
-
-  memcpy(tlv->data, cursor, tlv->len);
-  cursor += tlv->len;
+  /* The view only borrows the payload */
+  view->data = view->len ? (uint8_t *)cursor : NULL;
+  cursor += view->len;
 
   if (read) {
     *read = cursor - src;
   }
 
-  return tlv;
+  return OTRNG_SUCCESS;
+}
+
+INTERNAL void otrng_tlv_iter_init(tlv_iter_s *iter, const uint8_t *src,
+                                  size_t len) {
+  iter->cursor = src;
+  iter->len = len;
+}
+
+INTERNAL otrng_bool otrng_tlv_iter_next(tlv_s *view, tlv_iter_s *iter) {
+  size_t read = 0;
+
+  if (iter->len == 0) {
+    return otrng_false;
+  }
+
+  if (!parse_tlv_view(view, iter->cursor, iter->len, &read)) {
+    /* Whatever follows a malformed TLV can't be trusted either */
+    iter->len = 0;
+    return otrng_false;
+  }
+
+  iter->cursor += read;
+  iter->len -= read;
+
+  return otrng_true;
+}
+
+/*@null@*/ INTERNAL tlv_s *otrng_tlv_copy(const tlv_s *tlv) {
+  tlv_s *copy = otrng_tlv_new(OTRNG_TLV_NONE, tlv->len, tlv->data);
+  if (!copy) {
+    return NULL;
+  }
+
+  copy->type = tlv->type;
+
+  return copy;
+}
+
+/*@null@*/ INTERNAL tlv_list_s *otrng_tlv_list_append_after(tlv_list_s *tail,
+                                                           tlv_s *tlv) {
+  tlv_list_s *n = otrng_tlv_list_one(tlv);
+  if (!n) {
+    return NULL;
+  }
+
+  if (tail) {
+    tail->next = n;
+  }
+
+  return n;
 }
 
 /*@null@*/ INTERNAL tlv_list_s *otrng_append_tlv(tlv_list_s *head, tlv_s *tlv) {
@@ -114,20 +155,21 @@ tstatic void set_tlv_type(tlv_s *tlv, uint16_t tlv_type) {
 
 /*@null@*/ INTERNAL tlv_list_s *otrng_parse_tlvs(const uint8_t *src,
                                                  size_t len) {
-  tlv_list_s *ret = NULL, *tmp = NULL;
-  while (len > 0) {
-    size_t read = 0;
-    tlv_s *tlv = parse_tlv(src, len, &read);
-    if (!tlv) {
+  tlv_list_s *ret = NULL, *tail = NULL, *tmp;
+  tlv_iter_s iter;
+  tlv_s view;
+
+  otrng_tlv_iter_init(&iter, src, len);
+  while (otrng_tlv_iter_next(&view, &iter)) {
+    tmp = otrng_tlv_list_append_after(tail, otrng_tlv_copy(&view));
+    if (!tmp) {
       break;
     }
 
-    tmp = otrng_append_tlv(ret, tlv);
-    if (tmp != NULL) {
-      ret = tmp;
+    tail = tmp;
+    if (!ret) {
+      ret = tail;
     }
-    src += read;
-    len -= read;
   }
 
   return ret;
@@ -70,6 +70,17 @@ typedef struct tlv_list_s {
   struct tlv_list_s *next;
 } tlv_list_s;
 
+/**
+ * @brief The tlv_iter_s structure walks the TLVs of a serialized buffer.
+ *
+ *  [cursor] where the next TLV starts
+ *  [len]    how many bytes are left to parse
+ **/
+typedef struct tlv_iter_s {
+  const uint8_t *cursor;
+  size_t len;
+} tlv_iter_s;
+
 /**
  * @brief Frees the given list of TLVs
  *
@@ -119,6 +130,41 @@ INTERNAL void otrng_tlv_list_free(tlv_list_s *tlvs);
 /*@null@*/ INTERNAL tlv_list_s *otrng_parse_tlvs(const uint8_t *src,
                                                  size_t len);
 
+/**
+ * @brief Starts iterating over the TLVs in the memory region from [src] to
+ *    [src]+[len], without copying any of them.
+ *
+ * @param [iter] the iterator to initialize. can't be NULL
+ * @param [src]  the pointer to where to start parsing. can't be NULL
+ * @param [len]  the amount of data to parse. can be 0.
+ **/
+INTERNAL void otrng_tlv_iter_init(tlv_iter_s *iter, const uint8_t *src,
+                                  size_t len);
+
+/**
+ * @brief Reads the next TLV from [iter] into [view].
+ *
+ * @param [view] the TLV to fill in. Its [data] is borrowed from the buffer
+ *               given to otrng_tlv_iter_init: it must not be freed or
+ *               modified, and is only valid as long as that buffer is. Use
+ *               otrng_tlv_copy to keep it.
+ * @param [iter] the iterator. can't be NULL
+ *
+ * @return otrng_true if a TLV was read. otrng_false when there are no more
+ *         TLVs, or the next one is malformed.
+ **/
+INTERNAL otrng_bool otrng_tlv_iter_next(tlv_s *view, tlv_iter_s *iter);
+
+/**
+ * @brief creates a new TLV with a copy of the type and data of [tlv] - for
+ *    example, to keep a TLV read by otrng_tlv_iter_next.
+ *
+ * @return the newly created TLV, if successful. It is the callers
+ *         responsibility to free it after use.
+ *         returns NULL if something goes wrong.
+ **/
+/*@null@*/ INTERNAL tlv_s *otrng_tlv_copy(const tlv_s *tlv);
+
 /**
  * @brief creates a new TLV from the given data.
  *
@@ -151,6 +197,19 @@ INTERNAL void otrng_tlv_list_free(tlv_list_s *tlvs);
 /*@null@*/ INTERNAL tlv_list_s *otrng_append_tlv(/*@null@*/ tlv_list_s *tlvs,
                                                  tlv_s *tlv);
 
+/**
+ * @brief appends the given TLV after [tail], in constant time
+ *
+ * @param [tail] the last node of a list of TLVs. Can be NULL, to start a new
+ *               list.
+ * @param [tlv]  the TLV to add.
+ *
+ * @return the new last node of the list - which is also its first node, if
+ *         [tail] is NULL. Returns NULL if [tlv] is NULL.
+ **/
+/*@null@*/ INTERNAL tlv_list_s *
+otrng_tlv_list_append_after(/*@null@*/ tlv_list_s *tail, tlv_s *tlv);
+
 /*@null@*/ INTERNAL tlv_s *otrng_tlv_padding_new(size_t len);
 
 INTERNAL void otrng_tlv_free(tlv_s *tlv);
@@ -0,0 +1,207 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#define OTRNG_TRACE_PRIVATE
+
+#include "alloc.h"
+#include "trace.h"
+
+struct otrng_trace_sink_s {
+  otrng_trace_sink_f sink;
+  void *ctx;
+  otrng_trace_sink_s *next;
+};
+
+otrng_trace_sink_s *otrng_trace_current_sink = NULL;
+
+/* Every sink that was registered. A worker can still be calling one after it
+   was replaced, so they are never freed. They are only added by
+   otrng_trace_set_sink, which is called a handful of times */
+static pthread_mutex_t sinks_lock = PTHREAD_MUTEX_INITIALIZER;
+static otrng_trace_sink_s *sinks = NULL;
+
+static pthread_mutex_t ids_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t last_id = 0;
+
+struct otrng_trace_chrome_writer_s {
+  pthread_mutex_t lock;
+  FILE *out;
+  otrng_bool empty;
+};
+
+API void otrng_trace_set_sink(otrng_trace_sink_f sink, void *ctx) {
+  otrng_trace_sink_s *current = NULL;
+
+  if (sink) {
+    pthread_mutex_lock(&sinks_lock);
+    for (current = sinks; current; current = current->next) {
+      if (current->sink == sink && current->ctx == ctx) {
+        break;
+      }
+    }
+
+    if (!current) {
+      current = otrng_xmalloc_z(sizeof(otrng_trace_sink_s));
+      current->sink = sink;
+      current->ctx = ctx;
+      current->next = sinks;
+      sinks = current;
+    }
+    pthread_mutex_unlock(&sinks_lock);
+  }
+
+  /* The sink and its context are published together, so that an event never
+     goes to a sink with the context of another */
+  __atomic_store_n(&otrng_trace_current_sink, current, __ATOMIC_RELEASE);
+}
+
+static uint64_t monotonic_ns(void) {
+  struct timespec now;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static void emit(const otrng_trace_span_s *span, otrng_trace_phase phase,
+                 otrng_result result) {
+  const otrng_trace_sink_s *current =
+      __atomic_load_n(&otrng_trace_current_sink, __ATOMIC_ACQUIRE);
+  otrng_trace_event_s event;
+
+  /* The sink was cleared after the span began */
+  if (!current) {
+    return;
+  }
+
+  event.phase = phase;
+  event.name = span->name;
+  event.timestamp_ns = monotonic_ns();
+  event.client = span->client;
+  event.conversation = span->conversation;
+  event.our_instance_tag = span->our_instance_tag;
+  event.their_instance_tag = span->their_instance_tag;
+  event.message_type = span->message_type;
+  event.result = result;
+
+  current->sink(&event, current->ctx);
+}
+
+INTERNAL void otrng_trace_emit_begin(otrng_trace_span_s *span) {
+  span->begun = otrng_true;
+  emit(span, OTRNG_TRACE_BEGIN, OTRNG_SUCCESS);
+}
+
+INTERNAL void otrng_trace_emit_end(const otrng_trace_span_s *span,
+                                   otrng_result result) {
+  emit(span, OTRNG_TRACE_END, result);
+}
+
+INTERNAL uint64_t otrng_trace_new_id(void) {
+  uint64_t id;
+
+  pthread_mutex_lock(&ids_lock);
+  id = ++last_id;
+  pthread_mutex_unlock(&ids_lock);
+
+  return id;
+}
+
+API otrng_trace_chrome_writer_s *otrng_trace_chrome_writer_new(FILE *out) {
+  otrng_trace_chrome_writer_s *writer =
+      otrng_xmalloc_z(sizeof(otrng_trace_chrome_writer_s));
+
+  pthread_mutex_init(&writer->lock, NULL);
+  writer->out = out;
+  writer->empty = otrng_true;
+
+  (void)fputs("[", out);
+
+  return writer;
+}
+
+tstatic void write_json_string(FILE *out, const char *s) {
+  (void)fputc('"', out);
+  for (; *s; s++) {
+    unsigned char c = (unsigned char)*s;
+
+    if (c == '"' || c == '\\') {
+      (void)fputc('\\', out);
+      (void)fputc(c, out);
+    } else if (c < 0x20) {
+      (void)fprintf(out, "\\u%04x", c);
+    } else {
+      (void)fputc(c, out);
+    }
+  }
+  (void)fputc('"', out);
+}
+
+API void otrng_trace_chrome_sink(const otrng_trace_event_s *event,
+                                 void *writer) {
+  otrng_trace_chrome_writer_s *w = writer;
+
+  pthread_mutex_lock(&w->lock);
+
+  (void)fputs(w->empty ? "\n" : ",\n", w->out);
+  w->empty = otrng_false;
+
+  (void)fputs("{\"name\":", w->out);
+  write_json_string(w->out, event->name);
+
+  /* Timestamps are in microseconds. Begin and end events are paired by
+     thread, so the spans of a client outside of its conversations get a
+     thread of their own: the client number, which no conversation has */
+  (void)fprintf(w->out,
+                ",\"cat\":\"otrng\",\"ph\":\"%c\",\"ts\":%" PRIu64
+                ".%03u,\"pid\":%" PRIu64 ",\"tid\":%" PRIu64,
+                (char)event->phase, event->timestamp_ns / 1000,
+                (unsigned int)(event->timestamp_ns % 1000), event->client,
+                event->conversation ? event->conversation : event->client);
+
+  if (event->phase == OTRNG_TRACE_BEGIN) {
+    (void)fprintf(w->out,
+                  ",\"args\":{\"our_instance_tag\":%" PRIu32
+                  ",\"their_instance_tag\":%" PRIu32
+                  ",\"message_type\":%u}}",
+                  event->our_instance_tag, event->their_instance_tag,
+                  (unsigned int)event->message_type);
+  } else {
+    (void)fprintf(w->out, ",\"args\":{\"result\":\"%s\"}}",
+                  otrng_failed(event->result) ? "error" : "success");
+  }
+
+  pthread_mutex_unlock(&w->lock);
+}
+
+API void otrng_trace_chrome_writer_free(otrng_trace_chrome_writer_s *writer) {
+  if (!writer) {
+    return;
+  }
+
+  (void)fputs("\n]\n", writer->out);
+  (void)fflush(writer->out);
+
+  pthread_mutex_destroy(&writer->lock);
+  otrng_free(writer);
+}
@@ -0,0 +1,193 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Tracing reports what the library is doing as spans: each one is a begin
+ * and an end event with monotonic timestamps, tagged with the client and the
+ * conversation it belongs to, the instance tags on both sides, and the type
+ * of the message it is about. The events are given to a sink registered by
+ * the application.
+ *
+ * A sink that writes the Chrome trace event format is built in, so a trace
+ * can be opened in chrome://tracing or Perfetto.
+ *
+ * When no sink is registered, a span costs a single branch.
+ *
+ * The sink is global to the process, and can be changed at any time. Since
+ * spans are also emitted from worker threads, the sink has to be thread safe.
+ * The built-in one is. A sink that is replaced can still be called for events
+ * that were being emitted, so what its context points to has to outlive every
+ * span that could have begun while it was registered.
+ */
+
+#ifndef OTRNG_TRACE_H
+#define OTRNG_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "error.h"
+#include "shared.h"
+
+typedef enum {
+  OTRNG_TRACE_BEGIN = 'B',
+  OTRNG_TRACE_END = 'E',
+} otrng_trace_phase;
+
+/**
+ * @brief One end of a span.
+ *  [name]                what the span does. It lives as long as the library
+ *  [timestamp_ns]        from CLOCK_MONOTONIC
+ *  [client]              a number that is unique to the client in this
+ *                        process, or 0 if the span is not done for a client
+ *  [conversation]        a number that is unique to the conversation in this
+ *                        process, or 0 if the span is not in a conversation.
+ *                        Client and conversation numbers never overlap
+ *  [our_instance_tag]    0 if not known
+ *  [their_instance_tag]  0 if not known
+ *  [message_type]        the type of the OTRv4 message the span is about, such
+ *                        as DATA_MSG_TYPE, or 0
+ *  [result]              how the span ended. Only set for OTRNG_TRACE_END
+ **/
+typedef struct otrng_trace_event_s {
+  otrng_trace_phase phase;
+  const char *name;
+  uint64_t timestamp_ns;
+  uint64_t client;
+  uint64_t conversation;
+  uint32_t our_instance_tag;
+  uint32_t their_instance_tag;
+  uint8_t message_type;
+  otrng_result result;
+} otrng_trace_event_s;
+
+typedef void (*otrng_trace_sink_f)(const otrng_trace_event_s *event,
+                                   void *ctx);
+
+/* A span that was begun. It only has to live until it ends */
+typedef struct otrng_trace_span_s {
+  const char *name;
+  uint64_t client;
+  uint64_t conversation;
+  uint32_t our_instance_tag;
+  uint32_t their_instance_tag;
+  uint8_t message_type;
+  otrng_bool begun;
+} otrng_trace_span_s;
+
+/* Where the Chrome trace event format is written */
+typedef struct otrng_trace_chrome_writer_s otrng_trace_chrome_writer_s;
+
+/* A registered sink with its context */
+typedef struct otrng_trace_sink_s otrng_trace_sink_s;
+
+/**
+ * @brief Sends every span to [sink], which is called with [ctx]. A NULL
+ *    [sink] turns tracing off.
+ **/
+API void otrng_trace_set_sink(/*@null@*/ otrng_trace_sink_f sink,
+                              /*@null@*/ void *ctx);
+
+/**
+ * @brief Starts a Chrome trace in [out], which is not closed by the library.
+ *
+ * Each client is shown as a process, with its conversations as threads in it.
+ * The spans of the client itself, outside of any conversation, are on a
+ * thread of their own. Register it with:
+ *   otrng_trace_set_sink(otrng_trace_chrome_sink, writer);
+ **/
+API otrng_trace_chrome_writer_s *otrng_trace_chrome_writer_new(FILE *out);
+
+/**
+ * @brief The sink that writes [event] to the otrng_trace_chrome_writer_s in
+ *    [writer].
+ **/
+API void otrng_trace_chrome_sink(const otrng_trace_event_s *event,
+                                 void *writer);
+
+/**
+ * @brief Finishes the trace and frees [writer].
+ *
+ * It has to be unregistered first, and only freed once no span that began
+ * while it was registered can still be in flight. A worker thread that read
+ * the sink before it was unregistered still writes to [writer]: stop or wait
+ * for the library's work (SMP, prekey generation, startup) first.
+ **/
+API void otrng_trace_chrome_writer_free(
+    /*@only@*/ /*@null@*/ otrng_trace_chrome_writer_s *writer);
+
+/* Read by the inline functions below, so that a span costs a branch when
+   tracing is off. Use otrng_trace_set_sink to change it */
+extern /*@null@*/ otrng_trace_sink_s *otrng_trace_current_sink;
+
+INTERNAL void otrng_trace_emit_begin(otrng_trace_span_s *span);
+
+INTERNAL void otrng_trace_emit_end(const otrng_trace_span_s *span,
+                                   otrng_result result);
+
+/**
+ * @brief A number that identifies a new client or conversation in the spans.
+ **/
+INTERNAL uint64_t otrng_trace_new_id(void);
+
+static inline otrng_bool otrng_trace_enabled(void) {
+  return __atomic_load_n(&otrng_trace_current_sink, __ATOMIC_RELAXED) != NULL;
+}
+
+/**
+ * @brief Begins [span], if tracing is on. It has to be ended with
+ *    otrng_trace_end.
+ **/
+static inline void otrng_trace_begin(otrng_trace_span_s *span,
+                                     const char *name, uint64_t client,
+                                     uint64_t conversation,
+                                     uint32_t our_instance_tag,
+                                     uint32_t their_instance_tag,
+                                     uint8_t message_type) {
+  span->begun = otrng_false;
+  if (!otrng_trace_enabled()) {
+    return;
+  }
+
+  span->name = name;
+  span->client = client;
+  span->conversation = conversation;
+  span->our_instance_tag = our_instance_tag;
+  span->their_instance_tag = their_instance_tag;
+  span->message_type = message_type;
+  otrng_trace_emit_begin(span);
+}
+
+static inline void otrng_trace_end(const otrng_trace_span_s *span,
+                                   otrng_result result) {
+  if (!span->begun) {
+    return;
+  }
+
+  otrng_trace_emit_end(span, result);
+}
+
+#ifdef OTRNG_TRACE_PRIVATE
+
+tstatic void write_json_string(FILE *out, const char *s);
+
+#endif
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define OTRNG_WORKER_PRIVATE
+
+#include "worker.h"
+#include "alloc.h"
+
+tstatic void *worker_thread_main(void *data) {
+  otrng_worker_s *worker = data;
+  otrng_worker_job_s *job;
+
+  pthread_mutex_lock(&worker->lock);
+  for (;;) {
+    while (!worker->head && !worker->stopping) {
+      pthread_cond_wait(&worker->has_work, &worker->lock);
+    }
+
+    if (!worker->head) {
+      break;
+    }
+
+    job = worker->head;
+    worker->head = job->next;
+    if (!worker->head) {
+      worker->tail = NULL;
+    }
+    job->next = NULL;
+    pthread_mutex_unlock(&worker->lock);
+
+    job->run(job->data);
+
+    pthread_mutex_lock(&worker->lock);
+    job->ready = otrng_true;
+    pthread_cond_broadcast(&worker->work_done);
+    pthread_mutex_unlock(&worker->lock);
+
+    if (job->notify) {
+      job->notify(job->data);
+    }
+
+    pthread_mutex_lock(&worker->lock);
+    /* The job can be freed by its owner as soon as this is set */
+    job->done = otrng_true;
+    worker->pending--;
+    pthread_cond_broadcast(&worker->work_done);
+  }
+  pthread_mutex_unlock(&worker->lock);
+
+  return NULL;
+}
+
+static void worker_stop(otrng_worker_s *worker, unsigned int started) {
+  unsigned int i;
+
+  pthread_mutex_lock(&worker->lock);
+  worker->stopping = otrng_true;
+  pthread_cond_broadcast(&worker->has_work);
+  pthread_mutex_unlock(&worker->lock);
+
+  for (i = 0; i < started; i++) {
+    pthread_join(worker->threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&worker->work_done);
+  pthread_cond_destroy(&worker->has_work);
+  pthread_mutex_destroy(&worker->lock);
+  otrng_free(worker->threads);
+  otrng_free(worker);
+}
+
+INTERNAL /*@null@*/ otrng_worker_s *otrng_worker_new(unsigned int num_threads) {
+  otrng_worker_s *worker;
+  unsigned int i;
+
+  if (num_threads == 0) {
+    return NULL;
+  }
+
+  worker = otrng_xmalloc_z(sizeof(otrng_worker_s));
+  worker->threads = otrng_xmalloc_z(num_threads * sizeof(pthread_t));
+  worker->num_threads = num_threads;
+
+  pthread_mutex_init(&worker->lock, NULL);
+  pthread_cond_init(&worker->has_work, NULL);
+  pthread_cond_init(&worker->work_done, NULL);
+
+  for (i = 0; i < num_threads; i++) {
+    if (pthread_create(&worker->threads[i], NULL, worker_thread_main,
+                       worker) != 0) {
+      worker_stop(worker, i);
+      return NULL;
+    }
+  }
+
+  return worker;
+}
+
+INTERNAL void otrng_worker_free(otrng_worker_s *worker) {
+  if (!worker) {
+    return;
+  }
+
+  otrng_worker_wait(worker);
+  worker_stop(worker, worker->num_threads);
+}
+
+INTERNAL void otrng_worker_submit(otrng_worker_s *worker,
+                                  otrng_worker_job_s *job) {
+  job->ready = otrng_false;
+  job->done = otrng_false;
+  job->next = NULL;
+
+  pthread_mutex_lock(&worker->lock);
+  if (worker->tail) {
+    worker->tail->next = job;
+  } else {
+    worker->head = job;
+  }
+  worker->tail = job;
+  worker->pending++;
+  pthread_cond_signal(&worker->has_work);
+  pthread_mutex_unlock(&worker->lock);
+}
+
+INTERNAL otrng_bool otrng_worker_job_ready(otrng_worker_s *worker,
+                                           const otrng_worker_job_s *job) {
+  otrng_bool ready;
+
+  pthread_mutex_lock(&worker->lock);
+  ready = job->ready;
+  pthread_mutex_unlock(&worker->lock);
+
+  return ready;
+}
+
+INTERNAL void otrng_worker_job_wait(otrng_worker_s *worker,
+                                    const otrng_worker_job_s *job) {
+  pthread_mutex_lock(&worker->lock);
+  while (!job->done) {
+    pthread_cond_wait(&worker->work_done, &worker->lock);
+  }
+  pthread_mutex_unlock(&worker->lock);
+}
+
+INTERNAL void otrng_worker_wait(otrng_worker_s *worker) {
+  pthread_mutex_lock(&worker->lock);
+  while (worker->pending > 0) {
+    pthread_cond_wait(&worker->work_done, &worker->lock);
+  }
+  pthread_mutex_unlock(&worker->lock);
+}
@@ -0,0 +1,116 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A small pool of threads that runs jobs off the calling thread. Jobs are
+ * started in the order they were submitted. With a single thread, they also
+ * finish in that order.
+ *
+ * The functions in this file are safe to call concurrently from different
+ * threads. The jobs themselves have to make sure that they don't touch memory
+ * that is used somewhere else while they are running.
+ */
+
+#ifndef OTRNG_WORKER_H
+#define OTRNG_WORKER_H
+
+#include <pthread.h>
+
+#include "error.h"
+#include "shared.h"
+
+/**
+ * @brief The otrng_worker_job_s structure represents one unit of work.
+ *
+ *  [run]    called on a worker thread to do the work. can't be NULL.
+ *  [notify] called on the same worker thread after [run] has finished and the
+ *           job is ready. can be NULL.
+ *  [data]   given as argument to [run] and [notify].
+ *
+ * The memory for the job is owned by the caller, and it can't be freed before
+ * otrng_worker_job_wait has returned for it.
+ **/
+typedef struct otrng_worker_job_s {
+  void (*run)(void *data);
+  /*@null@*/ void (*notify)(void *data);
+  void *data;
+
+  /* These are guarded by the worker lock */
+  otrng_bool ready;
+  otrng_bool done;
+  struct otrng_worker_job_s *next;
+} otrng_worker_job_s;
+
+typedef struct otrng_worker_s {
+  pthread_mutex_t lock;
+  pthread_cond_t has_work;
+  pthread_cond_t work_done;
+
+  pthread_t *threads;
+  unsigned int num_threads;
+
+  otrng_worker_job_s *head;
+  otrng_worker_job_s *tail;
+  unsigned int pending;
+  otrng_bool stopping;
+} otrng_worker_s;
+
+/**
+ * @brief Creates a worker and starts [num_threads] threads for it.
+ *
+ * @return the new worker, or NULL if the threads could not be started.
+ **/
+INTERNAL /*@null@*/ otrng_worker_s *otrng_worker_new(unsigned int num_threads);
+
+/**
+ * @brief Waits for all submitted jobs to be done, stops the threads and frees
+ *    the worker. Safe to call with NULL.
+ **/
+INTERNAL void otrng_worker_free(/*@only@*/ /*@null@*/ otrng_worker_s *worker);
+
+INTERNAL void otrng_worker_submit(otrng_worker_s *worker,
+                                  otrng_worker_job_s *job);
+
+/**
+ * @brief Returns true once [run] has finished for the job. [notify] might
+ *    still be running at this point.
+ **/
+INTERNAL otrng_bool otrng_worker_job_ready(otrng_worker_s *worker,
+                                           const otrng_worker_job_s *job);
+
+/**
+ * @brief Blocks until the job is done. After this, the job memory can be
+ *    released.
+ **/
+INTERNAL void otrng_worker_job_wait(otrng_worker_s *worker,
+                                    const otrng_worker_job_s *job);
+
+/**
+ * @brief Blocks until every submitted job is done.
+ **/
+INTERNAL void otrng_worker_wait(otrng_worker_s *worker);
+
+#ifdef OTRNG_WORKER_PRIVATE
+
+tstatic void *worker_thread_main(void *data);
+
+#endif
+
+#endif
@@ -0,0 +1,325 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OTRNG_WRITE_BACK_PRIVATE
+
+#include "alloc.h"
+#include "str.h"
+#include "write_back.h"
+
+typedef otrng_result (*section_writer)(const otrng_global_state_s *gs,
+                                       FILE *f);
+
+/* Indexed by the bit of the section */
+static const section_writer section_writers[OTRNG_SECTION_COUNT] = {
+    otrng_global_state_private_key_v4_write_to,
+    otrng_global_state_forging_key_write_to,
+    otrng_global_state_private_key_v3_write_to,
+    otrng_global_state_client_profile_write_to,
+    otrng_global_state_expired_client_profile_write_to,
+    otrng_global_state_prekey_profile_write_to,
+    otrng_global_state_expired_prekey_profile_write_to,
+    otrng_global_state_prekey_messages_write_to,
+    otrng_global_state_fingerprints_v4_write_to,
+};
+
+static int section_index(otrng_client_section section) {
+  int i;
+
+  for (i = 0; i < OTRNG_SECTION_COUNT; i++) {
+    if ((unsigned int)section == 1u << i) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+static void call_store_callback(otrng_client_s *client,
+                                otrng_client_section section) {
+  const otrng_client_callbacks_s *cb = client->global_state->callbacks;
+
+  switch (section) {
+  case OTRNG_SECTION_PRIVKEY_V4:
+    cb->store_privkey_v4(client);
+    break;
+  case OTRNG_SECTION_FORGING_KEY:
+    cb->store_forging_key(client);
+    break;
+  case OTRNG_SECTION_PRIVKEY_V3:
+    cb->store_privkey_v3(client);
+    break;
+  case OTRNG_SECTION_CLIENT_PROFILE:
+    cb->store_client_profile(client);
+    break;
+  case OTRNG_SECTION_EXPIRED_CLIENT_PROFILE:
+    cb->store_expired_client_profile(client);
+    break;
+  case OTRNG_SECTION_PREKEY_PROFILE:
+    cb->store_prekey_profile(client);
+    break;
+  case OTRNG_SECTION_EXPIRED_PREKEY_PROFILE:
+    cb->store_expired_prekey_profile(client);
+    break;
+  case OTRNG_SECTION_PREKEY_MESSAGES:
+    cb->store_prekey_messages(client);
+    break;
+  case OTRNG_SECTION_FINGERPRINTS_V4:
+    cb->store_fingerprints_v4(client);
+    break;
+  default:
+    break;
+  }
+}
+
+INTERNAL otrng_bool otrng_client_is_dirty(const otrng_client_s *client,
+                                          otrng_client_section section) {
+  return (client->dirty_sections & (unsigned int)section) != 0;
+}
+
+INTERNAL void otrng_client_store_section(otrng_client_s *client,
+                                         otrng_client_section section) {
+  otrng_write_back_s *wb = client->global_state->write_back;
+
+  otrng_global_state_lock(client->global_state);
+
+  if (!wb) {
+    call_store_callback(client, section);
+    otrng_global_state_unlock(client->global_state);
+    return;
+  }
+
+  client->dirty_sections |= (unsigned int)section;
+
+  if (!wb->pending) {
+    wb->pending = otrng_true;
+    (void)clock_gettime(CLOCK_MONOTONIC, &wb->pending_since);
+  }
+
+  otrng_global_state_unlock(client->global_state);
+}
+
+tstatic otrng_bool write_back_due(const otrng_write_back_s *wb,
+                                  const struct timespec *now) {
+  long long elapsed_ms =
+      (long long)(now->tv_sec - wb->pending_since.tv_sec) * 1000 +
+      (now->tv_nsec - wb->pending_since.tv_nsec) / 1000000;
+
+  return elapsed_ms >= (long long)wb->delay_ms;
+}
+
+INTERNAL void otrng_write_back_free(otrng_write_back_s *wb) {
+  int i;
+
+  if (!wb) {
+    return;
+  }
+
+  for (i = 0; i < OTRNG_SECTION_COUNT; i++) {
+    otrng_free(wb->filenames[i]);
+  }
+
+  otrng_free(wb);
+}
+
+API void otrng_global_state_set_write_back(otrng_global_state_s *gs,
+                                           otrng_bool enabled,
+                                           unsigned int delay_ms) {
+  assert(gs != NULL);
+
+  if (!enabled) {
+    if (gs->write_back) {
+      (void)otrng_global_state_write_back_flush(gs, otrng_true, NULL);
+      otrng_write_back_free(gs->write_back);
+      gs->write_back = NULL;
+    }
+    return;
+  }
+
+  if (!gs->write_back) {
+    gs->write_back = otrng_xmalloc_z(sizeof(otrng_write_back_s));
+  }
+
+  gs->write_back->delay_ms = delay_ms;
+}
+
+API void otrng_global_state_set_write_back_file(otrng_global_state_s *gs,
+                                                otrng_client_section section,
+                                                const char *filename) {
+  int i = section_index(section);
+
+  assert(gs != NULL);
+
+  if (!gs->write_back || i < 0) {
+    return;
+  }
+
+  otrng_free(gs->write_back->filenames[i]);
+  gs->write_back->filenames[i] = filename ? otrng_xstrdup(filename) : NULL;
+}
+
+/* Writes the section for all clients to a temporary file, and moves it in
+   place of [filename] */
+static otrng_result write_section_file(const otrng_global_state_s *gs,
+                                       section_writer writer,
+                                       const char *filename, size_t *written) {
+  size_t len = strlen(filename) + strlen(".tmp") + 1;
+  char *tmp = otrng_xmalloc(len);
+  otrng_result result;
+  long size;
+  FILE *f;
+
+  snprintf(tmp, len, "%s.tmp", filename);
+
+  f = fopen(tmp, "w");
+  if (!f) {
+    otrng_free(tmp);
+    return OTRNG_ERROR;
+  }
+
+  result = writer(gs, f);
+  size = ftell(f);
+  if (size < 0 || fflush(f) != 0 || fsync(fileno(f)) != 0) {
+    result = OTRNG_ERROR;
+  }
+
+  if (fclose(f) != 0) {
+    result = OTRNG_ERROR;
+  }
+
+  if (otrng_succeeded(result) && rename(tmp, filename) != 0) {
+    result = OTRNG_ERROR;
+  }
+
+  if (otrng_succeeded(result)) {
+    *written = (size_t)size;
+  } else {
+    (void)remove(tmp);
+  }
+
+  otrng_free(tmp);
+  return result;
+}
+
+typedef struct dirty_context_s {
+  unsigned int sections;
+  unsigned int clients;
+} dirty_context_s;
+
+static void collect_dirty(list_element_s *node, void *context) {
+  const otrng_client_s *client = node->data;
+  dirty_context_s *ctx = context;
+
+  if (client->dirty_sections) {
+    ctx->sections |= client->dirty_sections;
+    ctx->clients++;
+  }
+}
+
+API otrng_result otrng_global_state_write_back_flush(
+    otrng_global_state_s *gs, otrng_bool force,
+    otrng_write_back_stats_s *stats) {
+  otrng_write_back_s *wb;
+  otrng_write_back_stats_s result_stats;
+  otrng_result result = OTRNG_SUCCESS;
+  dirty_context_s dirty;
+  struct timespec now;
+  list_element_s *current;
+  int i;
+
+  assert(gs != NULL);
+
+  memset(&result_stats, 0, sizeof(result_stats));
+  if (stats) {
+    *stats = result_stats;
+  }
+
+  wb = gs->write_back;
+  if (!wb) {
+    return OTRNG_ERROR;
+  }
+
+  if (!wb->pending) {
+    return OTRNG_SUCCESS;
+  }
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  if (!force && !write_back_due(wb, &now)) {
+    return OTRNG_SUCCESS;
+  }
+
+  memset(&dirty, 0, sizeof(dirty));
+  otrng_list_foreach(gs->clients, collect_dirty, &dirty);
+  result_stats.clients = dirty.clients;
+
+  for (i = 0; i < OTRNG_SECTION_COUNT; i++) {
+    unsigned int section = 1u << i;
+    size_t written = 0;
+
+    if (!(dirty.sections & section)) {
+      continue;
+    }
+
+    if (wb->filenames[i]) {
+      /* One write covers the section of every client */
+      if (otrng_failed(write_section_file(gs, section_writers[i],
+                                          wb->filenames[i], &written))) {
+        result = OTRNG_ERROR;
+        continue;
+      }
+
+      for (current = gs->clients; current; current = current->next) {
+        otrng_client_s *client = current->data;
+        client->dirty_sections &= ~section;
+      }
+      result_stats.bytes_written += written;
+    } else {
+      for (current = gs->clients; current; current = current->next) {
+        otrng_client_s *client = current->data;
+        if (client->dirty_sections & section) {
+          client->dirty_sections &= ~section;
+          call_store_callback(client, (otrng_client_section)section);
+          result_stats.callbacks++;
+        }
+      }
+    }
+
+    result_stats.sections++;
+  }
+
+  /* Sections that failed stay dirty for the next flush */
+  memset(&dirty, 0, sizeof(dirty));
+  otrng_list_foreach(gs->clients, collect_dirty, &dirty);
+  wb->pending = dirty.clients > 0;
+  if (wb->pending) {
+    wb->pending_since = now;
+  }
+
+  if (stats) {
+    *stats = result_stats;
+  }
+
+  return result;
+}
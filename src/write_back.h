@@ -0,0 +1,125 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2018, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A write-back layer for the persisted client state.
+ *
+ * Without it, every change to a key, profile, prekey message or fingerprint
+ * calls the matching store callback right away, and the callbacks usually
+ * rewrite the whole collection for every client. With it, a change only marks
+ * that section of the client as dirty. A flush then stores each dirty section
+ * once, however many times it changed since the previous flush.
+ *
+ * A section can be given a file, in which case the flush writes that section
+ * for all clients to the file (through a temporary file and a rename) and
+ * reports how many bytes it wrote. Sections without a file are stored through
+ * their callbacks, once per dirty client.
+ *
+ * otrng_poll flushes once the oldest change is older than the configured
+ * delay, so a burst of changes is written together.
+ */
+
+#ifndef OTRNG_WRITE_BACK_H
+#define OTRNG_WRITE_BACK_H
+
+#include <time.h>
+
+#include "messaging.h"
+#include "shared.h"
+
+typedef enum {
+  OTRNG_SECTION_PRIVKEY_V4 = 1 << 0,
+  OTRNG_SECTION_FORGING_KEY = 1 << 1,
+  OTRNG_SECTION_PRIVKEY_V3 = 1 << 2,
+  OTRNG_SECTION_CLIENT_PROFILE = 1 << 3,
+  OTRNG_SECTION_EXPIRED_CLIENT_PROFILE = 1 << 4,
+  OTRNG_SECTION_PREKEY_PROFILE = 1 << 5,
+  OTRNG_SECTION_EXPIRED_PREKEY_PROFILE = 1 << 6,
+  OTRNG_SECTION_PREKEY_MESSAGES = 1 << 7,
+  OTRNG_SECTION_FINGERPRINTS_V4 = 1 << 8,
+} otrng_client_section;
+
+#define OTRNG_SECTION_COUNT 9
+
+typedef struct otrng_write_back_stats_s {
+  unsigned int clients;  /* clients that had dirty sections */
+  unsigned int sections; /* sections that were written */
+  unsigned int callbacks;
+  size_t bytes_written; /* bytes written to section files */
+} otrng_write_back_stats_s;
+
+typedef struct otrng_write_back_s {
+  unsigned int delay_ms;
+  /*@null@*/ char *filenames[OTRNG_SECTION_COUNT];
+
+  /* When the oldest unflushed change was made */
+  otrng_bool pending;
+  struct timespec pending_since;
+} otrng_write_back_s;
+
+/**
+ * @brief Turns the write-back layer on, or off if [enabled] is false.
+ *    Turning it off flushes everything that is dirty.
+ *
+ * @param [delay_ms] How long otrng_poll waits after the first change before
+ *    flushing.
+ */
+API void otrng_global_state_set_write_back(otrng_global_state_s *gs,
+                                           otrng_bool enabled,
+                                           unsigned int delay_ms);
+
+/**
+ * @brief Writes [section] for all clients to [filename] when it is flushed,
+ *    instead of calling the store callback. NULL goes back to the callback.
+ */
+API void otrng_global_state_set_write_back_file(otrng_global_state_s *gs,
+                                                otrng_client_section section,
+                                                /*@null@*/ const char *filename);
+
+/**
+ * @brief Stores the dirty sections of all clients.
+ *
+ * @param [force] Flush even if the delay has not passed yet.
+ * @param [stats] Filled with what the flush did. Can be NULL.
+ */
+API otrng_result otrng_global_state_write_back_flush(
+    otrng_global_state_s *gs, otrng_bool force,
+    /*@null@*/ otrng_write_back_stats_s *stats);
+
+/**
+ * @brief Stores [section] of [client], or only marks it as dirty if the
+ *    write-back layer is on.
+ */
+INTERNAL void otrng_client_store_section(otrng_client_s *client,
+                                         otrng_client_section section);
+
+INTERNAL otrng_bool otrng_client_is_dirty(const otrng_client_s *client,
+                                          otrng_client_section section);
+
+INTERNAL void otrng_write_back_free(/*@only@*/ /*@null@*/ otrng_write_back_s *wb);
+
+#ifdef OTRNG_WRITE_BACK_PRIVATE
+
+tstatic otrng_bool write_back_due(const otrng_write_back_s *wb,
+                                  const struct timespec *now);
+
+#endif
+
+#endif